@@ -0,0 +1,98 @@
+/*
+ * codegen_bench.c - Compile-Time Benchmark
+ *
+ * Generates a synthetic program of N top-level forms (100000 by default)
+ * and times compiling it with the MASM and C backends.  Every form brings
+ * its own names and literals, so the compiler's string, symbol and label
+ * tables grow with the program.
+ *
+ * Usage: codegen_bench [forms] [output-directory]
+ */
+
+#include "codegen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Growable source text */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Source;
+
+static void append(Source *src, const char *format, int i) {
+    char line[256];
+    int n = snprintf(line, sizeof(line), format, i, i, i, i, i, i);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(line)) n = (int)sizeof(line) - 1;
+
+    if (src->length + (size_t)n + 1 > src->capacity) {
+        src->capacity = src->capacity ? src->capacity * 2 : 1 << 20;
+        src->data = (char *)realloc(src->data, src->capacity);
+        if (!src->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(src->data + src->length, line, (size_t)n);
+    src->length += (size_t)n;
+    src->data[src->length] = '\0';
+}
+
+/* One of several kinds of form for each i: procedures with conditionals
+ * and calls, constants, quoted lists and top-level effects */
+static char *generate_program(int forms) {
+    static const char *const kinds[] = {
+        "(define (f%d x) (if (< x %d) (g%d x \"literal %d\") 'sym%d))\n",
+        "(define (g%d x s) (begin (display s) (+ x %d)))\n",
+        "(define v%d '(a%d %d \"quoted %d\" (b%d c)))\n",
+        "(define n%d %d)\n",
+        "(display \"form %d\")\n",
+        "(set! n%d (f%d %d))\n",
+    };
+    int kind_count = (int)(sizeof(kinds) / sizeof(kinds[0]));
+
+    Source src = {NULL, 0, 0};
+    for (int i = 0; i < forms; i++) {
+        /* Keep every name a later form refers to defined before it */
+        int base = i - i % kind_count;
+        const char *kind = kinds[i % kind_count];
+        append(&src, kind, base);
+    }
+    return src.data ? src.data : strdup("");
+}
+
+static double seconds_since(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv) {
+    int forms = argc > 1 ? atoi(argv[1]) : 100000;
+    const char *directory = argc > 2 ? argv[2] : ".";
+    if (forms <= 0) {
+        fprintf(stderr, "Usage: %s [forms] [output-directory]\n", argv[0]);
+        return 1;
+    }
+
+    char *source = generate_program(forms);
+    printf("Synthetic program: %d forms, %lu bytes\n",
+           forms, (unsigned long)strlen(source));
+
+    char path[1024];
+    int failed = 0;
+
+    snprintf(path, sizeof(path), "%s/codegen_bench.asm", directory);
+    clock_t start = clock();
+    failed |= compile_string(source, path);
+    printf("MASM backend: %.3f s\n", seconds_since(start));
+
+    snprintf(path, sizeof(path), "%s/codegen_bench_c.c", directory);
+    start = clock();
+    failed |= compile_string_c(source, path, "codegen_bench");
+    printf("C backend:    %.3f s\n", seconds_since(start));
+
+    free(source);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * fasl_bench.c - Startup Benchmark for the fasl Cache
+ *
+ * Writes a synthetic application of many source files (200 files of
+ * 500 forms by default) and times reading all of it three ways: lexing
+ * and parsing each file in turn, as without a cache; a cold start,
+ * where every cache is missing, the files are parsed on a thread pool
+ * and the caches written; and a warm start, where every cache is mapped
+ * and fixed up.
+ *
+ * Usage: fasl_bench [files] [forms-per-file] [directory]
+ */
+
+#include "fasl.h"
+#include "lexer.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Several kinds of form, each with its own names and literals */
+static size_t write_source(const char *path, int file, int forms) {
+    static const char *const kinds[] = {
+        "(define (f%d-%d x)\n  (if (< x %d)\n      (g%d-%d x \"literal %d\")\n      'sym%d))\n",
+        "(define (g%d-%d x s)\n  (begin (display s) (+ x %d.5)))\n",
+        "(define v%d-%d '(a%d %d \"quoted %d\" (b%d . #\\c) #t))\n",
+        "(define n%d-%d `(1 ,(+ %d %d) ,@(list %d %d)))\n",
+    };
+    int kind_count = (int)(sizeof(kinds) / sizeof(kinds[0]));
+
+    FILE *out = fopen(path, "w");
+    if (!out) return 0;
+    fprintf(out, "; Synthetic source file %d\n", file);
+    for (int i = 0; i < forms; i++) {
+        fprintf(out, kinds[i % kind_count], file, i, i, file, i, i, i);
+    }
+    size_t size = (size_t)ftell(out);
+    fclose(out);
+    return size;
+}
+
+static char *read_text(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = (char *)malloc((size_t)size + 1);
+    if (text) {
+        text[fread(text, 1, (size_t)size, file)] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+static LispObject *parse_file(const char *path) {
+    char *source = read_text(path);
+    if (!source) return NULL;
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+    Parser parser;
+    parser_init(&parser, &lexer);
+    LispObject *program = parse_program(&parser);
+    if (parser_had_error(&parser)) program = NULL;
+
+    free(source);
+    return program;
+}
+
+int main(int argc, char **argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 200;
+    int forms = argc > 2 ? atoi(argv[2]) : 500;
+    const char *directory = argc > 3 ? argv[3] : ".";
+    if (files <= 0 || forms <= 0) {
+        fprintf(stderr, "Usage: %s [files] [forms-per-file] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    char **paths = (char **)calloc((size_t)files, sizeof(char *));
+    LispObject **programs = (LispObject **)calloc((size_t)files, sizeof(LispObject *));
+    if (!paths || !programs) return 1;
+
+    size_t total = 0;
+    char path[1024];
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/fasl_bench_%d.scm", directory, i);
+        paths[i] = strdup(path);
+        total += write_source(paths[i], i, forms);
+
+        /* Start cold */
+        char cache[1024];
+        if (fasl_cache_path(paths[i], cache, sizeof(cache))) remove(cache);
+    }
+    printf("Sources: %d files, %d forms each, %lu bytes\n",
+           files, forms, (unsigned long)total);
+
+    int failed = 0;
+
+    /* Without a cache */
+    lisp_init();
+    double start = now();
+    for (int i = 0; i < files; i++) {
+        failed |= parse_file(paths[i]) == NULL;
+    }
+    printf("Parse, no cache: %.3f s\n", now() - start);
+    lisp_shutdown();
+
+    /* Cold: no cache exists yet */
+    lisp_init();
+    start = now();
+    int loaded = fasl_load_files((const char *const *)paths, files, programs, 0);
+    printf("Cold start:      %.3f s (parsed in parallel, caches written)\n", now() - start);
+    failed |= loaded != files;
+    lisp_shutdown();
+    fasl_release();
+
+    /* Warm: every cache is up to date */
+    lisp_init();
+    start = now();
+    loaded = fasl_load_files((const char *const *)paths, files, programs, 0);
+    printf("Warm start:      %.3f s (caches mapped)\n", now() - start);
+    failed |= loaded != files;
+
+    /* The cached forms are the parsed forms */
+    for (int i = 0; i < files && !failed; i += files > 10 ? files / 10 : 1) {
+        LispObject *parsed = parse_file(paths[i]);
+        if (!programs[i] || !lisp_equal(parsed, programs[i])) {
+            fprintf(stderr, "Cached forms of %s differ from the source\n", paths[i]);
+            failed = 1;
+        }
+    }
+    lisp_shutdown();
+    fasl_release();
+
+    for (int i = 0; i < files; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(programs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * interp_bench.c - Interpreter Benchmark Suite
+ *
+ * Runs the programs in bench/scheme (fib, tak, nqueens, deriv,
+ * destruct, string building, hash table churn, vector sort, number
+ * printing and reading, log parsing and numeric vectors) in the
+ * interpreter.  Each file defines (run), the benchmark, and expected,
+ * what it must return.  A benchmark is loaded into a fresh heap, run a
+ * few times to warm up, then timed over a number of repetitions; the
+ * report gives the median and 95th percentile time of a run and the
+ * objects it allocates.
+ *
+ * With --baseline, the results are compared with a stored baseline: a
+ * median slower than the baseline by more than the tolerance, or any
+ * increase in allocations, is a regression and the exit status is 1.
+ * --write-baseline stores this run's results as a new baseline.
+ *
+ * Usage: interp_bench [--reps N] [--warmup N] [--only NAME]
+ *                     [--baseline FILE] [--write-baseline FILE]
+ *                     [--tolerance PERCENT] directory
+ */
+
+#include "env.h"
+#include "eval.h"
+#include "primitives.h"
+#include "reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const benchmarks[] = {
+    "fib", "tak", "nqueens", "deriv", "destruct", "string", "hashtable", "vsort",
+    "flonum", "logparse", "numeric",
+};
+
+#define BENCHMARK_COUNT ((int)(sizeof(benchmarks) / sizeof(benchmarks[0])))
+
+typedef struct {
+    int ok;              /* Loaded, and every run returned expected */
+    double median_ms;
+    double p95_ms;
+    long allocations;    /* Objects allocated by one run */
+} Result;
+
+typedef struct {
+    int present;
+    double median_ms;
+    long allocations;
+} Baseline;
+
+static double now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Objects allocated since startup: those freed plus those live */
+static long allocated(void) {
+    int freed, current;
+    gc_stats(NULL, &freed, &current);
+    return (long)freed + current;
+}
+
+/* Evaluate a file's forms into global; returns 0 on success */
+static int load_file(const char *path, Environment *global) {
+    Reader reader;
+    if (!reader_open(&reader, path)) {
+        fprintf(stderr, "Error: Cannot open file '%s'\n", path);
+        return 1;
+    }
+
+    LispObject *expr = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, &expr, 1);
+    int status;
+    while ((status = reader_next(&reader, &expr)) > 0) {
+        eval(expr, global);
+    }
+    gc_pop_frame(&frame);
+
+    if (status < 0) {
+        fprintf(stderr, "%s: parse error: %s\n", path, reader_error_message(&reader));
+    }
+    reader_close(&reader);
+    return status < 0 || lisp_had_error();
+}
+
+static Result run_benchmark(const char *directory, const char *name,
+                            int warmup, int reps) {
+    Result result = { 0, 0.0, 0.0, 0 };
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.scm", directory, name);
+
+    lisp_init();
+    eval_reset_depth();
+    lisp_clear_error();
+    Environment *global = env_create_global();
+    register_primitives(global);
+    gc_add_env_root(global);
+
+    double *times = (double *)malloc((size_t)reps * sizeof(double));
+    LispObject *run = NULL;
+    LispObject *expected = NULL;
+    if (!times || load_file(path, global) != 0) goto done;
+
+    run = env_lookup(global, make_symbol("run"));
+    expected = env_lookup(global, make_symbol("expected"));
+    if (!run || !expected) {
+        fprintf(stderr, "%s: does not define run and expected\n", path);
+        goto done;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < warmup + reps && ok; i++) {
+        long before = allocated();
+        double start = now_ms();
+        LispObject *value = apply(run, make_nil(), global);
+        double elapsed = now_ms() - start;
+
+        if (lisp_had_error() || !lisp_equal(value, expected)) {
+            printf("%s: (run) did not return expected: ", name);
+            lisp_print(value);
+            printf("\n");
+            ok = 0;
+        } else if (i >= warmup) {
+            times[i - warmup] = elapsed;
+            result.allocations = allocated() - before;
+        }
+    }
+    if (!ok) goto done;
+
+    qsort(times, (size_t)reps, sizeof(double), compare_doubles);
+    result.median_ms = reps % 2 ? times[reps / 2]
+                                : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+    int p95 = (reps * 95 + 99) / 100 - 1;
+    result.p95_ms = times[p95 < 0 ? 0 : p95];
+    result.ok = 1;
+
+done:
+    free(times);
+    gc_remove_env_root(global);
+    env_free(global);
+    lisp_shutdown();
+    return result;
+}
+
+/* Read a baseline written by write_baseline: one benchmark per line */
+static int read_baseline(const char *path, Baseline *baseline) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open baseline '%s'\n", path);
+        return 1;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char key[64];
+        if (sscanf(line, " \"%63[^\"]\"", key) != 1) continue;
+        const char *median = strstr(line, "\"median_ms\":");
+        const char *allocations = strstr(line, "\"allocations\":");
+        if (!median || !allocations) continue;
+
+        for (int i = 0; i < BENCHMARK_COUNT; i++) {
+            if (strcmp(key, benchmarks[i]) == 0) {
+                baseline[i].present = 1;
+                baseline[i].median_ms = strtod(median + strlen("\"median_ms\":"), NULL);
+                baseline[i].allocations = strtol(allocations + strlen("\"allocations\":"),
+                                                 NULL, 10);
+            }
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int write_baseline(const char *path, const Result *results,
+                          const int *selected, int reps) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot write baseline '%s'\n", path);
+        return 1;
+    }
+
+    fprintf(file, "{\n  \"reps\": %d,\n  \"benchmarks\": {\n", reps);
+    int first = 1;
+    for (int i = 0; i < BENCHMARK_COUNT; i++) {
+        if (!selected[i] || !results[i].ok) continue;
+        fprintf(file, "%s    \"%s\": {\"median_ms\": %.3f, \"p95_ms\": %.3f, \"allocations\": %ld}",
+                first ? "" : ",\n", benchmarks[i], results[i].median_ms,
+                results[i].p95_ms, results[i].allocations);
+        first = 0;
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--reps N] [--warmup N] [--only NAME] [--baseline FILE]\n"
+            "       [--write-baseline FILE] [--tolerance PERCENT] directory\n",
+            program);
+}
+
+int main(int argc, char **argv) {
+    int reps = 10;
+    int warmup = 2;
+    double tolerance = 10.0;
+    const char *only = NULL;
+    const char *baseline_path = NULL;
+    const char *write_path = NULL;
+    const char *directory = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int has_value = i + 1 < argc;
+        if (strcmp(arg, "--reps") == 0 && has_value) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(arg, "--warmup") == 0 && has_value) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(arg, "--only") == 0 && has_value) {
+            only = argv[++i];
+        } else if (strcmp(arg, "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (strcmp(arg, "--write-baseline") == 0 && has_value) {
+            write_path = argv[++i];
+        } else if (strcmp(arg, "--tolerance") == 0 && has_value) {
+            tolerance = atof(argv[++i]);
+        } else if (arg[0] != '-' && !directory) {
+            directory = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!directory || reps <= 0 || warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Baseline baseline[BENCHMARK_COUNT];
+    memset(baseline, 0, sizeof(baseline));
+    if (baseline_path && read_baseline(baseline_path, baseline) != 0) {
+        return 1;
+    }
+
+    Result results[BENCHMARK_COUNT];
+    int selected[BENCHMARK_COUNT];
+    int failed = 0;
+    int regressions = 0;
+
+    printf("%d runs after %d warmup runs; times in ms\n\n", reps, warmup);
+    printf("%-10s %10s %10s %12s", "Benchmark", "Median", "p95", "Allocations");
+    if (baseline_path) printf(" %10s %8s", "Baseline", "Change");
+    printf("\n");
+
+    for (int i = 0; i < BENCHMARK_COUNT; i++) {
+        selected[i] = !only || strcmp(only, benchmarks[i]) == 0;
+        if (!selected[i]) continue;
+
+        fflush(stdout);
+        results[i] = run_benchmark(directory, benchmarks[i], warmup, reps);
+        if (!results[i].ok) {
+            printf("%-10s %10s\n", benchmarks[i], "FAILED");
+            failed = 1;
+            continue;
+        }
+
+        printf("%-10s %10.3f %10.3f %12ld", benchmarks[i], results[i].median_ms,
+               results[i].p95_ms, results[i].allocations);
+        if (baseline_path && baseline[i].present) {
+            double change = baseline[i].median_ms > 0
+                ? (results[i].median_ms / baseline[i].median_ms - 1) * 100 : 0;
+            printf(" %10.3f %+7.1f%%", baseline[i].median_ms, change);
+            if (change > tolerance) {
+                printf("  slower");
+                regressions = 1;
+            }
+            if (results[i].allocations > baseline[i].allocations) {
+                printf("  allocations up from %ld", baseline[i].allocations);
+                regressions = 1;
+            }
+        } else if (baseline_path) {
+            printf(" %10s", "-");
+        }
+        printf("\n");
+    }
+
+    if (regressions) {
+        printf("\nRegressions against %s (tolerance %.1f%%)\n", baseline_path, tolerance);
+    }
+    if (write_path && !failed) {
+        if (write_baseline(write_path, results, selected, reps) != 0) return 1;
+        printf("\nBaseline written to %s\n", write_path);
+    }
+
+    return failed || regressions;
+}
@@ -0,0 +1,35 @@
+; deriv.scm - Symbolic differentiation: map over quoted lists and
+; allocation of the result trees
+
+(define (deriv a)
+  (cond ((not (pair? a))
+         (if (eq? a 'x) 1 0))
+        ((eq? (car a) '+)
+         (cons '+ (map deriv (cdr a))))
+        ((eq? (car a) '-)
+         (cons '- (map deriv (cdr a))))
+        ((eq? (car a) '*)
+         (list '*
+               a
+               (cons '+ (map (lambda (a) (list '/ (deriv a) a)) (cdr a)))))
+        ((eq? (car a) '/)
+         (list '-
+               (list '/ (deriv (car (cdr a))) (car (cdr (cdr a))))
+               (list '/
+                     (car (cdr a))
+                     (list '*
+                           (car (cdr (cdr a)))
+                           (car (cdr (cdr a)))
+                           (deriv (car (cdr (cdr a))))))))
+        (else (error "No derivation method available" (car a)))))
+
+(define (run)
+  (do ((i 0 (+ i 1))
+       (result '() (deriv '(+ (* 3 x x) (* a x x) (* b x) 5))))
+      ((= i 2000) result)))
+
+(define expected
+  '(+ (* (* 3 x x) (+ (/ 0 3) (/ 1 x) (/ 1 x)))
+      (* (* a x x) (+ (/ 0 a) (/ 1 x) (/ 1 x)))
+      (* (* b x) (+ (/ 0 b) (/ 1 x)))
+      0))
@@ -0,0 +1,35 @@
+; destruct.scm - Gabriel's destruct: repeated destructive updates of a
+; structure of mutable sequences.  The original splices lists with
+; set-car! and set-cdr!; here the same passes rewrite a vector of
+; vectors in place.
+
+(define (make-rows count width)
+  (let ((rows (make-vector count #f)))
+    (do ((i 0 (+ i 1)))
+        ((= i count) rows)
+      (vector-set! rows i (make-vector width 0)))))
+
+(define (destructive n m)
+  (let ((rows (make-rows 10 m)))
+    (do ((i n (- i 1)))
+        ((= i 0) rows)
+      (do ((j 0 (+ j 1)))
+          ((= j 10))
+        (let ((row (vector-ref rows j))
+              (from (vector-ref rows (modulo (+ j 1) 10)))
+              (half (quotient m 2)))
+          ;; First half from the next row, second half stamped with i
+          (do ((k 0 (+ k 1)))
+              ((= k m))
+            (vector-set! row k
+                         (if (< k half)
+                             (vector-ref from (+ k half))
+                             i))))))))
+
+(define (run)
+  (let ((rows (destructive 120 40)))
+    (list (vector-ref (vector-ref rows 0) 0)
+          (vector-ref (vector-ref rows 9) 39)
+          (vector-length rows))))
+
+(define expected '(2 1 10))
@@ -0,0 +1,10 @@
+; fib.scm - Doubly recursive Fibonacci: procedure calls and arithmetic
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (run) (fib 20))
+
+(define expected 6765)
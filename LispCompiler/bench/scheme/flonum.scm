@@ -0,0 +1,12 @@
+; flonum.scm - Writing and reading floating-point numbers: number->string
+; and string->number on fractions, which must read back equal
+
+(define (round-trips? x)
+  (= (string->number (number->string x)) x))
+
+(define (run)
+  (do ((i 1 (+ i 1))
+       (count 0 (if (round-trips? (/ i 7.3)) (+ count 1) count)))
+      ((> i 20000) count)))
+
+(define expected 20000)
@@ -0,0 +1,27 @@
+; hashtable.scm - Hash table churn: inserts, lookups and deletes with
+; number and string keys
+
+(define (churn-numbers n)
+  (let ((table (make-eqv-hashtable)))
+    (do ((i 0 (+ i 1)))
+        ((= i n))
+      (hashtable-set! table i (* i i)))
+    (do ((i 0 (+ i 2)))
+        ((>= i n))
+      (hashtable-delete! table i))
+    (do ((i 0 (+ i 1))
+         (sum 0 (+ sum (hashtable-ref table i 0))))
+        ((= i n) (list (hashtable-size table) sum)))))
+
+(define (churn-strings n)
+  (let ((table (make-hashtable)))
+    (do ((i 0 (+ i 1)))
+        ((= i n))
+      (let ((key (number->string (modulo i 500))))
+        (hashtable-set! table key (+ 1 (hashtable-ref table key 0)))))
+    (list (hashtable-size table) (hashtable-ref table "42" 0))))
+
+(define (run)
+  (append (churn-numbers 4000) (churn-strings 4000)))
+
+(define expected '(2000 10666666000 500 8))
@@ -0,0 +1,36 @@
+; logparse.scm - Log parsing: split a log into lines and fields, search
+; the lines, and compare and case-fold the fields
+
+(define levels '("INFO" "WARN" "ERROR" "DEBUG"))
+
+(define (make-log n)
+  (let loop ((i 0) (lines '()))
+    (if (= i n)
+        (string-join lines "\n")
+        (loop (+ i 1)
+              (cons (string-append "2026-10-18 12:" (number->string (modulo i 60))
+                                   " " (list-ref levels (modulo i 4))
+                                   " request " (number->string i)
+                                   " took " (number->string (modulo (* i 7) 300)) "ms"
+                                   (if (= (modulo i 5) 0) " (slow; retried)" ""))
+                    lines)))))
+
+(define log (make-log 400))
+
+(define (scan line counts)
+  (let ((fields (string-split line #\space)))
+    (list (+ (car counts) (if (string-ci=? (car (cdr (cdr fields))) "error") 1 0))
+          (+ (car (cdr counts)) (if (string-contains line "retried") 1 0))
+          (+ (car (cdr (cdr counts)))
+             (length (string-split (string-upcase line) "ST;"))))))
+
+(define (run)
+  (let loop ((round 0) (counts '(0 0 0)))
+    (if (= round 10)
+        counts
+        (loop (+ round 1)
+              (fold (lambda (line counts) (scan line counts))
+                    counts
+                    (string-split log #\newline))))))
+
+(define expected '(1000 800 22400))
@@ -0,0 +1,30 @@
+; nqueens.scm - Count the solutions of the 8 queens problem: list
+; building and short-lived conses
+
+(define (one-to n)
+  (let loop ((i n) (l '()))
+    (if (= i 0)
+        l
+        (loop (- i 1) (cons i l)))))
+
+(define (ok? row dist placed)
+  (if (null? placed)
+      #t
+      (and (not (= (car placed) (+ row dist)))
+           (not (= (car placed) (- row dist)))
+           (ok? row (+ dist 1) (cdr placed)))))
+
+(define (try-queens x y z)
+  (if (null? x)
+      (if (null? y) 1 0)
+      (+ (if (ok? (car x) 1 z)
+             (try-queens (append (cdr x) y) '() (cons (car x) z))
+             0)
+         (try-queens (cdr x) (cons (car x) y) z))))
+
+(define (queens n)
+  (try-queens (one-to n) '() '()))
+
+(define (run) (queens 8))
+
+(define expected 92)
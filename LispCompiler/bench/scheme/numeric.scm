@@ -0,0 +1,22 @@
+; numeric.scm - Numeric vectors: filling an f64vector element by element,
+; then the bulk operations over it (scale, add, dot, sum, min and max)
+
+(define n 100000)
+
+(define (ramp n)
+  (let ((v (make-f64vector n)))
+    (do ((i 0 (+ i 1)))
+        ((= i n) v)
+      (f64vector-set! v i (* i 0.5)))))
+
+(define (run)
+  (let* ((a (ramp n))
+         (b (numvector-scale a 2))
+         (total (make-f64vector n 0)))
+    (do ((k 0 (+ k 1)))
+        ((= k 100))
+      (numvector-add! total b))
+    (list (numvector-dot a b) (numvector-sum total)
+          (numvector-min total) (numvector-max total))))
+
+(define expected '(166664166675000 499995000000 0 9999900))
@@ -0,0 +1,20 @@
+; string.scm - String building: string-append loops, number->string and
+; substring
+
+(define (build-string n)
+  (let loop ((i 0) (s ""))
+    (if (= i n)
+        s
+        (loop (+ i 1) (string-append s (number->string (modulo i 10)))))))
+
+(define (run)
+  (let loop ((round 0) (total 0))
+    (if (= round 40)
+        total
+        (let ((s (build-string 300)))
+          (loop (+ round 1)
+                (+ total
+                   (string-length s)
+                   (string-length (substring s 100 200))))))))
+
+(define expected 16000)
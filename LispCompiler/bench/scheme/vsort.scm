@@ -0,0 +1,47 @@
+; vsort.scm - Sort a vector of pseudo-random numbers in place with
+; quicksort: vector-ref, vector-set! and numeric comparisons
+
+;; Park-Miller generator: products stay exact in a double
+(define (random-vector n seed)
+  (let ((v (make-vector n 0)))
+    (do ((i 0 (+ i 1))
+         (x seed (modulo (* x 16807) 2147483647)))
+        ((= i n) v)
+      (vector-set! v i (modulo x 100000)))))
+
+(define (swap! v i j)
+  (let ((t (vector-ref v i)))
+    (vector-set! v i (vector-ref v j))
+    (vector-set! v j t)))
+
+;; Lomuto partition of v[lo..hi] around v[hi]; returns the pivot's place
+(define (partition! v lo hi)
+  (let ((pivot (vector-ref v hi)))
+    (let loop ((i lo) (j lo))
+      (cond ((= j hi)
+             (swap! v i hi)
+             i)
+            ((< (vector-ref v j) pivot)
+             (swap! v i j)
+             (loop (+ i 1) (+ j 1)))
+            (else
+             (loop i (+ j 1)))))))
+
+(define (quicksort! v lo hi)
+  (if (< lo hi)
+      (let ((p (partition! v lo hi)))
+        (quicksort! v lo (- p 1))
+        (quicksort! v (+ p 1) hi))))
+
+(define (sorted? v)
+  (let loop ((i 1))
+    (cond ((>= i (vector-length v)) #t)
+          ((> (vector-ref v (- i 1)) (vector-ref v i)) #f)
+          (else (loop (+ i 1))))))
+
+(define (run)
+  (let ((v (random-vector 3000 42)))
+    (quicksort! v 0 (- (vector-length v) 1))
+    (list (sorted? v) (vector-ref v 0) (vector-ref v 2999))))
+
+(define expected '(#t 37 99993))
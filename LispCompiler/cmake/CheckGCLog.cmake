@@ -0,0 +1,37 @@
+# ==============================================================================
+# CheckGCLog.cmake - Check the GC telemetry of a program: what it prints
+# about (gc-statistics), and the JSON line lisp --gc-log writes for each
+# collection
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -DLOG=<out>
+#              -P CheckGCLog.cmake
+# ==============================================================================
+
+file(REMOVE ${LOG})
+execute_process(
+    COMMAND ${INTERPRETER} --gc-log=${LOG} ${SCRIPT}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0 OR NOT errors STREQUAL "")
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} (${result})\n${errors}")
+endif()
+
+set(expected "collected = #t\nlive objects = #t\nhistogram = #t\nvectors = #t\n")
+string(APPEND expected "top site = [^\n]*gc_stats\\.scm:9\n")
+if(NOT output MATCHES "^${expected}$")
+    message(FATAL_ERROR "Unexpected output from ${SCRIPT}:\n${output}")
+endif()
+
+if(NOT EXISTS ${LOG})
+    message(FATAL_ERROR "No GC log written to ${LOG}")
+endif()
+file(READ ${LOG} log)
+set(number "[0-9]+(\\.[0-9]+)?")
+set(line "{\"gc\":[0-9]+,\"before\":[0-9]+,\"after\":[0-9]+,\"freed\":[0-9]+,")
+string(APPEND line "\"survivor_rate\":${number},\"live_bytes\":[0-9]+,\"threshold\":[0-9]+,")
+string(APPEND line "\"mark_us\":${number},\"sweep_us\":${number},\"pause_us\":${number}}\n")
+if(NOT log MATCHES "^(${line})+$")
+    message(FATAL_ERROR "Malformed GC log:\n${log}")
+endif()
@@ -0,0 +1,36 @@
+# ==============================================================================
+# CheckProfile.cmake - Check that lisp --profile writes collapsed stacks
+# that show where a program spends its time, and a report on stderr
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -DFOLDED=<out>
+#              -P CheckProfile.cmake
+# ==============================================================================
+
+file(REMOVE ${FOLDED})
+execute_process(
+    COMMAND ${INTERPRETER} --profile=${FOLDED} ${SCRIPT}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE report
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} (${result})\n${report}")
+endif()
+if(NOT output MATCHES "fib\\(22\\) = 17711")
+    message(FATAL_ERROR "Unexpected output from ${SCRIPT}:\n${output}")
+endif()
+if(NOT report MATCHES "Profile: [0-9]+ samples\n *Self +Total +Procedure\n")
+    message(FATAL_ERROR "No profile report on stderr:\n${report}")
+endif()
+if(NOT EXISTS ${FOLDED})
+    message(FATAL_ERROR "No collapsed stacks written to ${FOLDED}")
+endif()
+
+# Every line is "frame;frame;... count", and the hot path is run-fib;fib
+file(READ ${FOLDED} folded)
+if(NOT folded MATCHES "^([^;\n]+(;[^;\n]+)* [0-9]+\n)+$")
+    message(FATAL_ERROR "Malformed collapsed stacks:\n${folded}")
+endif()
+if(NOT folded MATCHES "run-fib \\([^)]*profile_test\\.scm:12\\);fib \\([^)]*profile_test\\.scm:7\\) [0-9]+\n")
+    message(FATAL_ERROR "No samples in fib under run-fib:\n${folded}")
+endif()
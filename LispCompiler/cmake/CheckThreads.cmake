@@ -0,0 +1,29 @@
+# ==============================================================================
+# CheckThreads.cmake - Check a program that runs threads: what it prints,
+# and that the error of a failed thread is reported when it is joined
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -P CheckThreads.cmake
+# ==============================================================================
+
+execute_process(
+    COMMAND ${INTERPRETER} ${SCRIPT}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} (${result})\n${errors}")
+endif()
+
+set(expected "results = \\(41791750 42042751 42294755 42547764\\)\n")
+string(APPEND expected "total = 168677020\n")
+string(APPEND expected "names = \\(0 1 2 3\\)\n")
+string(APPEND expected "thread\\? = \\(#t #f #t\\)\n")
+string(APPEND expected "\ndone\n")
+if(NOT output MATCHES "^${expected}$")
+    message(FATAL_ERROR "Unexpected output from ${SCRIPT}:\n${output}")
+endif()
+
+if(NOT errors MATCHES "car: expected pair[^\n]*\n[^\n]*thread-join!: thread failed: [^\n]*car")
+    message(FATAL_ERROR "Thread error not reported by thread-join!:\n${errors}")
+endif()
@@ -0,0 +1,43 @@
+# ==============================================================================
+# CompareFasl.cmake - Check that a program run through its fasl cache
+# (lisp --fasl) prints exactly what it prints when read from source, both
+# when the cache is written and when it is loaded
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -DWORK_DIR=<dir>
+#              -P CompareFasl.cmake
+# ==============================================================================
+
+# Work on a copy, so the cache is not written into the source tree
+get_filename_component(name ${SCRIPT} NAME_WE)
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(COPY ${SCRIPT} DESTINATION ${WORK_DIR})
+file(REMOVE ${WORK_DIR}/${name}.fasl)
+set(copy ${WORK_DIR}/${name}.scm)
+
+execute_process(
+    COMMAND ${INTERPRETER} ${copy}
+    OUTPUT_VARIABLE expected
+    RESULT_VARIABLE source_result
+)
+if(NOT source_result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${copy} (${source_result})")
+endif()
+
+foreach(run cold warm)
+    execute_process(
+        COMMAND ${INTERPRETER} --fasl ${copy}
+        OUTPUT_VARIABLE actual
+        RESULT_VARIABLE fasl_result
+    )
+    if(NOT fasl_result EQUAL 0)
+        message(FATAL_ERROR "Interpreter failed on ${copy} with a ${run} cache (${fasl_result})")
+    endif()
+    if(NOT EXISTS ${WORK_DIR}/${name}.fasl)
+        message(FATAL_ERROR "No cache written for ${copy}")
+    endif()
+    if(NOT expected STREQUAL actual)
+        message(FATAL_ERROR "Output mismatch for ${copy} with a ${run} cache\n"
+                            "--- source ---\n${expected}\n"
+                            "--- fasl ---\n${actual}")
+    endif()
+endforeach()
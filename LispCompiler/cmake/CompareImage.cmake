@@ -0,0 +1,47 @@
+# ==============================================================================
+# CompareImage.cmake - Check that a program run from a heap image of its
+# library (lisp --image) prints exactly what it prints when the library
+# is evaluated first in the same interpreter
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DLIBRARY=<lib.scm> -DSCRIPT=<main.scm>
+#              -DWORK_DIR=<dir> -P CompareImage.cmake
+# ==============================================================================
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+set(image ${WORK_DIR}/image_test.img)
+file(REMOVE ${image})
+
+execute_process(
+    COMMAND ${INTERPRETER} ${LIBRARY} ${SCRIPT}
+    OUTPUT_VARIABLE expected
+    ERROR_VARIABLE expected_errors
+    RESULT_VARIABLE source_result
+)
+if(NOT source_result EQUAL 0 OR NOT expected_errors STREQUAL "")
+    message(FATAL_ERROR "Interpreter failed on ${LIBRARY} ${SCRIPT} (${source_result})\n"
+                        "${expected_errors}")
+endif()
+
+execute_process(
+    COMMAND ${INTERPRETER} --save-image ${image} ${LIBRARY}
+    RESULT_VARIABLE save_result
+)
+if(NOT save_result EQUAL 0 OR NOT EXISTS ${image})
+    message(FATAL_ERROR "Could not save an image of ${LIBRARY} (${save_result})")
+endif()
+
+execute_process(
+    COMMAND ${INTERPRETER} --image ${image} ${SCRIPT}
+    OUTPUT_VARIABLE actual
+    ERROR_VARIABLE actual_errors
+    RESULT_VARIABLE image_result
+)
+if(NOT image_result EQUAL 0 OR NOT actual_errors STREQUAL "")
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} from the image (${image_result})\n"
+                        "${actual_errors}")
+endif()
+if(NOT expected STREQUAL actual)
+    message(FATAL_ERROR "Output mismatch for ${SCRIPT} from an image\n"
+                        "--- source ---\n${expected}\n"
+                        "--- image ---\n${actual}")
+endif()
@@ -0,0 +1,30 @@
+# ==============================================================================
+# CompareOutputs.cmake - Check a compiled program against the interpreter
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -DCOMPILED=<exe>
+#              -P CompareOutputs.cmake
+# ==============================================================================
+
+execute_process(
+    COMMAND ${INTERPRETER} ${SCRIPT}
+    OUTPUT_VARIABLE expected
+    RESULT_VARIABLE interp_result
+)
+if(NOT interp_result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} (${interp_result})")
+endif()
+
+execute_process(
+    COMMAND ${COMPILED}
+    OUTPUT_VARIABLE actual
+    RESULT_VARIABLE compiled_result
+)
+if(NOT compiled_result EQUAL 0)
+    message(FATAL_ERROR "Compiled program ${COMPILED} failed (${compiled_result})")
+endif()
+
+if(NOT expected STREQUAL actual)
+    message(FATAL_ERROR "Output mismatch for ${SCRIPT}\n"
+                        "--- interpreter ---\n${expected}\n"
+                        "--- compiled ---\n${actual}")
+endif()
@@ -0,0 +1,31 @@
+# ==============================================================================
+# CompareStdin.cmake - Check that a program read from standard input
+# (lisp -) prints exactly what it prints when run as a file
+#
+# Usage: cmake -DINTERPRETER=<lisp> -DSCRIPT=<file.scm> -P CompareStdin.cmake
+# ==============================================================================
+
+execute_process(
+    COMMAND ${INTERPRETER} ${SCRIPT}
+    OUTPUT_VARIABLE expected
+    RESULT_VARIABLE file_result
+)
+if(NOT file_result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} (${file_result})")
+endif()
+
+execute_process(
+    COMMAND ${INTERPRETER} -
+    INPUT_FILE ${SCRIPT}
+    OUTPUT_VARIABLE actual
+    RESULT_VARIABLE stdin_result
+)
+if(NOT stdin_result EQUAL 0)
+    message(FATAL_ERROR "Interpreter failed on ${SCRIPT} from standard input (${stdin_result})")
+endif()
+
+if(NOT expected STREQUAL actual)
+    message(FATAL_ERROR "Output mismatch for ${SCRIPT}\n"
+                        "--- file ---\n${expected}\n"
+                        "--- standard input ---\n${actual}")
+endif()
@@ -7,6 +7,10 @@
  * Memory layout for Lisp objects:
  *   [type:8][gc:8][padding:16][data:varies]
  *
+ * Quoted data and string literals are laid out in the data section in
+ * this layout, with gc set to GC_MARK_STATIC; fields holding symbols or
+ * the nil/boolean singletons are filled in once by init_constants.
+ *
  * Result values are returned in RAX as pointers to Lisp objects.
  */
 
@@ -18,98 +22,437 @@
 #include <string.h>
 #include <stdarg.h>
 
+/* Runtime symbols the generated code may reference */
+static const struct {
+    const char *name;
+    const char *kind;
+} runtime_symbols[] = {
+    {"rt_nil",          "qword"},
+    {"rt_true",         "qword"},
+    {"rt_false",        "qword"},
+    {"rt_make_fixnum",  "proc"},
+    {"rt_make_float",   "proc"},
+    {"rt_make_string",  "proc"},
+    {"rt_make_symbol",  "proc"},
+    {"rt_make_closure", "proc"},
+    {"rt_cons",         "proc"},
+    {"rt_car",          "proc"},
+    {"rt_cdr",          "proc"},
+    {"rt_apply",        "proc"},
+    {"rt_env_lookup",   "proc"},
+    {"rt_env_define",   "proc"},
+    {"rt_env_set",      "proc"},
+    {"rt_init",         "proc"},
+    {"rt_shutdown",     "proc"},
+    {"rt_print",        "proc"},
+    {"rt_error",        "proc"},
+    {NULL, NULL}
+};
+
+static int is_label_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+/* Record the runtime symbols a line of assembly refers to */
+static void note_runtime_refs(CodegenContext *ctx, const char *line) {
+    for (const char *p = strstr(line, "rt_"); p; p = strstr(p + 1, "rt_")) {
+        if (p > line && is_label_char(p[-1])) continue;
+        for (int i = 0; runtime_symbols[i].name != NULL; i++) {
+            size_t len = strlen(runtime_symbols[i].name);
+            if (strncmp(p, runtime_symbols[i].name, len) == 0 &&
+                !is_label_char(p[len])) {
+                ctx->runtime_used |= 1u << i;
+                break;
+            }
+        }
+    }
+}
+
+/* Emitted text is buffered and written out in chunks of this size */
+#define CODEGEN_BUFFER_SIZE 65536
+
+/* Labels and names are carved out of chunks of this size */
+#define LABEL_CHUNK_SIZE 16384
+
+/* Write buffered output to the output file */
+void codegen_flush(CodegenContext *ctx) {
+    if (ctx->buffer_used > 0) {
+        fwrite(ctx->buffer, 1, ctx->buffer_used, ctx->output);
+        ctx->buffer_used = 0;
+    }
+}
+
+/* Make room for at least size more bytes in the output buffer */
+static int reserve_output(CodegenContext *ctx, size_t size) {
+    if (ctx->buffer_used + size <= ctx->buffer_capacity) return 1;
+
+    size_t capacity = ctx->buffer_capacity ? ctx->buffer_capacity : CODEGEN_BUFFER_SIZE;
+    while (capacity < ctx->buffer_used + size) {
+        capacity *= 2;
+    }
+    char *grown = (char *)realloc(ctx->buffer, capacity);
+    if (!grown) return 0;
+    ctx->buffer = grown;
+    ctx->buffer_capacity = capacity;
+    return 1;
+}
+
 /* Helper to emit a line of assembly */
 static void emit(CodegenContext *ctx, const char *format, ...) {
     va_list args;
+
+    if (!reserve_output(ctx, 256)) return;
+    size_t room = ctx->buffer_capacity - ctx->buffer_used;
+
+    va_start(args, format);
+    int length = vsnprintf(ctx->buffer + ctx->buffer_used, room, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if ((size_t)length + 1 >= room) {
+        if (!reserve_output(ctx, (size_t)length + 2)) return;
+        va_start(args, format);
+        vsnprintf(ctx->buffer + ctx->buffer_used, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+
+    char *line = ctx->buffer + ctx->buffer_used;
+    note_runtime_refs(ctx, line);
+    line[length] = '\n';
+    ctx->buffer_used += (size_t)length + 1;
+
+    if (ctx->buffer_used >= CODEGEN_BUFFER_SIZE) {
+        codegen_flush(ctx);
+    }
+}
+
+/* Copy formatted text into the label arena */
+static char *arena_format(CodegenContext *ctx, const char *format, ...) {
+    va_list args;
+
     va_start(args, format);
-    vfprintf(ctx->output, format, args);
-    fprintf(ctx->output, "\n");
+    int length = vsnprintf(NULL, 0, format, args);
     va_end(args);
+    if (length < 0) return NULL;
+
+    size_t size = (size_t)length + 1;
+    LabelChunk *chunk = ctx->arena;
+    if (!chunk || chunk->used + size > LABEL_CHUNK_SIZE) {
+        size_t capacity = size > LABEL_CHUNK_SIZE ? size : LABEL_CHUNK_SIZE;
+        chunk = (LabelChunk *)malloc(sizeof(LabelChunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->next = ctx->arena;
+        ctx->arena = chunk;
+    }
+
+    char *text = chunk->data + chunk->used;
+    va_start(args, format);
+    vsnprintf(text, size, format, args);
+    va_end(args);
+    chunk->used += size;
+    return text;
 }
 
-/* Generate a unique label */
+/* Generate a unique label (owned by the context) */
 static char *gen_label(CodegenContext *ctx, const char *prefix) {
-    char *label = (char *)malloc(64);
-    snprintf(label, 64, "%s_%d", prefix, ctx->label_counter++);
-    return label;
+    return arena_format(ctx, "%s_%d", prefix, ctx->label_counter++);
+}
+
+/* FNV-1a */
+static unsigned int hash_name(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+/* Slot for name: the one holding it, or the empty slot where it goes */
+static struct NameSlot *name_index_slot(NameIndex *index, const char *name,
+                                        unsigned int hash) {
+    size_t mask = index->size - 1;
+    size_t i = hash & mask;
+    while (index->slots[i].name) {
+        if (index->slots[i].hash == hash && strcmp(index->slots[i].name, name) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &index->slots[i];
+}
+
+static void *name_index_find(NameIndex *index, const char *name, unsigned int hash) {
+    if (index->size == 0) return NULL;
+    return name_index_slot(index, name, hash)->entry;
+}
+
+/* Add an entry whose name is not in the index yet */
+static void name_index_add(NameIndex *index, const char *name, unsigned int hash,
+                           void *entry) {
+    if ((index->count + 1) * 2 > index->size) {
+        NameIndex grown;
+        grown.size = index->size ? index->size * 2 : 256;
+        grown.count = index->count;
+        grown.slots = (struct NameSlot *)calloc(grown.size, sizeof(struct NameSlot));
+        if (!grown.slots) return;
+        for (size_t i = 0; i < index->size; i++) {
+            if (index->slots[i].name) {
+                *name_index_slot(&grown, index->slots[i].name, index->slots[i].hash) =
+                    index->slots[i];
+            }
+        }
+        free(index->slots);
+        *index = grown;
+    }
+
+    struct NameSlot *slot = name_index_slot(index, name, hash);
+    slot->name = name;
+    slot->hash = hash;
+    slot->entry = entry;
+    index->count++;
 }
 
 /* Add a string literal to the table */
 static char *add_string_literal(CodegenContext *ctx, const char *text) {
     /* Check if already exists */
-    for (struct StringLiteral *s = ctx->strings; s; s = s->next) {
-        if (strcmp(s->text, text) == 0) {
-            return s->label;
-        }
+    unsigned int hash = hash_name(text);
+    struct StringLiteral *s = (struct StringLiteral *)name_index_find(&ctx->string_index,
+                                                                      text, hash);
+    if (s) {
+        return s->label;
     }
 
     /* Add new string */
-    struct StringLiteral *s = (struct StringLiteral *)malloc(sizeof(struct StringLiteral));
-    s->text = strdup(text);
-    s->label = (char *)malloc(32);
-    snprintf(s->label, 32, "str_%d", ctx->string_counter++);
+    s = (struct StringLiteral *)malloc(sizeof(struct StringLiteral));
+    s->text = arena_format(ctx, "%s", text);
+    s->label = arena_format(ctx, "str_%d", ctx->string_counter++);
     s->next = ctx->strings;
     ctx->strings = s;
+    name_index_add(&ctx->string_index, s->text, hash, s);
     return s->label;
 }
 
 /* Add a symbol reference to the table */
 static void add_symbol_ref(CodegenContext *ctx, const char *name) {
     /* Check if already exists */
-    for (struct SymbolRef *s = ctx->symbols; s; s = s->next) {
-        if (strcmp(s->name, name) == 0) {
-            return;  /* Already tracked */
-        }
+    unsigned int hash = hash_name(name);
+    if (name_index_find(&ctx->symbol_index, name, hash)) {
+        return;  /* Already tracked */
     }
 
     /* Add new symbol */
     struct SymbolRef *s = (struct SymbolRef *)malloc(sizeof(struct SymbolRef));
-    s->name = strdup(name);
+    s->name = arena_format(ctx, "%s", name);
     s->next = ctx->symbols;
     ctx->symbols = s;
+    name_index_add(&ctx->symbol_index, s->name, hash, s);
+}
+
+/* ============================================================
+ * Whole-program reachability
+ * ============================================================ */
+
+static size_t hash_pointer(const void *p) {
+    unsigned long long h = (unsigned long long)(uintptr_t)p >> 4;
+    return (size_t)((h * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/* Slot of symbol in an address-hashed table: the one holding it, or the
+ * empty slot where it goes */
+static size_t symbol_slot(LispObject *const *table, size_t size, LispObject *symbol) {
+    size_t i = hash_pointer(symbol) & (size - 1);
+    while (table[i] && table[i] != symbol) {
+        i = (i + 1) & (size - 1);
+    }
+    return i;
+}
+
+static void reach_note(Reachability *r, LispObject *symbol) {
+    if ((size_t)(r->symbol_count + 1) * 2 > r->symbol_set_size) {
+        size_t size = r->symbol_set_size ? r->symbol_set_size * 2 : 256;
+        LispObject **set = (LispObject **)calloc(size, sizeof(LispObject *));
+        for (int i = 0; i < r->symbol_count; i++) {
+            set[symbol_slot(set, size, r->symbols[i])] = r->symbols[i];
+        }
+        free(r->symbol_set);
+        r->symbol_set = set;
+        r->symbol_set_size = size;
+    }
+
+    size_t slot = symbol_slot(r->symbol_set, r->symbol_set_size, symbol);
+    if (r->symbol_set[slot]) return;
+    r->symbol_set[slot] = symbol;
+
+    if (r->symbol_count >= r->symbol_capacity) {
+        r->symbol_capacity = r->symbol_capacity ? r->symbol_capacity * 2 : 64;
+        r->symbols = (LispObject **)realloc(r->symbols,
+                                            r->symbol_capacity * sizeof(LispObject *));
+    }
+    r->symbols[r->symbol_count++] = symbol;
+}
+
+/* Note every symbol in an expression, quoted data included */
+static void reach_collect(Reachability *r, LispObject *expr) {
+    while (is_cons(expr)) {
+        reach_collect(r, car(expr));
+        expr = cdr(expr);
+    }
+    if (is_symbol(expr)) {
+        reach_note(r, expr);
+    } else if (is_vector(expr)) {
+        for (size_t i = 0; i < expr->vector.length; i++) {
+            reach_collect(r, expr->vector.elements[i]);
+        }
+    }
+}
+
+/* Name bound by a definition that has no effect other than the binding
+ * (a procedure or a constant), or NULL */
+static LispObject *removable_definition(LispObject *form) {
+    if (!is_cons(form) || !is_symbol_named(car(form), "define") || !is_cons(cdr(form))) {
+        return NULL;
+    }
+
+    LispObject *target = cadr(form);
+    if (is_cons(target)) {
+        return is_symbol(car(target)) ? car(target) : NULL;
+    }
+    if (!is_symbol(target) || !is_cons(cddr(form)) || !is_nil(cdr(cddr(form)))) {
+        return NULL;
+    }
+
+    LispObject *value = caddr(form);
+    if (is_number(value) || is_string(value) || is_boolean(value)) return target;
+    if (is_cons(value) && (is_symbol_named(car(value), "lambda") ||
+                           is_symbol_named(car(value), "quote"))) {
+        return target;
+    }
+    return NULL;
+}
+
+/* Keep every form with effects, then every definition of a name a kept
+ * form mentions.  The mentioned symbols double as the work list, so each
+ * form is examined once. */
+void reachability_analyze(Reachability *r, LispObject *const *forms, int count) {
+    memset(r, 0, sizeof(*r));
+    size_t n = (size_t)(count > 0 ? count : 1);
+    r->live = (unsigned char *)calloc(n, 1);
+
+    /* Removable definitions by name: the first in a table hashed by the
+     * name's address, the others chained through next_definition */
+    size_t size = 256;
+    while (size < n * 2) size *= 2;
+    LispObject **names = (LispObject **)calloc(size, sizeof(LispObject *));
+    int *first_definition = (int *)malloc(size * sizeof(int));
+    int *next_definition = (int *)malloc(n * sizeof(int));
+
+    for (int i = count - 1; i >= 0; i--) {
+        LispObject *name = removable_definition(forms[i]);
+        if (!name) continue;
+        size_t slot = symbol_slot(names, size, name);
+        if (!names[slot]) {
+            names[slot] = name;
+            first_definition[slot] = -1;
+        }
+        next_definition[i] = first_definition[slot];
+        first_definition[slot] = i;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!removable_definition(forms[i])) {
+            r->live[i] = 1;
+            reach_collect(r, forms[i]);
+        }
+    }
+
+    for (int k = 0; k < r->symbol_count; k++) {
+        size_t slot = symbol_slot(names, size, r->symbols[k]);
+        if (!names[slot]) continue;
+        for (int i = first_definition[slot]; i >= 0; i = next_definition[i]) {
+            if (!r->live[i]) {
+                r->live[i] = 1;
+                reach_collect(r, cddr(forms[i]));
+            }
+        }
+    }
+
+    free(names);
+    free(first_definition);
+    free(next_definition);
+
+    for (int i = 0; i < count; i++) {
+        if (!r->live[i]) r->removed++;
+    }
+}
+
+int reachability_mentions(const Reachability *r, LispObject *symbol) {
+    if (!symbol || r->symbol_set_size == 0) return 0;
+    return r->symbol_set[symbol_slot(r->symbol_set, r->symbol_set_size, symbol)] != NULL;
+}
+
+void reachability_free(Reachability *r) {
+    free(r->live);
+    free(r->symbols);
+    free(r->symbol_set);
+    memset(r, 0, sizeof(*r));
 }
 
 /* Initialize code generator */
 void codegen_init(CodegenContext *ctx, FILE *output) {
+    memset(ctx, 0, sizeof(*ctx));
     ctx->output = output;
-    ctx->label_counter = 0;
-    ctx->string_counter = 0;
-    ctx->lambda_counter = 0;
-    ctx->env = NULL;
-    ctx->strings = NULL;
-    ctx->symbols = NULL;
-    ctx->lambdas = NULL;
 }
 
 /* Free code generator resources */
 void codegen_free(CodegenContext *ctx) {
-    /* Free string literals */
+    codegen_flush(ctx);
+    free(ctx->buffer);
+
+    /* Free string literals (texts and labels are in the arena) */
     struct StringLiteral *s = ctx->strings;
     while (s) {
         struct StringLiteral *next = s->next;
-        free(s->text);
-        free(s->label);
         free(s);
         s = next;
     }
+    free(ctx->string_index.slots);
 
     /* Free symbol references */
     struct SymbolRef *sym = ctx->symbols;
     while (sym) {
         struct SymbolRef *next = sym->next;
-        free(sym->name);
         free(sym);
         sym = next;
     }
+    free(ctx->symbol_index.slots);
+
+    /* Free static constants */
+    struct ConstantEntry *c = ctx->constants;
+    while (c) {
+        struct ConstantEntry *next = c->next;
+        free(c->layout);
+        free(c);
+        c = next;
+    }
+
+    struct ConstantFixup *f = ctx->fixups;
+    while (f) {
+        struct ConstantFixup *next = f->next;
+        free(f);
+        f = next;
+    }
 
-    /* Free lambda entries */
-    struct LambdaEntry *l = ctx->lambdas;
-    while (l) {
-        struct LambdaEntry *next = l->next;
-        free(l->label);
-        free(l);
-        l = next;
+    /* Free labels and names */
+    LabelChunk *chunk = ctx->arena;
+    while (chunk) {
+        LabelChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
+
+    memset(ctx, 0, sizeof(*ctx));
 }
 
 /* Forward declaration */
@@ -136,12 +479,137 @@ static void compile_number(CodegenContext *ctx, double value) {
     }
 }
 
-/* Compile a string literal */
-static void compile_string_literal(CodegenContext *ctx, const char *text) {
-    char *label = add_string_literal(ctx, text);
-    emit(ctx, "        ; Load string \"%s\"", text);
-    emit(ctx, "        lea     rcx, [%s]", label);
-    emit(ctx, "        call    rt_make_string");
+/* ============================================================
+ * Static constants
+ * ============================================================ */
+
+/* Append formatted text to a malloc'd string */
+static void text_append(char **text, const char *format, ...) {
+    va_list args;
+    size_t used = *text ? strlen(*text) : 0;
+
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    char *grown = (char *)realloc(*text, used + (size_t)length + 1);
+    if (!grown) return;
+    va_start(args, format);
+    vsnprintf(grown + used, (size_t)length + 1, format, args);
+    va_end(args);
+    *text = grown;
+}
+
+static struct ConstantEntry *new_entry(CodegenContext *ctx) {
+    struct ConstantEntry *c = (struct ConstantEntry *)calloc(1, sizeof(struct ConstantEntry));
+    c->label = gen_label(ctx, "const");
+    c->next = ctx->constants;
+    ctx->constants = c;
+    return c;
+}
+
+/* Start a static object: returns its entry, with the header laid out */
+static struct ConstantEntry *new_constant(CodegenContext *ctx, LispType type) {
+    struct ConstantEntry *c = new_entry(ctx);
+    text_append(&c->layout, "%s    dq      %d, %d, 0, 0",
+                c->label, (int)type, GC_MARK_STATIC);
+    return c;
+}
+
+static void add_fixup(CodegenContext *ctx, const char *label, int offset,
+                      const char *symbol, const char *value) {
+    struct ConstantFixup *f = (struct ConstantFixup *)calloc(1, sizeof(struct ConstantFixup));
+    if (offset) {
+        f->target = arena_format(ctx, "%s+%d", label, offset);
+    } else {
+        f->target = (char *)label;
+    }
+    f->symbol = symbol ? arena_format(ctx, "%s", symbol) : NULL;
+    f->value = value;
+    f->next = ctx->fixups;
+    ctx->fixups = f;
+}
+
+static const char *add_constant(CodegenContext *ctx, LispObject *datum);
+
+/* Data directive operand for a field at offset in the object at label:
+ * another static object, or 0 to be filled in at startup */
+static const char *constant_field(CodegenContext *ctx, LispObject *datum,
+                                  const char *label, int offset) {
+    if (is_symbol(datum)) {
+        add_fixup(ctx, label, offset, datum->symbol.name, NULL);
+    } else if (!datum || is_nil(datum)) {
+        add_fixup(ctx, label, offset, NULL, "rt_nil");
+    } else if (is_boolean(datum)) {
+        add_fixup(ctx, label, offset, NULL, is_true(datum) ? "rt_true" : "rt_false");
+    } else {
+        const char *object = add_constant(ctx, datum);
+        if (object) return object;
+        add_fixup(ctx, label, offset, NULL, "rt_nil");
+    }
+    return "0";
+}
+
+/* Lay out a number, string or list as a static object; NULL for data
+ * that has no static form */
+static const char *add_constant(CodegenContext *ctx, LispObject *datum) {
+    struct ConstantEntry *c;
+
+    switch (datum->type) {
+        case LISP_NUMBER: {
+            c = new_constant(ctx, LISP_NUMBER);
+            text_append(&c->layout, "\n        real8   %.17g", datum->number);
+            return c->label;
+        }
+
+        case LISP_STRING: {
+            const char *text = add_string_literal(ctx, datum->string.data);
+            c = new_constant(ctx, LISP_STRING);
+            text_append(&c->layout, "\n        dq      %s, %lu", text,
+                        (unsigned long)datum->string.length);
+            return c->label;
+        }
+
+        case LISP_CONS: {
+            c = new_constant(ctx, LISP_CONS);
+            const char *car_value = constant_field(ctx, car(datum), c->label, 32);
+            const char *cdr_value = constant_field(ctx, cdr(datum), c->label, 40);
+            text_append(&c->layout, "\n        dq      %s, %s", car_value, cdr_value);
+            return c->label;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/* Emit init_constants, which fills in the fields of static objects that
+ * are only known at run time */
+static void emit_constant_fixups(CodegenContext *ctx) {
+    emit(ctx, "init_constants proc");
+    emit(ctx, "        sub     rsp, 40");
+    for (struct ConstantFixup *f = ctx->fixups; f; f = f->next) {
+        if (f->symbol) {
+            char *name = add_string_literal(ctx, f->symbol);
+            emit(ctx, "        lea     rcx, [%s]", name);
+            emit(ctx, "        call    rt_make_symbol");
+        } else {
+            emit(ctx, "        mov     rax, [%s]", f->value);
+        }
+        emit(ctx, "        mov     qword ptr [%s], rax", f->target);
+    }
+    emit(ctx, "        add     rsp, 40");
+    emit(ctx, "        ret");
+    emit(ctx, "init_constants endp");
+    emit(ctx, "");
+}
+
+/* Compile a string literal (a static string object) */
+static void compile_string_literal(CodegenContext *ctx, LispObject *string) {
+    const char *label = add_constant(ctx, string);
+    emit(ctx, "        ; Load string \"%s\"", string->string.data);
+    emit(ctx, "        lea     rax, [%s]", label);
 }
 
 /* Compile a symbol reference */
@@ -155,32 +623,31 @@ static void compile_symbol_ref(CodegenContext *ctx, const char *name) {
     emit(ctx, "        jz      error_unbound");
 }
 
-/* Compile a quoted expression */
+/* Compile a quoted expression: immediates come from the runtime, other
+ * data is pre-built in the data section and costs nothing at run time */
 static void compile_quote(CodegenContext *ctx, LispObject *expr) {
     if (is_nil(expr)) {
         emit(ctx, "        mov     rax, [rt_nil]");
-    } else if (is_number(expr)) {
-        compile_number(ctx, expr->number);
-    } else if (is_string(expr)) {
-        compile_string_literal(ctx, expr->string.data);
-    } else if (is_symbol(expr)) {
-        char *label = add_string_literal(ctx, expr->symbol.name);
-        emit(ctx, "        lea     rcx, [%s]", label);
-        emit(ctx, "        call    rt_make_symbol");
-    } else if (is_cons(expr)) {
-        /* Recursively build the list at runtime */
-        compile_quote(ctx, cdr(expr));
-        emit(ctx, "        push    rax");
-        compile_quote(ctx, car(expr));
-        emit(ctx, "        mov     rcx, rax");
-        emit(ctx, "        pop     rdx");
-        emit(ctx, "        call    rt_cons");
     } else if (is_boolean(expr)) {
         if (is_true(expr)) {
             emit(ctx, "        mov     rax, [rt_true]");
         } else {
             emit(ctx, "        mov     rax, [rt_false]");
         }
+    } else if (is_symbol(expr)) {
+        /* A cell holding the interned symbol */
+        struct ConstantEntry *c = new_entry(ctx);
+        text_append(&c->layout, "%s    dq      0", c->label);
+        add_fixup(ctx, c->label, 0, expr->symbol.name, NULL);
+        emit(ctx, "        mov     rax, [%s]       ; '%s", c->label, expr->symbol.name);
+    } else {
+        const char *label = add_constant(ctx, expr);
+        if (label) {
+            emit(ctx, "        lea     rax, [%s]", label);
+        } else {
+            emit(ctx, "        ; Unsupported quoted datum of type %d", expr->type);
+            emit(ctx, "        mov     rax, [rt_nil]");
+        }
     }
 }
 
@@ -209,9 +676,6 @@ static void compile_if(CodegenContext *ctx, LispObject *args, int tail_position)
     }
 
     emit(ctx, "%s:", end_label);
-
-    free(else_label);
-    free(end_label);
 }
 
 /* Compile a begin expression */
@@ -235,9 +699,12 @@ static void compile_define(CodegenContext *ctx, LispObject *args) {
         /* Compile as lambda and bind */
         LispObject *params = cdr(first);
         LispObject *body = cdr(args);
-        LispObject *lambda = make_cons(make_symbol("lambda"),
-                                       make_cons(params, body));
+        LispObject *lambda = make_cons(params, body);
+        GCFrame frame;
+        gc_push_frame(&frame, &lambda, 1);
+        lambda = make_cons(make_symbol("lambda"), lambda);
         compile_expr(ctx, lambda, 0);
+        gc_pop_frame(&frame);
 
         /* Store in environment */
         add_symbol_ref(ctx, name->symbol.name);
@@ -301,9 +768,6 @@ static void compile_lambda(CodegenContext *ctx, LispObject *args) {
     emit(ctx, "        lea     rcx, [%s]", lambda_label);
     emit(ctx, "        mov     rdx, [rbp-8]    ; Current environment");
     emit(ctx, "        call    rt_make_closure");
-
-    free(lambda_label);
-    free(after_label);
 }
 
 /* Compile a function call */
@@ -321,6 +785,8 @@ static void compile_call(CodegenContext *ctx, LispObject *expr, int tail_positio
         emit(ctx, "        push    rax             ; Start with nil");
 
         LispObject *arg_list = list_reverse(args);
+        GCFrame frame;
+        gc_push_frame(&frame, &arg_list, 1);
         while (is_cons(arg_list)) {
             compile_expr(ctx, car(arg_list), 0);
             emit(ctx, "        mov     rcx, rax");
@@ -329,6 +795,7 @@ static void compile_call(CodegenContext *ctx, LispObject *expr, int tail_positio
             emit(ctx, "        push    rax");
             arg_list = cdr(arg_list);
         }
+        gc_pop_frame(&frame);
         emit(ctx, "        pop     rdx             ; Args list");
     } else {
         emit(ctx, "        mov     rdx, [rt_nil]   ; Empty args");
@@ -364,7 +831,7 @@ static void compile_expr(CodegenContext *ctx, LispObject *expr, int tail_positio
             break;
 
         case LISP_STRING:
-            compile_string_literal(ctx, expr->string.data);
+            compile_string_literal(ctx, expr);
             break;
 
         case LISP_BOOLEAN:
@@ -436,6 +903,13 @@ void codegen_data_section(CodegenContext *ctx) {
     }
     emit(ctx, "");
 
+    /* Static objects */
+    emit(ctx, "; Quoted data and string literals");
+    for (struct ConstantEntry *c = ctx->constants; c; c = c->next) {
+        emit(ctx, "%s", c->layout);
+    }
+    emit(ctx, "");
+
     /* Symbol name strings */
     emit(ctx, "; Symbol name strings");
     for (struct SymbolRef *sym = ctx->symbols; sym; sym = sym->next) {
@@ -444,48 +918,24 @@ void codegen_data_section(CodegenContext *ctx) {
     emit(ctx, "");
 }
 
-/* Generate the runtime support code */
+/* Generate the runtime support code: declare the runtime symbols the
+ * code emitted so far refers to */
 void codegen_runtime(CodegenContext *ctx) {
     emit(ctx, "");
     emit(ctx, "; =============================================================================");
     emit(ctx, "; Runtime Support (External References)");
     emit(ctx, "; =============================================================================");
     emit(ctx, "");
-    emit(ctx, "extern rt_nil:qword");
-    emit(ctx, "extern rt_true:qword");
-    emit(ctx, "extern rt_false:qword");
-    emit(ctx, "extern rt_make_fixnum:proc");
-    emit(ctx, "extern rt_make_float:proc");
-    emit(ctx, "extern rt_make_string:proc");
-    emit(ctx, "extern rt_make_symbol:proc");
-    emit(ctx, "extern rt_make_closure:proc");
-    emit(ctx, "extern rt_cons:proc");
-    emit(ctx, "extern rt_car:proc");
-    emit(ctx, "extern rt_cdr:proc");
-    emit(ctx, "extern rt_apply:proc");
-    emit(ctx, "extern rt_env_lookup:proc");
-    emit(ctx, "extern rt_env_define:proc");
-    emit(ctx, "extern rt_env_set:proc");
-    emit(ctx, "extern rt_init:proc");
-    emit(ctx, "extern rt_shutdown:proc");
-    emit(ctx, "extern rt_print:proc");
+    for (int i = 0; runtime_symbols[i].name != NULL; i++) {
+        if (ctx->runtime_used & (1u << i)) {
+            emit(ctx, "extern %s:%s", runtime_symbols[i].name, runtime_symbols[i].kind);
+        }
+    }
     emit(ctx, "");
 }
 
-/* Compile a Lisp program */
-void codegen_program(CodegenContext *ctx, LispObject *program) {
-    /* File header */
-    emit(ctx, "; =============================================================================");
-    emit(ctx, "; Lisp Compiled Output - MASM x64");
-    emit(ctx, "; Generated by LispCompiler");
-    emit(ctx, "; =============================================================================");
-    emit(ctx, "");
-    emit(ctx, ".code");
-    emit(ctx, "");
-
-    /* Runtime references */
-    codegen_runtime(ctx);
-
+/* Generate the entry point and data for the reachable forms */
+static void codegen_body(CodegenContext *ctx, LispObject *program) {
     /* Error handler */
     emit(ctx, "error_unbound:");
     emit(ctx, "        lea     rcx, [err_unbound_msg]");
@@ -506,21 +956,36 @@ void codegen_program(CodegenContext *ctx, LispObject *program) {
     emit(ctx, "        ; Initialize runtime");
     emit(ctx, "        call    rt_init");
     emit(ctx, "        mov     [rbp-8], rax    ; Global environment");
+    emit(ctx, "        call    init_constants");
     emit(ctx, "");
 
+    /* Definitions nothing refers to are left out */
+    int count = list_length(program);
+    LispObject **forms = (LispObject **)calloc((size_t)(count > 0 ? count : 1),
+                                               sizeof(LispObject *));
+    for (int i = 0; i < count; i++) {
+        forms[i] = car(program);
+        program = cdr(program);
+    }
+    Reachability reach;
+    reachability_analyze(&reach, forms, count);
+
     /* Compile each top-level expression */
-    while (is_cons(program)) {
+    for (int i = 0; i < count; i++) {
+        if (!reach.live[i]) continue;
+
         emit(ctx, "        ; Top-level expression");
-        compile_expr(ctx, car(program), 0);
+        compile_expr(ctx, forms[i], 0);
 
         /* Print result */
         emit(ctx, "        mov     rcx, rax");
         emit(ctx, "        call    rt_print");
         emit(ctx, "");
-
-        program = cdr(program);
     }
 
+    reachability_free(&reach);
+    free(forms);
+
     emit(ctx, "        ; Shutdown runtime");
     emit(ctx, "        call    rt_shutdown");
     emit(ctx, "");
@@ -531,6 +996,8 @@ void codegen_program(CodegenContext *ctx, LispObject *program) {
     emit(ctx, "main    endp");
     emit(ctx, "");
 
+    emit_constant_fixups(ctx);
+
     /* Data section */
     codegen_data_section(ctx);
 
@@ -540,6 +1007,51 @@ void codegen_program(CodegenContext *ctx, LispObject *program) {
     emit(ctx, "end");
 }
 
+/* File header */
+static void codegen_header(CodegenContext *ctx) {
+    emit(ctx, "; =============================================================================");
+    emit(ctx, "; Lisp Compiled Output - MASM x64");
+    emit(ctx, "; Generated by LispCompiler");
+    emit(ctx, "; =============================================================================");
+    emit(ctx, "");
+    emit(ctx, ".code");
+    emit(ctx, "");
+}
+
+/* Compile a Lisp program */
+void codegen_program(CodegenContext *ctx, LispObject *program) {
+    /* The externs are only known once the code is generated, so the body
+     * goes to a temporary file first */
+    FILE *output = ctx->output;
+    FILE *body = tmpfile();
+    if (!body) {
+        /* Declare the whole runtime up front instead */
+        ctx->runtime_used = ~0u;
+        codegen_header(ctx);
+        codegen_runtime(ctx);
+        codegen_body(ctx, program);
+        codegen_flush(ctx);
+        return;
+    }
+
+    ctx->output = body;
+    codegen_body(ctx, program);
+    codegen_flush(ctx);
+    ctx->output = output;
+
+    codegen_header(ctx);
+    codegen_runtime(ctx);
+    codegen_flush(ctx);
+
+    char buffer[CODEGEN_BUFFER_SIZE];
+    size_t n;
+    rewind(body);
+    while ((n = fread(buffer, 1, sizeof(buffer), body)) > 0) {
+        fwrite(buffer, 1, n, output);
+    }
+    fclose(body);
+}
+
 /* Compile a single expression */
 void codegen_expr(CodegenContext *ctx, LispObject *expr) {
     compile_expr(ctx, expr, 0);
@@ -596,12 +1108,18 @@ int compile_string(const char *source, const char *output_path) {
         return 1;
     }
 
-    /* Generate code */
+    /* Generate code (the program stays rooted while code generation
+     * allocates) */
+    GCFrame frame;
+    gc_push_frame(&frame, &program, 1);
+
     CodegenContext ctx;
     codegen_init(&ctx, output);
     codegen_program(&ctx, program);
     codegen_free(&ctx);
 
+    gc_pop_frame(&frame);
+
     fclose(output);
     lisp_shutdown();
 
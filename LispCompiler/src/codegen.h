@@ -1,8 +1,9 @@
 /*
- * codegen.h - MASM x64 Code Generator
+ * codegen.h - Code Generators
  *
- * Compiles Lisp expressions to x64 MASM assembly.
- * The generated code uses a runtime library for Lisp operations.
+ * Compiles Lisp expressions to x64 MASM assembly, or to portable C
+ * (the C backend).  Generated code uses a runtime library for Lisp
+ * operations.
  */
 
 #ifndef CODEGEN_H
@@ -12,12 +13,30 @@
 #include "env.h"
 #include <stdio.h>
 
+/* Hash index from names to table entries (open addressing, the size is
+ * a power of two kept at most half full) */
+typedef struct {
+    struct NameSlot {
+        const char *name;       /* Key, owned by the entry */
+        unsigned int hash;
+        void *entry;
+    } *slots;
+    size_t size;
+    size_t count;
+} NameIndex;
+
+/* Labels and names live in chunks that are freed all at once */
+typedef struct LabelChunk {
+    struct LabelChunk *next;
+    size_t used;
+    char data[];
+} LabelChunk;
+
 /* Compilation context */
 typedef struct {
     FILE *output;           /* Output file */
     int label_counter;      /* For generating unique labels */
     int string_counter;     /* For string literals */
-    int lambda_counter;     /* For lambda functions */
     Environment *env;       /* Current environment (for variable tracking) */
 
     /* String literal table */
@@ -26,27 +45,71 @@ typedef struct {
         char *label;
         struct StringLiteral *next;
     } *strings;
+    NameIndex string_index; /* text -> StringLiteral */
 
     /* Symbol reference table (for symbols used in code) */
     struct SymbolRef {
         char *name;
         struct SymbolRef *next;
     } *symbols;
+    NameIndex symbol_index; /* name -> SymbolRef */
 
-    /* Lambda function table */
-    struct LambdaEntry {
-        LispObject *lambda;
+    /* Quoted data and string literals laid out in the data section as
+     * objects the runtime's collector skips (gc = GC_MARK_STATIC) */
+    struct ConstantEntry {
         char *label;
-        struct LambdaEntry *next;
-    } *lambdas;
+        char *layout;           /* Data directives of the object */
+        struct ConstantEntry *next;
+    } *constants;
+
+    /* Fields of those objects that are only known at run time */
+    struct ConstantFixup {
+        char *target;           /* Address of the field */
+        char *symbol;           /* Symbol to intern, or NULL */
+        const char *value;      /* Runtime singleton otherwise */
+        struct ConstantFixup *next;
+    } *fixups;
+
+    /* Storage for labels, literal texts and symbol names */
+    LabelChunk *arena;
+
+    /* Emitted text not yet written to output */
+    char *buffer;
+    size_t buffer_used;
+    size_t buffer_capacity;
+
+    /* Runtime symbols referenced by the emitted code (one bit each) */
+    unsigned int runtime_used;
 } CodegenContext;
 
+/* Whole-program reachability, shared by both backends.  A top-level
+ * definition of a procedure or a constant is kept only when a kept form
+ * mentions its name; every other form is kept.  The language has no eval,
+ * so the symbols mentioned by the kept forms are also every global name
+ * the program can ever look up. */
+typedef struct {
+    unsigned char *live;        /* Per form: 1 if the form must be kept */
+    int removed;                /* Number of unreachable definitions */
+    LispObject **symbols;       /* Symbols mentioned by the kept forms */
+    int symbol_count;
+    int symbol_capacity;
+    LispObject **symbol_set;    /* The same symbols, hashed by address */
+    size_t symbol_set_size;
+} Reachability;
+
+void reachability_analyze(Reachability *r, LispObject *const *forms, int count);
+int reachability_mentions(const Reachability *r, LispObject *symbol);
+void reachability_free(Reachability *r);
+
 /* Initialize code generator */
 void codegen_init(CodegenContext *ctx, FILE *output);
 
-/* Free code generator resources */
+/* Free code generator resources (writes out any buffered output) */
 void codegen_free(CodegenContext *ctx);
 
+/* Write buffered output to the output file */
+void codegen_flush(CodegenContext *ctx);
+
 /* Compile a Lisp program to MASM */
 void codegen_program(CodegenContext *ctx, LispObject *program);
 
@@ -65,4 +128,8 @@ int compile_file(const char *input_path, const char *output_path);
 /* Compile a string */
 int compile_string(const char *source, const char *output_path);
 
+/* C backend (codegen_c.c): compile to portable C linked against lispcore */
+int compile_file_c(const char *input_path, const char *output_path);
+int compile_string_c(const char *source, const char *output_path, const char *input_name);
+
 #endif /* CODEGEN_H */
@@ -0,0 +1,2973 @@
+/*
+ * codegen_c.c - C Code Generator
+ *
+ * Compiles a Lisp program to portable C that links against the lispcore
+ * runtime library (see lisp_rt.h), so that any C compiler can optimize
+ * and build it ahead of time.
+ *
+ * Top-level function definitions become C functions.  Calls between them
+ * are direct C calls; self tail calls and named-let loops become jumps,
+ * other tail calls between compiled functions go through a trampoline.
+ * Closed lambdas (no free local variables) are compiled too.  Local
+ * variables live in a per-function array of slots registered with the
+ * garbage collector.  Forms the backend does not handle (macros,
+ * closures over locals, quasiquote, do, case, ...) are kept as source
+ * text and evaluated by the interpreter when the program reaches them.
+ *
+ * A whole-program type inference pass finds parameters that every direct
+ * call passes a number.  Such functions get a second, specialized C
+ * function that keeps those values (and numeric locals and results) in
+ * unboxed doubles; the normal entry checks the argument types at run time
+ * and dispatches to it, so calls through procedure objects stay correct.
+ */
+
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "eval.h"
+#include "primitives.h"
+#include "lisp_rt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+/* ============================================================
+ * Text buffers
+ * ============================================================ */
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} TextBuf;
+
+static void tb_append(TextBuf *tb, const char *text, size_t len) {
+    if (tb->length + len + 1 > tb->capacity) {
+        size_t capacity = tb->capacity ? tb->capacity : 256;
+        while (tb->length + len + 1 > capacity) {
+            capacity *= 2;
+        }
+        tb->data = (char *)realloc(tb->data, capacity);
+        tb->capacity = capacity;
+    }
+    memcpy(tb->data + tb->length, text, len);
+    tb->length += len;
+    tb->data[tb->length] = '\0';
+}
+
+static void tb_vprintf(TextBuf *tb, const char *format, va_list args) {
+    char small[256];
+    va_list copy;
+
+    va_copy(copy, args);
+    int len = vsnprintf(small, sizeof(small), format, copy);
+    va_end(copy);
+
+    if (len < 0) return;
+    if ((size_t)len < sizeof(small)) {
+        tb_append(tb, small, (size_t)len);
+        return;
+    }
+
+    char *large = (char *)malloc((size_t)len + 1);
+    vsnprintf(large, (size_t)len + 1, format, args);
+    tb_append(tb, large, (size_t)len);
+    free(large);
+}
+
+static void tb_printf(TextBuf *tb, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    tb_vprintf(tb, format, args);
+    va_end(args);
+}
+
+static void tb_truncate(TextBuf *tb, size_t length) {
+    if (length < tb->length) {
+        tb->length = length;
+        tb->data[length] = '\0';
+    }
+}
+
+static void tb_free(TextBuf *tb) {
+    free(tb->data);
+    tb->data = NULL;
+    tb->length = tb->capacity = 0;
+}
+
+/* Append bytes as the body of a C string literal */
+static void tb_c_escaped(TextBuf *tb, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        switch (c) {
+            case '\n': tb_append(tb, "\\n", 2); break;
+            case '\t': tb_append(tb, "\\t", 2); break;
+            case '\r': tb_append(tb, "\\r", 2); break;
+            case '\\': tb_append(tb, "\\\\", 2); break;
+            case '"':  tb_append(tb, "\\\"", 2); break;
+            case '?':  tb_append(tb, "\\?", 2); break;   /* avoid trigraphs */
+            default:
+                if (c < 32 || c >= 127) {
+                    tb_printf(tb, "\\%03o", c);
+                } else {
+                    char ch = (char)c;
+                    tb_append(tb, &ch, 1);
+                }
+                break;
+        }
+    }
+}
+
+/* ============================================================
+ * Compiler state
+ * ============================================================ */
+
+/* Static type of a value; also how a value is represented in C */
+typedef enum {
+    TY_NONE,                    /* No value (yet): the bottom of the lattice */
+    TY_NUM,                     /* Always a number: a C double */
+    TY_BOOL,                    /* Always #t or #f: a C int */
+    TY_OBJ                      /* Anything: a LispObject pointer */
+} ValType;
+
+/* A C function produced for a top-level define or a closed lambda */
+typedef struct {
+    char c_name[64];
+    char *lisp_name;            /* Name given to the procedure object */
+    int arity;
+    int *tail_called;           /* Points at the owner's flag (or NULL) */
+    int has_entries;            /* Needs __prim (and __tc) entry points */
+    ValType *param_kinds;       /* Parameter representations (NULL: objects) */
+    ValType ret_kind;           /* Result representation */
+    char *guard;                /* Code run before the frame is set up */
+    TextBuf code;               /* Definition of the direct entry */
+} CFunction;
+
+/* A top-level (define (name params...) body...) */
+typedef struct {
+    LispObject *name;
+    LispObject *params;
+    LispObject *body;
+    int arity;
+    int known;                  /* Compiled; callers may call it directly */
+    int tail_called;            /* Needs a trampoline entry */
+    char c_name[64];
+
+    /* Type inference */
+    ValType *param_types;       /* Join of the arguments of direct calls */
+    ValType ret_type;           /* Join of the values returned */
+    int foreign_tail;           /* Tail-calls another known function */
+} TopFunction;
+
+/* A top-level form and its source text */
+typedef struct {
+    LispObject *form;
+    const char *source;
+    size_t source_length;
+} TopForm;
+
+typedef struct {
+    TopForm *forms;
+    int form_count;
+
+    TopFunction *defs;
+    int def_count;
+
+    /* Names that are defined (at any depth) or assigned, with counts */
+    LispObject **bound_names;
+    int *bound_counts;
+    int bound_count;
+    int bound_capacity;
+
+    /* Names defined as macros anywhere in the program */
+    LispObject **macro_names;
+    int macro_count;
+    int macro_capacity;
+
+    /* Per-round output */
+    LispObject **symbols;
+    int symbol_count;
+    int symbol_capacity;
+    int uses_globals;
+
+    CFunction **funcs;
+    int func_count;
+    int func_capacity;
+
+    TextBuf const_init;
+    int const_count;
+
+    /* Quoted data laid out statically in C_ (see GC_MARK_STATIC) */
+    TextBuf static_objects;     /* Initializers of C_ elements */
+    TextBuf static_strings;     /* Character data of string constants */
+    int static_count;
+
+    /* Numeric constants already in K_ (numbers are immutable) */
+    double *number_values;
+    int *number_slots;
+    int number_count;
+    int number_capacity;
+
+    TextBuf sources;            /* Source text of interpreted forms */
+    int source_count;
+
+    TextBuf toplevel;
+    int toplevel_slots;
+    int toplevel_dvars;
+    int toplevel_bvars;
+
+    int label_counter;
+    int lambda_counter;
+    int changed;                /* A known function failed to compile */
+
+    /* Whole-program reachability */
+    int removed_forms;          /* Unreachable definitions left out */
+    const PrimitiveDef **primitives;    /* Primitives named by the program */
+    int primitive_count;
+
+    int compiled_forms;
+    int compiled_functions;
+    int specialized_functions;
+    int unboxed_ops;
+} CGen;
+
+/* Lexical scope entry */
+typedef struct Scope {
+    LispObject *symbol;
+    int slot;                   /* Frame slot, d[] index or SLOT_LOOP_NAME */
+    ValType type;               /* TY_NUM for unboxed numbers, else TY_OBJ */
+    struct Scope *next;
+} Scope;
+
+#define SLOT_LOOP_NAME (-2)
+
+/* Named let compiled as a loop */
+typedef struct {
+    LispObject *name;
+    Scope *vars;
+    int var_count;
+    int label;
+} LoopInfo;
+
+/* State of the function being compiled */
+typedef struct FnState {
+    CGen *cg;
+    TextBuf *out;
+    int slot_count;
+    int dvar_count;             /* Unboxed numbers: d[] */
+    int bvar_count;             /* Unboxed booleans: b[] */
+    int indent;
+    int failed;
+    int uses_top;
+    int uses_out;
+    TopFunction *self;          /* Set for known top-level functions */
+    Scope *params;              /* Parameters, in order */
+    struct FnState *parent;     /* Enclosing function (for lambdas) */
+    Scope *parent_scope;        /* Scope at the lambda expression */
+    unsigned char *label_used;
+    int label_capacity;
+} FnState;
+
+/* Where an expression's value goes and what happens next */
+typedef struct {
+    int dst;                    /* Slot (or d[]/b[] index), or DST_RET */
+    ValType kind;               /* Representation of the destination */
+    int fn_tail;                /* In tail position of the function */
+    LoopInfo *loop;             /* Innermost named let whose tail this is */
+    int exit;                   /* EXIT_NONE, EXIT_OUT or a label number */
+} Cont;
+
+#define DST_RET (-1)
+#define EXIT_NONE (-1)
+#define EXIT_OUT 0
+
+/* Primitives with inline fast paths in lisp_rt.h */
+static const struct {
+    const char *name;
+    int argc;
+    const char *c_name;
+} inline_prims[] = {
+    {"+",     2, "rt_add"},
+    {"-",     2, "rt_sub"},
+    {"*",     2, "rt_mul"},
+    {"=",     2, "rt_num_eq"},
+    {"<",     2, "rt_lt"},
+    {">",     2, "rt_gt"},
+    {"<=",    2, "rt_le"},
+    {">=",    2, "rt_ge"},
+    {"car",   1, "rt_car"},
+    {"cdr",   1, "rt_cdr"},
+    {"cons",  2, "rt_cons"},
+    {"null?", 1, "rt_null_p"},
+    {"pair?", 1, "rt_pair_p"},
+    {"not",   1, "rt_not"},
+    {"eq?",   2, "rt_eq_p"},
+    {NULL, 0, NULL}
+};
+
+/* Primitives whose result type does not depend on their arguments: on
+ * bad arguments they report an error and still return a number (or a
+ * boolean) */
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_ABS,
+    OP_LENGTH,
+    OP_COMPARE,
+    OP_NOT,
+    OP_NULL,
+    OP_PAIR
+} TypedOp;
+
+static const struct {
+    const char *name;
+    TypedOp op;
+    const char *c_op;           /* C operator or unboxed helper */
+    ValType result;
+} typed_prims[] = {
+    {"+",             OP_ADD,     "+",                TY_NUM},
+    {"-",             OP_SUB,     "-",                TY_NUM},
+    {"*",             OP_MUL,     "*",                TY_NUM},
+    {"abs",           OP_ABS,     "fabs",             TY_NUM},
+    {"vector-length", OP_LENGTH,  "rt_vector_length", TY_NUM},
+    {"string-length", OP_LENGTH,  "rt_string_length", TY_NUM},
+    {"=",             OP_COMPARE, "==",               TY_BOOL},
+    {"<",             OP_COMPARE, "<",                TY_BOOL},
+    {">",             OP_COMPARE, ">",                TY_BOOL},
+    {"<=",            OP_COMPARE, "<=",               TY_BOOL},
+    {">=",            OP_COMPARE, ">=",               TY_BOOL},
+    {"not",           OP_NOT,     "!",                TY_BOOL},
+    {"null?",         OP_NULL,    NULL,               TY_BOOL},
+    {"pair?",         OP_PAIR,    NULL,               TY_BOOL},
+    {NULL, OP_ADD, NULL, TY_NONE}
+};
+
+static void compile_expr(FnState *fn, LispObject *expr, Scope *scope, const Cont *k);
+static void compile_sequence(FnState *fn, LispObject *body, Scope *scope, const Cont *k);
+
+/* ============================================================
+ * Helpers
+ * ============================================================ */
+
+/* Number of elements in a proper list, or -1 */
+static int proper_length(LispObject *list) {
+    int n = 0;
+    while (is_cons(list)) {
+        n++;
+        list = cdr(list);
+    }
+    return is_nil(list) ? n : -1;
+}
+
+/* Check for a proper list of symbols */
+static int is_symbol_list(LispObject *list) {
+    while (is_cons(list)) {
+        if (!is_symbol(car(list))) return 0;
+        list = cdr(list);
+    }
+    return is_nil(list);
+}
+
+/* Turn a Lisp name into a C identifier fragment */
+static void c_identifier(char *out, size_t size, const char *prefix, int index,
+                         const char *name) {
+    int n = snprintf(out, size, "%s%d_", prefix, index);
+    size_t pos = (n > 0) ? (size_t)n : 0;
+    for (const char *p = name; *p && pos + 1 < size && pos < 48; p++) {
+        char c = *p;
+        int ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                 (c >= '0' && c <= '9');
+        out[pos++] = ok ? c : '_';
+    }
+    out[pos] = '\0';
+}
+
+static int symbol_index(CGen *cg, LispObject *symbol) {
+    for (int i = 0; i < cg->symbol_count; i++) {
+        if (cg->symbols[i] == symbol) return i;
+    }
+    if (cg->symbol_count >= cg->symbol_capacity) {
+        cg->symbol_capacity = cg->symbol_capacity ? cg->symbol_capacity * 2 : 64;
+        cg->symbols = (LispObject **)realloc(cg->symbols,
+                                             cg->symbol_capacity * sizeof(LispObject *));
+    }
+    cg->symbols[cg->symbol_count] = symbol;
+    return cg->symbol_count++;
+}
+
+static int bound_name_count(CGen *cg, LispObject *symbol) {
+    for (int i = 0; i < cg->bound_count; i++) {
+        if (cg->bound_names[i] == symbol) return cg->bound_counts[i];
+    }
+    return 0;
+}
+
+static void note_bound_name(CGen *cg, LispObject *symbol) {
+    for (int i = 0; i < cg->bound_count; i++) {
+        if (cg->bound_names[i] == symbol) {
+            cg->bound_counts[i]++;
+            return;
+        }
+    }
+    if (cg->bound_count >= cg->bound_capacity) {
+        cg->bound_capacity = cg->bound_capacity ? cg->bound_capacity * 2 : 64;
+        cg->bound_names = (LispObject **)realloc(cg->bound_names,
+                                                 cg->bound_capacity * sizeof(LispObject *));
+        cg->bound_counts = (int *)realloc(cg->bound_counts,
+                                          cg->bound_capacity * sizeof(int));
+    }
+    cg->bound_names[cg->bound_count] = symbol;
+    cg->bound_counts[cg->bound_count] = 1;
+    cg->bound_count++;
+}
+
+static int is_macro_name(CGen *cg, LispObject *symbol) {
+    for (int i = 0; i < cg->macro_count; i++) {
+        if (cg->macro_names[i] == symbol) return 1;
+    }
+    return 0;
+}
+
+/* Record every define/set!/defmacro target in a form */
+static void scan_bindings(CGen *cg, LispObject *expr) {
+    while (is_cons(expr)) {
+        LispObject *head = car(expr);
+        if (is_symbol_named(head, "quote")) return;
+
+        if ((is_symbol_named(head, "define") || is_symbol_named(head, "set!")) &&
+            is_cons(cdr(expr))) {
+            LispObject *target = cadr(expr);
+            if (is_cons(target)) target = car(target);
+            if (is_symbol(target)) note_bound_name(cg, target);
+        }
+
+        if (is_symbol_named(head, "defmacro") && is_cons(cdr(expr)) &&
+            is_symbol(cadr(expr))) {
+            if (cg->macro_count >= cg->macro_capacity) {
+                cg->macro_capacity = cg->macro_capacity ? cg->macro_capacity * 2 : 16;
+                cg->macro_names = (LispObject **)realloc(
+                    cg->macro_names, cg->macro_capacity * sizeof(LispObject *));
+            }
+            cg->macro_names[cg->macro_count++] = cadr(expr);
+        }
+
+        if (is_cons(head)) scan_bindings(cg, head);
+        expr = cdr(expr);
+    }
+}
+
+static TopFunction *find_known(CGen *cg, LispObject *symbol) {
+    for (int i = 0; i < cg->def_count; i++) {
+        if (cg->defs[i].name == symbol) {
+            return cg->defs[i].known ? &cg->defs[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Check whether an expression may assign a variable (ignores shadowing) */
+static int is_assigned(LispObject *expr, LispObject *symbol) {
+    while (is_cons(expr)) {
+        LispObject *head = car(expr);
+        if (is_symbol_named(head, "quote")) return 0;
+        if (is_symbol_named(head, "set!") && is_cons(cdr(expr)) && cadr(expr) == symbol) {
+            return 1;
+        }
+        if (is_cons(head) && is_assigned(head, symbol)) return 1;
+        expr = cdr(expr);
+    }
+    return 0;
+}
+
+static Scope *scope_find(Scope *scope, LispObject *symbol) {
+    for (Scope *s = scope; s != NULL; s = s->next) {
+        if (s->symbol == symbol) return s;
+    }
+    return NULL;
+}
+
+/* Index in typed_prims for a call of a global primitive, or -1 */
+static int typed_prim(CGen *cg, Scope *scope, LispObject *head, int argc) {
+    if (!is_symbol(head) || scope_find(scope, head) != NULL ||
+        bound_name_count(cg, head) != 0) {
+        return -1;
+    }
+    for (int i = 0; typed_prims[i].name != NULL; i++) {
+        if (strcmp(typed_prims[i].name, head->symbol.name) != 0) continue;
+
+        const PrimitiveDef *prim = primitive_find(typed_prims[i].name);
+        if (!prim || argc < prim->min_args ||
+            (prim->max_args >= 0 && argc > prim->max_args)) {
+            return -1;
+        }
+        return i;
+    }
+    return -1;
+}
+
+/* ============================================================
+ * Type inference
+ *
+ * Types only grow while the whole program is walked repeatedly, starting
+ * from TY_NONE, so the fixpoint is the least solution: a parameter is
+ * TY_NUM when every direct call passes a number.  Bodies are typed with
+ * the parameter types, giving each function's result type.  The same
+ * walk (without recording) types expressions during code generation.
+ * ============================================================ */
+
+typedef struct {
+    LispObject *name;
+    int var_count;
+    ValType *args;              /* Join of the values passed by loop calls */
+} InferLoop;
+
+typedef struct {
+    CGen *cg;
+    TopFunction *self;          /* Function whose body is walked (or NULL) */
+    int record;                 /* Join argument types into direct callees */
+    int foreign_tail;           /* Saw a tail call to another known function */
+    int changed;
+} Infer;
+
+static ValType ty_join(ValType a, ValType b) {
+    if (a == TY_NONE) return b;
+    if (b == TY_NONE) return a;
+    return a == b ? a : TY_OBJ;
+}
+
+/* Representation of a variable bound in region to a value of type t */
+static ValType local_type(Infer *in, ValType t, LispObject *region, LispObject *var) {
+    if (is_assigned(region, var)) return TY_OBJ;
+    if (t == TY_NUM) return TY_NUM;
+    if (t == TY_NONE && in->record) return TY_NONE;     /* Not known yet */
+    return TY_OBJ;
+}
+
+static ValType param_kind(TopFunction *def, int index) {
+    return def->param_types[index] == TY_NUM ? TY_NUM : TY_OBJ;
+}
+
+/* Representation of a function's result */
+static ValType result_kind(TopFunction *def) {
+    if (def->foreign_tail) return TY_OBJ;   /* Returns through the trampoline */
+    if (def->ret_type == TY_NUM || def->ret_type == TY_BOOL) return def->ret_type;
+    return TY_OBJ;
+}
+
+static int is_specialized(TopFunction *def) {
+    for (int i = 0; i < def->arity; i++) {
+        if (param_kind(def, i) == TY_NUM) return 1;
+    }
+    return result_kind(def) != TY_OBJ;
+}
+
+/* Type of a direct call: the callee's result if the arguments fit */
+static ValType call_type(TopFunction *def, const ValType *arg_types) {
+    if (def->foreign_tail) return TY_OBJ;
+    for (int i = 0; i < def->arity; i++) {
+        if (def->param_types[i] == TY_NUM &&
+            arg_types[i] != TY_NUM && arg_types[i] != TY_NONE) {
+            return TY_OBJ;
+        }
+    }
+    return def->ret_type;
+}
+
+static ValType infer_expr(Infer *in, LispObject *expr, Scope *scope, int tail,
+                          InferLoop *loop);
+
+static ValType infer_sequence(Infer *in, LispObject *body, Scope *scope, int tail,
+                              InferLoop *loop) {
+    ValType type = TY_OBJ;
+    while (is_cons(body)) {
+        int last = !is_cons(cdr(body));
+        type = infer_expr(in, car(body), scope, tail && last, last ? loop : NULL);
+        body = cdr(body);
+    }
+    return type;
+}
+
+/* Infer arguments left to right, storing their types if asked */
+static void infer_args(Infer *in, LispObject *args, Scope *scope, ValType *types) {
+    for (int i = 0; is_cons(args); i++, args = cdr(args)) {
+        ValType type = infer_expr(in, car(args), scope, 0, NULL);
+        if (types) types[i] = type;
+    }
+}
+
+static ValType infer_let(Infer *in, LispObject *args, Scope *scope, int tail,
+                         InferLoop *loop, int sequential) {
+    if (!is_cons(args)) return TY_OBJ;
+
+    LispObject *bindings = car(args);
+    int count = proper_length(bindings);
+    if (count < 0) return TY_OBJ;
+
+    Scope *nodes = (Scope *)malloc((count ? count : 1) * sizeof(Scope));
+    Scope *inner = scope;
+    ValType type = TY_OBJ;
+    int i;
+
+    for (i = 0; i < count; i++, bindings = cdr(bindings)) {
+        LispObject *binding = car(bindings);
+        if (proper_length(binding) != 2 || !is_symbol(car(binding))) break;
+
+        ValType init = infer_expr(in, cadr(binding), sequential ? inner : scope, 0, NULL);
+        nodes[i].symbol = car(binding);
+        nodes[i].slot = 0;
+        nodes[i].type = local_type(in, init, args, car(binding));
+        nodes[i].next = inner;
+        inner = &nodes[i];
+    }
+    if (i == count) {
+        type = infer_sequence(in, cdr(args), inner, tail, loop);
+    }
+    free(nodes);
+    return type;
+}
+
+/* Named let: the loop variables' types are the join of the initial values
+ * and the values passed by loop calls, found by iterating over the body */
+static ValType infer_named_let(Infer *in, LispObject *args, Scope *scope, int tail,
+                               ValType *var_types) {
+    if (proper_length(args) < 2) return TY_OBJ;
+
+    LispObject *name = car(args);
+    LispObject *bindings = cadr(args);
+    int count = proper_length(bindings);
+    if (count < 0) return TY_OBJ;
+
+    Scope *nodes = (Scope *)malloc((count + 1) * sizeof(Scope));
+    ValType *passed = (ValType *)malloc((count ? count : 1) * sizeof(ValType));
+    nodes[0].symbol = name;
+    nodes[0].slot = SLOT_LOOP_NAME;
+    nodes[0].type = TY_OBJ;
+    nodes[0].next = scope;
+
+    LispObject *b = bindings;
+    for (int i = 0; i < count; i++, b = cdr(b)) {
+        LispObject *binding = car(b);
+        if (proper_length(binding) != 2 || !is_symbol(car(binding))) {
+            free(passed);
+            free(nodes);
+            return TY_OBJ;
+        }
+        ValType init = infer_expr(in, cadr(binding), scope, 0, NULL);
+        nodes[i + 1].symbol = car(binding);
+        nodes[i + 1].slot = 0;
+        nodes[i + 1].type = local_type(in, init, args, car(binding));
+        nodes[i + 1].next = &nodes[i];
+    }
+
+    InferLoop loop;
+    loop.name = name;
+    loop.var_count = count;
+    loop.args = passed;
+
+    ValType type;
+    int changed;
+    do {
+        for (int i = 0; i < count; i++) {
+            passed[i] = TY_NONE;
+        }
+        type = infer_sequence(in, cddr(args), &nodes[count], tail, &loop);
+
+        changed = 0;
+        for (int i = 0; i < count; i++) {
+            ValType joined = local_type(in, ty_join(nodes[i + 1].type, passed[i]),
+                                        args, nodes[i + 1].symbol);
+            if (joined != nodes[i + 1].type) {
+                nodes[i + 1].type = joined;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    if (var_types) {
+        for (int i = 0; i < count; i++) {
+            var_types[i] = nodes[i + 1].type;
+        }
+    }
+    free(passed);
+    free(nodes);
+    return type;
+}
+
+static ValType infer_cond(Infer *in, LispObject *clauses, Scope *scope, int tail,
+                          InferLoop *loop) {
+    ValType type = TY_NONE;
+    for (; is_cons(clauses); clauses = cdr(clauses)) {
+        LispObject *clause = car(clauses);
+        if (!is_cons(clause)) return TY_OBJ;
+
+        if (is_symbol_named(car(clause), "else")) {
+            return ty_join(type, infer_sequence(in, cdr(clause), scope, tail, loop));
+        }
+        ValType test = infer_expr(in, car(clause), scope, 0, NULL);
+        if (is_cons(cdr(clause)) && is_symbol_named(cadr(clause), "=>")) return TY_OBJ;
+
+        if (is_nil(cdr(clause))) {
+            type = ty_join(type, test);
+        } else {
+            type = ty_join(type, infer_sequence(in, cdr(clause), scope, tail, loop));
+        }
+    }
+    return ty_join(type, TY_OBJ);           /* No clause matched */
+}
+
+static ValType infer_and_or(Infer *in, LispObject *args, Scope *scope, int tail,
+                            InferLoop *loop, int is_and) {
+    int count = proper_length(args);
+    if (count < 0) return TY_OBJ;
+    if (count == 0) return TY_BOOL;
+
+    /* Short-circuit values are #f for and, the operand itself for or */
+    ValType type = TY_NONE;
+    for (int i = 0; i < count - 1; i++, args = cdr(args)) {
+        ValType value = infer_expr(in, car(args), scope, 0, NULL);
+        type = ty_join(type, is_and ? TY_BOOL : value);
+    }
+    if (is_and) {
+        return ty_join(type, infer_expr(in, car(args), scope, tail, loop));
+    }
+    return ty_join(type, ty_join(TY_BOOL, infer_expr(in, car(args), scope, 0, NULL)));
+}
+
+/* Lambda bodies are walked for the direct calls they contain */
+static void infer_lambda(Infer *in, LispObject *args, Scope *scope) {
+    if (!is_cons(args) || !is_symbol_list(car(args))) return;
+
+    int count = proper_length(car(args));
+    Scope *nodes = (Scope *)malloc((count ? count : 1) * sizeof(Scope));
+    Scope *inner = scope;
+    LispObject *p = car(args);
+    for (int i = 0; i < count; i++, p = cdr(p)) {
+        nodes[i].symbol = car(p);
+        nodes[i].slot = 0;
+        nodes[i].type = TY_OBJ;
+        nodes[i].next = inner;
+        inner = &nodes[i];
+    }
+
+    Infer sub = *in;
+    sub.self = NULL;
+    sub.changed = 0;
+    infer_sequence(&sub, cdr(args), inner, 1, NULL);
+    in->changed |= sub.changed;
+    free(nodes);
+}
+
+static ValType infer_direct_call(Infer *in, TopFunction *def, LispObject *args,
+                                 Scope *scope, int tail) {
+    ValType local_types[8];
+    ValType *types = def->arity <= 8 ? local_types
+                                     : (ValType *)malloc(def->arity * sizeof(ValType));
+    infer_args(in, args, scope, types);
+
+    if (in->record) {
+        for (int i = 0; i < def->arity; i++) {
+            ValType joined = ty_join(def->param_types[i], types[i]);
+            if (joined != def->param_types[i]) {
+                def->param_types[i] = joined;
+                in->changed = 1;
+            }
+        }
+    }
+
+    ValType type;
+    if (tail && def == in->self) {
+        type = TY_NONE;                     /* A jump, not a value */
+    } else {
+        if (tail && in->self) in->foreign_tail = 1;
+        type = call_type(def, types);
+    }
+
+    if (types != local_types) free(types);
+    return type;
+}
+
+static ValType infer_form(Infer *in, LispObject *expr, Scope *scope, int tail,
+                          InferLoop *loop) {
+    CGen *cg = in->cg;
+    LispObject *head = car(expr);
+    LispObject *args = cdr(expr);
+    int argc = proper_length(args);
+    if (argc < 0) return TY_OBJ;
+
+    Scope *local = is_symbol(head) ? scope_find(scope, head) : NULL;
+
+    if (is_symbol(head) && local == NULL) {
+        const char *name = head->symbol.name;
+        if (is_macro_name(cg, head)) return TY_OBJ;
+
+        if (eval_is_special_form(name)) {
+            if (strcmp(name, "if") == 0) {
+                if (argc != 2 && argc != 3) return TY_OBJ;
+                infer_expr(in, car(args), scope, 0, NULL);
+                ValType type = infer_expr(in, cadr(args), scope, tail, loop);
+                return ty_join(type, argc == 3 ? infer_expr(in, caddr(args), scope, tail, loop)
+                                               : TY_OBJ);
+            }
+            if (strcmp(name, "begin") == 0) {
+                return infer_sequence(in, args, scope, tail, loop);
+            }
+            if (strcmp(name, "let") == 0) {
+                if (is_cons(args) && is_symbol(car(args))) {
+                    return infer_named_let(in, args, scope, tail, NULL);
+                }
+                return infer_let(in, args, scope, tail, loop, 0);
+            }
+            if (strcmp(name, "let*") == 0) {
+                return infer_let(in, args, scope, tail, loop, 1);
+            }
+            if (strcmp(name, "cond") == 0) {
+                return infer_cond(in, args, scope, tail, loop);
+            }
+            if (strcmp(name, "and") == 0 || strcmp(name, "or") == 0) {
+                return infer_and_or(in, args, scope, tail, loop, name[0] == 'a');
+            }
+            if (strcmp(name, "when") == 0 || strcmp(name, "unless") == 0) {
+                if (argc >= 1) {
+                    infer_expr(in, car(args), scope, 0, NULL);
+                    infer_sequence(in, cdr(args), scope, tail, loop);
+                }
+                return TY_OBJ;
+            }
+            if (strcmp(name, "set!") == 0) {
+                if (argc == 2) infer_expr(in, cadr(args), scope, 0, NULL);
+                return TY_OBJ;
+            }
+            if (strcmp(name, "lambda") == 0) {
+                infer_lambda(in, args, scope);
+                return TY_OBJ;
+            }
+            return TY_OBJ;      /* quote, or left to the interpreter */
+        }
+
+        int prim = typed_prim(cg, scope, head, argc);
+        if (prim >= 0) {
+            infer_args(in, args, scope, NULL);
+            return typed_prims[prim].result;
+        }
+
+        TopFunction *def = find_known(cg, head);
+        if (def && def->arity == argc) {
+            return infer_direct_call(in, def, args, scope, tail);
+        }
+    } else if (local && local->slot == SLOT_LOOP_NAME && loop &&
+               loop->name == head && argc == loop->var_count) {
+        ValType local_types[8];
+        ValType *types = argc <= 8 ? local_types
+                                   : (ValType *)malloc(argc * sizeof(ValType));
+        infer_args(in, args, scope, types);
+        for (int i = 0; i < argc; i++) {
+            loop->args[i] = ty_join(loop->args[i], types[i]);
+        }
+        if (types != local_types) free(types);
+        return TY_NONE;                     /* A jump, not a value */
+    }
+
+    if (is_cons(head)) infer_expr(in, head, scope, 0, NULL);
+    infer_args(in, args, scope, NULL);
+    return TY_OBJ;
+}
+
+static ValType infer_expr(Infer *in, LispObject *expr, Scope *scope, int tail,
+                          InferLoop *loop) {
+    switch (expr->type) {
+        case LISP_NUMBER:
+            return TY_NUM;
+
+        case LISP_BOOLEAN:
+            return TY_BOOL;
+
+        case LISP_SYMBOL: {
+            Scope *s = scope_find(scope, expr);
+            return (s && s->slot != SLOT_LOOP_NAME) ? s->type : TY_OBJ;
+        }
+
+        case LISP_CONS:
+            return infer_form(in, expr, scope, tail, loop);
+
+        default:
+            return TY_OBJ;
+    }
+}
+
+/* Parameter scope of a known function with the given types */
+static Scope *param_scope(TopFunction *def, Scope *nodes, const ValType *types) {
+    Scope *scope = NULL;
+    LispObject *p = def->params;
+    for (int i = 0; i < def->arity; i++, p = cdr(p)) {
+        nodes[i].symbol = car(p);
+        nodes[i].slot = i;
+        nodes[i].type = types[i];
+        nodes[i].next = scope;
+        scope = &nodes[i];
+    }
+    return scope;
+}
+
+/* Walk the whole program until parameter and result types are stable */
+static void infer_program(CGen *cg) {
+    for (int i = 0; i < cg->def_count; i++) {
+        TopFunction *def = &cg->defs[i];
+        if (!def->param_types) {
+            def->param_types = (ValType *)malloc((def->arity ? def->arity : 1) *
+                                                 sizeof(ValType));
+        }
+        LispObject *p = def->params;
+        for (int j = 0; j < def->arity; j++, p = cdr(p)) {
+            def->param_types[j] = is_assigned(def->body, car(p)) ? TY_OBJ : TY_NONE;
+        }
+        def->ret_type = TY_NONE;
+        def->foreign_tail = 0;
+    }
+
+    for (;;) {
+        int changed;
+        do {
+            changed = 0;
+            for (int i = 0; i < cg->form_count; i++) {
+                LispObject *form = cg->forms[i].form;
+                Infer in;
+                memset(&in, 0, sizeof(in));
+                in.cg = cg;
+                in.record = 1;
+
+                if (is_cons(form) && is_symbol_named(car(form), "define") &&
+                    is_cons(cdr(form))) {
+                    LispObject *target = cadr(form);
+                    if (is_cons(target)) {
+                        TopFunction *def = is_symbol(car(target)) ? find_known(cg, car(target))
+                                                                  : NULL;
+                        if (!def) continue;
+
+                        Scope *nodes = (Scope *)malloc((def->arity ? def->arity : 1) *
+                                                       sizeof(Scope));
+                        in.self = def;
+                        ValType type = infer_sequence(&in, def->body,
+                                                      param_scope(def, nodes, def->param_types),
+                                                      1, NULL);
+                        free(nodes);
+
+                        if (in.foreign_tail && !def->foreign_tail) {
+                            def->foreign_tail = 1;
+                            changed = 1;
+                        }
+                        type = ty_join(def->ret_type, type);
+                        if (type != def->ret_type) {
+                            def->ret_type = type;
+                            changed = 1;
+                        }
+                    } else if (proper_length(cdr(form)) == 2) {
+                        infer_expr(&in, caddr(form), NULL, 0, NULL);
+                    }
+                } else {
+                    infer_expr(&in, form, NULL, 0, NULL);
+                }
+                changed |= in.changed;
+            }
+        } while (changed);
+
+        /* Parameters no direct call reached can hold anything */
+        int widened = 0;
+        for (int i = 0; i < cg->def_count; i++) {
+            for (int j = 0; j < cg->defs[i].arity; j++) {
+                if (cg->defs[i].param_types[j] == TY_NONE) {
+                    cg->defs[i].param_types[j] = TY_OBJ;
+                    widened = 1;
+                }
+            }
+        }
+        if (!widened) break;
+    }
+}
+
+/* ============================================================
+ * Emission
+ * ============================================================ */
+
+static void fail(FnState *fn) {
+    fn->failed = 1;
+}
+
+static void emit_line(FnState *fn, const char *format, ...) {
+    for (int i = 0; i < fn->indent; i++) {
+        tb_append(fn->out, "    ", 4);
+    }
+    va_list args;
+    va_start(args, format);
+    tb_vprintf(fn->out, format, args);
+    va_end(args);
+    tb_append(fn->out, "\n", 1);
+}
+
+static int alloc_slots(FnState *fn, int count) {
+    int first = fn->slot_count;
+    fn->slot_count += count;
+    return first;
+}
+
+/* A fresh variable of the given representation */
+static int alloc_var(FnState *fn, ValType kind) {
+    if (kind == TY_NUM) return fn->dvar_count++;
+    if (kind == TY_BOOL) return fn->bvar_count++;
+    return alloc_slots(fn, 1);
+}
+
+static int new_label(FnState *fn) {
+    return ++fn->cg->label_counter;
+}
+
+static void mark_label(FnState *fn, int label) {
+    if (label >= fn->label_capacity) {
+        int capacity = fn->label_capacity ? fn->label_capacity : 64;
+        while (label >= capacity) capacity *= 2;
+        fn->label_used = (unsigned char *)realloc(fn->label_used, capacity);
+        memset(fn->label_used + fn->label_capacity, 0, capacity - fn->label_capacity);
+        fn->label_capacity = capacity;
+    }
+    fn->label_used[label] = 1;
+}
+
+static int label_is_used(FnState *fn, int label) {
+    return label < fn->label_capacity && fn->label_used[label];
+}
+
+static void var_ref(char *buf, size_t size, ValType kind, int slot) {
+    const char *name = kind == TY_NUM ? "d" : kind == TY_BOOL ? "b" : "f";
+    if (slot == DST_RET) {
+        snprintf(buf, size, "%sret", kind == TY_OBJ ? "" : name);
+    } else {
+        snprintf(buf, size, "%s[%d]", name, slot);
+    }
+}
+
+static void emit_exit(FnState *fn, const Cont *k) {
+    if (k->exit == EXIT_OUT) {
+        fn->uses_out = 1;
+        emit_line(fn, "goto out;");
+    } else if (k->exit > 0) {
+        mark_label(fn, k->exit);
+        emit_line(fn, "goto L%d;", k->exit);
+    }
+}
+
+/* Store a C object expression into the continuation's destination */
+static void emit_value(FnState *fn, const Cont *k, const char *format, ...) {
+    char dst[32];
+    TextBuf value = {0};
+    va_list args;
+
+    va_start(args, format);
+    tb_vprintf(&value, format, args);
+    va_end(args);
+
+    var_ref(dst, sizeof(dst), k->kind, k->dst);
+    if (k->kind == TY_NUM) {
+        emit_line(fn, "%s = rt_unbox_num(%s);", dst, value.data);
+    } else if (k->kind == TY_BOOL) {
+        emit_line(fn, "%s = rt_truthy(%s);", dst, value.data);
+    } else {
+        emit_line(fn, "%s = %s;", dst, value.data);
+    }
+    tb_free(&value);
+    emit_exit(fn, k);
+}
+
+/* Store an unboxed C expression (a double or a truth value) */
+static void emit_typed_value(FnState *fn, const Cont *k, ValType type,
+                             const char *format, ...) {
+    char dst[32];
+    TextBuf value = {0};
+    va_list args;
+
+    va_start(args, format);
+    tb_vprintf(&value, format, args);
+    va_end(args);
+
+    var_ref(dst, sizeof(dst), k->kind, k->dst);
+    if (k->kind == type) {
+        emit_line(fn, "%s = %s;", dst, value.data);
+    } else if (k->kind == TY_OBJ && type == TY_NUM) {
+        emit_line(fn, "%s = make_number(%s);", dst, value.data);
+    } else if (k->kind == TY_OBJ) {
+        emit_line(fn, "%s = (%s) ? LISP_TRUE : LISP_FALSE;", dst, value.data);
+    } else if (k->kind == TY_BOOL) {
+        /* Numbers are true */
+        emit_line(fn, "(void)(%s);", value.data);
+        emit_line(fn, "%s = 1;", dst);
+    } else {
+        emit_line(fn, "%s = rt_unbox_num((%s) ? LISP_TRUE : LISP_FALSE);", dst, value.data);
+    }
+    tb_free(&value);
+    emit_exit(fn, k);
+}
+
+static Cont value_cont(int slot) {
+    Cont k;
+    k.dst = slot;
+    k.kind = TY_OBJ;
+    k.fn_tail = 0;
+    k.loop = NULL;
+    k.exit = EXIT_NONE;
+    return k;
+}
+
+static Cont typed_cont(ValType kind, int var) {
+    Cont k = value_cont(var);
+    k.kind = kind;
+    return k;
+}
+
+/* Static type of an expression at this point of the function */
+static ValType static_type(FnState *fn, LispObject *expr, Scope *scope) {
+    Infer in;
+    memset(&in, 0, sizeof(in));
+    in.cg = fn->cg;
+    in.self = fn->self;
+    return infer_expr(&in, expr, scope, 0, NULL);
+}
+
+/* Representation of a local bound in region to init */
+static ValType static_local_type(FnState *fn, LispObject *init, Scope *scope,
+                                 LispObject *region, LispObject *var) {
+    Infer in;
+    memset(&in, 0, sizeof(in));
+    in.cg = fn->cg;
+    in.self = fn->self;
+    return local_type(&in, infer_expr(&in, init, scope, 0, NULL), region, var);
+}
+
+/* ============================================================
+ * Constants
+ * ============================================================ */
+
+static int new_constant(CGen *cg) {
+    return cg->const_count++;
+}
+
+static void double_literal(char *buf, size_t size, double value);
+
+/* Start the static initializer of C_[index]; the caller adds the fields */
+static int new_static(CGen *cg, const char *type) {
+    int index = cg->static_count++;
+    tb_printf(&cg->static_objects, "    [%d] = {.type = %s, .gc_mark = GC_MARK_STATIC", index, type);
+    return index;
+}
+
+/* A field of a static object: a pointer to another static object, or
+ * NULL patched by init_constants when the value only exists at run time
+ * (symbols and the nil/boolean singletons) */
+static const char *static_field(CGen *cg, const char *value, int index, const char *field) {
+    if (strncmp(value, "(&C_[", 5) == 0) return value;
+    tb_printf(&cg->const_init, "    C_[%d].%s = %s;\n", index, field, value);
+    return "NULL";
+}
+
+/* Write a C expression for a quoted datum into buf; 0 if unsupported.
+ * Numbers, characters, strings and lists are pre-built static objects
+ * that cost nothing when the quote is evaluated. */
+static int constant_expr(CGen *cg, LispObject *datum, char *buf, size_t size) {
+    switch (datum->type) {
+        case LISP_NIL:
+            snprintf(buf, size, "LISP_NIL_OBJ");
+            return 1;
+
+        case LISP_BOOLEAN:
+            snprintf(buf, size, "%s", datum->boolean ? "LISP_TRUE" : "LISP_FALSE");
+            return 1;
+
+        case LISP_SYMBOL:
+            snprintf(buf, size, "S_[%d]", symbol_index(cg, datum));
+            return 1;
+
+        case LISP_NUMBER: {
+            if (!isfinite(datum->number)) return 0;
+            for (int i = 0; i < cg->number_count; i++) {
+                if (cg->number_values[i] == datum->number &&
+                    signbit(cg->number_values[i]) == signbit(datum->number)) {
+                    snprintf(buf, size, "(&C_[%d])", cg->number_slots[i]);
+                    return 1;
+                }
+            }
+            char literal[64];
+            double_literal(literal, sizeof(literal), datum->number);
+            int index = new_static(cg, "LISP_NUMBER");
+            tb_printf(&cg->static_objects, ", .number = %s},\n", literal);
+            if (cg->number_count >= cg->number_capacity) {
+                cg->number_capacity = cg->number_capacity ? cg->number_capacity * 2 : 64;
+                cg->number_values = (double *)realloc(cg->number_values,
+                                                      cg->number_capacity * sizeof(double));
+                cg->number_slots = (int *)realloc(cg->number_slots,
+                                                  cg->number_capacity * sizeof(int));
+            }
+            cg->number_values[cg->number_count] = datum->number;
+            cg->number_slots[cg->number_count] = index;
+            cg->number_count++;
+            snprintf(buf, size, "(&C_[%d])", index);
+            return 1;
+        }
+
+        case LISP_CHARACTER: {
+            int index = new_static(cg, "LISP_CHARACTER");
+            tb_printf(&cg->static_objects, ", .character = %luu},\n",
+                      (unsigned long)datum->character);
+            snprintf(buf, size, "(&C_[%d])", index);
+            return 1;
+        }
+
+        case LISP_STRING: {
+            int index = new_static(cg, "LISP_STRING");
+            tb_printf(&cg->static_objects, ", .string = {C_%d_data, %lu, %lu, NULL}},\n",
+                      index, (unsigned long)datum->string.length,
+                      (unsigned long)datum->string.chars);
+            tb_printf(&cg->static_strings, "static char C_%d_data[] = \"", index);
+            tb_c_escaped(&cg->static_strings, datum->string.data, datum->string.length);
+            tb_printf(&cg->static_strings, "\";\n");
+            snprintf(buf, size, "(&C_[%d])", index);
+            return 1;
+        }
+
+        case LISP_CONS: {
+            /* Elements first, then the cells back to front */
+            int count = 0;
+            LispObject *p = datum;
+            while (is_cons(p)) {
+                count++;
+                p = cdr(p);
+            }
+
+            char tail[32];
+            if (!constant_expr(cg, p, tail, sizeof(tail))) return 0;
+
+            char **items = (char **)malloc(count * sizeof(char *));
+            p = datum;
+            for (int i = 0; i < count; i++) {
+                items[i] = (char *)malloc(32);
+                if (!constant_expr(cg, car(p), items[i], 32)) {
+                    for (int j = 0; j <= i; j++) free(items[j]);
+                    free(items);
+                    return 0;
+                }
+                p = cdr(p);
+            }
+
+            char next[32];
+            snprintf(next, sizeof(next), "%s", tail);
+            for (int i = count - 1; i >= 0; i--) {
+                int index = cg->static_count;
+                const char *car_value = static_field(cg, items[i], index, "cons.car");
+                const char *cdr_value = static_field(cg, next, index, "cons.cdr");
+                new_static(cg, "LISP_CONS");
+                tb_printf(&cg->static_objects, ", .cons = {%s, %s}},\n",
+                          car_value, cdr_value);
+                snprintf(next, sizeof(next), "(&C_[%d])", index);
+                free(items[i]);
+            }
+            free(items);
+
+            snprintf(buf, size, "%s", next);
+            return 1;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+/* ============================================================
+ * Variables
+ * ============================================================ */
+
+/* Find a local variable; NULL for globals.  Fails on captured locals. */
+static Scope *lookup_local(FnState *fn, Scope *scope, LispObject *symbol) {
+    Scope *local = scope_find(scope, symbol);
+    if (local) return local;
+
+    /* A local of an enclosing function would have to be captured */
+    for (FnState *f = fn; f->parent != NULL; f = f->parent) {
+        if (scope_find(f->parent_scope, symbol)) {
+            fail(fn);
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void compile_global_ref(FnState *fn, LispObject *symbol, const Cont *k) {
+    int index = symbol_index(fn->cg, symbol);
+    fn->cg->uses_globals = 1;
+    emit_value(fn, k, "rt_global_lookup(&G_[%d], S_[%d])", index, index);
+}
+
+static void compile_variable(FnState *fn, LispObject *symbol, Scope *scope, const Cont *k) {
+    Scope *local = lookup_local(fn, scope, symbol);
+    if (fn->failed) return;
+
+    if (local == NULL) {
+        compile_global_ref(fn, symbol, k);
+    } else if (local->slot == SLOT_LOOP_NAME) {
+        fail(fn);   /* Loop procedure used as a value */
+    } else if (local->type == TY_NUM) {
+        emit_typed_value(fn, k, TY_NUM, "d[%d]", local->slot);
+    } else {
+        emit_value(fn, k, "f[%d]", local->slot);
+    }
+}
+
+/* Check whether an expression contains a set! (which could change a
+ * local read earlier in the same argument list) */
+static int contains_set(LispObject *expr) {
+    while (is_cons(expr)) {
+        LispObject *head = car(expr);
+        if (is_symbol_named(head, "quote")) return 0;
+        if (is_symbol_named(head, "set!")) return 1;
+        if (is_cons(head) && contains_set(head)) return 1;
+        expr = cdr(expr);
+    }
+    return 0;
+}
+
+/* C operand for an expression that needs no code: a constant or a local */
+static int simple_operand(FnState *fn, LispObject *expr, Scope *scope,
+                          char *buf, size_t size) {
+    switch (expr->type) {
+        case LISP_NIL:
+        case LISP_BOOLEAN:
+        case LISP_NUMBER:
+        case LISP_STRING:
+        case LISP_CHARACTER:
+            return constant_expr(fn->cg, expr, buf, size);
+
+        case LISP_SYMBOL: {
+            Scope *local = scope_find(scope, expr);
+            if (local == NULL || local->slot < 0 || local->type != TY_OBJ) return 0;
+            snprintf(buf, size, "f[%d]", local->slot);
+            return 1;
+        }
+
+        case LISP_CONS:
+            if (is_symbol_named(car(expr), "quote") && proper_length(cdr(expr)) == 1) {
+                return constant_expr(fn->cg, cadr(expr), buf, size);
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+/* C operand text */
+typedef struct {
+    char text[32];
+} Operand;
+
+/* Evaluate arguments to C operands, using fresh slots only where needed */
+static Operand *compile_operands(FnState *fn, LispObject *args, int argc, Scope *scope) {
+    Operand *ops = (Operand *)malloc((argc ? argc : 1) * sizeof(Operand));
+    int allow_simple = !contains_set(args);
+
+    for (int i = 0; i < argc; i++, args = cdr(args)) {
+        if (!allow_simple ||
+            !simple_operand(fn, car(args), scope, ops[i].text, sizeof(ops[i].text))) {
+            int slot = alloc_slots(fn, 1);
+            Cont ak = value_cont(slot);
+            compile_expr(fn, car(args), scope, &ak);
+            snprintf(ops[i].text, sizeof(ops[i].text), "f[%d]", slot);
+        }
+    }
+    return ops;
+}
+
+/* Append "op0, op1, ..." to a buffer */
+static void operand_list(TextBuf *tb, Operand *ops, int count) {
+    tb_append(tb, "", 0);
+    for (int i = 0; i < count; i++) {
+        tb_printf(tb, "%s%s", i ? ", " : "", ops[i].text);
+    }
+}
+
+/* Evaluate arguments into consecutive fresh slots */
+static int compile_args(FnState *fn, LispObject *args, int argc, Scope *scope) {
+    int first = alloc_slots(fn, argc);
+    for (int i = 0; i < argc; i++, args = cdr(args)) {
+        Cont ak = value_cont(first + i);
+        compile_expr(fn, car(args), scope, &ak);
+    }
+    return first;
+}
+
+/* ============================================================
+ * Unboxed values
+ * ============================================================ */
+
+static char *compile_typed(FnState *fn, LispObject *expr, Scope *scope, ValType want);
+
+/* C literal of type double for a finite number */
+static void double_literal(char *buf, size_t size, double value) {
+    snprintf(buf, size, "%.17g", value);
+    if (!strpbrk(buf, ".e")) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, size - len, ".0");
+    }
+}
+
+/* Check whether every argument is statically a number */
+static int all_numeric(FnState *fn, LispObject *args, Scope *scope) {
+    for (; is_cons(args); args = cdr(args)) {
+        if (static_type(fn, car(args), scope) != TY_NUM) return 0;
+    }
+    return 1;
+}
+
+/* Whether compiling a typed primitive call avoids boxed arithmetic */
+static int unboxes(FnState *fn, int prim, LispObject *args, Scope *scope) {
+    switch (typed_prims[prim].op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_ABS:
+        case OP_COMPARE:
+            return all_numeric(fn, args, scope);
+        default:
+            return 0;
+    }
+}
+
+/* C object expression for a primitive call */
+static void prim_call_expr(FnState *fn, TextBuf *out, const PrimitiveDef *prim,
+                           LispObject *args, int argc, Scope *scope) {
+    for (int i = 0; inline_prims[i].name != NULL; i++) {
+        if (inline_prims[i].argc == argc && strcmp(inline_prims[i].name, prim->name) == 0) {
+            Operand *ops = compile_operands(fn, args, argc, scope);
+            tb_printf(out, "%s(", inline_prims[i].c_name);
+            operand_list(out, ops, argc);
+            tb_printf(out, ")");
+            free(ops);
+            return;
+        }
+    }
+
+    int first = compile_args(fn, args, argc, scope);
+
+    TextBuf name = {0};
+    tb_c_escaped(&name, prim->name, strlen(prim->name));
+    tb_printf(out, "rt_call_prim(%s, \"%s\", %d, %d, %d, &f[%d])",
+              prim->c_name, name.data, prim->min_args, prim->max_args, argc, first);
+    tb_free(&name);
+}
+
+/* Unboxed C expression for a call of a typed primitive */
+static char *compile_typed_prim(FnState *fn, int prim, LispObject *args, int argc,
+                                Scope *scope) {
+    TextBuf out = {0};
+    TypedOp op = typed_prims[prim].op;
+    const char *c_op = typed_prims[prim].c_op;
+
+    if (unboxes(fn, prim, args, scope)) {
+        char **values = (char **)malloc((argc ? argc : 1) * sizeof(char *));
+        int literal = 0;            /* Some operand is a nonzero constant */
+        LispObject *a = args;
+        for (int i = 0; i < argc; i++, a = cdr(a)) {
+            values[i] = compile_typed(fn, car(a), scope, TY_NUM);
+            if (car(a)->type == LISP_NUMBER && car(a)->number != 0) literal = 1;
+        }
+
+        if (op == OP_ABS) {
+            tb_printf(&out, "fabs(%s)", values[0]);
+        } else if (op == OP_SUB && argc == 1) {
+            tb_printf(&out, "(-(%s))", values[0]);
+        } else if (argc == 0) {
+            tb_printf(&out, op == OP_MUL ? "1.0" : "0.0");
+        } else {
+            /* prim_add sums from 0, which turns a lone -0.0 into 0.0 */
+            tb_printf(&out, "(%s", (op == OP_ADD && !literal) ? "0.0 + " : "");
+            for (int i = 0; i < argc; i++) {
+                tb_printf(&out, "%s%s", i ? " " : "", values[i]);
+                if (i + 1 < argc) tb_printf(&out, " %s", c_op);
+            }
+            tb_printf(&out, ")");
+        }
+
+        for (int i = 0; i < argc; i++) free(values[i]);
+        free(values);
+        fn->cg->unboxed_ops++;
+        return out.data;
+    }
+
+    switch (op) {
+        case OP_NOT: {
+            char *value = compile_typed(fn, car(args), scope, TY_BOOL);
+            tb_printf(&out, "(!%s)", value);
+            free(value);
+            break;
+        }
+
+        case OP_NULL:
+        case OP_PAIR: {
+            ValType type = static_type(fn, car(args), scope);
+            if (type == TY_NUM || type == TY_BOOL) {
+                free(compile_typed(fn, car(args), scope, type));
+                tb_printf(&out, "0");
+            } else {
+                Operand *ops = compile_operands(fn, args, 1, scope);
+                if (op == OP_NULL) {
+                    tb_printf(&out, "is_nil(%s)", ops[0].text);
+                } else {
+                    tb_printf(&out, "(%s->type == LISP_CONS)", ops[0].text);
+                }
+                free(ops);
+            }
+            break;
+        }
+
+        case OP_LENGTH: {
+            Operand *ops = compile_operands(fn, args, 1, scope);
+            tb_printf(&out, "%s(%s)", c_op, ops[0].text);
+            free(ops);
+            break;
+        }
+
+        default: {
+            /* Boxed fallback: the primitive reports the error */
+            if (op == OP_COMPARE) tb_printf(&out, "(");
+            prim_call_expr(fn, &out, primitive_find(typed_prims[prim].name),
+                           args, argc, scope);
+            tb_printf(&out, op == OP_COMPARE ? " == LISP_TRUE)" : "->number");
+            break;
+        }
+    }
+    return out.data;
+}
+
+/* Compile an expression for its value as a C double (TY_NUM) or as a C
+ * truth value (TY_BOOL).  Code with effects is emitted first; the returned
+ * expression (to be freed) only reads variables. */
+static char *compile_typed(FnState *fn, LispObject *expr, Scope *scope, ValType want) {
+    TextBuf out = {0};
+    ValType type = static_type(fn, expr, scope);
+
+    if (want == TY_BOOL && (type == TY_NUM || type == TY_OBJ)) {
+        /* Truth value of a number or an arbitrary object */
+        char op[32];
+        if (type == TY_NUM) {
+            free(compile_typed(fn, expr, scope, TY_NUM));
+            tb_printf(&out, "1");
+        } else if (simple_operand(fn, expr, scope, op, sizeof(op))) {
+            tb_printf(&out, "rt_truthy(%s)", op);
+        } else {
+            int slot = alloc_slots(fn, 1);
+            Cont k = value_cont(slot);
+            compile_expr(fn, expr, scope, &k);
+            tb_printf(&out, "rt_truthy(f[%d])", slot);
+        }
+        return out.data;
+    }
+
+    if (want == TY_NUM && expr->type == LISP_NUMBER && isfinite(expr->number)) {
+        char value[40];
+        double_literal(value, sizeof(value), expr->number);
+        tb_printf(&out, "%s", value);
+        return out.data;
+    }
+    if (want == TY_BOOL && expr->type == LISP_BOOLEAN) {
+        tb_printf(&out, "%d", expr->boolean ? 1 : 0);
+        return out.data;
+    }
+    if (want == TY_NUM && is_symbol(expr)) {
+        Scope *local = scope_find(scope, expr);
+        if (local && local->type == TY_NUM) {
+            tb_printf(&out, "d[%d]", local->slot);
+            return out.data;
+        }
+    }
+    if (type == want && is_cons(expr) && is_symbol(car(expr))) {
+        int argc = proper_length(cdr(expr));
+        int prim = typed_prim(fn->cg, scope, car(expr), argc);
+        if (prim >= 0 && typed_prims[prim].result == want &&
+            lookup_local(fn, scope, car(expr)) == NULL && !fn->failed) {
+            return compile_typed_prim(fn, prim, cdr(expr), argc, scope);
+        }
+    }
+
+    /* Anything else is computed into a temporary */
+    int var = alloc_var(fn, want);
+    Cont k = typed_cont(want, var);
+    compile_expr(fn, expr, scope, &k);
+    tb_printf(&out, "%s[%d]", want == TY_NUM ? "d" : "b", var);
+    return out.data;
+}
+
+/* ============================================================
+ * Special forms
+ * ============================================================ */
+
+static void compile_quote(FnState *fn, LispObject *args, const Cont *k) {
+    char expr[32];
+    if (proper_length(args) != 1 || !constant_expr(fn->cg, car(args), expr, sizeof(expr))) {
+        fail(fn);
+        return;
+    }
+    emit_value(fn, k, "%s", expr);
+}
+
+static void compile_if(FnState *fn, LispObject *args, Scope *scope, const Cont *k) {
+    int n = proper_length(args);
+    if (n != 2 && n != 3) {
+        fail(fn);
+        return;
+    }
+
+    char *test = compile_typed(fn, car(args), scope, TY_BOOL);
+    emit_line(fn, "if (%s) {", test);
+    free(test);
+    fn->indent++;
+    compile_expr(fn, cadr(args), scope, k);
+    fn->indent--;
+    emit_line(fn, "} else {");
+    fn->indent++;
+    if (n == 3) {
+        compile_expr(fn, caddr(args), scope, k);
+    } else {
+        emit_value(fn, k, "LISP_NIL_OBJ");
+    }
+    fn->indent--;
+    emit_line(fn, "}");
+}
+
+static void compile_set(FnState *fn, LispObject *args, Scope *scope, const Cont *k) {
+    if (proper_length(args) != 2 || !is_symbol(car(args))) {
+        fail(fn);
+        return;
+    }
+
+    LispObject *var = car(args);
+    Scope *local = lookup_local(fn, scope, var);
+    if (fn->failed) return;
+    if (local && (local->slot == SLOT_LOOP_NAME || local->type != TY_OBJ)) {
+        fail(fn);
+        return;
+    }
+
+    int value = alloc_slots(fn, 1);
+    Cont vk = value_cont(value);
+    compile_expr(fn, cadr(args), scope, &vk);
+
+    if (local) {
+        emit_line(fn, "f[%d] = f[%d];", local->slot, value);
+    } else {
+        int index = symbol_index(fn->cg, var);
+        fn->cg->uses_globals = 1;
+        emit_line(fn, "rt_global_set(&G_[%d], S_[%d], f[%d]);", index, index, value);
+    }
+    emit_value(fn, k, "f[%d]", value);
+}
+
+static int compile_function(CGen *cg, CFunction *cf, LispObject *params, LispObject *body,
+                            TopFunction *self, FnState *parent, Scope *parent_scope);
+
+static void add_function(CGen *cg, CFunction *cf) {
+    if (cg->func_count >= cg->func_capacity) {
+        cg->func_capacity = cg->func_capacity ? cg->func_capacity * 2 : 32;
+        cg->funcs = (CFunction **)realloc(cg->funcs, cg->func_capacity * sizeof(CFunction *));
+    }
+    cg->funcs[cg->func_count++] = cf;
+}
+
+static void free_function(CFunction *cf) {
+    tb_free(&cf->code);
+    free(cf->lisp_name);
+    free(cf->param_kinds);
+    free(cf->guard);
+    free(cf);
+}
+
+static void compile_lambda(FnState *fn, LispObject *args, Scope *scope, const Cont *k) {
+    CGen *cg = fn->cg;
+
+    if (!is_cons(args) || !is_symbol_list(car(args))) {
+        fail(fn);
+        return;
+    }
+
+    CFunction *cf = (CFunction *)calloc(1, sizeof(CFunction));
+    int number = cg->lambda_counter++;
+    snprintf(cf->c_name, sizeof(cf->c_name), "lambda_%d", number);
+    cf->lisp_name = strdup("lambda");
+    cf->arity = proper_length(car(args));
+    cf->has_entries = 1;
+    cf->ret_kind = TY_OBJ;
+
+    if (!compile_function(cg, cf, car(args), cdr(args), NULL, fn, scope)) {
+        free_function(cf);
+        fail(fn);
+        return;
+    }
+    add_function(cg, cf);
+
+    /* A closed lambda needs no environment: one procedure object suffices */
+    int index = new_constant(cg);
+    tb_printf(&cg->const_init,
+              "    K_[%d] = make_primitive(\"lambda\", %s__prim, %d, %d);\n",
+              index, cf->c_name, cf->arity, cf->arity);
+    emit_value(fn, k, "K_[%d]", index);
+}
+
+/* Allocate a new local and compile its initial value */
+static void compile_init(FnState *fn, Scope *var, LispObject *init, Scope *scope) {
+    var->slot = alloc_var(fn, var->type);
+    if (var->type == TY_NUM) {
+        char *value = compile_typed(fn, init, scope, TY_NUM);
+        emit_line(fn, "d[%d] = %s;", var->slot, value);
+        free(value);
+    } else {
+        Cont k = value_cont(var->slot);
+        compile_expr(fn, init, scope, &k);
+    }
+}
+
+/* (let ((var init) ...) body...) and (let* ...) */
+static void compile_let(FnState *fn, LispObject *args, Scope *scope, const Cont *k,
+                        int sequential) {
+    if (!is_cons(args)) {
+        fail(fn);
+        return;
+    }
+
+    LispObject *bindings = car(args);
+    int count = proper_length(bindings);
+    if (count < 0) {
+        fail(fn);
+        return;
+    }
+
+    Scope *nodes = (Scope *)malloc((count ? count : 1) * sizeof(Scope));
+    Scope *inner = scope;
+
+    for (int i = 0; i < count; i++, bindings = cdr(bindings)) {
+        LispObject *binding = car(bindings);
+        if (proper_length(binding) != 2 || !is_symbol(car(binding))) {
+            fail(fn);
+            break;
+        }
+
+        Scope *init_scope = sequential ? inner : scope;
+        nodes[i].symbol = car(binding);
+        nodes[i].type = static_local_type(fn, cadr(binding), init_scope, args, car(binding));
+        compile_init(fn, &nodes[i], cadr(binding), init_scope);
+        nodes[i].next = inner;
+        inner = &nodes[i];
+    }
+
+    if (!fn->failed) {
+        compile_sequence(fn, cdr(args), inner, k);
+    }
+    free(nodes);
+}
+
+/* (let name ((var init) ...) body...) as a loop */
+static void compile_named_let(FnState *fn, LispObject *args, Scope *scope, const Cont *k) {
+    if (proper_length(args) < 2) {
+        fail(fn);
+        return;
+    }
+
+    LispObject *name = car(args);
+    LispObject *bindings = cadr(args);
+    int count = proper_length(bindings);
+    if (count < 0) {
+        fail(fn);
+        return;
+    }
+
+    /* Loop variables that only ever hold numbers are unboxed */
+    ValType *types = (ValType *)malloc((count ? count : 1) * sizeof(ValType));
+    for (int i = 0; i < count; i++) {
+        types[i] = TY_OBJ;
+    }
+    Infer in;
+    memset(&in, 0, sizeof(in));
+    in.cg = fn->cg;
+    in.self = fn->self;
+    infer_named_let(&in, args, scope, k->fn_tail, types);
+
+    /* Initial values are evaluated outside the loop's scope */
+    Scope *nodes = (Scope *)malloc((count + 1) * sizeof(Scope));
+    nodes[0].symbol = name;
+    nodes[0].slot = SLOT_LOOP_NAME;
+    nodes[0].type = TY_OBJ;
+    nodes[0].next = scope;
+    Scope *inner = &nodes[0];
+
+    LispObject *b = bindings;
+    for (int i = 0; i < count; i++, b = cdr(b)) {
+        LispObject *binding = car(b);
+        if (proper_length(binding) != 2 || !is_symbol(car(binding))) {
+            fail(fn);
+            free(types);
+            free(nodes);
+            return;
+        }
+        nodes[i + 1].symbol = car(binding);
+        nodes[i + 1].type = types[i];
+        compile_init(fn, &nodes[i + 1], cadr(binding), scope);
+        nodes[i + 1].next = inner;
+        inner = &nodes[i + 1];
+    }
+    free(types);
+
+    LoopInfo loop;
+    loop.name = name;
+    loop.vars = &nodes[1];
+    loop.var_count = count;
+    loop.label = new_label(fn);
+
+    Cont bk = *k;
+    bk.loop = &loop;
+    int end_label = -1;
+    if (k->exit == EXIT_NONE) {
+        end_label = new_label(fn);
+        bk.exit = end_label;
+    }
+
+    /* Compile the body separately: the loop label is only emitted if used */
+    TextBuf body = {0};
+    TextBuf *saved = fn->out;
+    fn->out = &body;
+    compile_sequence(fn, cddr(args), inner, &bk);
+    fn->out = saved;
+
+    if (!fn->failed) {
+        if (label_is_used(fn, loop.label)) {
+            emit_line(fn, "L%d:", loop.label);
+        }
+        tb_append(fn->out, body.data, body.length);
+        if (end_label > 0 && label_is_used(fn, end_label)) {
+            emit_line(fn, "L%d:;", end_label);
+        }
+    }
+
+    tb_free(&body);
+    free(nodes);
+}
+
+static void compile_cond(FnState *fn, LispObject *clauses, Scope *scope, const Cont *k) {
+    if (is_nil(clauses)) {
+        emit_value(fn, k, "LISP_NIL_OBJ");
+        return;
+    }
+
+    LispObject *clause = car(clauses);
+    if (!is_cons(clause) || proper_length(clause) < 1 || !is_cons(clauses)) {
+        fail(fn);
+        return;
+    }
+
+    LispObject *test = car(clause);
+    if (is_symbol_named(test, "else")) {
+        compile_sequence(fn, cdr(clause), scope, k);
+        return;
+    }
+    if (is_cons(cdr(clause)) && is_symbol_named(cadr(clause), "=>")) {
+        fail(fn);
+        return;
+    }
+
+    if (is_nil(cdr(clause))) {
+        /* (cond (test) ...) yields the test's value */
+        int value = alloc_slots(fn, 1);
+        Cont tk = value_cont(value);
+        compile_expr(fn, test, scope, &tk);
+
+        emit_line(fn, "if (rt_truthy(f[%d])) {", value);
+        fn->indent++;
+        emit_value(fn, k, "f[%d]", value);
+    } else {
+        char *value = compile_typed(fn, test, scope, TY_BOOL);
+        emit_line(fn, "if (%s) {", value);
+        free(value);
+        fn->indent++;
+        compile_sequence(fn, cdr(clause), scope, k);
+    }
+    fn->indent--;
+    emit_line(fn, "} else {");
+    fn->indent++;
+    compile_cond(fn, cdr(clauses), scope, k);
+    fn->indent--;
+    emit_line(fn, "}");
+}
+
+/* (and ...) / (or ...): all but the last operand short-circuit */
+static void compile_and_or(FnState *fn, LispObject *args, Scope *scope, const Cont *k,
+                           int is_and) {
+    int count = proper_length(args);
+    if (count < 0) {
+        fail(fn);
+        return;
+    }
+    if (count == 0) {
+        emit_value(fn, k, is_and ? "LISP_TRUE" : "LISP_FALSE");
+        return;
+    }
+
+    int depth = 0;
+    for (int i = 0; i < count - 1; i++, args = cdr(args)) {
+        int value = alloc_slots(fn, 1);
+        Cont vk = value_cont(value);
+        compile_expr(fn, car(args), scope, &vk);
+
+        emit_line(fn, "if (%srt_truthy(f[%d])) {", is_and ? "!" : "", value);
+        fn->indent++;
+        if (is_and) {
+            emit_value(fn, k, "LISP_FALSE");
+        } else {
+            emit_value(fn, k, "f[%d]", value);
+        }
+        fn->indent--;
+        emit_line(fn, "} else {");
+        fn->indent++;
+        depth++;
+    }
+
+    if (is_and) {
+        compile_expr(fn, car(args), scope, k);
+    } else {
+        /* (or ... x) yields #f rather than x when x is false */
+        int value = alloc_slots(fn, 1);
+        Cont vk = value_cont(value);
+        compile_expr(fn, car(args), scope, &vk);
+        emit_value(fn, k, "rt_truthy(f[%d]) ? f[%d] : LISP_FALSE", value, value);
+    }
+
+    while (depth-- > 0) {
+        fn->indent--;
+        emit_line(fn, "}");
+    }
+}
+
+static void compile_when(FnState *fn, LispObject *args, Scope *scope, const Cont *k,
+                         int is_when) {
+    if (proper_length(args) < 1) {
+        fail(fn);
+        return;
+    }
+
+    char *test = compile_typed(fn, car(args), scope, TY_BOOL);
+    emit_line(fn, is_when ? "if (%s) {" : "if (!%s) {", test);
+    free(test);
+    fn->indent++;
+    compile_sequence(fn, cdr(args), scope, k);
+    fn->indent--;
+    emit_line(fn, "} else {");
+    fn->indent++;
+    emit_value(fn, k, "LISP_NIL_OBJ");
+    fn->indent--;
+    emit_line(fn, "}");
+}
+
+/* ============================================================
+ * Calls
+ * ============================================================ */
+
+/* Rebind variables in parallel: evaluate every new value first */
+static void compile_rebind(FnState *fn, Scope *vars, int count, LispObject *args,
+                           Scope *scope) {
+    int *temps = (int *)malloc((count ? count : 1) * sizeof(int));
+    for (int i = 0; i < count; i++, args = cdr(args)) {
+        temps[i] = alloc_var(fn, vars[i].type);
+        if (vars[i].type == TY_NUM) {
+            char *value = compile_typed(fn, car(args), scope, TY_NUM);
+            emit_line(fn, "d[%d] = %s;", temps[i], value);
+            free(value);
+        } else {
+            Cont ak = value_cont(temps[i]);
+            compile_expr(fn, car(args), scope, &ak);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const char *name = vars[i].type == TY_NUM ? "d" : "f";
+        emit_line(fn, "%s[%d] = %s[%d];", name, vars[i].slot, name, temps[i]);
+    }
+    free(temps);
+}
+
+static void compile_loop_jump(FnState *fn, LoopInfo *loop, LispObject *args, Scope *scope) {
+    compile_rebind(fn, loop->vars, loop->var_count, args, scope);
+    mark_label(fn, loop->label);
+    emit_line(fn, "goto L%d;", loop->label);
+}
+
+/* Call the specialized version of a function if the arguments fit */
+static int compile_specialized_call(FnState *fn, TopFunction *def, LispObject *args,
+                                    Scope *scope, const Cont *k) {
+    LispObject *a = args;
+    for (int i = 0; i < def->arity; i++, a = cdr(a)) {
+        if (param_kind(def, i) == TY_NUM) {
+            ValType type = static_type(fn, car(a), scope);
+            if (type != TY_NUM && type != TY_NONE) return 0;
+        }
+    }
+
+    TextBuf call = {0};
+    int allow_simple = !contains_set(args);
+    tb_printf(&call, "%s__spec(", def->c_name);
+    for (int i = 0; i < def->arity; i++, args = cdr(args)) {
+        char op[32];
+        if (i) tb_printf(&call, ", ");
+        if (param_kind(def, i) == TY_NUM) {
+            char *value = compile_typed(fn, car(args), scope, TY_NUM);
+            tb_printf(&call, "%s", value);
+            free(value);
+        } else if (allow_simple && simple_operand(fn, car(args), scope, op, sizeof(op))) {
+            tb_printf(&call, "%s", op);
+        } else {
+            int slot = alloc_slots(fn, 1);
+            Cont ak = value_cont(slot);
+            compile_expr(fn, car(args), scope, &ak);
+            tb_printf(&call, "f[%d]", slot);
+        }
+    }
+    tb_printf(&call, ")");
+
+    ValType kind = result_kind(def);
+    if (kind == TY_OBJ) {
+        emit_value(fn, k, "rt_run(%s)", call.data);
+    } else {
+        emit_typed_value(fn, k, kind, "%s", call.data);
+    }
+    tb_free(&call);
+    return 1;
+}
+
+static void compile_direct_call(FnState *fn, TopFunction *def, LispObject *args,
+                                Scope *scope, const Cont *k) {
+    if (k->fn_tail && fn->self == def) {
+        /* Self tail call: rebind the parameters and jump */
+        compile_rebind(fn, fn->params, def->arity, args, scope);
+        fn->uses_top = 1;
+        emit_line(fn, "goto top;");
+        return;
+    }
+
+    int trampoline = k->fn_tail && k->kind == TY_OBJ && def->arity <= RT_MAX_TAIL_ARGS;
+    if (!trampoline && is_specialized(def) &&
+        compile_specialized_call(fn, def, args, scope, k)) {
+        return;
+    }
+
+    Operand *ops = compile_operands(fn, args, def->arity, scope);
+
+    if (trampoline) {
+        /* Tail call: hand it to the trampoline of our caller */
+        for (int i = 0; i < def->arity; i++) {
+            emit_line(fn, "rt_tail.argv[%d] = %s;", i, ops[i].text);
+        }
+        emit_line(fn, "rt_tail.fn = %s__tc;", def->c_name);
+        emit_line(fn, "ret = RT_TAIL_MARK;");
+        emit_line(fn, "goto out;");
+        fn->uses_out = 1;
+        def->tail_called = 1;
+    } else {
+        TextBuf call = {0};
+        operand_list(&call, ops, def->arity);
+        emit_value(fn, k, "rt_run(%s(%s))", def->c_name, call.data);
+        tb_free(&call);
+    }
+    free(ops);
+}
+
+static void compile_prim_call(FnState *fn, const PrimitiveDef *prim, LispObject *args,
+                              int argc, Scope *scope, const Cont *k) {
+    TextBuf call = {0};
+    prim_call_expr(fn, &call, prim, args, argc, scope);
+    emit_value(fn, k, "%s", call.data);
+    tb_free(&call);
+}
+
+static void compile_call(FnState *fn, LispObject *expr, Scope *scope, const Cont *k) {
+    LispObject *head = car(expr);
+    LispObject *args = cdr(expr);
+    int argc = proper_length(args);
+    if (argc < 0) {
+        fail(fn);
+        return;
+    }
+
+    if (is_symbol(head)) {
+        Scope *local = lookup_local(fn, scope, head);
+        if (fn->failed) return;
+
+        if (local && local->slot == SLOT_LOOP_NAME) {
+            if (k->loop && k->loop->name == head && argc == k->loop->var_count) {
+                compile_loop_jump(fn, k->loop, args, scope);
+            } else {
+                fail(fn);
+            }
+            return;
+        }
+
+        if (local == NULL) {
+            int typed = typed_prim(fn->cg, scope, head, argc);
+            if (typed >= 0 && (k->kind != TY_OBJ || unboxes(fn, typed, args, scope))) {
+                char *value = compile_typed_prim(fn, typed, args, argc, scope);
+                emit_typed_value(fn, k, typed_prims[typed].result, "%s", value);
+                free(value);
+                return;
+            }
+
+            TopFunction *def = find_known(fn->cg, head);
+            if (def && def->arity == argc) {
+                compile_direct_call(fn, def, args, scope, k);
+                return;
+            }
+
+            const PrimitiveDef *prim = primitive_find(head->symbol.name);
+            if (prim && bound_name_count(fn->cg, head) == 0) {
+                compile_prim_call(fn, prim, args, argc, scope, k);
+                return;
+            }
+        }
+    }
+
+    /* Generic call through the procedure object */
+    int func = alloc_slots(fn, 1);
+    Cont fk = value_cont(func);
+    compile_expr(fn, head, scope, &fk);
+    int first = compile_args(fn, args, argc, scope);
+    emit_value(fn, k, "rt_call(f[%d], %d, &f[%d])", func, argc, first);
+}
+
+/* ============================================================
+ * Expressions
+ * ============================================================ */
+
+static void compile_form(FnState *fn, LispObject *expr, Scope *scope, const Cont *k) {
+    LispObject *head = car(expr);
+    LispObject *args = cdr(expr);
+
+    if (is_symbol(head)) {
+        const char *name = head->symbol.name;
+
+        if (is_macro_name(fn->cg, head)) {
+            fail(fn);
+            return;
+        }
+
+        if (eval_is_special_form(name)) {
+            if (strcmp(name, "quote") == 0) {
+                compile_quote(fn, args, k);
+            } else if (strcmp(name, "if") == 0) {
+                compile_if(fn, args, scope, k);
+            } else if (strcmp(name, "set!") == 0) {
+                compile_set(fn, args, scope, k);
+            } else if (strcmp(name, "lambda") == 0) {
+                compile_lambda(fn, args, scope, k);
+            } else if (strcmp(name, "begin") == 0) {
+                compile_sequence(fn, args, scope, k);
+            } else if (strcmp(name, "let") == 0) {
+                if (is_cons(args) && is_symbol(car(args))) {
+                    compile_named_let(fn, args, scope, k);
+                } else {
+                    compile_let(fn, args, scope, k, 0);
+                }
+            } else if (strcmp(name, "let*") == 0) {
+                compile_let(fn, args, scope, k, 1);
+            } else if (strcmp(name, "cond") == 0) {
+                compile_cond(fn, args, scope, k);
+            } else if (strcmp(name, "and") == 0) {
+                compile_and_or(fn, args, scope, k, 1);
+            } else if (strcmp(name, "or") == 0) {
+                compile_and_or(fn, args, scope, k, 0);
+            } else if (strcmp(name, "when") == 0) {
+                compile_when(fn, args, scope, k, 1);
+            } else if (strcmp(name, "unless") == 0) {
+                compile_when(fn, args, scope, k, 0);
+            } else {
+                fail(fn);   /* Left to the interpreter */
+            }
+            return;
+        }
+    }
+
+    compile_call(fn, expr, scope, k);
+}
+
+static void compile_expr(FnState *fn, LispObject *expr, Scope *scope, const Cont *k) {
+    if (fn->failed) return;
+
+    switch (expr->type) {
+        case LISP_NIL:
+            emit_value(fn, k, "LISP_NIL_OBJ");
+            break;
+
+        case LISP_BOOLEAN:
+            if (k->kind == TY_BOOL) {
+                emit_typed_value(fn, k, TY_BOOL, "%d", expr->boolean ? 1 : 0);
+            } else {
+                emit_value(fn, k, "%s", expr->boolean ? "LISP_TRUE" : "LISP_FALSE");
+            }
+            break;
+
+        case LISP_NUMBER:
+            if (k->kind != TY_OBJ && isfinite(expr->number)) {
+                char value[40];
+                double_literal(value, sizeof(value), expr->number);
+                emit_typed_value(fn, k, TY_NUM, "%s", value);
+                break;
+            }
+            /* fall through */
+        case LISP_STRING:
+        case LISP_CHARACTER: {
+            char value[32];
+            if (!constant_expr(fn->cg, expr, value, sizeof(value))) {
+                fail(fn);
+                return;
+            }
+            emit_value(fn, k, "%s", value);
+            break;
+        }
+
+        case LISP_SYMBOL:
+            compile_variable(fn, expr, scope, k);
+            break;
+
+        case LISP_CONS:
+            compile_form(fn, expr, scope, k);
+            break;
+
+        default:
+            fail(fn);
+            break;
+    }
+}
+
+static void compile_sequence(FnState *fn, LispObject *body, Scope *scope, const Cont *k) {
+    if (is_nil(body)) {
+        emit_value(fn, k, "LISP_NIL_OBJ");
+        return;
+    }
+    if (proper_length(body) < 0) {
+        fail(fn);
+        return;
+    }
+
+    while (is_cons(cdr(body))) {
+        int scratch = alloc_slots(fn, 1);
+        Cont sk = value_cont(scratch);
+        compile_expr(fn, car(body), scope, &sk);
+        body = cdr(body);
+    }
+    compile_expr(fn, car(body), scope, k);
+}
+
+/* ============================================================
+ * Functions
+ * ============================================================ */
+
+static const char *c_type(ValType kind) {
+    return kind == TY_NUM ? "double " : kind == TY_BOOL ? "int " : "LispObject *";
+}
+
+/* Write "static <type>name(<params>)" for a compiled function */
+static void function_header(TextBuf *tb, CFunction *cf) {
+    tb_printf(tb, "static %s%s(", c_type(cf->ret_kind), cf->c_name);
+    for (int i = 0; i < cf->arity; i++) {
+        ValType kind = cf->param_kinds ? cf->param_kinds[i] : TY_OBJ;
+        tb_printf(tb, "%s%sa%d", i ? ", " : "", c_type(kind), i);
+    }
+    tb_printf(tb, "%s)", cf->arity ? "" : "void");
+}
+
+/* Compile a procedure body into cf->code; returns 0 if unsupported */
+static int compile_function(CGen *cg, CFunction *cf, LispObject *params, LispObject *body,
+                            TopFunction *self, FnState *parent, Scope *parent_scope) {
+    FnState fn;
+    TextBuf text = {0};
+
+    memset(&fn, 0, sizeof(fn));
+    fn.cg = cg;
+    fn.out = &text;
+    fn.indent = 1;
+    fn.self = self;
+    fn.parent = parent;
+    fn.parent_scope = parent_scope;
+
+    /* Object parameters take the first frame slots, numbers the first d[] */
+    int arity = cf->arity;
+    Scope *nodes = (Scope *)malloc((arity ? arity : 1) * sizeof(Scope));
+    Scope *scope = NULL;
+    LispObject *p = params;
+    for (int i = 0; i < arity; i++, p = cdr(p)) {
+        nodes[i].symbol = car(p);
+        nodes[i].type = cf->param_kinds ? cf->param_kinds[i] : TY_OBJ;
+        nodes[i].slot = alloc_var(&fn, nodes[i].type);
+        nodes[i].next = scope;
+        scope = &nodes[i];
+    }
+    fn.params = nodes;
+    int object_params = fn.slot_count;
+    int number_params = fn.dvar_count;
+
+    Cont k = typed_cont(cf->ret_kind, DST_RET);
+    k.fn_tail = 1;
+    k.exit = EXIT_OUT;
+    compile_sequence(&fn, body, scope, &k);
+
+    int ok = !fn.failed;
+    if (ok) {
+        TextBuf *code = &cf->code;
+
+        function_header(code, cf);
+        tb_printf(code, " {\n");
+        tb_printf(code, "    if (rt_stack_exhausted()) {\n");
+        tb_printf(code, "        rt_stack_error();\n");
+        tb_printf(code, "        return %s;\n",
+                  cf->ret_kind == TY_NUM ? "0.0" : cf->ret_kind == TY_BOOL ? "0" : "make_nil()");
+        tb_printf(code, "    }\n");
+        if (cf->guard) {
+            tb_printf(code, "%s", cf->guard);
+        }
+
+        if (fn.slot_count) {
+            tb_printf(code, "    LispObject *f[%d] = {", fn.slot_count);
+            for (int i = 0, n = 0; i < arity; i++) {
+                if (nodes[i].type == TY_OBJ) tb_printf(code, "%sa%d", n++ ? ", " : "", i);
+            }
+            tb_printf(code, "%s};\n", object_params ? "" : "NULL");
+        }
+        if (fn.dvar_count) {
+            tb_printf(code, "    double d[%d] = {", fn.dvar_count);
+            for (int i = 0, n = 0; i < arity; i++) {
+                if (nodes[i].type == TY_NUM) tb_printf(code, "%sa%d", n++ ? ", " : "", i);
+            }
+            tb_printf(code, "%s};\n", number_params ? "" : "0.0");
+        }
+        if (fn.bvar_count) {
+            tb_printf(code, "    int b[%d] = {0};\n", fn.bvar_count);
+        }
+        if (cf->ret_kind == TY_NUM) {
+            tb_printf(code, "    double dret = 0.0;\n");
+        } else if (cf->ret_kind == TY_BOOL) {
+            tb_printf(code, "    int bret = 0;\n");
+        } else {
+            tb_printf(code, "    LispObject *ret = NULL;\n");
+        }
+        if (fn.slot_count) {
+            tb_printf(code, "    GCFrame gcf;\n\n");
+            tb_printf(code, "    gc_push_frame(&gcf, f, %d);\n", fn.slot_count);
+        } else {
+            tb_printf(code, "\n");
+        }
+        if (fn.uses_top) {
+            tb_printf(code, "top:\n");
+        }
+        tb_append(code, text.data, text.length);
+        if (fn.uses_out) {
+            tb_printf(code, "out:\n");
+        }
+        if (fn.slot_count) {
+            tb_printf(code, "    gc_pop_frame(&gcf);\n");
+        }
+        tb_printf(code, "    return %s;\n",
+                  cf->ret_kind == TY_NUM ? "dret" : cf->ret_kind == TY_BOOL ? "bret" : "ret");
+        tb_printf(code, "}\n\n");
+    }
+
+    tb_free(&text);
+    free(fn.label_used);
+    free(nodes);
+    return ok;
+}
+
+/* "return <call of the specialized version>;" with boxed arguments */
+static void specialized_return(TextBuf *tb, TopFunction *def, const char *indent) {
+    ValType kind = result_kind(def);
+    TextBuf call = {0};
+
+    tb_printf(&call, "%s__spec(", def->c_name);
+    for (int i = 0; i < def->arity; i++) {
+        tb_printf(&call, "%sa%d%s", i ? ", " : "", i,
+                  param_kind(def, i) == TY_NUM ? "->number" : "");
+    }
+    tb_printf(&call, ")");
+
+    if (kind == TY_NUM) {
+        tb_printf(tb, "%sreturn make_number(%s);\n", indent, call.data);
+    } else if (kind == TY_BOOL) {
+        tb_printf(tb, "%sreturn %s ? LISP_TRUE : LISP_FALSE;\n", indent, call.data);
+    } else {
+        tb_printf(tb, "%sreturn %s;\n", indent, call.data);
+    }
+    tb_free(&call);
+}
+
+/* Compile a known function: a specialized version if types allow, and
+ * the entry used by procedure objects and unspecialized calls */
+static int compile_known_function(CGen *cg, TopFunction *def, CFunction *cf) {
+    if (!is_specialized(def)) {
+        return compile_function(cg, cf, def->params, def->body, def, NULL, NULL);
+    }
+
+    CFunction *spec = (CFunction *)calloc(1, sizeof(CFunction));
+    snprintf(spec->c_name, sizeof(spec->c_name), "%.56s__spec", def->c_name);
+    spec->lisp_name = strdup(cf->lisp_name);
+    spec->arity = def->arity;
+    spec->ret_kind = result_kind(def);
+    spec->param_kinds = (ValType *)malloc((def->arity ? def->arity : 1) * sizeof(ValType));
+    for (int i = 0; i < def->arity; i++) {
+        spec->param_kinds[i] = param_kind(def, i);
+    }
+    if (!compile_function(cg, spec, def->params, def->body, def, NULL, NULL)) {
+        free_function(spec);
+        return 0;
+    }
+
+    /* Guard: numeric parameters must hold numbers */
+    TextBuf guard = {0};
+    int checks = 0;
+    for (int i = 0; i < def->arity; i++) {
+        if (param_kind(def, i) != TY_NUM) continue;
+        tb_printf(&guard, "%sa%d->type == LISP_NUMBER", checks++ ? " && " : "    if (", i);
+    }
+
+    if (checks == 0) {
+        /* Only the result is specialized: box it */
+        function_header(&cf->code, cf);
+        tb_printf(&cf->code, " {\n");
+        specialized_return(&cf->code, def, "    ");
+        tb_printf(&cf->code, "}\n\n");
+        tb_free(&guard);
+    } else {
+        tb_printf(&guard, ") {\n");
+        specialized_return(&guard, def, "        ");
+        tb_printf(&guard, "    }\n");
+        cf->guard = guard.data;
+        if (!compile_function(cg, cf, def->params, def->body, def, NULL, NULL)) {
+            free_function(spec);
+            return 0;
+        }
+    }
+
+    add_function(cg, spec);
+    cg->specialized_functions++;
+    return 1;
+}
+
+/* ============================================================
+ * Top level
+ * ============================================================ */
+
+/* Keep a form's source text for the interpreter */
+static void emit_interpreted(CGen *cg, TopForm *top) {
+    int index = cg->source_count++;
+    tb_printf(&cg->sources, "static const char *const src_%d[] = {\n", index);
+
+    /* Split into pieces well below the portable string literal limit */
+    size_t pos = 0;
+    while (pos < top->source_length) {
+        size_t len = top->source_length - pos;
+        if (len > 1000) len = 1000;
+        tb_printf(&cg->sources, "    \"");
+        tb_c_escaped(&cg->sources, top->source + pos, len);
+        tb_printf(&cg->sources, "\",\n");
+        pos += len;
+    }
+    tb_printf(&cg->sources, "    NULL\n};\n\n");
+
+    tb_printf(&cg->toplevel, "    rt_eval_source(src_%d);\n", index);
+}
+
+static TopFunction *find_def(CGen *cg, LispObject *name) {
+    for (int i = 0; i < cg->def_count; i++) {
+        if (cg->defs[i].name == name) return &cg->defs[i];
+    }
+    return NULL;
+}
+
+static void compile_toplevel_form(CGen *cg, TopForm *top) {
+    LispObject *form = top->form;
+    int func_mark = cg->func_count;
+    size_t const_mark = cg->const_init.length;
+    int const_count_mark = cg->const_count;
+    size_t objects_mark = cg->static_objects.length;
+    size_t strings_mark = cg->static_strings.length;
+    int static_count_mark = cg->static_count;
+    int number_mark = cg->number_count;
+
+    FnState fn;
+    TextBuf text = {0};
+    memset(&fn, 0, sizeof(fn));
+    fn.cg = cg;
+    fn.out = &text;
+    fn.indent = 2;
+
+    if (is_cons(form) && is_symbol_named(car(form), "define") && is_cons(cdr(form))) {
+        LispObject *target = cadr(form);
+
+        if (is_cons(target)) {
+            /* (define (name params...) body...) */
+            TopFunction *def = is_symbol(car(target)) ? find_def(cg, car(target)) : NULL;
+            if (def && def->known) {
+                CFunction *cf = (CFunction *)calloc(1, sizeof(CFunction));
+                memcpy(cf->c_name, def->c_name, sizeof(cf->c_name));
+                cf->lisp_name = strdup(def->name->symbol.name);
+                cf->arity = def->arity;
+                cf->tail_called = &def->tail_called;
+                cf->has_entries = 1;
+                cf->ret_kind = TY_OBJ;
+
+                if (compile_known_function(cg, def, cf)) {
+                    add_function(cg, cf);
+                    int index = symbol_index(cg, def->name);
+                    tb_printf(&text, "        rt_global_define(S_[%d], "
+                              "make_primitive(\"", index);
+                    tb_c_escaped(&text, cf->lisp_name, strlen(cf->lisp_name));
+                    tb_printf(&text, "\", %s__prim, %d, %d));\n",
+                              cf->c_name, cf->arity, cf->arity);
+                    cg->compiled_functions++;
+                } else {
+                    free_function(cf);
+                    def->known = 0;
+                    cg->changed = 1;
+                    fail(&fn);
+                }
+            } else {
+                fail(&fn);
+            }
+        } else if (is_symbol(target) && proper_length(cdr(form)) == 2) {
+            /* (define var value) */
+            int value = alloc_slots(&fn, 1);
+            Cont vk = value_cont(value);
+            compile_expr(&fn, caddr(form), NULL, &vk);
+            int index = symbol_index(cg, target);
+            emit_line(&fn, "rt_global_define(S_[%d], f[%d]);", index, value);
+        } else {
+            fail(&fn);
+        }
+    } else {
+        int value = alloc_slots(&fn, 1);
+        Cont vk = value_cont(value);
+        compile_expr(&fn, form, NULL, &vk);
+    }
+
+    if (fn.failed) {
+        /* Roll back anything generated for this form */
+        for (int i = func_mark; i < cg->func_count; i++) {
+            free_function(cg->funcs[i]);
+        }
+        cg->func_count = func_mark;
+        tb_truncate(&cg->const_init, const_mark);
+        cg->const_count = const_count_mark;
+        tb_truncate(&cg->static_objects, objects_mark);
+        tb_truncate(&cg->static_strings, strings_mark);
+        cg->static_count = static_count_mark;
+        cg->number_count = number_mark;
+        emit_interpreted(cg, top);
+    } else {
+        tb_printf(&cg->toplevel, "    {\n");
+        tb_append(&cg->toplevel, text.data ? text.data : "", text.length);
+        tb_printf(&cg->toplevel, "    }\n");
+        if (fn.slot_count > cg->toplevel_slots) {
+            cg->toplevel_slots = fn.slot_count;
+        }
+        if (fn.dvar_count > cg->toplevel_dvars) {
+            cg->toplevel_dvars = fn.dvar_count;
+        }
+        if (fn.bvar_count > cg->toplevel_bvars) {
+            cg->toplevel_bvars = fn.bvar_count;
+        }
+        cg->compiled_forms++;
+    }
+
+    tb_free(&text);
+    free(fn.label_used);
+}
+
+/* Reset per-round output */
+static void reset_round(CGen *cg) {
+    for (int i = 0; i < cg->func_count; i++) {
+        free_function(cg->funcs[i]);
+    }
+    cg->func_count = 0;
+    cg->symbol_count = 0;
+    cg->uses_globals = 0;
+    tb_truncate(&cg->const_init, 0);
+    cg->const_count = 0;
+    tb_truncate(&cg->static_objects, 0);
+    tb_truncate(&cg->static_strings, 0);
+    cg->static_count = 0;
+    cg->number_count = 0;
+    tb_truncate(&cg->sources, 0);
+    cg->source_count = 0;
+    tb_truncate(&cg->toplevel, 0);
+    cg->toplevel_slots = 0;
+    cg->toplevel_dvars = 0;
+    cg->toplevel_bvars = 0;
+    cg->label_counter = 0;
+    cg->lambda_counter = 0;
+    cg->changed = 0;
+    cg->compiled_forms = 0;
+    cg->compiled_functions = 0;
+    cg->specialized_functions = 0;
+    cg->unboxed_ops = 0;
+    for (int i = 0; i < cg->def_count; i++) {
+        cg->defs[i].tail_called = 0;
+    }
+}
+
+static int primitive_total(void) {
+    int count = 0;
+    while (primitive_defs[count].name != NULL) count++;
+    return count;
+}
+
+/* Drop definitions nothing refers to and find the primitives the
+ * remaining forms refer to by name */
+static void remove_unreachable(CGen *cg) {
+    LispObject **forms = (LispObject **)calloc(
+        (size_t)(cg->form_count > 0 ? cg->form_count : 1), sizeof(LispObject *));
+    for (int i = 0; i < cg->form_count; i++) {
+        forms[i] = cg->forms[i].form;
+    }
+
+    Reachability reach;
+    reachability_analyze(&reach, forms, cg->form_count);
+    free(forms);
+
+    int kept = 0;
+    for (int i = 0; i < cg->form_count; i++) {
+        if (reach.live[i]) cg->forms[kept++] = cg->forms[i];
+    }
+    cg->form_count = kept;
+    cg->removed_forms = reach.removed;
+
+    cg->primitives = (const PrimitiveDef **)malloc(
+        (size_t)(reach.symbol_count > 0 ? reach.symbol_count : 1) *
+        sizeof(const PrimitiveDef *));
+    for (int i = 0; i < reach.symbol_count; i++) {
+        const PrimitiveDef *prim = primitive_find(reach.symbols[i]->symbol.name);
+        if (prim) cg->primitives[cg->primitive_count++] = prim;
+    }
+
+    reachability_free(&reach);
+}
+
+/* Find top-level functions that can be called directly */
+static void collect_functions(CGen *cg) {
+    for (int i = 0; i < cg->form_count; i++) {
+        scan_bindings(cg, cg->forms[i].form);
+    }
+
+    cg->defs = (TopFunction *)calloc((size_t)(cg->form_count > 0 ? cg->form_count : 1),
+                                     sizeof(TopFunction));
+    for (int i = 0; i < cg->form_count; i++) {
+        LispObject *form = cg->forms[i].form;
+        if (!is_cons(form) || !is_symbol_named(car(form), "define")) continue;
+        if (!is_cons(cdr(form)) || !is_cons(cadr(form))) continue;
+
+        LispObject *name = car(cadr(form));
+        LispObject *params = cdr(cadr(form));
+        if (!is_symbol(name) || !is_symbol_list(params)) continue;
+
+        /* Defined once and never assigned: calls may bind to it statically */
+        if (bound_name_count(cg, name) != 1) continue;
+
+        TopFunction *def = &cg->defs[cg->def_count];
+        def->name = name;
+        def->params = params;
+        def->body = cddr(form);
+        def->arity = proper_length(params);
+        def->known = 1;
+        c_identifier(def->c_name, sizeof(def->c_name), "fn_", cg->def_count,
+                     name->symbol.name);
+        cg->def_count++;
+    }
+}
+
+/* ============================================================
+ * Output
+ * ============================================================ */
+
+static void write_program(CGen *cg, FILE *out, const char *input_name) {
+    int symbol_slots = cg->symbol_count ? cg->symbol_count : 1;
+    int const_slots = cg->const_count ? cg->const_count : 1;
+    int top_slots = cg->toplevel_slots ? cg->toplevel_slots : 1;
+
+    fprintf(out, "/*\n");
+    fprintf(out, " * Generated by the Lisp compiler C backend from %s\n", input_name);
+    fprintf(out, " * Build: cc -O2 -I<LispCompiler/src> <this file> -llispcore -lm\n");
+    fprintf(out, " */\n\n");
+    fprintf(out, "#include \"lisp_rt.h\"\n\n");
+
+    /* Symbols, global binding caches and constants */
+    fprintf(out, "#define SYMBOL_COUNT %d\n\n", cg->symbol_count);
+    fprintf(out, "static const char *const symbol_names[%d] = {\n", symbol_slots);
+    for (int i = 0; i < cg->symbol_count; i++) {
+        TextBuf name = {0};
+        const char *s = cg->symbols[i]->symbol.name;
+        tb_c_escaped(&name, s, strlen(s));
+        fprintf(out, "    \"%s\",\n", name.data ? name.data : "");
+        tb_free(&name);
+    }
+    if (cg->symbol_count == 0) fprintf(out, "    NULL\n");
+    fprintf(out, "};\n\n");
+    fprintf(out, "static LispObject *S_[%d];\n", symbol_slots);
+    if (cg->uses_globals) {
+        fprintf(out, "static Binding *G_[%d];\n", symbol_slots);
+    }
+    fprintf(out, "static LispObject *K_[%d];\n\n", const_slots);
+
+    /* Quoted data, never traced or freed by the collector */
+    if (cg->static_count) {
+        if (cg->static_strings.length) {
+            fwrite(cg->static_strings.data, 1, cg->static_strings.length, out);
+            fprintf(out, "\n");
+        }
+        fprintf(out, "static LispObject C_[%d] = {\n", cg->static_count);
+        fwrite(cg->static_objects.data, 1, cg->static_objects.length, out);
+        fprintf(out, "};\n\n");
+    }
+
+    /* Primitives bound in the global environment: the ones the program
+     * refers to by name (direct calls do not go through the binding) */
+    fprintf(out, "static const PrimitiveDef primitives[] = {\n");
+    for (int i = 0; i < cg->primitive_count; i++) {
+        const PrimitiveDef *prim = cg->primitives[i];
+        TextBuf name = {0};
+        tb_c_escaped(&name, prim->name, strlen(prim->name));
+        fprintf(out, "    {\"%s\", %s, %d, %d, \"%s\"},\n", name.data,
+                prim->c_name, prim->min_args, prim->max_args, prim->c_name);
+        tb_free(&name);
+    }
+    fprintf(out, "    {NULL, NULL, 0, 0, NULL}\n");
+    fprintf(out, "};\n\n");
+
+    /* Prototypes */
+    for (int i = 0; i < cg->func_count; i++) {
+        CFunction *cf = cg->funcs[i];
+        TextBuf header = {0};
+        function_header(&header, cf);
+        fprintf(out, "%s;\n", header.data);
+        tb_free(&header);
+        if (!cf->has_entries) continue;
+        fprintf(out, "static LispObject *%s__prim(LispObject *args);\n", cf->c_name);
+        if (cf->tail_called && *cf->tail_called) {
+            fprintf(out, "static LispObject *%s__tc(LispObject **argv);\n", cf->c_name);
+        }
+    }
+    if (cg->func_count) fprintf(out, "\n");
+
+    /* Interpreted forms */
+    if (cg->sources.length) fwrite(cg->sources.data, 1, cg->sources.length, out);
+
+    /* Functions and their entry points */
+    for (int i = 0; i < cg->func_count; i++) {
+        CFunction *cf = cg->funcs[i];
+        fwrite(cf->code.data, 1, cf->code.length, out);
+        if (!cf->has_entries) continue;
+
+        /* Entry used by procedure objects */
+        fprintf(out, "static LispObject *%s__prim(LispObject *args) {\n", cf->c_name);
+        for (int j = 0; j < cf->arity; j++) {
+            if (j) fprintf(out, "    args = cdr(args);\n");
+            fprintf(out, "    LispObject *a%d = car(args);\n", j);
+        }
+        if (cf->arity == 0) fprintf(out, "    (void)args;\n");
+        fprintf(out, "    return rt_run(%s(", cf->c_name);
+        for (int j = 0; j < cf->arity; j++) {
+            fprintf(out, "%sa%d", j ? ", " : "", j);
+        }
+        fprintf(out, "));\n}\n\n");
+
+        /* Entry used by the tail call trampoline */
+        if (cf->tail_called && *cf->tail_called) {
+            fprintf(out, "static LispObject *%s__tc(LispObject **argv) {\n", cf->c_name);
+            fprintf(out, "    return %s(", cf->c_name);
+            for (int j = 0; j < cf->arity; j++) {
+                fprintf(out, "%sargv[%d]", j ? ", " : "", j);
+            }
+            fprintf(out, ");\n}\n\n");
+        }
+    }
+
+    /* Constants */
+    fprintf(out, "static void init_constants(void) {\n");
+    if (cg->const_init.length) {
+        fwrite(cg->const_init.data, 1, cg->const_init.length, out);
+    }
+    fprintf(out, "}\n\n");
+
+    /* Top-level forms in program order */
+    fprintf(out, "static void scheme_toplevel(void) {\n");
+    fprintf(out, "    LispObject *f[%d] = {NULL};\n", top_slots);
+    if (cg->toplevel_dvars) {
+        fprintf(out, "    double d[%d] = {0.0};\n", cg->toplevel_dvars);
+    }
+    if (cg->toplevel_bvars) {
+        fprintf(out, "    int b[%d] = {0};\n", cg->toplevel_bvars);
+    }
+    fprintf(out, "    GCFrame gcf;\n\n");
+    fprintf(out, "    gc_push_frame(&gcf, f, %d);\n", top_slots);
+    if (cg->toplevel.length) {
+        fwrite(cg->toplevel.data, 1, cg->toplevel.length, out);
+    }
+    fprintf(out, "    gc_pop_frame(&gcf);\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int main(int argc, char **argv) {\n");
+    fprintf(out, "    GCFrame constants;\n\n");
+    fprintf(out, "    rt_init(argc, argv, primitives);\n");
+    fprintf(out, "    rt_intern_symbols(symbol_names, S_, SYMBOL_COUNT);\n");
+    fprintf(out, "    gc_push_frame(&constants, K_, %d);\n", const_slots);
+    fprintf(out, "    init_constants();\n");
+    fprintf(out, "    scheme_toplevel();\n");
+    fprintf(out, "    gc_pop_frame(&constants);\n");
+    fprintf(out, "    rt_shutdown();\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+static void cgen_free(CGen *cg) {
+    reset_round(cg);
+    for (int i = 0; i < cg->def_count; i++) {
+        free(cg->defs[i].param_types);
+    }
+    free(cg->forms);
+    free(cg->primitives);
+    free(cg->defs);
+    free(cg->bound_names);
+    free(cg->bound_counts);
+    free(cg->macro_names);
+    free(cg->symbols);
+    free(cg->funcs);
+    free(cg->number_values);
+    free(cg->number_slots);
+    tb_free(&cg->const_init);
+    tb_free(&cg->static_objects);
+    tb_free(&cg->static_strings);
+    tb_free(&cg->sources);
+    tb_free(&cg->toplevel);
+}
+
+/* ============================================================
+ * Entry points
+ * ============================================================ */
+
+/* Compile a string to C */
+int compile_string_c(const char *source, const char *output_path, const char *input_name) {
+    lisp_init();
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+
+    Parser parser;
+    parser_init(&parser, &lexer);
+
+    CGen cg;
+    memset(&cg, 0, sizeof(cg));
+
+    /* Parse form by form, remembering each form's source text */
+    LispObject *forms = make_nil();
+    gc_add_root(&forms);
+    int capacity = 0;
+
+    while (parser.current.type != TOK_EOF) {
+        const char *start = lexer.start;
+        LispObject *form = parse_expression(&parser);
+        if (!form || parser_had_error(&parser)) {
+            fprintf(stderr, "Parse error: %s\n", parser_error_message(&parser));
+            gc_remove_root(&forms);
+            cgen_free(&cg);
+            lisp_shutdown();
+            return 1;
+        }
+        forms = make_cons(form, forms);
+
+        if (cg.form_count >= capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            cg.forms = (TopForm *)realloc(cg.forms, capacity * sizeof(TopForm));
+        }
+        cg.forms[cg.form_count].form = form;
+        cg.forms[cg.form_count].source = start;
+        cg.forms[cg.form_count].source_length = (size_t)(lexer.start - start);
+        cg.form_count++;
+    }
+
+    remove_unreachable(&cg);
+    collect_functions(&cg);
+
+    /* Functions that fail to compile stop being direct-call targets, which
+     * can change how others compile: repeat until nothing changes */
+    do {
+        reset_round(&cg);
+        infer_program(&cg);
+        for (int i = 0; i < cg.form_count; i++) {
+            compile_toplevel_form(&cg, &cg.forms[i]);
+        }
+    } while (cg.changed);
+
+    FILE *output = fopen(output_path, "w");
+    if (!output) {
+        fprintf(stderr, "Cannot open output file: %s\n", output_path);
+        gc_remove_root(&forms);
+        cgen_free(&cg);
+        lisp_shutdown();
+        return 1;
+    }
+
+    write_program(&cg, output, input_name);
+    fclose(output);
+
+    printf("C backend: %d of %d top-level forms compiled (%d functions), "
+           "%d left to the interpreter\n",
+           cg.compiled_forms, cg.form_count, cg.compiled_functions,
+           cg.form_count - cg.compiled_forms);
+    printf("C backend: %d functions specialized for numbers, "
+           "%d unboxed numeric operations\n",
+           cg.specialized_functions, cg.unboxed_ops);
+    printf("C backend: %d unreachable definitions removed, "
+           "%d of %d primitives bound\n",
+           cg.removed_forms, cg.primitive_count, primitive_total());
+
+    gc_remove_root(&forms);
+    cgen_free(&cg);
+    lisp_shutdown();
+    return 0;
+}
+
+/* Compile a file to C */
+int compile_file_c(const char *input_path, const char *output_path) {
+    FILE *input = fopen(input_path, "rb");
+    if (!input) {
+        fprintf(stderr, "Cannot open input file: %s\n", input_path);
+        return 1;
+    }
+
+    fseek(input, 0, SEEK_END);
+    long size = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    if (size < 0 || !validate_input_size((size_t)size)) {
+        fprintf(stderr, "Cannot read input file: %s\n", input_path);
+        fclose(input);
+        return 1;
+    }
+
+    char *source = (char *)malloc((size_t)size + 1);
+    size_t read = fread(source, 1, (size_t)size, input);
+    source[read] = '\0';
+    fclose(input);
+
+    const char *base = strrchr(input_path, '/');
+    const char *base_win = strrchr(input_path, '\\');
+    if (base_win && (!base || base_win > base)) base = base_win;
+    base = base ? base + 1 : input_path;
+
+    int result = compile_string_c(source, output_path, base);
+    free(source);
+    return result;
+}
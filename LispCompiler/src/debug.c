@@ -8,6 +8,7 @@
 #include "debug.h"
 #include "parser.h"
 #include "eval.h"
+#include "srcloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,7 +75,10 @@ void debug_disable(void) {
  * Check if debugging is enabled
  */
 int debug_is_enabled(void) {
-    return g_debug_state && g_debug_state->mode != DEBUG_MODE_NONE;
+    /* The debugger follows the main thread, whose context has no thread
+     * object */
+    return g_debug_state && g_debug_state->mode != DEBUG_MODE_NONE &&
+           (!lisp_context || !lisp_context->thread);
 }
 
 /*
@@ -651,6 +655,18 @@ int debug_check_break(LispObject *expr, Environment *env) {
     g_debug_state->current_expr = expr;
     g_debug_state->current_env = env;
 
+    /* Forms read from a file carry their own location; line breakpoints
+     * are checked as evaluation enters a new line */
+    const char *file;
+    int line, column;
+    int new_line = 0;
+    if (srcloc_get(expr, &file, &line, &column)) {
+        SourceLocation *loc = &g_debug_state->current_location;
+        new_line = line != loc->line || !loc->filename ||
+                   strcmp(file, loc->filename) != 0;
+        debug_set_current_location(file, line, column);
+    }
+
     /* Update watch expressions and check for data breakpoints */
     debug_update_watches();
 
@@ -688,6 +704,7 @@ int debug_check_break(LispObject *expr, Environment *env) {
             break;
 
         case DEBUG_MODE_CONTINUE: {
+            if (!new_line) break;
             int bp_id = has_breakpoint_at(
                 g_debug_state->current_location.filename,
                 g_debug_state->current_location.line);
@@ -0,0 +1,127 @@
+/*
+ * deque.c - Work-Stealing Deque
+ *
+ * After Chase and Lev, "Dynamic Circular Work-Stealing Deque", with the
+ * memory orders of Le et al., "Correct and Efficient Work-Stealing for
+ * Weak Memory Models".  Indices only grow; an item lives in slot
+ * index & (size - 1).
+ */
+
+#include "deque.h"
+#include <stdlib.h>
+
+#define DEQUE_INITIAL_SIZE 1024
+
+struct DequeArray {
+    long size;                  /* Power of two */
+    DequeArray *older;          /* The array this one replaced */
+    void *slots[];
+};
+
+#ifdef _MSC_VER
+/* Parallel collection needs POSIX threads, so on Windows a deque only
+ * ever has one thread */
+#define LOAD(p, order) (*(p))
+#define STORE(p, v, order) (*(p) = (v))
+#define FENCE(order) ((void)0)
+#define CAS(p, expected, desired) (*(p) == (expected) ? (*(p) = (desired), 1) : 0)
+#else
+#define LOAD(p, order) __atomic_load_n((p), __ATOMIC_##order)
+#define STORE(p, v, order) __atomic_store_n((p), (v), __ATOMIC_##order)
+#define FENCE(order) __atomic_thread_fence(__ATOMIC_##order)
+static int cas_long(long *p, long expected, long desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+#define CAS(p, expected, desired) cas_long((p), (expected), (desired))
+#endif
+
+static DequeArray *array_new(long size) {
+    DequeArray *array = (DequeArray *)malloc(sizeof(DequeArray) + (size_t)size * sizeof(void *));
+    if (!array) return NULL;
+    array->size = size;
+    array->older = NULL;
+    return array;
+}
+
+int deque_init(Deque *deque) {
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = array_new(DEQUE_INITIAL_SIZE);
+    return deque->array != NULL;
+}
+
+void deque_destroy(Deque *deque) {
+    DequeArray *array = deque->array;
+    while (array) {
+        DequeArray *older = array->older;
+        free(array);
+        array = older;
+    }
+    deque->array = NULL;
+}
+
+/* Copy the items between top and bottom into an array twice the size */
+static DequeArray *grow(Deque *deque, DequeArray *array, long top, long bottom) {
+    DequeArray *grown = array_new(array->size * 2);
+    if (!grown) return NULL;
+    for (long i = top; i < bottom; i++) {
+        grown->slots[i & (grown->size - 1)] = LOAD(&array->slots[i & (array->size - 1)], RELAXED);
+    }
+    grown->older = array;
+    STORE(&deque->array, grown, RELEASE);
+    return grown;
+}
+
+int deque_push(Deque *deque, void *item) {
+    long bottom = LOAD(&deque->bottom, RELAXED);
+    long top = LOAD(&deque->top, ACQUIRE);
+    DequeArray *array = LOAD(&deque->array, RELAXED);
+    if (bottom - top > array->size - 1) {
+        array = grow(deque, array, top, bottom);
+        if (!array) return 0;
+    }
+    STORE(&array->slots[bottom & (array->size - 1)], item, RELAXED);
+    FENCE(RELEASE);
+    STORE(&deque->bottom, bottom + 1, RELAXED);
+    return 1;
+}
+
+void *deque_take(Deque *deque) {
+    long bottom = LOAD(&deque->bottom, RELAXED) - 1;
+    DequeArray *array = LOAD(&deque->array, RELAXED);
+    STORE(&deque->bottom, bottom, RELAXED);
+    FENCE(SEQ_CST);
+    long top = LOAD(&deque->top, RELAXED);
+
+    void *item = NULL;
+    if (top <= bottom) {
+        item = LOAD(&array->slots[bottom & (array->size - 1)], RELAXED);
+        if (top == bottom) {
+            /* The last item: thieves may be after it too */
+            if (!CAS(&deque->top, top, top + 1)) item = NULL;
+            STORE(&deque->bottom, bottom + 1, RELAXED);
+        }
+    } else {
+        STORE(&deque->bottom, bottom + 1, RELAXED);
+    }
+    return item;
+}
+
+void *deque_steal(Deque *deque) {
+    long top = LOAD(&deque->top, ACQUIRE);
+    FENCE(SEQ_CST);
+    long bottom = LOAD(&deque->bottom, ACQUIRE);
+    if (top >= bottom) return NULL;
+
+    DequeArray *array = LOAD(&deque->array, ACQUIRE);
+    void *item = LOAD(&array->slots[top & (array->size - 1)], RELAXED);
+    if (!CAS(&deque->top, top, top + 1)) return NULL;
+    return item;
+}
+
+int deque_empty(Deque *deque) {
+    long top = LOAD(&deque->top, ACQUIRE);
+    long bottom = LOAD(&deque->bottom, ACQUIRE);
+    return top >= bottom;
+}
@@ -0,0 +1,39 @@
+/*
+ * deque.h - Work-Stealing Deque
+ *
+ * A Chase-Lev deque of pointers, as used by the parallel collector: the
+ * thread that owns a deque pushes and takes at the bottom, and other
+ * threads steal from the top.  The array grows as needed; arrays it
+ * outgrew are kept until the deque is destroyed, since a thief may
+ * still be reading one.
+ */
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stddef.h>
+
+typedef struct DequeArray DequeArray;
+
+typedef struct {
+    long top;                   /* Next to steal */
+    long bottom;                /* Next free slot */
+    DequeArray *array;
+} Deque;
+
+/* Returns 0 if out of memory */
+int deque_init(Deque *deque);
+void deque_destroy(Deque *deque);
+
+/* Owner only.  deque_push returns 0 if the deque could not grow. */
+int deque_push(Deque *deque, void *item);
+void *deque_take(Deque *deque);
+
+/* Any thread: the oldest item, or NULL if the deque is empty or another
+ * thread took it first */
+void *deque_steal(Deque *deque);
+
+/* Whether the deque looked empty (a hint for idle thieves) */
+int deque_empty(Deque *deque);
+
+#endif /* DEQUE_H */
@@ -3,9 +3,20 @@
  */
 
 #include "env.h"
+#include "promise.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* Definitions in the global environment, which threads share, are
+ * serialized; lookups walk the bindings without a lock, as a binding
+ * is complete before it is linked in */
+#ifndef _WIN32
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* Create a new environment */
 Environment *env_create(Environment *parent) {
@@ -40,7 +51,7 @@ LispObject *env_lookup(Environment *env, LispObject *symbol) {
 
     /* Search through the environment chain */
     for (Environment *e = env; e != NULL; e = e->parent) {
-        for (Binding *b = e->bindings; b != NULL; b = b->next) {
+        for (Binding *b = LOAD_ACQUIRE(&e->bindings); b != NULL; b = b->next) {
             if (symbol_eq(b->symbol, symbol)) {
                 return b->value;
             }
@@ -50,13 +61,21 @@ LispObject *env_lookup(Environment *env, LispObject *symbol) {
     return NULL;  /* Not found */
 }
 
-/* Define a new variable in current scope */
-void env_define(Environment *env, LispObject *symbol, LispObject *value) {
-    if (!is_symbol(symbol)) {
-        lisp_error("env_define: not a symbol");
-        return;
+/* Look up the binding cell for a variable (NULL if unbound).
+ * Binding cells stay valid for the lifetime of their environment, so
+ * callers such as compiled code may cache them. */
+Binding *env_lookup_binding(Environment *env, LispObject *symbol) {
+    for (Environment *e = env; e != NULL; e = e->parent) {
+        for (Binding *b = LOAD_ACQUIRE(&e->bindings); b != NULL; b = b->next) {
+            if (symbol_eq(b->symbol, symbol)) {
+                return b;
+            }
+        }
     }
+    return NULL;
+}
 
+static void define_binding(Environment *env, LispObject *symbol, LispObject *value) {
     /* Check if already defined in current scope */
     for (Binding *b = env->bindings; b != NULL; b = b->next) {
         if (symbol_eq(b->symbol, symbol)) {
@@ -71,7 +90,25 @@ void env_define(Environment *env, LispObject *symbol, LispObject *value) {
     b->symbol = symbol;
     b->value = value;
     b->next = env->bindings;
-    env->bindings = b;
+    STORE_RELEASE(&env->bindings, b);
+}
+
+/* Define a new variable in current scope */
+void env_define(Environment *env, LispObject *symbol, LispObject *value) {
+    if (!is_symbol(symbol)) {
+        lisp_error("env_define: not a symbol");
+        return;
+    }
+
+#ifndef _WIN32
+    if (!env->parent) {
+        pthread_mutex_lock(&global_lock);
+        define_binding(env, symbol, value);
+        pthread_mutex_unlock(&global_lock);
+        return;
+    }
+#endif
+    define_binding(env, symbol, value);
 }
 
 /* Set an existing variable */
@@ -83,7 +120,7 @@ int env_set(Environment *env, LispObject *symbol, LispObject *value) {
 
     /* Search through the environment chain */
     for (Environment *e = env; e != NULL; e = e->parent) {
-        for (Binding *b = e->bindings; b != NULL; b = b->next) {
+        for (Binding *b = LOAD_ACQUIRE(&e->bindings); b != NULL; b = b->next) {
             if (symbol_eq(b->symbol, symbol)) {
                 b->value = value;
                 return 1;  /* Success */
@@ -130,6 +167,9 @@ Environment *env_create_global(void) {
     env_define(global, make_symbol("#t"), LISP_TRUE);
     env_define(global, make_symbol("#f"), LISP_FALSE);
 
+    /* SRFI-41: the empty stream */
+    env_define(global, make_symbol("stream-null"), make_promise(PROMISE_DONE, make_nil()));
+
     return global;
 }
 
@@ -36,6 +36,9 @@ void env_free(Environment *env);
 /* Look up a variable in the environment chain */
 LispObject *env_lookup(Environment *env, LispObject *symbol);
 
+/* Look up the binding cell of a variable (NULL if unbound) */
+Binding *env_lookup_binding(Environment *env, LispObject *symbol);
+
 /* Define a new variable in the current environment */
 void env_define(Environment *env, LispObject *symbol, LispObject *value);
 
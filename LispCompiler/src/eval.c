@@ -6,6 +6,10 @@
 
 #include "eval.h"
 #include "debug.h"
+#include "primitives.h"
+#include "profile.h"
+#include "promise.h"
+#include "record.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,16 +18,45 @@
  * Essential #1: Recursion Depth Protection
  * ============================================================ */
 #define MAX_EVAL_DEPTH 10000
-static int current_eval_depth = 0;
+
+#if MAX_EVAL_DEPTH >= GC_ENV_STACK_SIZE
+#error "GC_ENV_STACK_SIZE must exceed MAX_EVAL_DEPTH"
+#endif
+
+/* Make env the environment of the evaluation in progress, so that the
+ * collector marks the variables bound in it */
+static void set_eval_env(Environment *env) {
+    LispContext *context = lisp_context;
+    context->env_stack[context->env_depth] = env;
+}
+
 
 /* Reset evaluation depth (call at program start) */
 void eval_reset_depth(void) {
-    current_eval_depth = 0;
+    lisp_context->env_depth = 0;
 }
 
 /* Get current evaluation depth */
 int eval_get_depth(void) {
-    return current_eval_depth;
+    return lisp_context->env_depth;
+}
+
+/* Names handled by eval_special_form (keep in sync when adding forms) */
+static const char *const special_form_names[] = {
+    "quote", "if", "define", "set!", "lambda", "begin", "let", "let*",
+    "letrec", "cond", "and", "or", "defmacro", "quasiquote", "when",
+    "unless", "case-lambda", "do", "let-values", "let*-values", "guard",
+    "case", "delay", "delay-force", "stream-cons", "define-record-type", NULL
+};
+
+/* Check if a name denotes a special form */
+int eval_is_special_form(const char *name) {
+    for (int i = 0; special_form_names[i] != NULL; i++) {
+        if (strcmp(special_form_names[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /* Forward declarations */
@@ -68,24 +101,50 @@ static void bind_parameters(Environment *env, LispObject *params, LispObject *ar
 
 /* Main evaluation function */
 LispObject *eval(LispObject *expr, Environment *env) {
-    /* Essential #1: Check recursion depth */
-    if (++current_eval_depth > MAX_EVAL_DEPTH) {
-        current_eval_depth--;
+    LispContext *context = lisp_context;
+
+    /* Essential #1: Check recursion depth, and the stack left for it */
+    if (++context->env_depth > MAX_EVAL_DEPTH) {
+        context->env_depth--;
         lisp_error("Maximum recursion depth exceeded (%d levels)", MAX_EVAL_DEPTH);
         return make_nil();
     }
+    if (LISP_STACK_ADDRESS() < context->stack_limit) {
+        context->env_depth--;
+        lisp_error("Maximum recursion depth exceeded (stack exhausted)");
+        return make_nil();
+    }
+    context->env_stack[context->env_depth] = env;
+
+    /* Safepoint: collect when the heap filled up since the last eval,
+     * or stop while another thread collects */
+    if (context->gc_pending || LOAD_ACQUIRE(&gc_stop_requested)) {
+        GCFrame frame;
+        gc_push_frame(&frame, &expr, 1);
+        gc_safepoint();
+        gc_pop_frame(&frame);
+    }
 
     /* Debug hook: check if we should break at this expression */
     if (debug_is_enabled()) {
         debug_check_break(expr, env);
     }
 
+    /* Profiler: sample the call stack for elapsed timer ticks */
+    if (profile_ticks) {
+        profile_sample();
+    }
+
     /* Self-evaluating objects */
     if (!expr) {
-        current_eval_depth--;
+        context->env_depth--;
         return make_nil();
     }
 
+    /* Errors in a form read from a file report where it is */
+    int located = expr->has_location;
+    LispObject *outer_form = located ? lisp_set_current_form(expr) : NULL;
+
     LispObject *result = NULL;
 
     switch (expr->type) {
@@ -119,7 +178,10 @@ LispObject *eval(LispObject *expr, Environment *env) {
                 if (value && is_macro(value)) {
                     /* Expand macro and evaluate result */
                     LispObject *expanded = apply(value, cdr(expr), env);
+                    GCFrame frame;
+                    gc_push_frame(&frame, &expanded, 1);
                     result = eval(expanded, env);
+                    gc_pop_frame(&frame);
                     break;
                 }
             }
@@ -143,10 +205,123 @@ LispObject *eval(LispObject *expr, Environment *env) {
             break;
     }
 
-    current_eval_depth--;
+    if (located) lisp_set_current_form(outer_form);
+    context->env_depth--;
     return result;
 }
 
+/* delay and delay-force: a promise of an expression.  stream-cons: a
+ * stream of a promised element and a promised stream.  Kept out of
+ * eval_special_form, whose frame every nested eval of an if, let or
+ * begin body pays for. */
+static LispObject *eval_promise_form(const char *name, LispObject *args, Environment *env) {
+    if (strcmp(name, "stream-cons") != 0) {
+        return make_delayed(strcmp(name, "delay") == 0 ? PROMISE_DELAY : PROMISE_LAZY,
+                            car(args), env);
+    }
+
+    LispObject *pair = make_cons(make_delayed(PROMISE_DELAY, car(args), env),
+                                 make_delayed(PROMISE_LAZY, cadr(args), env));
+    return make_promise(PROMISE_DONE, pair);
+}
+
+/* define-record-type: (define-record-type <name> (ctor field ...) pred
+ * (field accessor [modifier]) ...).  As in SRFI-131, <name> may be
+ * (<name> parent), parent evaluating to the type the new one derives
+ * from, whose fields the constructor may name too.  ctor may also be a
+ * name alone, taking every field in order, or #f; pred may be #f. */
+static LispObject *eval_define_record_type(LispObject *args, Environment *env) {
+    LispObject *type_name = car(args);
+    LispObject *parent = make_nil();
+    if (is_cons(type_name)) {
+        parent = eval(cadr(type_name), env);
+        type_name = car(type_name);
+        if (!is_record_type(parent)) {
+            lisp_error("define-record-type: parent of %s is not a record type",
+                       is_symbol(type_name) ? type_name->symbol.name : "record");
+            return make_nil();
+        }
+    }
+    if (!is_symbol(type_name) || !is_cons(cdr(args)) || !is_cons(cddr(args))) {
+        lisp_error("define-record-type: expected a name, a constructor and a predicate");
+        return make_nil();
+    }
+    LispObject *ctor = cadr(args);
+    LispObject *pred = caddr(args);
+    LispObject *specs = cdr(cddr(args));
+
+    gc_pause();
+
+    /* The type, named without the brackets of <name> */
+    LispObject *fields = make_nil();
+    LispObject **tail = &fields;
+    for (LispObject *s = specs; is_cons(s); s = cdr(s)) {
+        LispObject *field = is_cons(car(s)) ? caar(s) : car(s);
+        if (!is_symbol(field)) {
+            lisp_error("define-record-type: bad field of %s", type_name->symbol.name);
+            gc_resume();
+            return make_nil();
+        }
+        *tail = make_cons(field, make_nil());
+        tail = &(*tail)->cons.cdr;
+    }
+    const char *display = type_name->symbol.name;
+    size_t length = strlen(display);
+    LispObject *rtd_name = type_name;
+    if (length > 2 && display[0] == '<' && display[length - 1] == '>') {
+        rtd_name = make_symbol_n(display + 1, length - 2);
+    }
+    LispObject *rtd = make_record_type(rtd_name, parent, fields);
+    env_define(env, type_name, rtd);
+
+    /* Constructor: the fields it names, or all of them */
+    if (is_cons(ctor) || is_symbol(ctor)) {
+        LispObject *indices = make_nil();
+        tail = &indices;
+        if (is_symbol(ctor)) {
+            for (int i = 0; i < rtd->record_type.size; i++) {
+                *tail = make_cons(make_number(i), make_nil());
+                tail = &(*tail)->cons.cdr;
+            }
+        } else {
+            for (LispObject *f = cdr(ctor); is_cons(f); f = cdr(f)) {
+                int index = record_field_index(rtd, car(f));
+                if (index < 0) {
+                    lisp_error("define-record-type: %s is not a field of %s",
+                               is_symbol(car(f)) ? car(f)->symbol.name : "?",
+                               type_name->symbol.name);
+                    gc_resume();
+                    return make_nil();
+                }
+                *tail = make_cons(make_number(index), make_nil());
+                tail = &(*tail)->cons.cdr;
+            }
+            ctor = car(ctor);
+        }
+        env_define(env, ctor, make_record_constructor(ctor, rtd, indices));
+    }
+
+    if (is_symbol(pred)) {
+        env_define(env, pred, make_record_proc(RECORD_PREDICATE, pred, rtd, 0));
+    }
+
+    /* Accessors and modifiers of the type's own fields */
+    int index = rtd->record_type.size - rtd->record_type.field_count;
+    for (LispObject *s = specs; is_cons(s); s = cdr(s), index++) {
+        LispObject *spec = car(s);
+        if (!is_cons(spec) || !is_cons(cdr(spec))) continue;
+        if (is_symbol(cadr(spec))) {
+            env_define(env, cadr(spec), make_record_proc(RECORD_ACCESSOR, cadr(spec), rtd, index));
+        }
+        if (is_cons(cddr(spec)) && is_symbol(caddr(spec))) {
+            env_define(env, caddr(spec), make_record_proc(RECORD_MODIFIER, caddr(spec), rtd, index));
+        }
+    }
+
+    gc_resume();
+    return type_name;
+}
+
 /* Evaluate special forms */
 static LispObject *eval_special_form(LispObject *expr, Environment *env) {
     if (!is_cons(expr)) return NULL;
@@ -233,21 +408,24 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
 
             /* Create environment with loop function */
             Environment *let_env = env_create(env);
+            set_eval_env(let_env);
 
             /* Collect parameters and initial values */
-            LispObject *params = make_nil();
-            LispObject *vals = make_nil();
+            LispObject *slots[2] = { make_nil(), make_nil() };
+            GCFrame frame;
+            gc_push_frame(&frame, slots, 2);
             LispObject *b = bindings;
 
             while (is_cons(b)) {
                 LispObject *binding = car(b);
-                params = make_cons(car(binding), params);
-                vals = make_cons(eval(cadr(binding), env), vals);
+                slots[0] = make_cons(car(binding), slots[0]);
+                LispObject *val = eval(cadr(binding), env);
+                slots[1] = make_cons(val, slots[1]);
                 b = cdr(b);
             }
 
-            params = list_reverse(params);
-            vals = list_reverse(vals);
+            LispObject *params = list_reverse(slots[0]);
+            LispObject *vals = list_reverse(slots[1]);
 
             /* Create the loop function */
             LispObject *loop_fn = make_lambda(params, body, let_env);
@@ -256,12 +434,14 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
 
             /* Bind initial values */
             bind_parameters(let_env, params, vals);
+            gc_pop_frame(&frame);
 
             return eval_sequence(body, let_env);
         }
 
         /* Regular let */
         Environment *let_env = env_create(env);
+        set_eval_env(let_env);
 
         /* Evaluate bindings */
         while (is_cons(bindings)) {
@@ -281,6 +461,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
         LispObject *body = cdr(args);
 
         Environment *let_env = env_create(env);
+        set_eval_env(let_env);
 
         /* Evaluate bindings sequentially */
         while (is_cons(bindings)) {
@@ -300,6 +481,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
         LispObject *body = cdr(args);
 
         Environment *let_env = env_create(env);
+        set_eval_env(let_env);
 
         /* First pass: bind all variables to undefined */
         LispObject *b = bindings;
@@ -341,8 +523,12 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
                 }
                 /* Check for => syntax */
                 if (is_symbol_named(cadr(clause), "=>")) {
+                    GCFrame frame;
+                    gc_push_frame(&frame, &result, 1);
                     LispObject *proc = eval(caddr(clause), env);
-                    return apply(proc, make_cons(result, make_nil()), env);
+                    LispObject *call_args = make_cons(result, make_nil());
+                    gc_pop_frame(&frame);
+                    return apply(proc, call_args, env);
                 }
                 return eval_sequence(cdr(clause), env);
             }
@@ -435,6 +621,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
 
         /* Create environment for loop variables */
         Environment *do_env = env_create(env);
+        set_eval_env(do_env);
 
         /* Initialize loop variables */
         LispObject *b = bindings;
@@ -463,6 +650,8 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
 
             /* Update loop variables (collect new values first) */
             LispObject *new_vals = make_nil();
+            GCFrame frame;
+            gc_push_frame(&frame, &new_vals, 1);
             b = bindings;
             while (is_cons(b)) {
                 LispObject *binding = car(b);
@@ -488,6 +677,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
                 b = cdr(b);
                 new_vals = cdr(new_vals);
             }
+            gc_pop_frame(&frame);
         }
     }
 
@@ -496,6 +686,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
         LispObject *bindings = car(args);
         LispObject *body = cdr(args);
         Environment *let_env = env_create(env);
+        set_eval_env(let_env);
 
         while (is_cons(bindings)) {
             LispObject *binding = car(bindings);
@@ -529,6 +720,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
         LispObject *bindings = car(args);
         LispObject *body = cdr(args);
         Environment *let_env = env_create(env);
+        set_eval_env(let_env);
 
         while (is_cons(bindings)) {
             LispObject *binding = car(bindings);
@@ -570,6 +762,8 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
     /* R7RS: case - case dispatch */
     if (strcmp(name, "case") == 0) {
         LispObject *key = eval(car(args), env);
+        GCFrame frame;
+        gc_push_frame(&frame, &key, 1);
         LispObject *clauses = cdr(args);
 
         while (is_cons(clauses)) {
@@ -579,6 +773,7 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
 
             /* else clause */
             if (is_symbol_named(datums, "else")) {
+                gc_pop_frame(&frame);
                 return eval_sequence(exprs, env);
             }
 
@@ -588,8 +783,11 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
                     /* Check for => syntax */
                     if (is_cons(exprs) && is_symbol_named(car(exprs), "=>")) {
                         LispObject *proc = eval(cadr(exprs), env);
-                        return apply(proc, make_cons(key, make_nil()), env);
+                        LispObject *call_args = make_cons(key, make_nil());
+                        gc_pop_frame(&frame);
+                        return apply(proc, call_args, env);
                     }
+                    gc_pop_frame(&frame);
                     return eval_sequence(exprs, env);
                 }
                 datums = cdr(datums);
@@ -598,9 +796,21 @@ static LispObject *eval_special_form(LispObject *expr, Environment *env) {
             clauses = cdr(clauses);
         }
 
+        gc_pop_frame(&frame);
         return make_nil();
     }
 
+    /* R7RS: define-record-type */
+    if (strcmp(name, "define-record-type") == 0) {
+        return eval_define_record_type(args, env);
+    }
+
+    /* R7RS: delay, delay-force; SRFI-41: stream-cons */
+    if (strcmp(name, "delay") == 0 || strcmp(name, "delay-force") == 0 ||
+        strcmp(name, "stream-cons") == 0) {
+        return eval_promise_form(name, args, env);
+    }
+
     /* Not a special form */
     return NULL;
 }
@@ -640,6 +850,8 @@ LispObject *expand_quasiquote(LispObject *expr, Environment *env, int depth) {
     /* Regular list - expand each element */
     LispObject *result_head = NULL;
     LispObject *result_tail = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, &result_head, 1);
 
     while (is_cons(expr)) {
         LispObject *item = car(expr);
@@ -694,24 +906,82 @@ LispObject *expand_quasiquote(LispObject *expr, Environment *env, int depth) {
         }
     }
 
+    gc_pop_frame(&frame);
     return result_head ? result_head : make_nil();
 }
 
+/* Binary arithmetic and comparison on two numbers, without building an
+ * argument list.  Returns NULL when func is not one of these primitives. */
+static LispObject *apply_binary_numeric(LispObject *func, LispObject *a, LispObject *b) {
+    LispPrimitiveFn fn = func->primitive.func;
+    if (!is_number(a) || !is_number(b)) return NULL;
+
+    double x = a->number;
+    double y = b->number;
+
+    /* prim_add starts from 0, so the sum of two -0.0 is +0.0 */
+    if (fn == prim_add) return make_number(0.0 + x + y);
+    if (fn == prim_sub) return make_number(x - y);
+    if (fn == prim_mul) return make_number(x * y);
+    if (fn == prim_eq_num) return make_boolean(x == y);
+    if (fn == prim_lt) return make_boolean(x < y);
+    if (fn == prim_gt) return make_boolean(x > y);
+    if (fn == prim_le) return make_boolean(x <= y);
+    if (fn == prim_ge) return make_boolean(x >= y);
+    return NULL;
+}
+
+static int is_binary_numeric_prim(LispObject *func) {
+    if (!is_primitive(func)) return 0;
+    LispPrimitiveFn fn = func->primitive.func;
+    return fn == prim_add || fn == prim_sub || fn == prim_mul ||
+           fn == prim_eq_num || fn == prim_lt || fn == prim_gt ||
+           fn == prim_le || fn == prim_ge;
+}
+
 /* Evaluate function application */
 static LispObject *eval_application(LispObject *expr, Environment *env) {
     /* Evaluate the function */
     LispObject *func = eval(car(expr), env);
-    gc_add_root(&func);  /* Protect from GC while evaluating arguments */
+    GCFrame func_frame;
+    gc_push_frame(&func_frame, &func, 1);  /* Protect from GC while evaluating arguments */
+
+    /* Fast path: (op a b) on numbers for the common arithmetic primitives */
+    LispObject *operands = cdr(expr);
+    if (is_binary_numeric_prim(func) && is_cons(operands) &&
+        is_cons(cdr(operands)) && is_nil(cddr(operands))) {
+        LispObject *slots[3] = { NULL, NULL, NULL };
+        GCFrame frame;
+        gc_push_frame(&frame, slots, 3);
+
+        slots[0] = eval(car(operands), env);
+        slots[1] = eval(cadr(operands), env);
+
+        LispObject *result = apply_binary_numeric(func, slots[0], slots[1]);
+        if (!result) {
+            slots[2] = make_cons(slots[1], make_nil());
+            slots[2] = make_cons(slots[0], slots[2]);
+            result = apply(func, slots[2], env);
+        }
+
+        gc_pop_frame(&frame);
+        gc_pop_frame(&func_frame);
+        return result;
+    }
 
     /* Evaluate arguments */
     LispObject *args = eval_list(cdr(expr), env);
-    gc_add_root(&args);  /* Protect from GC during apply */
+    GCFrame args_frame;
+    gc_push_frame(&args_frame, &args, 1);  /* Protect from GC during apply */
 
-    /* Apply function */
+    /* Apply function; a primitive may release args (gc_release_args) */
+    LispObject **outer_args = lisp_context->call_args;
+    lisp_context->call_args = &args;
     LispObject *result = apply(func, args, env);
+    lisp_context->call_args = outer_args;
 
-    gc_remove_root(&args);
-    gc_remove_root(&func);
+    gc_pop_frame(&args_frame);
+    gc_pop_frame(&func_frame);
 
     return result;
 }
@@ -722,13 +992,12 @@ LispObject *eval_list(LispObject *list, Environment *env) {
 
     LispObject *head = NULL;
     LispObject *tail = NULL;
-    gc_add_root(&head);  /* Protect result list from GC */
+    GCFrame frame;
+    gc_push_frame(&frame, &head, 1);  /* Protect result list from GC */
 
     while (is_cons(list)) {
         LispObject *value = eval(car(list), env);
-        gc_add_root(&value);  /* Protect value while creating cons */
         LispObject *new_cell = make_cons(value, make_nil());
-        gc_remove_root(&value);
 
         if (tail) {
             tail->cons.cdr = new_cell;
@@ -740,7 +1009,7 @@ LispObject *eval_list(LispObject *list, Environment *env) {
         list = cdr(list);
     }
 
-    gc_remove_root(&head);
+    gc_pop_frame(&frame);
     return head ? head : make_nil();
 }
 
@@ -760,6 +1029,7 @@ LispObject *apply(LispObject *func, LispObject *args, Environment *env) {
             return make_nil();
         }
 
+        if (func->primitive.data) return func->primitive.closure(func, args);
         return func->primitive.func(args);
     }
 
@@ -799,7 +1069,9 @@ LispObject *apply(LispObject *func, LispObject *args, Environment *env) {
                         debug_push_frame("case-lambda", args, call_env, NULL);
                     }
 
+                    profile_enter(func);
                     LispObject *result = eval_sequence(body, call_env);
+                    profile_leave();
 
                     /* Debug: pop call frame */
                     if (debug_is_enabled()) {
@@ -830,7 +1102,9 @@ LispObject *apply(LispObject *func, LispObject *args, Environment *env) {
         }
 
         /* Evaluate body */
+        profile_enter(func);
         LispObject *result = eval_sequence(func->lambda.body, call_env);
+        profile_leave();
 
         /* Debug: pop call frame */
         if (debug_is_enabled()) {
@@ -878,6 +1152,8 @@ LispObject *expand_macros(LispObject *expr, Environment *env) {
     /* Recursively expand subforms */
     LispObject *result_head = NULL;
     LispObject *result_tail = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, &result_head, 1);
 
     while (is_cons(expr)) {
         LispObject *expanded = expand_macros(car(expr), env);
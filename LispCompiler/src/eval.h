@@ -26,6 +26,9 @@ LispObject *expand_macros(LispObject *expr, Environment *env);
 /* Expand quasiquote expression */
 LispObject *expand_quasiquote(LispObject *expr, Environment *env, int depth);
 
+/* Check if a name denotes a special form */
+int eval_is_special_form(const char *name);
+
 /* Essential #1: Recursion depth management */
 void eval_reset_depth(void);
 int eval_get_depth(void);
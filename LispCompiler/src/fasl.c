@@ -0,0 +1,776 @@
+/*
+ * fasl.c - Cache of Parsed Source Files
+ *
+ * Image layout:
+ *   FaslHeader
+ *   LispObject objects[object_count]
+ *   BlockLocation locations[location_count], sorted by object
+ *   symbol names, each NUL-terminated
+ *   string data, each NUL-terminated
+ *
+ * In the image, a car or cdr holds a reference rather than a pointer:
+ * an object index, a symbol index or a singleton, tagged in the low two
+ * bits.  A string's data holds the offset of its bytes in the string
+ * data.  Images are built straight from tokens, without touching the
+ * heap, so any number of files can be parsed at once.
+ */
+
+#include "fasl.h"
+#include "lexer.h"
+#include "srcloc.h"
+#include "text.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define FASL_MAGIC "LISPFASL"
+#define FASL_VERSION 2
+
+/* Reference tags and singletons */
+enum { REF_OBJECT, REF_SYMBOL, REF_CONSTANT };
+enum { CONSTANT_NIL, CONSTANT_TRUE, CONSTANT_FALSE };
+
+#define MAKE_REF(tag, index) ((uintptr_t)(index) << 2 | (uintptr_t)(tag))
+#define REF_TAG(ref)         ((int)((ref) & 3))
+#define REF_INDEX(ref)       ((ref) >> 2)
+#define NIL_REF              MAKE_REF(REF_CONSTANT, CONSTANT_NIL)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_size;       /* sizeof(LispObject) of the writer */
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    uint64_t root;              /* Reference to the list of forms */
+    uint32_t object_count;
+    uint32_t location_count;
+    uint32_t symbol_count;
+    uint32_t reserved;
+    uint64_t symbols_length;    /* Bytes of symbol names */
+    uint64_t strings_length;    /* Bytes of string data */
+} FaslHeader;
+
+/* ============================================================
+ * Building Images
+ * ============================================================ */
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+static void *buffer_extend(Buffer *buf, size_t size) {
+    if (buf->length + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while (capacity < buf->length + size) capacity *= 2;
+        char *grown = (char *)realloc(buf->data, capacity);
+        if (!grown) return NULL;
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    void *p = buf->data + buf->length;
+    buf->length += size;
+    return p;
+}
+
+typedef struct {
+    Lexer lexer;
+    Token current;
+    int failed;                 /* Syntax error or out of memory */
+
+    Buffer objects;
+    Buffer locations;
+    Buffer symbols;             /* Names */
+    Buffer strings;
+
+    /* Symbol index: slot holds symbol number + 1, 0 if empty */
+    uint32_t *symbol_slots;
+    size_t symbol_slot_count;   /* Power of two */
+    Buffer symbol_offsets;      /* uint32_t offset of each name */
+    uint32_t symbol_count;
+} Builder;
+
+static uint64_t hash_bytes(const char *data, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void next(Builder *b) {
+    b->current = lexer_next_token(&b->lexer);
+    if (b->current.type == TOK_ERROR) b->failed = 1;
+}
+
+static LispObject *object_at(Builder *b, uintptr_t index) {
+    return (LispObject *)b->objects.data + index;
+}
+
+static uintptr_t new_object(Builder *b, LispType type) {
+    uintptr_t index = b->objects.length / sizeof(LispObject);
+    LispObject *obj = (LispObject *)buffer_extend(&b->objects, sizeof(LispObject));
+    if (!obj || index >= UINT32_MAX) {
+        b->failed = 1;
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    obj->type = type;
+    obj->gc_mark = GC_MARK_STATIC;
+    return index;
+}
+
+static int grow_symbol_index(Builder *b) {
+    size_t count = b->symbol_slot_count ? b->symbol_slot_count * 2 : 256;
+    uint32_t *slots = (uint32_t *)calloc(count, sizeof(uint32_t));
+    if (!slots) return 0;
+
+    const uint32_t *offsets = (const uint32_t *)b->symbol_offsets.data;
+    for (uint32_t n = 0; n < b->symbol_count; n++) {
+        const char *name = b->symbols.data + offsets[n];
+        size_t i = (size_t)hash_bytes(name, strlen(name)) & (count - 1);
+        while (slots[i]) i = (i + 1) & (count - 1);
+        slots[i] = n + 1;
+    }
+    free(b->symbol_slots);
+    b->symbol_slots = slots;
+    b->symbol_slot_count = count;
+    return 1;
+}
+
+static uintptr_t symbol_ref(Builder *b, const char *name, size_t length) {
+    if ((b->symbol_count + 1) * 2 > b->symbol_slot_count && !grow_symbol_index(b)) {
+        b->failed = 1;
+        return NIL_REF;
+    }
+
+    size_t mask = b->symbol_slot_count - 1;
+    size_t i = (size_t)hash_bytes(name, length) & mask;
+    while (b->symbol_slots[i]) {
+        uint32_t n = b->symbol_slots[i] - 1;
+        const char *known = b->symbols.data + ((const uint32_t *)b->symbol_offsets.data)[n];
+        if (memcmp(known, name, length) == 0 && known[length] == '\0') {
+            return MAKE_REF(REF_SYMBOL, n);
+        }
+        i = (i + 1) & mask;
+    }
+
+    uint32_t offset = (uint32_t)b->symbols.length;
+    char *copy = (char *)buffer_extend(&b->symbols, length + 1);
+    uint32_t *slot = (uint32_t *)buffer_extend(&b->symbol_offsets, sizeof(uint32_t));
+    if (!copy || !slot) {
+        b->failed = 1;
+        return NIL_REF;
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    *slot = offset;
+
+    b->symbol_slots[i] = ++b->symbol_count;
+    return MAKE_REF(REF_SYMBOL, b->symbol_count - 1);
+}
+
+static uintptr_t build_datum(Builder *b);
+
+/* Append item to the list ending at *tail (head in *head) */
+static void append(Builder *b, uintptr_t *head, uintptr_t *tail, uintptr_t item) {
+    uintptr_t cell = new_object(b, LISP_CONS);
+    if (b->failed) return;
+
+    LispObject *obj = object_at(b, cell);
+    obj->cons.car = (LispObject *)item;
+    obj->cons.cdr = (LispObject *)NIL_REF;
+
+    if (*head == NIL_REF) {
+        *head = MAKE_REF(REF_OBJECT, cell);
+    } else {
+        object_at(b, REF_INDEX(*tail))->cons.cdr = (LispObject *)MAKE_REF(REF_OBJECT, cell);
+    }
+    *tail = MAKE_REF(REF_OBJECT, cell);
+}
+
+static uintptr_t build_list(Builder *b) {
+    int line, column;
+    lexer_location(&b->lexer, &b->current, &line, &column);
+    next(b);
+
+    uintptr_t head = NIL_REF, tail = NIL_REF;
+    while (!b->failed && b->current.type != TOK_RPAREN &&
+           b->current.type != TOK_DOT && b->current.type != TOK_EOF) {
+        uintptr_t item = build_datum(b);
+        append(b, &head, &tail, item);
+    }
+    if (b->failed) return NIL_REF;
+
+    if (b->current.type == TOK_DOT) {
+        next(b);
+        uintptr_t item = build_datum(b);
+        if (head == NIL_REF || b->failed) {
+            b->failed = 1;
+            return NIL_REF;
+        }
+        object_at(b, REF_INDEX(tail))->cons.cdr = (LispObject *)item;
+    }
+
+    if (b->current.type != TOK_RPAREN) {
+        b->failed = 1;
+        return NIL_REF;
+    }
+    next(b);
+
+    if (head != NIL_REF) {
+        BlockLocation *loc = (BlockLocation *)buffer_extend(&b->locations, sizeof(BlockLocation));
+        if (!loc) {
+            b->failed = 1;
+            return NIL_REF;
+        }
+        loc->index = (uint32_t)REF_INDEX(head);
+        loc->line = (uint32_t)line;
+        loc->column = (uint32_t)column;
+    }
+    return head;
+}
+
+static uintptr_t build_string(Builder *b) {
+    uintptr_t index = new_object(b, LISP_STRING);
+    size_t offset = b->strings.length;
+    char *text = (char *)buffer_extend(&b->strings, b->current.length + 1);
+    if (b->failed || !text) {
+        b->failed = 1;
+        return NIL_REF;
+    }
+
+    size_t length = b->current.length;
+    if (b->current.value.escapes) {
+        length = lexer_unescape(&b->current, text);
+    } else {
+        memcpy(text, b->current.text, length);
+    }
+    text[length] = '\0';
+    b->strings.length = offset + length + 1;
+
+    /* A string that is not UTF-8 is left to the reader, which repairs it */
+    if (text_utf8_valid(text, length) != length) {
+        b->failed = 1;
+        return NIL_REF;
+    }
+
+    LispObject *obj = object_at(b, index);
+    obj->string.data = (char *)(uintptr_t)offset;
+    obj->string.length = length;
+    obj->string.chars = text_utf8_count(text, length);
+    return MAKE_REF(REF_OBJECT, index);
+}
+
+/* Build a datum, as parse_datum would parse it */
+static uintptr_t build_datum(Builder *b) {
+    const char *quote = NULL;
+    uintptr_t ref = NIL_REF;
+    uintptr_t index;
+
+    if (b->failed) return NIL_REF;
+
+    switch (b->current.type) {
+        case TOK_QUOTE:          quote = "quote"; break;
+        case TOK_QUASIQUOTE:     quote = "quasiquote"; break;
+        case TOK_UNQUOTE:        quote = "unquote"; break;
+        case TOK_UNQUOTE_SPLICE: quote = "unquote-splicing"; break;
+
+        case TOK_LPAREN:
+            return build_list(b);
+
+        case TOK_SYMBOL:
+            ref = symbol_ref(b, b->current.text, b->current.length);
+            break;
+
+        case TOK_NUMBER:
+            index = new_object(b, LISP_NUMBER);
+            if (b->failed) return NIL_REF;
+            object_at(b, index)->number = b->current.value.number;
+            ref = MAKE_REF(REF_OBJECT, index);
+            break;
+
+        case TOK_STRING:
+            ref = build_string(b);
+            break;
+
+        case TOK_BOOLEAN:
+            ref = MAKE_REF(REF_CONSTANT, b->current.value.boolean ? CONSTANT_TRUE : CONSTANT_FALSE);
+            break;
+
+        case TOK_CHARACTER:
+            index = new_object(b, LISP_CHARACTER);
+            if (b->failed) return NIL_REF;
+            object_at(b, index)->character = b->current.value.character;
+            ref = MAKE_REF(REF_OBJECT, index);
+            break;
+
+        default:
+            b->failed = 1;
+            return NIL_REF;
+    }
+
+    next(b);
+    if (!quote) return ref;
+
+    /* (quote datum) */
+    uintptr_t head = NIL_REF, tail = NIL_REF;
+    uintptr_t datum = build_datum(b);
+    append(b, &head, &tail, symbol_ref(b, quote, strlen(quote)));
+    append(b, &head, &tail, datum);
+    return head;
+}
+
+static int compare_locations(const void *a, const void *b) {
+    uint32_t x = ((const BlockLocation *)a)->index;
+    uint32_t y = ((const BlockLocation *)b)->index;
+    return (x > y) - (x < y);
+}
+
+static void builder_free(Builder *b) {
+    free(b->objects.data);
+    free(b->locations.data);
+    free(b->symbols.data);
+    free(b->strings.data);
+    free(b->symbol_slots);
+    free(b->symbol_offsets.data);
+}
+
+/* Parse source into an image; returns NULL on a syntax error or a
+ * string that is not UTF-8 */
+static unsigned char *build_image(const char *source, size_t source_size,
+                                  int64_t mtime, size_t *image_size) {
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    lexer_init(&b.lexer, source);
+    next(&b);
+
+    uintptr_t root = NIL_REF, tail = NIL_REF;
+    while (!b.failed && b.current.type != TOK_EOF) {
+        uintptr_t form = build_datum(&b);
+        append(&b, &root, &tail, form);
+    }
+
+    unsigned char *image = NULL;
+    if (!b.failed) {
+        /* A list's cell is made after its first element's, so locations
+         * are recorded out of order */
+        qsort(b.locations.data, b.locations.length / sizeof(BlockLocation),
+              sizeof(BlockLocation), compare_locations);
+
+        FaslHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FASL_MAGIC, sizeof(header.magic));
+        header.version = FASL_VERSION;
+        header.object_size = (uint32_t)sizeof(LispObject);
+        header.source_size = source_size;
+        header.source_mtime = mtime;
+        header.source_hash = hash_bytes(source, source_size);
+        header.root = root;
+        header.object_count = (uint32_t)(b.objects.length / sizeof(LispObject));
+        header.location_count = (uint32_t)(b.locations.length / sizeof(BlockLocation));
+        header.symbol_count = b.symbol_count;
+        header.symbols_length = b.symbols.length;
+        header.strings_length = b.strings.length;
+
+        *image_size = sizeof(header) + b.objects.length + b.locations.length +
+                      b.symbols.length + b.strings.length;
+        image = (unsigned char *)malloc(*image_size);
+        if (image) {
+            unsigned char *p = image;
+            memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            if (b.objects.length) memcpy(p, b.objects.data, b.objects.length);
+            p += b.objects.length;
+            if (b.locations.length) memcpy(p, b.locations.data, b.locations.length);
+            p += b.locations.length;
+            if (b.symbols.length) memcpy(p, b.symbols.data, b.symbols.length);
+            p += b.symbols.length;
+            if (b.strings.length) memcpy(p, b.strings.data, b.strings.length);
+        }
+    }
+
+    builder_free(&b);
+    return image;
+}
+
+/* ============================================================
+ * Cache Files
+ * ============================================================ */
+
+typedef struct {
+    const char *path;
+    char cache[1024];
+    unsigned char *image;
+    size_t size;
+    int mapped;                 /* image is mapped from the cache */
+} FaslJob;
+
+/* Loaded images, kept until fasl_release */
+static FaslJob *loaded = NULL;
+static int loaded_count = 0;
+static int loaded_capacity = 0;
+
+int fasl_cache_path(const char *source, char *out, size_t size) {
+    size_t length = strlen(source);
+    if (length >= 4 && strcmp(source + length - 4, ".scm") == 0) length -= 4;
+    int n = snprintf(out, size, "%.*s.fasl", (int)length, source);
+    return n > 0 && (size_t)n < size;
+}
+
+static char *read_source(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = length >= 0 ? (char *)malloc((size_t)length + 1) : NULL;
+    if (source) {
+        *size = fread(source, 1, (size_t)length, file);
+        source[*size] = '\0';
+    }
+    fclose(file);
+    return source;
+}
+
+static void unmap(unsigned char *image, size_t size, int mapped) {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(image, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(image);
+}
+
+/* Map a cache file, writable so references can be fixed up in place */
+static unsigned char *map_file(const char *path, size_t *size, int *mapped) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        image = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (image == MAP_FAILED) return NULL;
+
+    *size = (size_t)st.st_size;
+    *mapped = 1;
+    return (unsigned char *)image;
+#else
+    *mapped = 0;
+    return (unsigned char *)read_source(path, size);
+#endif
+}
+
+/* Check that an image is complete and was made by this build */
+static int image_valid(const unsigned char *image, size_t size) {
+    if (size < sizeof(FaslHeader)) return 0;
+
+    const FaslHeader *h = (const FaslHeader *)image;
+    if (memcmp(h->magic, FASL_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != FASL_VERSION || h->object_size != sizeof(LispObject)) {
+        return 0;
+    }
+
+    uint64_t expected = sizeof(FaslHeader) +
+                        (uint64_t)h->object_count * sizeof(LispObject) +
+                        (uint64_t)h->location_count * sizeof(BlockLocation) +
+                        h->symbols_length + h->strings_length;
+    if (expected != size) return 0;
+
+    /* Names and string data must end with their terminators */
+    const char *end = (const char *)image + size;
+    if (h->strings_length && end[-1] != '\0') return 0;
+    if (h->symbols_length && end[-1 - (ptrdiff_t)h->strings_length] != '\0') return 0;
+    return 1;
+}
+
+/* Use a source's cache if it is up to date */
+static int open_cache(FaslJob *job) {
+    struct stat st;
+    if (stat(job->path, &st) != 0) return 0;
+
+    job->image = map_file(job->cache, &job->size, &job->mapped);
+    if (!job->image) return 0;
+
+    const FaslHeader *h = (const FaslHeader *)job->image;
+    int fresh = image_valid(job->image, job->size) &&
+                h->source_size == (uint64_t)st.st_size;
+
+    /* Touched but possibly unchanged: compare contents */
+    if (fresh && h->source_mtime != (int64_t)st.st_mtime) {
+        size_t size;
+        char *source = read_source(job->path, &size);
+        fresh = source && size == h->source_size &&
+                hash_bytes(source, size) == h->source_hash;
+        free(source);
+    }
+
+    if (!fresh) {
+        unmap(job->image, job->size, job->mapped);
+        job->image = NULL;
+    }
+    return fresh;
+}
+
+/* Parse a source and rewrite its cache */
+static void compile_job(FaslJob *job) {
+    struct stat st;
+    if (stat(job->path, &st) != 0) return;
+
+    size_t size;
+    char *source = read_source(job->path, &size);
+    if (!source) return;
+
+    job->image = build_image(source, size, (int64_t)st.st_mtime, &job->size);
+    job->mapped = 0;
+    free(source);
+    if (!job->image) return;
+
+    /* Write a temporary file and rename it, so a cache is never seen
+     * half written; a cache that cannot be written is simply skipped */
+    char temp[sizeof(job->cache) + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", job->cache);
+    FILE *file = fopen(temp, "wb");
+    if (!file) return;
+    int ok = fwrite(job->image, 1, job->size, file) == job->size;
+    ok &= fclose(file) == 0;
+#ifdef _WIN32
+    if (ok) remove(job->cache);
+#endif
+    if (!ok || rename(temp, job->cache) != 0) remove(temp);
+}
+
+/* ============================================================
+ * Parsing in Parallel
+ * ============================================================ */
+
+typedef struct {
+    FaslJob **jobs;
+    int count;
+    int next;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} JobQueue;
+
+static void *worker(void *arg) {
+    JobQueue *queue = (JobQueue *)arg;
+    for (;;) {
+#ifndef _WIN32
+        pthread_mutex_lock(&queue->lock);
+#endif
+        int i = queue->next++;
+#ifndef _WIN32
+        pthread_mutex_unlock(&queue->lock);
+#endif
+        if (i >= queue->count) return NULL;
+        compile_job(queue->jobs[i]);
+    }
+}
+
+static int processor_count(void) {
+#if !defined(_WIN32) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return (int)n;
+#endif
+    return 1;
+}
+
+static void compile_jobs(FaslJob **jobs, int count, int threads) {
+    JobQueue queue;
+    queue.jobs = jobs;
+    queue.count = count;
+    queue.next = 0;
+
+    if (threads <= 0) threads = processor_count();
+    if (threads > count) threads = count;
+
+#ifndef _WIN32
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_t *pool = threads > 1 ? (pthread_t *)malloc((size_t)threads * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    if (pool) {
+        /* The calling thread is one of the workers */
+        while (started < threads - 1 &&
+               pthread_create(&pool[started], NULL, worker, &queue) == 0) {
+            started++;
+        }
+    }
+    worker(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(pool[i], NULL);
+    }
+    free(pool);
+    pthread_mutex_destroy(&queue.lock);
+#else
+    (void)threads;
+    worker(&queue);
+#endif
+}
+
+/* ============================================================
+ * Loading Images
+ * ============================================================ */
+
+static LispObject *resolve(uintptr_t ref, LispObject *objects, uint32_t object_count,
+                           LispObject **symbols, uint32_t symbol_count) {
+    uintptr_t index = REF_INDEX(ref);
+    switch (REF_TAG(ref)) {
+        case REF_OBJECT:
+            return index < object_count ? objects + index : NULL;
+        case REF_SYMBOL:
+            return index < symbol_count ? symbols[index] : NULL;
+        case REF_CONSTANT:
+            if (index == CONSTANT_NIL) return make_nil();
+            if (index == CONSTANT_TRUE) return make_boolean(1);
+            if (index == CONSTANT_FALSE) return make_boolean(0);
+            return NULL;
+        default:
+            return NULL;
+    }
+}
+
+/* Intern an image's symbols and turn its references into pointers;
+ * returns its list of forms, or NULL if the image is inconsistent */
+static LispObject *link_image(unsigned char *image, int file_id) {
+    FaslHeader *h = (FaslHeader *)image;
+    LispObject *objects = (LispObject *)(image + sizeof(FaslHeader));
+    BlockLocation *locations = (BlockLocation *)(objects + h->object_count);
+    const char *names = (const char *)(locations + h->location_count);
+    char *strings = (char *)names + h->symbols_length;
+
+    LispObject **symbols = (LispObject **)malloc((h->symbol_count + 1) * sizeof(LispObject *));
+    if (!symbols) return NULL;
+
+    const char *name = names;
+    const char *names_end = names + h->symbols_length;
+    for (uint32_t i = 0; i < h->symbol_count; i++) {
+        const char *nul = name < names_end ? (const char *)memchr(name, '\0', (size_t)(names_end - name)) : NULL;
+        if (!nul) {
+            free(symbols);
+            return NULL;
+        }
+        symbols[i] = make_symbol_n(name, (size_t)(nul - name));
+        name = nul + 1;
+    }
+
+    LispObject *root = NULL;
+    for (uint32_t i = 0; i < h->object_count; i++) {
+        LispObject *obj = &objects[i];
+        switch (obj->type) {
+            case LISP_CONS:
+                obj->cons.car = resolve((uintptr_t)obj->cons.car, objects, h->object_count,
+                                        symbols, h->symbol_count);
+                obj->cons.cdr = resolve((uintptr_t)obj->cons.cdr, objects, h->object_count,
+                                        symbols, h->symbol_count);
+                if (!obj->cons.car || !obj->cons.cdr) goto done;
+                break;
+
+            case LISP_STRING: {
+                uintptr_t offset = (uintptr_t)obj->string.data;
+                if (offset + obj->string.length >= h->strings_length) goto done;
+                obj->string.data = strings + offset;
+                break;
+            }
+
+            case LISP_NUMBER:
+            case LISP_CHARACTER:
+                break;
+
+            default:
+                goto done;
+        }
+        obj->gc_mark = GC_MARK_STATIC;
+        obj->has_location = 0;
+    }
+
+    srcloc_add_block(objects, h->object_count, file_id, locations, h->location_count);
+
+    root = resolve((uintptr_t)h->root, objects, h->object_count, symbols, h->symbol_count);
+
+done:
+    free(symbols);
+    return root;
+}
+
+static void keep_loaded(FaslJob *job) {
+    if (loaded_count == loaded_capacity) {
+        int capacity = loaded_capacity ? loaded_capacity * 2 : 16;
+        FaslJob *grown = (FaslJob *)realloc(loaded, (size_t)capacity * sizeof(FaslJob));
+        if (!grown) return;
+        loaded = grown;
+        loaded_capacity = capacity;
+    }
+    loaded[loaded_count++] = *job;
+}
+
+int fasl_load_files(const char *const *paths, int count,
+                    LispObject **programs, int threads) {
+    FaslJob *jobs = (FaslJob *)calloc((size_t)(count > 0 ? count : 1), sizeof(FaslJob));
+    FaslJob **stale = (FaslJob **)malloc((size_t)(count > 0 ? count : 1) * sizeof(FaslJob *));
+    if (!jobs || !stale) {
+        free(jobs);
+        free(stale);
+        for (int i = 0; i < count; i++) programs[i] = NULL;
+        return 0;
+    }
+
+    int stale_count = 0;
+    for (int i = 0; i < count; i++) {
+        jobs[i].path = paths[i];
+        if (!fasl_cache_path(paths[i], jobs[i].cache, sizeof(jobs[i].cache))) continue;
+        if (!open_cache(&jobs[i])) stale[stale_count++] = &jobs[i];
+    }
+
+    if (stale_count > 0) compile_jobs(stale, stale_count, threads);
+
+    int loaded_files = 0;
+    for (int i = 0; i < count; i++) {
+        FaslJob *job = &jobs[i];
+        programs[i] = NULL;
+        if (!job->image) continue;
+
+        programs[i] = link_image(job->image, srcloc_file(job->path));
+        if (programs[i]) {
+            keep_loaded(job);
+            loaded_files++;
+        } else {
+            unmap(job->image, job->size, job->mapped);
+        }
+    }
+
+    free(stale);
+    free(jobs);
+    return loaded_files;
+}
+
+void fasl_release(void) {
+    for (int i = 0; i < loaded_count; i++) {
+        unmap(loaded[i].image, loaded[i].size, loaded[i].mapped);
+    }
+    free(loaded);
+    loaded = NULL;
+    loaded_count = 0;
+    loaded_capacity = 0;
+}
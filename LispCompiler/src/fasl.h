@@ -0,0 +1,38 @@
+/*
+ * fasl.h - Cache of Parsed Source Files
+ *
+ * The forms of a source file can be saved in binary form next to it
+ * (foo.scm -> foo.fasl), so later runs skip lexing and parsing.  A fasl
+ * file is an image of the file's cons cells, numbers, characters and
+ * strings laid out as LispObjects, followed by the names of the symbols
+ * they use.  Loading maps the image, interns the symbols and turns the
+ * stored references into pointers; the objects are then used in place,
+ * outside the heap, like the static constants of compiled programs
+ * (GC_MARK_STATIC).
+ *
+ * A cache is used while the source's size and modification time match
+ * those recorded in it, or, if only the time differs, while the source's
+ * hash still matches.  Sources without a usable cache are parsed on a
+ * pool of threads and their caches rewritten.
+ */
+
+#ifndef FASL_H
+#define FASL_H
+
+#include "lisp.h"
+
+/* Load the top-level forms of each of count source files through their
+ * caches: programs[i] receives the list of forms of paths[i], or NULL
+ * if the file could not be read or has a syntax error (it is then not
+ * cached).  At most threads threads parse stale files (0: one per
+ * processor).  Returns the number of files loaded. */
+int fasl_load_files(const char *const *paths, int count,
+                    LispObject **programs, int threads);
+
+/* Path of the cache of a source file; returns 0 if it does not fit */
+int fasl_cache_path(const char *source, char *out, size_t size);
+
+/* Unmap all loaded images (after lisp_shutdown) */
+void fasl_release(void);
+
+#endif /* FASL_H */
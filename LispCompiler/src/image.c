@@ -0,0 +1,1230 @@
+/*
+ * image.c - Saved Heap Images
+ *
+ * Saving numbers every object and environment reachable from the global
+ * environment, breadth first, then writes:
+ *   ImageHeader
+ *   for each object, its type (and a symbol's name, a record's field
+ *     count or a record type's depth, which size its allocation)
+ *   for each object, its contents
+ *   for each environment, its parent, level and bindings in order
+ *   the source files and locations of located lists
+ *
+ * References are 32-bit: 0 is NULL, then nil, #t, #f and the transducer
+ * type, which are the loading process's own, then objects by index.  Loading reads the types first, so that every object exists
+ * before any contents refer to it; hash tables, persistent maps and
+ * persistent sets are filled last, once the keys they hash are
+ * complete.  Persistent collections are written as their elements and
+ * rebuilt, so versions that shared nodes load without sharing them.
+ */
+
+#include "image.h"
+#include "numvec.h"
+#include "pcoll.h"
+#include "primitives.h"
+#include "record.h"
+#include "srcloc.h"
+#include "text.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define IMAGE_MAGIC "LISPIMG"
+#define IMAGE_VERSION 6
+
+/* Object references */
+enum { REF_NULL, REF_NIL, REF_TRUE, REF_FALSE, REF_TRANSDUCER_TYPE, REF_FIRST_OBJECT };
+
+/* Streams of ports that are reopened on load */
+enum { STREAM_NONE, STREAM_STDIN, STREAM_STDOUT, STREAM_STDERR };
+
+/* Length of an absent string */
+#define NO_STRING UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_count;
+    uint32_t env_count;
+    uint32_t global;            /* Index of the global environment */
+    uint32_t file_count;
+    uint32_t location_count;
+} ImageHeader;
+
+/* ============================================================
+ * Address Maps
+ * ============================================================ */
+
+typedef struct {
+    const void **keys;          /* NULL for an empty slot */
+    uint32_t *values;
+    size_t size;                /* Power of two */
+    size_t count;
+} PointerMap;
+
+static size_t pointer_hash(const void *key, size_t size) {
+    uint64_t h = (uint64_t)(uintptr_t)key >> 3;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & (size - 1);
+}
+
+static int map_find(const PointerMap *map, const void *key, uint32_t *value) {
+    if (!map->size) return 0;
+    size_t i = pointer_hash(key, map->size);
+    while (map->keys[i]) {
+        if (map->keys[i] == key) {
+            *value = map->values[i];
+            return 1;
+        }
+        i = (i + 1) & (map->size - 1);
+    }
+    return 0;
+}
+
+static int map_add(PointerMap *map, const void *key, uint32_t value) {
+    if ((map->count + 1) * 2 > map->size) {
+        size_t size = map->size ? map->size * 2 : 1024;
+        const void **keys = (const void **)calloc(size, sizeof(void *));
+        uint32_t *values = (uint32_t *)malloc(size * sizeof(uint32_t));
+        if (!keys || !values) {
+            free(keys);
+            free(values);
+            return 0;
+        }
+        for (size_t i = 0; i < map->size; i++) {
+            if (!map->keys[i]) continue;
+            size_t j = pointer_hash(map->keys[i], size);
+            while (keys[j]) j = (j + 1) & (size - 1);
+            keys[j] = map->keys[i];
+            values[j] = map->values[i];
+        }
+        free(map->keys);
+        free(map->values);
+        map->keys = keys;
+        map->values = values;
+        map->size = size;
+    }
+
+    size_t i = pointer_hash(key, map->size);
+    while (map->keys[i]) i = (i + 1) & (map->size - 1);
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+    return 1;
+}
+
+static void map_free(PointerMap *map) {
+    free(map->keys);
+    free(map->values);
+}
+
+/* ============================================================
+ * Saving
+ * ============================================================ */
+
+typedef struct {
+    FILE *out;
+    int failed;
+
+    LispObject **objects;       /* By index; also the work list */
+    uint32_t object_count;
+    uint32_t object_capacity;
+    PointerMap object_index;
+
+    Environment **envs;
+    uint32_t env_count;
+    uint32_t env_capacity;
+    PointerMap env_index;
+} ImageWriter;
+
+static uint32_t object_ref(ImageWriter *w, LispObject *obj) {
+    if (!obj) return REF_NULL;
+    if (obj->type == LISP_NIL) return REF_NIL;
+    if (obj->type == LISP_BOOLEAN) return obj->boolean ? REF_TRUE : REF_FALSE;
+    if (obj == LISP_TRANSDUCER_TYPE) return REF_TRANSDUCER_TYPE;
+
+    uint32_t index;
+    if (map_find(&w->object_index, obj, &index)) return index + REF_FIRST_OBJECT;
+
+    if (w->object_count == w->object_capacity) {
+        uint32_t capacity = w->object_capacity ? w->object_capacity * 2 : 1024;
+        LispObject **grown = (LispObject **)realloc(w->objects, capacity * sizeof(LispObject *));
+        if (!grown) {
+            w->failed = 1;
+            return REF_NULL;
+        }
+        w->objects = grown;
+        w->object_capacity = capacity;
+    }
+    index = w->object_count;
+    if (!map_add(&w->object_index, obj, index)) {
+        w->failed = 1;
+        return REF_NULL;
+    }
+    w->objects[w->object_count++] = obj;
+    return index + REF_FIRST_OBJECT;
+}
+
+static uint32_t env_ref(ImageWriter *w, Environment *env) {
+    if (!env) return 0;
+
+    uint32_t index;
+    if (map_find(&w->env_index, env, &index)) return index + 1;
+
+    if (w->env_count == w->env_capacity) {
+        uint32_t capacity = w->env_capacity ? w->env_capacity * 2 : 64;
+        Environment **grown = (Environment **)realloc(w->envs, capacity * sizeof(Environment *));
+        if (!grown) {
+            w->failed = 1;
+            return 0;
+        }
+        w->envs = grown;
+        w->env_capacity = capacity;
+    }
+    index = w->env_count;
+    if (!map_add(&w->env_index, env, index)) {
+        w->failed = 1;
+        return 0;
+    }
+    w->envs[w->env_count++] = env;
+    return index + 1;
+}
+
+static void visit_entry(LispObject *key, LispObject *value, void *data) {
+    object_ref((ImageWriter *)data, key);
+    object_ref((ImageWriter *)data, value);
+}
+
+static void visit_element(LispObject *value, void *data) {
+    object_ref((ImageWriter *)data, value);
+}
+
+/* Number everything an object refers to */
+static void visit(ImageWriter *w, LispObject *obj) {
+    switch (obj->type) {
+        case LISP_CONS:
+            object_ref(w, obj->cons.car);
+            object_ref(w, obj->cons.cdr);
+            break;
+        case LISP_LAMBDA:
+            object_ref(w, obj->lambda.params);
+            object_ref(w, obj->lambda.body);
+            env_ref(w, obj->lambda.env);
+            break;
+        case LISP_MACRO:
+            object_ref(w, obj->macro.params);
+            object_ref(w, obj->macro.body);
+            env_ref(w, obj->macro.env);
+            break;
+        case LISP_VECTOR:
+            for (size_t i = 0; i < obj->vector.length; i++) {
+                object_ref(w, obj->vector.elements[i]);
+            }
+            break;
+        case LISP_HASHTABLE:
+            for (size_t i = 0; i < obj->hashtable.capacity; i++) {
+                if (!obj->hashtable.keys[i]) continue;
+                object_ref(w, obj->hashtable.keys[i]);
+                object_ref(w, obj->hashtable.values[i]);
+            }
+            break;
+        case LISP_RECORD_TYPE:
+            object_ref(w, obj->record_type.name);
+            object_ref(w, obj->record_type.parent);
+            object_ref(w, obj->record_type.fields);
+            break;
+        case LISP_RECORD:
+            object_ref(w, obj->record.rtd);
+            for (size_t i = 0; i < obj->record.count; i++) {
+                object_ref(w, RECORD_FIELDS(obj)[i]);
+            }
+            break;
+        case LISP_PRIMITIVE:
+            if (obj->primitive.data) object_ref(w, obj->primitive.data);
+            break;
+        case LISP_CONDITION:
+            object_ref(w, obj->condition.type);
+            object_ref(w, obj->condition.message);
+            object_ref(w, obj->condition.irritants);
+            object_ref(w, obj->condition.who);
+            break;
+        case LISP_VALUES:
+            for (int i = 0; i < obj->values.count; i++) {
+                object_ref(w, obj->values.vals[i]);
+            }
+            break;
+        case LISP_THREAD:
+            object_ref(w, obj->thread.thunk);
+            object_ref(w, obj->thread.name);
+            break;
+        case LISP_MUTEX:
+            object_ref(w, obj->mutex.name);
+            break;
+        case LISP_PROMISE:
+            object_ref(w, obj->promise.value);
+            env_ref(w, obj->promise.env);
+            break;
+        case LISP_PMAP:
+        case LISP_PSET:
+            pmap_each(obj, visit_entry, w);
+            break;
+        case LISP_PVECTOR:
+            pvector_each(obj, visit_element, w);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Number everything reachable from the global environment */
+static void collect(ImageWriter *w, Environment *global) {
+    uint32_t next_object = 0, next_env = 0;
+
+    env_ref(w, global);
+    while (!w->failed && (next_object < w->object_count || next_env < w->env_count)) {
+        while (next_env < w->env_count) {
+            Environment *env = w->envs[next_env++];
+            env_ref(w, env->parent);
+            for (Binding *b = env->bindings; b; b = b->next) {
+                object_ref(w, b->symbol);
+                object_ref(w, b->value);
+            }
+        }
+        while (next_object < w->object_count) {
+            visit(w, w->objects[next_object++]);
+        }
+    }
+}
+
+static void put_bytes(ImageWriter *w, const void *data, size_t size) {
+    if (size && fwrite(data, 1, size, w->out) != size) w->failed = 1;
+}
+
+static void put_u8(ImageWriter *w, uint8_t value) {
+    put_bytes(w, &value, sizeof(value));
+}
+
+static void put_u32(ImageWriter *w, uint32_t value) {
+    put_bytes(w, &value, sizeof(value));
+}
+
+static void put_u64(ImageWriter *w, uint64_t value) {
+    put_bytes(w, &value, sizeof(value));
+}
+
+static void put_string(ImageWriter *w, const char *text) {
+    if (!text) {
+        put_u32(w, NO_STRING);
+        return;
+    }
+    uint32_t length = (uint32_t)strlen(text);
+    put_u32(w, length);
+    put_bytes(w, text, length);
+}
+
+static void put_ref(ImageWriter *w, LispObject *obj) {
+    put_u32(w, object_ref(w, obj));
+}
+
+static void put_entry(LispObject *key, LispObject *value, void *data) {
+    put_ref((ImageWriter *)data, key);
+    put_ref((ImageWriter *)data, value);
+}
+
+static void put_key(LispObject *key, LispObject *value, void *data) {
+    (void)value;
+    put_ref((ImageWriter *)data, key);
+}
+
+static void put_element(LispObject *value, void *data) {
+    put_ref((ImageWriter *)data, value);
+}
+
+static void write_contents(ImageWriter *w, LispObject *obj) {
+    switch (obj->type) {
+        case LISP_NUMBER:
+            put_bytes(w, &obj->number, sizeof(obj->number));
+            break;
+
+        case LISP_CHARACTER:
+            put_u32(w, obj->character);
+            break;
+
+        case LISP_STRING:
+            put_u64(w, obj->string.length);
+            put_bytes(w, obj->string.data, obj->string.length);
+            break;
+
+        case LISP_CONS:
+            put_ref(w, obj->cons.car);
+            put_ref(w, obj->cons.cdr);
+            break;
+
+        case LISP_LAMBDA:
+            put_ref(w, obj->lambda.params);
+            put_ref(w, obj->lambda.body);
+            put_u32(w, env_ref(w, obj->lambda.env));
+            put_string(w, obj->lambda.name);
+            break;
+
+        case LISP_PRIMITIVE: {
+            /* A record procedure's kind + 1, or 0 */
+            int kind = record_proc_kind(obj);
+            put_string(w, obj->primitive.name);
+            put_u32(w, (uint32_t)obj->primitive.min_args);
+            put_u32(w, (uint32_t)obj->primitive.max_args);
+            put_u32(w, (uint32_t)(kind + 1));
+            if (kind >= 0) {
+                put_ref(w, obj->primitive.data);
+                put_u32(w, (uint32_t)obj->primitive.slot);
+            }
+            break;
+        }
+
+        case LISP_MACRO:
+            put_ref(w, obj->macro.params);
+            put_ref(w, obj->macro.body);
+            put_u32(w, env_ref(w, obj->macro.env));
+            break;
+
+        case LISP_VECTOR:
+            put_u64(w, obj->vector.length);
+            for (size_t i = 0; i < obj->vector.length; i++) {
+                put_ref(w, obj->vector.elements[i]);
+            }
+            break;
+
+        case LISP_BYTEVECTOR:
+            put_u64(w, obj->bytevector.length);
+            put_bytes(w, obj->bytevector.bytes, obj->bytevector.length);
+            break;
+
+        case LISP_NUMVECTOR:
+            /* Elements in the machine's own byte order */
+            put_u32(w, (uint32_t)obj->numvector.kind);
+            put_u64(w, obj->numvector.length);
+            put_bytes(w, obj->numvector.data,
+                      obj->numvector.length *
+                      numvec_element_size((NumvecKind)obj->numvector.kind));
+            break;
+
+        case LISP_HASHTABLE:
+            put_u32(w, (uint32_t)obj->hashtable.hash_type);
+            put_u64(w, obj->hashtable.capacity);
+            put_u64(w, obj->hashtable.count);
+            for (size_t i = 0; i < obj->hashtable.capacity; i++) {
+                if (!obj->hashtable.keys[i]) continue;
+                put_ref(w, obj->hashtable.keys[i]);
+                put_ref(w, obj->hashtable.values[i]);
+            }
+            break;
+
+        case LISP_RECORD_TYPE:
+            put_ref(w, obj->record_type.name);
+            put_ref(w, obj->record_type.parent);
+            put_ref(w, obj->record_type.fields);
+            put_u32(w, (uint32_t)obj->record_type.field_count);
+            put_u32(w, (uint32_t)obj->record_type.size);
+            put_u32(w, (uint32_t)obj->record_type.sealed);
+            put_u32(w, (uint32_t)obj->record_type.opaque);
+            break;
+
+        case LISP_RECORD:
+            put_ref(w, obj->record.rtd);
+            for (size_t i = 0; i < obj->record.count; i++) {
+                put_ref(w, RECORD_FIELDS(obj)[i]);
+            }
+            break;
+
+        case LISP_CONDITION:
+            put_ref(w, obj->condition.type);
+            put_ref(w, obj->condition.message);
+            put_ref(w, obj->condition.irritants);
+            put_ref(w, obj->condition.who);
+            break;
+
+        case LISP_VALUES:
+            put_u32(w, (uint32_t)obj->values.count);
+            for (int i = 0; i < obj->values.count; i++) {
+                put_ref(w, obj->values.vals[i]);
+            }
+            break;
+
+        case LISP_PORT: {
+            FILE *stream = (FILE *)obj->port.stream;
+            uint8_t id = STREAM_NONE;
+            if (obj->port.is_open) {
+                if (stream == stdin) id = STREAM_STDIN;
+                else if (stream == stdout) id = STREAM_STDOUT;
+                else if (stream == stderr) id = STREAM_STDERR;
+            }
+            put_u8(w, id);
+            put_u32(w, (uint32_t)obj->port.is_input);
+            put_u32(w, (uint32_t)obj->port.is_output);
+            put_u32(w, (uint32_t)obj->port.is_binary);
+            put_string(w, obj->port.name);
+            break;
+        }
+
+        /* Threads load as not started, mutexes as unlocked */
+        case LISP_THREAD:
+            put_ref(w, obj->thread.thunk);
+            put_ref(w, obj->thread.name);
+            break;
+
+        case LISP_MUTEX:
+            put_ref(w, obj->mutex.name);
+            break;
+
+        case LISP_PROMISE:
+            put_u32(w, (uint32_t)obj->promise.state);
+            put_u32(w, (uint32_t)obj->promise.op);
+            put_ref(w, obj->promise.value);
+            put_u32(w, env_ref(w, obj->promise.env));
+            break;
+
+        case LISP_PMAP:
+        case LISP_PSET:
+        case LISP_PVECTOR:
+            put_u32(w, obj->pcoll.edit != 0);
+            put_u64(w, obj->pcoll.count);
+            if (obj->type == LISP_PMAP) pmap_each(obj, put_entry, w);
+            else if (obj->type == LISP_PSET) pmap_each(obj, put_key, w);
+            else pvector_each(obj, put_element, w);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int image_save(const char *path, Environment *global) {
+    ImageWriter w;
+    memset(&w, 0, sizeof(w));
+
+    collect(&w, global);
+
+    /* Located lists, and the files they are in */
+    const char **files = NULL;
+    uint32_t file_count = 0;
+    uint32_t location_count = 0;
+    for (uint32_t i = 0; i < w.object_count; i++) {
+        const char *file;
+        if (!srcloc_get(w.objects[i], &file, NULL, NULL)) continue;
+        location_count++;
+
+        uint32_t f = 0;
+        while (f < file_count && files[f] != file) f++;
+        if (f == file_count) {
+            const char **grown = (const char **)realloc(files, (file_count + 1) * sizeof(char *));
+            if (!grown) {
+                w.failed = 1;
+                break;
+            }
+            files = grown;
+            files[file_count++] = file;
+        }
+    }
+
+    w.out = w.failed ? NULL : fopen(path, "wb");
+    if (w.out) {
+        ImageHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+        header.version = IMAGE_VERSION;
+        header.object_count = w.object_count;
+        header.env_count = w.env_count;
+        header.global = 0;
+        header.file_count = file_count;
+        header.location_count = location_count;
+        put_bytes(&w, &header, sizeof(header));
+
+        for (uint32_t i = 0; i < w.object_count; i++) {
+            LispObject *obj = w.objects[i];
+            put_u8(&w, (uint8_t)obj->type);
+            if (obj->type == LISP_SYMBOL) put_string(&w, obj->symbol.name);
+            if (obj->type == LISP_RECORD) put_u32(&w, (uint32_t)obj->record.count);
+            if (obj->type == LISP_RECORD_TYPE) put_u32(&w, (uint32_t)obj->record_type.depth);
+        }
+
+        for (uint32_t i = 0; i < w.object_count; i++) {
+            write_contents(&w, w.objects[i]);
+        }
+
+        for (uint32_t i = 0; i < w.env_count; i++) {
+            Environment *env = w.envs[i];
+            uint32_t count = 0;
+            for (Binding *b = env->bindings; b; b = b->next) count++;
+
+            put_u32(&w, env_ref(&w, env->parent));
+            put_u32(&w, (uint32_t)env->level);
+            put_u32(&w, count);
+            for (Binding *b = env->bindings; b; b = b->next) {
+                put_ref(&w, b->symbol);
+                put_ref(&w, b->value);
+            }
+        }
+
+        for (uint32_t f = 0; f < file_count; f++) {
+            put_string(&w, files[f]);
+        }
+        for (uint32_t i = 0; i < w.object_count; i++) {
+            const char *file;
+            int line, column;
+            if (!srcloc_get(w.objects[i], &file, &line, &column)) continue;
+
+            uint32_t f = 0;
+            while (files[f] != file) f++;
+            put_u32(&w, i);
+            put_u32(&w, f);
+            put_u32(&w, (uint32_t)line);
+            put_u32(&w, (uint32_t)column);
+        }
+
+        if (fclose(w.out) != 0) w.failed = 1;
+    } else {
+        w.failed = 1;
+    }
+
+    if (w.failed) {
+        lisp_error("Cannot write image '%s'", path);
+        remove(path);
+    }
+
+    free(files);
+    free(w.objects);
+    free(w.envs);
+    map_free(&w.object_index);
+    map_free(&w.env_index);
+    return w.failed ? 1 : 0;
+}
+
+/* ============================================================
+ * Loading
+ * ============================================================ */
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int failed;
+
+    LispObject **objects;
+    uint32_t object_count;
+    Environment **envs;
+    uint32_t env_count;
+} ImageReader;
+
+static const unsigned char *get_bytes(ImageReader *r, size_t size) {
+    if (r->failed || (size_t)(r->end - r->p) < size) {
+        r->failed = 1;
+        return NULL;
+    }
+    const unsigned char *data = r->p;
+    r->p += size;
+    return data;
+}
+
+static uint8_t get_u8(ImageReader *r) {
+    const unsigned char *p = get_bytes(r, 1);
+    return p ? *p : 0;
+}
+
+static uint32_t get_u32(ImageReader *r) {
+    uint32_t value = 0;
+    const unsigned char *p = get_bytes(r, sizeof(value));
+    if (p) memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t get_u64(ImageReader *r) {
+    uint64_t value = 0;
+    const unsigned char *p = get_bytes(r, sizeof(value));
+    if (p) memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/* A string in a new allocation (NULL if absent) */
+static char *get_string(ImageReader *r) {
+    uint32_t length = get_u32(r);
+    if (length == NO_STRING) return NULL;
+
+    const unsigned char *text = get_bytes(r, length);
+    char *copy = text ? (char *)malloc((size_t)length + 1) : NULL;
+    if (!copy) {
+        r->failed = 1;
+        return NULL;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static LispObject *get_ref(ImageReader *r) {
+    uint32_t ref = get_u32(r);
+    switch (ref) {
+        case REF_NULL:  return NULL;
+        case REF_NIL:   return make_nil();
+        case REF_TRUE:  return make_boolean(1);
+        case REF_FALSE: return make_boolean(0);
+        case REF_TRANSDUCER_TYPE: return LISP_TRANSDUCER_TYPE;
+        default:
+            if (ref - REF_FIRST_OBJECT < r->object_count) {
+                return r->objects[ref - REF_FIRST_OBJECT];
+            }
+            r->failed = 1;
+            return NULL;
+    }
+}
+
+static Environment *get_env(ImageReader *r) {
+    uint32_t ref = get_u32(r);
+    if (ref == 0) return NULL;
+    if (ref - 1 < r->env_count) return r->envs[ref - 1];
+    r->failed = 1;
+    return NULL;
+}
+
+/* Allocate an array of count object pointers, or fail */
+static LispObject **get_array(ImageReader *r, uint64_t count) {
+    if (count > (uint64_t)(r->end - r->p) / 4) {
+        r->failed = 1;
+        return NULL;
+    }
+    LispObject **array = (LispObject **)calloc(count ? (size_t)count : 1, sizeof(LispObject *));
+    if (!array) r->failed = 1;
+    return array;
+}
+
+/* Fill in an object's contents; hash tables only get their table here
+ * and are filled by fill_hashtable */
+static void read_contents(ImageReader *r, LispObject *obj) {
+    switch (obj->type) {
+        case LISP_NUMBER: {
+            const unsigned char *p = get_bytes(r, sizeof(obj->number));
+            if (p) memcpy(&obj->number, p, sizeof(obj->number));
+            break;
+        }
+
+        case LISP_CHARACTER:
+            obj->character = get_u32(r);
+            break;
+
+        case LISP_STRING: {
+            uint64_t length = get_u64(r);
+            const unsigned char *text = get_bytes(r, (size_t)length);
+            char *data = text && text_utf8_valid((const char *)text, (size_t)length) == length
+                ? (char *)malloc((size_t)length + 1) : NULL;
+            if (!data) {
+                r->failed = 1;
+                break;
+            }
+            memcpy(data, text, (size_t)length);
+            data[length] = '\0';
+            obj->string.data = data;
+            obj->string.length = (size_t)length;
+            obj->string.chars = text_utf8_count(data, (size_t)length);
+            obj->string.index = NULL;
+            break;
+        }
+
+        case LISP_SYMBOL:
+            break;
+
+        case LISP_CONS:
+            obj->cons.car = get_ref(r);
+            obj->cons.cdr = get_ref(r);
+            break;
+
+        case LISP_LAMBDA:
+            obj->lambda.params = get_ref(r);
+            obj->lambda.body = get_ref(r);
+            obj->lambda.env = get_env(r);
+            obj->lambda.name = get_string(r);
+            break;
+
+        case LISP_PRIMITIVE: {
+            char *name = get_string(r);
+            obj->primitive.min_args = (int)get_u32(r);
+            obj->primitive.max_args = (int)get_u32(r);
+            uint32_t kind = get_u32(r);
+            if (!name || kind > RECORD_MODIFIER + 1) {
+                r->failed = 1;
+                free(name);
+                break;
+            }
+
+            if (kind == 0) {
+                const PrimitiveDef *def = primitive_find(name);
+                if (!def) {
+                    lisp_error("Image uses unknown primitive '%s'", name);
+                    r->failed = 1;
+                    free(name);
+                    break;
+                }
+                obj->primitive.name = def->name;
+                obj->primitive.func = def->func;
+            } else {
+                /* A record procedure, checked by check_record_proc */
+                obj->primitive.name = make_symbol(name)->symbol.name;
+                obj->primitive.closure = record_proc_function((RecordProc)(kind - 1));
+                obj->primitive.data = get_ref(r);
+                obj->primitive.slot = (int)get_u32(r);
+                if (!obj->primitive.data) r->failed = 1;
+            }
+            free(name);
+            break;
+        }
+
+        case LISP_MACRO:
+            obj->macro.params = get_ref(r);
+            obj->macro.body = get_ref(r);
+            obj->macro.env = get_env(r);
+            break;
+
+        case LISP_VECTOR: {
+            uint64_t length = get_u64(r);
+            LispObject **elements = get_array(r, length);
+            if (!elements) break;
+            for (uint64_t i = 0; i < length; i++) {
+                elements[i] = get_ref(r);
+            }
+            obj->vector.elements = elements;
+            obj->vector.length = (size_t)length;
+            break;
+        }
+
+        case LISP_BYTEVECTOR: {
+            uint64_t length = get_u64(r);
+            const unsigned char *bytes = get_bytes(r, (size_t)length);
+            uint8_t *copy = bytes ? (uint8_t *)malloc(length ? (size_t)length : 1) : NULL;
+            if (!copy) {
+                r->failed = 1;
+                break;
+            }
+            memcpy(copy, bytes, (size_t)length);
+            obj->bytevector.bytes = copy;
+            obj->bytevector.length = (size_t)length;
+            break;
+        }
+
+        case LISP_NUMVECTOR: {
+            uint32_t kind = get_u32(r);
+            uint64_t length = get_u64(r);
+            if (kind == NUMVEC_U8 || kind >= NUMVEC_KIND_COUNT ||
+                length > SIZE_MAX / 8) {
+                r->failed = 1;
+                break;
+            }
+            size_t bytes = (size_t)length * numvec_element_size((NumvecKind)kind);
+            const unsigned char *data = get_bytes(r, bytes);
+            void *copy = data ? malloc(bytes ? bytes : 1) : NULL;
+            if (!copy) {
+                r->failed = 1;
+                break;
+            }
+            memcpy(copy, data, bytes);
+            obj->numvector.data = copy;
+            obj->numvector.length = (size_t)length;
+            obj->numvector.kind = (int)kind;
+            break;
+        }
+
+        case LISP_HASHTABLE: {
+            int hash_type = (int)get_u32(r);
+            uint64_t capacity = get_u64(r);
+            uint64_t count = get_u64(r);
+            if (count > capacity || !get_bytes(r, (size_t)count * 8)) {
+                r->failed = 1;
+                break;
+            }
+            LispObject **keys = (LispObject **)calloc((size_t)capacity, sizeof(LispObject *));
+            LispObject **values = (LispObject **)calloc((size_t)capacity, sizeof(LispObject *));
+            if (!keys || !values) {
+                free(keys);
+                free(values);
+                r->failed = 1;
+                break;
+            }
+            obj->hashtable.hash_type = hash_type;
+            obj->hashtable.keys = keys;
+            obj->hashtable.values = values;
+            obj->hashtable.capacity = (size_t)capacity;
+            break;
+        }
+
+        case LISP_RECORD_TYPE:
+            obj->record_type.name = get_ref(r);
+            obj->record_type.parent = get_ref(r);
+            obj->record_type.fields = get_ref(r);
+            obj->record_type.field_count = (int)get_u32(r);
+            obj->record_type.size = (int)get_u32(r);
+            obj->record_type.sealed = (uint8_t)get_u32(r);
+            obj->record_type.opaque = (uint8_t)get_u32(r);
+            break;
+
+        case LISP_RECORD:
+            obj->record.rtd = get_ref(r);
+            for (size_t i = 0; i < obj->record.count && !r->failed; i++) {
+                RECORD_FIELDS(obj)[i] = get_ref(r);
+            }
+            break;
+
+        case LISP_CONDITION:
+            obj->condition.type = get_ref(r);
+            obj->condition.message = get_ref(r);
+            obj->condition.irritants = get_ref(r);
+            obj->condition.who = get_ref(r);
+            break;
+
+        case LISP_VALUES: {
+            uint32_t count = get_u32(r);
+            LispObject **vals = get_array(r, count);
+            if (!vals) break;
+            for (uint32_t i = 0; i < count; i++) {
+                vals[i] = get_ref(r);
+            }
+            obj->values.vals = vals;
+            obj->values.count = (int)count;
+            break;
+        }
+
+        case LISP_PORT: {
+            uint8_t id = get_u8(r);
+            obj->port.is_input = (int)get_u32(r);
+            obj->port.is_output = (int)get_u32(r);
+            obj->port.is_binary = (int)get_u32(r);
+            obj->port.name = get_string(r);
+            obj->port.stream = id == STREAM_STDIN ? (void *)stdin :
+                               id == STREAM_STDOUT ? (void *)stdout :
+                               id == STREAM_STDERR ? (void *)stderr : NULL;
+            obj->port.is_open = obj->port.stream != NULL;
+            obj->port.is_string = 0;    /* String ports load closed */
+            break;
+        }
+
+        case LISP_THREAD:
+            obj->thread.thunk = get_ref(r);
+            obj->thread.name = get_ref(r);
+            break;
+
+        case LISP_MUTEX:
+            obj->mutex.name = get_ref(r);
+            break;
+
+        case LISP_PROMISE:
+            obj->promise.state = (int)get_u32(r);
+            obj->promise.op = (int)get_u32(r);
+            obj->promise.value = get_ref(r);
+            obj->promise.env = get_env(r);
+            break;
+
+        case LISP_PMAP:
+        case LISP_PSET: {
+            get_u32(r);
+            uint64_t count = get_u64(r);
+            uint64_t width = obj->type == LISP_PMAP ? 2 : 1;
+            if (count > (uint64_t)(r->end - r->p) / (4 * width) ||
+                !get_bytes(r, (size_t)(count * width * 4))) {
+                r->failed = 1;
+            }
+            break;
+        }
+
+        case LISP_PVECTOR: {
+            uint32_t transient = get_u32(r);
+            uint64_t count = get_u64(r);
+            if (count > (uint64_t)(r->end - r->p) / 4) {
+                r->failed = 1;
+                break;
+            }
+            LispObject *vec = pcoll_transient(make_pvector());
+            for (uint64_t i = 0; i < count && !r->failed; i++) {
+                vec = pvector_push(vec, get_ref(r));
+            }
+            obj->pcoll = vec->pcoll;
+            if (!transient) pcoll_persistent(obj);
+            break;
+        }
+
+        default:
+            r->failed = 1;
+            break;
+    }
+}
+
+/* Insert a hash table's entries, now that its keys are complete */
+static void fill_hashtable(ImageReader *r, LispObject *ht) {
+    get_u32(r);
+    get_u64(r);
+    uint64_t count = get_u64(r);
+    for (uint64_t i = 0; i < count && !r->failed; i++) {
+        LispObject *key = get_ref(r);
+        LispObject *value = get_ref(r);
+        if (key) hashtable_set(ht, key, value);
+    }
+}
+
+/* Insert a persistent map's or set's entries, the same way */
+static void fill_pmap(ImageReader *r, LispObject *obj) {
+    uint32_t transient = get_u32(r);
+    uint64_t count = get_u64(r);
+    LispObject *coll = pcoll_transient(obj->type == LISP_PMAP ? make_pmap() : make_pset());
+    for (uint64_t i = 0; i < count && !r->failed; i++) {
+        LispObject *key = get_ref(r);
+        LispObject *value = obj->type == LISP_PMAP ? get_ref(r) : key;
+        if (key) coll = pmap_set(coll, key, value);
+    }
+    obj->pcoll = coll->pcoll;
+    if (!transient) pcoll_persistent(obj);
+}
+
+/* Fill in a record type's ancestors and check that records and record
+ * procedures fit their types, now that every type is read */
+static int check_record_object(LispObject *obj) {
+    switch (obj->type) {
+        case LISP_RECORD_TYPE: {
+            LispObject *t = obj;
+            for (int depth = obj->record_type.depth; depth >= 0; depth--) {
+                if (!is_record_type(t)) return 0;
+                RECORD_TYPE_ANCESTORS(obj)[depth] = t;
+                t = t->record_type.parent;
+            }
+            LispObject *parent = obj->record_type.parent;
+            int inherited = is_record_type(parent) ? parent->record_type.size : 0;
+            return !is_record_type(t) && obj->record_type.field_count >= 0 &&
+                   obj->record_type.size == obj->record_type.field_count + inherited;
+        }
+
+        case LISP_RECORD:
+            return is_record_type(obj->record.rtd) &&
+                   (size_t)obj->record.rtd->record_type.size == obj->record.count;
+
+        case LISP_PRIMITIVE: {
+            int kind = record_proc_kind(obj);
+            LispObject *data = obj->primitive.data;
+            if (kind < 0) return 1;
+            if (kind != RECORD_CONSTRUCTOR) {
+                return is_record_type(data) && obj->primitive.slot >= 0 &&
+                       obj->primitive.slot < data->record_type.size;
+            }
+            if (!is_vector(data) || data->vector.length == 0 ||
+                !is_record_type(data->vector.elements[0])) {
+                return 0;
+            }
+            for (size_t i = 1; i < data->vector.length; i++) {
+                LispObject *index = data->vector.elements[i];
+                if (!is_number(index) || !(index->number >= 0) ||
+                    index->number >= data->vector.elements[0]->record_type.size) {
+                    return 0;
+                }
+            }
+            return 1;
+        }
+
+        default:
+            return 1;
+    }
+}
+
+/* Map or read a whole file */
+static unsigned char *map_image(const char *path, size_t *size, int *mapped) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data != MAP_FAILED) {
+            *size = (size_t)st.st_size;
+            *mapped = 1;
+            return (unsigned char *)data;
+        }
+    }
+#endif
+    *mapped = 0;
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = length > 0 ? (unsigned char *)malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+static void unmap_image(unsigned char *data, size_t size, int mapped) {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(data);
+}
+
+Environment *image_load(const char *path) {
+    size_t size;
+    int mapped;
+    unsigned char *data = map_image(path, &size, &mapped);
+    if (!data) {
+        lisp_error("Cannot read image '%s'", path);
+        return NULL;
+    }
+
+    ImageHeader header;
+    if (size < sizeof(header)) {
+        memset(&header, 0, sizeof(header));
+    } else {
+        memcpy(&header, data, sizeof(header));
+    }
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+        header.version != IMAGE_VERSION || header.global >= header.env_count ||
+        header.object_count > size || header.env_count > size) {
+        lisp_error("'%s' is not an image saved by this version", path);
+        unmap_image(data, size, mapped);
+        return NULL;
+    }
+
+    ImageReader r;
+    memset(&r, 0, sizeof(r));
+    r.p = data + sizeof(header);
+    r.end = data + size;
+    r.object_count = header.object_count;
+    r.env_count = header.env_count;
+    r.objects = (LispObject **)calloc(header.object_count + 1, sizeof(LispObject *));
+    r.envs = (Environment **)calloc(header.env_count, sizeof(Environment *));
+    const unsigned char **tables = (const unsigned char **)calloc(header.object_count + 1, sizeof(char *));
+    r.failed = !r.objects || !r.envs || !tables;
+
+    /* Nothing is rooted until the global environment is returned */
+    gc_pause();
+
+    /* Every object, so contents can refer to any of them */
+    for (uint32_t i = 0; i < r.object_count && !r.failed; i++) {
+        uint8_t type = get_u8(&r);
+        if (type == LISP_SYMBOL) {
+            uint32_t length = get_u32(&r);
+            const unsigned char *name = get_bytes(&r, length);
+            if (name) r.objects[i] = make_symbol_n((const char *)name, length);
+        } else if (type == LISP_RECORD || type == LISP_RECORD_TYPE) {
+            /* Each field is at least a reference; no type is deeper
+             * than there are types */
+            uint32_t count = get_u32(&r);
+            if (type == LISP_RECORD ? count <= (size_t)(r.end - r.p) / 4
+                                    : count < r.object_count) {
+                size_t slots = type == LISP_RECORD ? count : (size_t)count + 1;
+                LispObject *obj = lisp_alloc_tail(slots * sizeof(LispObject *));
+                obj->type = (LispType)type;
+                if (type == LISP_RECORD) obj->record.count = count;
+                else obj->record_type.depth = (int)count;
+                r.objects[i] = obj;
+            }
+        } else if (type == LISP_THREAD || type == LISP_MUTEX) {
+            LispObject *obj = type == LISP_THREAD ? make_thread(NULL, NULL) : make_mutex(NULL);
+            if (obj->type == type) r.objects[i] = obj;
+        } else if ((type <= LISP_PORT && type != LISP_NIL && type != LISP_BOOLEAN) ||
+                   type == LISP_PROMISE || type == LISP_NUMVECTOR ||
+                   type == LISP_PMAP || type == LISP_PSET || type == LISP_PVECTOR) {
+            r.objects[i] = lisp_alloc();
+            if (r.objects[i]) r.objects[i]->type = (LispType)type;
+        }
+        if (!r.objects[i]) r.failed = 1;
+    }
+    for (uint32_t i = 0; i < r.env_count && !r.failed; i++) {
+        r.envs[i] = env_create(NULL);
+    }
+
+    for (uint32_t i = 0; i < r.object_count && !r.failed; i++) {
+        LispType type = r.objects[i]->type;
+        if (type == LISP_HASHTABLE || type == LISP_PMAP || type == LISP_PSET) tables[i] = r.p;
+        read_contents(&r, r.objects[i]);
+    }
+
+    for (uint32_t i = 0; i < r.env_count && !r.failed; i++) {
+        Environment *env = r.envs[i];
+        env->parent = get_env(&r);
+        env->level = (int)get_u32(&r);
+
+        uint32_t count = get_u32(&r);
+        Binding **tail = &env->bindings;
+        for (uint32_t j = 0; j < count && !r.failed; j++) {
+            Binding *b = (Binding *)malloc(sizeof(Binding));
+            if (!b) {
+                r.failed = 1;
+                break;
+            }
+            b->symbol = get_ref(&r);
+            b->value = get_ref(&r);
+            b->next = NULL;
+            *tail = b;
+            tail = &b->next;
+        }
+    }
+
+    uint32_t *file_ids = (uint32_t *)calloc(header.file_count + 1, sizeof(uint32_t));
+    if (!file_ids) r.failed = 1;
+    for (uint32_t f = 0; f < header.file_count && !r.failed; f++) {
+        char *name = get_string(&r);
+        file_ids[f] = (uint32_t)srcloc_file(name);
+        free(name);
+    }
+    for (uint32_t i = 0; i < header.location_count && !r.failed; i++) {
+        uint32_t object = get_u32(&r);
+        uint32_t file = get_u32(&r);
+        uint32_t line = get_u32(&r);
+        uint32_t column = get_u32(&r);
+        if (object < r.object_count && file < header.file_count) {
+            srcloc_set(r.objects[object], (int)file_ids[file], (int)line, (int)column);
+        }
+    }
+    free(file_ids);
+
+    for (uint32_t i = 0; i < r.object_count && !r.failed; i++) {
+        if (!check_record_object(r.objects[i])) r.failed = 1;
+    }
+
+    for (uint32_t i = 0; i < r.object_count && !r.failed; i++) {
+        if (!tables[i]) continue;
+        ImageReader table = r;
+        table.p = tables[i];
+        if (r.objects[i]->type == LISP_HASHTABLE) fill_hashtable(&table, r.objects[i]);
+        else fill_pmap(&table, r.objects[i]);
+        r.failed = table.failed;
+    }
+
+    gc_resume();
+
+    Environment *global = NULL;
+    if (!r.failed) {
+        global = r.envs[header.global];
+    } else {
+        lisp_error("Image '%s' is damaged", path);
+        for (uint32_t i = 0; i < r.env_count && r.envs; i++) {
+            env_free(r.envs[i]);
+        }
+    }
+
+    free(tables);
+    free(r.objects);
+    free(r.envs);
+    unmap_image(data, size, mapped);
+    return global;
+}
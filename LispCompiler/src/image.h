@@ -0,0 +1,30 @@
+/*
+ * image.h - Saved Heap Images
+ *
+ * An image holds a global environment and everything reachable from it:
+ * the objects, the symbols they use, the environments of closures and
+ * the source locations of forms.  Loading one replaces creating the
+ * global environment, registering the primitives and evaluating library
+ * code, so an interpreter can start from a warm environment.
+ *
+ * Objects are stored by index, so an image does not depend on where
+ * anything was in memory.  Primitives are stored by name and linked to
+ * this build's functions on load.  Open ports other than the standard
+ * streams are saved closed.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "lisp.h"
+#include "env.h"
+
+/* Save a global environment and everything reachable from it; returns 0
+ * on success */
+int image_save(const char *path, Environment *global);
+
+/* Load an image saved by image_save (after lisp_init); returns its
+ * global environment, or NULL if the image cannot be loaded */
+Environment *image_load(const char *path);
+
+#endif /* IMAGE_H */
@@ -1,38 +1,81 @@
 /*
  * lexer.c - Lisp Lexical Analyzer Implementation
+ *
+ * Tokens are views into the source text, so lexing allocates nothing.
+ * Whitespace runs and string bodies are scanned 16 bytes at a time with
+ * SSE2 where available, comments with memchr, and line numbers are only
+ * counted when a location is asked for (error messages).
  */
 
 #include "lexer.h"
+#include "number.h"
+#include "text.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEXER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Character classes */
+enum {
+    CHAR_SPACE = 1,     /* Whitespace */
+    CHAR_DELIMITER = 2  /* Ends a symbol */
+};
+
+static const unsigned char char_class[256] = {
+    [' ']  = CHAR_SPACE | CHAR_DELIMITER,
+    ['\t'] = CHAR_SPACE | CHAR_DELIMITER,
+    ['\n'] = CHAR_SPACE | CHAR_DELIMITER,
+    ['\r'] = CHAR_SPACE | CHAR_DELIMITER,
+    ['\0'] = CHAR_DELIMITER,
+    ['(']  = CHAR_DELIMITER,
+    [')']  = CHAR_DELIMITER,
+    ['"']  = CHAR_DELIMITER,
+    [';']  = CHAR_DELIMITER,
+    ['\''] = CHAR_DELIMITER,
+    ['`']  = CHAR_DELIMITER,
+    [',']  = CHAR_DELIMITER,
+};
+
+/* Names of characters (R7RS) */
+static const struct {
+    const char *name;
+    uint32_t code;
+} char_names[] = {
+    {"alarm", 0x07}, {"backspace", 0x08}, {"delete", 0x7F}, {"escape", 0x1B},
+    {"newline", '\n'}, {"null", 0x00}, {"return", '\r'}, {"space", ' '},
+    {"tab", '\t'},
+};
+
+#define CHAR_NAME_COUNT (sizeof(char_names) / sizeof(char_names[0]))
+
 /* Initialize lexer */
 void lexer_init(Lexer *lex, const char *source) {
+    lexer_init_at(lex, source, 1, 1);
+}
+
+void lexer_init_at(Lexer *lex, const char *source, int line, int column) {
     lex->source = source;
+    lex->end = source + strlen(source);
     lex->start = source;
     lex->current = source;
-    lex->line = 1;
-    lex->column = 1;
-    lex->start_line = 1;
-    lex->start_column = 1;
+    lex->line_mark = source;
+    lex->line = line;
+    lex->first_line = line;
+    lex->first_column = column;
 }
 
 /* Character utilities */
 static int is_at_end(Lexer *lex) {
-    return *lex->current == '\0';
+    return lex->current >= lex->end;
 }
 
 static char advance(Lexer *lex) {
-    char c = *lex->current++;
-    if (c == '\n') {
-        lex->line++;
-        lex->column = 1;
-    } else {
-        lex->column++;
-    }
-    return c;
+    return *lex->current++;
 }
 
 char lexer_peek(Lexer *lex) {
@@ -45,7 +88,7 @@ char lexer_peek_next(Lexer *lex) {
 }
 
 static int is_whitespace(char c) {
-    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    return (char_class[(unsigned char)c] & CHAR_SPACE) != 0;
 }
 
 static int is_digit(char c) {
@@ -54,27 +97,80 @@ static int is_digit(char c) {
 
 /* Symbol character rules - very permissive in Lisp */
 static int is_symbol_char(char c) {
-    if (c == '\0' || is_whitespace(c)) return 0;
-    if (c == '(' || c == ')') return 0;
-    if (c == '"' || c == ';') return 0;
-    if (c == '\'' || c == '`' || c == ',') return 0;
-    return 1;
+    return char_class[(unsigned char)c] == 0;
 }
 
 static int is_symbol_start(char c) {
     return is_symbol_char(c) && c != '#';
 }
 
+#ifdef LEXER_SSE2
+/* Index of the lowest set bit of a nonzero mask */
+static int lowest_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+#endif
+
+/* First byte at or after p that is not whitespace */
+static const char *skip_spaces(const char *p, const char *end) {
+#ifdef LEXER_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, cr)));
+        unsigned int other = ~(unsigned int)_mm_movemask_epi8(match) & 0xFFFF;
+        if (other) return p + lowest_bit(other);
+        p += 16;
+    }
+#endif
+    while (p < end && is_whitespace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/* First '"' or '\\' at or after p, or end */
+static const char *find_string_special(const char *p, const char *end) {
+#ifdef LEXER_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        unsigned int match = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)));
+        if (match) return p + lowest_bit(match);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') {
+        p++;
+    }
+    return p;
+}
+
 /* Create a token */
 static Token make_token(Lexer *lex, TokenType type) {
     Token tok;
     tok.type = type;
-    int len = (int)(lex->current - lex->start);
-    tok.text = (char *)malloc(len + 1);
-    memcpy(tok.text, lex->start, len);
-    tok.text[len] = '\0';
-    tok.line = lex->start_line;
-    tok.column = lex->start_column;
+    tok.text = lex->start;
+    tok.length = (size_t)(lex->current - lex->start);
+    tok.offset = (size_t)(lex->start - lex->source);
     tok.value.number = 0;
     return tok;
 }
@@ -82,28 +178,23 @@ static Token make_token(Lexer *lex, TokenType type) {
 static Token make_error_token(Lexer *lex, const char *message) {
     Token tok;
     tok.type = TOK_ERROR;
-    tok.text = strdup(message);
-    tok.line = lex->line;
-    tok.column = lex->column;
+    tok.text = message;
+    tok.length = strlen(message);
+    tok.offset = (size_t)(lex->current - lex->source);
+    tok.value.number = 0;
     return tok;
 }
 
 /* Skip whitespace and comments */
 static void skip_whitespace(Lexer *lex) {
     while (1) {
-        char c = lexer_peek(lex);
-
-        /* Whitespace */
-        if (is_whitespace(c)) {
-            advance(lex);
-            continue;
-        }
+        lex->current = skip_spaces(lex->current, lex->end);
 
         /* Line comment */
-        if (c == ';') {
-            while (lexer_peek(lex) != '\n' && !is_at_end(lex)) {
-                advance(lex);
-            }
+        if (lexer_peek(lex) == ';') {
+            const char *eol = (const char *)memchr(lex->current, '\n',
+                                                   (size_t)(lex->end - lex->current));
+            lex->current = eol ? eol : lex->end;
             continue;
         }
 
@@ -143,62 +234,100 @@ static Token read_number(Lexer *lex) {
     }
 
     Token tok = make_token(lex, TOK_NUMBER);
-    tok.value.number = strtod(tok.text, NULL);
+    if (!number_parse(tok.text, tok.length, &tok.value.number)) {
+        return make_error_token(lex, "Malformed number");
+    }
     return tok;
 }
 
-/* Read a string */
+/* Read a string: the token is the body between the quotes, decoded by
+ * lexer_unescape when it has escape sequences */
 static Token read_string(Lexer *lex) {
     advance(lex);  /* consume opening quote */
 
-    /* Accumulate string content */
-    size_t capacity = 64;
+    const char *body = lex->current;
+    int escapes = 0;
+
+    while (1) {
+        lex->current = find_string_special(lex->current, lex->end);
+        if (is_at_end(lex)) {
+            return make_error_token(lex, "Unterminated string");
+        }
+        if (lexer_peek(lex) == '"') break;
+
+        /* Escape sequence */
+        escapes = 1;
+        advance(lex);
+        if (is_at_end(lex)) {
+            return make_error_token(lex, "Unterminated string");
+        }
+        advance(lex);
+    }
+
+    Token tok = make_token(lex, TOK_STRING);
+    tok.text = body;
+    tok.length = (size_t)(lex->current - body);
+    tok.value.escapes = escapes;
+
+    advance(lex);  /* consume closing quote */
+    return tok;
+}
+
+/* The value of the length hex digits at text, if they are 1 to 6
+ * digits naming a Unicode scalar value */
+static int parse_hex_code(const char *text, size_t length, uint32_t *code) {
+    if (length == 0 || length > 6) return 0;
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return 0;
+        value = value * 16 + (uint32_t)digit;
+    }
+    if (!text_is_scalar(value)) return 0;
+    *code = value;
+    return 1;
+}
+
+/* Decode a string token's escape sequences.  \xHH; writes the UTF-8 of
+ * the character HH, which is never longer than the escape. */
+size_t lexer_unescape(const Token *tok, char *out) {
     size_t length = 0;
-    char *buffer = (char *)malloc(capacity);
 
-    while (!is_at_end(lex) && lexer_peek(lex) != '"') {
-        char c = advance(lex);
+    for (size_t i = 0; i < tok->length; i++) {
+        char c = tok->text[i];
 
-        if (c == '\\') {
-            /* Escape sequence */
-            if (is_at_end(lex)) {
-                free(buffer);
-                return make_error_token(lex, "Unterminated string");
-            }
-            c = advance(lex);
+        if (c == '\\' && i + 1 < tok->length) {
+            c = tok->text[++i];
             switch (c) {
                 case 'n':  c = '\n'; break;
                 case 't':  c = '\t'; break;
                 case 'r':  c = '\r'; break;
+                case 'a':  c = '\a'; break;
+                case 'b':  c = '\b'; break;
                 case '\\': c = '\\'; break;
                 case '"':  c = '"';  break;
+                case 'x': {
+                    const char *digits = tok->text + i + 1;
+                    const char *semicolon = (const char *)memchr(digits, ';', tok->length - i - 1);
+                    uint32_t code;
+                    if (semicolon && parse_hex_code(digits, (size_t)(semicolon - digits), &code)) {
+                        length += text_utf8_encode(code, out + length);
+                        i = (size_t)(semicolon - tok->text);
+                        continue;
+                    }
+                    break;
+                }
                 default:
                     /* Keep the character as-is */
                     break;
             }
         }
-
-        /* Grow buffer if needed */
-        if (length + 1 >= capacity) {
-            capacity *= 2;
-            buffer = (char *)realloc(buffer, capacity);
-        }
-        buffer[length++] = c;
+        out[length++] = c;
     }
-
-    if (is_at_end(lex)) {
-        free(buffer);
-        return make_error_token(lex, "Unterminated string");
-    }
-
-    advance(lex);  /* consume closing quote */
-    buffer[length] = '\0';
-
-    Token tok = make_token(lex, TOK_STRING);
-    free(tok.text);
-    tok.text = buffer;
-    tok.value.string = buffer;
-    return tok;
+    return length;
 }
 
 /* Read a symbol */
@@ -206,7 +335,14 @@ static Token read_symbol(Lexer *lex) {
     while (is_symbol_char(lexer_peek(lex))) {
         advance(lex);
     }
-    return make_token(lex, TOK_SYMBOL);
+    Token tok = make_token(lex, TOK_SYMBOL);
+
+    /* +inf.0, -inf.0 and +nan.0 are numbers */
+    if (tok.length == 6 && (tok.text[0] == '+' || tok.text[0] == '-') &&
+        number_parse(tok.text, tok.length, &tok.value.number)) {
+        tok.type = TOK_NUMBER;
+    }
+    return tok;
 }
 
 /* Read a hash literal (#t, #f, #\char) */
@@ -242,29 +378,44 @@ static Token read_hash_literal(Lexer *lex) {
             return make_error_token(lex, "Unexpected end in character literal");
         }
 
-        /* Check for named characters */
+        /* One character, then any more up to a delimiter: a name such
+         * as space, or x and hex digits */
         const char *start = lex->current;
-        while (!is_at_end(lex) && !is_whitespace(lexer_peek(lex)) &&
-               lexer_peek(lex) != '(' && lexer_peek(lex) != ')') {
+        uint32_t first = (unsigned char)*start;
+        size_t first_length = 1;
+        if (first >= 0x80) {
+            size_t available = (size_t)(lex->end - start);
+            size_t n = first < 0xE0 ? 2 : first < 0xF0 ? 3 : 4;
+            if (n <= available && text_utf8_valid(start, n) == n) {
+                first_length = text_utf8_decode(start, n, &first);
+            } else {
+                first = TEXT_REPLACEMENT;
+            }
+        }
+        lex->current += first_length;
+        while (is_symbol_char(lexer_peek(lex))) {
             advance(lex);
         }
 
-        int len = (int)(lex->current - start);
+        size_t len = (size_t)(lex->current - start);
         Token tok = make_token(lex, TOK_CHARACTER);
 
-        if (len == 1) {
-            tok.value.character = start[0];
-        } else if (len == 7 && strncmp(start, "newline", 7) == 0) {
-            tok.value.character = '\n';
-        } else if (len == 5 && strncmp(start, "space", 5) == 0) {
-            tok.value.character = ' ';
-        } else if (len == 3 && strncmp(start, "tab", 3) == 0) {
-            tok.value.character = '\t';
-        } else if (len == 6 && strncmp(start, "return", 6) == 0) {
-            tok.value.character = '\r';
+        if (len == first_length) {
+            tok.value.character = first;
+        } else if ((start[0] == 'x' || start[0] == 'X') &&
+                   parse_hex_code(start + 1, len - 1, &tok.value.character)) {
+            /* #\x3bb */
         } else {
-            free(tok.text);
-            return make_error_token(lex, "Unknown character name");
+            size_t i = 0;
+            while (i < CHAR_NAME_COUNT &&
+                   !(strlen(char_names[i].name) == len &&
+                     strncmp(start, char_names[i].name, len) == 0)) {
+                i++;
+            }
+            if (i == CHAR_NAME_COUNT) {
+                return make_error_token(lex, "Unknown character name");
+            }
+            tok.value.character = char_names[i].code;
         }
 
         return tok;
@@ -278,8 +429,6 @@ Token lexer_next_token(Lexer *lex) {
     skip_whitespace(lex);
 
     lex->start = lex->current;
-    lex->start_line = lex->line;
-    lex->start_column = lex->column;
 
     if (is_at_end(lex)) {
         return make_token(lex, TOK_EOF);
@@ -305,41 +454,35 @@ Token lexer_next_token(Lexer *lex) {
             return make_token(lex, TOK_UNQUOTE);
     }
 
-    /* Dot - check if it's not part of a number */
+    /* Dot - check if it's not part of a number or a symbol (.5, ...) */
     if (c == '.') {
         if (!is_digit(lexer_peek(lex)) && !is_symbol_char(lexer_peek(lex))) {
             return make_token(lex, TOK_DOT);
         }
-        /* Otherwise fall through to symbol handling */
-        lex->current--;  /* Back up */
-        lex->column--;
+        /* Otherwise fall through to number or symbol handling */
     }
 
-    /* Number (including negative) */
-    if (is_digit(c) || (c == '-' && is_digit(lexer_peek(lex)))) {
+    /* Number (including negative, and a leading point) */
+    if (is_digit(c) || ((c == '-' || c == '.') && is_digit(lexer_peek(lex)))) {
         lex->current--;  /* Back up */
-        lex->column--;
         return read_number(lex);
     }
 
     /* String */
     if (c == '"') {
         lex->current--;  /* Back up */
-        lex->column--;
         return read_string(lex);
     }
 
     /* Hash literals */
     if (c == '#') {
         lex->current--;  /* Back up */
-        lex->column--;
         return read_hash_literal(lex);
     }
 
     /* Symbol */
     if (is_symbol_start(c)) {
         lex->current--;  /* Back up */
-        lex->column--;
         return read_symbol(lex);
     }
 
@@ -348,9 +491,32 @@ Token lexer_next_token(Lexer *lex) {
 
 /* Free token resources */
 void token_free(Token *tok) {
-    if (tok->text) {
-        free(tok->text);
-        tok->text = NULL;
+    tok->text = NULL;
+    tok->length = 0;
+}
+
+/* Line and column of a token, counting newlines from the last position
+ * asked about (or from the start when the token comes before it) */
+void lexer_location(Lexer *lex, const Token *tok, int *line, int *column) {
+    const char *target = lex->source + tok->offset;
+    if (target > lex->end) target = lex->end;
+
+    if (target < lex->line_mark) {
+        lex->line_mark = lex->source;
+        lex->line = lex->first_line;
+    }
+
+    const char *p = lex->line_mark;
+    const char *eol;
+    while ((eol = (const char *)memchr(p, '\n', (size_t)(target - p))) != NULL) {
+        lex->line++;
+        p = eol + 1;
+    }
+    lex->line_mark = p;
+
+    if (line) *line = lex->line;
+    if (column) {
+        *column = (int)(target - p) + (p == lex->source ? lex->first_column : 1);
     }
 }
 
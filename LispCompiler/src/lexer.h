@@ -34,16 +34,18 @@ typedef enum {
     TOK_ERROR
 } TokenType;
 
-/* Token structure */
+/* Token structure: a view of the source text (nothing to free) */
 typedef struct {
     TokenType type;
-    char *text;         /* Token text (owned, must be freed) */
-    int line;
-    int column;
+    const char *text;   /* Token text, not NUL-terminated (for STRING
+                         * tokens the body between the quotes, for ERROR
+                         * tokens the message) */
+    size_t length;      /* Length of text */
+    size_t offset;      /* Offset of the token in the source */
     union {
         double number;
-        char *string;   /* For STRING tokens (owned) */
-        char character;
+        int escapes;    /* STRING: body contains escape sequences */
+        uint32_t character;
         int boolean;
     } value;
 } Token;
@@ -51,23 +53,38 @@ typedef struct {
 /* Lexer state */
 typedef struct {
     const char *source;     /* Source code */
+    const char *end;        /* Terminating NUL of the source */
     const char *start;      /* Start of current token */
     const char *current;    /* Current position */
-    int line;
-    int column;
-    int start_line;
-    int start_column;
+
+    /* Line numbers are counted on demand, resuming from the last
+     * position asked about */
+    const char *line_mark;  /* A position that starts a line */
+    int line;               /* Line number of line_mark */
+    int first_line;         /* Line and column of source[0] */
+    int first_column;
 } Lexer;
 
 /* Initialize lexer with source code */
 void lexer_init(Lexer *lex, const char *source);
 
+/* Initialize lexer with a piece of a larger text that starts at the
+ * given line and column (locations are reported in the larger text) */
+void lexer_init_at(Lexer *lex, const char *source, int line, int column);
+
 /* Get the next token */
 Token lexer_next_token(Lexer *lex);
 
-/* Free token resources */
+/* Free token resources (tokens own nothing; kept for callers) */
 void token_free(Token *tok);
 
+/* Line and column (both from 1) of a token */
+void lexer_location(Lexer *lex, const Token *tok, int *line, int *column);
+
+/* Decode the escape sequences of a STRING token into out (which needs
+ * room for tok->length bytes); returns the decoded length */
+size_t lexer_unescape(const Token *tok, char *out);
+
 /* Token type name for debugging */
 const char *token_type_name(TokenType type);
 
@@ -4,10 +4,23 @@
 
 #include "lisp.h"
 #include "env.h"
+#include "srcloc.h"
+#include "thread.h"
+#include "deque.h"
+#include "printer.h"
+#include "text.h"
+#include "numvec.h"
+#include "pcoll.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
 
 /* Uncomment for GC debugging output */
 /* #define GC_DEBUG 1 */
@@ -16,30 +29,39 @@
 LispObject *LISP_NIL_OBJ = NULL;
 LispObject *LISP_TRUE = NULL;
 LispObject *LISP_FALSE = NULL;
-
-/* Symbol interning table */
-#define SYMBOL_TABLE_SIZE 1024
-static LispObject *symbol_table[SYMBOL_TABLE_SIZE];
-
-/* Simple memory tracking for GC */
-#define MAX_OBJECTS 262144  /* Increased from 65536 for deep recursion support (256K objects) */
-static LispObject *all_objects[MAX_OBJECTS];
-static int num_objects = 0;
+LispObject *LISP_TRANSDUCER_TYPE = NULL;
+
+/* Symbol interning table (open addressing, grows at half load).
+ * Lookups take no lock: a slot is filled once, with a complete symbol,
+ * and a grown table replaces the old one whole; old tables are kept
+ * until shutdown for readers still probing them.  Inserts are
+ * serialized by symbol_lock. */
+#define SYMBOL_TABLE_INITIAL_SIZE 1024
+
+typedef struct SymbolTable {
+    LispObject **slots;
+    size_t size;
+    struct SymbolTable *retired;    /* The table this one replaced */
+} SymbolTable;
+
+static SymbolTable *symbol_table = NULL;
+static size_t symbol_count = 0;
+#ifndef _WIN32
+static pthread_mutex_t symbol_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* ============================================================
  * Garbage Collector
  * ============================================================ */
 
-/* GC Configuration */
-#define GC_THRESHOLD 0.75  /* Trigger GC at 75% capacity */
-#define MAX_GC_ROOTS 1024
+/* GC Configuration: collect once the heap reaches gc_threshold objects;
+ * after each collection the threshold becomes twice the survivors */
+#define GC_MIN_THRESHOLD 196608
+static int gc_threshold = GC_MIN_THRESHOLD;
 #define MAX_ENV_ROOTS 64
 
-/* GC Root Registry */
-static LispObject **gc_roots[MAX_GC_ROOTS];
-static int num_gc_roots = 0;
-
-/* Environment Root Registry */
+/* Environment Root Registry (shared; GC roots and frames are per
+ * context) */
 static Environment *env_roots[MAX_ENV_ROOTS];
 static int num_env_roots = 0;
 
@@ -47,24 +69,239 @@ static int num_env_roots = 0;
 static int gc_collections = 0;
 static int gc_objects_freed = 0;
 
-/* Forward declarations for GC */
-static void gc_mark_object(LispObject *obj);
-static void gc_mark_binding(Binding *binding);
-static void gc_mark_env(Environment *env);
-static void gc_sweep(void);
+/* GC Telemetry: objects and bytes freed by type (allocated = freed +
+ * live), pause times, and the sites of a sample of allocations */
+#define LISP_TYPE_COUNT (LISP_TRIE + 1)
+#define GC_SITE_SAMPLE 256          /* One allocation in this many */
+#define GC_PAUSE_BUCKETS 32         /* Bucket i: pauses under 2^i us */
+#define GC_TOP_SITES 10
+
+static uint64_t gc_freed_by_type[LISP_TYPE_COUNT];
+static uint64_t gc_freed_bytes_by_type[LISP_TYPE_COUNT];
+static uint64_t gc_pause_histogram[GC_PAUSE_BUCKETS];
+static double gc_pause_total_us = 0;
+static double gc_pause_max_us = 0;
+static double gc_mark_total_us = 0;
+static double gc_sweep_total_us = 0;
+static double gc_last_survivor_rate = 0;
+static size_t gc_live_bytes = 0;     /* After the last collection */
+static FILE *gc_log = NULL;
+
+/* Allocation sites, by source file and line of the form being
+ * evaluated (open addressing, grows at half load) */
+typedef struct {
+    const char *file;               /* NULL: empty slot */
+    int line;
+    uint64_t samples;
+} GCSite;
+
+static GCSite *gc_sites = NULL;
+static size_t gc_sites_size = 0;
+static size_t gc_site_count = 0;
+static uint64_t gc_site_samples = 0;
+#ifndef _WIN32
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static void gc_record_site(void);
+
+
+/* ============================================================
+ * Evaluation Contexts
+ * ============================================================ */
+
+LISP_THREAD_LOCAL LispContext *lisp_context = NULL;
+
+/* Every context, and the objects of destroyed ones (each heap object
+ * is in exactly one of these arrays) */
+static LispContext *contexts = NULL;
+static LispObject **retired_objects = NULL;
+static int retired_count = 0;
+static int retired_capacity = 0;
+
+/* Stopping the world: a thread that collects sets gc_stop_requested
+ * and waits until every other context is stopped, either parked at a
+ * safepoint or blocked.  world_lock guards the counts and is held for
+ * the whole collection. */
+static int world_contexts = 0;
+static int world_stopped = 0;
+int gc_stop_requested = 0;
+#ifndef _WIN32
+static pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t world_changed = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void world_acquire(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&world_lock);
+#endif
+}
+
+static void world_release(void) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&world_lock);
+#endif
+}
+
+/* Wait for a change in the counts (with world_lock held) */
+static void world_wait(void) {
+#ifndef _WIN32
+    pthread_cond_wait(&world_changed, &world_lock);
+#endif
+}
+
+static void world_notify(void) {
+#ifndef _WIN32
+    pthread_cond_broadcast(&world_changed);
+#endif
+}
+
+/* Stay stopped until a collection in progress is over (with world_lock
+ * held) */
+static void world_park(void) {
+    world_stopped++;
+    world_notify();
+    while (gc_stop_requested) world_wait();
+    world_stopped--;
+}
+
+/* Stop every other context; returns 0 (having waited) if another thread
+ * was stopping them first.  On success world_lock stays held until
+ * world_start. */
+static int world_stop(void) {
+    world_acquire();
+    if (gc_stop_requested) {
+        world_park();
+        world_release();
+        return 0;
+    }
+    STORE_RELEASE(&gc_stop_requested, 1);
+    while (world_stopped < world_contexts - 1) world_wait();
+    return 1;
+}
+
+static void world_start(void) {
+    STORE_RELEASE(&gc_stop_requested, 0);
+    world_notify();
+    world_release();
+}
+
+LispContext *lisp_context_create(LispObject *thread) {
+    LispContext *context = (LispContext *)calloc(1, sizeof(LispContext));
+    if (!context) return NULL;
+    context->thread = thread;
+    context->blocked = 1;
+    context->site_countdown = GC_SITE_SAMPLE;
+
+    world_acquire();
+    context->next = contexts;
+    contexts = context;
+    world_contexts++;
+    world_stopped++;
+    world_notify();
+    world_release();
+    return context;
+}
+
+void lisp_context_enter(LispContext *context) {
+    context->stack_limit = LISP_STACK_ADDRESS() - (lisp_stack_size() - LISP_STACK_RESERVE);
+    lisp_context = context;
+    gc_blocking_end();
+}
+
+size_t lisp_stack_size(void) {
+#ifndef _WIN32
+    size_t size = LISP_MAX_STACK;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+        limit.rlim_cur < size) {
+        size = (size_t)limit.rlim_cur;
+    }
+#else
+    size_t size = 1024 * 1024;      /* The linker's default */
+#endif
+    return size > 2 * LISP_STACK_RESERVE ? size : 2 * LISP_STACK_RESERVE;
+}
+
+void lisp_context_destroy(LispContext *context) {
+    if (!context) return;
+
+    world_acquire();
+    if (context->blocked) {
+        world_stopped--;
+    } else if (gc_stop_requested) {
+        world_park();
+    }
+
+    /* Its objects stay in the heap, now in the retired array */
+    if (retired_count + context->object_count > retired_capacity) {
+        int capacity = retired_capacity ? retired_capacity : 1024;
+        while (capacity < retired_count + context->object_count) capacity *= 2;
+        LispObject **grown = (LispObject **)realloc(retired_objects,
+                                                    (size_t)capacity * sizeof(LispObject *));
+        if (grown) {
+            retired_objects = grown;
+            retired_capacity = capacity;
+        }
+    }
+    if (retired_count + context->object_count <= retired_capacity) {
+        memcpy(retired_objects + retired_count, context->objects,
+               (size_t)context->object_count * sizeof(LispObject *));
+        retired_count += context->object_count;
+    }
+
+    for (LispContext **link = &contexts; *link; link = &(*link)->next) {
+        if (*link == context) {
+            *link = context->next;
+            break;
+        }
+    }
+    world_contexts--;
+    world_notify();
+    world_release();
+
+    if (context == lisp_context) lisp_context = NULL;
+    free(context->objects);
+    free(context);
+}
+
+void lisp_wait_threads(void) {
+    gc_blocking_begin();
+    world_acquire();
+    while (world_contexts > 1) world_wait();
+    world_release();
+    gc_blocking_end();
+}
+
+void gc_blocking_begin(void) {
+    world_acquire();
+    lisp_context->blocked = 1;
+    world_stopped++;
+    world_notify();
+    world_release();
+}
+
+void gc_blocking_end(void) {
+    world_acquire();
+    while (gc_stop_requested) world_wait();
+    lisp_context->blocked = 0;
+    world_stopped--;
+    world_release();
+}
 
 /* Register a root pointer */
 void gc_add_root(LispObject **root) {
-    if (num_gc_roots < MAX_GC_ROOTS) {
-        gc_roots[num_gc_roots++] = root;
+    LispContext *context = lisp_context;
+    if (context->root_count < MAX_GC_ROOTS) {
+        context->roots[context->root_count++] = root;
     }
 }
 
 /* Remove a root pointer */
 void gc_remove_root(LispObject **root) {
-    for (int i = 0; i < num_gc_roots; i++) {
-        if (gc_roots[i] == root) {
-            gc_roots[i] = gc_roots[--num_gc_roots];
+    LispContext *context = lisp_context;
+    for (int i = 0; i < context->root_count; i++) {
+        if (context->roots[i] == root) {
+            context->roots[i] = context->roots[--context->root_count];
             return;
         }
     }
@@ -72,116 +309,184 @@ void gc_remove_root(LispObject **root) {
 
 /* Register an environment as a root */
 void gc_add_env_root(Environment *env) {
+    world_acquire();
     if (num_env_roots < MAX_ENV_ROOTS) {
         env_roots[num_env_roots++] = env;
     }
+    world_release();
 }
 
 /* Remove an environment root */
 void gc_remove_env_root(Environment *env) {
+    world_acquire();
     for (int i = 0; i < num_env_roots; i++) {
         if (env_roots[i] == env) {
             env_roots[i] = env_roots[--num_env_roots];
-            return;
+            break;
         }
     }
+    world_release();
 }
 
-/* Mark a single binding */
-static void gc_mark_binding(Binding *binding) {
-    while (binding != NULL) {
-        gc_mark_object(binding->symbol);
-        gc_mark_object(binding->value);
-        binding = binding->next;
-    }
+void gc_release_args(LispObject *args) {
+    LispObject **held = lisp_context->call_args;
+    if (held && *held == args) *held = NULL;
 }
 
-/* Mark environment frames */
-static void gc_mark_env(Environment *env) {
-    while (env != NULL) {
-        gc_mark_binding(env->bindings);
-        env = env->parent;
-    }
-}
+/* ============================================================
+ * Marking
+ * ============================================================ */
 
-/* Mark a single object and its children */
-static void gc_mark_object(LispObject *obj) {
-    if (obj == NULL || obj->gc_mark) {
-        return;  /* Already marked or null */
+/* Objects marked whose children are not yet: a stack when one thread
+ * marks, or the worker's deque when several do.  Marking never
+ * recurses, so long lists cannot overflow the C stack. */
+typedef struct {
+    LispObject **stack;
+    size_t count;
+    size_t capacity;
+    Deque *deque;
+} Marker;
+
+static void gc_scan_object(Marker *marker, LispObject *obj);
+
+/* Mark an object and queue it for scanning.  Workers marking in
+ * parallel race for the mark bit; the one that sets it queues the
+ * object.  Static objects (GC_MARK_STATIC) are never queued. */
+static void gc_mark_object(Marker *marker, LispObject *obj) {
+    if (obj == NULL) return;
+
+    if (marker->deque) {
+#ifndef _WIN32
+        uint8_t unmarked = 0;
+        if (__atomic_load_n(&obj->gc_mark, __ATOMIC_RELAXED) ||
+            !__atomic_compare_exchange_n(&obj->gc_mark, &unmarked, 1, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+#endif
+        if (!deque_push(marker->deque, obj)) gc_scan_object(marker, obj);
+        return;
     }
 
+    if (obj->gc_mark) return;
     obj->gc_mark = 1;
 
-    /* Recursively mark children based on type */
+    if (marker->count == marker->capacity) {
+        size_t capacity = marker->capacity ? marker->capacity * 2 : 4096;
+        LispObject **grown = (LispObject **)realloc(marker->stack, capacity * sizeof(LispObject *));
+        if (!grown) {
+            /* Out of memory: scan it here instead */
+            gc_scan_object(marker, obj);
+            return;
+        }
+        marker->stack = grown;
+        marker->capacity = capacity;
+    }
+    marker->stack[marker->count++] = obj;
+}
+
+/* Mark the bindings of an environment chain */
+static void gc_mark_env(Marker *marker, Environment *env) {
+    for (; env != NULL; env = env->parent) {
+        for (Binding *binding = env->bindings; binding != NULL; binding = binding->next) {
+            gc_mark_object(marker, binding->symbol);
+            gc_mark_object(marker, binding->value);
+        }
+    }
+}
+
+/* Mark the children of a marked object */
+static void gc_scan_object(Marker *marker, LispObject *obj) {
     switch (obj->type) {
         case LISP_CONS:
-            gc_mark_object(obj->cons.car);
-            gc_mark_object(obj->cons.cdr);
+            gc_mark_object(marker, obj->cons.car);
+            gc_mark_object(marker, obj->cons.cdr);
             break;
 
         case LISP_LAMBDA:
-            gc_mark_object(obj->lambda.params);
-            gc_mark_object(obj->lambda.body);
-            gc_mark_env(obj->lambda.env);
+            gc_mark_object(marker, obj->lambda.params);
+            gc_mark_object(marker, obj->lambda.body);
+            gc_mark_env(marker, obj->lambda.env);
             break;
 
         case LISP_MACRO:
-            gc_mark_object(obj->macro.params);
-            gc_mark_object(obj->macro.body);
-            gc_mark_env(obj->macro.env);
+            gc_mark_object(marker, obj->macro.params);
+            gc_mark_object(marker, obj->macro.body);
+            gc_mark_env(marker, obj->macro.env);
             break;
 
         case LISP_VECTOR:
             for (size_t i = 0; i < obj->vector.length; i++) {
-                gc_mark_object(obj->vector.elements[i]);
+                gc_mark_object(marker, obj->vector.elements[i]);
             }
             break;
 
         case LISP_HASHTABLE:
             for (size_t i = 0; i < obj->hashtable.capacity; i++) {
                 if (obj->hashtable.keys[i]) {
-                    gc_mark_object(obj->hashtable.keys[i]);
-                    gc_mark_object(obj->hashtable.values[i]);
+                    gc_mark_object(marker, obj->hashtable.keys[i]);
+                    gc_mark_object(marker, obj->hashtable.values[i]);
                 }
             }
             break;
 
         case LISP_RECORD:
-            gc_mark_object(obj->record.rtd);
-            /* Mark all fields */
-            if (obj->record.rtd && is_record_type(obj->record.rtd)) {
-                /* Count total fields including parent */
-                int total_fields = obj->record.rtd->record_type.field_count;
-                LispObject *parent = obj->record.rtd->record_type.parent;
-                while (is_record_type(parent)) {
-                    total_fields += parent->record_type.field_count;
-                    parent = parent->record_type.parent;
-                }
-                for (int i = 0; i < total_fields; i++) {
-                    gc_mark_object(obj->record.fields[i]);
-                }
+            gc_mark_object(marker, obj->record.rtd);
+            for (size_t i = 0; i < obj->record.count; i++) {
+                gc_mark_object(marker, RECORD_FIELDS(obj)[i]);
             }
             break;
 
         case LISP_RECORD_TYPE:
-            gc_mark_object(obj->record_type.name);
-            gc_mark_object(obj->record_type.parent);
-            gc_mark_object(obj->record_type.fields);
+            gc_mark_object(marker, obj->record_type.name);
+            gc_mark_object(marker, obj->record_type.parent);
+            gc_mark_object(marker, obj->record_type.fields);
             break;
 
         case LISP_CONDITION:
-            gc_mark_object(obj->condition.type);
-            gc_mark_object(obj->condition.message);
-            gc_mark_object(obj->condition.irritants);
-            gc_mark_object(obj->condition.who);
+            gc_mark_object(marker, obj->condition.type);
+            gc_mark_object(marker, obj->condition.message);
+            gc_mark_object(marker, obj->condition.irritants);
+            gc_mark_object(marker, obj->condition.who);
             break;
 
         case LISP_VALUES:
             for (int i = 0; i < obj->values.count; i++) {
-                gc_mark_object(obj->values.vals[i]);
+                gc_mark_object(marker, obj->values.vals[i]);
             }
             break;
 
+        case LISP_THREAD:
+            gc_mark_object(marker, obj->thread.thunk);
+            gc_mark_object(marker, obj->thread.name);
+            gc_mark_object(marker, obj->thread.result);
+            break;
+
+        case LISP_MUTEX:
+            gc_mark_object(marker, obj->mutex.name);
+            break;
+
+        case LISP_PROMISE:
+            gc_mark_object(marker, obj->promise.value);
+            gc_mark_env(marker, obj->promise.env);
+            break;
+
+        case LISP_PMAP:
+        case LISP_PSET:
+        case LISP_PVECTOR:
+            gc_mark_object(marker, obj->pcoll.root);
+            break;
+
+        case LISP_TRIE:
+            for (uint32_t i = 0; i < obj->trie.length; i++) {
+                gc_mark_object(marker, obj->trie.slots[i]);
+            }
+            break;
+
+        case LISP_PRIMITIVE:
+            if (obj->primitive.data) gc_mark_object(marker, obj->primitive.data);
+            break;
+
         /* Atomic types - no children to mark */
         case LISP_NIL:
         case LISP_BOOLEAN:
@@ -189,131 +494,630 @@ static void gc_mark_object(LispObject *obj) {
         case LISP_CHARACTER:
         case LISP_STRING:
         case LISP_SYMBOL:
-        case LISP_PRIMITIVE:
         case LISP_PORT:
         case LISP_BYTEVECTOR:
+        case LISP_NUMVECTOR:
             break;
     }
 }
 
 /* Mark all roots */
-static void gc_mark_roots(void) {
-    /* Mark registered roots */
-    for (int i = 0; i < num_gc_roots; i++) {
-        if (gc_roots[i] && *gc_roots[i]) {
-            gc_mark_object(*gc_roots[i]);
+static void gc_mark_roots(Marker *marker) {
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        /* Mark registered roots */
+        for (int i = 0; i < context->root_count; i++) {
+            if (context->roots[i] && *context->roots[i]) {
+                gc_mark_object(marker, *context->roots[i]);
+            }
+        }
+
+        /* Mark shadow stack frames */
+        for (GCFrame *frame = context->frame_top; frame != NULL; frame = frame->prev) {
+            for (int i = 0; i < frame->count; i++) {
+                gc_mark_object(marker, frame->slots[i]);
+            }
+        }
+
+        /* Mark environments of evaluations in progress (nested forms
+         * usually share one, so repeats are skipped) */
+        for (int i = 1; i <= context->env_depth; i++) {
+            if (context->env_stack[i] && context->env_stack[i] != context->env_stack[i - 1]) {
+                gc_mark_env(marker, context->env_stack[i]);
+            }
         }
+
+        gc_mark_object(marker, context->thread);
+        gc_mark_object(marker, context->current_form);
     }
 
     /* Mark registered environment roots */
     for (int i = 0; i < num_env_roots; i++) {
         if (env_roots[i]) {
-            gc_mark_env(env_roots[i]);
+            gc_mark_env(marker, env_roots[i]);
         }
     }
 
     /* Mark symbol table (symbols are permanent) */
-    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
-        if (symbol_table[i]) {
-            gc_mark_object(symbol_table[i]);
+    for (size_t i = 0; i < symbol_table->size; i++) {
+        if (symbol_table->slots[i]) {
+            gc_mark_object(marker, symbol_table->slots[i]);
         }
     }
 
     /* Mark global singletons */
-    gc_mark_object(LISP_NIL_OBJ);
-    gc_mark_object(LISP_TRUE);
-    gc_mark_object(LISP_FALSE);
+    gc_mark_object(marker, LISP_NIL_OBJ);
+    gc_mark_object(marker, LISP_TRUE);
+    gc_mark_object(marker, LISP_FALSE);
+    gc_mark_object(marker, LISP_TRANSDUCER_TYPE);
 }
 
-/* Sweep phase - free unmarked objects */
-static void gc_sweep(void) {
+/* Mark everything reachable, on one thread */
+static void gc_mark_serial(void) {
+    Marker marker = { NULL, 0, 0, NULL };
+    gc_mark_roots(&marker);
+    while (marker.count > 0) {
+        gc_scan_object(&marker, marker.stack[--marker.count]);
+    }
+    free(marker.stack);
+}
+
+/* ============================================================
+ * Parallel Collection
+ * ============================================================ */
+
+/* With gc_threads > 1, collections of heaps this large mark and sweep
+ * on that many threads.  The collecting thread is one of them; the
+ * others are started for the collection, as starting them costs little
+ * next to marking a heap this size. */
+#define GC_PARALLEL_MIN_OBJECTS 100000
+#define GC_SWEEP_SEGMENT 16384      /* Objects per task of a parallel sweep */
+
+static int gc_threads = 1;
+
+void gc_set_threads(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > GC_MAX_THREADS) threads = GC_MAX_THREADS;
+    gc_threads = threads;
+}
+
+#ifndef _WIN32
+/* Run task(arg, worker, workers) on up to threads threads, the calling
+ * thread as worker 0.  Workers wait at a gate until all have started,
+ * so that each knows how many there are. */
+typedef struct {
+    void (*task)(void *arg, int worker, int workers);
+    void *arg;
+    int workers;
+    int open;
+    pthread_mutex_t lock;
+    pthread_cond_t opened;
+} WorkerGate;
+
+typedef struct {
+    WorkerGate *gate;
+    int index;
+} GCWorker;
+
+static void *gc_worker_main(void *arg) {
+    GCWorker *worker = (GCWorker *)arg;
+    WorkerGate *gate = worker->gate;
+    pthread_mutex_lock(&gate->lock);
+    while (!gate->open) pthread_cond_wait(&gate->opened, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+    gate->task(gate->arg, worker->index, gate->workers);
+    return NULL;
+}
+
+static void gc_run_workers(void (*task)(void *, int, int), void *arg, int threads) {
+    WorkerGate gate;
+    gate.task = task;
+    gate.arg = arg;
+    gate.open = 0;
+    pthread_mutex_init(&gate.lock, NULL);
+    pthread_cond_init(&gate.opened, NULL);
+
+    GCWorker workers[GC_MAX_THREADS];
+    pthread_t ids[GC_MAX_THREADS];
+    int started = 1;
+    while (started < threads) {
+        workers[started].gate = &gate;
+        workers[started].index = started;
+        if (pthread_create(&ids[started], NULL, gc_worker_main, &workers[started]) != 0) break;
+        started++;
+    }
+
+    pthread_mutex_lock(&gate.lock);
+    gate.workers = started;
+    gate.open = 1;
+    pthread_cond_broadcast(&gate.opened);
+    pthread_mutex_unlock(&gate.lock);
+
+    task(arg, 0, started);
+    for (int i = 1; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    pthread_cond_destroy(&gate.opened);
+    pthread_mutex_destroy(&gate.lock);
+}
+
+/* Parallel marking: each worker scans from its own deque and steals
+ * from the others' when it runs out.  A worker with nothing to steal
+ * counts itself idle; marking is done when all are, as only a worker
+ * that is not idle can queue more. */
+typedef struct {
+    Marker markers[GC_MAX_THREADS];
+    Deque deques[GC_MAX_THREADS];
+    int idle;
+} MarkJob;
+
+static LispObject *gc_steal(MarkJob *job, int worker, int workers) {
+    for (int i = 1; i < workers; i++) {
+        LispObject *obj = (LispObject *)deque_steal(&job->deques[(worker + i) % workers]);
+        if (obj) return obj;
+    }
+    return NULL;
+}
+
+static int gc_work_left(MarkJob *job, int workers) {
+    for (int i = 0; i < workers; i++) {
+        if (!deque_empty(&job->deques[i])) return 1;
+    }
+    return 0;
+}
+
+static void gc_mark_task(void *arg, int worker, int workers) {
+    MarkJob *job = (MarkJob *)arg;
+    Marker *marker = &job->markers[worker];
+
+    for (;;) {
+        LispObject *obj;
+        while ((obj = (LispObject *)deque_take(marker->deque)) != NULL) {
+            gc_scan_object(marker, obj);
+        }
+        obj = gc_steal(job, worker, workers);
+        if (obj) {
+            gc_scan_object(marker, obj);
+            continue;
+        }
+
+        __atomic_add_fetch(&job->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&job->idle, __ATOMIC_SEQ_CST) == workers) return;
+            if (gc_work_left(job, workers)) {
+                __atomic_sub_fetch(&job->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/* Mark on threads threads; returns 0 (having marked nothing) if the
+ * deques cannot be allocated */
+static int gc_mark_parallel(int threads) {
+    MarkJob *job = (MarkJob *)calloc(1, sizeof(MarkJob));
+    if (!job) return 0;
+    int ready = 0;
+    while (ready < threads && deque_init(&job->deques[ready])) {
+        job->markers[ready].deque = &job->deques[ready];
+        ready++;
+    }
+
+    if (ready == threads) {
+        /* The roots go to worker 0 (this thread); the rest steal them */
+        gc_mark_roots(&job->markers[0]);
+        gc_run_workers(gc_mark_task, job, threads);
+    }
+
+    for (int i = 0; i < ready; i++) {
+        deque_destroy(&job->deques[i]);
+    }
+    free(job);
+    return ready == threads;
+}
+#endif
+
+/* ============================================================
+ * Sweeping
+ * ============================================================ */
+
+/* A string's index (lisp.h) */
+struct StringIndex {
+    size_t count;
+    size_t offsets[];        /* offsets[k]: where character
+                              * k * STRING_INDEX_STRIDE starts */
+};
+
+/* Bytes an object holds: the object and what it owns */
+static size_t object_bytes(const LispObject *obj) {
+    size_t bytes = sizeof(LispObject);
+    switch (obj->type) {
+        case LISP_STRING:
+            bytes += obj->string.length + 1;
+            if (obj->string.index) {
+                bytes += sizeof(StringIndex) + obj->string.index->count * sizeof(size_t);
+            }
+            break;
+        case LISP_VECTOR:
+            bytes += obj->vector.length * sizeof(LispObject *);
+            break;
+        case LISP_BYTEVECTOR:
+            bytes += obj->bytevector.length;
+            break;
+        case LISP_NUMVECTOR:
+            bytes += obj->numvector.length * numvec_element_size((NumvecKind)obj->numvector.kind);
+            break;
+        case LISP_HASHTABLE:
+            bytes += obj->hashtable.capacity * 2 * sizeof(LispObject *);
+            break;
+        case LISP_TRIE:
+            bytes += obj->trie.length * sizeof(LispObject *);
+            if (obj->trie.sizes) bytes += obj->trie.length * sizeof(size_t);
+            break;
+        case LISP_RECORD_TYPE:
+            bytes += (size_t)(obj->record_type.depth + 1) * sizeof(LispObject *);
+            break;
+        case LISP_RECORD:
+            bytes += obj->record.count * sizeof(LispObject *);
+            break;
+        case LISP_VALUES:
+            bytes += (size_t)obj->values.count * sizeof(LispObject *);
+            break;
+        default:
+            break;
+    }
+    return bytes;
+}
+
+/* What a sweep freed and kept (each parallel worker keeps its own) */
+typedef struct {
+    uint64_t freed[LISP_TYPE_COUNT];
+    uint64_t freed_bytes[LISP_TYPE_COUNT];
+    size_t live_bytes;
+} SweepStats;
+
+static void gc_add_sweep_stats(const SweepStats *stats) {
+    for (int type = 0; type < LISP_TYPE_COUNT; type++) {
+        gc_freed_by_type[type] += stats->freed[type];
+        gc_freed_bytes_by_type[type] += stats->freed_bytes[type];
+    }
+    gc_live_bytes += stats->live_bytes;
+}
+
+#ifndef _WIN32
+/* The source location table is not shared by sweeping threads */
+static pthread_mutex_t forget_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Sweep one array of objects, compacting it; returns the survivors */
+static int gc_sweep_objects(LispObject **objects, int count, SweepStats *stats,
+                            int parallel) {
     int new_count = 0;
 
-    for (int i = 0; i < num_objects; i++) {
-        LispObject *obj = all_objects[i];
+    for (int i = 0; i < count; i++) {
+        LispObject *obj = objects[i];
+        size_t bytes = object_bytes(obj);
 
         if (obj->gc_mark) {
             /* Object is reachable - keep it */
             obj->gc_mark = 0;  /* Reset for next GC cycle */
-            all_objects[new_count++] = obj;
+            objects[new_count++] = obj;
+            stats->live_bytes += bytes;
         } else {
             /* Object is garbage - free it */
+            stats->freed[obj->type]++;
+            stats->freed_bytes[obj->type] += bytes;
+#ifndef _WIN32
+            if (parallel && obj->has_location) {
+                pthread_mutex_lock(&forget_lock);
+                srcloc_forget(obj);
+                pthread_mutex_unlock(&forget_lock);
+            }
+#else
+            (void)parallel;
+#endif
             lisp_free(obj);
         }
     }
 
-    num_objects = new_count;
+    return new_count;
 }
 
-/* Run garbage collection */
-void gc_collect(void) {
-    int before = num_objects;
+/* Sweep phase - free unmarked objects */
+static void gc_sweep_serial(void) {
+    SweepStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        context->object_count = gc_sweep_objects(context->objects, context->object_count,
+                                                 &stats, 0);
+    }
+    retired_count = gc_sweep_objects(retired_objects, retired_count, &stats, 0);
+
+    gc_live_bytes = 0;
+    gc_add_sweep_stats(&stats);
+}
+
+#ifndef _WIN32
+/* Parallel sweeping: every object array is cut into segments, which
+ * workers claim in turn and compact in place; the survivors of each
+ * array's segments are then moved together. */
+typedef struct {
+    LispObject **objects;
+    int start;
+    int count;
+    int kept;
+} SweepSegment;
+
+typedef struct {
+    SweepSegment *segments;
+    int segment_count;
+    int next;
+    SweepStats stats[GC_MAX_THREADS];
+} SweepJob;
+
+static void gc_sweep_task(void *arg, int worker, int workers) {
+    (void)workers;
+    SweepJob *job = (SweepJob *)arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->segment_count) return;
+        SweepSegment *segment = &job->segments[i];
+        segment->kept = gc_sweep_objects(segment->objects + segment->start, segment->count,
+                                         &job->stats[worker], 1);
+    }
+}
+
+/* Add the segments of an array to a job */
+static void gc_add_segments(SweepJob *job, LispObject **objects, int count) {
+    for (int start = 0; start < count; start += GC_SWEEP_SEGMENT) {
+        SweepSegment *segment = &job->segments[job->segment_count++];
+        segment->objects = objects;
+        segment->start = start;
+        segment->count = count - start < GC_SWEEP_SEGMENT ? count - start : GC_SWEEP_SEGMENT;
+        segment->kept = 0;
+    }
+}
+
+/* Move the survivors of an array's segments together; returns them */
+static int gc_join_segments(SweepSegment **segment) {
+    LispObject **objects = (*segment)->objects;
+    int kept = 0;
+    while ((*segment)->objects == objects) {
+        memmove(objects + kept, objects + (*segment)->start,
+                (size_t)(*segment)->kept * sizeof(LispObject *));
+        kept += (*segment)->kept;
+        (*segment)++;
+    }
+    return kept;
+}
+
+/* Sweep on threads threads; returns 0 (having swept nothing) if the
+ * segments cannot be allocated */
+static int gc_sweep_parallel(int threads) {
+    int segments = (retired_count + GC_SWEEP_SEGMENT - 1) / GC_SWEEP_SEGMENT;
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        segments += (context->object_count + GC_SWEEP_SEGMENT - 1) / GC_SWEEP_SEGMENT;
+    }
+
+    SweepJob *job = (SweepJob *)calloc(1, sizeof(SweepJob));
+    SweepSegment *list = (SweepSegment *)calloc((size_t)segments + 1, sizeof(SweepSegment));
+    if (!job || !list) {
+        free(job);
+        free(list);
+        return 0;
+    }
+    job->segments = list;
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        gc_add_segments(job, context->objects, context->object_count);
+    }
+    gc_add_segments(job, retired_objects, retired_count);
 
-    /* Mark phase */
-    gc_mark_roots();
+    gc_run_workers(gc_sweep_task, job, threads);
 
-    /* Sweep phase */
-    gc_sweep();
+    /* The list ends with an entry whose objects are NULL */
+    SweepSegment *segment = list;
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        context->object_count = context->object_count ? gc_join_segments(&segment) : 0;
+    }
+    retired_count = retired_count ? gc_join_segments(&segment) : 0;
+
+    gc_live_bytes = 0;
+    for (int i = 0; i < threads; i++) {
+        gc_add_sweep_stats(&job->stats[i]);
+    }
+    free(list);
+    free(job);
+    return 1;
+}
+#endif
+
+/* Objects in the heap (exact only with the world stopped) */
+static int heap_objects(void) {
+    int count = retired_count;
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        count += context->object_count;
+    }
+    return count;
+}
+
+static double gc_now_us(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+/* Run garbage collection, stopping every thread */
+void gc_collect(void) {
+    if (!world_stop()) return;  /* Another thread collected meanwhile */
+
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        context->gc_pending = 0;
+    }
+    int before = heap_objects();
+    double start = gc_now_us();
+
+    /* Mark and sweep, in parallel for a large heap */
+#ifndef _WIN32
+    int threads = gc_threads > 1 && before >= GC_PARALLEL_MIN_OBJECTS ? gc_threads : 1;
+    if (threads == 1 || !gc_mark_parallel(threads)) gc_mark_serial();
+    double marked = gc_now_us();
+    if (threads == 1 || !gc_sweep_parallel(threads)) gc_sweep_serial();
+#else
+    gc_mark_serial();
+    double marked = gc_now_us();
+    gc_sweep_serial();
+#endif
+    double end = gc_now_us();
 
     /* Statistics */
+    int num_objects = heap_objects();
     gc_collections++;
     gc_objects_freed += (before - num_objects);
 
+    gc_threshold = num_objects * 2;
+    if (gc_threshold < GC_MIN_THRESHOLD) gc_threshold = GC_MIN_THRESHOLD;
+
+    double mark_us = marked - start;
+    double sweep_us = end - marked;
+    double pause_us = end - start;
+    int bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && pause_us >= (double)(1u << bucket)) bucket++;
+    gc_pause_histogram[bucket]++;
+    gc_pause_total_us += pause_us;
+    if (pause_us > gc_pause_max_us) gc_pause_max_us = pause_us;
+    gc_mark_total_us += mark_us;
+    gc_sweep_total_us += sweep_us;
+    gc_last_survivor_rate = before ? (double)num_objects / before : 0.0;
+
+    if (gc_log) {
+        fprintf(gc_log,
+                "{\"gc\":%d,\"before\":%d,\"after\":%d,\"freed\":%d,"
+                "\"survivor_rate\":%.4f,\"live_bytes\":%lu,\"threshold\":%d,"
+                "\"mark_us\":%.1f,\"sweep_us\":%.1f,\"pause_us\":%.1f}\n",
+                gc_collections, before, num_objects, before - num_objects,
+                gc_last_survivor_rate, (unsigned long)gc_live_bytes, gc_threshold,
+                mark_us, sweep_us, pause_us);
+        fflush(gc_log);
+    }
+
     #ifdef GC_DEBUG
     printf("[GC] Collection #%d: %d -> %d objects (%d freed)\n",
            gc_collections, before, num_objects, before - num_objects);
     #endif
+
+    world_start();
+}
+
+/* Stop for a collection another thread runs, or run one that is due */
+void gc_safepoint(void) {
+    LispContext *context = lisp_context;
+    if (LOAD_ACQUIRE(&gc_stop_requested)) {
+        world_acquire();
+        if (gc_stop_requested) world_park();
+        world_release();
+    }
+    if (context->gc_pending) {
+        context->gc_pending = 0;
+        if (context->object_count >= gc_threshold) gc_collect();
+    }
+}
+
+/* Log each collection as a line of JSON to log (NULL: stop logging) */
+void gc_set_log(FILE *log) {
+    gc_log = log;
 }
 
-/* Get GC statistics */
+/* Pause and resume collection */
+void gc_pause(void) {
+    lisp_context->gc_paused++;
+}
+
+void gc_resume(void) {
+    if (lisp_context->gc_paused > 0) lisp_context->gc_paused--;
+}
+
+/* Get GC statistics (the current count is the calling thread's view) */
 void gc_stats(int *collections, int *freed, int *current) {
     if (collections) *collections = gc_collections;
     if (freed) *freed = gc_objects_freed;
-    if (current) *current = num_objects;
+    if (current) *current = heap_objects();
 }
 
 /* Hash function for symbols */
-static uint32_t hash_string(const char *str) {
+static uint32_t hash_string(const char *str, size_t len) {
     uint32_t hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+    for (size_t i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + str[i];
     }
     return hash;
 }
 
 /* Allocate a new object */
 LispObject *lisp_alloc(void) {
-    /* Check if GC needed */
-    if (num_objects >= (int)(MAX_OBJECTS * GC_THRESHOLD)) {
-        gc_collect();
+    return lisp_alloc_tail(0);
+}
+
+LispObject *lisp_alloc_tail(size_t tail) {
+    LispContext *context = lisp_context;
+
+    /* Check if GC needed.  While eval runs, primitives and special
+     * forms hold new objects in C locals between allocations, so the
+     * collection waits for the next eval, where those are rooted.
+     * Each thread counts the objects it allocated. */
+    if (!context->gc_paused) {
+        if (context->object_count >= gc_threshold) {
+            if (context->env_depth > 0) {
+                context->gc_pending = 1;
+            } else {
+                gc_collect();
+            }
+        } else if (LOAD_ACQUIRE(&gc_stop_requested) && context->env_depth == 0) {
+            gc_safepoint();
+        }
     }
 
-    /* Check if still out of memory after GC */
-    if (num_objects >= MAX_OBJECTS) {
-        lisp_error("Out of memory: %d objects allocated", num_objects);
-        return NULL;
+    /* Sample the allocation site */
+    if (--context->site_countdown <= 0) {
+        context->site_countdown = GC_SITE_SAMPLE;
+        gc_record_site();
+    }
+
+    /* Grow the object table */
+    if (context->object_count >= context->object_capacity) {
+        int capacity = context->object_capacity ? context->object_capacity * 2
+                                                : GC_MIN_THRESHOLD;
+        LispObject **grown = (LispObject **)realloc(context->objects,
+                                                    (size_t)capacity * sizeof(LispObject *));
+        if (!grown) {
+            lisp_error("Out of memory: %d objects allocated", context->object_count);
+            return NULL;
+        }
+        context->objects = grown;
+        context->object_capacity = capacity;
     }
 
     /* Allocate new object */
-    LispObject *obj = (LispObject *)calloc(1, sizeof(LispObject));
+    LispObject *obj = (LispObject *)calloc(1, sizeof(LispObject) + tail);
     if (!obj) {
         lisp_error("Out of memory");
         return NULL;
     }
 
     obj->gc_mark = 0;
-    all_objects[num_objects++] = obj;
+    context->objects[context->object_count++] = obj;
     return obj;
 }
 
 /* Free an object (not typically called directly) */
 void lisp_free(LispObject *obj) {
     if (!obj) return;
+    if (obj->has_location) srcloc_forget(obj);
 
     switch (obj->type) {
         case LISP_STRING:
             free(obj->string.data);
+            free(obj->string.index);
             break;
         case LISP_SYMBOL:
             /* Symbols are interned, don't free name */
@@ -327,18 +1131,32 @@ void lisp_free(LispObject *obj) {
         case LISP_BYTEVECTOR:
             free(obj->bytevector.bytes);
             break;
+        case LISP_NUMVECTOR:
+            free(obj->numvector.data);
+            break;
         case LISP_HASHTABLE:
             free(obj->hashtable.keys);
             free(obj->hashtable.values);
             break;
-        case LISP_RECORD:
-            free(obj->record.fields);
+        case LISP_TRIE:
+            free(obj->trie.slots);
+            free(obj->trie.sizes);
             break;
         case LISP_VALUES:
             free(obj->values.vals);
             break;
         case LISP_PORT:
             if (obj->port.name) free(obj->port.name);
+            if (obj->port.is_string && obj->port.stream) {
+                printer_free((Printer *)obj->port.stream);
+                free(obj->port.stream);
+            }
+            break;
+        case LISP_THREAD:
+            thread_free(obj);
+            break;
+        case LISP_MUTEX:
+            mutex_free(obj);
             break;
         default:
             break;
@@ -348,8 +1166,21 @@ void lisp_free(LispObject *obj) {
 
 /* Initialize the Lisp system */
 void lisp_init(void) {
+    /* The main thread's context */
+    if (!lisp_context) {
+        lisp_context_enter(lisp_context_create(NULL));
+    }
+
     /* Initialize symbol table */
-    memset(symbol_table, 0, sizeof(symbol_table));
+    if (!symbol_table) {
+        symbol_table = (SymbolTable *)calloc(1, sizeof(SymbolTable));
+        symbol_table->size = SYMBOL_TABLE_INITIAL_SIZE;
+        symbol_table->slots = (LispObject **)calloc(symbol_table->size, sizeof(LispObject *));
+    } else {
+        memset(symbol_table->slots, 0, symbol_table->size * sizeof(LispObject *));
+    }
+    symbol_count = 0;
+    gc_threshold = GC_MIN_THRESHOLD;
 
     /* Create singleton objects */
     LISP_NIL_OBJ = lisp_alloc();
@@ -362,18 +1193,46 @@ void lisp_init(void) {
     LISP_FALSE = lisp_alloc();
     LISP_FALSE->type = LISP_BOOLEAN;
     LISP_FALSE->boolean = 0;
+
+    gc_pause();
+    LISP_TRANSDUCER_TYPE = make_record_type(make_symbol("transducer"), make_nil(),
+                                            make_cons(make_symbol("stages"), make_nil()));
+    gc_resume();
 }
 
 /* Shutdown the Lisp system */
 void lisp_shutdown(void) {
-    /* Free all allocated objects */
-    for (int i = 0; i < num_objects; i++) {
-        if (all_objects[i]) {
-            lisp_free(all_objects[i]);
-            all_objects[i] = NULL;
-        }
-    }
-    num_objects = 0;
+    /* Free all allocated objects, once every thread has finished and
+     * retired its context (a joined thread may still be retiring) */
+    lisp_context_destroy(lisp_context);
+    world_acquire();
+    while (contexts) world_wait();
+    world_release();
+    for (int i = 0; i < retired_count; i++) {
+        lisp_free(retired_objects[i]);
+    }
+    free(retired_objects);
+    retired_objects = NULL;
+    retired_count = 0;
+    retired_capacity = 0;
+
+    while (symbol_table) {
+        SymbolTable *retired = symbol_table->retired;
+        free(symbol_table->slots);
+        free(symbol_table);
+        symbol_table = retired;
+    }
+    symbol_count = 0;
+
+    /* Sites refer to source file names, which go with the table */
+    free(gc_sites);
+    gc_sites = NULL;
+    gc_sites_size = 0;
+    gc_site_count = 0;
+    gc_site_samples = 0;
+
+    srcloc_reset();
+
     LISP_NIL_OBJ = NULL;
     LISP_TRUE = NULL;
     LISP_FALSE = NULL;
@@ -396,7 +1255,7 @@ LispObject *make_number(double value) {
     return obj;
 }
 
-LispObject *make_character(char c) {
+LispObject *make_character(uint32_t c) {
     LispObject *obj = lisp_alloc();
     obj->type = LISP_CHARACTER;
     obj->character = c;
@@ -407,38 +1266,226 @@ LispObject *make_string(const char *str) {
     return make_string_n(str, strlen(str));
 }
 
+/* A copy of the len bytes at str with U+FFFD for each byte that is not
+ * part of valid UTF-8, its length in *out_len */
+static char *utf8_repair(const char *str, size_t len, size_t *out_len) {
+    char *data = (char *)malloc(len * 3 + 1);
+    size_t n = 0;
+    size_t i = 0;
+    while (i < len) {
+        size_t valid = text_utf8_valid(str + i, len - i);
+        memcpy(data + n, str + i, valid);
+        n += valid;
+        i += valid;
+        if (i < len) {
+            n += text_utf8_encode(TEXT_REPLACEMENT, data + n);
+            i++;
+        }
+    }
+    *out_len = n;
+    return data;
+}
+
 LispObject *make_string_n(const char *str, size_t len) {
     LispObject *obj = lisp_alloc();
     obj->type = LISP_STRING;
-    obj->string.data = (char *)malloc(len + 1);
-    memcpy(obj->string.data, str, len);
+    if (text_utf8_valid(str, len) == len) {
+        obj->string.data = (char *)malloc(len + 1);
+        memcpy(obj->string.data, str, len);
+    } else {
+        obj->string.data = utf8_repair(str, len, &len);
+    }
     obj->string.data[len] = '\0';
     obj->string.length = len;
+    obj->string.chars = text_utf8_count(obj->string.data, len);
+    obj->string.index = NULL;
     return obj;
 }
 
-LispObject *make_symbol(const char *name) {
-    uint32_t hash = hash_string(name);
-    int index = hash % SYMBOL_TABLE_SIZE;
+/* ============================================================
+ * String Indexing
+ * ============================================================ */
 
-    /* Look for existing symbol */
-    LispObject *sym = symbol_table[index];
-    while (sym) {
-        if (sym->symbol.hash == hash && strcmp(sym->symbol.name, name) == 0) {
-            return sym;  /* Return interned symbol */
+/* Bytes of the UTF-8 sequence that starts with lead */
+static size_t utf8_sequence_length(unsigned char lead) {
+    return lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+}
+
+/* A string's index, made on first use.  Strings never change, so an
+ * index stays right; threads that make one at the same time keep the
+ * first. */
+static StringIndex *string_index(LispObject *str) {
+    StringIndex *index = LOAD_ACQUIRE(&str->string.index);
+    if (index) return index;
+
+    size_t count = str->string.chars / STRING_INDEX_STRIDE + 1;
+    index = (StringIndex *)malloc(sizeof(StringIndex) + count * sizeof(size_t));
+    if (!index) return NULL;
+    index->count = count;
+
+    const unsigned char *data = (const unsigned char *)str->string.data;
+    size_t offset = 0;
+    for (size_t k = 0; k < count; k++) {
+        index->offsets[k] = offset;
+        for (int i = 0; i < STRING_INDEX_STRIDE && offset < str->string.length; i++) {
+            offset += utf8_sequence_length(data[offset]);
+        }
+    }
+
+#ifdef _MSC_VER
+    str->string.index = index;
+#else
+    StringIndex *expected = NULL;
+    if (!__atomic_compare_exchange_n(&str->string.index, &expected, index, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(index);
+        index = expected;
+    }
+#endif
+    return index;
+}
+
+size_t string_offset(LispObject *str, size_t index) {
+    if (str->string.chars == str->string.length) return index;
+    if (index >= str->string.chars) return str->string.length;
+
+    /* Short strings are scanned from the start */
+    size_t offset = 0;
+    size_t steps = index;
+    if (index >= STRING_INDEX_STRIDE) {
+        StringIndex *string_idx = string_index(str);
+        if (string_idx) {
+            offset = string_idx->offsets[index / STRING_INDEX_STRIDE];
+            steps = index % STRING_INDEX_STRIDE;
+        }
+    }
+
+    const unsigned char *data = (const unsigned char *)str->string.data;
+    while (steps-- > 0) {
+        offset += utf8_sequence_length(data[offset]);
+    }
+    return offset;
+}
+
+size_t string_char_index(LispObject *str, size_t offset) {
+    if (str->string.chars == str->string.length) return offset;
+    if (offset >= str->string.length) return str->string.chars;
+
+    /* The last index entry at or before offset, then the characters
+     * from it */
+    size_t base = 0;
+    size_t from = 0;
+    if (offset >= STRING_INDEX_STRIDE) {
+        StringIndex *index = string_index(str);
+        if (index) {
+            size_t low = 0, high = index->count;
+            while (high - low > 1) {
+                size_t mid = low + (high - low) / 2;
+                if (index->offsets[mid] <= offset) low = mid;
+                else high = mid;
+            }
+            base = low * STRING_INDEX_STRIDE;
+            from = index->offsets[low];
+        }
+    }
+    return base + text_utf8_count(str->string.data + from, offset - from);
+}
+
+uint32_t string_char_at(LispObject *str, size_t index) {
+    if (str->string.chars == str->string.length) {
+        return (unsigned char)str->string.data[index];
+    }
+    size_t offset = string_offset(str, index);
+    uint32_t code;
+    text_utf8_decode(str->string.data + offset, str->string.length - offset, &code);
+    return code;
+}
+
+/* Double the symbol table, reinserting by the stored hashes (with
+ * symbol_lock held) */
+static void grow_symbol_table(void) {
+    SymbolTable *old = symbol_table;
+    SymbolTable *table = (SymbolTable *)malloc(sizeof(SymbolTable));
+    if (!table) return;
+    table->size = old->size * 2;
+    table->slots = (LispObject **)calloc(table->size, sizeof(LispObject *));
+    table->retired = old;
+    if (!table->slots) {
+        free(table);
+        return;
+    }
+
+    for (size_t i = 0; i < old->size; i++) {
+        LispObject *sym = old->slots[i];
+        if (!sym) continue;
+        size_t index = sym->symbol.hash & (table->size - 1);
+        while (table->slots[index]) {
+            index = (index + 1) & (table->size - 1);
+        }
+        table->slots[index] = sym;
+    }
+
+    STORE_RELEASE(&symbol_table, table);
+}
+
+/* Find an interned symbol; returns NULL with *slot set to the empty
+ * slot where it belongs */
+static LispObject *find_symbol(SymbolTable *table, const char *name, size_t len,
+                               uint32_t hash, size_t *slot) {
+    size_t index = hash & (table->size - 1);
+    LispObject *sym;
+    while ((sym = LOAD_ACQUIRE(&table->slots[index])) != NULL) {
+        if (sym->symbol.hash == hash && strncmp(sym->symbol.name, name, len) == 0 &&
+            sym->symbol.name[len] == '\0') {
+            return sym;
         }
         /* Linear probing for collision */
-        index = (index + 1) % SYMBOL_TABLE_SIZE;
-        sym = symbol_table[index];
+        index = (index + 1) & (table->size - 1);
     }
+    *slot = index;
+    return NULL;
+}
 
-    /* Create new symbol */
+LispObject *make_symbol(const char *name) {
+    return make_symbol_n(name, strlen(name));
+}
+
+/* Intern a symbol named by len bytes that need not be NUL-terminated
+ * (the reader interns straight from the source text) */
+LispObject *make_symbol_n(const char *name, size_t len) {
+    uint32_t hash = hash_string(name, len);
+    size_t index;
+
+    /* Look for existing symbol */
+    LispObject *sym = find_symbol(LOAD_ACQUIRE(&symbol_table), name, len, hash, &index);
+    if (sym) return sym;
+
+    /* Allocate before taking the lock, since allocating may wait for a
+     * collection; if another thread interns the name first, the object
+     * is left as garbage */
     LispObject *obj = lisp_alloc();
-    obj->type = LISP_SYMBOL;
-    obj->symbol.name = strdup(name);
-    obj->symbol.hash = hash;
-    symbol_table[index] = obj;
-    return obj;
+#ifndef _WIN32
+    pthread_mutex_lock(&symbol_lock);
+#endif
+    sym = find_symbol(symbol_table, name, len, hash, &index);
+    if (!sym) {
+        /* Create new symbol */
+        obj->symbol.name = (char *)malloc(len + 1);
+        memcpy(obj->symbol.name, name, len);
+        obj->symbol.name[len] = '\0';
+        obj->symbol.hash = hash;
+        obj->type = LISP_SYMBOL;
+        STORE_RELEASE(&symbol_table->slots[index], obj);
+        sym = obj;
+
+        if (++symbol_count * 2 > symbol_table->size) {
+            grow_symbol_table();
+        }
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&symbol_lock);
+#endif
+    return sym;
 }
 
 LispObject *make_cons(LispObject *car_val, LispObject *cdr_val) {
@@ -466,6 +1513,21 @@ LispObject *make_primitive(const char *name, LispPrimitiveFn func, int min_args,
     obj->primitive.func = func;
     obj->primitive.min_args = min_args;
     obj->primitive.max_args = max_args;
+    obj->primitive.data = NULL;
+    obj->primitive.slot = 0;
+    return obj;
+}
+
+LispObject *make_primitive_closure(const char *name, LispClosureFn func, int min_args,
+                                   int max_args, LispObject *data, int slot) {
+    LispObject *obj = lisp_alloc();
+    obj->type = LISP_PRIMITIVE;
+    obj->primitive.name = name;
+    obj->primitive.closure = func;
+    obj->primitive.min_args = min_args;
+    obj->primitive.max_args = max_args;
+    obj->primitive.data = data;
+    obj->primitive.slot = slot;
     return obj;
 }
 
@@ -627,10 +1689,66 @@ int lisp_eq(LispObject *a, LispObject *b) {
     return a == b;
 }
 
-int lisp_equal(LispObject *a, LispObject *b) {
-    if (a == b) return 1;
-    if (a->type != b->type) return 0;
-
+/* equal? compares pairs and vectors part by part, with a stack of its
+ * own rather than recursion, so that long lists and deep nesting
+ * compare in constant C stack.  Shared and circular structure is
+ * handled as in Adams and Dybvig, "Efficient Nondestructive Equality
+ * Checking for Trees and Graphs" (ICFP 2008).  The comparison starts
+ * without bookkeeping, and once EQUAL_FAST_STEPS lists and vectors
+ * have been compared, it takes turns with stretches of
+ * EQUAL_SLOW_STEPS in which each two compared are merged into one
+ * class of a union-find.  Objects already in one class are taken as
+ * equal: either they compared equal, or the comparison under way
+ * decides it.  So a cycle ends once a slow stretch has been round it,
+ * and a shared part is compared about once rather than once per path
+ * to it.  The pairs of two lists are stepped through together, and
+ * if the two come round to pairs they were at before, as Brent's
+ * method checks, the rest is what has been compared already. */
+#define EQUAL_FAST_STEPS 400
+#define EQUAL_SLOW_STEPS 40
+
+/* A task of comparing two objects (index EQUAL_WHOLE) or the rest of
+ * two vectors of one length, from index */
+#define EQUAL_WHOLE ((size_t)-1)
+
+typedef struct {
+    LispObject *a;
+    LispObject *b;
+    size_t index;
+} EqualTask;
+
+typedef struct {
+    LispObject *obj;            /* NULL: empty slot */
+    size_t node;
+} UnionSlot;
+
+typedef struct {
+    EqualTask *tasks;
+    size_t count;
+    size_t capacity;
+    EqualTask local[32];        /* Tasks before any are allocated */
+    long fuel;                  /* Above 0: fast steps left; else slow */
+    UnionSlot *slots;           /* Open addressing, power-of-two size */
+    size_t slot_capacity;
+    size_t *parent;             /* Union-find forest over nodes */
+    size_t node_count;
+    size_t node_capacity;
+    int failed;                 /* Out of memory */
+} EqualState;
+
+static size_t pointer_hash(const void *key, size_t size) {
+    uint64_t h = (uint64_t)(uintptr_t)key >> 3;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & (size - 1);
+}
+
+/* Objects compared part by part */
+static int equal_compound(LispObject *obj) {
+    return obj->type == LISP_CONS || obj->type == LISP_VECTOR;
+}
+
+/* equal? of two objects of one type that are not compound */
+static int equal_atoms(LispObject *a, LispObject *b) {
     switch (a->type) {
         case LISP_NIL:
             return 1;
@@ -642,198 +1760,218 @@ int lisp_equal(LispObject *a, LispObject *b) {
             return a->character == b->character;
         case LISP_STRING:
             return a->string.length == b->string.length &&
-                   strcmp(a->string.data, b->string.data) == 0;
-        case LISP_SYMBOL:
-            return a == b;  /* Symbols are interned */
-        case LISP_CONS:
-            return lisp_equal(car(a), car(b)) && lisp_equal(cdr(a), cdr(b));
+                   memcmp(a->string.data, b->string.data, a->string.length) == 0;
+        case LISP_BYTEVECTOR:
+            return a->bytevector.length == b->bytevector.length &&
+                   memcmp(a->bytevector.bytes, b->bytevector.bytes, a->bytevector.length) == 0;
+        case LISP_NUMVECTOR:
+            return a->numvector.kind == b->numvector.kind &&
+                   a->numvector.length == b->numvector.length &&
+                   memcmp(a->numvector.data, b->numvector.data,
+                          a->numvector.length *
+                          numvec_element_size((NumvecKind)a->numvector.kind)) == 0;
+        case LISP_PMAP:
+        case LISP_PSET:
+        case LISP_PVECTOR:
+            return pcoll_equal(a, b);
         default:
-            return 0;
+            return a == b;  /* Symbols are interned; others compare by identity */
     }
 }
 
-/* Printing */
-
-static void print_recursive(LispObject *obj, FILE *out, int quoted) {
-    if (!obj) {
-        fprintf(out, "#<null>");
-        return;
+static void equal_push(EqualState *state, LispObject *a, LispObject *b, size_t index) {
+    if (state->count == state->capacity) {
+        size_t capacity = state->capacity * 2;
+        EqualTask *grown;
+        if (state->tasks == state->local) {
+            grown = (EqualTask *)malloc(capacity * sizeof(EqualTask));
+            if (grown) memcpy(grown, state->local, sizeof(state->local));
+        } else {
+            grown = (EqualTask *)realloc(state->tasks, capacity * sizeof(EqualTask));
+        }
+        if (!grown) {
+            state->failed = 1;
+            return;
+        }
+        state->tasks = grown;
+        state->capacity = capacity;
+    }
+    EqualTask *task = &state->tasks[state->count++];
+    task->a = a;
+    task->b = b;
+    task->index = index;
+}
+
+/* The union-find node of obj, made if it has none; (size_t)-1 if out
+ * of memory */
+static size_t union_node(EqualState *state, LispObject *obj) {
+    if ((state->node_count + 1) * 2 > state->slot_capacity) {
+        size_t capacity = state->slot_capacity ? state->slot_capacity * 2 : 64;
+        UnionSlot *slots = (UnionSlot *)calloc(capacity, sizeof(UnionSlot));
+        if (!slots) return (size_t)-1;
+        for (size_t i = 0; i < state->slot_capacity; i++) {
+            if (!state->slots[i].obj) continue;
+            size_t j = pointer_hash(state->slots[i].obj, capacity);
+            while (slots[j].obj) j = (j + 1) & (capacity - 1);
+            slots[j] = state->slots[i];
+        }
+        free(state->slots);
+        state->slots = slots;
+        state->slot_capacity = capacity;
     }
 
-    switch (obj->type) {
-        case LISP_NIL:
-            fprintf(out, "()");
-            break;
-
-        case LISP_BOOLEAN:
-            fprintf(out, obj->boolean ? "#t" : "#f");
-            break;
-
-        case LISP_NUMBER:
-            if (obj->number == (long long)obj->number) {
-                fprintf(out, "%lld", (long long)obj->number);
-            } else {
-                fprintf(out, "%g", obj->number);
-            }
-            break;
-
-        case LISP_CHARACTER:
-            if (quoted) {
-                switch (obj->character) {
-                    case '\n': fprintf(out, "#\\newline"); break;
-                    case ' ':  fprintf(out, "#\\space"); break;
-                    case '\t': fprintf(out, "#\\tab"); break;
-                    default:   fprintf(out, "#\\%c", obj->character); break;
-                }
-            } else {
-                fprintf(out, "%c", obj->character);
-            }
-            break;
-
-        case LISP_STRING:
-            if (quoted) {
-                fprintf(out, "\"");
-                for (size_t i = 0; i < obj->string.length; i++) {
-                    char c = obj->string.data[i];
-                    switch (c) {
-                        case '\n': fprintf(out, "\\n"); break;
-                        case '\t': fprintf(out, "\\t"); break;
-                        case '\\': fprintf(out, "\\\\"); break;
-                        case '"':  fprintf(out, "\\\""); break;
-                        default:   fprintf(out, "%c", c); break;
-                    }
-                }
-                fprintf(out, "\"");
-            } else {
-                fprintf(out, "%s", obj->string.data);
-            }
-            break;
-
-        case LISP_SYMBOL:
-            fprintf(out, "%s", obj->symbol.name);
-            break;
-
-        case LISP_CONS:
-            fprintf(out, "(");
-            print_recursive(car(obj), out, quoted);
-            obj = cdr(obj);
-            while (is_cons(obj)) {
-                fprintf(out, " ");
-                print_recursive(car(obj), out, quoted);
-                obj = cdr(obj);
-            }
-            if (!is_nil(obj)) {
-                fprintf(out, " . ");
-                print_recursive(obj, out, quoted);
-            }
-            fprintf(out, ")");
-            break;
+    size_t mask = state->slot_capacity - 1;
+    size_t i = pointer_hash(obj, state->slot_capacity);
+    while (state->slots[i].obj) {
+        if (state->slots[i].obj == obj) return state->slots[i].node;
+        i = (i + 1) & mask;
+    }
 
-        case LISP_LAMBDA:
-            if (obj->lambda.name) {
-                fprintf(out, "#<lambda:%s>", obj->lambda.name);
-            } else {
-                fprintf(out, "#<lambda>");
-            }
-            break;
+    if (state->node_count == state->node_capacity) {
+        size_t capacity = state->node_capacity ? state->node_capacity * 2 : 64;
+        size_t *parent = (size_t *)realloc(state->parent, capacity * sizeof(size_t));
+        if (!parent) return (size_t)-1;
+        state->parent = parent;
+        state->node_capacity = capacity;
+    }
+    size_t node = state->node_count++;
+    state->parent[node] = node;
+    state->slots[i].obj = obj;
+    state->slots[i].node = node;
+    return node;
+}
 
-        case LISP_PRIMITIVE:
-            fprintf(out, "#<primitive:%s>", obj->primitive.name);
-            break;
+static size_t union_find(EqualState *state, size_t node) {
+    while (state->parent[node] != node) {
+        state->parent[node] = state->parent[state->parent[node]];   /* Path halving */
+        node = state->parent[node];
+    }
+    return node;
+}
 
-        case LISP_MACRO:
-            fprintf(out, "#<macro>");
-            break;
+/* Whether two compound objects need comparing.  In a slow stretch,
+ * not if they are in one class already, and otherwise their classes
+ * are merged. */
+static int equal_visit(EqualState *state, LispObject *a, LispObject *b) {
+    if (state->fuel > 0) {
+        state->fuel--;
+        return 1;
+    }
+    if (--state->fuel < -EQUAL_SLOW_STEPS) state->fuel = EQUAL_FAST_STEPS;
 
-        case LISP_VECTOR:
-            fprintf(out, "#(");
-            for (size_t i = 0; i < obj->vector.length; i++) {
-                if (i > 0) fprintf(out, " ");
-                print_recursive(obj->vector.elements[i], out, quoted);
-            }
-            fprintf(out, ")");
-            break;
+    size_t node_a = union_node(state, a);
+    size_t node_b = node_a == (size_t)-1 ? node_a : union_node(state, b);
+    if (node_b == (size_t)-1) {
+        state->failed = 1;
+        return 0;
+    }
+    node_a = union_find(state, node_a);
+    node_b = union_find(state, node_b);
+    if (node_a == node_b) return 0;
+    state->parent[node_b] = node_a;
+    return 1;
+}
 
-        case LISP_BYTEVECTOR:
-            fprintf(out, "#vu8(");
-            for (size_t i = 0; i < obj->bytevector.length; i++) {
-                if (i > 0) fprintf(out, " ");
-                fprintf(out, "%u", obj->bytevector.bytes[i]);
+/* Compare a and b, leaving their compound parts other than a list's
+ * pairs as tasks.  Returns 0 if they differ. */
+static int equal_one(EqualState *state, LispObject *a, LispObject *b) {
+    if (a == b) return 1;
+    if (!a || !b || a->type != b->type) return 0;
+    if (!equal_compound(a)) return equal_atoms(a, b);
+    if (!equal_visit(state, a, b)) return 1;
+
+    if (a->type == LISP_VECTOR) {
+        if (a->vector.length != b->vector.length) return 0;
+        equal_push(state, a, b, 0);
+        return 1;
+    }
+
+    LispObject *mark_a = a, *mark_b = b;
+    size_t power = 1, steps = 0;
+    for (;;) {
+        LispObject *car_a = a->cons.car;
+        LispObject *car_b = b->cons.car;
+        if (car_a != car_b) {
+            if (!car_a || !car_b || car_a->type != car_b->type) return 0;
+            if (car_a->type == LISP_NUMBER) {
+                if (car_a->number != car_b->number) return 0;
+            } else if (equal_compound(car_a)) {
+                equal_push(state, car_a, car_b, EQUAL_WHOLE);
+            } else if (!equal_atoms(car_a, car_b)) {
+                return 0;
             }
-            fprintf(out, ")");
-            break;
-
-        case LISP_HASHTABLE:
-            fprintf(out, "#<hashtable count=%zu>", obj->hashtable.count);
-            break;
+        }
 
-        case LISP_RECORD_TYPE:
-            fprintf(out, "#<record-type-descriptor ");
-            print_recursive(obj->record_type.name, out, quoted);
-            fprintf(out, ">");
-            break;
+        a = a->cons.cdr;
+        b = b->cons.cdr;
+        if (a == b) return 1;
+        if (!a || !b || a->type != b->type) return 0;
+        if (a->type != LISP_CONS) {
+            if (!equal_compound(a)) return equal_atoms(a, b);
+            equal_push(state, a, b, EQUAL_WHOLE);
+            return 1;
+        }
+        if (a == mark_a && b == mark_b) return 1;
+        if (++steps == power) {
+            mark_a = a;
+            mark_b = b;
+            power *= 2;
+            steps = 0;
+        }
+    }
+}
 
-        case LISP_RECORD:
-            fprintf(out, "#<record ");
-            if (obj->record.rtd && is_record_type(obj->record.rtd)) {
-                print_recursive(obj->record.rtd->record_type.name, out, quoted);
-            }
-            fprintf(out, ">");
-            break;
+int lisp_equal(LispObject *a, LispObject *b) {
+    if (a == b) return 1;
+    if (!a || !b || a->type != b->type) return 0;
+    if (!equal_compound(a)) return equal_atoms(a, b);
+
+    EqualState state;
+    memset(&state, 0, sizeof(state));
+    state.tasks = state.local;
+    state.capacity = sizeof(state.local) / sizeof(state.local[0]);
+    state.fuel = EQUAL_FAST_STEPS;
+
+    int equal = 1;
+    equal_push(&state, a, b, EQUAL_WHOLE);
+    while (equal && state.count > 0 && !state.failed) {
+        EqualTask task = state.tasks[--state.count];
+        if (task.index == EQUAL_WHOLE) {
+            equal = equal_one(&state, task.a, task.b);
+            continue;
+        }
 
-        case LISP_CONDITION:
-            fprintf(out, "#<condition ");
-            print_recursive(obj->condition.type, out, quoted);
-            if (obj->condition.message && !is_nil(obj->condition.message)) {
-                fprintf(out, ": ");
-                print_recursive(obj->condition.message, out, 0);
+        /* The rest of two vectors: simple elements now, up to one that
+         * is compound */
+        size_t i = task.index;
+        while (i < task.a->vector.length) {
+            LispObject *item_a = task.a->vector.elements[i];
+            LispObject *item_b = task.b->vector.elements[i++];
+            if (item_a == item_b) continue;
+            if (!item_a || !item_b || item_a->type != item_b->type) {
+                equal = 0;
+                break;
             }
-            fprintf(out, ">");
-            break;
-
-        case LISP_VALUES:
-            fprintf(out, "#<values");
-            for (int i = 0; i < obj->values.count; i++) {
-                fprintf(out, " ");
-                print_recursive(obj->values.vals[i], out, quoted);
+            if (equal_compound(item_a)) {
+                equal_push(&state, task.a, task.b, i);
+                equal_push(&state, item_a, item_b, EQUAL_WHOLE);
+                break;
             }
-            fprintf(out, ">");
-            break;
-
-        case LISP_PORT:
-            fprintf(out, "#<%s%s-port",
-                    obj->port.is_input ? "input" : "",
-                    obj->port.is_output ? "output" : "");
-            if (obj->port.name) {
-                fprintf(out, " %s", obj->port.name);
+            if (!equal_atoms(item_a, item_b)) {
+                equal = 0;
+                break;
             }
-            fprintf(out, "%s>", obj->port.is_open ? "" : " closed");
-            break;
-
-        default:
-            fprintf(out, "#<unknown>");
-            break;
+        }
     }
-}
-
-void lisp_print(LispObject *obj) {
-    print_recursive(obj, stdout, 1);
-}
 
-void lisp_print_to_buffer(LispObject *obj, char *buffer, size_t size) {
-    /* Simple implementation using a temp file */
-    FILE *tmp = tmpfile();
-    if (!tmp) {
-        snprintf(buffer, size, "#<error>");
-        return;
+    if (state.failed) {
+        lisp_error("equal?: out of memory");
+        equal = 0;
     }
-    print_recursive(obj, tmp, 1);
-    long len = ftell(tmp);
-    rewind(tmp);
-    if ((size_t)len >= size) len = size - 1;
-    fread(buffer, 1, len, tmp);
-    buffer[len] = '\0';
-    fclose(tmp);
+    if (state.tasks != state.local) free(state.tasks);
+    free(state.slots);
+    free(state.parent);
+    return equal;
 }
 
 const char *lisp_type_name(LispType type) {
@@ -856,6 +1994,14 @@ const char *lisp_type_name(LispType type) {
         case LISP_CONDITION:   return "condition";
         case LISP_VALUES:      return "values";
         case LISP_PORT:        return "port";
+        case LISP_THREAD:      return "thread";
+        case LISP_MUTEX:       return "mutex";
+        case LISP_PROMISE:     return "promise";
+        case LISP_NUMVECTOR:   return "numeric vector";
+        case LISP_PMAP:        return "persistent map";
+        case LISP_PSET:        return "persistent set";
+        case LISP_PVECTOR:     return "persistent vector";
+        case LISP_TRIE:        return "trie node";
         default:               return "unknown";
     }
 }
@@ -864,48 +2010,219 @@ const char *lisp_type_name(LispType type) {
  * Essential #2: Enhanced Error Handling with Location
  * ============================================================ */
 
-/* Global error state */
-static const char *current_error_file = NULL;
-static int current_error_line = 0;
-static int current_error_column = 0;
-static char last_error_message[1024] = {0};
-static int error_occurred = 0;
+/* The error state and the innermost form under evaluation that has a
+ * source location are the calling thread's (see LispContext) */
 
 /* Set current source location */
 void lisp_set_location(const char *file, int line, int column) {
-    current_error_file = file;
-    current_error_line = line;
-    current_error_column = column;
+    lisp_context->error_file = file;
+    lisp_context->error_line = line;
+    lisp_context->error_column = column;
+}
+
+/* Set the located form being evaluated */
+LispObject *lisp_set_current_form(LispObject *form) {
+    LispObject *previous = lisp_context->current_form;
+    lisp_context->current_form = form;
+    return previous;
 }
 
-/* Get current source location */
+/* ============================================================
+ * GC Telemetry
+ * ============================================================ */
+
+static size_t gc_site_slot(const char *file, int line, size_t size) {
+    uint64_t h = ((uint64_t)(uintptr_t)file >> 3) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)line;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & (size - 1);
+}
+
+/* Count an allocation at the location of the form being evaluated */
+static void gc_record_site(void) {
+    const char *file = NULL;
+    int line = 0;
+    if (!srcloc_get(lisp_context->current_form, &file, &line, NULL)) {
+        file = "<unknown>";
+        line = 0;
+    }
+
+#ifndef _WIN32
+    pthread_mutex_lock(&site_lock);
+#endif
+    if ((gc_site_count + 1) * 2 > gc_sites_size) {
+        size_t size = gc_sites_size ? gc_sites_size * 2 : 256;
+        GCSite *sites = (GCSite *)calloc(size, sizeof(GCSite));
+        if (!sites) {
+#ifndef _WIN32
+            pthread_mutex_unlock(&site_lock);
+#endif
+            return;
+        }
+        for (size_t i = 0; i < gc_sites_size; i++) {
+            if (!gc_sites[i].file) continue;
+            size_t j = gc_site_slot(gc_sites[i].file, gc_sites[i].line, size);
+            while (sites[j].file) j = (j + 1) & (size - 1);
+            sites[j] = gc_sites[i];
+        }
+        free(gc_sites);
+        gc_sites = sites;
+        gc_sites_size = size;
+    }
+
+    size_t i = gc_site_slot(file, line, gc_sites_size);
+    while (gc_sites[i].file &&
+           (gc_sites[i].file != file || gc_sites[i].line != line)) {
+        i = (i + 1) & (gc_sites_size - 1);
+    }
+    if (!gc_sites[i].file) {
+        gc_sites[i].file = file;
+        gc_sites[i].line = line;
+        gc_site_count++;
+    }
+    gc_sites[i].samples++;
+    gc_site_samples++;
+#ifndef _WIN32
+    pthread_mutex_unlock(&site_lock);
+#endif
+}
+
+static LispObject *gc_entry(const char *key, LispObject *value) {
+    return make_cons(make_symbol(key), value);
+}
+
+/* Sites by samples, most first */
+static int compare_sites(const void *a, const void *b) {
+    const GCSite *sa = *(const GCSite *const *)a;
+    const GCSite *sb = *(const GCSite *const *)b;
+    if (sa->samples != sb->samples) return sa->samples < sb->samples ? 1 : -1;
+    return 0;
+}
+
+/* GC statistics as an alist (see gc-statistics in primitives.c) */
+LispObject *gc_statistics(void) {
+    /* Objects allocated so far are those freed plus those alive */
+    uint64_t live[LISP_TYPE_COUNT] = {0};
+    uint64_t live_bytes[LISP_TYPE_COUNT] = {0};
+    size_t heap_bytes = 0;
+    int num_objects = 0;
+
+    /* Other threads allocate into their own arrays: stop them */
+    while (!world_stop()) {}
+    for (LispContext *context = contexts; context != NULL; context = context->next) {
+        for (int i = 0; i < context->object_count; i++) {
+            LispObject *obj = context->objects[i];
+            size_t bytes = object_bytes(obj);
+            live[obj->type]++;
+            live_bytes[obj->type] += bytes;
+            heap_bytes += bytes;
+        }
+        num_objects += context->object_count;
+    }
+    for (int i = 0; i < retired_count; i++) {
+        size_t bytes = object_bytes(retired_objects[i]);
+        live[retired_objects[i]->type]++;
+        live_bytes[retired_objects[i]->type] += bytes;
+        heap_bytes += bytes;
+    }
+    num_objects += retired_count;
+
+    /* The busiest sites, while no thread records one */
+    GCSite top[GC_TOP_SITES];
+    size_t top_count = 0;
+    const GCSite **order = (const GCSite **)malloc((gc_site_count + 1) * sizeof(GCSite *));
+    if (order) {
+        for (size_t i = 0; i < gc_sites_size; i++) {
+            if (gc_sites[i].file) order[top_count++] = &gc_sites[i];
+        }
+        qsort(order, top_count, sizeof(GCSite *), compare_sites);
+        if (top_count > GC_TOP_SITES) top_count = GC_TOP_SITES;
+        for (size_t i = 0; i < top_count; i++) top[i] = *order[i];
+        free(order);
+    }
+    world_start();
+
+    /* The result is not reachable until it is returned */
+    gc_pause();
+
+    LispObject *allocations = make_nil();
+    for (int type = LISP_TYPE_COUNT - 1; type >= 0; type--) {
+        uint64_t count = gc_freed_by_type[type] + live[type];
+        if (!count) continue;
+        uint64_t bytes = gc_freed_bytes_by_type[type] + live_bytes[type];
+        LispObject *entry = make_cons(make_symbol(lisp_type_name((LispType)type)),
+                                make_cons(make_number((double)count),
+                                    make_cons(make_number((double)bytes), make_nil())));
+        allocations = make_cons(entry, allocations);
+    }
+
+    /* Estimated allocations at the busiest sites */
+    LispObject *sites = make_nil();
+    for (size_t i = top_count; i-- > 0;) {
+        char name[1024];
+        snprintf(name, sizeof(name), "%s:%d", top[i].file, top[i].line);
+        sites = make_cons(make_cons(make_string(name),
+                                    make_number((double)(top[i].samples * GC_SITE_SAMPLE))),
+                          sites);
+    }
+
+    /* Pauses by upper bound in microseconds */
+    LispObject *histogram = make_nil();
+    for (int bucket = GC_PAUSE_BUCKETS - 1; bucket >= 0; bucket--) {
+        if (!gc_pause_histogram[bucket]) continue;
+        histogram = make_cons(make_cons(make_number((double)(1u << bucket)),
+                                        make_number((double)gc_pause_histogram[bucket])),
+                              histogram);
+    }
+
+    LispObject *stats = make_nil();
+    stats = make_cons(gc_entry("pause-histogram", histogram), stats);
+    stats = make_cons(gc_entry("sites", sites), stats);
+    stats = make_cons(gc_entry("allocations", allocations), stats);
+    stats = make_cons(gc_entry("survivor-rate", make_number(gc_last_survivor_rate)), stats);
+    stats = make_cons(gc_entry("sweep-ms", make_number(gc_sweep_total_us / 1000.0)), stats);
+    stats = make_cons(gc_entry("mark-ms", make_number(gc_mark_total_us / 1000.0)), stats);
+    stats = make_cons(gc_entry("max-pause-ms", make_number(gc_pause_max_us / 1000.0)), stats);
+    stats = make_cons(gc_entry("pause-ms", make_number(gc_pause_total_us / 1000.0)), stats);
+    stats = make_cons(gc_entry("freed", make_number((double)gc_objects_freed)), stats);
+    stats = make_cons(gc_entry("threshold", make_number((double)gc_threshold)), stats);
+    stats = make_cons(gc_entry("live-bytes", make_number((double)heap_bytes)), stats);
+    stats = make_cons(gc_entry("live-objects", make_number((double)num_objects)), stats);
+    stats = make_cons(gc_entry("collections", make_number((double)gc_collections)), stats);
+
+    gc_resume();
+    return stats;
+}
+
+/* Get current source location: that of the form being evaluated, if it
+ * has one */
 void lisp_get_location(const char **file, int *line, int *column) {
-    if (file) *file = current_error_file;
-    if (line) *line = current_error_line;
-    if (column) *column = current_error_column;
+    if (srcloc_get(lisp_context->current_form, file, line, column)) return;
+    if (file) *file = lisp_context->error_file;
+    if (line) *line = lisp_context->error_line;
+    if (column) *column = lisp_context->error_column;
 }
 
 /* Clear source location */
 void lisp_clear_location(void) {
-    current_error_file = NULL;
-    current_error_line = 0;
-    current_error_column = 0;
+    lisp_context->error_file = NULL;
+    lisp_context->error_line = 0;
+    lisp_context->error_column = 0;
 }
 
 /* Get last error message */
 const char *lisp_get_last_error(void) {
-    return last_error_message;
+    return lisp_context->error_message;
 }
 
 /* Check if an error occurred */
 int lisp_had_error(void) {
-    return error_occurred;
+    return lisp_context->error_occurred;
 }
 
 /* Clear error state */
 void lisp_clear_error(void) {
-    error_occurred = 0;
-    last_error_message[0] = '\0';
+    lisp_context->error_occurred = 0;
+    lisp_context->error_message[0] = '\0';
 }
 
 /* Error handling - basic (uses current location if set) */
@@ -913,36 +2230,29 @@ void lisp_error(const char *format, ...) {
     va_list args;
     va_start(args, format);
 
-    error_occurred = 1;
+    lisp_context->error_occurred = 1;
 
     /* Format message to buffer */
     char msg_buffer[512];
     vsnprintf(msg_buffer, sizeof(msg_buffer), format, args);
 
+    const char *file;
+    int line, column;
+    lisp_get_location(&file, &line, &column);
+
     /* Print with location if available */
-    if (current_error_file && current_error_line > 0) {
+    if (file && line > 0) {
         fprintf(stderr, "Error at %s:%d:%d: %s\n",
-                current_error_file,
-                current_error_line,
-                current_error_column,
-                msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
-                 "%s:%d:%d: %s",
-                 current_error_file,
-                 current_error_line,
-                 current_error_column,
-                 msg_buffer);
-    } else if (current_error_line > 0) {
-        fprintf(stderr, "Error at line %d: %s\n",
-                current_error_line,
-                msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
-                 "line %d: %s",
-                 current_error_line,
-                 msg_buffer);
+                file, line, column, msg_buffer);
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
+                 "%s:%d:%d: %s", file, line, column, msg_buffer);
+    } else if (line > 0) {
+        fprintf(stderr, "Error at line %d: %s\n", line, msg_buffer);
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
+                 "line %d: %s", line, msg_buffer);
     } else {
         fprintf(stderr, "Error: %s\n", msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
                  "%s", msg_buffer);
     }
 
@@ -954,7 +2264,7 @@ void lisp_error_at(const char *file, int line, int column, const char *format, .
     va_list args;
     va_start(args, format);
 
-    error_occurred = 1;
+    lisp_context->error_occurred = 1;
 
     /* Format message to buffer */
     char msg_buffer[512];
@@ -963,15 +2273,15 @@ void lisp_error_at(const char *file, int line, int column, const char *format, .
     /* Print with location */
     if (file && line > 0) {
         fprintf(stderr, "Error at %s:%d:%d: %s\n", file, line, column, msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
                  "%s:%d:%d: %s", file, line, column, msg_buffer);
     } else if (line > 0) {
         fprintf(stderr, "Error at line %d: %s\n", line, msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
                  "line %d: %s", line, msg_buffer);
     } else {
         fprintf(stderr, "Error: %s\n", msg_buffer);
-        snprintf(last_error_message, sizeof(last_error_message),
+        snprintf(lisp_context->error_message, sizeof(lisp_context->error_message),
                  "%s", msg_buffer);
     }
 
@@ -1116,6 +2426,104 @@ size_t bytevector_length(LispObject *bv) {
 #define HASHTABLE_INITIAL_SIZE 16
 #define HASHTABLE_LOAD_FACTOR 0.75
 
+/* Hash of a number: small integers differ only in the high bits of
+ * their representation, so all 64 bits are mixed in (0.0 and -0.0 are
+ * the same key) */
+static uint32_t hash_number(double d) {
+    uint64_t bits;
+    if (d == 0) d = 0;
+    memcpy(&bits, &d, sizeof bits);
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+/* Parts of a key an equal hash looks at */
+#define EQUAL_HASH_PARTS 32
+
+/* A hash that is the same for keys that are equal?.  It looks at the
+ * key and its parts breadth first, and at no more than
+ * EQUAL_HASH_PARTS of them, so a long or circular key hashes quickly
+ * and by its start. */
+static uint32_t equal_hash(LispObject *key) {
+    LispObject *parts[EQUAL_HASH_PARTS];
+    size_t head = 0, tail = 0;
+    uint32_t h = 0;
+    parts[tail++] = key;
+
+    while (head < tail) {
+        LispObject *obj = parts[head++];
+        uint32_t part;
+        if (!obj) {
+            part = 0;
+        } else {
+            switch (obj->type) {
+                case LISP_STRING:
+                    part = hash_string(obj->string.data, obj->string.length);
+                    break;
+                case LISP_SYMBOL:
+                    part = obj->symbol.hash;
+                    break;
+                case LISP_NUMBER:
+                    part = hash_number(obj->number);
+                    break;
+                case LISP_CHARACTER:
+                    part = obj->character;
+                    break;
+                case LISP_BOOLEAN:
+                    part = (uint32_t)obj->boolean;
+                    break;
+                case LISP_NIL:
+                    part = 0;
+                    break;
+                case LISP_BYTEVECTOR:
+                    part = hash_string((const char *)obj->bytevector.bytes, obj->bytevector.length);
+                    break;
+                case LISP_NUMVECTOR:
+                    part = hash_string((const char *)obj->numvector.data,
+                                       obj->numvector.length *
+                                       numvec_element_size((NumvecKind)obj->numvector.kind)) +
+                           (uint32_t)obj->numvector.kind;
+                    break;
+                case LISP_CONS:
+                    part = 0;
+                    if (tail < EQUAL_HASH_PARTS) parts[tail++] = obj->cons.car;
+                    if (tail < EQUAL_HASH_PARTS) parts[tail++] = obj->cons.cdr;
+                    break;
+                case LISP_VECTOR:
+                    part = (uint32_t)obj->vector.length;
+                    for (size_t i = 0; i < obj->vector.length && tail < EQUAL_HASH_PARTS; i++) {
+                        parts[tail++] = obj->vector.elements[i];
+                    }
+                    break;
+                case LISP_PVECTOR:
+                    part = (uint32_t)obj->pcoll.count;
+                    for (size_t i = 0; i < obj->pcoll.count && tail < EQUAL_HASH_PARTS; i++) {
+                        parts[tail++] = pvector_ref(obj, i);
+                    }
+                    break;
+                case LISP_PMAP:
+                case LISP_PSET:
+                    /* Equal maps may hold colliding keys in different
+                     * orders: only the count is the same */
+                    part = (uint32_t)obj->pcoll.count;
+                    break;
+                default:
+                    part = (uint32_t)(uintptr_t)obj;
+                    break;
+            }
+            part ^= (uint32_t)obj->type << 24;
+        }
+        h = (h ^ part) * 0x01000193u;
+    }
+    return h;
+}
+
+uint32_t lisp_hash(LispObject *obj) {
+    return equal_hash(obj);
+}
+
 static size_t hashtable_hash(LispObject *ht, LispObject *key) {
     uint32_t h;
     switch (ht->hashtable.hash_type) {
@@ -1124,8 +2532,7 @@ static size_t hashtable_hash(LispObject *ht, LispObject *key) {
             break;
         case 1:  /* eqv hash */
             if (is_number(key)) {
-                double d = key->number;
-                h = (uint32_t)(*(uint64_t *)&d);
+                h = hash_number(key->number);
             } else if (is_symbol(key)) {
                 h = key->symbol.hash;
             } else {
@@ -1134,16 +2541,7 @@ static size_t hashtable_hash(LispObject *ht, LispObject *key) {
             break;
         case 2:  /* equal hash */
         default:
-            if (is_string(key)) {
-                h = hash_string(key->string.data);
-            } else if (is_symbol(key)) {
-                h = key->symbol.hash;
-            } else if (is_number(key)) {
-                double d = key->number;
-                h = (uint32_t)(*(uint64_t *)&d);
-            } else {
-                h = (uint32_t)(uintptr_t)key;
-            }
+            h = equal_hash(key);
             break;
     }
     return h % ht->hashtable.capacity;
@@ -1285,6 +2683,25 @@ void hashtable_delete(LispObject *ht, LispObject *key) {
             ht->hashtable.keys[index] = NULL;
             ht->hashtable.values[index] = NULL;
             ht->hashtable.count--;
+
+            /* Move later keys of the probe run back into the hole, so
+             * that lookups for them do not stop short at it */
+            size_t capacity = ht->hashtable.capacity;
+            size_t hole = index;
+            size_t next = (index + 1) % capacity;
+            while (ht->hashtable.keys[next]) {
+                size_t home = hashtable_hash(ht, ht->hashtable.keys[next]);
+                int movable = hole <= next ? (home <= hole || home > next)
+                                           : (home <= hole && home > next);
+                if (movable) {
+                    ht->hashtable.keys[hole] = ht->hashtable.keys[next];
+                    ht->hashtable.values[hole] = ht->hashtable.values[next];
+                    ht->hashtable.keys[next] = NULL;
+                    ht->hashtable.values[next] = NULL;
+                    hole = next;
+                }
+                next = (next + 1) % capacity;
+            }
             return;
         }
         index = (index + 1) % ht->hashtable.capacity;
@@ -1332,14 +2749,24 @@ LispObject *hashtable_values(LispObject *ht) {
  * ============================================================ */
 
 LispObject *make_record_type(LispObject *name, LispObject *parent, LispObject *fields) {
-    LispObject *obj = lisp_alloc();
+    int depth = is_record_type(parent) ? parent->record_type.depth + 1 : 0;
+    LispObject *obj = lisp_alloc_tail((size_t)(depth + 1) * sizeof(LispObject *));
     obj->type = LISP_RECORD_TYPE;
     obj->record_type.name = name;
     obj->record_type.parent = parent;
     obj->record_type.fields = fields;
     obj->record_type.field_count = list_length(fields);
+    obj->record_type.size = obj->record_type.field_count +
+                            (depth > 0 ? parent->record_type.size : 0);
+    obj->record_type.depth = depth;
     obj->record_type.sealed = 0;
     obj->record_type.opaque = 0;
+
+    /* The ancestors from the root down: a type is at its depth in the
+     * ancestors of every type derived from it */
+    for (LispObject *t = obj; depth >= 0; t = t->record_type.parent) {
+        RECORD_TYPE_ANCESTORS(obj)[depth--] = t;
+    }
     return obj;
 }
 
@@ -1347,32 +2774,28 @@ int is_record_type(LispObject *obj) {
     return obj && obj->type == LISP_RECORD_TYPE;
 }
 
+int record_type_is(LispObject *rtd, LispObject *ancestor) {
+    int depth = ancestor->record_type.depth;
+    return rtd == ancestor ||
+           (rtd->record_type.depth > depth && RECORD_TYPE_ANCESTORS(rtd)[depth] == ancestor);
+}
+
 LispObject *make_record(LispObject *rtd) {
     if (!is_record_type(rtd)) {
         lisp_error("make-record: not a record type descriptor");
         return LISP_NIL_OBJ;
     }
 
-    /* Count total fields including parent */
-    int total_fields = rtd->record_type.field_count;
-    LispObject *parent = rtd->record_type.parent;
-    while (is_record_type(parent)) {
-        total_fields += parent->record_type.field_count;
-        parent = parent->record_type.parent;
-    }
-
-    LispObject *obj = lisp_alloc();
+    /* The fields follow the object */
+    size_t count = (size_t)rtd->record_type.size;
+    LispObject *obj = lisp_alloc_tail(count * sizeof(LispObject *));
     obj->type = LISP_RECORD;
     obj->record.rtd = rtd;
-    obj->record.fields = (LispObject **)calloc(total_fields, sizeof(LispObject *));
-    if (!obj->record.fields && total_fields > 0) {
-        lisp_error("Out of memory allocating record");
-        return LISP_NIL_OBJ;
-    }
+    obj->record.count = count;
 
     /* Initialize all fields to unspecified (nil) */
-    for (int i = 0; i < total_fields; i++) {
-        obj->record.fields[i] = LISP_NIL_OBJ;
+    for (size_t i = 0; i < count; i++) {
+        RECORD_FIELDS(obj)[i] = LISP_NIL_OBJ;
     }
 
     return obj;
@@ -1395,7 +2818,7 @@ LispObject *record_ref(LispObject *rec, int field_index) {
         lisp_error("record-ref: not a record");
         return LISP_NIL_OBJ;
     }
-    return rec->record.fields[field_index];
+    return RECORD_FIELDS(rec)[field_index];
 }
 
 void record_set(LispObject *rec, int field_index, LispObject *value) {
@@ -1403,7 +2826,7 @@ void record_set(LispObject *rec, int field_index, LispObject *value) {
         lisp_error("record-set!: not a record");
         return;
     }
-    rec->record.fields[field_index] = value;
+    RECORD_FIELDS(rec)[field_index] = value;
 }
 
 /* ============================================================
@@ -1464,6 +2887,7 @@ LispObject *make_port(void *stream, int is_input, int is_output, int is_binary,
     obj->port.is_output = is_output;
     obj->port.is_binary = is_binary;
     obj->port.is_open = 1;
+    obj->port.is_string = 0;
     obj->port.name = name ? strdup(name) : NULL;
     return obj;
 }
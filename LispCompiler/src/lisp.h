@@ -10,10 +10,29 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 /* Forward declarations */
 typedef struct LispObject LispObject;
 typedef struct Environment Environment;
+typedef struct StringIndex StringIndex;
+typedef struct LispContext LispContext;
+
+/* Storage class of per-thread variables */
+#ifdef _MSC_VER
+#define LISP_THREAD_LOCAL __declspec(thread)
+#else
+#define LISP_THREAD_LOCAL _Thread_local
+#endif
+
+/* Loads and stores of pointers read by other threads without a lock */
+#ifdef _MSC_VER
+#define LOAD_ACQUIRE(p) (*(p))
+#define STORE_RELEASE(p, v) (*(p) = (v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
 
 /* Object types */
 typedef enum {
@@ -35,16 +54,38 @@ typedef enum {
     LISP_RECORD,
     LISP_CONDITION,
     LISP_VALUES,
-    LISP_PORT
+    LISP_PORT,
+    /* Threads (thread.h) */
+    LISP_THREAD,
+    LISP_MUTEX,
+    /* Promises and streams (promise.h) */
+    LISP_PROMISE,
+    /* Homogeneous numeric vectors (numvec.h) */
+    LISP_NUMVECTOR,
+    /* Persistent collections and their nodes (pcoll.h) */
+    LISP_PMAP,
+    LISP_PSET,
+    LISP_PVECTOR,
+    LISP_TRIE
 } LispType;
 
 /* Primitive function pointer type */
 typedef LispObject* (*LispPrimitiveFn)(LispObject *args);
 
+/* Function of a primitive closure, which it is passed as self */
+typedef LispObject* (*LispClosureFn)(LispObject *self, LispObject *args);
+
+/* gc_mark of objects laid out statically outside the heap (constants in
+ * compiled programs).  The collector treats them as already marked, so it
+ * neither traces nor frees them; everything they point to must be
+ * permanent as well (symbols, singletons or other static objects). */
+#define GC_MARK_STATIC 2
+
 /* The universal Lisp object structure */
 struct LispObject {
     LispType type;
     uint8_t gc_mark;      /* For garbage collection */
+    uint8_t has_location; /* Has an entry in the source location table */
 
     union {
         /* Boolean */
@@ -53,13 +94,18 @@ struct LispObject {
         /* Number (double precision) */
         double number;
 
-        /* Character */
-        char character;
+        /* Character: a Unicode scalar value */
+        uint32_t character;
 
-        /* String */
+        /* String: UTF-8, always valid */
         struct {
             char *data;
-            size_t length;
+            size_t length;           /* Bytes */
+            size_t chars;            /* Characters; equal to length for ASCII */
+            StringIndex *index;      /* Where every STRING_INDEX_STRIDEth
+                                      * character starts: made the first
+                                      * time a long non-ASCII string is
+                                      * indexed, NULL until then */
         } string;
 
         /* Symbol */
@@ -82,12 +128,17 @@ struct LispObject {
             char *name;              /* Optional name for debugging */
         } lambda;
 
-        /* Primitive function */
+        /* Primitive function, or a primitive closure if data is set */
         struct {
             const char *name;
-            LispPrimitiveFn func;
+            union {
+                LispPrimitiveFn func;
+                LispClosureFn closure;
+            };
             int min_args;
             int max_args;            /* -1 for variadic */
+            LispObject *data;        /* What a closure closes over */
+            int slot;                /* and a number it was made with */
         } primitive;
 
         /* Macro */
@@ -118,20 +169,23 @@ struct LispObject {
             int hash_type;  /* 0=eq, 1=eqv, 2=equal */
         } hashtable;
 
-        /* R6RS: Record type descriptor */
+        /* R6RS: Record type descriptor, followed by its depth + 1
+         * ancestors (RECORD_TYPE_ANCESTORS) */
         struct {
             LispObject *name;
             LispObject *parent;
             LispObject *fields;     /* List of field names */
             int field_count;
-            int sealed;
-            int opaque;
+            int size;               /* Fields, with those of the parents */
+            int depth;              /* Parents above it */
+            uint8_t sealed;
+            uint8_t opaque;
         } record_type;
 
-        /* R6RS: Record instance */
+        /* R6RS: Record instance, followed by its fields (RECORD_FIELDS) */
         struct {
             LispObject *rtd;        /* Record type descriptor */
-            LispObject **fields;
+            size_t count;
         } record;
 
         /* R6RS: Condition */
@@ -155,8 +209,59 @@ struct LispObject {
             int is_output;
             int is_binary;
             int is_open;
+            int is_string;          /* stream is a Printer collecting a string */
             char *name;
         } port;
+
+        /* Thread */
+        struct {
+            LispObject *thunk;
+            LispObject *name;
+            LispObject *result;     /* The thunk's value, once it returns */
+            void *handle;           /* Operating system state (thread.c) */
+        } thread;
+
+        /* Mutex */
+        struct {
+            LispObject *name;
+            void *handle;
+        } mutex;
+
+        /* Promise */
+        struct {
+            int state;              /* PromiseState (promise.h) */
+            int op;                 /* StreamOp of a PROMISE_STREAM */
+            LispObject *value;      /* Value, expression, step arguments
+                                     * or the promise it has become */
+            Environment *env;       /* Where the expression is evaluated */
+        } promise;
+
+        /* SRFI-4: Numeric vector */
+        struct {
+            void *data;             /* length elements of kind */
+            size_t length;
+            int kind;               /* NumvecKind (numvec.h) */
+        } numvector;
+
+        /* Persistent map, set or vector */
+        struct {
+            LispObject *root;       /* Trie node, or NULL when empty */
+            size_t count;           /* Entries or elements */
+            uint64_t edit;          /* Nonzero while a transient */
+            int shift;              /* Vector: 5 bits per level above the leaves */
+        } pcoll;
+
+        /* Node of a persistent collection */
+        struct {
+            LispObject **slots;     /* Entries then children, or elements */
+            size_t *sizes;          /* Vector: elements up to the end of
+                                     * each child, NULL while all but the
+                                     * last are full */
+            uint64_t edit;          /* The transient that may change it */
+            uint32_t datamap;       /* Map: hash fragments of the entries */
+            uint32_t nodemap;       /* Map: hash fragments of the children */
+            uint32_t length;        /* Slots */
+        } trie;
     };
 };
 
@@ -165,6 +270,10 @@ extern LispObject *LISP_NIL_OBJ;
 extern LispObject *LISP_TRUE;
 extern LispObject *LISP_FALSE;
 
+/* The record type of transducers (primitives.c), made once for the
+ * process so every thread, and images, share it */
+extern LispObject *LISP_TRANSDUCER_TYPE;
+
 /* Initialize the Lisp system */
 void lisp_init(void);
 void lisp_shutdown(void);
@@ -173,13 +282,19 @@ void lisp_shutdown(void);
 LispObject *make_nil(void);
 LispObject *make_boolean(int value);
 LispObject *make_number(double value);
-LispObject *make_character(char c);
+LispObject *make_character(uint32_t c);
 LispObject *make_string(const char *str);
+/* A string of the len bytes at str, which should be UTF-8: a byte that
+ * is not is taken as U+FFFD */
 LispObject *make_string_n(const char *str, size_t len);
 LispObject *make_symbol(const char *name);
+LispObject *make_symbol_n(const char *name, size_t len);
 LispObject *make_cons(LispObject *car, LispObject *cdr);
 LispObject *make_lambda(LispObject *params, LispObject *body, Environment *env);
 LispObject *make_primitive(const char *name, LispPrimitiveFn func, int min_args, int max_args);
+/* A primitive that calls func with itself, and so with data and slot */
+LispObject *make_primitive_closure(const char *name, LispClosureFn func, int min_args,
+                                   int max_args, LispObject *data, int slot);
 LispObject *make_macro(LispObject *params, LispObject *body, Environment *env);
 
 /* R6RS constructors */
@@ -220,6 +335,22 @@ int is_port(LispObject *obj);
 int is_input_port(LispObject *obj);
 int is_output_port(LispObject *obj);
 
+/* Characters of strings.  Strings are indexed by character: an ASCII
+ * string's indices are its byte offsets, and a longer non-ASCII one
+ * keeps an index of where every STRING_INDEX_STRIDEth character starts,
+ * so finding any character takes at most that many steps. */
+#define STRING_INDEX_STRIDE 32
+
+/* Byte offset of character index of str (its byte length for index
+ * str->string.chars) */
+size_t string_offset(LispObject *str, size_t index);
+
+/* Character index of the character that starts at byte offset of str */
+size_t string_char_index(LispObject *str, size_t offset);
+
+/* Character index of str */
+uint32_t string_char_at(LispObject *str, size_t index);
+
 /* Accessors for cons cells */
 LispObject *car(LispObject *obj);
 LispObject *cdr(LispObject *obj);
@@ -244,13 +375,16 @@ int is_symbol_named(LispObject *obj, const char *name);
 int lisp_eq(LispObject *a, LispObject *b);
 int lisp_equal(LispObject *a, LispObject *b);
 
-/* Printing */
+/* Printing (printer.c): as write does, to stdout or into a buffer of
+ * size bytes, cut short if it does not fit */
 void lisp_print(LispObject *obj);
 void lisp_print_to_buffer(LispObject *obj, char *buffer, size_t size);
 const char *lisp_type_name(LispType type);
 
 /* Memory management */
 LispObject *lisp_alloc(void);
+/* An object followed by tail bytes of zeros that belong to it */
+LispObject *lisp_alloc_tail(size_t tail);
 void lisp_free(LispObject *obj);
 
 /* Garbage Collection */
@@ -259,8 +393,163 @@ void gc_remove_root(LispObject **root);
 void gc_add_env_root(Environment *env);
 void gc_remove_env_root(Environment *env);
 void gc_collect(void);
+
+/* Hold off collection while building objects that are not yet
+ * reachable from a root (calls nest) */
+void gc_pause(void);
+void gc_resume(void);
+
+/* Shadow stack of C frames whose object slots are GC roots.
+ * Used by compiled code: push a frame on entry, pop it on exit
+ * (gc_push_frame and gc_pop_frame, with the evaluation contexts). */
+typedef struct GCFrame {
+    struct GCFrame *prev;
+    LispObject **slots;
+    int count;
+} GCFrame;
+
+/* Stop rooting args, if it is the argument list the evaluator is
+ * applying a primitive to.  A primitive that consumes a stream calls
+ * this once it has rooted what it still needs, so that the part of the
+ * stream it has passed can be collected. */
+void gc_release_args(LispObject *args);
+
+/* Stop at a safepoint: eval calls this when lisp_context->gc_pending or
+ * gc_stop_requested is set, with every object it holds rooted.  Runs a
+ * collection that is due, or waits while another thread's runs. */
+void gc_safepoint(void);
+
+/* Set while a thread waits for the others to stop for a collection
+ * (read with LOAD_ACQUIRE: it changes under the collector's lock) */
+extern int gc_stop_requested;
+
+/* Bracket a call that may block (joining a thread, locking a mutex),
+ * during which the thread holds no unrooted objects: collections
+ * proceed without waiting for it */
+void gc_blocking_begin(void);
+void gc_blocking_end(void);
+
 void gc_stats(int *collections, int *freed, int *current);
 
+/* Telemetry since startup as an alist: collections, live objects and
+ * bytes, threshold, objects freed, total and longest pause, mark and
+ * sweep time (ms), the last collection's survivor rate, allocations by
+ * type as (type count bytes), estimated allocations at the busiest
+ * source locations as ("file:line" . count), and pauses as
+ * (upper-bound-us . count) */
+LispObject *gc_statistics(void);
+
+/* Write one line of JSON per collection to log (NULL: stop) */
+void gc_set_log(FILE *log);
+
+/* Mark and sweep large heaps on this many threads (1, the default, for
+ * none besides the collecting thread) */
+#define GC_MAX_THREADS 64
+void gc_set_threads(int threads);
+
+/* ============================================================
+ * Evaluation Contexts
+ * ============================================================ */
+
+#define MAX_GC_ROOTS 1024
+
+/* Environments of the evaluations in progress, indexed by eval depth
+ * (1..env_depth).  Local variables are reachable from nothing else, so
+ * eval records each evaluation's environment here. */
+#define GC_ENV_STACK_SIZE 10001
+
+/* Stack kept free below the deepest evaluation, for reporting that the
+ * recursion went too deep and returning; how deep that is depends on
+ * the frames of the build, so eval checks the stack left as well as its
+ * depth */
+#define LISP_STACK_RESERVE (256 * 1024)
+
+/* Address of the calling function's frame (stacks grow down) */
+#if defined(__GNUC__)
+#define LISP_STACK_ADDRESS() ((uintptr_t)__builtin_frame_address(0))
+#else
+#include <intrin.h>
+#define LISP_STACK_ADDRESS() ((uintptr_t)_AddressOfReturnAddress())
+#endif
+
+/* The state of one thread's evaluation: the objects it allocated, its
+ * GC roots, the environments of its evaluations in progress and its
+ * error state.  Threads share the heap (a collection stops them all at
+ * safepoints), the symbol table and the global environment.
+ * lisp_init creates and enters the main thread's context. */
+struct LispContext {
+    /* Objects this thread allocated (swept by every collection) */
+    LispObject **objects;
+    int object_count;
+    int object_capacity;
+
+    /* Roots: registered pointers, shadow frames, eval's environments */
+    LispObject **roots[MAX_GC_ROOTS];
+    int root_count;
+    GCFrame *frame_top;
+    int env_depth;
+    Environment *env_stack[GC_ENV_STACK_SIZE];
+    LispObject **call_args;        /* Argument list being applied (eval) */
+    LispObject *thread;            /* Thread object this context runs */
+    uintptr_t stack_limit;         /* Lowest frame address eval allows */
+
+    /* Collection */
+    int gc_pending;                /* Due at the next eval (see lisp_alloc) */
+    int gc_paused;
+    int blocked;                   /* Between gc_blocking_begin and _end */
+    int site_countdown;            /* Allocations until the next sample */
+
+    /* Errors */
+    LispObject *current_form;
+    const char *error_file;
+    int error_line;
+    int error_column;
+    int error_occurred;
+    char error_message[1024];
+
+    LispContext *next;             /* All contexts */
+};
+
+/* The calling thread's context */
+extern LISP_THREAD_LOCAL LispContext *lisp_context;
+
+/* Push a frame of object slots onto the calling thread's shadow stack,
+ * and pop it (it must be the innermost one); inline, as every compiled
+ * function does both */
+static inline void gc_push_frame(GCFrame *frame, LispObject **slots, int count) {
+    LispContext *context = lisp_context;
+    frame->slots = slots;
+    frame->count = count;
+    frame->prev = context->frame_top;
+    context->frame_top = frame;
+}
+
+static inline void gc_pop_frame(GCFrame *frame) {
+    lisp_context->frame_top = frame->prev;
+}
+
+/* Create a context for a new thread, rooting its thread object.  It
+ * counts as blocked until the thread enters it. */
+LispContext *lisp_context_create(LispObject *thread);
+
+/* Make context the calling thread's (on the thread that runs it), its
+ * stack the lisp_stack_size bytes from here down */
+void lisp_context_enter(LispContext *context);
+
+/* Size of a thread's stack: the main thread's limit, up to
+ * LISP_MAX_STACK; threads are started with this much */
+#define LISP_MAX_STACK (8 * 1024 * 1024)
+size_t lisp_stack_size(void);
+
+/* Destroy a context: the calling thread's, or one that no thread has
+ * entered.  The objects it allocated stay in the heap. */
+void lisp_context_destroy(LispContext *context);
+
+/* Wait until every thread started from the calling one's context has
+ * finished, letting collections run meanwhile; done before freeing the
+ * global environment the threads may still use */
+void lisp_wait_threads(void);
+
 /* ============================================================
  * Essential #2: Enhanced Error Handling with Location
  * ============================================================ */
@@ -274,6 +563,10 @@ void lisp_get_location(const char **file, int *line, int *column);
 /* Clear source location */
 void lisp_clear_location(void);
 
+/* Set the form being evaluated whose source location errors report;
+ * returns the previous one */
+LispObject *lisp_set_current_form(LispObject *form);
+
 /* Error handling - basic */
 void lisp_error(const char *format, ...);
 
@@ -309,7 +602,17 @@ size_t hashtable_size(LispObject *ht);
 LispObject *hashtable_keys(LispObject *ht);
 LispObject *hashtable_values(LispObject *ht);
 
+/* A hash that is the same for objects that are equal?, the one
+ * hashtables made by make-hashtable use */
+uint32_t lisp_hash(LispObject *obj);
+
 /* R6RS: Record operations */
+#define RECORD_FIELDS(rec) ((LispObject **)((rec) + 1))
+#define RECORD_TYPE_ANCESTORS(rtd) ((LispObject **)((rtd) + 1))
+
+/* Whether records of type rtd are of type ancestor: ancestor is rtd or
+ * one of its parents */
+int record_type_is(LispObject *rtd, LispObject *ancestor);
 LispObject *record_ref(LispObject *rec, int field_index);
 void record_set(LispObject *rec, int field_index, LispObject *value);
 LispObject *record_rtd(LispObject *rec);
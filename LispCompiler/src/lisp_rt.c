@@ -0,0 +1,175 @@
+/*
+ * lisp_rt.c - Runtime Support for C Code Generated by the C Backend
+ */
+
+#include "lisp_rt.h"
+#include "lexer.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RtTailCall rt_tail;
+LispObject rt_tail_marker;
+Environment *rt_global_env = NULL;
+
+/* Keeps the trampoline argument registers rooted */
+static GCFrame tail_frame;
+
+/* Initialize the runtime for a compiled program */
+void rt_init(int argc, char **argv, const PrimitiveDef *primitives) {
+    (void)argc;
+    (void)argv;
+
+    lisp_init();
+
+    rt_global_env = env_create_global();
+    register_primitive_defs(rt_global_env, primitives);
+    gc_add_env_root(rt_global_env);
+
+    gc_push_frame(&tail_frame, rt_tail.argv, RT_MAX_TAIL_ARGS);
+}
+
+/* Release runtime resources */
+void rt_shutdown(void) {
+    gc_pop_frame(&tail_frame);
+    lisp_wait_threads();
+    gc_remove_env_root(rt_global_env);
+    env_free(rt_global_env);
+    rt_global_env = NULL;
+    lisp_shutdown();
+}
+
+/* Intern the program's symbols */
+void rt_intern_symbols(const char *const *names, LispObject **symbols, int count) {
+    for (int i = 0; i < count; i++) {
+        symbols[i] = make_symbol(names[i]);
+    }
+}
+
+/* Look up a global variable, caching its binding cell */
+LispObject *rt_global_lookup(Binding **cache, LispObject *symbol) {
+    if (*cache == NULL) {
+        *cache = env_lookup_binding(rt_global_env, symbol);
+        if (*cache == NULL) {
+            lisp_error("Unbound variable: %s", symbol->symbol.name);
+            return make_nil();
+        }
+    }
+    return (*cache)->value;
+}
+
+/* Define (or redefine) a global variable */
+void rt_global_define(LispObject *symbol, LispObject *value) {
+    env_define(rt_global_env, symbol, value);
+}
+
+/* Assign an existing global variable */
+void rt_global_set(Binding **cache, LispObject *symbol, LispObject *value) {
+    if (*cache == NULL) {
+        *cache = env_lookup_binding(rt_global_env, symbol);
+        if (*cache == NULL) {
+            lisp_error("Cannot set undefined variable: %s", symbol->symbol.name);
+            return;
+        }
+    }
+    (*cache)->value = value;
+}
+
+/* Build an argument list from rooted argument slots */
+static LispObject *make_arg_list(int argc, LispObject **argv) {
+    LispObject *list = make_nil();
+    for (int i = argc - 1; i >= 0; i--) {
+        list = make_cons(argv[i], list);
+    }
+    return list;
+}
+
+/* Call any procedure object (argv slots must be GC roots) */
+LispObject *rt_call(LispObject *func, int argc, LispObject **argv) {
+    LispObject *slots[2];
+    GCFrame frame;
+
+    slots[0] = func;
+    slots[1] = NULL;
+    gc_push_frame(&frame, slots, 2);
+
+    slots[1] = make_arg_list(argc, argv);
+    LispObject *result = apply(func, slots[1], rt_global_env);
+
+    gc_pop_frame(&frame);
+    return result;
+}
+
+/* Report recursion too deep for the stack, as eval does */
+void rt_stack_error(void) {
+    lisp_error("Maximum recursion depth exceeded (stack exhausted)");
+}
+
+/* Call a primitive's C function directly, checking arity like apply() */
+LispObject *rt_call_prim(LispPrimitiveFn fn, const char *name,
+                         int min_args, int max_args, int argc, LispObject **argv) {
+    if (argc < min_args) {
+        lisp_error("%s: too few arguments (expected at least %d, got %d)",
+                   name, min_args, argc);
+        return make_nil();
+    }
+    if (max_args >= 0 && argc > max_args) {
+        lisp_error("%s: too many arguments (expected at most %d, got %d)",
+                   name, max_args, argc);
+        return make_nil();
+    }
+
+    LispObject *args = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, &args, 1);
+
+    args = make_arg_list(argc, argv);
+    LispObject *result = fn(args);
+
+    gc_pop_frame(&frame);
+    return result;
+}
+
+/* Evaluate a top-level form given as source text */
+LispObject *rt_eval_source(const char *const *pieces) {
+    size_t length = 0;
+    for (int i = 0; pieces[i] != NULL; i++) {
+        length += strlen(pieces[i]);
+    }
+
+    char *source = (char *)malloc(length + 1);
+    if (!source) {
+        lisp_error("Out of memory");
+        return make_nil();
+    }
+    source[0] = '\0';
+    length = 0;
+    for (int i = 0; pieces[i] != NULL; i++) {
+        size_t n = strlen(pieces[i]);
+        memcpy(source + length, pieces[i], n);
+        length += n;
+    }
+    source[length] = '\0';
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+
+    Parser parser;
+    parser_init(&parser, &lexer);
+
+    LispObject *expr = parse_expression(&parser);
+    if (parser_had_error(&parser)) {
+        fprintf(stderr, "Parse error: %s\n", parser_error_message(&parser));
+        free(source);
+        return make_nil();
+    }
+
+    GCFrame frame;
+    gc_push_frame(&frame, &expr, 1);
+    LispObject *result = eval(expr, rt_global_env);
+    gc_pop_frame(&frame);
+
+    free(source);
+    return result;
+}
@@ -0,0 +1,172 @@
+/*
+ * lisp_rt.h - Runtime Support for C Code Generated by the C Backend
+ *
+ * Generated programs include this header and link against lispcore.
+ * It provides program startup, cached global variable access, calls
+ * through procedure objects, a trampoline for tail calls between
+ * compiled functions, and inline fast paths for common primitives.
+ * Every fast path falls back to the real primitive so that results and
+ * error messages match the interpreter; the unboxed helpers at the end
+ * serve functions the backend specialized for numeric arguments.
+ */
+
+#ifndef LISP_RT_H
+#define LISP_RT_H
+
+#include "lisp.h"
+#include "env.h"
+#include "eval.h"
+#include "primitives.h"
+#include <math.h>
+
+/* Maximum number of arguments passed through the tail call trampoline */
+#define RT_MAX_TAIL_ARGS 64
+
+/* Entry point of a compiled function used by the trampoline */
+typedef LispObject *(*RtTailFn)(LispObject **argv);
+
+/* Pending tail call (argv slots are GC roots) */
+typedef struct {
+    RtTailFn fn;
+    LispObject *argv[RT_MAX_TAIL_ARGS];
+} RtTailCall;
+
+extern RtTailCall rt_tail;
+extern LispObject rt_tail_marker;
+
+/* Returned by a compiled function that requests a tail call */
+#define RT_TAIL_MARK (&rt_tail_marker)
+
+/* Global environment of the running program */
+extern Environment *rt_global_env;
+
+/* Program startup and shutdown; only the given primitives (a table
+ * terminated by a NULL name) are bound in the global environment */
+void rt_init(int argc, char **argv, const PrimitiveDef *primitives);
+void rt_shutdown(void);
+
+/* Intern the program's symbols (symbols are permanent) */
+void rt_intern_symbols(const char *const *names, LispObject **symbols, int count);
+
+/* Globals */
+LispObject *rt_global_lookup(Binding **cache, LispObject *symbol);
+void rt_global_define(LispObject *symbol, LispObject *value);
+void rt_global_set(Binding **cache, LispObject *symbol, LispObject *value);
+
+/* Calls */
+LispObject *rt_call(LispObject *func, int argc, LispObject **argv);
+LispObject *rt_call_prim(LispPrimitiveFn fn, const char *name,
+                         int min_args, int max_args, int argc, LispObject **argv);
+
+/* Evaluate a form with the interpreter, given its source text split into
+ * NULL-terminated pieces (used for forms the backend does not compile) */
+LispObject *rt_eval_source(const char *const *pieces);
+
+/* Whether the stack is too deep for another call (see eval's check);
+ * compiled functions then report the error with rt_stack_error and
+ * return without running their body */
+static inline int rt_stack_exhausted(void) {
+    return LISP_STACK_ADDRESS() < lisp_context->stack_limit;
+}
+
+void rt_stack_error(void);
+
+/* Truth test (everything except #f is true) */
+static inline int rt_truthy(LispObject *x) {
+    return x != LISP_FALSE && !(x->type == LISP_BOOLEAN && !x->boolean);
+}
+
+/* Run pending tail calls until a real value is produced */
+static inline LispObject *rt_run(LispObject *result) {
+    while (result == RT_TAIL_MARK) {
+        result = rt_tail.fn(rt_tail.argv);
+    }
+    return result;
+}
+
+/* Fast paths for common primitives */
+
+static inline LispObject *rt_call_prim2(LispPrimitiveFn fn, const char *name,
+                                        LispObject *a, LispObject *b) {
+    LispObject *argv[2];
+    argv[0] = a;
+    argv[1] = b;
+    return rt_call_prim(fn, name, 2, 2, 2, argv);
+}
+
+/* prim_add starts from 0, so the sum of two -0.0 is +0.0 */
+#define RT_NUMERIC_OP(fname, expr, prim, pname)                             \
+    static inline LispObject *fname(LispObject *a, LispObject *b) {         \
+        if (a->type == LISP_NUMBER && b->type == LISP_NUMBER) {             \
+            return make_number(expr);                                       \
+        }                                                                   \
+        return rt_call_prim2(prim, pname, a, b);                            \
+    }
+
+#define RT_COMPARE_OP(fname, op, prim, pname)                               \
+    static inline LispObject *fname(LispObject *a, LispObject *b) {         \
+        if (a->type == LISP_NUMBER && b->type == LISP_NUMBER) {             \
+            return make_boolean(a->number op b->number);                    \
+        }                                                                   \
+        return rt_call_prim2(prim, pname, a, b);                            \
+    }
+
+RT_NUMERIC_OP(rt_add, 0.0 + a->number + b->number, prim_add, "+")
+RT_NUMERIC_OP(rt_sub, a->number - b->number, prim_sub, "-")
+RT_NUMERIC_OP(rt_mul, a->number * b->number, prim_mul, "*")
+RT_COMPARE_OP(rt_num_eq, ==, prim_eq_num, "=")
+RT_COMPARE_OP(rt_lt, <, prim_lt, "<")
+RT_COMPARE_OP(rt_gt, >, prim_gt, ">")
+RT_COMPARE_OP(rt_le, <=, prim_le, "<=")
+RT_COMPARE_OP(rt_ge, >=, prim_ge, ">=")
+
+#undef RT_NUMERIC_OP
+#undef RT_COMPARE_OP
+
+static inline LispObject *rt_car(LispObject *x) {
+    if (x->type == LISP_CONS) return x->cons.car;
+    return rt_call_prim(prim_car, "car", 1, 1, 1, &x);
+}
+
+static inline LispObject *rt_cdr(LispObject *x) {
+    if (x->type == LISP_CONS) return x->cons.cdr;
+    return rt_call_prim(prim_cdr, "cdr", 1, 1, 1, &x);
+}
+
+static inline LispObject *rt_cons(LispObject *a, LispObject *b) {
+    return make_cons(a, b);
+}
+
+static inline LispObject *rt_null_p(LispObject *x) {
+    return make_boolean(is_nil(x));
+}
+
+static inline LispObject *rt_pair_p(LispObject *x) {
+    return make_boolean(x->type == LISP_CONS);
+}
+
+static inline LispObject *rt_not(LispObject *x) {
+    return make_boolean(is_false(x));
+}
+
+static inline LispObject *rt_eq_p(LispObject *a, LispObject *b) {
+    return make_boolean(lisp_eq(a, b));
+}
+
+/* Unboxed values used by code specialized for numbers */
+
+static inline double rt_unbox_num(LispObject *x) {
+    return x->type == LISP_NUMBER ? x->number : 0.0;
+}
+
+static inline double rt_vector_length(LispObject *x) {
+    if (x->type == LISP_VECTOR) return (double)x->vector.length;
+    return rt_call_prim(prim_vector_length, "vector-length", 1, 1, 1, &x)->number;
+}
+
+static inline double rt_string_length(LispObject *x) {
+    if (x->type == LISP_STRING) return (double)x->string.chars;
+    return rt_call_prim(prim_string_length, "string-length", 1, 1, 1, &x)->number;
+}
+
+#endif /* LISP_RT_H */
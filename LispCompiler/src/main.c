@@ -4,8 +4,17 @@
  * Usage:
  *   lisp                    - Start REPL
  *   lisp file.scm           - Execute file (interpreted)
+ *   lisp -                  - Execute forms read from standard input
+ *   lisp a.scm b.scm ...    - Execute files in order
+ *   lisp --fasl a.scm ...   - Execute files, caching their parsed forms
+ *   lisp --save-image img a.scm - Execute files, then save the heap to img
+ *   lisp --image img b.scm  - Execute files starting from a saved heap
+ *   lisp --profile a.scm    - Execute files under the sampling profiler
+ *   lisp --gc-log=log a.scm - Execute files, logging each collection
+ *   lisp --gc-threads=4 a.scm - Execute files, collecting on 4 threads
  *   lisp -c file.scm        - Compile to MASM (outputs file.asm)
  *   lisp -c file.scm -o out - Compile to specified output file
+ *   lisp -c --emit=c file.scm - Compile to portable C (outputs file.c)
  */
 
 #include <stdio.h>
@@ -15,15 +24,35 @@
 #include "lisp.h"
 #include "lexer.h"
 #include "parser.h"
+#include "reader.h"
+#include "fasl.h"
+#include "image.h"
+#include "profile.h"
 #include "env.h"
 #include "eval.h"
 #include "primitives.h"
 #include "codegen.h"
 #include "debug.h"
+#include "srcloc.h"
 
 #define VERSION "1.1.0"
 #define MAX_LINE_LENGTH 4096
 
+/* Collapsed stacks of --profile without a file name */
+#define DEFAULT_PROFILE "profile.folded"
+
+/* Procedures listed in the profile report */
+#define PROFILE_REPORT_TOP 20
+
+/* How execute_files runs the files */
+typedef struct {
+    int use_fasl;               /* Load files through their caches */
+    const char *load_image;     /* Start from this heap image */
+    const char *save_image;     /* Save the heap here at the end */
+    const char *profile;        /* Profile, writing collapsed stacks here */
+    const char *gc_log;         /* Log collections here as JSON lines */
+} RunOptions;
+
 /* Print usage information */
 static void print_usage(const char *program_name) {
     printf("Lisp Compiler/Interpreter v%s\n", VERSION);
@@ -31,14 +60,27 @@ static void print_usage(const char *program_name) {
     printf("Usage:\n");
     printf("  %s                      Start interactive REPL\n", program_name);
     printf("  %s <file.scm>           Execute file (interpreted)\n", program_name);
+    printf("  %s -                    Execute forms from standard input\n", program_name);
+    printf("  %s <a.scm> <b.scm> ...  Execute files in order\n", program_name);
+    printf("  %s --save-image <img> <a.scm> ... Execute files, then save the heap\n", program_name);
+    printf("  %s --image <img> [file.scm] Start from a saved heap\n", program_name);
     printf("  %s -d <file.scm>        Debug file\n", program_name);
     printf("  %s -c <file.scm>        Compile to MASM assembly\n", program_name);
     printf("  %s -c <file.scm> -o out Compile to specified output file\n", program_name);
+    printf("  %s -c --emit=c <file.scm> Compile to portable C\n", program_name);
     printf("\n");
     printf("Options:\n");
     printf("  -c, --compile    Compile to MASM x64 assembly\n");
     printf("  -d, --debug      Run with debugger\n");
     printf("  --debug-json     Run debugger in JSON mode (for IDE)\n");
+    printf("  --emit=masm|c    Output of -c: MASM assembly (default) or C\n");
+    printf("  --fasl           Cache parsed files next to them (file.fasl)\n");
+    printf("  --image FILE     Start from a heap image instead of an empty environment\n");
+    printf("  --save-image FILE Save the heap to an image after executing the files\n");
+    printf("  --profile[=FILE] Profile execution: collapsed stacks to FILE\n");
+    printf("                   (default %s), top procedures to stderr\n", DEFAULT_PROFILE);
+    printf("  --gc-log=FILE    Log each garbage collection to FILE as a JSON line\n");
+    printf("  --gc-threads=N   Mark and sweep large heaps on N threads (default 1)\n");
     printf("  -o, --output     Specify output file\n");
     printf("  -h, --help       Show this help message\n");
     printf("  -v, --version    Show version information\n");
@@ -84,52 +126,122 @@ static char *read_file(const char *path) {
     return buffer;
 }
 
-/* Execute a file */
-static int execute_file(const char *path) {
-    char *source = read_file(path);
-    if (!source) {
+/* Create the global environment, from a heap image if one is given (see
+ * image.h), and register it as a GC root; returns NULL if the image
+ * cannot be loaded */
+static Environment *create_global(const char *image) {
+    Environment *global;
+    if (image) {
+        global = image_load(image);
+        if (!global) return NULL;
+    } else {
+        global = env_create_global();
+        register_primitives(global);
+    }
+    gc_add_env_root(global);
+    return global;
+}
+
+/* Evaluate the forms of a file ("-" for standard input), each as soon
+ * as it has been read */
+static int run_file(const char *path, Environment *global) {
+    Reader reader;
+    if (!reader_open(&reader, path)) {
         fprintf(stderr, "Error: Cannot open file '%s'\n", path);
         return 1;
     }
 
-    /* Initialize Lisp system */
-    lisp_init();
+    /* Keep the form being evaluated alive; earlier forms can be
+     * collected */
+    LispObject *expr = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, &expr, 1);
 
-    /* Create global environment */
-    Environment *global = env_create_global();
-    register_primitives(global);
+    /* Read and execute each expression */
+    int exit_code = 0;
+    int status;
+    while ((status = reader_next(&reader, &expr)) > 0) {
+        LispObject *result = eval(expr, global);
+        (void)result;  /* Ignore result for file execution */
+    }
 
-    /* Register global environment as GC root */
-    gc_add_env_root(global);
+    if (status < 0) {
+        fprintf(stderr, "Parse error: %s\n", reader_error_message(&reader));
+        exit_code = 1;
+    }
 
-    /* Parse */
-    Lexer lexer;
-    lexer_init(&lexer, source);
+    gc_pop_frame(&frame);
+    reader_close(&reader);
+    return exit_code;
+}
 
-    Parser parser;
-    parser_init(&parser, &lexer);
+/* Execute files in order in one global environment, created from a
+ * heap image if given.  With use_fasl, files are loaded through their
+ * caches (see fasl.h), and any that cannot be are read as usual.  With
+ * save_image, the heap is saved there once every file has run. */
+static int execute_files(const char *const *paths, int count, const RunOptions *options) {
+    FILE *gc_log = NULL;
+    if (options->gc_log) {
+        gc_log = fopen(options->gc_log, "w");
+        if (!gc_log) {
+            fprintf(stderr, "Error: Cannot open GC log '%s'\n", options->gc_log);
+            return 1;
+        }
+        gc_set_log(gc_log);
+    }
 
-    LispObject *program = parse_program(&parser);
+    /* Initialize Lisp system */
+    lisp_init();
 
-    if (parser_had_error(&parser)) {
-        fprintf(stderr, "Parse error: %s\n", parser_error_message(&parser));
-        free(source);
+    Environment *global = create_global(options->load_image);
+    if (!global) {
         lisp_shutdown();
+        if (gc_log) fclose(gc_log);
         return 1;
     }
 
-    /* Execute each expression */
+    /* Cached forms live outside the heap and need no roots */
+    LispObject **programs = (LispObject **)calloc((size_t)count, sizeof(LispObject *));
+    if (options->use_fasl && programs) {
+        fasl_load_files(paths, count, programs, 0);
+    }
+
+    if (options->profile && profile_start() != 0) {
+        fprintf(stderr, "Warning: Profiling is not supported on this system\n");
+    }
+
     int exit_code = 0;
-    while (is_cons(program)) {
-        LispObject *result = eval(car(program), global);
-        (void)result;  /* Ignore result for file execution */
-        program = cdr(program);
+    for (int i = 0; i < count && exit_code == 0; i++) {
+        if (!programs || !programs[i]) {
+            exit_code = run_file(paths[i], global);
+            continue;
+        }
+        for (LispObject *form = programs[i]; is_cons(form); form = cdr(form)) {
+            eval(car(form), global);
+        }
     }
 
-    free(source);
+    if (options->profile) {
+        fflush(stdout);
+        profile_stop(options->profile, stderr, PROFILE_REPORT_TOP);
+    }
+
+    if (options->save_image && exit_code == 0 &&
+        image_save(options->save_image, global) != 0) {
+        exit_code = 1;
+    }
+
+    free(programs);
+    lisp_wait_threads();
     gc_remove_env_root(global);
     env_free(global);
     lisp_shutdown();
+    fasl_release();
+
+    if (gc_log) {
+        gc_set_log(NULL);
+        fclose(gc_log);
+    }
 
     return exit_code;
 }
@@ -149,7 +261,8 @@ static int debug_file(const char *path, int json_mode) {
     debug_init();
     debug_enable();
     debug_set_json_mode(json_mode);
-    debug_set_current_location(path, 1, 1);
+    /* No line yet: the first form evaluated sets it */
+    debug_set_current_location(path, 0, 0);
 
     /* Create global environment */
     Environment *global = env_create_global();
@@ -164,6 +277,7 @@ static int debug_file(const char *path, int json_mode) {
 
     Parser parser;
     parser_init(&parser, &lexer);
+    parser_set_file(&parser, srcloc_file(path));
 
     LispObject *program = parse_program(&parser);
 
@@ -181,14 +295,15 @@ static int debug_file(const char *path, int json_mode) {
         printf("Type 'help' for debugger commands.\n\n");
     }
 
-    /* Execute each expression */
+    /* Keep the unevaluated forms alive while earlier ones run */
+    GCFrame frame;
+    gc_push_frame(&frame, &program, 1);
+
+    /* Execute each expression; eval keeps the debugger's location up to
+     * date from the forms' recorded locations */
     int exit_code = 0;
-    int line_num = 1;
 
     while (is_cons(program)) {
-        /* Update source location */
-        debug_set_current_location(path, line_num, 1);
-
         LispObject *result = eval(car(program), global);
         (void)result;
 
@@ -198,7 +313,6 @@ static int debug_file(const char *path, int json_mode) {
         }
 
         program = cdr(program);
-        line_num++;
     }
 
     if (!json_mode) {
@@ -207,7 +321,9 @@ static int debug_file(const char *path, int json_mode) {
         debug_send_json_event("terminated", NULL);
     }
 
+    gc_pop_frame(&frame);
     free(source);
+    lisp_wait_threads();
     gc_remove_env_root(global);
     env_free(global);
     debug_shutdown();
@@ -217,7 +333,7 @@ static int debug_file(const char *path, int json_mode) {
 }
 
 /* REPL (Read-Eval-Print Loop) */
-static void repl(void) {
+static int repl(const char *image) {
     char line[MAX_LINE_LENGTH];
     char input_buffer[MAX_LINE_LENGTH * 10];  /* For multi-line input */
     int paren_depth = 0;
@@ -228,12 +344,11 @@ static void repl(void) {
     /* Initialize Lisp system */
     lisp_init();
 
-    /* Create global environment */
-    Environment *global = env_create_global();
-    register_primitives(global);
-
-    /* Register global environment as GC root */
-    gc_add_env_root(global);
+    Environment *global = create_global(image);
+    if (!global) {
+        lisp_shutdown();
+        return 1;
+    }
 
     input_buffer[0] = '\0';
 
@@ -347,18 +462,29 @@ static void repl(void) {
 
     printf("Goodbye!\n");
 
+    lisp_wait_threads();
     gc_remove_env_root(global);
     env_free(global);
     lisp_shutdown();
+    return 0;
 }
 
 /* Main entry point */
 int main(int argc, char *argv[]) {
     int compile_mode = 0;
+    int emit_c = 0;
     int debug_mode = 0;
     int debug_json_mode = 0;
+    RunOptions options = { 0, NULL, NULL, NULL, NULL };
     const char *input_file = NULL;
     const char *output_file = NULL;
+    const char **input_files = (const char **)malloc((size_t)argc * sizeof(char *));
+    int input_count = 0;
+
+    if (!input_files) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
 
     /* Parse command line arguments */
     for (int i = 1; i < argc; i++) {
@@ -374,6 +500,17 @@ int main(int argc, char *argv[]) {
             compile_mode = 1;
             continue;
         }
+        if (strncmp(argv[i], "--emit=", 7) == 0) {
+            if (strcmp(argv[i] + 7, "c") == 0) {
+                emit_c = 1;
+            } else if (strcmp(argv[i] + 7, "masm") == 0) {
+                emit_c = 0;
+            } else {
+                fprintf(stderr, "Error: Unknown output kind '%s'\n", argv[i] + 7);
+                return 1;
+            }
+            continue;
+        }
         if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
             debug_mode = 1;
             continue;
@@ -383,6 +520,43 @@ int main(int argc, char *argv[]) {
             debug_json_mode = 1;
             continue;
         }
+        if (strcmp(argv[i], "--fasl") == 0) {
+            options.use_fasl = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--profile") == 0) {
+            options.profile = DEFAULT_PROFILE;
+            continue;
+        }
+        if (strncmp(argv[i], "--profile=", 10) == 0) {
+            options.profile = argv[i] + 10;
+            continue;
+        }
+        if (strncmp(argv[i], "--gc-log=", 9) == 0) {
+            options.gc_log = argv[i] + 9;
+            continue;
+        }
+        if (strncmp(argv[i], "--gc-threads=", 13) == 0) {
+            int threads = atoi(argv[i] + 13);
+            if (threads < 1 || threads > GC_MAX_THREADS) {
+                fprintf(stderr, "Error: --gc-threads takes 1 to %d\n", GC_MAX_THREADS);
+                return 1;
+            }
+            gc_set_threads(threads);
+            continue;
+        }
+        if (strcmp(argv[i], "--image") == 0 || strcmp(argv[i], "--save-image") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+                return 1;
+            }
+            if (argv[i][2] == 'i') {
+                options.load_image = argv[++i];
+            } else {
+                options.save_image = argv[++i];
+            }
+            continue;
+        }
         if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) {
             if (i + 1 < argc) {
                 output_file = argv[++i];
@@ -392,18 +566,20 @@ int main(int argc, char *argv[]) {
             }
             continue;
         }
-        if (argv[i][0] == '-') {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
             fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
             return 1;
         }
 
-        /* Input file */
-        if (!input_file) {
-            input_file = argv[i];
-        } else {
-            fprintf(stderr, "Error: Multiple input files specified\n");
-            return 1;
-        }
+        /* Input files */
+        input_files[input_count++] = argv[i];
+    }
+    if (input_count > 0) {
+        input_file = input_files[0];
+    }
+    if (input_count > 1 && (compile_mode || debug_mode)) {
+        fprintf(stderr, "Error: Multiple input files specified\n");
+        return 1;
     }
 
     /* Determine action */
@@ -416,18 +592,31 @@ int main(int argc, char *argv[]) {
         /* Generate output filename if not specified */
         if (!output_file) {
             static char default_output[256];
+            const char *ext = emit_c ? ".c" : ".asm";
             const char *dot = strrchr(input_file, '.');
             if (dot) {
                 size_t base_len = dot - input_file;
                 strncpy(default_output, input_file, base_len);
-                strcpy(default_output + base_len, ".asm");
+                strcpy(default_output + base_len, ext);
             } else {
-                snprintf(default_output, sizeof(default_output), "%s.asm", input_file);
+                snprintf(default_output, sizeof(default_output), "%s%s", input_file, ext);
             }
             output_file = default_output;
         }
 
         printf("Compiling %s -> %s\n", input_file, output_file);
+
+        if (emit_c) {
+            int result = compile_file_c(input_file, output_file);
+            if (result == 0) {
+                printf("Compilation successful.\n");
+                printf("\nTo build (link against the lispcore library):\n");
+                printf("  cc -O2 -I<LispCompiler/src> %s -L<build> -llispcore -lm\n",
+                       output_file);
+            }
+            return result;
+        }
+
         int result = compile_file(input_file, output_file);
 
         if (result == 0) {
@@ -449,12 +638,13 @@ int main(int argc, char *argv[]) {
         return debug_file(input_file, debug_json_mode);
     }
 
-    if (input_file) {
-        /* Execute file */
-        return execute_file(input_file);
+    if (input_count > 0 || options.save_image) {
+        /* Execute files */
+        int result = execute_files(input_files, input_count, &options);
+        free(input_files);
+        return result;
     }
 
     /* Start REPL */
-    repl();
-    return 0;
+    return repl(options.load_image);
 }
@@ -0,0 +1,473 @@
+/*
+ * number.c - Number Conversion
+ *
+ * Printing follows Adams, "Ryu: Fast Float-to-String Conversion": the
+ * interval of decimals that round to the double is computed with
+ * 125-bit powers of five (number_table.h), and digits are removed
+ * while the interval still holds a shorter decimal.  Reading takes
+ * Clinger's exact path when the digits and the power of ten are both
+ * exact doubles, and otherwise multiplies by the same powers of five
+ * (Ryu's s2d), rounding to even from the discarded bits.  Inputs with
+ * more than 17 significant digits go to strtod.
+ */
+
+#include "number.h"
+#include "number_table.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define EXPONENT_BIAS 1023
+
+/* Longest digit string that number_parse converts itself */
+#define PARSE_MAX_DIGITS 17
+
+/* ============================================================
+ * Arithmetic
+ * ============================================================ */
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* floor(log2(5^e)) + 1, for 0 <= e <= 3528 */
+static int pow5_bits(int e) {
+    return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)), for 0 <= e <= 1650 */
+static int log10_pow2(int e) {
+    return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+/* floor(log10(5^e)), for 0 <= e <= 2620 */
+static int log10_pow5(int e) {
+    return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+static int floor_log2(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int log = 0;
+    while (value >>= 1) log++;
+    return log;
+#endif
+}
+
+static int pow5_factor(uint64_t value) {
+    int count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static int multiple_of_pow5(uint64_t value, int p) {
+    return pow5_factor(value) >= p;
+}
+
+static int multiple_of_pow2(uint64_t value, int p) {
+    return (value & ((1ULL << p) - 1)) == 0;
+}
+
+/* (m * mul) >> j, where mul is a 128-bit {low, high} pair and
+ * 64 < j < 128 */
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 uint128;
+
+static uint64_t mul_shift(uint64_t m, const uint64_t *mul, int j) {
+    uint128 low = (uint128)m * mul[0];
+    uint128 high = (uint128)m * mul[1];
+    return (uint64_t)(((low >> 64) + high) >> (j - 64));
+}
+#else
+static uint64_t umul128(uint64_t a, uint64_t b, uint64_t *high) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo, b01 = a_lo * b_hi;
+    uint64_t b10 = a_hi * b_lo, b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+    *high = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t)b00;
+}
+
+static uint64_t mul_shift(uint64_t m, const uint64_t *mul, int j) {
+    uint64_t high0, high1;
+    umul128(m, mul[0], &high0);
+    uint64_t low1 = umul128(m, mul[1], &high1);
+    uint64_t sum = high0 + low1;
+    if (sum < high0) high1++;
+    int shift = j - 64;
+    return (high1 << (64 - shift)) | (sum >> shift);
+}
+#endif
+
+/* ============================================================
+ * Printing
+ * ============================================================ */
+
+/* Shortest decimal digits * 10^exponent that reads back as the finite,
+ * nonzero double with these mantissa and exponent fields */
+static uint64_t shortest_decimal(uint64_t ieee_mantissa, int ieee_exponent, int *exponent) {
+    int e2;
+    uint64_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - EXPONENT_BIAS - MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = ieee_exponent - EXPONENT_BIAS - MANTISSA_BITS - 2;
+        m2 = (1ULL << MANTISSA_BITS) | ieee_mantissa;
+    }
+    int accept_bounds = (m2 & 1) == 0;
+
+    /* The double's interval (mm, mp) around mv, all scaled by 4 */
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    uint64_t vr, vp, vm;
+    int e10;
+    int vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+    if (e2 >= 0) {
+        int q = log10_pow2(e2) - (e2 > 3);
+        e10 = q;
+        int k = POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        int i = -e2 + q + k;
+        vr = mul_shift(4 * m2, POW5_INV_SPLIT[q], i);
+        vp = mul_shift(4 * m2 + 2, POW5_INV_SPLIT[q], i);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, POW5_INV_SPLIT[q], i);
+        if (q <= 21) {
+            /* Only then can mv be a multiple of 5^q */
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        int q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        int i = -e2 - q;
+        int k = pow5_bits(i) - POW5_BITCOUNT;
+        int j = q - k;
+        vr = mul_shift(4 * m2, POW5_SPLIT[i], j);
+        vp = mul_shift(4 * m2 + 2, POW5_SPLIT[i], j);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, POW5_SPLIT[i], j);
+        if (q <= 1) {
+            vr_trailing_zeros = 1;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm_shift == 1;
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Drop digits while the interval still holds a shorter decimal */
+    int removed = 0;
+    int last_removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        /* Rare: an endpoint or the value itself may be exact */
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (int)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (int)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+            last_removed = 4;   /* Exactly halfway: round to even */
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                       last_removed >= 5);
+    } else {
+        int round_up = 0;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    *exponent = e10 + removed;
+    return output;
+}
+
+/* Write the decimal digits of value; returns how many */
+static int write_digits(uint64_t value, char *out) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (int i = 0; i < count; i++) {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+size_t number_format(double value, char *buffer) {
+    char *p = buffer;
+
+    if (isnan(value)) {
+        memcpy(buffer, "+nan.0", 7);
+        return 6;
+    }
+    if (isinf(value)) {
+        memcpy(buffer, value < 0 ? "-inf.0" : "+inf.0", 7);
+        return 6;
+    }
+
+    /* Negative zero keeps its sign and a point, to read back as itself */
+    if (value == 0) {
+        if (signbit(value)) {
+            memcpy(buffer, "-0.0", 5);
+            return 4;
+        }
+        memcpy(buffer, "0", 2);
+        return 1;
+    }
+
+    uint64_t bits = double_bits(value);
+    if (bits >> 63) *p++ = '-';
+
+    /* Integers print all their digits, as integers */
+    double magnitude = fabs(value);
+    if (magnitude < 9223372036854775808.0 && magnitude == floor(magnitude)) {
+        p += write_digits((uint64_t)magnitude, p);
+        *p = '\0';
+        return (size_t)(p - buffer);
+    }
+
+    int exponent;
+    uint64_t mantissa = bits & ((1ULL << MANTISSA_BITS) - 1);
+    int ieee_exponent = (int)((bits >> MANTISSA_BITS) & ((1u << EXPONENT_BITS) - 1));
+    uint64_t decimal = shortest_decimal(mantissa, ieee_exponent, &exponent);
+
+    char digits[20];
+    int count = write_digits(decimal, digits);
+
+    /* The value is 0.DIGITS * 10^point */
+    int point = count + exponent;
+    if (point > 0 && point <= 21) {
+        if (point >= count) {
+            memcpy(p, digits, (size_t)count);
+            memset(p + count, '0', (size_t)(point - count));
+            p += point;
+        } else {
+            memcpy(p, digits, (size_t)point);
+            p += point;
+            *p++ = '.';
+            memcpy(p, digits + point, (size_t)(count - point));
+            p += count - point;
+        }
+    } else if (point <= 0 && point > -6) {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', (size_t)-point);
+        p += -point;
+        memcpy(p, digits, (size_t)count);
+        p += count;
+    } else {
+        *p++ = digits[0];
+        if (count > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, (size_t)(count - 1));
+            p += count - 1;
+        }
+        int e = point - 1;
+        *p++ = 'e';
+        *p++ = e < 0 ? '-' : '+';
+        p += write_digits((uint64_t)(e < 0 ? -e : e), p);
+    }
+    *p = '\0';
+    return (size_t)(p - buffer);
+}
+
+/* ============================================================
+ * Reading
+ * ============================================================ */
+
+/* Exact powers of ten as doubles */
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The double nearest to m10 * 10^e10, for 0 < m10 < 10^17 */
+static double decimal_to_double(uint64_t m10, int e10, int negative) {
+    /* Clinger: both factors are exact, so one rounding */
+    if (m10 <= (1ULL << 53) && e10 >= -22 && e10 <= 22) {
+        double value = (double)m10;
+        value = e10 < 0 ? value / exact_pow10[-e10] : value * exact_pow10[e10];
+        return negative ? -value : value;
+    }
+
+    uint64_t sign = (uint64_t)negative << 63;
+    int m10_digits = 1;
+    for (uint64_t m = m10; m >= 10; m /= 10) m10_digits++;
+    if (m10_digits + e10 <= -324) return bits_double(sign);
+    if (m10_digits + e10 >= 310) return bits_double(sign | (0x7FFULL << MANTISSA_BITS));
+
+    /* m2 * 2^e2 approximates the value, with some bits to spare */
+    int e2;
+    uint64_t m2;
+    int trailing_zeros;
+    if (e10 >= 0) {
+        e2 = floor_log2(m10) + e10 + pow5_bits(e10) - 1 - (MANTISSA_BITS + 1);
+        int j = e2 - e10 - pow5_bits(e10) + POW5_BITCOUNT;
+        m2 = mul_shift(m10, POW5_SPLIT[e10], j);
+        trailing_zeros = e2 < e10 || (e2 - e10 < 64 && multiple_of_pow2(m10, e2 - e10));
+    } else {
+        e2 = floor_log2(m10) + e10 - pow5_bits(-e10) - (MANTISSA_BITS + 1);
+        int j = e2 - e10 + pow5_bits(-e10) - 1 + POW5_INV_BITCOUNT;
+        m2 = mul_shift(m10, POW5_INV_SPLIT[-e10], j);
+        trailing_zeros = multiple_of_pow5(m10, -e10);
+    }
+
+    int ieee_e2 = e2 + EXPONENT_BIAS + floor_log2(m2);
+    if (ieee_e2 < 0) ieee_e2 = 0;
+    if (ieee_e2 > 0x7FE) return bits_double(sign | (0x7FFULL << MANTISSA_BITS));
+
+    /* Round the bits beyond the mantissa to even */
+    int shift = (ieee_e2 == 0 ? 1 : ieee_e2) - e2 - EXPONENT_BIAS - MANTISSA_BITS;
+    trailing_zeros &= (m2 & ((1ULL << (shift - 1)) - 1)) == 0;
+    uint64_t last_removed = (m2 >> (shift - 1)) & 1;
+    int round_up = last_removed && (!trailing_zeros || ((m2 >> shift) & 1));
+    uint64_t ieee_m2 = (m2 >> shift) + (uint64_t)round_up;
+    if (ieee_m2 == (1ULL << (MANTISSA_BITS + 1))) ieee_e2++;
+    ieee_m2 &= (1ULL << MANTISSA_BITS) - 1;
+    return bits_double(sign | ((uint64_t)ieee_e2 << MANTISSA_BITS) | ieee_m2);
+}
+
+/* strtod on a copy: the text is known to be a plain decimal, so strtod
+ * reads all of it */
+static int parse_long(const char *text, size_t length, double *value) {
+    char small[64];
+    char *copy = small;
+    if (length >= sizeof(small)) {
+        copy = (char *)malloc(length + 1);
+        if (!copy) return 0;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    *value = strtod(copy, NULL);
+    if (copy != small) free(copy);
+    return 1;
+}
+
+int number_parse(const char *text, size_t length, double *value) {
+    const char *p = text;
+    const char *end = text + length;
+
+    int negative = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+        if (end - p == 5 && memcmp(p, "inf.0", 5) == 0) {
+            *value = negative ? -HUGE_VAL : HUGE_VAL;
+            return 1;
+        }
+        if (end - p == 5 && memcmp(p, "nan.0", 5) == 0) {
+            *value = NAN;
+            return 1;
+        }
+    }
+
+    /* Significant digits go into mantissa, except that zeros after the
+     * last nonzero digit are only counted */
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int zeros = 0;
+    int fraction_digits = 0;
+    int any_digits = 0;
+    int too_long = 0;
+    int in_fraction = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c == '.' && !in_fraction) {
+            in_fraction = 1;
+            continue;
+        }
+        if (c < '0' || c > '9') break;
+        any_digits = 1;
+        fraction_digits += in_fraction;
+        if (c == '0') {
+            if (digits > 0) zeros++;
+            continue;
+        }
+        if (digits + zeros + 1 > PARSE_MAX_DIGITS) {
+            too_long = 1;
+            continue;
+        }
+        digits += zeros + 1;
+        for (; zeros > 0; zeros--) mantissa *= 10;
+        mantissa = mantissa * 10 + (uint64_t)(c - '0');
+    }
+    if (!any_digits) return 0;
+
+    int exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exponent_negative = 0;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exponent_negative = *p == '-';
+            p++;
+        }
+        if (p == end) return 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (exponent < 100000) exponent = exponent * 10 + (*p - '0');
+        }
+        if (exponent_negative) exponent = -exponent;
+    }
+    if (p != end) return 0;
+
+    if (too_long) return parse_long(text, length, value);
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return 1;
+    }
+    *value = decimal_to_double(mantissa, exponent + zeros - fraction_digits, negative);
+    return 1;
+}
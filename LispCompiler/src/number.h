@@ -0,0 +1,34 @@
+/*
+ * number.h - Number Conversion
+ *
+ * Conversions between doubles and their decimal text, shared by the
+ * printer, number->string, string->number and the lexer.  Printing
+ * gives an integer's exact digits and any other number the shortest
+ * digits that read back as the same double (Ryu); reading rounds
+ * correctly, so anything written reads back equal.
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stddef.h>
+
+/* Enough for any double as number_format writes it, with the '\0' */
+#define NUMBER_BUFFER_SIZE 32
+
+/* Write text that reads back as value.  Integers below 2^63 print
+ * exactly, every digit of their value and no decimal point ("42",
+ * "3347755035530381312"), not the shortest digits that would round to
+ * them.  Other numbers print the shortest such digits, in fixed
+ * notation ("0.1", "123.5") or, when very large or small, with an
+ * exponent ("1e+300", "2.5e-7"), and +inf.0, -inf.0 and +nan.0.
+ * Negative zero prints as -0.0.  Returns the length. */
+size_t number_format(double value, char *buffer);
+
+/* Read a number from the length bytes at text: an optional sign,
+ * digits with an optional decimal point, and an optional exponent, or
+ * one of +inf.0, -inf.0 and +nan.0.  Returns 1 and sets *value if all
+ * of the text is a number, and 0 if it is not. */
+int number_parse(const char *text, size_t length, double *value);
+
+#endif /* NUMBER_H */
@@ -0,0 +1,674 @@
+/*
+ * numvec.c - Homogeneous Numeric Vectors
+ *
+ * The kernels run over whole 32- or 16-byte blocks with AVX2 or SSE2
+ * (chosen as in text.c) and finish with a scalar loop, which does all
+ * the work for the kinds and operations with no vector form.  Integer
+ * arithmetic is done in the unsigned type of the same width, so that it
+ * wraps around instead of overflowing.
+ */
+
+#include "numvec.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define NUMVEC_X86 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NUMVEC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef NUMVEC_X86
+static int have_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+size_t numvec_element_size(NumvecKind kind) {
+    switch (kind) {
+        case NUMVEC_U8:  return 1;
+        case NUMVEC_S32: return 4;
+        case NUMVEC_S64: return 8;
+        case NUMVEC_F32: return 4;
+        case NUMVEC_F64: return 8;
+    }
+    return 1;
+}
+
+const char *numvec_tag(NumvecKind kind) {
+    switch (kind) {
+        case NUMVEC_U8:  return "u8";
+        case NUMVEC_S32: return "s32";
+        case NUMVEC_S64: return "s64";
+        case NUMVEC_F32: return "f32";
+        case NUMVEC_F64: return "f64";
+    }
+    return "u8";
+}
+
+/* ============================================================
+ * Vectors
+ * ============================================================ */
+
+LispObject *make_numvector(NumvecKind kind, size_t length) {
+    if (kind == NUMVEC_U8) return make_bytevector(length, 0);
+
+    size_t size = numvec_element_size(kind);
+    if (length > SIZE_MAX / size) {
+        lisp_error("make-%svector: length %zu is too large", numvec_tag(kind), length);
+        return LISP_NIL_OBJ;
+    }
+    LispObject *obj = lisp_alloc();
+    obj->type = LISP_NUMVECTOR;
+    obj->numvector.kind = (int)kind;
+    obj->numvector.length = length;
+    obj->numvector.data = calloc(length ? length : 1, size);
+    if (!obj->numvector.data) {
+        obj->numvector.length = 0;
+        lisp_error("Out of memory allocating %svector", numvec_tag(kind));
+        return LISP_NIL_OBJ;
+    }
+    return obj;
+}
+
+int is_numvector(LispObject *obj) {
+    return obj && obj->type == LISP_NUMVECTOR;
+}
+
+int numvec_view(LispObject *obj, void **data, size_t *length, NumvecKind *kind) {
+    if (is_numvector(obj)) {
+        *data = obj->numvector.data;
+        *length = obj->numvector.length;
+        *kind = (NumvecKind)obj->numvector.kind;
+        return 1;
+    }
+    if (is_bytevector(obj)) {
+        *data = obj->bytevector.bytes;
+        *length = obj->bytevector.length;
+        *kind = NUMVEC_U8;
+        return 1;
+    }
+    return 0;
+}
+
+double numvec_get(const void *data, NumvecKind kind, size_t i) {
+    switch (kind) {
+        case NUMVEC_U8:  return ((const uint8_t *)data)[i];
+        case NUMVEC_S32: return ((const int32_t *)data)[i];
+        case NUMVEC_S64: return (double)((const int64_t *)data)[i];
+        case NUMVEC_F32: return ((const float *)data)[i];
+        case NUMVEC_F64: return ((const double *)data)[i];
+    }
+    return 0;
+}
+
+int numvec_fits(NumvecKind kind, double value) {
+    switch (kind) {
+        case NUMVEC_U8:
+            return value == floor(value) && value >= 0 && value <= 255;
+        case NUMVEC_S32:
+            return value == floor(value) && value >= -2147483648.0 && value <= 2147483647.0;
+        case NUMVEC_S64:
+            /* 2^63 itself is a double; the largest int64_t is not */
+            return value == floor(value) && value >= -9223372036854775808.0 &&
+                   value < 9223372036854775808.0;
+        case NUMVEC_F32:
+        case NUMVEC_F64:
+            return 1;
+    }
+    return 0;
+}
+
+void numvec_set(void *data, NumvecKind kind, size_t i, double value) {
+    switch (kind) {
+        case NUMVEC_U8:  ((uint8_t *)data)[i] = (uint8_t)value; break;
+        case NUMVEC_S32: ((int32_t *)data)[i] = (int32_t)value; break;
+        case NUMVEC_S64: ((int64_t *)data)[i] = (int64_t)value; break;
+        case NUMVEC_F32: ((float *)data)[i] = (float)value; break;
+        case NUMVEC_F64: ((double *)data)[i] = value; break;
+    }
+}
+
+/* ============================================================
+ * Vector Blocks
+ * ============================================================ */
+
+/* Each *_blocks function does the whole blocks of its operation and
+ * returns how many elements that covered (0 for the kinds it leaves to
+ * the scalar loop); reductions leave their partial result in *result,
+ * or for sums of integers in *total (modulo 2^64). */
+
+#ifdef NUMVEC_X86
+/* x and y: the next 32 bytes of a and b */
+#define BLOCKS_AVX2(STEP)                                                   \
+    for (; i + 32 <= bytes; i += 32) {                                      \
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));           \
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));           \
+        (void)y;                                                            \
+        STEP;                                                               \
+    }
+
+#define AS_PD(v) _mm256_castsi256_pd(v)
+#define AS_PS(v) _mm256_castsi256_ps(v)
+
+TARGET_AVX2
+static size_t add_avx2(char *d, const char *a, const char *b, size_t bytes,
+                       NumvecKind kind) {
+    size_t i = 0;
+#define STORE(v) _mm256_storeu_si256((__m256i *)(d + i), v)
+    switch (kind) {
+        case NUMVEC_U8:  BLOCKS_AVX2(STORE(_mm256_add_epi8(x, y))); break;
+        case NUMVEC_S32: BLOCKS_AVX2(STORE(_mm256_add_epi32(x, y))); break;
+        case NUMVEC_S64: BLOCKS_AVX2(STORE(_mm256_add_epi64(x, y))); break;
+        case NUMVEC_F32:
+            BLOCKS_AVX2(STORE(_mm256_castps_si256(_mm256_add_ps(AS_PS(x), AS_PS(y)))));
+            break;
+        case NUMVEC_F64:
+            BLOCKS_AVX2(STORE(_mm256_castpd_si256(_mm256_add_pd(AS_PD(x), AS_PD(y)))));
+            break;
+    }
+#undef STORE
+    return i / numvec_element_size(kind);
+}
+
+TARGET_AVX2
+static size_t scale_avx2(char *d, const char *a, double factor, size_t bytes,
+                         NumvecKind kind) {
+    const char *b = a;
+    size_t i = 0;
+#define STORE(v) _mm256_storeu_si256((__m256i *)(d + i), v)
+    if (kind == NUMVEC_S32) {
+        const __m256i k = _mm256_set1_epi32((int32_t)(uint32_t)(int64_t)factor);
+        BLOCKS_AVX2(STORE(_mm256_mullo_epi32(x, k)));
+    } else if (kind == NUMVEC_F32) {
+        const __m256 k = _mm256_set1_ps((float)factor);
+        BLOCKS_AVX2(STORE(_mm256_castps_si256(_mm256_mul_ps(AS_PS(x), k))));
+    } else if (kind == NUMVEC_F64) {
+        const __m256d k = _mm256_set1_pd(factor);
+        BLOCKS_AVX2(STORE(_mm256_castpd_si256(_mm256_mul_pd(AS_PD(x), k))));
+    }
+#undef STORE
+    return i / numvec_element_size(kind);
+}
+
+/* The sum of the lanes of v */
+TARGET_AVX2
+static double sum_lanes_avx2(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+TARGET_AVX2
+static size_t dot_avx2(const char *a, const char *b, size_t bytes, NumvecKind kind,
+                       double *result) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    if (kind == NUMVEC_F64) {
+        /* Alternating between the accumulators, two blocks are in
+         * flight at once */
+        BLOCKS_AVX2(__m256d t = _mm256_add_pd(acc1, _mm256_mul_pd(AS_PD(x), AS_PD(y)));
+                    acc1 = acc0; acc0 = t);
+    } else if (kind == NUMVEC_F32) {
+        /* Each block of 8 floats as two of 4 doubles */
+        BLOCKS_AVX2(
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(
+                _mm256_cvtps_pd(_mm256_castps256_ps128(AS_PS(x))),
+                _mm256_cvtps_pd(_mm256_castps256_ps128(AS_PS(y)))));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(
+                _mm256_cvtps_pd(_mm256_extractf128_ps(AS_PS(x), 1)),
+                _mm256_cvtps_pd(_mm256_extractf128_ps(AS_PS(y), 1)))));
+    } else {
+        return 0;
+    }
+    *result = sum_lanes_avx2(_mm256_add_pd(acc0, acc1));
+    return i / numvec_element_size(kind);
+}
+
+TARGET_AVX2
+static size_t sum_avx2(const char *a, size_t bytes, NumvecKind kind, double *result,
+                       uint64_t *total) {
+    const char *b = a;
+    size_t i = 0;
+    if (kind == NUMVEC_F64 || kind == NUMVEC_F32) {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        if (kind == NUMVEC_F64) {
+            BLOCKS_AVX2(__m256d t = _mm256_add_pd(acc1, AS_PD(x)); acc1 = acc0; acc0 = t);
+        } else {
+            BLOCKS_AVX2(
+                acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(AS_PS(x))));
+                acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(AS_PS(x), 1))));
+        }
+        *result = sum_lanes_avx2(_mm256_add_pd(acc0, acc1));
+        return i / numvec_element_size(kind);
+    }
+
+    /* Integers in 64-bit lanes, which wrap as the scalar sum does */
+    __m256i acc = _mm256_setzero_si256();
+    switch (kind) {
+        case NUMVEC_U8:
+            BLOCKS_AVX2(acc = _mm256_add_epi64(acc, _mm256_sad_epu8(x, _mm256_setzero_si256())));
+            break;
+        case NUMVEC_S32:
+            BLOCKS_AVX2(
+                acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+                acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1))));
+            break;
+        case NUMVEC_S64:
+            BLOCKS_AVX2(acc = _mm256_add_epi64(acc, x));
+            break;
+        default:
+            break;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    *total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i / numvec_element_size(kind);
+}
+
+/* Least (greatest if max) element of the whole blocks */
+TARGET_AVX2
+static size_t extreme_avx2(const char *a, size_t bytes, NumvecKind kind, int max,
+                           double *result) {
+    const char *b = a;
+    size_t i = 0;
+    if (bytes < 32) return 0;
+    __m256i m = _mm256_loadu_si256((const __m256i *)a);
+#define FOLD(MIN, MAX) BLOCKS_AVX2(m = max ? MAX : MIN)
+    switch (kind) {
+        case NUMVEC_U8:  FOLD(_mm256_min_epu8(m, x), _mm256_max_epu8(m, x)); break;
+        case NUMVEC_S32: FOLD(_mm256_min_epi32(m, x), _mm256_max_epi32(m, x)); break;
+        case NUMVEC_F32:
+            FOLD(_mm256_castps_si256(_mm256_min_ps(AS_PS(m), AS_PS(x))),
+                 _mm256_castps_si256(_mm256_max_ps(AS_PS(m), AS_PS(x))));
+            break;
+        case NUMVEC_F64:
+            FOLD(_mm256_castpd_si256(_mm256_min_pd(AS_PD(m), AS_PD(x))),
+                 _mm256_castpd_si256(_mm256_max_pd(AS_PD(m), AS_PD(x))));
+            break;
+        default:
+            return 0;
+    }
+#undef FOLD
+    char lanes[32];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+    size_t count = 32 / numvec_element_size(kind);
+    double best = numvec_get(lanes, kind, 0);
+    for (size_t k = 1; k < count; k++) {
+        double v = numvec_get(lanes, kind, k);
+        if (max ? v > best : v < best) best = v;
+    }
+    *result = best;
+    return i / numvec_element_size(kind);
+}
+
+#undef AS_PD
+#undef AS_PS
+#endif /* NUMVEC_X86 */
+
+#ifdef NUMVEC_SSE2
+/* x and y: the next 16 bytes of a and b */
+#define BLOCKS_SSE2(STEP)                                                   \
+    for (; i + 16 <= bytes; i += 16) {                                      \
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));              \
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));              \
+        (void)y;                                                            \
+        STEP;                                                               \
+    }
+
+#define AS_PD(v) _mm_castsi128_pd(v)
+#define AS_PS(v) _mm_castsi128_ps(v)
+
+static size_t add_sse2(char *d, const char *a, const char *b, size_t bytes,
+                       NumvecKind kind) {
+    size_t i = 0;
+#define STORE(v) _mm_storeu_si128((__m128i *)(d + i), v)
+    switch (kind) {
+        case NUMVEC_U8:  BLOCKS_SSE2(STORE(_mm_add_epi8(x, y))); break;
+        case NUMVEC_S32: BLOCKS_SSE2(STORE(_mm_add_epi32(x, y))); break;
+        case NUMVEC_S64: BLOCKS_SSE2(STORE(_mm_add_epi64(x, y))); break;
+        case NUMVEC_F32:
+            BLOCKS_SSE2(STORE(_mm_castps_si128(_mm_add_ps(AS_PS(x), AS_PS(y)))));
+            break;
+        case NUMVEC_F64:
+            BLOCKS_SSE2(STORE(_mm_castpd_si128(_mm_add_pd(AS_PD(x), AS_PD(y)))));
+            break;
+    }
+#undef STORE
+    return i / numvec_element_size(kind);
+}
+
+static size_t scale_sse2(char *d, const char *a, double factor, size_t bytes,
+                         NumvecKind kind) {
+    const char *b = a;
+    size_t i = 0;
+#define STORE(v) _mm_storeu_si128((__m128i *)(d + i), v)
+    if (kind == NUMVEC_F32) {
+        const __m128 k = _mm_set1_ps((float)factor);
+        BLOCKS_SSE2(STORE(_mm_castps_si128(_mm_mul_ps(AS_PS(x), k))));
+    } else if (kind == NUMVEC_F64) {
+        const __m128d k = _mm_set1_pd(factor);
+        BLOCKS_SSE2(STORE(_mm_castpd_si128(_mm_mul_pd(AS_PD(x), k))));
+    }
+#undef STORE
+    return i / numvec_element_size(kind);
+}
+
+static double sum_lanes_sse2(__m128d v) {
+    double lanes[2];
+    _mm_storeu_pd(lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+static size_t dot_sse2(const char *a, const char *b, size_t bytes, NumvecKind kind,
+                       double *result) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    if (kind == NUMVEC_F64) {
+        BLOCKS_SSE2(__m128d t = _mm_add_pd(acc1, _mm_mul_pd(AS_PD(x), AS_PD(y)));
+                    acc1 = acc0; acc0 = t);
+    } else if (kind == NUMVEC_F32) {
+        BLOCKS_SSE2(
+            acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_cvtps_pd(AS_PS(x)), _mm_cvtps_pd(AS_PS(y))));
+            acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_cvtps_pd(AS_PS(_mm_srli_si128(x, 8))),
+                                               _mm_cvtps_pd(AS_PS(_mm_srli_si128(y, 8))))));
+    } else {
+        return 0;
+    }
+    *result = sum_lanes_sse2(_mm_add_pd(acc0, acc1));
+    return i / numvec_element_size(kind);
+}
+
+static size_t sum_sse2(const char *a, size_t bytes, NumvecKind kind, double *result,
+                       uint64_t *total) {
+    const char *b = a;
+    size_t i = 0;
+    if (kind == NUMVEC_F64 || kind == NUMVEC_F32) {
+        __m128d acc0 = _mm_setzero_pd();
+        __m128d acc1 = _mm_setzero_pd();
+        if (kind == NUMVEC_F64) {
+            BLOCKS_SSE2(__m128d t = _mm_add_pd(acc1, AS_PD(x)); acc1 = acc0; acc0 = t);
+        } else {
+            BLOCKS_SSE2(
+                acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(AS_PS(x)));
+                acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(AS_PS(_mm_srli_si128(x, 8)))));
+        }
+        *result = sum_lanes_sse2(_mm_add_pd(acc0, acc1));
+        return i / numvec_element_size(kind);
+    }
+
+    __m128i acc = _mm_setzero_si128();
+    if (kind == NUMVEC_U8) {
+        BLOCKS_SSE2(acc = _mm_add_epi64(acc, _mm_sad_epu8(x, _mm_setzero_si128())));
+    } else if (kind == NUMVEC_S64) {
+        BLOCKS_SSE2(acc = _mm_add_epi64(acc, x));
+    } else {
+        return 0;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    *total = lanes[0] + lanes[1];
+    return i / numvec_element_size(kind);
+}
+
+static size_t extreme_sse2(const char *a, size_t bytes, NumvecKind kind, int max,
+                           double *result) {
+    const char *b = a;
+    size_t i = 0;
+    if (bytes < 16) return 0;
+    __m128i m = _mm_loadu_si128((const __m128i *)a);
+#define FOLD(MIN, MAX) BLOCKS_SSE2(m = max ? MAX : MIN)
+    switch (kind) {
+        case NUMVEC_U8:  FOLD(_mm_min_epu8(m, x), _mm_max_epu8(m, x)); break;
+        case NUMVEC_F32:
+            FOLD(_mm_castps_si128(_mm_min_ps(AS_PS(m), AS_PS(x))),
+                 _mm_castps_si128(_mm_max_ps(AS_PS(m), AS_PS(x))));
+            break;
+        case NUMVEC_F64:
+            FOLD(_mm_castpd_si128(_mm_min_pd(AS_PD(m), AS_PD(x))),
+                 _mm_castpd_si128(_mm_max_pd(AS_PD(m), AS_PD(x))));
+            break;
+        default:
+            return 0;
+    }
+#undef FOLD
+    char lanes[16];
+    _mm_storeu_si128((__m128i *)lanes, m);
+    size_t count = 16 / numvec_element_size(kind);
+    double best = numvec_get(lanes, kind, 0);
+    for (size_t k = 1; k < count; k++) {
+        double v = numvec_get(lanes, kind, k);
+        if (max ? v > best : v < best) best = v;
+    }
+    *result = best;
+    return i / numvec_element_size(kind);
+}
+
+#undef AS_PD
+#undef AS_PS
+#endif /* NUMVEC_SSE2 */
+
+/* The widest blocks the processor runs, for each kernel */
+
+static size_t add_blocks(void *dst, const void *a, const void *b, size_t length,
+                         NumvecKind kind) {
+    size_t bytes = length * numvec_element_size(kind);
+#ifdef NUMVEC_X86
+    if (have_avx2()) return add_avx2((char *)dst, (const char *)a, (const char *)b, bytes, kind);
+#endif
+#ifdef NUMVEC_SSE2
+    return add_sse2((char *)dst, (const char *)a, (const char *)b, bytes, kind);
+#else
+    (void)dst; (void)a; (void)b; (void)bytes;
+    return 0;
+#endif
+}
+
+static size_t scale_blocks(void *dst, const void *a, double factor, size_t length,
+                           NumvecKind kind) {
+    size_t bytes = length * numvec_element_size(kind);
+#ifdef NUMVEC_X86
+    if (have_avx2()) return scale_avx2((char *)dst, (const char *)a, factor, bytes, kind);
+#endif
+#ifdef NUMVEC_SSE2
+    return scale_sse2((char *)dst, (const char *)a, factor, bytes, kind);
+#else
+    (void)dst; (void)a; (void)factor; (void)bytes;
+    return 0;
+#endif
+}
+
+static size_t dot_blocks(const void *a, const void *b, size_t length, NumvecKind kind,
+                         double *result) {
+    size_t bytes = length * numvec_element_size(kind);
+#ifdef NUMVEC_X86
+    if (have_avx2()) return dot_avx2((const char *)a, (const char *)b, bytes, kind, result);
+#endif
+#ifdef NUMVEC_SSE2
+    return dot_sse2((const char *)a, (const char *)b, bytes, kind, result);
+#else
+    (void)a; (void)b; (void)bytes; (void)result;
+    return 0;
+#endif
+}
+
+static size_t sum_blocks(const void *a, size_t length, NumvecKind kind, double *result,
+                         uint64_t *total) {
+    size_t bytes = length * numvec_element_size(kind);
+#ifdef NUMVEC_X86
+    if (have_avx2()) return sum_avx2((const char *)a, bytes, kind, result, total);
+#endif
+#ifdef NUMVEC_SSE2
+    return sum_sse2((const char *)a, bytes, kind, result, total);
+#else
+    (void)a; (void)bytes; (void)result; (void)total;
+    return 0;
+#endif
+}
+
+static size_t extreme_blocks(const void *a, size_t length, NumvecKind kind, int max,
+                             double *result) {
+    size_t bytes = length * numvec_element_size(kind);
+#ifdef NUMVEC_X86
+    if (have_avx2()) return extreme_avx2((const char *)a, bytes, kind, max, result);
+#endif
+#ifdef NUMVEC_SSE2
+    return extreme_sse2((const char *)a, bytes, kind, max, result);
+#else
+    (void)a; (void)bytes; (void)max; (void)result;
+    return 0;
+#endif
+}
+
+/* ============================================================
+ * Kernels
+ * ============================================================ */
+
+/* STEP(T) once with T the storage type of kind, arithmetic done
+ * unsigned for the integers */
+#define FOR_KIND(kind, STEP)                                                \
+    switch (kind) {                                                         \
+        case NUMVEC_U8:  { STEP(uint8_t);  break; }                         \
+        case NUMVEC_S32: { STEP(uint32_t); break; }                         \
+        case NUMVEC_S64: { STEP(uint64_t); break; }                         \
+        case NUMVEC_F32: { STEP(float);    break; }                         \
+        case NUMVEC_F64: { STEP(double);   break; }                         \
+    }
+
+/* The integer elements as int64_t, for integer arithmetic */
+static int64_t integer_at(const void *a, NumvecKind kind, size_t i) {
+    switch (kind) {
+        case NUMVEC_U8:  return ((const uint8_t *)a)[i];
+        case NUMVEC_S32: return ((const int32_t *)a)[i];
+        default:         return ((const int64_t *)a)[i];
+    }
+}
+
+void numvec_add(void *dst, const void *a, const void *b, size_t length, NumvecKind kind) {
+    size_t i = add_blocks(dst, a, b, length, kind);
+#define ADD(T)                                                              \
+    for (; i < length; i++) {                                               \
+        ((T *)dst)[i] = (T)(((const T *)a)[i] + ((const T *)b)[i]);         \
+    }
+    FOR_KIND(kind, ADD)
+#undef ADD
+}
+
+void numvec_scale(void *dst, const void *a, double factor, size_t length,
+                  NumvecKind kind) {
+    size_t i = scale_blocks(dst, a, factor, length, kind);
+    switch (kind) {
+        case NUMVEC_F32:
+            for (; i < length; i++) {
+                ((float *)dst)[i] = ((const float *)a)[i] * (float)factor;
+            }
+            break;
+        case NUMVEC_F64:
+            for (; i < length; i++) {
+                ((double *)dst)[i] = ((const double *)a)[i] * factor;
+            }
+            break;
+        default: {
+            /* Products modulo 2^64, cut to the element's width */
+            uint64_t k = (uint64_t)(int64_t)factor;
+            for (; i < length; i++) {
+                uint64_t product = (uint64_t)integer_at(a, kind, i) * k;
+                switch (kind) {
+                    case NUMVEC_U8:  ((uint8_t *)dst)[i] = (uint8_t)product; break;
+                    case NUMVEC_S32: ((uint32_t *)dst)[i] = (uint32_t)product; break;
+                    default:         ((uint64_t *)dst)[i] = product; break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+static int is_float_kind(NumvecKind kind) {
+    return kind == NUMVEC_F32 || kind == NUMVEC_F64;
+}
+
+double numvec_dot(const void *a, const void *b, size_t length, NumvecKind kind) {
+    double sum = 0;
+    size_t i = dot_blocks(a, b, length, kind, &sum);
+    if (is_float_kind(kind)) {
+        for (; i < length; i++) {
+            sum += numvec_get(a, kind, i) * numvec_get(b, kind, i);
+        }
+        return sum;
+    }
+    uint64_t total = 0;
+    for (; i < length; i++) {
+        total += (uint64_t)integer_at(a, kind, i) * (uint64_t)integer_at(b, kind, i);
+    }
+    return (double)(int64_t)total;
+}
+
+double numvec_sum(const void *a, size_t length, NumvecKind kind) {
+    double sum = 0;
+    uint64_t total = 0;
+    size_t i = sum_blocks(a, length, kind, &sum, &total);
+    if (is_float_kind(kind)) {
+        for (; i < length; i++) {
+            sum += numvec_get(a, kind, i);
+        }
+        return sum;
+    }
+    for (; i < length; i++) {
+        total += (uint64_t)integer_at(a, kind, i);
+    }
+    return (double)(int64_t)total;
+}
+
+static double extreme(const void *a, size_t length, NumvecKind kind, int max) {
+    double best = numvec_get(a, kind, 0);
+    size_t i = extreme_blocks(a, length, kind, max, &best);
+    if (kind == NUMVEC_S64) {
+        /* Compared as integers, which doubles cannot all hold */
+        int64_t best64 = ((const int64_t *)a)[0];
+        for (i = 1; i < length; i++) {
+            int64_t v = ((const int64_t *)a)[i];
+            if (max ? v > best64 : v < best64) best64 = v;
+        }
+        return (double)best64;
+    }
+    for (; i < length; i++) {
+        double v = numvec_get(a, kind, i);
+        if (max ? v > best : v < best) best = v;
+    }
+    return best;
+}
+
+double numvec_min(const void *a, size_t length, NumvecKind kind) {
+    return extreme(a, length, kind, 0);
+}
+
+double numvec_max(const void *a, size_t length, NumvecKind kind) {
+    return extreme(a, length, kind, 1);
+}
+
+void numvec_fill(void *data, size_t length, NumvecKind kind, double value) {
+    if (length == 0) return;
+    if (kind == NUMVEC_U8) {
+        memset(data, (int)value, length);
+        return;
+    }
+    /* One element, then copies of what is filled so far */
+    size_t size = numvec_element_size(kind);
+    size_t total = length * size;
+    numvec_set(data, kind, 0, value);
+    for (size_t done = size; done < total; ) {
+        size_t n = done < total - done ? done : total - done;
+        memcpy((char *)data + done, data, n);
+        done += n;
+    }
+}
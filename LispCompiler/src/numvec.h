@@ -0,0 +1,78 @@
+/*
+ * numvec.h - Homogeneous Numeric Vectors
+ *
+ * SRFI-4 vectors hold numbers of one kind unboxed, in a plain C array
+ * that the collector never traces: a million doubles are one object and
+ * 8 MB, not a million boxed numbers.  s32, s64, f32 and f64 vectors are
+ * objects of their own (LISP_NUMVECTOR); u8 vectors are bytevectors.
+ *
+ * The bulk kernels (add, scale, dot, sum, min, max, fill) work on any
+ * kind, 32 bytes at a time with AVX2 when the processor has it and 16
+ * with SSE2 otherwise on x86, and an element at a time elsewhere.
+ * Integer elements wrap around on overflow, as in C.  Sums and dot
+ * products add in a different order than a loop from the first element
+ * would, so floating-point results may differ from one in the last
+ * bits.
+ */
+
+#ifndef NUMVEC_H
+#define NUMVEC_H
+
+#include "lisp.h"
+
+typedef enum {
+    NUMVEC_U8,
+    NUMVEC_S32,
+    NUMVEC_S64,
+    NUMVEC_F32,
+    NUMVEC_F64
+} NumvecKind;
+
+#define NUMVEC_KIND_COUNT (NUMVEC_F64 + 1)
+
+/* Bytes in an element of kind, and the SRFI-4 tag of kind ("f64") */
+size_t numvec_element_size(NumvecKind kind);
+const char *numvec_tag(NumvecKind kind);
+
+/* A vector of length elements of kind (a bytevector for NUMVEC_U8),
+ * all zero */
+LispObject *make_numvector(NumvecKind kind, size_t length);
+int is_numvector(LispObject *obj);
+
+/* The elements, count and kind of a numeric vector or bytevector; 0 if
+ * obj is neither */
+int numvec_view(LispObject *obj, void **data, size_t *length, NumvecKind *kind);
+
+/* Element i of data as a number */
+double numvec_get(const void *data, NumvecKind kind, size_t i);
+
+/* Whether value fits an element of kind: any number for the float
+ * kinds, an integer in range for the others */
+int numvec_fits(NumvecKind kind, double value);
+
+/* Store value, which fits, as element i */
+void numvec_set(void *data, NumvecKind kind, size_t i, double value);
+
+/* ============================================================
+ * Bulk Kernels
+ * ============================================================ */
+
+/* dst[i] = a[i] + b[i]; dst may be a or b */
+void numvec_add(void *dst, const void *a, const void *b, size_t length, NumvecKind kind);
+
+/* dst[i] = a[i] * factor; dst may be a.  factor fits the kind. */
+void numvec_scale(void *dst, const void *a, double factor, size_t length,
+                  NumvecKind kind);
+
+/* Sum of a[i] * b[i], and of a[i] */
+double numvec_dot(const void *a, const void *b, size_t length, NumvecKind kind);
+double numvec_sum(const void *a, size_t length, NumvecKind kind);
+
+/* Least and greatest element of length >= 1 */
+double numvec_min(const void *a, size_t length, NumvecKind kind);
+double numvec_max(const void *a, size_t length, NumvecKind kind);
+
+/* Every element value, which fits */
+void numvec_fill(void *data, size_t length, NumvecKind kind, double value);
+
+#endif /* NUMVEC_H */
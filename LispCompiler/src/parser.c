@@ -7,6 +7,7 @@
  */
 
 #include "parser.h"
+#include "srcloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,10 +25,12 @@ static void advance(Parser *parser) {
         if (parser->current.type != TOK_ERROR) break;
 
         /* Report lexer error */
+        int line;
+        lexer_location(parser->lexer, &parser->current, &line, NULL);
         parser->had_error = 1;
         snprintf(error_message, sizeof(error_message),
-                 "Lexer error at line %d: %s",
-                 parser->current.line, parser->current.text);
+                 "Lexer error at line %d: %.*s",
+                 line, (int)parser->current.length, parser->current.text);
         token_free(&parser->current);
     }
 }
@@ -50,10 +53,12 @@ static void error_at(Parser *parser, Token *token, const char *message) {
     parser->panic_mode = 1;
     parser->had_error = 1;
 
+    int line, column;
+    lexer_location(parser->lexer, token, &line, &column);
     snprintf(error_message, sizeof(error_message),
-             "Error at line %d, column %d: %s (got '%s')",
-             token->line, token->column, message,
-             token->text ? token->text : "?");
+             "Error at line %d, column %d: %s (got '%.*s')",
+             line, column, message,
+             token->text ? (int)token->length : 1, token->text ? token->text : "?");
 }
 
 static void error_current(Parser *parser, const char *message) {
@@ -76,7 +81,7 @@ static LispObject *parse_datum(Parser *parser);
 static LispObject *parse_atom(Parser *parser) {
     switch (parser->current.type) {
         case TOK_SYMBOL: {
-            LispObject *obj = make_symbol(parser->current.text);
+            LispObject *obj = make_symbol_n(parser->current.text, parser->current.length);
             advance(parser);
             return obj;
         }
@@ -88,7 +93,15 @@ static LispObject *parse_atom(Parser *parser) {
         }
 
         case TOK_STRING: {
-            LispObject *obj = make_string(parser->current.text);
+            LispObject *obj;
+            if (parser->current.value.escapes) {
+                char *text = (char *)malloc(parser->current.length + 1);
+                if (!text) return NULL;
+                obj = make_string_n(text, lexer_unescape(&parser->current, text));
+                free(text);
+            } else {
+                obj = make_string_n(parser->current.text, parser->current.length);
+            }
             advance(parser);
             return obj;
         }
@@ -112,6 +125,13 @@ static LispObject *parse_atom(Parser *parser) {
 
 /* Parse a list */
 static LispObject *parse_list(Parser *parser) {
+    /* Locate the '(' now: the lexer counts lines forward from its last
+     * lookup, and the list's elements come later in the source */
+    int line = 0, column = 0;
+    if (parser->file_id) {
+        lexer_location(parser->lexer, &parser->current, &line, &column);
+    }
+
     consume(parser, TOK_LPAREN, "Expected '('");
 
     /* Empty list */
@@ -119,26 +139,30 @@ static LispObject *parse_list(Parser *parser) {
         return make_nil();
     }
 
-    /* Build list of datums */
-    LispObject *head = NULL;
+    /* Build list of datums; the partial list and the datum being added
+     * are GC roots while the next cell is allocated */
+    LispObject *slots[2] = { NULL, NULL };
     LispObject *tail = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
 
     while (!check(parser, TOK_RPAREN) && !check(parser, TOK_DOT) &&
            !check(parser, TOK_EOF)) {
 
-        LispObject *datum = parse_datum(parser);
-        if (!datum) {
+        slots[1] = parse_datum(parser);
+        if (!slots[1]) {
             error_current(parser, "Expected expression");
+            gc_pop_frame(&frame);
             return make_nil();
         }
 
-        LispObject *new_cell = make_cons(datum, make_nil());
+        LispObject *new_cell = make_cons(slots[1], make_nil());
 
         if (tail) {
             tail->cons.cdr = new_cell;
             tail = new_cell;
         } else {
-            head = tail = new_cell;
+            slots[0] = tail = new_cell;
         }
     }
 
@@ -146,12 +170,14 @@ static LispObject *parse_list(Parser *parser) {
     if (match(parser, TOK_DOT)) {
         if (!tail) {
             error_current(parser, "Invalid dotted pair - no elements before dot");
+            gc_pop_frame(&frame);
             return make_nil();
         }
 
         LispObject *datum = parse_datum(parser);
         if (!datum) {
             error_current(parser, "Expected expression after dot");
+            gc_pop_frame(&frame);
             return make_nil();
         }
 
@@ -161,7 +187,10 @@ static LispObject *parse_list(Parser *parser) {
 
     consume(parser, TOK_RPAREN, "Expected ')'");
 
-    return head ? head : make_nil();
+    gc_pop_frame(&frame);
+    if (!slots[0]) return make_nil();
+    if (parser->file_id) srcloc_set(slots[0], parser->file_id, line, column);
+    return slots[0];
 }
 
 /* Parse a quoted expression */
@@ -194,8 +223,12 @@ static LispObject *parse_quoted(Parser *parser) {
     }
 
     /* Build (quote datum) or similar */
-    return make_cons(make_symbol(quote_sym),
-                     make_cons(datum, make_nil()));
+    GCFrame frame;
+    gc_push_frame(&frame, &datum, 1);
+    datum = make_cons(datum, make_nil());
+    datum = make_cons(make_symbol(quote_sym), datum);
+    gc_pop_frame(&frame);
+    return datum;
 }
 
 /* Parse any datum (expression) */
@@ -226,12 +259,18 @@ void parser_init(Parser *parser, Lexer *lexer) {
     parser->lexer = lexer;
     parser->had_error = 0;
     parser->panic_mode = 0;
+    parser->file_id = 0;
     error_message[0] = '\0';
 
     /* Prime the parser with the first token */
     advance(parser);
 }
 
+/* Set the file parsed lists are located in */
+void parser_set_file(Parser *parser, int file_id) {
+    parser->file_id = file_id;
+}
+
 /* Parse a single expression */
 LispObject *parse_expression(Parser *parser) {
     parser->had_error = 0;
@@ -255,30 +294,34 @@ LispObject *parse_program(Parser *parser) {
     parser->had_error = 0;
     parser->panic_mode = 0;
 
-    LispObject *head = NULL;
+    /* The partial program and the expression being added are GC roots */
+    LispObject *slots[2] = { NULL, NULL };
     LispObject *tail = NULL;
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
 
     while (!check(parser, TOK_EOF)) {
-        LispObject *expr = parse_datum(parser);
+        slots[1] = parse_datum(parser);
 
-        if (!expr) {
+        if (!slots[1]) {
             if (!parser->had_error) {
                 error_current(parser, "Expected expression");
             }
             break;
         }
 
-        LispObject *new_cell = make_cons(expr, make_nil());
+        LispObject *new_cell = make_cons(slots[1], make_nil());
 
         if (tail) {
             tail->cons.cdr = new_cell;
             tail = new_cell;
         } else {
-            head = tail = new_cell;
+            slots[0] = tail = new_cell;
         }
     }
 
-    return head ? head : make_nil();
+    gc_pop_frame(&frame);
+    return slots[0] ? slots[0] : make_nil();
 }
 
 /* Check if parser had errors */
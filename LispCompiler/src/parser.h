@@ -19,11 +19,16 @@ typedef struct {
     Token previous;
     int had_error;
     int panic_mode;
+    int file_id;          /* srcloc file id of the source, 0 if none */
 } Parser;
 
 /* Initialize parser with a lexer */
 void parser_init(Parser *parser, Lexer *lexer);
 
+/* Record the source location of each list parsed (see srcloc.h) as
+ * being in the given file */
+void parser_set_file(Parser *parser, int file_id);
+
 /* Parse a single expression */
 LispObject *parse_expression(Parser *parser);
 
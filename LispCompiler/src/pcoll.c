@@ -0,0 +1,843 @@
+/*
+ * pcoll.c - Persistent Collections
+ */
+
+#include "pcoll.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TRIE_BITS 5
+#define TRIE_WIDTH (1 << TRIE_BITS)
+#define TRIE_MASK (TRIE_WIDTH - 1)
+
+/* Map nodes at a shift past this are below the last fragment of a
+ * 32-bit hash: they hold entries whose keys' hashes are all the same */
+#define HASH_MAX_SHIFT 30
+
+/* How many more nodes than the fewest a concatenation may leave */
+#define RRB_EXTRAS 2
+
+/* Edit numbers of transients, never reused */
+static uint64_t last_edit = 0;
+
+static uint64_t new_edit(void) {
+#ifdef _WIN32
+    return ++last_edit;
+#else
+    return __atomic_add_fetch(&last_edit, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static size_t bit_count(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_popcount(mask);
+#else
+    size_t count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+#endif
+}
+
+/* ============================================================
+ * Collections and Nodes
+ * ============================================================ */
+
+static LispObject *make_pcoll(LispType type, LispObject *root, size_t count, int shift) {
+    LispObject *obj = lisp_alloc();
+    obj->type = type;
+    obj->pcoll.root = root;
+    obj->pcoll.count = count;
+    obj->pcoll.edit = 0;
+    obj->pcoll.shift = shift;
+    return obj;
+}
+
+LispObject *make_pmap(void) {
+    return make_pcoll(LISP_PMAP, NULL, 0, 0);
+}
+
+LispObject *make_pset(void) {
+    return make_pcoll(LISP_PSET, NULL, 0, 0);
+}
+
+LispObject *make_pvector(void) {
+    return make_pcoll(LISP_PVECTOR, NULL, 0, 0);
+}
+
+int is_pmap(LispObject *obj) {
+    return obj && obj->type == LISP_PMAP;
+}
+
+int is_pset(LispObject *obj) {
+    return obj && obj->type == LISP_PSET;
+}
+
+int is_pvector(LispObject *obj) {
+    return obj && obj->type == LISP_PVECTOR;
+}
+
+int pcoll_is_transient(LispObject *obj) {
+    return (is_pmap(obj) || is_pset(obj) || is_pvector(obj)) && obj->pcoll.edit != 0;
+}
+
+LispObject *pcoll_transient(LispObject *coll) {
+    LispObject *transient = make_pcoll(coll->type, coll->pcoll.root, coll->pcoll.count,
+                                       coll->pcoll.shift);
+    transient->pcoll.edit = new_edit();
+    return transient;
+}
+
+void pcoll_persistent(LispObject *coll) {
+    /* Its nodes keep the number, which nothing will own again */
+    coll->pcoll.edit = 0;
+}
+
+/* coll with a new root and count: coll itself, changed, if it is a
+ * transient, otherwise a new collection (or coll if nothing changed) */
+static LispObject *pcoll_update(LispObject *coll, LispObject *root, size_t count, int shift) {
+    if (coll->pcoll.edit) {
+        coll->pcoll.root = root;
+        coll->pcoll.count = count;
+        coll->pcoll.shift = shift;
+        return coll;
+    }
+    if (root == coll->pcoll.root && count == coll->pcoll.count) return coll;
+    return make_pcoll(coll->type, root, count, shift);
+}
+
+static LispObject *make_node(uint64_t edit, size_t length) {
+    LispObject *node = lisp_alloc();
+    node->type = LISP_TRIE;
+    node->trie.slots = NULL;
+    node->trie.sizes = NULL;
+    node->trie.edit = edit;
+    node->trie.datamap = 0;
+    node->trie.nodemap = 0;
+    node->trie.length = (uint32_t)length;
+    if (length > 0) {
+        node->trie.slots = (LispObject **)calloc(length, sizeof(LispObject *));
+        if (!node->trie.slots) {
+            lisp_error("Out of memory allocating persistent collection");
+            node->trie.length = 0;
+        }
+    }
+    return node;
+}
+
+/* node with the remove slots at `at` replaced by insert empty ones:
+ * node itself if edit owns it, otherwise a copy that edit owns (a
+ * persistent one for edit 0).  The bitmaps are kept; sizes are not. */
+static LispObject *node_splice(LispObject *node, uint64_t edit, size_t at,
+                               size_t remove, size_t insert) {
+    size_t length = node->trie.length;
+    size_t new_length = length - remove + insert;
+    size_t tail = length - at - remove;
+
+    if (edit && node->trie.edit == edit) {
+        if (new_length > length) {
+            LispObject **slots = (LispObject **)realloc(node->trie.slots,
+                                                        new_length * sizeof(LispObject *));
+            if (!slots) {
+                lisp_error("Out of memory allocating persistent collection");
+                return node;
+            }
+            node->trie.slots = slots;
+        }
+        if (tail > 0 && insert != remove) {
+            memmove(&node->trie.slots[at + insert], &node->trie.slots[at + remove],
+                    tail * sizeof(LispObject *));
+        }
+        for (size_t i = 0; i < insert; i++) node->trie.slots[at + i] = NULL;
+        node->trie.length = (uint32_t)new_length;
+        return node;
+    }
+
+    LispObject *copy = make_node(edit, new_length);
+    if (copy->trie.length != new_length) return copy;
+    if (at > 0) memcpy(copy->trie.slots, node->trie.slots, at * sizeof(LispObject *));
+    if (tail > 0) {
+        memcpy(&copy->trie.slots[at + insert], &node->trie.slots[at + remove],
+               tail * sizeof(LispObject *));
+    }
+    copy->trie.datamap = node->trie.datamap;
+    copy->trie.nodemap = node->trie.nodemap;
+    return copy;
+}
+
+/* node with the remove slots at from taken out, then insert empty ones
+ * put at `to` of what is left, copying node at most once */
+static LispObject *node_move(LispObject *node, uint64_t edit, size_t from, size_t remove,
+                             size_t to, size_t insert) {
+    uint64_t own = edit ? edit : new_edit();
+    LispObject *result = node_splice(node, own, from, remove, 0);
+    result = node_splice(result, own, to, 0, insert);
+    result->trie.edit = edit;
+    return result;
+}
+
+/* ============================================================
+ * Maps and Sets
+ * ============================================================
+ *
+ * A node's slots are its entries, a key and a value each in a map (just
+ * a key in a set), in the order of their hash fragments, then its
+ * children in the same order.  Below HASH_MAX_SHIFT a node has no
+ * bitmaps and holds only entries, those whose keys' hashes collide.
+ * Every node but the root holds at least two entries in all. */
+
+typedef struct {
+    uint64_t edit;      /* Edit number of the transient changed, or 0 */
+    size_t width;       /* Slots per entry */
+    int changed;        /* Whether an entry was added or removed */
+} MapEdit;
+
+static size_t map_width(LispObject *coll) {
+    return coll->type == LISP_PMAP ? 2 : 1;
+}
+
+static uint32_t hash_fragment(uint32_t hash, int shift) {
+    return 1u << ((hash >> shift) & TRIE_MASK);
+}
+
+/* The entry for key, or NULL */
+static LispObject **map_find(LispObject *node, LispObject *key, uint32_t hash, size_t width) {
+    for (int shift = 0; node != NULL; shift += TRIE_BITS) {
+        if (shift > HASH_MAX_SHIFT) {
+            for (size_t i = 0; i < node->trie.length; i += width) {
+                if (lisp_equal(node->trie.slots[i], key)) return &node->trie.slots[i];
+            }
+            return NULL;
+        }
+        uint32_t bit = hash_fragment(hash, shift);
+        if (node->trie.datamap & bit) {
+            LispObject **entry = &node->trie.slots[width * bit_count(node->trie.datamap & (bit - 1))];
+            return lisp_equal(*entry, key) ? entry : NULL;
+        }
+        if (!(node->trie.nodemap & bit)) return NULL;
+        node = node->trie.slots[width * bit_count(node->trie.datamap) +
+                                bit_count(node->trie.nodemap & (bit - 1))];
+    }
+    return NULL;
+}
+
+/* A node at shift holding entries a and b, of different keys */
+static LispObject *map_pair(LispObject **a, uint32_t hash_a, LispObject **b, uint32_t hash_b,
+                            int shift, MapEdit *op) {
+    size_t width = op->width;
+    if (shift > HASH_MAX_SHIFT) {
+        LispObject *node = make_node(op->edit, 2 * width);
+        memcpy(node->trie.slots, a, width * sizeof(LispObject *));
+        memcpy(&node->trie.slots[width], b, width * sizeof(LispObject *));
+        return node;
+    }
+
+    uint32_t bit_a = hash_fragment(hash_a, shift);
+    uint32_t bit_b = hash_fragment(hash_b, shift);
+    if (bit_a == bit_b) {
+        LispObject *child = map_pair(a, hash_a, b, hash_b, shift + TRIE_BITS, op);
+        LispObject *node = make_node(op->edit, 1);
+        node->trie.nodemap = bit_a;
+        node->trie.slots[0] = child;
+        return node;
+    }
+
+    LispObject *node = make_node(op->edit, 2 * width);
+    node->trie.datamap = bit_a | bit_b;
+    if (bit_a > bit_b) {
+        LispObject **swap = a;
+        a = b;
+        b = swap;
+    }
+    memcpy(node->trie.slots, a, width * sizeof(LispObject *));
+    memcpy(&node->trie.slots[width], b, width * sizeof(LispObject *));
+    return node;
+}
+
+/* node with the value of the entry at i replaced */
+static LispObject *map_replace(LispObject *node, size_t i, LispObject **entry, MapEdit *op) {
+    if (op->width == 1 || node->trie.slots[i + 1] == entry[1]) return node;
+    LispObject *result = node_splice(node, op->edit, 0, 0, 0);
+    result->trie.slots[i + 1] = entry[1];
+    return result;
+}
+
+static LispObject *map_insert(LispObject *node, LispObject **entry, uint32_t hash, int shift,
+                              MapEdit *op) {
+    size_t width = op->width;
+    if (shift > HASH_MAX_SHIFT) {
+        for (size_t i = 0; i < node->trie.length; i += width) {
+            if (lisp_equal(node->trie.slots[i], entry[0])) return map_replace(node, i, entry, op);
+        }
+        size_t at = node->trie.length;
+        LispObject *result = node_splice(node, op->edit, at, 0, width);
+        memcpy(&result->trie.slots[at], entry, width * sizeof(LispObject *));
+        op->changed = 1;
+        return result;
+    }
+
+    uint32_t bit = hash_fragment(hash, shift);
+    size_t entries = width * bit_count(node->trie.datamap);
+
+    if (node->trie.datamap & bit) {
+        size_t i = width * bit_count(node->trie.datamap & (bit - 1));
+        LispObject **old = &node->trie.slots[i];
+        if (lisp_equal(old[0], entry[0])) return map_replace(node, i, entry, op);
+
+        /* Two keys for one fragment: the entry becomes a child */
+        LispObject *child = map_pair(old, lisp_hash(old[0]), entry, hash, shift + TRIE_BITS, op);
+        size_t at = entries - width + bit_count(node->trie.nodemap & (bit - 1));
+        LispObject *result = node_move(node, op->edit, i, width, at, 1);
+        result->trie.slots[at] = child;
+        result->trie.datamap &= ~bit;
+        result->trie.nodemap |= bit;
+        op->changed = 1;
+        return result;
+    }
+
+    if (node->trie.nodemap & bit) {
+        size_t j = entries + bit_count(node->trie.nodemap & (bit - 1));
+        LispObject *child = node->trie.slots[j];
+        LispObject *new_child = map_insert(child, entry, hash, shift + TRIE_BITS, op);
+        if (new_child == child) return node;
+        LispObject *result = node_splice(node, op->edit, 0, 0, 0);
+        result->trie.slots[j] = new_child;
+        return result;
+    }
+
+    size_t i = width * bit_count(node->trie.datamap & (bit - 1));
+    LispObject *result = node_splice(node, op->edit, i, 0, width);
+    memcpy(&result->trie.slots[i], entry, width * sizeof(LispObject *));
+    result->trie.datamap |= bit;
+    op->changed = 1;
+    return result;
+}
+
+static LispObject *map_remove(LispObject *node, LispObject *key, uint32_t hash, int shift,
+                              MapEdit *op) {
+    size_t width = op->width;
+    if (shift > HASH_MAX_SHIFT) {
+        for (size_t i = 0; i < node->trie.length; i += width) {
+            if (lisp_equal(node->trie.slots[i], key)) {
+                op->changed = 1;
+                return node_splice(node, op->edit, i, width, 0);
+            }
+        }
+        return node;
+    }
+
+    uint32_t bit = hash_fragment(hash, shift);
+    size_t entries = width * bit_count(node->trie.datamap);
+
+    if (node->trie.datamap & bit) {
+        size_t i = width * bit_count(node->trie.datamap & (bit - 1));
+        if (!lisp_equal(node->trie.slots[i], key)) return node;
+        LispObject *result = node_splice(node, op->edit, i, width, 0);
+        result->trie.datamap &= ~bit;
+        op->changed = 1;
+        return result;
+    }
+
+    if (!(node->trie.nodemap & bit)) return node;
+    size_t j = entries + bit_count(node->trie.nodemap & (bit - 1));
+    LispObject *child = node->trie.slots[j];
+    LispObject *new_child = map_remove(child, key, hash, shift + TRIE_BITS, op);
+    if (!op->changed) return node;
+
+    if (new_child->trie.nodemap == 0 && new_child->trie.length == width) {
+        /* One entry left below: it moves up into this node */
+        size_t i = width * bit_count(node->trie.datamap & (bit - 1));
+        LispObject *result = node_move(node, op->edit, j, 1, i, width);
+        memcpy(&result->trie.slots[i], new_child->trie.slots, width * sizeof(LispObject *));
+        result->trie.datamap |= bit;
+        result->trie.nodemap &= ~bit;
+        return result;
+    }
+    if (new_child == child) return node;
+    LispObject *result = node_splice(node, op->edit, 0, 0, 0);
+    result->trie.slots[j] = new_child;
+    return result;
+}
+
+LispObject *pmap_ref(LispObject *coll, LispObject *key, LispObject *missing) {
+    size_t width = map_width(coll);
+    LispObject **entry = map_find(coll->pcoll.root, key, lisp_hash(key), width);
+    if (!entry) return missing;
+    return entry[width - 1];
+}
+
+LispObject *pmap_set(LispObject *coll, LispObject *key, LispObject *value) {
+    MapEdit op = { coll->pcoll.edit, map_width(coll), 0 };
+    LispObject *entry[2] = { key, value };
+    uint32_t hash = lisp_hash(key);
+
+    gc_pause();
+    LispObject *root = coll->pcoll.root;
+    if (!root) {
+        root = make_node(op.edit, op.width);
+        memcpy(root->trie.slots, entry, op.width * sizeof(LispObject *));
+        root->trie.datamap = hash_fragment(hash, 0);
+        op.changed = 1;
+    } else {
+        root = map_insert(root, entry, hash, 0, &op);
+    }
+    LispObject *result = pcoll_update(coll, root, coll->pcoll.count + (op.changed ? 1 : 0), 0);
+    gc_resume();
+    return result;
+}
+
+LispObject *pmap_delete(LispObject *coll, LispObject *key) {
+    if (!coll->pcoll.root) return coll;
+    MapEdit op = { coll->pcoll.edit, map_width(coll), 0 };
+
+    gc_pause();
+    LispObject *root = map_remove(coll->pcoll.root, key, lisp_hash(key), 0, &op);
+    size_t count = coll->pcoll.count - (op.changed ? 1 : 0);
+    LispObject *result = pcoll_update(coll, count > 0 ? root : NULL, count, 0);
+    gc_resume();
+    return result;
+}
+
+static void map_walk(LispObject *node, size_t width,
+                     void (*visit)(LispObject *key, LispObject *value, void *data), void *data) {
+    size_t entries = node->trie.datamap || node->trie.nodemap
+                   ? width * bit_count(node->trie.datamap) : node->trie.length;
+    for (size_t i = 0; i < entries; i += width) {
+        visit(node->trie.slots[i], node->trie.slots[i + width - 1], data);
+    }
+    for (size_t j = entries; j < node->trie.length; j++) {
+        map_walk(node->trie.slots[j], width, visit, data);
+    }
+}
+
+void pmap_each(LispObject *coll,
+               void (*visit)(LispObject *key, LispObject *value, void *data), void *data) {
+    if (!coll->pcoll.root) return;
+    gc_pause();
+    map_walk(coll->pcoll.root, map_width(coll), visit, data);
+    gc_resume();
+}
+
+/* Whether every entry under node is in other with an equal value */
+static int map_within(LispObject *node, size_t width, LispObject *other) {
+    size_t entries = node->trie.datamap || node->trie.nodemap
+                   ? width * bit_count(node->trie.datamap) : node->trie.length;
+    for (size_t i = 0; i < entries; i += width) {
+        LispObject *key = node->trie.slots[i];
+        LispObject **entry = map_find(other, key, lisp_hash(key), width);
+        if (!entry || (width == 2 && !lisp_equal(node->trie.slots[i + 1], entry[1]))) return 0;
+    }
+    for (size_t j = entries; j < node->trie.length; j++) {
+        if (!map_within(node->trie.slots[j], width, other)) return 0;
+    }
+    return 1;
+}
+
+/* ============================================================
+ * Vectors
+ * ============================================================
+ *
+ * Leaves (shift 0) hold elements, other nodes children one level
+ * down.  All leaves are at the same depth.  A node whose children
+ * before the last are all full (1 << shift elements each) is indexed
+ * by the bits of the index at its shift; others keep sizes. */
+
+/* Elements under node at shift */
+static size_t vec_count(LispObject *node, int shift) {
+    size_t count = 0;
+    for (; shift > 0; shift -= TRIE_BITS) {
+        if (node->trie.sizes) return count + node->trie.sizes[node->trie.length - 1];
+        count += (size_t)(node->trie.length - 1) << shift;
+        node = node->trie.slots[node->trie.length - 1];
+    }
+    return count + node->trie.length;
+}
+
+/* Set or clear the sizes of a node at shift above the leaves, as its
+ * children require */
+static void vec_set_sizes(LispObject *node, int shift) {
+    size_t length = node->trie.length;
+    size_t *sizes = (size_t *)realloc(node->trie.sizes, length * sizeof(size_t));
+    if (!sizes) {
+        lisp_error("Out of memory allocating persistent collection");
+        return;
+    }
+    int relaxed = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < length; i++) {
+        size_t count = vec_count(node->trie.slots[i], shift - TRIE_BITS);
+        if (i + 1 < length && count != (size_t)1 << shift) relaxed = 1;
+        total += count;
+        sizes[i] = total;
+    }
+    if (!relaxed) {
+        free(sizes);
+        sizes = NULL;
+    }
+    node->trie.sizes = sizes;
+}
+
+/* node for edit with length slots, the first of them (and their
+ * sizes) node's */
+static LispObject *vec_resize(LispObject *node, uint64_t edit, size_t length) {
+    size_t keep = node->trie.length < length ? node->trie.length : length;
+    LispObject *result = node;
+    if (edit && node->trie.edit == edit) {
+        if (length != node->trie.length) {
+            result = node_splice(node, edit, keep, node->trie.length - keep, length - keep);
+            if (node->trie.sizes) {
+                size_t *sizes = (size_t *)realloc(node->trie.sizes, length * sizeof(size_t));
+                if (sizes) node->trie.sizes = sizes;
+            }
+        }
+        return result;
+    }
+
+    result = make_node(edit, length);
+    if (result->trie.length != length) return result;
+    memcpy(result->trie.slots, node->trie.slots, keep * sizeof(LispObject *));
+    if (node->trie.sizes) {
+        result->trie.sizes = (size_t *)malloc(length * sizeof(size_t));
+        if (result->trie.sizes) memcpy(result->trie.sizes, node->trie.sizes, keep * sizeof(size_t));
+    }
+    return result;
+}
+
+/* The slot of node at shift that holds *index, which becomes the index
+ * within that child.  Children before the slot hold at most 1 << shift
+ * elements each, so the slot is at least index >> shift. */
+static size_t vec_slot(LispObject *node, int shift, size_t *index) {
+    size_t slot = *index >> shift;
+    if (node->trie.sizes) {
+        while (node->trie.sizes[slot] <= *index) slot++;
+        if (slot > 0) *index -= node->trie.sizes[slot - 1];
+    } else {
+        *index -= slot << shift;
+    }
+    return slot;
+}
+
+/* The leaf of vec holding *index, which becomes its slot there */
+static LispObject *vec_leaf(LispObject *vec, size_t *index) {
+    LispObject *node = vec->pcoll.root;
+    for (int shift = vec->pcoll.shift; shift > 0; shift -= TRIE_BITS) {
+        node = node->trie.slots[vec_slot(node, shift, index)];
+    }
+    return node;
+}
+
+LispObject *pvector_ref(LispObject *vec, size_t index) {
+    LispObject *leaf = vec_leaf(vec, &index);
+    return leaf->trie.slots[index];
+}
+
+static LispObject *vec_assoc(LispObject *node, int shift, size_t index, LispObject *value,
+                             uint64_t edit) {
+    LispObject *result = vec_resize(node, edit, node->trie.length);
+    if (shift == 0) {
+        result->trie.slots[index] = value;
+        return result;
+    }
+    size_t slot = vec_slot(node, shift, &index);
+    result->trie.slots[slot] = vec_assoc(node->trie.slots[slot], shift - TRIE_BITS, index,
+                                         value, edit);
+    return result;
+}
+
+LispObject *pvector_set(LispObject *vec, size_t index, LispObject *value) {
+    gc_pause();
+    LispObject *root = vec_assoc(vec->pcoll.root, vec->pcoll.shift, index, value, vec->pcoll.edit);
+    LispObject *result = pcoll_update(vec, root, vec->pcoll.count, vec->pcoll.shift);
+    gc_resume();
+    return result;
+}
+
+/* Nodes from shift down to a leaf holding value alone */
+static LispObject *vec_path(int shift, LispObject *value, uint64_t edit) {
+    LispObject *node = make_node(edit, 1);
+    node->trie.slots[0] = value;
+    for (int level = TRIE_BITS; level <= shift; level += TRIE_BITS) {
+        LispObject *parent = make_node(edit, 1);
+        parent->trie.slots[0] = node;
+        node = parent;
+    }
+    return node;
+}
+
+/* node at shift with value added at the end, or NULL if it is full */
+static LispObject *vec_append(LispObject *node, int shift, LispObject *value, uint64_t edit) {
+    size_t length = node->trie.length;
+    if (shift == 0) {
+        if (length == TRIE_WIDTH) return NULL;
+        LispObject *result = vec_resize(node, edit, length + 1);
+        result->trie.slots[length] = value;
+        return result;
+    }
+
+    LispObject *last = node->trie.slots[length - 1];
+    LispObject *child = vec_append(last, shift - TRIE_BITS, value, edit);
+    if (child) {
+        LispObject *result = vec_resize(node, edit, length);
+        result->trie.slots[length - 1] = child;
+        if (result->trie.sizes) result->trie.sizes[length - 1]++;
+        return result;
+    }
+    if (length == TRIE_WIDTH) return NULL;
+
+    int balanced = !node->trie.sizes &&
+                   vec_count(last, shift - TRIE_BITS) == (size_t)1 << shift;
+    LispObject *result = vec_resize(node, edit, length + 1);
+    result->trie.slots[length] = vec_path(shift - TRIE_BITS, value, edit);
+    if (result->trie.sizes) {
+        result->trie.sizes[length] = result->trie.sizes[length - 1] + 1;
+    } else if (!balanced) {
+        vec_set_sizes(result, shift);
+    }
+    return result;
+}
+
+LispObject *pvector_push(LispObject *vec, LispObject *value) {
+    uint64_t edit = vec->pcoll.edit;
+    int shift = vec->pcoll.shift;
+
+    gc_pause();
+    LispObject *root;
+    if (!vec->pcoll.root) {
+        root = vec_path(0, value, edit);
+    } else {
+        root = vec_append(vec->pcoll.root, shift, value, edit);
+        if (!root) {
+            root = make_node(edit, 2);
+            root->trie.slots[0] = vec->pcoll.root;
+            root->trie.slots[1] = vec_path(shift, value, edit);
+            shift += TRIE_BITS;
+            vec_set_sizes(root, shift);
+        }
+    }
+    LispObject *result = pcoll_update(vec, root, vec->pcoll.count + 1, shift);
+    gc_resume();
+    return result;
+}
+
+/* Concatenation (Bagwell and Rompf's RRB trees): the two trees are
+ * joined down their facing edges, and at each level the nodes along the
+ * seam are redistributed so that there are at most RRB_EXTRAS more of
+ * them than the fewest that would do.  Each step returns a node one
+ * level above its arguments holding one or two nodes. */
+
+/* The nodes at shift made from the slots of the nodes at shift - 5
+ * along a seam: left's but its last, centre's, and right's but its
+ * first, either of which may be missing.  Returns a node at shift + 5
+ * holding them. */
+static LispObject *vec_rebalance(LispObject *left, LispObject *centre, LispObject *right,
+                                 int shift) {
+    LispObject *nodes[3 * TRIE_WIDTH];
+    size_t count = 0;
+    if (left) {
+        for (size_t i = 0; i + 1 < left->trie.length; i++) nodes[count++] = left->trie.slots[i];
+    }
+    for (size_t i = 0; i < centre->trie.length; i++) nodes[count++] = centre->trie.slots[i];
+    if (right) {
+        for (size_t i = 1; i < right->trie.length; i++) nodes[count++] = right->trie.slots[i];
+    }
+
+    /* The plan: how many slots each new node takes */
+    size_t sizes[3 * TRIE_WIDTH];
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        sizes[i] = nodes[i]->trie.length;
+        total += sizes[i];
+    }
+    size_t fewest = (total + TRIE_WIDTH - 1) / TRIE_WIDTH;
+    size_t planned = count;
+    size_t i = 0;
+    while (planned > fewest + RRB_EXTRAS) {
+        while (sizes[i] > TRIE_WIDTH - RRB_EXTRAS / 2) i++;
+        /* Spread node i over those after it */
+        size_t remaining = sizes[i];
+        while (remaining > 0 && i + 1 < planned) {
+            size_t merged = remaining + sizes[i + 1] < TRIE_WIDTH
+                          ? remaining + sizes[i + 1] : TRIE_WIDTH;
+            sizes[i] = merged;
+            remaining = remaining + sizes[i + 1] - merged;
+            i++;
+        }
+        for (size_t j = i; j + 1 < planned; j++) sizes[j] = sizes[j + 1];
+        planned--;
+        if (i > 0) i--;
+    }
+
+    /* Carry it out, a slot at a time */
+    LispObject *made[3 * TRIE_WIDTH];
+    size_t from = 0, from_slot = 0;
+    int child_shift = shift - TRIE_BITS;
+    for (size_t k = 0; k < planned; k++) {
+        LispObject *node = make_node(0, sizes[k]);
+        for (size_t s = 0; s < sizes[k]; s++) {
+            while (from_slot == nodes[from]->trie.length) {
+                from++;
+                from_slot = 0;
+            }
+            node->trie.slots[s] = nodes[from]->trie.slots[from_slot++];
+        }
+        if (child_shift > 0) vec_set_sizes(node, child_shift);
+        made[k] = node;
+    }
+
+    /* At most 2 * TRIE_WIDTH of them, under one or two parents */
+    size_t parents = planned > TRIE_WIDTH ? 2 : 1;
+    LispObject *top = make_node(0, parents);
+    for (size_t p = 0; p < parents; p++) {
+        size_t first = p * TRIE_WIDTH;
+        size_t length = planned - first < TRIE_WIDTH ? planned - first : TRIE_WIDTH;
+        LispObject *parent = make_node(0, length);
+        memcpy(parent->trie.slots, &made[first], length * sizeof(LispObject *));
+        vec_set_sizes(parent, shift);
+        top->trie.slots[p] = parent;
+    }
+    vec_set_sizes(top, shift + TRIE_BITS);
+    return top;
+}
+
+static LispObject *vec_join(LispObject *left, int left_shift, LispObject *right, int right_shift) {
+    if (left_shift > right_shift) {
+        LispObject *centre = vec_join(left->trie.slots[left->trie.length - 1],
+                                      left_shift - TRIE_BITS, right, right_shift);
+        return vec_rebalance(left, centre, NULL, left_shift);
+    }
+    if (left_shift < right_shift) {
+        LispObject *centre = vec_join(left, left_shift, right->trie.slots[0],
+                                      right_shift - TRIE_BITS);
+        return vec_rebalance(NULL, centre, right, right_shift);
+    }
+    if (left_shift == 0) {
+        LispObject *top = make_node(0, 2);
+        top->trie.slots[0] = left;
+        top->trie.slots[1] = right;
+        vec_set_sizes(top, TRIE_BITS);
+        return top;
+    }
+    LispObject *centre = vec_join(left->trie.slots[left->trie.length - 1], left_shift - TRIE_BITS,
+                                  right->trie.slots[0], right_shift - TRIE_BITS);
+    return vec_rebalance(left, centre, right, left_shift);
+}
+
+/* A vector of root at shift, less the levels above it with one child */
+static LispObject *vec_make(LispObject *root, int shift, size_t count) {
+    while (shift > 0 && root->trie.length == 1) {
+        root = root->trie.slots[0];
+        shift -= TRIE_BITS;
+    }
+    return make_pcoll(LISP_PVECTOR, root, count, shift);
+}
+
+LispObject *pvector_concat(LispObject *a, LispObject *b) {
+    if (b->pcoll.count == 0) return a;
+    if (a->pcoll.count == 0) return b;
+
+    gc_pause();
+    LispObject *root = vec_join(a->pcoll.root, a->pcoll.shift, b->pcoll.root, b->pcoll.shift);
+    int shift = (a->pcoll.shift > b->pcoll.shift ? a->pcoll.shift : b->pcoll.shift) + TRIE_BITS;
+    if (shift == TRIE_BITS && root->trie.length == 2 &&
+        a->pcoll.count + b->pcoll.count <= TRIE_WIDTH) {
+        /* Two short leaves make one */
+        LispObject *leaf = make_node(0, a->pcoll.count + b->pcoll.count);
+        memcpy(leaf->trie.slots, a->pcoll.root->trie.slots, a->pcoll.count * sizeof(LispObject *));
+        memcpy(&leaf->trie.slots[a->pcoll.count], b->pcoll.root->trie.slots,
+               b->pcoll.count * sizeof(LispObject *));
+        root = leaf;
+        shift = 0;
+    }
+    LispObject *result = vec_make(root, shift, a->pcoll.count + b->pcoll.count);
+    gc_resume();
+    return result;
+}
+
+/* The first count (at least one) of the elements under node at shift */
+static LispObject *vec_take(LispObject *node, int shift, size_t count) {
+    if (shift == 0) {
+        if (count == node->trie.length) return node;
+        LispObject *leaf = make_node(0, count);
+        memcpy(leaf->trie.slots, node->trie.slots, count * sizeof(LispObject *));
+        return leaf;
+    }
+    size_t index = count - 1;
+    size_t slot = vec_slot(node, shift, &index);
+    LispObject *child = vec_take(node->trie.slots[slot], shift - TRIE_BITS, index + 1);
+    if (slot + 1 == node->trie.length && child == node->trie.slots[slot]) return node;
+
+    LispObject *result = make_node(0, slot + 1);
+    memcpy(result->trie.slots, node->trie.slots, slot * sizeof(LispObject *));
+    result->trie.slots[slot] = child;
+    vec_set_sizes(result, shift);
+    return result;
+}
+
+/* The elements under node at shift after the first count of them */
+static LispObject *vec_drop(LispObject *node, int shift, size_t count) {
+    if (count == 0) return node;
+    if (shift == 0) {
+        LispObject *leaf = make_node(0, node->trie.length - count);
+        memcpy(leaf->trie.slots, &node->trie.slots[count],
+               (node->trie.length - count) * sizeof(LispObject *));
+        return leaf;
+    }
+    size_t index = count;
+    size_t slot = vec_slot(node, shift, &index);
+    LispObject *result = make_node(0, node->trie.length - slot);
+    result->trie.slots[0] = vec_drop(node->trie.slots[slot], shift - TRIE_BITS, index);
+    memcpy(&result->trie.slots[1], &node->trie.slots[slot + 1],
+           (node->trie.length - slot - 1) * sizeof(LispObject *));
+    vec_set_sizes(result, shift);
+    return result;
+}
+
+LispObject *pvector_slice(LispObject *vec, size_t start, size_t end) {
+    if (start == 0 && end == vec->pcoll.count) return vec;
+    if (start == end) return make_pvector();
+
+    gc_pause();
+    LispObject *root = vec_take(vec->pcoll.root, vec->pcoll.shift, end);
+    root = vec_drop(root, vec->pcoll.shift, start);
+    LispObject *result = vec_make(root, vec->pcoll.shift, end - start);
+    gc_resume();
+    return result;
+}
+
+void pvector_each(LispObject *vec, void (*visit)(LispObject *value, void *data), void *data) {
+    gc_pause();
+    size_t index = 0;
+    while (index < vec->pcoll.count) {
+        size_t slot = index;
+        LispObject *leaf = vec_leaf(vec, &slot);
+        for (; slot < leaf->trie.length; slot++, index++) {
+            visit(leaf->trie.slots[slot], data);
+        }
+    }
+    gc_resume();
+}
+
+/* ============================================================
+ * Equality
+ * ============================================================ */
+
+int pcoll_equal(LispObject *a, LispObject *b) {
+    if (a->pcoll.count != b->pcoll.count) return 0;
+    if (a->pcoll.root == b->pcoll.root) return 1;
+
+    if (a->type != LISP_PVECTOR) return map_within(a->pcoll.root, map_width(a), b->pcoll.root);
+
+    LispObject *leaf_a = NULL, *leaf_b = NULL;
+    size_t slot_a = 0, slot_b = 0;
+    for (size_t index = 0; index < a->pcoll.count; index++) {
+        if (!leaf_a || slot_a == leaf_a->trie.length) {
+            slot_a = index;
+            leaf_a = vec_leaf(a, &slot_a);
+        }
+        if (!leaf_b || slot_b == leaf_b->trie.length) {
+            slot_b = index;
+            leaf_b = vec_leaf(b, &slot_b);
+        }
+        if (!lisp_equal(leaf_a->trie.slots[slot_a++], leaf_b->trie.slots[slot_b++])) return 0;
+    }
+    return 1;
+}
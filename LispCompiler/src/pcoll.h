@@ -0,0 +1,100 @@
+/*
+ * pcoll.h - Persistent Collections
+ *
+ * Maps, sets and vectors that are never changed: setting a key or an
+ * element makes a new collection that shares all of the old one but the
+ * path to the change, some log32(n) nodes of up to 32 slots.  A thousand
+ * versions of a large map, each a key apart, cost a thousand paths, not
+ * a thousand maps.
+ *
+ * Maps and sets are hash array mapped tries in the CHAMP layout: each
+ * node has a bitmap of the hash fragments it holds entries for and one
+ * of those it holds children for, entries first.  Keys are compared
+ * with equal? and hashed as hashtables made by make-hashtable hash them
+ * (lisp_hash).  A deletion leaves the trie that inserting the remaining
+ * keys would have made.
+ *
+ * Vectors are RRB trees (relaxed radix balanced): a node holds 32
+ * children or, in a leaf, 32 elements, and is indexed by five bits of
+ * the index per level while its children are full.  Concatenation and
+ * slicing leave nodes that are not; those keep a table of the elements
+ * under each child, so both take O(log n) too.
+ *
+ * A transient is a collection that may be changed in place, to build
+ * or batch-update one without a copy of a path per change.  Its nodes
+ * carry the transient's edit number, and a change copies only nodes
+ * that carry another.  Making it persistent again takes nothing but
+ * forgetting the number.  A transient must not be changed by two
+ * threads at once.
+ */
+
+#ifndef PCOLL_H
+#define PCOLL_H
+
+#include "lisp.h"
+
+/* Empty collections */
+LispObject *make_pmap(void);
+LispObject *make_pset(void);
+LispObject *make_pvector(void);
+
+int is_pmap(LispObject *obj);
+int is_pset(LispObject *obj);
+int is_pvector(LispObject *obj);
+
+/* Whether obj is a persistent collection that is a transient */
+int pcoll_is_transient(LispObject *obj);
+
+/* A transient with the contents of a persistent coll */
+LispObject *pcoll_transient(LispObject *coll);
+
+/* Make a transient persistent, in place */
+void pcoll_persistent(LispObject *coll);
+
+/* equal? of two collections of one type */
+int pcoll_equal(LispObject *a, LispObject *b);
+
+/* ============================================================
+ * Maps and Sets
+ * ============================================================
+ *
+ * A set is a map whose entries have no values.  The changes return the
+ * new collection: coll itself, changed, if it is a transient. */
+
+/* The value of key (for a set, the key as stored), or missing */
+LispObject *pmap_ref(LispObject *coll, LispObject *key, LispObject *missing);
+
+/* coll with key set to value (ignored for a set) */
+LispObject *pmap_set(LispObject *coll, LispObject *key, LispObject *value);
+
+/* coll without key */
+LispObject *pmap_delete(LispObject *coll, LispObject *key);
+
+/* Call visit on each entry, in an order fixed by the keys' hashes */
+void pmap_each(LispObject *coll,
+               void (*visit)(LispObject *key, LispObject *value, void *data),
+               void *data);
+
+/* ============================================================
+ * Vectors
+ * ============================================================ */
+
+/* Element index, which is below the length */
+LispObject *pvector_ref(LispObject *vec, size_t index);
+
+/* vec with element index, below the length, set to value */
+LispObject *pvector_set(LispObject *vec, size_t index, LispObject *value);
+
+/* vec with value added at the end */
+LispObject *pvector_push(LispObject *vec, LispObject *value);
+
+/* The elements of a then b, and elements start up to end of vec: new
+ * persistent vectors sharing nodes with their arguments, which must be
+ * persistent */
+LispObject *pvector_concat(LispObject *a, LispObject *b);
+LispObject *pvector_slice(LispObject *vec, size_t start, size_t end);
+
+/* Call visit on each element in order */
+void pvector_each(LispObject *vec, void (*visit)(LispObject *value, void *data), void *data);
+
+#endif /* PCOLL_H */
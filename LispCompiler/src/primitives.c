@@ -4,6 +4,13 @@
 
 #include "primitives.h"
 #include "eval.h"
+#include "thread.h"
+#include "promise.h"
+#include "number.h"
+#include "printer.h"
+#include "text.h"
+#include "numvec.h"
+#include "pcoll.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,6 +69,32 @@ LispObject *prim_list(LispObject *args) {
     return args;  /* Arguments are already a list */
 }
 
+LispObject *prim_set_car(LispObject *args) {
+    LispObject *pair = require_arg(args, 0, "set-car!");
+    LispObject *value = require_arg(args, 1, "set-car!");
+    if (!pair || !value) return make_nil();
+    if (!require_type(pair, LISP_CONS, "set-car!")) return make_nil();
+    if (pair->gc_mark == GC_MARK_STATIC) {
+        lisp_error("set-car!: cannot modify a literal constant");
+        return make_nil();
+    }
+    pair->cons.car = value;
+    return make_nil();
+}
+
+LispObject *prim_set_cdr(LispObject *args) {
+    LispObject *pair = require_arg(args, 0, "set-cdr!");
+    LispObject *value = require_arg(args, 1, "set-cdr!");
+    if (!pair || !value) return make_nil();
+    if (!require_type(pair, LISP_CONS, "set-cdr!")) return make_nil();
+    if (pair->gc_mark == GC_MARK_STATIC) {
+        lisp_error("set-cdr!: cannot modify a literal constant");
+        return make_nil();
+    }
+    pair->cons.cdr = value;
+    return make_nil();
+}
+
 LispObject *prim_length(LispObject *args) {
     LispObject *lst = require_arg(args, 0, "length");
     if (!lst) return make_number(0);
@@ -340,26 +373,88 @@ LispObject *prim_not(LispObject *args) {
 
 /* I/O */
 
-LispObject *prim_display(LispObject *args) {
-    LispObject *obj = require_arg(args, 0, "display");
-    if (!obj) return make_nil();
+/* The printer for the optional port argument after n others: the
+ * port's own for a string port, else file_printer set up for the
+ * port's stream or stdout.  NULL (after an error) if the argument is
+ * not an open output port. */
+static Printer *port_printer(LispObject *args, int n, const char *name, Printer *file_printer) {
+    for (int i = 0; i < n && is_cons(args); i++) args = cdr(args);
+    if (!is_cons(args)) {
+        printer_init(file_printer, stdout);
+        return file_printer;
+    }
 
-    /* Print without quotes for strings */
-    if (is_string(obj)) {
-        printf("%s", obj->string.data);
-    } else {
-        lisp_print(obj);
+    LispObject *port = car(args);
+    if (!is_output_port(port) || !port->port.is_open || !port->port.stream) {
+        lisp_error("%s: expected an open output port", name);
+        return NULL;
     }
+    if (port->port.is_string) return (Printer *)port->port.stream;
+    printer_init(file_printer, (FILE *)port->port.stream);
+    return file_printer;
+}
+
+/* Print obj to the port argument after it, or stdout */
+static LispObject *print_to_port(LispObject *args, int quoted, const char *name) {
+    LispObject *obj = require_arg(args, 0, name);
+    if (!obj) return make_nil();
 
+    Printer file_printer;
+    Printer *printer = port_printer(args, 1, name, &file_printer);
+    if (!printer) return make_nil();
+    printer_print(printer, obj, quoted);
+    if (printer == &file_printer) printer_free(&file_printer);
     return make_nil();
 }
 
+LispObject *prim_display(LispObject *args) {
+    /* Strings print without quotes, though strings inside lists keep
+     * theirs */
+    LispObject *obj = require_arg(args, 0, "display");
+    return print_to_port(args, !(obj && is_string(obj)), "display");
+}
+
+LispObject *prim_write(LispObject *args) {
+    return print_to_port(args, 1, "write");
+}
+
 LispObject *prim_newline(LispObject *args) {
-    (void)args;
-    printf("\n");
+    Printer file_printer;
+    Printer *printer = port_printer(args, 0, "newline", &file_printer);
+    if (!printer) return make_nil();
+    printer_putc(printer, '\n');
+    if (printer == &file_printer) printer_free(&file_printer);
     return make_nil();
 }
 
+LispObject *prim_open_output_string(LispObject *args) {
+    (void)args;
+    Printer *printer = (Printer *)malloc(sizeof(Printer));
+    if (!printer) {
+        lisp_error("open-output-string: out of memory");
+        return make_nil();
+    }
+    printer_init(printer, NULL);
+    LispObject *port = make_port(printer, 0, 1, 0, "string");
+    port->port.is_string = 1;
+    return port;
+}
+
+LispObject *prim_get_output_string(LispObject *args) {
+    LispObject *port = require_arg(args, 0, "get-output-string");
+    if (!port) return make_string("");
+    if (!is_port(port) || !port->port.is_string || !port->port.stream) {
+        lisp_error("get-output-string: expected a string output port");
+        return make_string("");
+    }
+    Printer *printer = (Printer *)port->port.stream;
+    if (printer->failed) {
+        lisp_error("get-output-string: out of memory");
+        return make_string("");
+    }
+    return make_string_n(printer_string(printer), printer->length);
+}
+
 LispObject *prim_print(LispObject *args) {
     LispObject *obj = require_arg(args, 0, "print");
     if (!obj) return make_nil();
@@ -381,7 +476,7 @@ LispObject *prim_string_length(LispObject *args) {
         return make_number(0);
     }
 
-    return make_number((double)s->string.length);
+    return make_number((double)s->string.chars);
 }
 
 LispObject *prim_string_append(LispObject *args) {
@@ -431,12 +526,12 @@ LispObject *prim_string_ref(LispObject *args) {
     }
 
     int i = (int)idx->number;
-    if (i < 0 || (size_t)i >= s->string.length) {
+    if (i < 0 || (size_t)i >= s->string.chars) {
         lisp_error("string-ref: index out of bounds");
         return make_character('\0');
     }
 
-    return make_character(s->string.data[i]);
+    return make_character(string_char_at(s, (size_t)i));
 }
 
 LispObject *prim_number_to_string(LispObject *args) {
@@ -448,13 +543,8 @@ LispObject *prim_number_to_string(LispObject *args) {
         return make_string("0");
     }
 
-    char buffer[64];
-    if (n->number == (long long)n->number) {
-        snprintf(buffer, sizeof(buffer), "%lld", (long long)n->number);
-    } else {
-        snprintf(buffer, sizeof(buffer), "%g", n->number);
-    }
-
+    char buffer[NUMBER_BUFFER_SIZE];
+    number_format(n->number, buffer);
     return make_string(buffer);
 }
 
@@ -467,13 +557,10 @@ LispObject *prim_string_to_number(LispObject *args) {
         return LISP_FALSE;
     }
 
-    char *endptr;
-    double value = strtod(s->string.data, &endptr);
-
-    if (endptr == s->string.data) {
-        return LISP_FALSE;  /* No conversion */
+    double value;
+    if (!number_parse(s->string.data, s->string.length, &value)) {
+        return LISP_FALSE;
     }
-
     return make_number(value);
 }
 
@@ -714,6 +801,70 @@ LispObject *prim_bytevector_u8_set(LispObject *args) {
     return make_nil();
 }
 
+/* Helper for the optional start and end of a range of length items at
+ * argument n: returns 0 after reporting an error if they are not one */
+static int optional_range(LispObject *args, int n, size_t length,
+                          size_t *start, size_t *end, const char *func_name) {
+    *start = 0;
+    *end = length;
+    for (int i = 0; i < n && is_cons(args); i++) {
+        args = cdr(args);
+    }
+    for (int i = 0; i < 2 && is_cons(args); i++, args = cdr(args)) {
+        LispObject *obj = car(args);
+        if (!require_type(obj, LISP_NUMBER, func_name)) return 0;
+        if (obj->number < 0 || obj->number > (double)length ||
+            obj->number != floor(obj->number)) {
+            lisp_error("%s: index %g out of range", func_name, obj->number);
+            return 0;
+        }
+        if (i == 0) *start = (size_t)obj->number;
+        else *end = (size_t)obj->number;
+    }
+    if (*start > *end) {
+        lisp_error("%s: start %zu is after end %zu", func_name, *start, *end);
+        return 0;
+    }
+    return 1;
+}
+
+LispObject *prim_string_to_utf8(LispObject *args) {
+    LispObject *str = require_arg(args, 0, "string->utf8");
+    if (!str) return make_bytevector(0, 0);
+    if (!require_type(str, LISP_STRING, "string->utf8")) return make_bytevector(0, 0);
+
+    size_t start, end;
+    if (!optional_range(args, 1, str->string.chars, &start, &end, "string->utf8")) {
+        return make_bytevector(0, 0);
+    }
+    start = string_offset(str, start);
+    end = string_offset(str, end);
+
+    /* Strings hold UTF-8 already: a copy of the bytes */
+    LispObject *bv = make_bytevector(end - start, 0);
+    memcpy(bv->bytevector.bytes, str->string.data + start, end - start);
+    return bv;
+}
+
+LispObject *prim_utf8_to_string(LispObject *args) {
+    LispObject *bv = require_arg(args, 0, "utf8->string");
+    if (!bv) return make_string("");
+    if (!require_type(bv, LISP_BYTEVECTOR, "utf8->string")) return make_string("");
+
+    size_t start, end;
+    if (!optional_range(args, 1, bv->bytevector.length, &start, &end, "utf8->string")) {
+        return make_string("");
+    }
+
+    const char *bytes = (const char *)bv->bytevector.bytes + start;
+    size_t valid = text_utf8_valid(bytes, end - start);
+    if (valid < end - start) {
+        lisp_error("utf8->string: invalid UTF-8 at byte %zu", start + valid);
+        return make_string("");
+    }
+    return make_string_n(bytes, end - start);
+}
+
 /* ============================================================
  * R6RS: Hashtable Primitives
  * ============================================================ */
@@ -1241,17 +1392,24 @@ LispObject *prim_char_to_integer(LispObject *args) {
         lisp_error("char->integer: expected character");
         return make_number(0);
     }
-    return make_number((double)(unsigned char)c->character);
+    return make_number((double)c->character);
 }
 
 LispObject *prim_integer_to_char(LispObject *args) {
     LispObject *n = require_arg(args, 0, "integer->char");
-    if (!n) return make_character('\0');
+    if (!n) return make_nil();
     if (!is_number(n)) {
         lisp_error("integer->char: expected number");
-        return make_character('\0');
+        return make_nil();
+    }
+    if (n->number < 0 || n->number > TEXT_MAX_CODE || n->number != floor(n->number) ||
+        !text_is_scalar((uint32_t)n->number)) {
+        char buffer[NUMBER_BUFFER_SIZE];
+        number_format(n->number, buffer);
+        lisp_error("integer->char: %s is not a Unicode scalar value", buffer);
+        return make_nil();
     }
-    return make_character((char)(int)n->number);
+    return make_character((uint32_t)n->number);
 }
 
 /* ============================================================
@@ -1366,6 +1524,13 @@ LispObject *prim_list_set(LispObject *args) {
         index--;
     }
 
+    /* Literal lists may live outside the heap, where the collector
+     * would not see what they point to */
+    if (is_cons(lst) && lst->gc_mark == GC_MARK_STATIC) {
+        lisp_error("list-set!: cannot modify a literal constant");
+        return make_nil();
+    }
+
     if (is_cons(lst)) {
         lst->cons.car = obj;
     }
@@ -1488,7 +1653,7 @@ LispObject *prim_string_copy(LispObject *args) {
     }
 
     size_t start = 0;
-    size_t end = str->string.length;
+    size_t end = str->string.chars;
 
     if (is_cons(cdr(args))) {
         LispObject *start_obj = cadr(args);
@@ -1503,12 +1668,13 @@ LispObject *prim_string_copy(LispObject *args) {
         }
     }
 
-    if (start > end || end > str->string.length) {
+    if (start > end || end > str->string.chars) {
         lisp_error("string-copy: invalid range");
         return make_string("");
     }
 
-    return make_string_n(str->string.data + start, end - start);
+    size_t from = string_offset(str, start);
+    return make_string_n(str->string.data + from, string_offset(str, end) - from);
 }
 
 LispObject *prim_substring(LispObject *args) {
@@ -1529,12 +1695,13 @@ LispObject *prim_substring(LispObject *args) {
     size_t start = (size_t)start_obj->number;
     size_t end = (size_t)end_obj->number;
 
-    if (start > end || end > str->string.length) {
+    if (start > end || end > str->string.chars) {
         lisp_error("substring: invalid range");
         return make_string("");
     }
 
-    return make_string_n(str->string.data + start, end - start);
+    size_t from = string_offset(str, start);
+    return make_string_n(str->string.data + from, string_offset(str, end) - from);
 }
 
 LispObject *prim_string_eq(LispObject *args) {
@@ -1548,7 +1715,8 @@ LispObject *prim_string_eq(LispObject *args) {
     }
 
     return make_boolean(a->string.length == b->string.length &&
-                       strcmp(a->string.data, b->string.data) == 0);
+                       text_compare(a->string.data, a->string.length,
+                                    b->string.data, b->string.length) == 0);
 }
 
 LispObject *prim_string_lt(LispObject *args) {
@@ -1561,7 +1729,357 @@ LispObject *prim_string_lt(LispObject *args) {
         return LISP_FALSE;
     }
 
-    return make_boolean(strcmp(a->string.data, b->string.data) < 0);
+    return make_boolean(text_compare(a->string.data, a->string.length,
+                                     b->string.data, b->string.length) < 0);
+}
+
+/* ============================================================
+ * Text Processing
+ * ============================================================ */
+
+/* Searching, splitting, case and comparison run in the kernels of
+ * text.c, a block of bytes at a time.  Indices in and out are character
+ * indices, turned into byte offsets and back at the edges. */
+
+/* Helper to get a required string argument */
+static LispObject *require_string(LispObject *args, int n, const char *func_name) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj) return NULL;
+    if (!require_type(obj, LISP_STRING, func_name)) return NULL;
+    return obj;
+}
+
+/* Helper for an optional index into str: leaves *offset alone if
+ * argument n is absent, sets it to the byte offset of the index if it
+ * is one of str (0 to its length), and returns 0 after reporting an
+ * error if not */
+static int optional_index(LispObject *args, int n, LispObject *str, size_t *offset,
+                          const char *func_name) {
+    for (int i = 0; i < n && is_cons(args); i++) {
+        args = cdr(args);
+    }
+    if (!is_cons(args)) return 1;
+
+    LispObject *obj = car(args);
+    if (!require_type(obj, LISP_NUMBER, func_name)) return 0;
+    if (obj->number < 0 || obj->number > (double)str->string.chars ||
+        obj->number != floor(obj->number)) {
+        lisp_error("%s: index %g out of range", func_name, obj->number);
+        return 0;
+    }
+    *offset = string_offset(str, (size_t)obj->number);
+    return 1;
+}
+
+/* The character index at byte offset of str, or #f for TEXT_NOT_FOUND */
+static LispObject *index_or_false(LispObject *str, size_t offset) {
+    return offset == TEXT_NOT_FOUND ? LISP_FALSE
+                                    : make_number((double)string_char_index(str, offset));
+}
+
+/* Characters to search for, given as a char or a string of them.  A set
+ * of ASCII characters is searched for as bytes, and a single character
+ * as its UTF-8; other sets are matched a character at a time. */
+typedef struct {
+    TextSet set;           /* The bytes, for ASCII */
+    const char *chars;     /* The characters, for a general set */
+    size_t chars_length;
+    char utf8[4];          /* The character, for a single one */
+    size_t utf8_length;
+} Delimiters;
+
+static int delimiters_init(LispObject *obj, Delimiters *d, const char *func_name) {
+    d->chars = NULL;
+    d->utf8_length = 0;
+    if (obj->type == LISP_CHARACTER) {
+        d->utf8_length = text_utf8_encode(obj->character, d->utf8);
+        if (d->utf8_length == 1) {
+            text_set_init(&d->set, d->utf8, 1);
+            d->utf8_length = 0;
+        }
+        return 1;
+    }
+    if (obj->type == LISP_STRING) {
+        if (obj->string.chars == obj->string.length) {
+            text_set_init(&d->set, obj->string.data, obj->string.length);
+        } else {
+            d->chars = obj->string.data;
+            d->chars_length = obj->string.length;
+        }
+        return 1;
+    }
+    lisp_error("%s: expected character or string, got %s",
+               func_name, lisp_type_name(obj->type));
+    return 0;
+}
+
+/* Offset of the first delimiter in the length bytes of UTF-8 at text, or
+ * TEXT_NOT_FOUND; sets *width to its bytes */
+static size_t delimiters_find(const Delimiters *d, const char *text, size_t length,
+                              size_t *width) {
+    if (d->utf8_length) {
+        *width = d->utf8_length;
+        return text_search(text, length, d->utf8, d->utf8_length);
+    }
+    if (!d->chars) {
+        *width = 1;
+        return text_find_any(text, length, &d->set);
+    }
+    /* UTF-8 only matches whole characters, so a character is in the set
+     * when its bytes are found in it */
+    for (size_t pos = 0; pos < length; ) {
+        uint32_t code;
+        size_t n = text_utf8_decode(text + pos, length - pos, &code);
+        if (text_search(d->chars, d->chars_length, text + pos, n) != TEXT_NOT_FOUND) {
+            *width = n;
+            return pos;
+        }
+        pos += n;
+    }
+    return TEXT_NOT_FOUND;
+}
+
+LispObject *prim_string_search_forward(LispObject *args) {
+    LispObject *pattern = require_string(args, 0, "string-search-forward");
+    LispObject *str = require_string(args, 1, "string-search-forward");
+    if (!pattern || !str) return LISP_FALSE;
+
+    size_t start = 0;
+    if (!optional_index(args, 2, str, &start, "string-search-forward")) return LISP_FALSE;
+
+    size_t at = text_search(str->string.data + start, str->string.length - start,
+                            pattern->string.data, pattern->string.length);
+    return index_or_false(str, at == TEXT_NOT_FOUND ? at : start + at);
+}
+
+LispObject *prim_string_search_backward(LispObject *args) {
+    LispObject *pattern = require_string(args, 0, "string-search-backward");
+    LispObject *str = require_string(args, 1, "string-search-backward");
+    if (!pattern || !str) return LISP_FALSE;
+
+    size_t end = str->string.length;
+    if (!optional_index(args, 2, str, &end, "string-search-backward")) return LISP_FALSE;
+
+    /* The index after the match, as in MIT Scheme */
+    size_t at = text_search_last(str->string.data, end,
+                                 pattern->string.data, pattern->string.length);
+    return index_or_false(str, at == TEXT_NOT_FOUND ? at : at + pattern->string.length);
+}
+
+LispObject *prim_string_search_all(LispObject *args) {
+    LispObject *pattern = require_string(args, 0, "string-search-all");
+    LispObject *str = require_string(args, 1, "string-search-all");
+    if (!pattern || !str) return make_nil();
+
+    LispObject *result = make_nil();
+    LispObject *tail = NULL;
+    gc_pause();
+    for (size_t pos = 0; pos <= str->string.length; ) {
+        size_t at = text_search(str->string.data + pos, str->string.length - pos,
+                                pattern->string.data, pattern->string.length);
+        if (at == TEXT_NOT_FOUND) break;
+        LispObject *cell = make_cons(index_or_false(str, pos + at), make_nil());
+        if (tail) tail->cons.cdr = cell;
+        else result = cell;
+        tail = cell;
+        /* On to the next character (matches start on characters) */
+        pos += at;
+        if (pos == str->string.length) break;
+        uint32_t code;
+        pos += text_utf8_decode(str->string.data + pos, str->string.length - pos, &code);
+    }
+    gc_resume();
+    return result;
+}
+
+LispObject *prim_string_contains(LispObject *args) {
+    LispObject *str = require_string(args, 0, "string-contains");
+    LispObject *pattern = require_string(args, 1, "string-contains");
+    if (!str || !pattern) return LISP_FALSE;
+
+    size_t start = 0;
+    if (!optional_index(args, 2, str, &start, "string-contains")) return LISP_FALSE;
+
+    size_t at = text_search(str->string.data + start, str->string.length - start,
+                            pattern->string.data, pattern->string.length);
+    return index_or_false(str, at == TEXT_NOT_FOUND ? at : start + at);
+}
+
+LispObject *prim_string_index(LispObject *args) {
+    LispObject *str = require_string(args, 0, "string-index");
+    LispObject *pred = require_arg(args, 1, "string-index");
+    if (!str || !pred) return LISP_FALSE;
+
+    size_t start = 0;
+    size_t end = str->string.length;
+    if (!optional_index(args, 2, str, &start, "string-index") ||
+        !optional_index(args, 3, str, &end, "string-index")) {
+        return LISP_FALSE;
+    }
+    if (start > end) {
+        lisp_error("string-index: start %zu is after end %zu",
+                   string_char_index(str, start), string_char_index(str, end));
+        return LISP_FALSE;
+    }
+
+    /* A character or a string of them: a search for the set */
+    if (!is_callable(pred)) {
+        Delimiters d;
+        if (!delimiters_init(pred, &d, "string-index")) return LISP_FALSE;
+        size_t width;
+        size_t at = delimiters_find(&d, str->string.data + start, end - start, &width);
+        return index_or_false(str, at == TEXT_NOT_FOUND ? at : start + at);
+    }
+
+    size_t i = string_char_index(str, start);
+    for (size_t pos = start; pos < end; i++) {
+        uint32_t code;
+        pos += text_utf8_decode(str->string.data + pos, str->string.length - pos, &code);
+        gc_pause();
+        LispObject *call_args = make_cons(make_character(code), make_nil());
+        gc_resume();
+        LispObject *keep = apply(pred, call_args, NULL);
+        if (is_true(keep)) return make_number((double)i);
+    }
+    return LISP_FALSE;
+}
+
+LispObject *prim_string_split(LispObject *args) {
+    LispObject *str = require_string(args, 0, "string-split");
+    LispObject *delimiters = require_arg(args, 1, "string-split");
+    if (!str || !delimiters) return make_nil();
+
+    Delimiters d;
+    if (!delimiters_init(delimiters, &d, "string-split")) return make_nil();
+
+    /* Fields between delimiters, empty ones included */
+    const char *data = str->string.data;
+    size_t length = str->string.length;
+    LispObject *result = make_nil();
+    LispObject *tail = NULL;
+    gc_pause();
+    for (size_t pos = 0; ; ) {
+        size_t width;
+        size_t at = delimiters_find(&d, data + pos, length - pos, &width);
+        size_t field_end = at == TEXT_NOT_FOUND ? length : pos + at;
+        LispObject *cell = make_cons(make_string_n(data + pos, field_end - pos), make_nil());
+        if (tail) tail->cons.cdr = cell;
+        else result = cell;
+        tail = cell;
+        if (at == TEXT_NOT_FOUND) break;
+        pos = field_end + width;
+    }
+    gc_resume();
+    return result;
+}
+
+LispObject *prim_string_join(LispObject *args) {
+    LispObject *list = require_arg(args, 0, "string-join");
+    if (!list) return make_string("");
+
+    const char *delimiter = " ";
+    size_t delimiter_length = 1;
+    if (is_cons(cdr(args))) {
+        LispObject *obj = require_string(args, 1, "string-join");
+        if (!obj) return make_string("");
+        delimiter = obj->string.data;
+        delimiter_length = obj->string.length;
+    }
+
+    /* Measure, then copy into one buffer */
+    size_t total = 0;
+    size_t count = 0;
+    for (LispObject *l = list; is_cons(l); l = cdr(l)) {
+        if (!require_type(car(l), LISP_STRING, "string-join")) return make_string("");
+        total += car(l)->string.length;
+        count++;
+    }
+    if (count > 1) total += (count - 1) * delimiter_length;
+
+    char *buffer = (char *)malloc(total + 1);
+    if (!buffer) {
+        lisp_error("string-join: out of memory");
+        return make_string("");
+    }
+    char *p = buffer;
+    for (LispObject *l = list; is_cons(l); l = cdr(l)) {
+        if (p != buffer) {
+            memcpy(p, delimiter, delimiter_length);
+            p += delimiter_length;
+        }
+        memcpy(p, car(l)->string.data, car(l)->string.length);
+        p += car(l)->string.length;
+    }
+
+    LispObject *result = make_string_n(buffer, total);
+    free(buffer);
+    return result;
+}
+
+/* A copy of the string argument of func_name in one case */
+static LispObject *string_case(LispObject *args, int upper, const char *func_name) {
+    LispObject *str = require_string(args, 0, func_name);
+    if (!str) return make_string("");
+
+    LispObject *result = make_string_n(str->string.data, str->string.length);
+    if (upper) {
+        text_upcase(result->string.data, result->string.data, result->string.length);
+    } else {
+        text_downcase(result->string.data, result->string.data, result->string.length);
+    }
+    return result;
+}
+
+LispObject *prim_string_upcase(LispObject *args) {
+    return string_case(args, 1, "string-upcase");
+}
+
+LispObject *prim_string_downcase(LispObject *args) {
+    return string_case(args, 0, "string-downcase");
+}
+
+LispObject *prim_string_foldcase(LispObject *args) {
+    return string_case(args, 0, "string-foldcase");
+}
+
+LispObject *prim_string_ci_eq(LispObject *args) {
+    LispObject *a = require_string(args, 0, "string-ci=?");
+    LispObject *b = require_string(args, 1, "string-ci=?");
+    if (!a || !b) return LISP_FALSE;
+
+    return make_boolean(a->string.length == b->string.length &&
+                        text_compare_ci(a->string.data, a->string.length,
+                                        b->string.data, b->string.length) == 0);
+}
+
+LispObject *prim_string_ci_lt(LispObject *args) {
+    LispObject *a = require_string(args, 0, "string-ci<?");
+    LispObject *b = require_string(args, 1, "string-ci<?");
+    if (!a || !b) return LISP_FALSE;
+
+    return make_boolean(text_compare_ci(a->string.data, a->string.length,
+                                        b->string.data, b->string.length) < 0);
+}
+
+LispObject *prim_string_prefix_p(LispObject *args) {
+    LispObject *prefix = require_string(args, 0, "string-prefix?");
+    LispObject *str = require_string(args, 1, "string-prefix?");
+    if (!prefix || !str) return LISP_FALSE;
+
+    size_t n = prefix->string.length;
+    return make_boolean(n <= str->string.length &&
+                        memcmp(str->string.data, prefix->string.data, n) == 0);
+}
+
+LispObject *prim_string_suffix_p(LispObject *args) {
+    LispObject *suffix = require_string(args, 0, "string-suffix?");
+    LispObject *str = require_string(args, 1, "string-suffix?");
+    if (!suffix || !str) return LISP_FALSE;
+
+    size_t n = suffix->string.length;
+    return make_boolean(n <= str->string.length &&
+                        memcmp(str->string.data + str->string.length - n,
+                               suffix->string.data, n) == 0);
 }
 
 /* ============================================================
@@ -1738,129 +2256,155 @@ LispObject *prim_symbol_eq(LispObject *args) {
  * R7RS: Higher-order Functions
  * ============================================================ */
 
+/* Primitives known to keep no hold on their argument list (list, for
+ * one, returns it) */
+static const LispPrimitiveFn list_free_prims[] = {
+    prim_add, prim_sub, prim_mul, prim_div, prim_eq_num, prim_lt, prim_gt,
+    prim_le, prim_ge, prim_min, prim_max, prim_abs, prim_square,
+    prim_quotient, prim_remainder, prim_modulo, prim_zero_p,
+    prim_positive_p, prim_negative_p, prim_odd_p, prim_even_p,
+    prim_integer_p, prim_number_p, prim_null_p, prim_pair_p, prim_list_p,
+    prim_symbol_p, prim_string_p, prim_boolean_p, prim_not, prim_eq,
+    prim_equal, prim_car, prim_cdr, prim_cons, prim_string_length,
+    prim_vector_ref, prim_rcons, prim_rcount, NULL
+};
+
+/* Whether proc keeps no hold on the argument list it is called with, so
+ * that a loop may pass one list, updated in place, to call after call.
+ * A lambda without a rest parameter binds the elements, not the list. */
+static int args_reusable(LispObject *proc) {
+    if (is_primitive(proc)) {
+        for (int i = 0; list_free_prims[i] != NULL; i++) {
+            if (proc->primitive.func == list_free_prims[i]) return 1;
+        }
+        return 0;
+    }
+    if (!is_lambda(proc)) return 0;
+    LispObject *params = proc->lambda.params;
+    while (is_cons(params)) params = cdr(params);
+    return is_nil(params);
+}
+
+/* The argument list (a) or, if b is given, (a b) for one call in a
+ * loop: the list in *cell updated in place if reuse is set (once it
+ * has been made), or a new list.  The caller roots *cell. */
+static LispObject *loop_args(LispObject **cell, int reuse, LispObject *a, LispObject *b) {
+    if (reuse && *cell) {
+        (*cell)->cons.car = a;
+        if (b) (*cell)->cons.cdr->cons.car = b;
+        return *cell;
+    }
+    gc_pause();
+    LispObject *list = make_cons(a, b ? make_cons(b, make_nil()) : make_nil());
+    gc_resume();
+    if (reuse) *cell = list;
+    return list;
+}
+
+/* A walk of lists in step, as map and for-each make: a copy of the list
+ * of lists, moved on in place by walk_next */
+static LispObject *walk_lists(LispObject *lists) {
+    LispObject *head = make_nil();
+    LispObject *tail = NULL;
+    gc_pause();
+    for (; is_cons(lists); lists = cdr(lists)) {
+        LispObject *cell = make_cons(car(lists), make_nil());
+        if (tail) tail->cons.cdr = cell;
+        else head = cell;
+        tail = cell;
+    }
+    gc_resume();
+    return head;
+}
+
+/* Set *call_args to the next element of each list and move the lists
+ * on; returns 0 once a list has run out.  With reuse, *call_args is
+ * made once and updated in place. */
+static int walk_next(LispObject *walk, LispObject **call_args, int reuse) {
+    for (LispObject *l = walk; is_cons(l); l = cdr(l)) {
+        if (!is_cons(car(l))) return 0;
+    }
+
+    if (reuse && *call_args) {
+        LispObject *arg = *call_args;
+        for (LispObject *l = walk; is_cons(l); l = cdr(l)) {
+            arg->cons.car = car(car(l));
+            arg = cdr(arg);
+        }
+    } else {
+        LispObject *tail = NULL;
+        gc_pause();
+        for (LispObject *l = walk; is_cons(l); l = cdr(l)) {
+            LispObject *arg = make_cons(car(car(l)), make_nil());
+            if (tail) tail->cons.cdr = arg;
+            else *call_args = arg;
+            tail = arg;
+        }
+        gc_resume();
+    }
+
+    for (LispObject *l = walk; is_cons(l); l = cdr(l)) {
+        l->cons.car = cdr(car(l));
+    }
+    return 1;
+}
+
 LispObject *prim_map(LispObject *args) {
     LispObject *proc = require_arg(args, 0, "map");
     if (!proc) return make_nil();
-
-    /* Collect lists */
-    LispObject *lists = cdr(args);
-    if (!is_cons(lists)) {
+    if (!is_cons(cdr(args))) {
         lisp_error("map: requires at least one list");
         return make_nil();
     }
 
-    LispObject *result = make_nil();
-    LispObject *result_tail = NULL;
-
-    while (1) {
-        /* Check if any list is empty */
-        LispObject *l = lists;
-        while (is_cons(l)) {
-            if (!is_cons(car(l))) {
-                return result;
-            }
-            l = cdr(l);
-        }
-
-        /* Collect arguments (car of each list) */
-        LispObject *call_args = make_nil();
-        LispObject *call_tail = NULL;
-        l = lists;
-        while (is_cons(l)) {
-            LispObject *new_arg = make_cons(car(car(l)), make_nil());
-            if (call_tail) {
-                call_tail->cons.cdr = new_arg;
-            } else {
-                call_args = new_arg;
-            }
-            call_tail = new_arg;
-            l = cdr(l);
-        }
+    /* The result so far, the walk of the lists and the arguments are
+     * only held here while the procedure runs */
+    LispObject *slots[3] = { make_nil(), NULL, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 3);
+    slots[1] = walk_lists(cdr(args));
 
-        /* Apply procedure */
-        LispObject *value = apply(proc, call_args, NULL);
+    int reuse = args_reusable(proc);
+    LispObject *result_tail = NULL;
+    while (walk_next(slots[1], &slots[2], reuse)) {
+        LispObject *value = apply(proc, slots[2], NULL);
 
-        /* Add to result */
+        gc_pause();
         LispObject *new_cell = make_cons(value, make_nil());
+        gc_resume();
         if (result_tail) {
             result_tail->cons.cdr = new_cell;
         } else {
-            result = new_cell;
+            slots[0] = new_cell;
         }
         result_tail = new_cell;
-
-        /* Advance all lists */
-        LispObject *new_lists = make_nil();
-        LispObject *new_lists_tail = NULL;
-        l = lists;
-        while (is_cons(l)) {
-            LispObject *new_list = make_cons(cdr(car(l)), make_nil());
-            if (new_lists_tail) {
-                new_lists_tail->cons.cdr = new_list;
-            } else {
-                new_lists = new_list;
-            }
-            new_lists_tail = new_list;
-            l = cdr(l);
-        }
-        lists = new_lists;
     }
+
+    gc_pop_frame(&frame);
+    return slots[0];
 }
 
 LispObject *prim_for_each(LispObject *args) {
     LispObject *proc = require_arg(args, 0, "for-each");
     if (!proc) return make_nil();
-
-    LispObject *lists = cdr(args);
-    if (!is_cons(lists)) {
+    if (!is_cons(cdr(args))) {
         lisp_error("for-each: requires at least one list");
         return make_nil();
     }
 
-    while (1) {
-        /* Check if any list is empty */
-        LispObject *l = lists;
-        while (is_cons(l)) {
-            if (!is_cons(car(l))) {
-                return make_nil();
-            }
-            l = cdr(l);
-        }
-
-        /* Collect arguments */
-        LispObject *call_args = make_nil();
-        LispObject *call_tail = NULL;
-        l = lists;
-        while (is_cons(l)) {
-            LispObject *new_arg = make_cons(car(car(l)), make_nil());
-            if (call_tail) {
-                call_tail->cons.cdr = new_arg;
-            } else {
-                call_args = new_arg;
-            }
-            call_tail = new_arg;
-            l = cdr(l);
-        }
+    /* The walk of the lists and the arguments */
+    LispObject *slots[2] = { NULL, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+    slots[0] = walk_lists(cdr(args));
 
-        /* Apply procedure (discard result) */
-        apply(proc, call_args, NULL);
-
-        /* Advance all lists */
-        LispObject *new_lists = make_nil();
-        LispObject *new_lists_tail = NULL;
-        l = lists;
-        while (is_cons(l)) {
-            LispObject *new_list = make_cons(cdr(car(l)), make_nil());
-            if (new_lists_tail) {
-                new_lists_tail->cons.cdr = new_list;
-            } else {
-                new_lists = new_list;
-            }
-            new_lists_tail = new_list;
-            l = cdr(l);
-        }
-        lists = new_lists;
+    int reuse = args_reusable(proc);
+    while (walk_next(slots[0], &slots[1], reuse)) {
+        apply(proc, slots[1], NULL);
     }
+
+    gc_pop_frame(&frame);
+    return make_nil();
 }
 
 LispObject *prim_filter(LispObject *args) {
@@ -1868,19 +2412,23 @@ LispObject *prim_filter(LispObject *args) {
     LispObject *lst = require_arg(args, 1, "filter");
     if (!proc || !lst) return make_nil();
 
-    LispObject *result = make_nil();
-    LispObject *result_tail = NULL;
+    /* The result so far and the argument list */
+    LispObject *slots[2] = { make_nil(), NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
 
+    int reuse = args_reusable(proc);
+    LispObject *result_tail = NULL;
     while (is_cons(lst)) {
         LispObject *item = car(lst);
-        LispObject *test = apply(proc, make_cons(item, make_nil()), NULL);
+        LispObject *test = apply(proc, loop_args(&slots[1], reuse, item, NULL), NULL);
 
         if (is_true(test)) {
             LispObject *new_cell = make_cons(item, make_nil());
             if (result_tail) {
                 result_tail->cons.cdr = new_cell;
             } else {
-                result = new_cell;
+                slots[0] = new_cell;
             }
             result_tail = new_cell;
         }
@@ -1888,7 +2436,8 @@ LispObject *prim_filter(LispObject *args) {
         lst = cdr(lst);
     }
 
-    return result;
+    gc_pop_frame(&frame);
+    return slots[0];
 }
 
 LispObject *prim_fold(LispObject *args) {
@@ -1897,14 +2446,19 @@ LispObject *prim_fold(LispObject *args) {
     LispObject *lst = require_arg(args, 2, "fold");
     if (!proc || !init || !lst) return make_nil();
 
-    LispObject *accum = init;
+    /* The accumulated value and the argument list */
+    LispObject *slots[2] = { init, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+
+    int reuse = args_reusable(proc);
     while (is_cons(lst)) {
-        LispObject *call_args = make_cons(car(lst), make_cons(accum, make_nil()));
-        accum = apply(proc, call_args, NULL);
+        slots[0] = apply(proc, loop_args(&slots[1], reuse, car(lst), slots[0]), NULL);
         lst = cdr(lst);
     }
 
-    return accum;
+    gc_pop_frame(&frame);
+    return slots[0];
 }
 
 LispObject *prim_fold_right(LispObject *args) {
@@ -1913,201 +2467,1890 @@ LispObject *prim_fold_right(LispObject *args) {
     LispObject *lst = require_arg(args, 2, "fold-right");
     if (!proc || !init || !lst) return make_nil();
 
-    /* Reverse the list first */
-    LispObject *reversed = list_reverse(lst);
+    /* The list reversed, the accumulated value and the argument list */
+    LispObject *slots[3] = { list_reverse(lst), init, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 3);
 
-    LispObject *accum = init;
-    while (is_cons(reversed)) {
-        LispObject *call_args = make_cons(car(reversed), make_cons(accum, make_nil()));
-        accum = apply(proc, call_args, NULL);
-        reversed = cdr(reversed);
+    int reuse = args_reusable(proc);
+    for (LispObject *reversed = slots[0]; is_cons(reversed); reversed = cdr(reversed)) {
+        slots[1] = apply(proc, loop_args(&slots[2], reuse, car(reversed), slots[1]), NULL);
     }
 
-    return accum;
+    gc_pop_frame(&frame);
+    return slots[1];
 }
 
-/* Register all primitives */
-void register_primitives(Environment *env) {
-    struct {
-        const char *name;
-        LispPrimitiveFn func;
-        int min_args;
-        int max_args;
-    } prims[] = {
-        /* List operations */
-        {"car",     prim_car,     1, 1},
-        {"cdr",     prim_cdr,     1, 1},
-        {"cons",    prim_cons,    2, 2},
-        {"list",    prim_list,    0, -1},
-        {"length",  prim_length,  1, 1},
-        {"append",  prim_append,  0, -1},
-        {"reverse", prim_reverse, 1, 1},
-
-        /* Type predicates */
-        {"null?",      prim_null_p,      1, 1},
-        {"pair?",      prim_pair_p,      1, 1},
-        {"number?",    prim_number_p,    1, 1},
-        {"symbol?",    prim_symbol_p,    1, 1},
-        {"string?",    prim_string_p,    1, 1},
-        {"procedure?", prim_procedure_p, 1, 1},
-        {"boolean?",   prim_boolean_p,   1, 1},
-
-        /* Arithmetic */
-        {"+",   prim_add, 0, -1},
-        {"-",   prim_sub, 1, -1},
-        {"*",   prim_mul, 0, -1},
-        {"/",   prim_div, 2, 2},
-        {"mod", prim_mod, 2, 2},
-        {"abs", prim_abs, 1, 1},
-
-        /* Comparison */
-        {"=",      prim_eq_num, 2, 2},
-        {"<",      prim_lt,     2, 2},
-        {">",      prim_gt,     2, 2},
-        {"<=",     prim_le,     2, 2},
-        {">=",     prim_ge,     2, 2},
-        {"eq?",    prim_eq,     2, 2},
-        {"equal?", prim_equal,  2, 2},
-
-        /* Boolean */
-        {"not", prim_not, 1, 1},
-
-        /* I/O */
-        {"display", prim_display, 1, 1},
-        {"newline", prim_newline, 0, 0},
-        {"print",   prim_print,   1, 1},
-
-        /* String operations */
-        {"string-length",   prim_string_length,   1, 1},
-        {"string-append",   prim_string_append,   0, -1},
-        {"string-ref",      prim_string_ref,      2, 2},
-        {"number->string",  prim_number_to_string, 1, 1},
-        {"string->number",  prim_string_to_number, 1, 1},
-        {"symbol->string",  prim_symbol_to_string, 1, 1},
-        {"string->symbol",  prim_string_to_symbol, 1, 1},
-
-        /* Utility */
-        {"apply", prim_apply, 2, 2},
-        {"error", prim_error, 0, -1},
-
-        /* R6RS: Vectors */
-        {"vector?",       prim_vector_p,       1, 1},
-        {"make-vector",   prim_make_vector,    1, 2},
-        {"vector",        prim_vector,         0, -1},
-        {"vector-length", prim_vector_length,  1, 1},
-        {"vector-ref",    prim_vector_ref,     2, 2},
-        {"vector-set!",   prim_vector_set,     3, 3},
-        {"vector->list",  prim_vector_to_list, 1, 1},
-        {"list->vector",  prim_list_to_vector, 1, 1},
-
-        /* R6RS: Bytevectors */
-        {"bytevector?",       prim_bytevector_p,       1, 1},
-        {"make-bytevector",   prim_make_bytevector,    1, 2},
-        {"bytevector-length", prim_bytevector_length,  1, 1},
-        {"bytevector-u8-ref", prim_bytevector_u8_ref,  2, 2},
-        {"bytevector-u8-set!", prim_bytevector_u8_set, 3, 3},
-
-        /* R6RS: Hashtables */
-        {"hashtable?",         prim_hashtable_p,         1, 1},
-        {"make-eq-hashtable",  prim_make_eq_hashtable,   0, 0},
-        {"make-eqv-hashtable", prim_make_eqv_hashtable,  0, 0},
-        {"make-hashtable",     prim_make_hashtable,      0, 2},
-        {"hashtable-ref",      prim_hashtable_ref,       3, 3},
-        {"hashtable-set!",     prim_hashtable_set,       3, 3},
-        {"hashtable-delete!",  prim_hashtable_delete,    2, 2},
-        {"hashtable-contains?", prim_hashtable_contains, 2, 2},
-        {"hashtable-size",     prim_hashtable_size,      1, 1},
-        {"hashtable-keys",     prim_hashtable_keys,      1, 1},
-
-        /* R6RS: Additional numeric */
-        {"floor",     prim_floor,     1, 1},
-        {"ceiling",   prim_ceiling,   1, 1},
-        {"truncate",  prim_truncate,  1, 1},
-        {"round",     prim_round,     1, 1},
-        {"sqrt",      prim_sqrt,      1, 1},
-        {"expt",      prim_expt,      2, 2},
-        {"log",       prim_log,       1, 1},
-        {"sin",       prim_sin,       1, 1},
-        {"cos",       prim_cos,       1, 1},
-        {"tan",       prim_tan,       1, 1},
-        {"quotient",  prim_quotient,  2, 2},
-        {"remainder", prim_remainder, 2, 2},
-        {"modulo",    prim_modulo,    2, 2},
-        {"integer?",  prim_integer_p, 1, 1},
-        {"real?",     prim_real_p,    1, 1},
-        {"zero?",     prim_zero_p,    1, 1},
-        {"positive?", prim_positive_p, 1, 1},
-        {"negative?", prim_negative_p, 1, 1},
-        {"odd?",      prim_odd_p,     1, 1},
-        {"even?",     prim_even_p,    1, 1},
-        {"min",       prim_min,       1, -1},
-        {"max",       prim_max,       1, -1},
-
-        /* R6RS: Additional list operations */
-        {"list?",     prim_list_p,    1, 1},
-        {"list-ref",  prim_list_ref,  2, 2},
-        {"list-tail", prim_list_tail, 2, 2},
-        {"memq",      prim_memq,      2, 2},
-        {"memv",      prim_memv,      2, 2},
-        {"member",    prim_member,    2, 2},
-        {"assq",      prim_assq,      2, 2},
-        {"assv",      prim_assv,      2, 2},
-        {"assoc",     prim_assoc,     2, 2},
-
-        /* R6RS: Characters */
-        {"char?",          prim_char_p,          1, 1},
-        {"char=?",         prim_char_eq,         2, 2},
-        {"char<?",         prim_char_lt,         2, 2},
-        {"char->integer",  prim_char_to_integer, 1, 1},
-        {"integer->char",  prim_integer_to_char, 1, 1},
-
-        /* R7RS: Multiple values */
-        {"values",           prim_values,           0, -1},
-        {"call-with-values", prim_call_with_values, 2, 2},
-
-        /* R7RS: List operations */
-        {"make-list",  prim_make_list,  1, 2},
-        {"list-copy",  prim_list_copy,  1, 1},
-        {"list-set!",  prim_list_set,   3, 3},
-
-        /* R7RS: Vector operations */
-        {"vector-copy",   prim_vector_copy,   1, 3},
-        {"vector-fill!",  prim_vector_fill,   2, 4},
-        {"vector-append", prim_vector_append, 0, -1},
-
-        /* R7RS: String operations */
-        {"string-copy", prim_string_copy, 1, 3},
-        {"substring",   prim_substring,   3, 3},
-        {"string=?",    prim_string_eq,   2, 2},
-        {"string<?",    prim_string_lt,   2, 2},
-
-        /* R7RS: Numeric operations */
-        {"square",    prim_square,     1, 1},
-        {"exact",     prim_exact,      1, 1},
-        {"inexact",   prim_inexact,    1, 1},
-        {"finite?",   prim_finite_p,   1, 1},
-        {"infinite?", prim_infinite_p, 1, 1},
-        {"nan?",      prim_nan_p,      1, 1},
-        {"gcd",       prim_gcd,        0, -1},
-        {"lcm",       prim_lcm,        0, -1},
-
-        /* R7RS: Equivalence */
-        {"boolean=?", prim_boolean_eq, 1, -1},
-        {"symbol=?",  prim_symbol_eq,  1, -1},
-
-        /* R7RS: Higher-order functions */
-        {"map",        prim_map,        2, -1},
-        {"for-each",   prim_for_each,   2, -1},
-        {"filter",     prim_filter,     2, 2},
-        {"fold",       prim_fold,       3, 3},
-        {"fold-right", prim_fold_right, 3, 3},
-
-        {NULL, NULL, 0, 0}
-    };
-
-    for (int i = 0; prims[i].name != NULL; i++) {
-        LispObject *prim = make_primitive(prims[i].name, prims[i].func,
-                                          prims[i].min_args, prims[i].max_args);
-        env_define(env, make_symbol(prims[i].name), prim);
+/* ============================================================
+ * SRFI-171: Transducers
+ * ============================================================ */
+
+/* A transducer is a record of type transducer whose one field lists its
+ * stages in order, each (map . proc), (filter . pred), (take . count) or
+ * (drop . count).  Being data rather than a procedure wrapping a
+ * reducer, a transducer runs as one loop over the stages, with no
+ * closure or intermediate list per stage.  The type is made by lisp_init
+ * (LISP_TRANSDUCER_TYPE). */
+static LispObject *make_transducer(LispObject *stages) {
+    gc_pause();
+    LispObject *transducer = make_record(LISP_TRANSDUCER_TYPE);
+    RECORD_FIELDS(transducer)[0] = stages;
+    gc_resume();
+    return transducer;
+}
+
+static int is_transducer(LispObject *obj) {
+    return is_record(obj) && obj->record.rtd == LISP_TRANSDUCER_TYPE;
+}
+
+/* A transducer of the one stage (kind . arg) */
+static LispObject *transducer_stage(const char *kind, LispObject *arg) {
+    gc_pause();
+    LispObject *stages = make_cons(make_cons(make_symbol(kind), arg), make_nil());
+    gc_resume();
+    return make_transducer(stages);
+}
+
+/* (tmap proc) - each element as proc maps it */
+LispObject *prim_tmap(LispObject *args) {
+    LispObject *proc = require_arg(args, 0, "tmap");
+    if (!proc) return make_nil();
+    if (!is_callable(proc)) {
+        lisp_error("tmap: expected procedure, got %s", lisp_type_name(proc->type));
+        return make_nil();
+    }
+    return transducer_stage("map", proc);
+}
+
+/* (tfilter pred) - the elements pred accepts */
+LispObject *prim_tfilter(LispObject *args) {
+    LispObject *pred = require_arg(args, 0, "tfilter");
+    if (!pred) return make_nil();
+    if (!is_callable(pred)) {
+        lisp_error("tfilter: expected procedure, got %s", lisp_type_name(pred->type));
+        return make_nil();
+    }
+    return transducer_stage("filter", pred);
+}
+
+/* (ttake n) - the first n elements, then the transduction stops */
+LispObject *prim_ttake(LispObject *args) {
+    LispObject *n = require_arg(args, 0, "ttake");
+    if (!n) return make_nil();
+    if (!require_type(n, LISP_NUMBER, "ttake")) return make_nil();
+    return transducer_stage("take", n);
+}
+
+/* (tdrop n) - all but the first n elements */
+LispObject *prim_tdrop(LispObject *args) {
+    LispObject *n = require_arg(args, 0, "tdrop");
+    if (!n) return make_nil();
+    if (!require_type(n, LISP_NUMBER, "tdrop")) return make_nil();
+    return transducer_stage("drop", n);
+}
+
+/* (compose transducer ...) - a transducer making the transformations of
+ * each in turn, the first first */
+LispObject *prim_compose(LispObject *args) {
+    for (LispObject *a = args; is_cons(a); a = cdr(a)) {
+        if (!is_transducer(car(a))) {
+            lisp_error("compose: expected transducer, got %s", lisp_type_name(car(a)->type));
+            return make_nil();
+        }
+    }
+
+    LispObject *stages = make_nil();
+    LispObject *tail = NULL;
+    gc_pause();
+    for (LispObject *a = args; is_cons(a); a = cdr(a)) {
+        for (LispObject *s = RECORD_FIELDS(car(a))[0]; is_cons(s); s = cdr(s)) {
+            LispObject *cell = make_cons(car(s), make_nil());
+            if (tail) tail->cons.cdr = cell;
+            else stages = cell;
+            tail = cell;
+        }
+    }
+    LispObject *transducer = make_transducer(stages);
+    gc_resume();
+    return transducer;
+}
+
+/* (rcons), (rcons list), (rcons list x) - the reducer collecting a list */
+LispObject *prim_rcons(LispObject *args) {
+    if (!is_cons(args)) return make_nil();
+    if (!is_cons(cdr(args))) return list_reverse(car(args));
+    return make_cons(cadr(args), car(args));
+}
+
+/* (rcount), (rcount n), (rcount n x) - the reducer counting elements */
+LispObject *prim_rcount(LispObject *args) {
+    if (!is_cons(args)) return make_number(0);
+    LispObject *n = car(args);
+    if (!require_type(n, LISP_NUMBER, "rcount")) return make_number(0);
+    return is_cons(cdr(args)) ? make_number(n->number + 1) : n;
+}
+
+typedef enum {
+    STAGE_MAP,
+    STAGE_FILTER,
+    STAGE_TAKE,
+    STAGE_DROP
+} StageKind;
+
+typedef struct {
+    StageKind kind;
+    LispObject *proc;
+    double count;               /* Elements still to take or drop */
+    int reuse;                  /* args_reusable(proc) */
+} Stage;
+
+/* One run of a transducer into a reducer */
+typedef struct {
+    Stage *stages;
+    int stage_count;
+    LispObject *reducer;        /* Rooted by the caller's arguments */
+    int reuse;
+    int last;                   /* A take stage has had its last element */
+    /* The accumulated value, the element, and the argument lists of
+     * the stages and the reducer */
+    LispObject *slots[4];
+} Transduction;
+
+/* Pass x through the stages and into the reducer; returns 0 once the
+ * transduction is complete */
+static int transduce_element(Transduction *t, LispObject *x) {
+    t->slots[1] = x;
+    for (int i = 0; i < t->stage_count; i++) {
+        Stage *stage = &t->stages[i];
+        switch (stage->kind) {
+            case STAGE_MAP:
+                t->slots[1] = apply(stage->proc, loop_args(&t->slots[2], stage->reuse,
+                                                           t->slots[1], NULL), NULL);
+                break;
+            case STAGE_FILTER:
+                if (!is_true(apply(stage->proc, loop_args(&t->slots[2], stage->reuse,
+                                                          t->slots[1], NULL), NULL))) {
+                    return 1;
+                }
+                break;
+            case STAGE_TAKE:
+                if (stage->count < 1) return 0;
+                if (--stage->count < 1) t->last = 1;
+                break;
+            case STAGE_DROP:
+                if (stage->count >= 1) {
+                    stage->count--;
+                    return 1;
+                }
+                break;
+        }
+    }
+    t->slots[0] = apply(t->reducer, loop_args(&t->slots[3], t->reuse,
+                                              t->slots[0], t->slots[1]), NULL);
+    return !t->last;
+}
+
+/* Set up the stages of a transducer; returns 0 if out of memory */
+static int transduction_init(Transduction *t, LispObject *transducer, LispObject *reducer) {
+    memset(t, 0, sizeof(*t));
+    t->reducer = reducer;
+    t->reuse = args_reusable(reducer);
+
+    LispObject *stages = RECORD_FIELDS(transducer)[0];
+    t->stage_count = list_length(stages);
+    if (t->stage_count == 0) return 1;
+    t->stages = (Stage *)malloc((size_t)t->stage_count * sizeof(Stage));
+    if (!t->stages) return 0;
+
+    for (int i = 0; i < t->stage_count; i++, stages = cdr(stages)) {
+        Stage *stage = &t->stages[i];
+        LispObject *kind = car(car(stages));
+        LispObject *arg = cdr(car(stages));
+        stage->kind = is_symbol_named(kind, "map") ? STAGE_MAP :
+                      is_symbol_named(kind, "filter") ? STAGE_FILTER :
+                      is_symbol_named(kind, "take") ? STAGE_TAKE : STAGE_DROP;
+        stage->proc = arg;
+        stage->count = is_number(arg) ? arg->number : 0;
+        stage->reuse = args_reusable(arg);
+    }
+    return 1;
+}
+
+/* list-transduce and vector-transduce: (xform reducer [init] source) */
+static LispObject *transduce(LispObject *args, const char *name, LispType source_type) {
+    LispObject *xform = require_arg(args, 0, name);
+    LispObject *reducer = require_arg(args, 1, name);
+    LispObject *source = require_arg(args, list_length(args) - 1, name);
+    if (!xform || !reducer || !source) return make_nil();
+    if (!is_callable(reducer)) {
+        lisp_error("%s: expected procedure, got %s", name, lisp_type_name(reducer->type));
+        return make_nil();
+    }
+    if (source_type == LISP_VECTOR) {
+        if (!require_type(source, LISP_VECTOR, name)) return make_nil();
+    } else if (!is_list(source)) {
+        lisp_error("%s: expected list, got %s", name, lisp_type_name(source->type));
+        return make_nil();
+    }
+
+    /* A transducer written as a procedure of a reducer (as SRFI-171
+     * defines them) runs through the reducer it returns */
+    if (!is_transducer(xform)) {
+        if (!is_callable(xform)) {
+            lisp_error("%s: expected transducer, got %s", name, lisp_type_name(xform->type));
+            return make_nil();
+        }
+        reducer = apply(xform, make_cons(reducer, make_nil()), NULL);
+        if (!is_callable(reducer)) {
+            lisp_error("%s: transducer returned %s, not a procedure",
+                       name, lisp_type_name(reducer->type));
+            return make_nil();
+        }
+        xform = make_transducer(make_nil());
+    }
+
+    /* The reducer and transducer, made here or held by args */
+    LispObject *held[2] = { reducer, xform };
+    GCFrame held_frame;
+    gc_push_frame(&held_frame, held, 2);
+
+    Transduction t;
+    if (!transduction_init(&t, xform, reducer)) {
+        gc_pop_frame(&held_frame);
+        lisp_error("%s: out of memory", name);
+        return make_nil();
+    }
+    GCFrame frame;
+    gc_push_frame(&frame, t.slots, 4);
+
+    t.slots[0] = list_length(args) == 4 ? caddr(args) : apply(reducer, make_nil(), NULL);
+    if (source_type == LISP_VECTOR) {
+        for (size_t i = 0; i < source->vector.length; i++) {
+            if (!transduce_element(&t, source->vector.elements[i])) break;
+        }
+    } else {
+        for (LispObject *l = source; is_cons(l); l = cdr(l)) {
+            if (!transduce_element(&t, car(l))) break;
+        }
+    }
+
+    /* Completion: the reducer of the accumulated value alone */
+    LispObject *result = apply(reducer, make_cons(t.slots[0], make_nil()), NULL);
+
+    gc_pop_frame(&frame);
+    gc_pop_frame(&held_frame);
+    free(t.stages);
+    return result;
+}
+
+/* (list-transduce xform reducer [init] list) */
+LispObject *prim_list_transduce(LispObject *args) {
+    return transduce(args, "list-transduce", LISP_CONS);
+}
+
+/* (vector-transduce xform reducer [init] vector) */
+LispObject *prim_vector_transduce(LispObject *args) {
+    return transduce(args, "vector-transduce", LISP_VECTOR);
+}
+
+/* ============================================================
+ * Runtime: GC telemetry
+ * ============================================================ */
+
+/* (gc-statistics) - telemetry of the collector as an alist (see
+ * gc_statistics in lisp.h) */
+LispObject *prim_gc_statistics(LispObject *args) {
+    (void)args;
+    return gc_statistics();
+}
+
+/* ============================================================
+ * SRFI-18: Threads and Mutexes
+ * ============================================================ */
+
+/* Optional name argument (nil if absent) */
+static LispObject *optional_name(LispObject *args) {
+    return is_cons(args) && is_cons(cdr(args)) ? car(cdr(args)) : make_nil();
+}
+
+/* (make-thread thunk [name]) */
+LispObject *prim_make_thread(LispObject *args) {
+    LispObject *thunk = require_arg(args, 0, "make-thread");
+    if (!thunk) return make_nil();
+    if (!is_callable(thunk)) {
+        lisp_error("make-thread: expected procedure, got %s", lisp_type_name(thunk->type));
+        return make_nil();
+    }
+    return make_thread(thunk, optional_name(args));
+}
+
+LispObject *prim_thread_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "thread?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_thread(obj));
+}
+
+LispObject *prim_thread_name(LispObject *args) {
+    LispObject *thread = require_arg(args, 0, "thread-name");
+    if (!thread) return make_nil();
+    if (!require_type(thread, LISP_THREAD, "thread-name")) return make_nil();
+    return thread->thread.name;
+}
+
+/* (thread-start! thread) - returns the thread */
+LispObject *prim_thread_start(LispObject *args) {
+    LispObject *thread = require_arg(args, 0, "thread-start!");
+    if (!thread) return make_nil();
+    if (!require_type(thread, LISP_THREAD, "thread-start!")) return make_nil();
+    if (thread_start(thread) != 0) return make_nil();
+    return thread;
+}
+
+/* (thread-join! thread) - the value of the thread's thunk */
+LispObject *prim_thread_join(LispObject *args) {
+    LispObject *thread = require_arg(args, 0, "thread-join!");
+    if (!thread) return make_nil();
+    if (!require_type(thread, LISP_THREAD, "thread-join!")) return make_nil();
+    return thread_join(thread);
+}
+
+/* (make-mutex [name]) */
+LispObject *prim_make_mutex(LispObject *args) {
+    return make_mutex(is_cons(args) ? car(args) : make_nil());
+}
+
+LispObject *prim_mutex_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "mutex?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_mutex(obj));
+}
+
+LispObject *prim_mutex_lock(LispObject *args) {
+    LispObject *mutex = require_arg(args, 0, "mutex-lock!");
+    if (!mutex) return make_nil();
+    if (!require_type(mutex, LISP_MUTEX, "mutex-lock!")) return make_nil();
+    mutex_lock(mutex);
+    return LISP_TRUE;
+}
+
+LispObject *prim_mutex_unlock(LispObject *args) {
+    LispObject *mutex = require_arg(args, 0, "mutex-unlock!");
+    if (!mutex) return make_nil();
+    if (!require_type(mutex, LISP_MUTEX, "mutex-unlock!")) return make_nil();
+    if (mutex_unlock(mutex) != 0) return make_nil();
+    return LISP_TRUE;
+}
+
+/* ============================================================
+ * R7RS: Promises
+ * ============================================================ */
+
+LispObject *prim_force(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "force");
+    if (!obj) return make_nil();
+    return promise_force(obj);
+}
+
+/* (make-promise obj) - a promise already forced to obj, or obj if it
+ * is a promise */
+LispObject *prim_make_promise(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "make-promise");
+    if (!obj) return make_nil();
+    return is_promise(obj) ? obj : make_promise(PROMISE_DONE, obj);
+}
+
+LispObject *prim_promise_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "promise?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_promise(obj));
+}
+
+/* ============================================================
+ * SRFI-41: Streams
+ * ============================================================ */
+
+/* Helper to get a required stream argument */
+static LispObject *require_stream(LispObject *args, int n, const char *func_name) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj) return NULL;
+    if (!is_promise(obj)) {
+        lisp_error("%s: expected stream, got %s", func_name, lisp_type_name(obj->type));
+        return NULL;
+    }
+    return obj;
+}
+
+/* Helper to get a required procedure argument */
+static LispObject *require_procedure(LispObject *args, int n, const char *func_name) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj) return NULL;
+    if (!is_callable(obj)) {
+        lisp_error("%s: expected procedure, got %s", func_name, lisp_type_name(obj->type));
+        return NULL;
+    }
+    return obj;
+}
+
+/* Helper to get a required count argument (a number of elements) */
+static LispObject *require_count(LispObject *args, int n, const char *func_name) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj) return NULL;
+    if (!require_type(obj, LISP_NUMBER, func_name)) return NULL;
+    if (obj->number < 0) {
+        lisp_error("%s: count must be non-negative", func_name);
+        return NULL;
+    }
+    return obj;
+}
+
+LispObject *prim_stream_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "stream?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_promise(obj));
+}
+
+LispObject *prim_stream_pair_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "stream-pair?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_promise(obj) && is_cons(promise_force(obj)));
+}
+
+LispObject *prim_stream_null_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "stream-null?");
+    if (!obj) return LISP_FALSE;
+    return make_boolean(is_promise(obj) && is_nil(promise_force(obj)));
+}
+
+/* The pair of a stream that must not be empty */
+static LispObject *stream_pair(LispObject *args, const char *func_name) {
+    LispObject *stream = require_stream(args, 0, func_name);
+    if (!stream) return NULL;
+    LispObject *pair = stream_force(stream, func_name);
+    if (pair && is_nil(pair)) {
+        lisp_error("%s: empty stream", func_name);
+        return NULL;
+    }
+    return pair;
+}
+
+LispObject *prim_stream_car(LispObject *args) {
+    LispObject *pair = stream_pair(args, "stream-car");
+    if (!pair) return make_nil();
+    return promise_force(car(pair));
+}
+
+LispObject *prim_stream_cdr(LispObject *args) {
+    LispObject *pair = stream_pair(args, "stream-cdr");
+    if (!pair) return make_nil();
+    return cdr(pair);
+}
+
+/* (stream-range first past [step]) - step is 1, or -1 if past is below
+ * first, when not given */
+LispObject *prim_stream_range(LispObject *args) {
+    LispObject *first = require_arg(args, 0, "stream-range");
+    LispObject *past = require_arg(args, 1, "stream-range");
+    if (!first || !past) return make_nil();
+    if (!require_type(first, LISP_NUMBER, "stream-range") ||
+        !require_type(past, LISP_NUMBER, "stream-range")) return make_nil();
+
+    LispObject *step = is_cons(cddr(args)) ? caddr(args) : NULL;
+    if (step && !require_type(step, LISP_NUMBER, "stream-range")) return make_nil();
+    if (!step) step = make_number(past->number < first->number ? -1 : 1);
+
+    /* The step updates its arguments: give it a list of its own */
+    gc_pause();
+    LispObject *stream = make_stream(STREAM_RANGE, make_cons(first, make_cons(past, make_cons(step, make_nil()))));
+    gc_resume();
+    return stream;
+}
+
+LispObject *prim_list_to_stream(LispObject *args) {
+    LispObject *list = require_arg(args, 0, "list->stream");
+    if (!list) return make_nil();
+    if (!is_list(list)) {
+        lisp_error("list->stream: expected list, got %s", lisp_type_name(list->type));
+        return make_nil();
+    }
+    return make_stream(STREAM_LIST, list);
+}
+
+/* (stream-map proc stream ...) - ends with the shortest stream */
+LispObject *prim_stream_map(LispObject *args) {
+    if (!require_procedure(args, 0, "stream-map")) return make_nil();
+    for (LispObject *rest = cdr(args); is_cons(rest); rest = cdr(rest)) {
+        if (!is_promise(car(rest))) {
+            lisp_error("stream-map: expected stream, got %s", lisp_type_name(car(rest)->type));
+            return make_nil();
+        }
+    }
+    return make_stream(STREAM_MAP, args);
+}
+
+/* A stream of op on a new list of a and b (the step may update it) */
+static LispObject *make_stream_args(StreamOp op, LispObject *a, LispObject *b) {
+    gc_pause();
+    LispObject *stream = make_stream(op, make_cons(a, make_cons(b, make_nil())));
+    gc_resume();
+    return stream;
+}
+
+LispObject *prim_stream_filter(LispObject *args) {
+    LispObject *pred = require_procedure(args, 0, "stream-filter");
+    LispObject *stream = require_stream(args, 1, "stream-filter");
+    if (!pred || !stream) return make_nil();
+    return make_stream_args(STREAM_FILTER, pred, stream);
+}
+
+/* (stream-take count stream) - the first count elements */
+LispObject *prim_stream_take(LispObject *args) {
+    LispObject *count = require_count(args, 0, "stream-take");
+    LispObject *stream = require_stream(args, 1, "stream-take");
+    if (!count || !stream) return make_nil();
+    return make_stream_args(STREAM_TAKE, count, stream);
+}
+
+/* (stream-drop count stream) - all but the first count elements */
+LispObject *prim_stream_drop(LispObject *args) {
+    LispObject *count = require_count(args, 0, "stream-drop");
+    LispObject *stream = require_stream(args, 1, "stream-drop");
+    if (!count || !stream) return make_nil();
+    return make_stream_args(STREAM_DROP, count, stream);
+}
+
+/* The consumers below hold the stream only where they have got to:
+ * once they have rooted it they release the argument list, which holds
+ * its head (see gc_release_args).  They move on from a pair once they
+ * are done with its element. */
+
+/* (stream-ref stream n) */
+LispObject *prim_stream_ref(LispObject *args) {
+    LispObject *stream = require_stream(args, 0, "stream-ref");
+    LispObject *n = require_count(args, 1, "stream-ref");
+    if (!stream || !n) return make_nil();
+
+    GCFrame frame;
+    gc_push_frame(&frame, &stream, 1);
+    gc_release_args(args);
+
+    LispObject *result = make_nil();
+    for (double i = n->number; ; i--) {
+        LispObject *pair = stream_force(stream, "stream-ref");
+        if (!pair) break;
+        if (is_nil(pair)) {
+            lisp_error("stream-ref: index %g out of range", n->number);
+            break;
+        }
+        if (i < 1) {
+            result = promise_force(car(pair));
+            break;
+        }
+        stream = cdr(pair);
+    }
+
+    gc_pop_frame(&frame);
+    return result;
+}
+
+/* (stream-fold proc base stream) - calls (proc accumulated element) for
+ * each element, as SRFI-41 does (fold calls (proc element accumulated)) */
+LispObject *prim_stream_fold(LispObject *args) {
+    LispObject *slots[3];
+    slots[0] = require_procedure(args, 0, "stream-fold");
+    slots[1] = require_arg(args, 1, "stream-fold");
+    slots[2] = require_stream(args, 2, "stream-fold");
+    if (!slots[0] || !slots[1] || !slots[2]) return make_nil();
+
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 3);
+    gc_release_args(args);
+
+    for (;;) {
+        LispObject *pair = stream_force(slots[2], "stream-fold");
+        if (!pair || is_nil(pair)) break;
+        LispObject *item = promise_force(car(pair));
+        gc_pause();
+        LispObject *call_args = make_cons(slots[1], make_cons(item, make_nil()));
+        gc_resume();
+        slots[2] = cdr(pair);
+        slots[1] = apply(slots[0], call_args, NULL);
+    }
+
+    gc_pop_frame(&frame);
+    return slots[1];
+}
+
+LispObject *prim_stream_for_each(LispObject *args) {
+    LispObject *slots[2];
+    slots[0] = require_procedure(args, 0, "stream-for-each");
+    slots[1] = require_stream(args, 1, "stream-for-each");
+    if (!slots[0] || !slots[1]) return make_nil();
+
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+    gc_release_args(args);
+
+    for (;;) {
+        LispObject *pair = stream_force(slots[1], "stream-for-each");
+        if (!pair || is_nil(pair)) break;
+        LispObject *call_args = make_cons(promise_force(car(pair)), make_nil());
+        slots[1] = cdr(pair);
+        apply(slots[0], call_args, NULL);
+    }
+
+    gc_pop_frame(&frame);
+    return make_nil();
+}
+
+/* (stream->list [count] stream) - the elements, or the first count */
+LispObject *prim_stream_to_list(LispObject *args) {
+    int counted = is_cons(cdr(args));
+    LispObject *count = counted ? require_count(args, 0, "stream->list") : NULL;
+    LispObject *slots[2] = { require_stream(args, counted, "stream->list"), NULL };
+    if ((counted && !count) || !slots[0]) return make_nil();
+
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+    gc_release_args(args);
+
+    LispObject *tail = NULL;
+    for (double i = 0; !count || i < count->number; i++) {
+        LispObject *pair = stream_force(slots[0], "stream->list");
+        if (!pair || is_nil(pair)) break;
+        LispObject *cell = make_cons(promise_force(car(pair)), make_nil());
+        slots[0] = cdr(pair);
+        if (tail) tail->cons.cdr = cell;
+        else slots[1] = cell;
+        tail = cell;
+    }
+
+    gc_pop_frame(&frame);
+    return slots[1] ? slots[1] : make_nil();
+}
+
+/* ============================================================
+ * SRFI-4: Numeric Vectors
+ * ============================================================ */
+
+/* Each kind has the SRFI-4 procedures, made by NUMVEC_PRIMS from the
+ * functions below; u8 vectors are bytevectors.  The numvector- bulk
+ * operations take vectors of any kind, bytevectors included, and run
+ * in the kernels of numvec.c. */
+
+/* Helper for a vector argument of kind, or of any kind if kind is
+ * NUMVEC_KIND_COUNT: sets its elements, length and kind, and returns 0
+ * after reporting an error if it is not one */
+static int require_numvec(LispObject *args, int n, int kind, const char *func_name,
+                          void **data, size_t *length, NumvecKind *actual) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj) return 0;
+    int is_vector = numvec_view(obj, data, length, actual);
+    if (is_vector && (kind == NUMVEC_KIND_COUNT || *actual == (NumvecKind)kind)) return 1;
+
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%svector",
+             kind == NUMVEC_KIND_COUNT ? "numeric " : numvec_tag((NumvecKind)kind));
+    if (is_vector) {
+        lisp_error("%s: expected %s, got %svector", func_name, expected, numvec_tag(*actual));
+    } else {
+        lisp_error("%s: expected %s, got %s", func_name, expected, lisp_type_name(obj->type));
+    }
+    return 0;
+}
+
+/* Helper for a value to store in a vector of kind */
+static int numvec_value(LispObject *obj, NumvecKind kind, double *value,
+                        const char *func_name) {
+    if (!require_type(obj, LISP_NUMBER, func_name)) return 0;
+    if (!numvec_fits(kind, obj->number)) {
+        lisp_error("%s: %g out of range for %svector", func_name, obj->number,
+                   numvec_tag(kind));
+        return 0;
+    }
+    *value = obj->number;
+    return 1;
+}
+
+/* Helper for an index below length */
+static int numvec_index(LispObject *obj, size_t length, size_t *index,
+                        const char *func_name) {
+    if (!require_type(obj, LISP_NUMBER, func_name)) return 0;
+    if (obj->number < 0 || obj->number >= (double)length ||
+        obj->number != floor(obj->number)) {
+        lisp_error("%s: index %g out of range", func_name, obj->number);
+        return 0;
+    }
+    *index = (size_t)obj->number;
+    return 1;
+}
+
+static LispObject *numvec_p(LispObject *args, NumvecKind kind, const char *func_name) {
+    LispObject *obj = require_arg(args, 0, func_name);
+    void *data;
+    size_t length;
+    NumvecKind actual;
+    return make_boolean(obj && numvec_view(obj, &data, &length, &actual) && actual == kind);
+}
+
+static LispObject *numvec_make(LispObject *args, NumvecKind kind, const char *func_name) {
+    LispObject *len_obj = require_arg(args, 0, func_name);
+    if (!len_obj || !require_type(len_obj, LISP_NUMBER, func_name)) return make_nil();
+    if (len_obj->number < 0 || len_obj->number != floor(len_obj->number)) {
+        lisp_error("%s: invalid length %g", func_name, len_obj->number);
+        return make_nil();
+    }
+
+    double fill = 0;
+    if (is_cons(cdr(args)) && !numvec_value(cadr(args), kind, &fill, func_name)) {
+        return make_nil();
+    }
+
+    LispObject *vec = make_numvector(kind, (size_t)len_obj->number);
+    void *data;
+    size_t length;
+    if (fill != 0 && numvec_view(vec, &data, &length, &kind)) {
+        numvec_fill(data, length, kind, fill);
+    }
+    return vec;
+}
+
+/* A vector of the numbers in list, the arguments of (f64vector ...) or
+ * the list of list->f64vector */
+static LispObject *numvec_from_list(LispObject *list, NumvecKind kind,
+                                    const char *func_name) {
+    size_t count = 0;
+    for (LispObject *l = list; is_cons(l); l = cdr(l)) {
+        double value;
+        if (!numvec_value(car(l), kind, &value, func_name)) return make_nil();
+        count++;
+    }
+
+    LispObject *vec = make_numvector(kind, count);
+    void *data;
+    size_t length;
+    if (!numvec_view(vec, &data, &length, &kind)) return vec;
+    size_t i = 0;
+    for (LispObject *l = list; is_cons(l) && i < length; l = cdr(l)) {
+        numvec_set(data, kind, i++, car(l)->number);
+    }
+    return vec;
+}
+
+static LispObject *numvec_length_of(LispObject *args, NumvecKind kind,
+                                    const char *func_name) {
+    void *data;
+    size_t length;
+    if (!require_numvec(args, 0, kind, func_name, &data, &length, &kind)) return make_number(0);
+    return make_number((double)length);
+}
+
+static LispObject *numvec_ref(LispObject *args, NumvecKind kind, const char *func_name) {
+    void *data;
+    size_t length;
+    size_t index;
+    LispObject *idx = require_arg(args, 1, func_name);
+    if (!idx || !require_numvec(args, 0, kind, func_name, &data, &length, &kind) ||
+        !numvec_index(idx, length, &index, func_name)) {
+        return make_number(0);
+    }
+    return make_number(numvec_get(data, kind, index));
+}
+
+static LispObject *numvec_set_at(LispObject *args, NumvecKind kind, const char *func_name) {
+    void *data;
+    size_t length;
+    size_t index;
+    double value;
+    LispObject *idx = require_arg(args, 1, func_name);
+    LispObject *val = require_arg(args, 2, func_name);
+    if (!idx || !val || !require_numvec(args, 0, kind, func_name, &data, &length, &kind) ||
+        !numvec_index(idx, length, &index, func_name) ||
+        !numvec_value(val, kind, &value, func_name)) {
+        return make_nil();
+    }
+    numvec_set(data, kind, index, value);
+    return make_nil();
+}
+
+static LispObject *numvec_to_list(LispObject *args, NumvecKind kind, const char *func_name) {
+    void *data;
+    size_t length;
+    if (!require_numvec(args, 0, kind, func_name, &data, &length, &kind)) return make_nil();
+
+    /* From the end, so each pair is made once */
+    LispObject *result = make_nil();
+    gc_pause();
+    for (size_t i = length; i > 0; i--) {
+        result = make_cons(make_number(numvec_get(data, kind, i - 1)), result);
+    }
+    gc_resume();
+    return result;
+}
+
+/* The SRFI-4 procedures of one kind */
+#define NUMVEC_PRIMS(tag, kind)                                             \
+    LispObject *prim_##tag##vector_p(LispObject *args) {                    \
+        return numvec_p(args, kind, #tag "vector?");                        \
+    }                                                                       \
+    LispObject *prim_make_##tag##vector(LispObject *args) {                 \
+        return numvec_make(args, kind, "make-" #tag "vector");              \
+    }                                                                       \
+    LispObject *prim_##tag##vector(LispObject *args) {                      \
+        return numvec_from_list(args, kind, #tag "vector");                 \
+    }                                                                       \
+    LispObject *prim_##tag##vector_length(LispObject *args) {               \
+        return numvec_length_of(args, kind, #tag "vector-length");          \
+    }                                                                       \
+    LispObject *prim_##tag##vector_ref(LispObject *args) {                  \
+        return numvec_ref(args, kind, #tag "vector-ref");                   \
+    }                                                                       \
+    LispObject *prim_##tag##vector_set(LispObject *args) {                  \
+        return numvec_set_at(args, kind, #tag "vector-set!");               \
+    }                                                                       \
+    LispObject *prim_##tag##vector_to_list(LispObject *args) {              \
+        return numvec_to_list(args, kind, #tag "vector->list");             \
+    }                                                                       \
+    LispObject *prim_list_to_##tag##vector(LispObject *args) {              \
+        LispObject *list = require_arg(args, 0, "list->" #tag "vector");    \
+        if (!list) return make_nil();                                       \
+        return numvec_from_list(list, kind, "list->" #tag "vector");        \
+    }
+
+NUMVEC_PRIMS(u8, NUMVEC_U8)
+NUMVEC_PRIMS(s32, NUMVEC_S32)
+NUMVEC_PRIMS(s64, NUMVEC_S64)
+NUMVEC_PRIMS(f32, NUMVEC_F32)
+NUMVEC_PRIMS(f64, NUMVEC_F64)
+
+/* Helper for the second vector of a binary operation: the same kind and
+ * length as the first */
+static int require_same_numvec(LispObject *args, int n, NumvecKind kind, size_t length,
+                               const char *func_name, void **data) {
+    size_t other_length;
+    NumvecKind other_kind;
+    if (!require_numvec(args, n, kind, func_name, data, &other_length, &other_kind)) {
+        return 0;
+    }
+    if (other_length != length) {
+        lisp_error("%s: lengths %zu and %zu differ", func_name, length, other_length);
+        return 0;
+    }
+    return 1;
+}
+
+/* a + b, into a new vector or (in_place) into a */
+static LispObject *numvec_add_prim(LispObject *args, int in_place, const char *func_name) {
+    void *a, *b;
+    size_t length;
+    NumvecKind kind;
+    if (!require_numvec(args, 0, NUMVEC_KIND_COUNT, func_name, &a, &length, &kind) ||
+        !require_same_numvec(args, 1, kind, length, func_name, &b)) {
+        return make_nil();
+    }
+
+    LispObject *result = car(args);
+    if (!in_place) {
+        result = make_numvector(kind, length);
+        void *data;
+        if (!numvec_view(result, &data, &length, &kind)) return result;
+        numvec_add(data, a, b, length, kind);
+    } else {
+        numvec_add(a, a, b, length, kind);
+    }
+    return result;
+}
+
+LispObject *prim_numvector_add(LispObject *args) {
+    return numvec_add_prim(args, 0, "numvector-add");
+}
+
+LispObject *prim_numvector_add_x(LispObject *args) {
+    return numvec_add_prim(args, 1, "numvector-add!");
+}
+
+/* v * factor, into a new vector or (in_place) into v */
+static LispObject *numvec_scale_prim(LispObject *args, int in_place, const char *func_name) {
+    void *a;
+    size_t length;
+    NumvecKind kind;
+    LispObject *factor = require_arg(args, 1, func_name);
+    if (!factor || !require_numvec(args, 0, NUMVEC_KIND_COUNT, func_name, &a, &length, &kind) ||
+        !require_type(factor, LISP_NUMBER, func_name)) {
+        return make_nil();
+    }
+    /* Integer vectors scale by integers, wrapping around as they add */
+    if (kind != NUMVEC_F32 && kind != NUMVEC_F64 &&
+        !numvec_fits(NUMVEC_S64, factor->number)) {
+        lisp_error("%s: expected an integer factor for a %svector, got %g",
+                   func_name, numvec_tag(kind), factor->number);
+        return make_nil();
+    }
+
+    LispObject *result = car(args);
+    if (!in_place) {
+        result = make_numvector(kind, length);
+        void *data;
+        if (!numvec_view(result, &data, &length, &kind)) return result;
+        numvec_scale(data, a, factor->number, length, kind);
+    } else {
+        numvec_scale(a, a, factor->number, length, kind);
+    }
+    return result;
+}
+
+LispObject *prim_numvector_scale(LispObject *args) {
+    return numvec_scale_prim(args, 0, "numvector-scale");
+}
+
+LispObject *prim_numvector_scale_x(LispObject *args) {
+    return numvec_scale_prim(args, 1, "numvector-scale!");
+}
+
+LispObject *prim_numvector_dot(LispObject *args) {
+    void *a, *b;
+    size_t length;
+    NumvecKind kind;
+    if (!require_numvec(args, 0, NUMVEC_KIND_COUNT, "numvector-dot", &a, &length, &kind) ||
+        !require_same_numvec(args, 1, kind, length, "numvector-dot", &b)) {
+        return make_number(0);
+    }
+    return make_number(numvec_dot(a, b, length, kind));
+}
+
+LispObject *prim_numvector_sum(LispObject *args) {
+    void *a;
+    size_t length;
+    NumvecKind kind;
+    if (!require_numvec(args, 0, NUMVEC_KIND_COUNT, "numvector-sum", &a, &length, &kind)) {
+        return make_number(0);
+    }
+    return make_number(numvec_sum(a, length, kind));
+}
+
+/* The least or (max) greatest element */
+static LispObject *numvec_extreme_prim(LispObject *args, int max, const char *func_name) {
+    void *a;
+    size_t length;
+    NumvecKind kind;
+    if (!require_numvec(args, 0, NUMVEC_KIND_COUNT, func_name, &a, &length, &kind)) {
+        return make_number(0);
+    }
+    if (length == 0) {
+        lisp_error("%s: empty vector", func_name);
+        return make_number(0);
+    }
+    return make_number(max ? numvec_max(a, length, kind) : numvec_min(a, length, kind));
+}
+
+LispObject *prim_numvector_min(LispObject *args) {
+    return numvec_extreme_prim(args, 0, "numvector-min");
+}
+
+LispObject *prim_numvector_max(LispObject *args) {
+    return numvec_extreme_prim(args, 1, "numvector-max");
+}
+
+LispObject *prim_numvector_fill(LispObject *args) {
+    void *data;
+    size_t length;
+    NumvecKind kind;
+    size_t start, end;
+    double value;
+    LispObject *val = require_arg(args, 1, "numvector-fill!");
+    if (!val || !require_numvec(args, 0, NUMVEC_KIND_COUNT, "numvector-fill!",
+                                &data, &length, &kind) ||
+        !numvec_value(val, kind, &value, "numvector-fill!") ||
+        !optional_range(args, 2, length, &start, &end, "numvector-fill!")) {
+        return make_nil();
+    }
+    numvec_fill((char *)data + start * numvec_element_size(kind), end - start, kind, value);
+    return make_nil();
+}
+
+LispObject *prim_numvector_copy(LispObject *args) {
+    void *data;
+    size_t length;
+    NumvecKind kind;
+    size_t start, end;
+    if (!require_numvec(args, 0, NUMVEC_KIND_COUNT, "numvector-copy", &data, &length, &kind) ||
+        !optional_range(args, 1, length, &start, &end, "numvector-copy")) {
+        return make_nil();
+    }
+
+    LispObject *result = make_numvector(kind, end - start);
+    void *copy;
+    size_t copy_length;
+    if (numvec_view(result, &copy, &copy_length, &kind)) {
+        memcpy(copy, (char *)data + start * numvec_element_size(kind),
+               copy_length * numvec_element_size(kind));
+    }
+    return result;
+}
+
+LispObject *prim_numvector_copy_x(LispObject *args) {
+    void *to, *from;
+    size_t to_length, from_length;
+    NumvecKind kind, from_kind;
+    size_t at, start, end;
+    LispObject *at_obj = require_arg(args, 1, "numvector-copy!");
+    if (!at_obj ||
+        !require_numvec(args, 0, NUMVEC_KIND_COUNT, "numvector-copy!", &to, &to_length, &kind) ||
+        !require_numvec(args, 2, kind, "numvector-copy!", &from, &from_length, &from_kind) ||
+        !optional_range(args, 3, from_length, &start, &end, "numvector-copy!")) {
+        return make_nil();
+    }
+    if (!require_type(at_obj, LISP_NUMBER, "numvector-copy!")) return make_nil();
+    if (at_obj->number < 0 || at_obj->number != floor(at_obj->number) ||
+        at_obj->number + (double)(end - start) > (double)to_length) {
+        lisp_error("numvector-copy!: %zu elements do not fit at %g",
+                   end - start, at_obj->number);
+        return make_nil();
+    }
+    at = (size_t)at_obj->number;
+
+    /* The two may be one vector, with overlapping ranges */
+    size_t size = numvec_element_size(kind);
+    memmove((char *)to + at * size, (char *)from + start * size, (end - start) * size);
+    return make_nil();
+}
+
+/* Numbers stored in bytevectors (R6RS): a field of kind at byte index k,
+ * in big or little endianness, or the machine's own when not given */
+
+/* Helper for the field of size bytes at argument 1 of a bytevector at
+ * argument 0, with the endianness at argument endian_arg: returns the
+ * field, or NULL after reporting an error, and sets *swap if its bytes
+ * are the other way round from the machine's */
+static uint8_t *bytevector_field(LispObject *args, size_t size, int endian_arg,
+                                 int *swap, const char *func_name) {
+    LispObject *bv = require_arg(args, 0, func_name);
+    LispObject *idx = require_arg(args, 1, func_name);
+    if (!bv || !idx) return NULL;
+    if (!require_type(bv, LISP_BYTEVECTOR, func_name) ||
+        !require_type(idx, LISP_NUMBER, func_name)) {
+        return NULL;
+    }
+    if (idx->number < 0 || idx->number != floor(idx->number) ||
+        idx->number + (double)size > (double)bv->bytevector.length) {
+        lisp_error("%s: index %g out of range", func_name, idx->number);
+        return NULL;
+    }
+
+    const uint16_t one = 1;
+    int little = *(const uint8_t *)&one;
+    *swap = 0;
+    LispObject *rest = args;
+    for (int i = 0; i < endian_arg && is_cons(rest); i++) {
+        rest = cdr(rest);
+    }
+    if (is_cons(rest)) {
+        LispObject *endianness = car(rest);
+        if (endianness == make_symbol("big")) {
+            *swap = little;
+        } else if (endianness == make_symbol("little")) {
+            *swap = !little;
+        } else {
+            lisp_error("%s: expected big or little for endianness", func_name);
+            return NULL;
+        }
+    }
+    return bv->bytevector.bytes + (size_t)idx->number;
+}
+
+static LispObject *bytevector_number_ref(LispObject *args, NumvecKind kind,
+                                         const char *func_name) {
+    size_t size = numvec_element_size(kind);
+    int swap;
+    uint8_t *field = bytevector_field(args, size, 2, &swap, func_name);
+    if (!field) return make_number(0);
+
+    uint8_t bytes[8];
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = field[swap ? size - 1 - i : i];
+    }
+    return make_number(numvec_get(bytes, kind, 0));
+}
+
+static LispObject *bytevector_number_set(LispObject *args, NumvecKind kind,
+                                         const char *func_name) {
+    size_t size = numvec_element_size(kind);
+    int swap;
+    double value;
+    LispObject *val = require_arg(args, 2, func_name);
+    if (!val || !numvec_value(val, kind, &value, func_name)) return make_nil();
+    uint8_t *field = bytevector_field(args, size, 3, &swap, func_name);
+    if (!field) return make_nil();
+
+    uint8_t bytes[8];
+    numvec_set(bytes, kind, 0, value);
+    for (size_t i = 0; i < size; i++) {
+        field[i] = bytes[swap ? size - 1 - i : i];
+    }
+    return make_nil();
+}
+
+LispObject *prim_bytevector_ieee_double_ref(LispObject *args) {
+    return bytevector_number_ref(args, NUMVEC_F64, "bytevector-ieee-double-ref");
+}
+
+LispObject *prim_bytevector_ieee_double_set(LispObject *args) {
+    return bytevector_number_set(args, NUMVEC_F64, "bytevector-ieee-double-set!");
+}
+
+LispObject *prim_bytevector_ieee_single_ref(LispObject *args) {
+    return bytevector_number_ref(args, NUMVEC_F32, "bytevector-ieee-single-ref");
+}
+
+LispObject *prim_bytevector_ieee_single_set(LispObject *args) {
+    return bytevector_number_set(args, NUMVEC_F32, "bytevector-ieee-single-set!");
+}
+
+LispObject *prim_bytevector_s32_ref(LispObject *args) {
+    return bytevector_number_ref(args, NUMVEC_S32, "bytevector-s32-ref");
+}
+
+LispObject *prim_bytevector_s32_set(LispObject *args) {
+    return bytevector_number_set(args, NUMVEC_S32, "bytevector-s32-set!");
+}
+
+LispObject *prim_bytevector_s64_ref(LispObject *args) {
+    return bytevector_number_ref(args, NUMVEC_S64, "bytevector-s64-ref");
+}
+
+LispObject *prim_bytevector_s64_set(LispObject *args) {
+    return bytevector_number_set(args, NUMVEC_S64, "bytevector-s64-set!");
+}
+
+/* ============================================================
+ * Persistent Collections
+ * ============================================================ */
+
+/* Which collections an operation takes */
+typedef enum {
+    PCOLL_ANY,
+    PCOLL_PERSISTENT,
+    PCOLL_TRANSIENT
+} PcollMode;
+
+/* Helper to get a persistent collection argument of type: any, or only
+ * one that is not a transient, or only a transient */
+static LispObject *require_pcoll(LispObject *args, int n, LispType type, PcollMode mode,
+                                 const char *func_name) {
+    LispObject *obj = require_arg(args, n, func_name);
+    if (!obj || !require_type(obj, type, func_name)) return NULL;
+    if (mode == PCOLL_TRANSIENT && !pcoll_is_transient(obj)) {
+        lisp_error("%s: expected transient, got %s", func_name, lisp_type_name(type));
+        return NULL;
+    }
+    if (mode == PCOLL_PERSISTENT && pcoll_is_transient(obj)) {
+        lisp_error("%s: expected %s, got transient", func_name, lisp_type_name(type));
+        return NULL;
+    }
+    return obj;
+}
+
+static void collect_key(LispObject *key, LispObject *value, void *data) {
+    (void)value;
+    *(LispObject **)data = make_cons(key, *(LispObject **)data);
+}
+
+static void collect_value(LispObject *key, LispObject *value, void *data) {
+    (void)key;
+    *(LispObject **)data = make_cons(value, *(LispObject **)data);
+}
+
+static void collect_entry(LispObject *key, LispObject *value, void *data) {
+    *(LispObject **)data = make_cons(make_cons(key, value), *(LispObject **)data);
+}
+
+/* Maps */
+
+LispObject *prim_pmap(LispObject *args) {
+    if (list_length(args) % 2 != 0) {
+        lisp_error("pmap: expected keys and values in pairs");
+        return make_pmap();
+    }
+    gc_pause();
+    LispObject *map = pcoll_transient(make_pmap());
+    for (; is_cons(args) && is_cons(cdr(args)); args = cddr(args)) {
+        map = pmap_set(map, car(args), cadr(args));
+    }
+    pcoll_persistent(map);
+    gc_resume();
+    return map;
+}
+
+LispObject *prim_alist_to_pmap(LispObject *args) {
+    LispObject *alist = require_arg(args, 0, "alist->pmap");
+    if (!alist) return make_pmap();
+
+    gc_pause();
+    LispObject *map = pcoll_transient(make_pmap());
+    for (; is_cons(alist); alist = cdr(alist)) {
+        LispObject *entry = car(alist);
+        if (!require_type(entry, LISP_CONS, "alist->pmap")) break;
+        /* The first entry for a key wins, as with assoc */
+        if (!pmap_ref(map, car(entry), NULL)) map = pmap_set(map, car(entry), cdr(entry));
+    }
+    pcoll_persistent(map);
+    gc_resume();
+    return map;
+}
+
+LispObject *prim_pmap_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "pmap?");
+    return make_boolean(is_pmap(obj));
+}
+
+LispObject *prim_pmap_size(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap-size");
+    if (!map) return make_number(0);
+    return make_number((double)map->pcoll.count);
+}
+
+/* (pmap-ref map key [default]) - default is #f when not given */
+LispObject *prim_pmap_ref(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap-ref");
+    LispObject *key = require_arg(args, 1, "pmap-ref");
+    if (!map || !key) return LISP_FALSE;
+    LispObject *missing = is_cons(cddr(args)) ? caddr(args) : LISP_FALSE;
+    return pmap_ref(map, key, missing);
+}
+
+LispObject *prim_pmap_contains(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap-contains?");
+    LispObject *key = require_arg(args, 1, "pmap-contains?");
+    if (!map || !key) return LISP_FALSE;
+    return make_boolean(pmap_ref(map, key, NULL) != NULL);
+}
+
+static LispObject *pmap_set_prim(LispObject *args, PcollMode mode, const char *func_name) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, mode, func_name);
+    LispObject *key = require_arg(args, 1, func_name);
+    LispObject *value = require_arg(args, 2, func_name);
+    if (!map || !key || !value) return make_nil();
+    return pmap_set(map, key, value);
+}
+
+LispObject *prim_pmap_set(LispObject *args) {
+    return pmap_set_prim(args, PCOLL_PERSISTENT, "pmap-set");
+}
+
+LispObject *prim_pmap_set_x(LispObject *args) {
+    return pmap_set_prim(args, PCOLL_TRANSIENT, "pmap-set!");
+}
+
+static LispObject *pmap_delete_prim(LispObject *args, LispType type, PcollMode mode,
+                                    const char *func_name) {
+    LispObject *coll = require_pcoll(args, 0, type, mode, func_name);
+    LispObject *key = require_arg(args, 1, func_name);
+    if (!coll || !key) return make_nil();
+    return pmap_delete(coll, key);
+}
+
+LispObject *prim_pmap_delete(LispObject *args) {
+    return pmap_delete_prim(args, LISP_PMAP, PCOLL_PERSISTENT, "pmap-delete");
+}
+
+LispObject *prim_pmap_delete_x(LispObject *args) {
+    return pmap_delete_prim(args, LISP_PMAP, PCOLL_TRANSIENT, "pmap-delete!");
+}
+
+LispObject *prim_pmap_keys(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap-keys");
+    LispObject *list = make_nil();
+    if (map) pmap_each(map, collect_key, &list);
+    return list;
+}
+
+LispObject *prim_pmap_values(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap-values");
+    LispObject *list = make_nil();
+    if (map) pmap_each(map, collect_value, &list);
+    return list;
+}
+
+LispObject *prim_pmap_to_alist(LispObject *args) {
+    LispObject *map = require_pcoll(args, 0, LISP_PMAP, PCOLL_ANY, "pmap->alist");
+    LispObject *list = make_nil();
+    if (map) pmap_each(map, collect_entry, &list);
+    return list;
+}
+
+/* Sets */
+
+static LispObject *pset_from_list(LispObject *list) {
+    gc_pause();
+    LispObject *set = pcoll_transient(make_pset());
+    for (; is_cons(list); list = cdr(list)) {
+        set = pmap_set(set, car(list), car(list));
+    }
+    pcoll_persistent(set);
+    gc_resume();
+    return set;
+}
+
+LispObject *prim_pset(LispObject *args) {
+    return pset_from_list(args);
+}
+
+LispObject *prim_list_to_pset(LispObject *args) {
+    LispObject *list = require_arg(args, 0, "list->pset");
+    if (!list) return make_pset();
+    return pset_from_list(list);
+}
+
+LispObject *prim_pset_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "pset?");
+    return make_boolean(is_pset(obj));
+}
+
+LispObject *prim_pset_size(LispObject *args) {
+    LispObject *set = require_pcoll(args, 0, LISP_PSET, PCOLL_ANY, "pset-size");
+    if (!set) return make_number(0);
+    return make_number((double)set->pcoll.count);
+}
+
+LispObject *prim_pset_contains(LispObject *args) {
+    LispObject *set = require_pcoll(args, 0, LISP_PSET, PCOLL_ANY, "pset-contains?");
+    LispObject *key = require_arg(args, 1, "pset-contains?");
+    if (!set || !key) return LISP_FALSE;
+    return make_boolean(pmap_ref(set, key, NULL) != NULL);
+}
+
+static LispObject *pset_add_prim(LispObject *args, PcollMode mode, const char *func_name) {
+    LispObject *set = require_pcoll(args, 0, LISP_PSET, mode, func_name);
+    LispObject *key = require_arg(args, 1, func_name);
+    if (!set || !key) return make_nil();
+    return pmap_set(set, key, key);
+}
+
+LispObject *prim_pset_add(LispObject *args) {
+    return pset_add_prim(args, PCOLL_PERSISTENT, "pset-add");
+}
+
+LispObject *prim_pset_add_x(LispObject *args) {
+    return pset_add_prim(args, PCOLL_TRANSIENT, "pset-add!");
+}
+
+LispObject *prim_pset_delete(LispObject *args) {
+    return pmap_delete_prim(args, LISP_PSET, PCOLL_PERSISTENT, "pset-delete");
+}
+
+LispObject *prim_pset_delete_x(LispObject *args) {
+    return pmap_delete_prim(args, LISP_PSET, PCOLL_TRANSIENT, "pset-delete!");
+}
+
+LispObject *prim_pset_to_list(LispObject *args) {
+    LispObject *set = require_pcoll(args, 0, LISP_PSET, PCOLL_ANY, "pset->list");
+    LispObject *list = make_nil();
+    if (set) pmap_each(set, collect_key, &list);
+    return list;
+}
+
+/* Vectors */
+
+static LispObject *pvector_from_list(LispObject *list) {
+    gc_pause();
+    LispObject *vec = pcoll_transient(make_pvector());
+    for (; is_cons(list); list = cdr(list)) {
+        vec = pvector_push(vec, car(list));
+    }
+    pcoll_persistent(vec);
+    gc_resume();
+    return vec;
+}
+
+LispObject *prim_pvector(LispObject *args) {
+    return pvector_from_list(args);
+}
+
+LispObject *prim_list_to_pvector(LispObject *args) {
+    LispObject *list = require_arg(args, 0, "list->pvector");
+    if (!list) return make_pvector();
+    return pvector_from_list(list);
+}
+
+LispObject *prim_pvector_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "pvector?");
+    return make_boolean(is_pvector(obj));
+}
+
+LispObject *prim_pvector_length(LispObject *args) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, PCOLL_ANY, "pvector-length");
+    if (!vec) return make_number(0);
+    return make_number((double)vec->pcoll.count);
+}
+
+LispObject *prim_pvector_ref(LispObject *args) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, PCOLL_ANY, "pvector-ref");
+    LispObject *index_obj = require_arg(args, 1, "pvector-ref");
+    size_t index;
+    if (!vec || !index_obj ||
+        !numvec_index(index_obj, vec->pcoll.count, &index, "pvector-ref")) {
+        return make_nil();
+    }
+    return pvector_ref(vec, index);
+}
+
+static LispObject *pvector_set_prim(LispObject *args, PcollMode mode, const char *func_name) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, mode, func_name);
+    LispObject *index_obj = require_arg(args, 1, func_name);
+    LispObject *value = require_arg(args, 2, func_name);
+    size_t index;
+    if (!vec || !index_obj || !value ||
+        !numvec_index(index_obj, vec->pcoll.count, &index, func_name)) {
+        return make_nil();
+    }
+    return pvector_set(vec, index, value);
+}
+
+LispObject *prim_pvector_set(LispObject *args) {
+    return pvector_set_prim(args, PCOLL_PERSISTENT, "pvector-set");
+}
+
+LispObject *prim_pvector_set_x(LispObject *args) {
+    return pvector_set_prim(args, PCOLL_TRANSIENT, "pvector-set!");
+}
+
+static LispObject *pvector_push_prim(LispObject *args, PcollMode mode, const char *func_name) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, mode, func_name);
+    LispObject *value = require_arg(args, 1, func_name);
+    if (!vec || !value) return make_nil();
+    return pvector_push(vec, value);
+}
+
+LispObject *prim_pvector_push(LispObject *args) {
+    return pvector_push_prim(args, PCOLL_PERSISTENT, "pvector-push");
+}
+
+LispObject *prim_pvector_push_x(LispObject *args) {
+    return pvector_push_prim(args, PCOLL_TRANSIENT, "pvector-push!");
+}
+
+/* (pvector-append v ...) - shares the nodes of the vectors, concatenated
+ * in O(log n) each */
+LispObject *prim_pvector_append(LispObject *args) {
+    gc_pause();
+    LispObject *result = make_pvector();
+    for (; is_cons(args); args = cdr(args)) {
+        LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, PCOLL_PERSISTENT,
+                                        "pvector-append");
+        if (!vec) break;
+        result = pvector_concat(result, vec);
+    }
+    gc_resume();
+    return result;
+}
+
+/* (pvector-slice v start [end]) */
+LispObject *prim_pvector_slice(LispObject *args) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, PCOLL_PERSISTENT, "pvector-slice");
+    size_t start, end;
+    if (!vec || !optional_range(args, 1, vec->pcoll.count, &start, &end, "pvector-slice")) {
+        return make_pvector();
+    }
+    return pvector_slice(vec, start, end);
+}
+
+typedef struct {
+    LispObject *head;
+    LispObject *tail;
+} ListBuilder;
+
+static void collect_element(LispObject *value, void *data) {
+    ListBuilder *list = (ListBuilder *)data;
+    LispObject *cell = make_cons(value, make_nil());
+    if (list->tail) list->tail->cons.cdr = cell;
+    else list->head = cell;
+    list->tail = cell;
+}
+
+LispObject *prim_pvector_to_list(LispObject *args) {
+    LispObject *vec = require_pcoll(args, 0, LISP_PVECTOR, PCOLL_ANY, "pvector->list");
+    ListBuilder list = { make_nil(), NULL };
+    if (vec) pvector_each(vec, collect_element, &list);
+    return list.head;
+}
+
+/* Transients */
+
+LispObject *prim_transient(LispObject *args) {
+    LispObject *coll = require_arg(args, 0, "transient");
+    if (!coll) return make_nil();
+    if (!is_pmap(coll) && !is_pset(coll) && !is_pvector(coll)) {
+        lisp_error("transient: expected persistent map, set or vector, got %s",
+                   lisp_type_name(coll->type));
+        return make_nil();
+    }
+    if (pcoll_is_transient(coll)) {
+        lisp_error("transient: expected %s, got transient", lisp_type_name(coll->type));
+        return make_nil();
+    }
+    return pcoll_transient(coll);
+}
+
+LispObject *prim_persistent_x(LispObject *args) {
+    LispObject *coll = require_arg(args, 0, "persistent!");
+    if (!coll) return make_nil();
+    if (!pcoll_is_transient(coll)) {
+        lisp_error("persistent!: expected transient, got %s", lisp_type_name(coll->type));
+        return make_nil();
+    }
+    pcoll_persistent(coll);
+    return coll;
+}
+
+LispObject *prim_transient_p(LispObject *args) {
+    LispObject *obj = require_arg(args, 0, "transient?");
+    return make_boolean(pcoll_is_transient(obj));
+}
+
+/* Table of all primitives.  PRIM records the C function name as well so
+ * that the C backend can call primitives directly. */
+#define PRIM(name, fn, min_args, max_args) {name, fn, min_args, max_args, #fn}
+
+const PrimitiveDef primitive_defs[] = {
+    /* List operations */
+    PRIM("car",     prim_car,     1, 1),
+    PRIM("cdr",     prim_cdr,     1, 1),
+    PRIM("cons",    prim_cons,    2, 2),
+    PRIM("list",    prim_list,    0, -1),
+    PRIM("set-car!", prim_set_car, 2, 2),
+    PRIM("set-cdr!", prim_set_cdr, 2, 2),
+    PRIM("length",  prim_length,  1, 1),
+    PRIM("append",  prim_append,  0, -1),
+    PRIM("reverse", prim_reverse, 1, 1),
+
+    /* Type predicates */
+    PRIM("null?",      prim_null_p,      1, 1),
+    PRIM("pair?",      prim_pair_p,      1, 1),
+    PRIM("number?",    prim_number_p,    1, 1),
+    PRIM("symbol?",    prim_symbol_p,    1, 1),
+    PRIM("string?",    prim_string_p,    1, 1),
+    PRIM("procedure?", prim_procedure_p, 1, 1),
+    PRIM("boolean?",   prim_boolean_p,   1, 1),
+
+    /* Arithmetic */
+    PRIM("+",   prim_add, 0, -1),
+    PRIM("-",   prim_sub, 1, -1),
+    PRIM("*",   prim_mul, 0, -1),
+    PRIM("/",   prim_div, 2, 2),
+    PRIM("mod", prim_mod, 2, 2),
+    PRIM("abs", prim_abs, 1, 1),
+
+    /* Comparison */
+    PRIM("=",      prim_eq_num, 2, 2),
+    PRIM("<",      prim_lt,     2, 2),
+    PRIM(">",      prim_gt,     2, 2),
+    PRIM("<=",     prim_le,     2, 2),
+    PRIM(">=",     prim_ge,     2, 2),
+    PRIM("eq?",    prim_eq,     2, 2),
+    PRIM("equal?", prim_equal,  2, 2),
+
+    /* Boolean */
+    PRIM("not", prim_not, 1, 1),
+
+    /* I/O */
+    PRIM("display", prim_display, 1, 2),
+    PRIM("write",   prim_write,   1, 2),
+    PRIM("newline", prim_newline, 0, 1),
+    PRIM("print",   prim_print,   1, 1),
+    PRIM("open-output-string", prim_open_output_string, 0, 0),
+    PRIM("get-output-string",  prim_get_output_string,  1, 1),
+
+    /* String operations */
+    PRIM("string-length",   prim_string_length,   1, 1),
+    PRIM("string-append",   prim_string_append,   0, -1),
+    PRIM("string-ref",      prim_string_ref,      2, 2),
+    PRIM("number->string",  prim_number_to_string, 1, 1),
+    PRIM("string->number",  prim_string_to_number, 1, 1),
+    PRIM("symbol->string",  prim_symbol_to_string, 1, 1),
+    PRIM("string->symbol",  prim_string_to_symbol, 1, 1),
+
+    /* Utility */
+    PRIM("apply", prim_apply, 2, 2),
+    PRIM("error", prim_error, 0, -1),
+
+    /* R6RS: Vectors */
+    PRIM("vector?",       prim_vector_p,       1, 1),
+    PRIM("make-vector",   prim_make_vector,    1, 2),
+    PRIM("vector",        prim_vector,         0, -1),
+    PRIM("vector-length", prim_vector_length,  1, 1),
+    PRIM("vector-ref",    prim_vector_ref,     2, 2),
+    PRIM("vector-set!",   prim_vector_set,     3, 3),
+    PRIM("vector->list",  prim_vector_to_list, 1, 1),
+    PRIM("list->vector",  prim_list_to_vector, 1, 1),
+
+    /* R6RS: Bytevectors */
+    PRIM("bytevector?",       prim_bytevector_p,       1, 1),
+    PRIM("make-bytevector",   prim_make_bytevector,    1, 2),
+    PRIM("bytevector-length", prim_bytevector_length,  1, 1),
+    PRIM("bytevector-u8-ref", prim_bytevector_u8_ref,  2, 2),
+    PRIM("bytevector-u8-set!", prim_bytevector_u8_set, 3, 3),
+    PRIM("string->utf8",      prim_string_to_utf8,     1, 3),
+    PRIM("utf8->string",      prim_utf8_to_string,     1, 3),
+
+    /* R6RS: Hashtables */
+    PRIM("hashtable?",         prim_hashtable_p,         1, 1),
+    PRIM("make-eq-hashtable",  prim_make_eq_hashtable,   0, 0),
+    PRIM("make-eqv-hashtable", prim_make_eqv_hashtable,  0, 0),
+    PRIM("make-hashtable",     prim_make_hashtable,      0, 2),
+    PRIM("hashtable-ref",      prim_hashtable_ref,       3, 3),
+    PRIM("hashtable-set!",     prim_hashtable_set,       3, 3),
+    PRIM("hashtable-delete!",  prim_hashtable_delete,    2, 2),
+    PRIM("hashtable-contains?", prim_hashtable_contains, 2, 2),
+    PRIM("hashtable-size",     prim_hashtable_size,      1, 1),
+    PRIM("hashtable-keys",     prim_hashtable_keys,      1, 1),
+
+    /* R6RS: Additional numeric */
+    PRIM("floor",     prim_floor,     1, 1),
+    PRIM("ceiling",   prim_ceiling,   1, 1),
+    PRIM("truncate",  prim_truncate,  1, 1),
+    PRIM("round",     prim_round,     1, 1),
+    PRIM("sqrt",      prim_sqrt,      1, 1),
+    PRIM("expt",      prim_expt,      2, 2),
+    PRIM("log",       prim_log,       1, 1),
+    PRIM("sin",       prim_sin,       1, 1),
+    PRIM("cos",       prim_cos,       1, 1),
+    PRIM("tan",       prim_tan,       1, 1),
+    PRIM("quotient",  prim_quotient,  2, 2),
+    PRIM("remainder", prim_remainder, 2, 2),
+    PRIM("modulo",    prim_modulo,    2, 2),
+    PRIM("integer?",  prim_integer_p, 1, 1),
+    PRIM("real?",     prim_real_p,    1, 1),
+    PRIM("zero?",     prim_zero_p,    1, 1),
+    PRIM("positive?", prim_positive_p, 1, 1),
+    PRIM("negative?", prim_negative_p, 1, 1),
+    PRIM("odd?",      prim_odd_p,     1, 1),
+    PRIM("even?",     prim_even_p,    1, 1),
+    PRIM("min",       prim_min,       1, -1),
+    PRIM("max",       prim_max,       1, -1),
+
+    /* R6RS: Additional list operations */
+    PRIM("list?",     prim_list_p,    1, 1),
+    PRIM("list-ref",  prim_list_ref,  2, 2),
+    PRIM("list-tail", prim_list_tail, 2, 2),
+    PRIM("memq",      prim_memq,      2, 2),
+    PRIM("memv",      prim_memv,      2, 2),
+    PRIM("member",    prim_member,    2, 2),
+    PRIM("assq",      prim_assq,      2, 2),
+    PRIM("assv",      prim_assv,      2, 2),
+    PRIM("assoc",     prim_assoc,     2, 2),
+
+    /* R6RS: Characters */
+    PRIM("char?",          prim_char_p,          1, 1),
+    PRIM("char=?",         prim_char_eq,         2, 2),
+    PRIM("char<?",         prim_char_lt,         2, 2),
+    PRIM("char->integer",  prim_char_to_integer, 1, 1),
+    PRIM("integer->char",  prim_integer_to_char, 1, 1),
+
+    /* R7RS: Multiple values */
+    PRIM("values",           prim_values,           0, -1),
+    PRIM("call-with-values", prim_call_with_values, 2, 2),
+
+    /* R7RS: List operations */
+    PRIM("make-list",  prim_make_list,  1, 2),
+    PRIM("list-copy",  prim_list_copy,  1, 1),
+    PRIM("list-set!",  prim_list_set,   3, 3),
+
+    /* R7RS: Vector operations */
+    PRIM("vector-copy",   prim_vector_copy,   1, 3),
+    PRIM("vector-fill!",  prim_vector_fill,   2, 4),
+    PRIM("vector-append", prim_vector_append, 0, -1),
+
+    /* R7RS: String operations */
+    PRIM("string-copy", prim_string_copy, 1, 3),
+    PRIM("substring",   prim_substring,   3, 3),
+    PRIM("string=?",    prim_string_eq,   2, 2),
+    PRIM("string<?",    prim_string_lt,   2, 2),
+
+    /* Text processing */
+    PRIM("string-search-forward",  prim_string_search_forward,  2, 3),
+    PRIM("string-search-backward", prim_string_search_backward, 2, 3),
+    PRIM("string-search-all",      prim_string_search_all,      2, 2),
+    PRIM("string-contains",        prim_string_contains,        2, 3),
+    PRIM("string-index",           prim_string_index,           2, 4),
+    PRIM("string-split",           prim_string_split,           2, 2),
+    PRIM("string-join",            prim_string_join,            1, 2),
+    PRIM("string-upcase",          prim_string_upcase,          1, 1),
+    PRIM("string-downcase",        prim_string_downcase,        1, 1),
+    PRIM("string-foldcase",        prim_string_foldcase,        1, 1),
+    PRIM("string-ci=?",            prim_string_ci_eq,           2, 2),
+    PRIM("string-ci<?",            prim_string_ci_lt,           2, 2),
+    PRIM("string-prefix?",         prim_string_prefix_p,        2, 2),
+    PRIM("string-suffix?",         prim_string_suffix_p,        2, 2),
+
+    /* R7RS: Numeric operations */
+    PRIM("square",    prim_square,     1, 1),
+    PRIM("exact",     prim_exact,      1, 1),
+    PRIM("inexact",   prim_inexact,    1, 1),
+    PRIM("finite?",   prim_finite_p,   1, 1),
+    PRIM("infinite?", prim_infinite_p, 1, 1),
+    PRIM("nan?",      prim_nan_p,      1, 1),
+    PRIM("gcd",       prim_gcd,        0, -1),
+    PRIM("lcm",       prim_lcm,        0, -1),
+
+    /* R7RS: Equivalence */
+    PRIM("boolean=?", prim_boolean_eq, 1, -1),
+    PRIM("symbol=?",  prim_symbol_eq,  1, -1),
+
+    /* R7RS: Higher-order functions */
+    PRIM("map",        prim_map,        2, -1),
+    PRIM("for-each",   prim_for_each,   2, -1),
+    PRIM("filter",     prim_filter,     2, 2),
+    PRIM("fold",       prim_fold,       3, 3),
+    PRIM("fold-right", prim_fold_right, 3, 3),
+
+    /* SRFI-171: Transducers */
+    PRIM("tmap",             prim_tmap,             1, 1),
+    PRIM("tfilter",          prim_tfilter,          1, 1),
+    PRIM("ttake",            prim_ttake,            1, 1),
+    PRIM("tdrop",            prim_tdrop,            1, 1),
+    PRIM("compose",          prim_compose,          0, -1),
+    PRIM("rcons",            prim_rcons,            0, 2),
+    PRIM("rcount",           prim_rcount,           0, 2),
+    PRIM("list-transduce",   prim_list_transduce,   3, 4),
+    PRIM("vector-transduce", prim_vector_transduce, 3, 4),
+
+    /* SRFI-18: Threads and mutexes */
+    PRIM("make-thread",   prim_make_thread,  1, 2),
+    PRIM("thread?",       prim_thread_p,     1, 1),
+    PRIM("thread-name",   prim_thread_name,  1, 1),
+    PRIM("thread-start!", prim_thread_start, 1, 1),
+    PRIM("thread-join!",  prim_thread_join,  1, 1),
+    PRIM("make-mutex",    prim_make_mutex,   0, 1),
+    PRIM("mutex?",        prim_mutex_p,      1, 1),
+    PRIM("mutex-lock!",   prim_mutex_lock,   1, 1),
+    PRIM("mutex-unlock!", prim_mutex_unlock, 1, 1),
+
+    /* R7RS: Promises */
+    PRIM("force",        prim_force,        1, 1),
+    PRIM("make-promise", prim_make_promise, 1, 1),
+    PRIM("promise?",     prim_promise_p,    1, 1),
+
+    /* SRFI-41: Streams */
+    PRIM("stream?",         prim_stream_p,        1, 1),
+    PRIM("stream-pair?",    prim_stream_pair_p,   1, 1),
+    PRIM("stream-null?",    prim_stream_null_p,   1, 1),
+    PRIM("stream-car",      prim_stream_car,      1, 1),
+    PRIM("stream-cdr",      prim_stream_cdr,      1, 1),
+    PRIM("stream-range",    prim_stream_range,    2, 3),
+    PRIM("list->stream",    prim_list_to_stream,  1, 1),
+    PRIM("stream-map",      prim_stream_map,      2, -1),
+    PRIM("stream-filter",   prim_stream_filter,   2, 2),
+    PRIM("stream-take",     prim_stream_take,     2, 2),
+    PRIM("stream-drop",     prim_stream_drop,     2, 2),
+    PRIM("stream-ref",      prim_stream_ref,      2, 2),
+    PRIM("stream-fold",     prim_stream_fold,     3, 3),
+    PRIM("stream-for-each", prim_stream_for_each, 2, 2),
+    PRIM("stream->list",    prim_stream_to_list,  1, 2),
+
+    /* SRFI-4: Numeric vectors */
+#define NUMVEC_PRIM_DEFS(tag)                                                   \
+    PRIM(#tag "vector?",         prim_##tag##vector_p,         1, 1),           \
+    PRIM("make-" #tag "vector",  prim_make_##tag##vector,      1, 2),           \
+    PRIM(#tag "vector",          prim_##tag##vector,           0, -1),          \
+    PRIM(#tag "vector-length",   prim_##tag##vector_length,    1, 1),           \
+    PRIM(#tag "vector-ref",      prim_##tag##vector_ref,       2, 2),           \
+    PRIM(#tag "vector-set!",     prim_##tag##vector_set,       3, 3),           \
+    PRIM(#tag "vector->list",    prim_##tag##vector_to_list,   1, 1),           \
+    PRIM("list->" #tag "vector", prim_list_to_##tag##vector,   1, 1)
+    NUMVEC_PRIM_DEFS(u8),
+    NUMVEC_PRIM_DEFS(s32),
+    NUMVEC_PRIM_DEFS(s64),
+    NUMVEC_PRIM_DEFS(f32),
+    NUMVEC_PRIM_DEFS(f64),
+    PRIM("numvector-add",    prim_numvector_add,     2, 2),
+    PRIM("numvector-add!",   prim_numvector_add_x,   2, 2),
+    PRIM("numvector-scale",  prim_numvector_scale,   2, 2),
+    PRIM("numvector-scale!", prim_numvector_scale_x, 2, 2),
+    PRIM("numvector-dot",    prim_numvector_dot,     2, 2),
+    PRIM("numvector-sum",    prim_numvector_sum,     1, 1),
+    PRIM("numvector-min",    prim_numvector_min,     1, 1),
+    PRIM("numvector-max",    prim_numvector_max,     1, 1),
+    PRIM("numvector-fill!",  prim_numvector_fill,    2, 4),
+    PRIM("numvector-copy",   prim_numvector_copy,    1, 3),
+    PRIM("numvector-copy!",  prim_numvector_copy_x,  3, 5),
+
+    /* R6RS: Numbers in bytevectors */
+    PRIM("bytevector-ieee-double-ref",  prim_bytevector_ieee_double_ref, 2, 3),
+    PRIM("bytevector-ieee-double-set!", prim_bytevector_ieee_double_set, 3, 4),
+    PRIM("bytevector-ieee-single-ref",  prim_bytevector_ieee_single_ref, 2, 3),
+    PRIM("bytevector-ieee-single-set!", prim_bytevector_ieee_single_set, 3, 4),
+    PRIM("bytevector-s32-ref",          prim_bytevector_s32_ref,         2, 3),
+    PRIM("bytevector-s32-set!",         prim_bytevector_s32_set,         3, 4),
+    PRIM("bytevector-s64-ref",          prim_bytevector_s64_ref,         2, 3),
+    PRIM("bytevector-s64-set!",         prim_bytevector_s64_set,         3, 4),
+
+    /* Persistent collections */
+    PRIM("pmap",           prim_pmap,           0, -1),
+    PRIM("alist->pmap",    prim_alist_to_pmap,  1, 1),
+    PRIM("pmap?",          prim_pmap_p,         1, 1),
+    PRIM("pmap-size",      prim_pmap_size,      1, 1),
+    PRIM("pmap-ref",       prim_pmap_ref,       2, 3),
+    PRIM("pmap-contains?", prim_pmap_contains,  2, 2),
+    PRIM("pmap-set",       prim_pmap_set,       3, 3),
+    PRIM("pmap-set!",      prim_pmap_set_x,     3, 3),
+    PRIM("pmap-delete",    prim_pmap_delete,    2, 2),
+    PRIM("pmap-delete!",   prim_pmap_delete_x,  2, 2),
+    PRIM("pmap-keys",      prim_pmap_keys,      1, 1),
+    PRIM("pmap-values",    prim_pmap_values,    1, 1),
+    PRIM("pmap->alist",    prim_pmap_to_alist,  1, 1),
+    PRIM("pset",           prim_pset,           0, -1),
+    PRIM("list->pset",     prim_list_to_pset,   1, 1),
+    PRIM("pset?",          prim_pset_p,         1, 1),
+    PRIM("pset-size",      prim_pset_size,      1, 1),
+    PRIM("pset-contains?", prim_pset_contains,  2, 2),
+    PRIM("pset-add",       prim_pset_add,       2, 2),
+    PRIM("pset-add!",      prim_pset_add_x,     2, 2),
+    PRIM("pset-delete",    prim_pset_delete,    2, 2),
+    PRIM("pset-delete!",   prim_pset_delete_x,  2, 2),
+    PRIM("pset->list",     prim_pset_to_list,   1, 1),
+    PRIM("pvector",        prim_pvector,        0, -1),
+    PRIM("list->pvector",  prim_list_to_pvector, 1, 1),
+    PRIM("pvector?",       prim_pvector_p,      1, 1),
+    PRIM("pvector-length", prim_pvector_length, 1, 1),
+    PRIM("pvector-ref",    prim_pvector_ref,    2, 2),
+    PRIM("pvector-set",    prim_pvector_set,    3, 3),
+    PRIM("pvector-set!",   prim_pvector_set_x,  3, 3),
+    PRIM("pvector-push",   prim_pvector_push,   2, 2),
+    PRIM("pvector-push!",  prim_pvector_push_x, 2, 2),
+    PRIM("pvector-append", prim_pvector_append, 0, -1),
+    PRIM("pvector-slice",  prim_pvector_slice,  2, 3),
+    PRIM("pvector->list",  prim_pvector_to_list, 1, 1),
+    PRIM("transient",      prim_transient,      1, 1),
+    PRIM("persistent!",    prim_persistent_x,   1, 1),
+    PRIM("transient?",     prim_transient_p,    1, 1),
+
+    /* Runtime */
+    PRIM("gc-statistics", prim_gc_statistics, 0, 0),
+
+    {NULL, NULL, 0, 0, NULL}
+};
+
+#undef PRIM
+
+/* Look up a primitive definition by its Lisp name */
+const PrimitiveDef *primitive_find(const char *name) {
+    for (int i = 0; primitive_defs[i].name != NULL; i++) {
+        if (strcmp(primitive_defs[i].name, name) == 0) {
+            return &primitive_defs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Register all primitives */
+void register_primitives(Environment *env) {
+    register_primitive_defs(env, primitive_defs);
+}
+
+void register_primitive_defs(Environment *env, const PrimitiveDef *defs) {
+    for (int i = 0; defs[i].name != NULL; i++) {
+        const PrimitiveDef *def = &defs[i];
+        LispObject *prim = make_primitive(def->name, def->func,
+                                          def->min_args, def->max_args);
+        env_define(env, make_symbol(def->name), prim);
     }
 }
@@ -10,9 +10,28 @@
 #include "lisp.h"
 #include "env.h"
 
+/* Primitive table entry */
+typedef struct {
+    const char *name;        /* Lisp name */
+    LispPrimitiveFn func;
+    int min_args;
+    int max_args;            /* -1 for variadic */
+    const char *c_name;      /* C function name (used by the C backend) */
+} PrimitiveDef;
+
+/* All primitives, terminated by an entry with a NULL name */
+extern const PrimitiveDef primitive_defs[];
+
+/* Look up a primitive definition by Lisp name (NULL if not found) */
+const PrimitiveDef *primitive_find(const char *name);
+
 /* Register all primitive functions in an environment */
 void register_primitives(Environment *env);
 
+/* Register the primitives of a table terminated by an entry with a NULL
+ * name (compiled programs pass only the ones they use) */
+void register_primitive_defs(Environment *env, const PrimitiveDef *defs);
+
 /* Individual primitives (can be called directly if needed) */
 
 /* List operations */
@@ -20,6 +39,8 @@ LispObject *prim_car(LispObject *args);
 LispObject *prim_cdr(LispObject *args);
 LispObject *prim_cons(LispObject *args);
 LispObject *prim_list(LispObject *args);
+LispObject *prim_set_car(LispObject *args);
+LispObject *prim_set_cdr(LispObject *args);
 LispObject *prim_length(LispObject *args);
 LispObject *prim_append(LispObject *args);
 LispObject *prim_reverse(LispObject *args);
@@ -55,8 +76,11 @@ LispObject *prim_not(LispObject *args);
 
 /* I/O */
 LispObject *prim_display(LispObject *args);
+LispObject *prim_write(LispObject *args);
 LispObject *prim_newline(LispObject *args);
 LispObject *prim_print(LispObject *args);
+LispObject *prim_open_output_string(LispObject *args);
+LispObject *prim_get_output_string(LispObject *args);
 
 /* String operations */
 LispObject *prim_string_length(LispObject *args);
@@ -87,6 +111,8 @@ LispObject *prim_make_bytevector(LispObject *args);
 LispObject *prim_bytevector_length(LispObject *args);
 LispObject *prim_bytevector_u8_ref(LispObject *args);
 LispObject *prim_bytevector_u8_set(LispObject *args);
+LispObject *prim_string_to_utf8(LispObject *args);
+LispObject *prim_utf8_to_string(LispObject *args);
 
 /* R6RS: Hashtables */
 LispObject *prim_hashtable_p(LispObject *args);
@@ -162,6 +188,22 @@ LispObject *prim_substring(LispObject *args);
 LispObject *prim_string_eq(LispObject *args);
 LispObject *prim_string_lt(LispObject *args);
 
+/* Text processing */
+LispObject *prim_string_search_forward(LispObject *args);
+LispObject *prim_string_search_backward(LispObject *args);
+LispObject *prim_string_search_all(LispObject *args);
+LispObject *prim_string_contains(LispObject *args);
+LispObject *prim_string_index(LispObject *args);
+LispObject *prim_string_split(LispObject *args);
+LispObject *prim_string_join(LispObject *args);
+LispObject *prim_string_upcase(LispObject *args);
+LispObject *prim_string_downcase(LispObject *args);
+LispObject *prim_string_foldcase(LispObject *args);
+LispObject *prim_string_ci_eq(LispObject *args);
+LispObject *prim_string_ci_lt(LispObject *args);
+LispObject *prim_string_prefix_p(LispObject *args);
+LispObject *prim_string_suffix_p(LispObject *args);
+
 /* R7RS: Numeric operations */
 LispObject *prim_square(LispObject *args);
 LispObject *prim_exact(LispObject *args);
@@ -183,4 +225,131 @@ LispObject *prim_filter(LispObject *args);
 LispObject *prim_fold(LispObject *args);
 LispObject *prim_fold_right(LispObject *args);
 
+/* SRFI-171: Transducers */
+LispObject *prim_tmap(LispObject *args);
+LispObject *prim_tfilter(LispObject *args);
+LispObject *prim_ttake(LispObject *args);
+LispObject *prim_tdrop(LispObject *args);
+LispObject *prim_compose(LispObject *args);
+LispObject *prim_rcons(LispObject *args);
+LispObject *prim_rcount(LispObject *args);
+LispObject *prim_list_transduce(LispObject *args);
+LispObject *prim_vector_transduce(LispObject *args);
+
+/* SRFI-18: Threads and mutexes */
+LispObject *prim_make_thread(LispObject *args);
+LispObject *prim_thread_p(LispObject *args);
+LispObject *prim_thread_name(LispObject *args);
+LispObject *prim_thread_start(LispObject *args);
+LispObject *prim_thread_join(LispObject *args);
+LispObject *prim_make_mutex(LispObject *args);
+LispObject *prim_mutex_p(LispObject *args);
+LispObject *prim_mutex_lock(LispObject *args);
+LispObject *prim_mutex_unlock(LispObject *args);
+
+/* R7RS: Promises */
+LispObject *prim_force(LispObject *args);
+LispObject *prim_make_promise(LispObject *args);
+LispObject *prim_promise_p(LispObject *args);
+
+/* SRFI-41: Streams */
+LispObject *prim_stream_p(LispObject *args);
+LispObject *prim_stream_pair_p(LispObject *args);
+LispObject *prim_stream_null_p(LispObject *args);
+LispObject *prim_stream_car(LispObject *args);
+LispObject *prim_stream_cdr(LispObject *args);
+LispObject *prim_stream_range(LispObject *args);
+LispObject *prim_list_to_stream(LispObject *args);
+LispObject *prim_stream_map(LispObject *args);
+LispObject *prim_stream_filter(LispObject *args);
+LispObject *prim_stream_take(LispObject *args);
+LispObject *prim_stream_drop(LispObject *args);
+LispObject *prim_stream_ref(LispObject *args);
+LispObject *prim_stream_fold(LispObject *args);
+LispObject *prim_stream_for_each(LispObject *args);
+LispObject *prim_stream_to_list(LispObject *args);
+
+/* SRFI-4: Numeric vectors, one set per kind (tag is u8, s32, s64, f32
+ * or f64) */
+#define NUMVEC_PRIM_DECLS(tag)                                              \
+    LispObject *prim_##tag##vector_p(LispObject *args);                     \
+    LispObject *prim_make_##tag##vector(LispObject *args);                  \
+    LispObject *prim_##tag##vector(LispObject *args);                       \
+    LispObject *prim_##tag##vector_length(LispObject *args);                \
+    LispObject *prim_##tag##vector_ref(LispObject *args);                   \
+    LispObject *prim_##tag##vector_set(LispObject *args);                   \
+    LispObject *prim_##tag##vector_to_list(LispObject *args);               \
+    LispObject *prim_list_to_##tag##vector(LispObject *args);
+
+NUMVEC_PRIM_DECLS(u8)
+NUMVEC_PRIM_DECLS(s32)
+NUMVEC_PRIM_DECLS(s64)
+NUMVEC_PRIM_DECLS(f32)
+NUMVEC_PRIM_DECLS(f64)
+
+LispObject *prim_numvector_add(LispObject *args);
+LispObject *prim_numvector_add_x(LispObject *args);
+LispObject *prim_numvector_scale(LispObject *args);
+LispObject *prim_numvector_scale_x(LispObject *args);
+LispObject *prim_numvector_dot(LispObject *args);
+LispObject *prim_numvector_sum(LispObject *args);
+LispObject *prim_numvector_min(LispObject *args);
+LispObject *prim_numvector_max(LispObject *args);
+LispObject *prim_numvector_fill(LispObject *args);
+LispObject *prim_numvector_copy(LispObject *args);
+LispObject *prim_numvector_copy_x(LispObject *args);
+
+/* R6RS: Numbers in bytevectors */
+LispObject *prim_bytevector_ieee_double_ref(LispObject *args);
+LispObject *prim_bytevector_ieee_double_set(LispObject *args);
+LispObject *prim_bytevector_ieee_single_ref(LispObject *args);
+LispObject *prim_bytevector_ieee_single_set(LispObject *args);
+LispObject *prim_bytevector_s32_ref(LispObject *args);
+LispObject *prim_bytevector_s32_set(LispObject *args);
+LispObject *prim_bytevector_s64_ref(LispObject *args);
+LispObject *prim_bytevector_s64_set(LispObject *args);
+
+/* Persistent collections */
+LispObject *prim_pmap(LispObject *args);
+LispObject *prim_alist_to_pmap(LispObject *args);
+LispObject *prim_pmap_p(LispObject *args);
+LispObject *prim_pmap_size(LispObject *args);
+LispObject *prim_pmap_ref(LispObject *args);
+LispObject *prim_pmap_contains(LispObject *args);
+LispObject *prim_pmap_set(LispObject *args);
+LispObject *prim_pmap_set_x(LispObject *args);
+LispObject *prim_pmap_delete(LispObject *args);
+LispObject *prim_pmap_delete_x(LispObject *args);
+LispObject *prim_pmap_keys(LispObject *args);
+LispObject *prim_pmap_values(LispObject *args);
+LispObject *prim_pmap_to_alist(LispObject *args);
+LispObject *prim_pset(LispObject *args);
+LispObject *prim_list_to_pset(LispObject *args);
+LispObject *prim_pset_p(LispObject *args);
+LispObject *prim_pset_size(LispObject *args);
+LispObject *prim_pset_contains(LispObject *args);
+LispObject *prim_pset_add(LispObject *args);
+LispObject *prim_pset_add_x(LispObject *args);
+LispObject *prim_pset_delete(LispObject *args);
+LispObject *prim_pset_delete_x(LispObject *args);
+LispObject *prim_pset_to_list(LispObject *args);
+LispObject *prim_pvector(LispObject *args);
+LispObject *prim_list_to_pvector(LispObject *args);
+LispObject *prim_pvector_p(LispObject *args);
+LispObject *prim_pvector_length(LispObject *args);
+LispObject *prim_pvector_ref(LispObject *args);
+LispObject *prim_pvector_set(LispObject *args);
+LispObject *prim_pvector_set_x(LispObject *args);
+LispObject *prim_pvector_push(LispObject *args);
+LispObject *prim_pvector_push_x(LispObject *args);
+LispObject *prim_pvector_append(LispObject *args);
+LispObject *prim_pvector_slice(LispObject *args);
+LispObject *prim_pvector_to_list(LispObject *args);
+LispObject *prim_transient(LispObject *args);
+LispObject *prim_persistent_x(LispObject *args);
+LispObject *prim_transient_p(LispObject *args);
+
+/* Runtime */
+LispObject *prim_gc_statistics(LispObject *args);
+
 #endif /* PRIMITIVES_H */
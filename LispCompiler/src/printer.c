@@ -0,0 +1,916 @@
+/*
+ * printer.c - Printer
+ *
+ * An object that holds others may have cycles, which must be labelled
+ * where they start, before anything inside them prints.  A walk without
+ * bookkeeping first counts the objects inside; if it finishes within
+ * PRINT_WALK_LIMIT of them, the object has no cycle.  Otherwise the
+ * object prints with its output held back, keeping the objects it is
+ * inside of in a table and checking each list's pairs for a cdr cycle
+ * as Brent's method does, so that going round a cycle is noticed
+ * within a lap or two.  Only then, or once PRINT_HOLD_LIMIT bytes are
+ * held, does a depth-first walk find the objects reached again from
+ * inside themselves; if there are any, printing starts over with them
+ * labelled.  Most large objects, having no cycles, so print in one
+ * pass.  The walk, like the printer, follows a list's pairs in place
+ * and keeps in its table only the objects entered other than as the
+ * rest of a list.
+ */
+
+#include "printer.h"
+#include "number.h"
+#include "numvec.h"
+#include "text.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Objects a first walk may visit before cycles are looked for */
+#define PRINT_WALK_LIMIT 4096
+
+/* Output held back while printing an object that might have cycles */
+#define PRINT_HOLD_LIMIT (256 * (size_t)PRINTER_CHUNK)
+
+/* ============================================================
+ * Output
+ * ============================================================ */
+
+void printer_init(Printer *printer, FILE *out) {
+    memset(printer, 0, sizeof(*printer));
+    printer->out = out;
+}
+
+void printer_flush(Printer *printer) {
+    if (printer->out && printer->length > 0) {
+        fwrite(printer->data, 1, printer->length, printer->out);
+        printer->length = 0;
+    }
+}
+
+void printer_free(Printer *printer) {
+    printer_flush(printer);
+    free(printer->data);
+    printer->data = NULL;
+    printer->length = 0;
+    printer->capacity = 0;
+}
+
+/* Make room for extra more bytes (and a string's '\0'); returns 0 if
+ * there is none, in which case a stream printer writes them directly */
+static int reserve(Printer *printer, size_t extra) {
+    if (printer->length + extra < printer->capacity) return 1;
+
+    if (printer->out && !printer->holding) {
+        printer_flush(printer);
+        if (!printer->data) {
+            printer->data = (char *)malloc(PRINTER_CHUNK);
+            if (!printer->data) return 0;
+            printer->capacity = PRINTER_CHUNK;
+        }
+        return extra < printer->capacity;
+    }
+
+    size_t capacity = printer->capacity ? printer->capacity : 64;
+    while (printer->length + extra >= capacity) capacity *= 2;
+    char *grown = (char *)realloc(printer->data, capacity);
+    if (!grown) {
+        printer->failed = 1;
+        return 0;
+    }
+    printer->data = grown;
+    printer->capacity = capacity;
+    return 1;
+}
+
+void printer_write(Printer *printer, const char *text, size_t length) {
+    if (printer->truncated || printer->failed) return;
+    if (printer->limit && printer->length + length > printer->limit) {
+        length = printer->limit - printer->length;
+        printer->truncated = 1;
+    }
+    if (!reserve(printer, length)) {
+        if (printer->out) fwrite(text, 1, length, printer->out);
+        return;
+    }
+    memcpy(printer->data + printer->length, text, length);
+    printer->length += length;
+}
+
+void printer_puts(Printer *printer, const char *text) {
+    printer_write(printer, text, strlen(text));
+}
+
+void printer_putc(Printer *printer, char c) {
+    if (printer->length + 1 < printer->capacity && !printer->limit) {
+        printer->data[printer->length++] = c;
+        return;
+    }
+    printer_write(printer, &c, 1);
+}
+
+const char *printer_string(Printer *printer) {
+    if (!printer->data) return "";
+    printer->data[printer->length] = '\0';
+    return printer->data;
+}
+
+static void print_unsigned(Printer *printer, unsigned long long value) {
+    char digits[24];
+    int count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    printer_write(printer, digits + sizeof(digits) - count, (size_t)count);
+}
+
+static void print_number(Printer *printer, double value) {
+    if (reserve(printer, NUMBER_BUFFER_SIZE) && !printer->limit) {
+        printer->length += number_format(value, printer->data + printer->length);
+        return;
+    }
+    char text[NUMBER_BUFFER_SIZE];
+    size_t length = number_format(value, text);
+    printer_write(printer, text, length);
+}
+
+/* A string in quotes, writing the runs between escapes whole */
+static void print_quoted_string(Printer *printer, const char *data, size_t length) {
+    printer_putc(printer, '"');
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)data[i];
+        char escape[8];
+        switch (c) {
+            case '\n': strcpy(escape, "\\n"); break;
+            case '\t': strcpy(escape, "\\t"); break;
+            case '\r': strcpy(escape, "\\r"); break;
+            case '\\': strcpy(escape, "\\\\"); break;
+            case '"':  strcpy(escape, "\\\""); break;
+            default:
+                /* Other control characters as \xHH; (UTF-8 as it is) */
+                if (c >= 0x20 && c != 0x7F) continue;
+                snprintf(escape, sizeof(escape), "\\x%x;", c);
+                break;
+        }
+        printer_write(printer, data + start, i - start);
+        printer_puts(printer, escape);
+        start = i + 1;
+    }
+    printer_write(printer, data + start, length - start);
+    printer_putc(printer, '"');
+}
+
+/* A character as write prints it: by name, as #\xHH for other control
+ * characters, or as itself */
+static void print_character(Printer *printer, uint32_t c) {
+    static const char *const names[] = {
+        [0x00] = "null", [0x07] = "alarm", [0x08] = "backspace", [0x09] = "tab",
+        [0x0A] = "newline", [0x0D] = "return", [0x1B] = "escape", [0x20] = "space",
+    };
+    printer_write(printer, "#\\", 2);
+    if (c < sizeof(names) / sizeof(names[0]) && names[c]) {
+        printer_puts(printer, names[c]);
+    } else if (c == 0x7F) {
+        printer_puts(printer, "delete");
+    } else if (c < 0x20) {
+        char hex[8];
+        snprintf(hex, sizeof(hex), "x%x", (unsigned int)c);
+        printer_puts(printer, hex);
+    } else {
+        char utf8[4];
+        printer_write(printer, utf8, text_utf8_encode(c, utf8));
+    }
+}
+
+/* ============================================================
+ * Finding Cycles
+ * ============================================================ */
+
+/* Objects whose printed form includes other objects */
+static int is_container(LispObject *obj) {
+    switch (obj->type) {
+        case LISP_CONS:
+        case LISP_VECTOR:
+        case LISP_VALUES:
+        case LISP_CONDITION:
+        case LISP_RECORD_TYPE:
+        case LISP_RECORD:
+        case LISP_THREAD:
+        case LISP_MUTEX:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* The index-th object printed inside a container; returns 0 after the
+ * last */
+static int print_child(LispObject *obj, size_t index, LispObject **child) {
+    switch (obj->type) {
+        case LISP_CONS:
+            if (index > 1) return 0;
+            *child = index == 0 ? obj->cons.car : obj->cons.cdr;
+            return 1;
+        case LISP_VECTOR:
+            if (index >= obj->vector.length) return 0;
+            *child = obj->vector.elements[index];
+            return 1;
+        case LISP_VALUES:
+            if (index >= (size_t)obj->values.count) return 0;
+            *child = obj->values.vals[index];
+            return 1;
+        case LISP_CONDITION:
+            if (index > 1) return 0;
+            *child = index == 0 ? obj->condition.type : obj->condition.message;
+            return 1;
+        case LISP_RECORD_TYPE:
+            if (index > 0) return 0;
+            *child = obj->record_type.name;
+            return 1;
+        case LISP_RECORD:
+            if (index > 0 || !obj->record.rtd || !is_record_type(obj->record.rtd)) return 0;
+            *child = obj->record.rtd->record_type.name;
+            return 1;
+        case LISP_THREAD:
+            if (index > 0) return 0;
+            *child = obj->thread.name;
+            return 1;
+        case LISP_MUTEX:
+            if (index > 0) return 0;
+            *child = obj->mutex.name;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+typedef struct {
+    LispObject *head;           /* The object entered */
+    LispObject *obj;            /* For a list, the pair reached so far */
+    size_t index;               /* Next child to visit */
+    LispObject *mark;           /* For a list, the pair a cdr cycle returns to */
+    size_t power;               /* Steps before mark moves on */
+    size_t steps;               /* Steps since mark last moved */
+} WalkFrame;
+
+typedef struct {
+    WalkFrame *frames;
+    size_t count;
+    size_t capacity;
+} WalkStack;
+
+static int walk_push(WalkStack *stack, LispObject *obj) {
+    if (stack->count == stack->capacity) {
+        size_t capacity = stack->capacity ? stack->capacity * 2 : 64;
+        WalkFrame *grown = (WalkFrame *)realloc(stack->frames, capacity * sizeof(WalkFrame));
+        if (!grown) return 0;
+        stack->frames = grown;
+        stack->capacity = capacity;
+    }
+    WalkFrame *frame = &stack->frames[stack->count++];
+    frame->head = obj;
+    frame->obj = obj;
+    frame->index = 0;
+    frame->mark = obj;
+    frame->power = 1;
+    frame->steps = 0;
+    return 1;
+}
+
+/* Whether obj holds at most PRINT_WALK_LIMIT containers, counting
+ * shared ones each time they are reached (a cycle never finishes) */
+static int walk_is_small(LispObject *obj, WalkStack *stack) {
+    size_t visited = 1;
+    stack->count = 0;
+    if (!walk_push(stack, obj)) return 0;
+    while (stack->count > 0) {
+        WalkFrame *frame = &stack->frames[stack->count - 1];
+        LispObject *child;
+        if (!print_child(frame->obj, frame->index++, &child)) {
+            stack->count--;
+            continue;
+        }
+        if (!child || !is_container(child)) continue;
+        if (++visited > PRINT_WALK_LIMIT || !walk_push(stack, child)) return 0;
+    }
+    return 1;
+}
+
+enum {
+    LABEL_ON_PATH = 1,          /* Being walked: reaching it again is a cycle */
+    LABEL_CYCLIC = 2            /* Reached again from inside itself */
+};
+
+typedef struct {
+    LispObject *obj;            /* NULL: empty slot */
+    int flags;
+    int label;                  /* Number once printed, else -1 */
+} LabelEntry;
+
+typedef struct {
+    LabelEntry *entries;
+    size_t capacity;            /* Power of two */
+    size_t count;
+    int next_label;
+} Labels;
+
+static size_t label_slot(const Labels *labels, LispObject *obj) {
+    uintptr_t h = (uintptr_t)obj >> 4;
+    h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 29)) & (labels->capacity - 1);
+}
+
+static LabelEntry *labels_find(const Labels *labels, LispObject *obj) {
+    if (labels->count == 0) return NULL;
+    for (size_t i = label_slot(labels, obj);; i = (i + 1) & (labels->capacity - 1)) {
+        LabelEntry *entry = &labels->entries[i];
+        if (entry->obj == obj) return entry;
+        if (!entry->obj) return NULL;
+    }
+}
+
+static int labels_init(Labels *labels, size_t capacity) {
+    labels->entries = (LabelEntry *)calloc(capacity, sizeof(LabelEntry));
+    labels->capacity = capacity;
+    labels->count = 0;
+    labels->next_label = 0;
+    return labels->entries != NULL;
+}
+
+static LabelEntry *labels_insert(Labels *labels, LispObject *obj, int flags) {
+    if ((labels->count + 1) * 2 > labels->capacity) {
+        Labels grown;
+        if (!labels_init(&grown, labels->capacity * 2)) return NULL;
+        for (size_t i = 0; i < labels->capacity; i++) {
+            LabelEntry *entry = &labels->entries[i];
+            if (entry->obj) *labels_insert(&grown, entry->obj, entry->flags) = *entry;
+        }
+        free(labels->entries);
+        *labels = grown;
+    }
+    size_t i = label_slot(labels, obj);
+    while (labels->entries[i].obj) i = (i + 1) & (labels->capacity - 1);
+    LabelEntry *entry = &labels->entries[i];
+    entry->obj = obj;
+    entry->flags = flags;
+    entry->label = -1;
+    labels->count++;
+    return entry;
+}
+
+/* Remove obj, moving back the entries after it that would otherwise
+ * no longer be found */
+static void labels_remove(Labels *labels, LispObject *obj) {
+    size_t mask = labels->capacity - 1;
+    size_t i = label_slot(labels, obj);
+    while (labels->entries[i].obj != obj) {
+        if (!labels->entries[i].obj) return;
+        i = (i + 1) & mask;
+    }
+    for (size_t j = (i + 1) & mask; labels->entries[j].obj; j = (j + 1) & mask) {
+        size_t home = label_slot(labels, labels->entries[j].obj);
+        /* Entry j may fill the hole at i unless its home lies
+         * cyclically in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            labels->entries[i] = labels->entries[j];
+            i = j;
+        }
+    }
+    labels->entries[i].obj = NULL;
+    labels->count--;
+}
+
+/* The pair at which the cdr cycle of the given length in list starts */
+static LispObject *cycle_start(LispObject *list, size_t length) {
+    LispObject *ahead = list;
+    for (size_t i = 0; i < length; i++) ahead = ahead->cons.cdr;
+    while (list != ahead) {
+        list = list->cons.cdr;
+        ahead = ahead->cons.cdr;
+    }
+    return list;
+}
+
+/* Enter child unless it has been entered; if it is still being walked
+ * it is reached from inside itself.  Returns 0 if out of memory. */
+static int walk_enter(Labels *seen, WalkStack *stack, LispObject *child) {
+    if (!child || !is_container(child)) return 1;
+    LabelEntry *entry = labels_find(seen, child);
+    if (!entry) return labels_insert(seen, child, LABEL_ON_PATH) && walk_push(stack, child);
+    if (entry->flags & LABEL_ON_PATH) entry->flags |= LABEL_CYCLIC;
+    return 1;
+}
+
+/* Collect in labels the containers inside obj that are part of a
+ * cycle; returns 0 if out of memory */
+static int find_cycles(LispObject *obj, WalkStack *stack, Labels *labels) {
+    Labels seen;
+    if (!labels_init(&seen, 64)) return 0;
+    stack->count = 0;
+    int ok = walk_enter(&seen, stack, obj);
+
+    while (ok && stack->count > 0) {
+        WalkFrame *frame = &stack->frames[stack->count - 1];
+        LispObject *pair = frame->obj;
+        LispObject *child;
+
+        if (pair->type != LISP_CONS) {
+            if (print_child(pair, frame->index++, &child)) {
+                ok = walk_enter(&seen, stack, child);
+                continue;
+            }
+        } else if (frame->index == 0) {
+            frame->index = 1;
+            ok = walk_enter(&seen, stack, pair->cons.car);
+            continue;
+        } else if (frame->index == 1) {
+            /* Step to the next pair of the list unless the walk has
+             * entered it */
+            LispObject *rest = pair->cons.cdr;
+            frame->index = 2;
+            if (!rest || !is_cons(rest) || labels_find(&seen, rest)) {
+                ok = walk_enter(&seen, stack, rest);
+                continue;
+            }
+            frame->steps++;
+            if (rest == frame->mark) {
+                LispObject *start = cycle_start(frame->head, frame->steps);
+                ok = labels_insert(&seen, start, LABEL_CYCLIC) != NULL;
+                continue;
+            }
+            if (frame->steps == frame->power) {
+                frame->mark = rest;
+                frame->power *= 2;
+                frame->steps = 0;
+            }
+            frame->obj = rest;
+            frame->index = 0;
+            continue;
+        }
+
+        labels_find(&seen, frame->head)->flags &= ~LABEL_ON_PATH;
+        stack->count--;
+    }
+
+    /* Keep only the cyclic ones, so that printing looks up few */
+    size_t cyclic = 0;
+    for (size_t i = 0; ok && i < seen.capacity; i++) {
+        if (seen.entries[i].obj && (seen.entries[i].flags & LABEL_CYCLIC)) cyclic++;
+    }
+    if (ok && cyclic > 0) {
+        size_t capacity = 16;
+        while (capacity < cyclic * 2 + 2) capacity *= 2;
+        ok = labels_init(labels, capacity);
+        for (size_t i = 0; ok && i < seen.capacity; i++) {
+            if (seen.entries[i].obj && (seen.entries[i].flags & LABEL_CYCLIC)) {
+                labels_insert(labels, seen.entries[i].obj, LABEL_CYCLIC);
+            }
+        }
+    }
+    free(seen.entries);
+    return ok;
+}
+
+/* ============================================================
+ * Printing
+ * ============================================================ */
+
+typedef enum {
+    TASK_OBJECT,                /* Print obj */
+    TASK_LIST_REST,             /* Print the rest of a list, obj, and ")" */
+    TASK_ITEMS,                 /* Print the items of a vector or values
+                                 * from index, then text */
+    TASK_TEXT,                  /* Write text */
+    TASK_CLOSE                  /* obj has printed */
+} TaskKind;
+
+typedef struct {
+    TaskKind kind;
+    int quoted;
+    int spaced;                 /* TASK_ITEMS: a space before the first item too */
+    LispObject *obj;
+    size_t index;               /* TASK_LIST_REST: steps since mark moved */
+    const char *text;
+    LispObject *mark;           /* TASK_LIST_REST: as in WalkFrame */
+    size_t power;
+} PrintTask;
+
+typedef struct {
+    PrintTask *tasks;
+    size_t count;
+    size_t capacity;
+    Printer *printer;
+    Labels labels;
+    int sensing;                /* Watching for cycles, labels unknown */
+    int cyclic;                 /* Sensing went round a cycle */
+    Labels open;                /* When sensing, the objects being printed */
+} PrintState;
+
+static void push_task(PrintState *state, TaskKind kind, LispObject *obj, int quoted,
+                      size_t index, const char *text) {
+    if (state->count == state->capacity) {
+        size_t capacity = state->capacity ? state->capacity * 2 : 64;
+        PrintTask *grown = (PrintTask *)realloc(state->tasks, capacity * sizeof(PrintTask));
+        if (!grown) {
+            state->printer->failed = 1;
+            return;
+        }
+        state->tasks = grown;
+        state->capacity = capacity;
+    }
+    PrintTask *task = &state->tasks[state->count++];
+    task->kind = kind;
+    task->quoted = quoted;
+    task->spaced = 0;
+    task->obj = obj;
+    task->index = index;
+    task->text = text;
+    task->mark = NULL;
+    task->power = 0;
+}
+
+static void push_text(PrintState *state, const char *text) {
+    push_task(state, TASK_TEXT, NULL, 0, 0, text);
+}
+
+static void push_object(PrintState *state, LispObject *obj, int quoted) {
+    push_task(state, TASK_OBJECT, obj, quoted, 0, NULL);
+}
+
+/* Print an atom, or start a container by pushing tasks for its parts */
+static void print_object(PrintState *state, LispObject *obj, int quoted) {
+    Printer *printer = state->printer;
+    if (!obj) {
+        printer_puts(printer, "#<null>");
+        return;
+    }
+
+    /* A labelled object prints as #n# after the first time */
+    if (state->labels.count > 0 && is_container(obj)) {
+        LabelEntry *entry = labels_find(&state->labels, obj);
+        if (entry) {
+            printer_putc(printer, '#');
+            if (entry->label >= 0) {
+                print_unsigned(printer, (unsigned)entry->label);
+                printer_putc(printer, '#');
+                return;
+            }
+            entry->label = state->labels.next_label++;
+            print_unsigned(printer, (unsigned)entry->label);
+            printer_putc(printer, '=');
+        }
+    }
+
+    /* Reaching an object again while inside it is going round a cycle */
+    if (state->sensing && is_container(obj)) {
+        if (labels_find(&state->open, obj) || !labels_insert(&state->open, obj, 0)) {
+            state->cyclic = 1;
+            return;
+        }
+        push_task(state, TASK_CLOSE, obj, 0, 0, NULL);
+    }
+
+    switch (obj->type) {
+        case LISP_NIL:
+            printer_write(printer, "()", 2);
+            break;
+
+        case LISP_BOOLEAN:
+            printer_write(printer, obj->boolean ? "#t" : "#f", 2);
+            break;
+
+        case LISP_NUMBER:
+            print_number(printer, obj->number);
+            break;
+
+        case LISP_CHARACTER:
+            if (quoted) {
+                print_character(printer, obj->character);
+            } else {
+                char utf8[4];
+                printer_write(printer, utf8, text_utf8_encode(obj->character, utf8));
+            }
+            break;
+
+        case LISP_STRING:
+            if (quoted) {
+                print_quoted_string(printer, obj->string.data, obj->string.length);
+            } else {
+                printer_write(printer, obj->string.data, obj->string.length);
+            }
+            break;
+
+        case LISP_SYMBOL:
+            printer_puts(printer, obj->symbol.name);
+            break;
+
+        case LISP_CONS:
+            printer_putc(printer, '(');
+            push_task(state, TASK_LIST_REST, obj->cons.cdr, quoted, 0, NULL);
+            if (state->count > 0) {
+                state->tasks[state->count - 1].mark = obj;
+                state->tasks[state->count - 1].power = 1;
+            }
+            push_object(state, obj->cons.car, quoted);
+            break;
+
+        case LISP_LAMBDA:
+            if (obj->lambda.name) {
+                printer_puts(printer, "#<lambda:");
+                printer_puts(printer, obj->lambda.name);
+                printer_putc(printer, '>');
+            } else {
+                printer_puts(printer, "#<lambda>");
+            }
+            break;
+
+        case LISP_PRIMITIVE:
+            printer_puts(printer, "#<primitive:");
+            printer_puts(printer, obj->primitive.name);
+            printer_putc(printer, '>');
+            break;
+
+        case LISP_MACRO:
+            printer_puts(printer, "#<macro>");
+            break;
+
+        case LISP_VECTOR:
+            printer_write(printer, "#(", 2);
+            push_task(state, TASK_ITEMS, obj, quoted, 0, ")");
+            break;
+
+        case LISP_BYTEVECTOR:
+            printer_puts(printer, "#vu8(");
+            for (size_t i = 0; i < obj->bytevector.length; i++) {
+                if (i > 0) printer_putc(printer, ' ');
+                print_unsigned(printer, obj->bytevector.bytes[i]);
+            }
+            printer_putc(printer, ')');
+            break;
+
+        case LISP_NUMVECTOR: {
+            NumvecKind kind = (NumvecKind)obj->numvector.kind;
+            printer_putc(printer, '#');
+            printer_puts(printer, numvec_tag(kind));
+            printer_putc(printer, '(');
+            for (size_t i = 0; i < obj->numvector.length; i++) {
+                if (i > 0) printer_putc(printer, ' ');
+                print_number(printer, numvec_get(obj->numvector.data, kind, i));
+            }
+            printer_putc(printer, ')');
+            break;
+        }
+
+        case LISP_HASHTABLE:
+            printer_puts(printer, "#<hashtable count=");
+            print_unsigned(printer, obj->hashtable.count);
+            printer_putc(printer, '>');
+            break;
+
+        case LISP_RECORD_TYPE:
+            printer_puts(printer, "#<record-type-descriptor ");
+            push_text(state, ">");
+            push_object(state, obj->record_type.name, quoted);
+            break;
+
+        case LISP_RECORD:
+            printer_puts(printer, "#<record ");
+            push_text(state, ">");
+            if (obj->record.rtd && is_record_type(obj->record.rtd)) {
+                push_object(state, obj->record.rtd->record_type.name, quoted);
+            }
+            break;
+
+        case LISP_CONDITION:
+            printer_puts(printer, "#<condition ");
+            push_text(state, ">");
+            if (obj->condition.message && !is_nil(obj->condition.message)) {
+                push_object(state, obj->condition.message, 0);
+                push_text(state, ": ");
+            }
+            push_object(state, obj->condition.type, quoted);
+            break;
+
+        case LISP_VALUES:
+            printer_puts(printer, "#<values");
+            push_task(state, TASK_ITEMS, obj, quoted, 0, ">");
+            if (state->count > 0) state->tasks[state->count - 1].spaced = 1;
+            break;
+
+        case LISP_PORT:
+            printer_puts(printer, "#<");
+            printer_puts(printer, obj->port.is_input ? "input" : "");
+            printer_puts(printer, obj->port.is_output ? "output" : "");
+            printer_puts(printer, "-port");
+            if (obj->port.name) {
+                printer_putc(printer, ' ');
+                printer_puts(printer, obj->port.name);
+            }
+            printer_puts(printer, obj->port.is_open ? ">" : " closed>");
+            break;
+
+        case LISP_THREAD:
+        case LISP_MUTEX: {
+            LispObject *name = obj->type == LISP_THREAD ? obj->thread.name
+                                                        : obj->mutex.name;
+            printer_puts(printer, obj->type == LISP_THREAD ? "#<thread" : "#<mutex");
+            push_text(state, ">");
+            if (name && !is_nil(name)) {
+                push_object(state, name, 0);
+                push_text(state, " ");
+            }
+            break;
+        }
+
+        case LISP_PROMISE:
+            printer_puts(printer, "#<promise>");
+            break;
+
+        case LISP_PMAP:
+        case LISP_PSET:
+            printer_puts(printer, obj->type == LISP_PMAP ? "#<pmap count=" : "#<pset count=");
+            print_unsigned(printer, obj->pcoll.count);
+            printer_puts(printer, obj->pcoll.edit ? " transient>" : ">");
+            break;
+
+        case LISP_PVECTOR:
+            printer_puts(printer, "#<pvector length=");
+            print_unsigned(printer, obj->pcoll.count);
+            printer_puts(printer, obj->pcoll.edit ? " transient>" : ">");
+            break;
+
+        case LISP_TRIE:
+            printer_puts(printer, "#<trie node>");
+            break;
+
+        default:
+            printer_puts(printer, "#<unknown>");
+            break;
+    }
+}
+
+/* The next item of a vector or values, or the closing text */
+static void print_items(PrintState *state, PrintTask task) {
+    LispObject *obj = task.obj;
+    size_t count = obj->type == LISP_VECTOR ? obj->vector.length : (size_t)obj->values.count;
+    if (task.index >= count) {
+        printer_puts(state->printer, task.text);
+        return;
+    }
+    LispObject *item = obj->type == LISP_VECTOR ? obj->vector.elements[task.index]
+                                                : obj->values.vals[task.index];
+    if (task.index > 0 || task.spaced) printer_putc(state->printer, ' ');
+    push_task(state, TASK_ITEMS, obj, task.quoted, task.index + 1, task.text);
+    if (state->count > 0) state->tasks[state->count - 1].spaced = task.spaced;
+    push_object(state, item, task.quoted);
+}
+
+/* The rest of a list after an element: more elements, the end, or a
+ * dotted tail (which a labelled pair also is) */
+static void print_list_rest(PrintState *state, PrintTask task) {
+    Printer *printer = state->printer;
+    LispObject *rest = task.obj;
+    if (is_cons(rest) && !labels_find(&state->labels, rest)) {
+        size_t steps = task.index + 1;
+        if (state->sensing) {
+            if (rest == task.mark || labels_find(&state->open, rest)) {
+                state->cyclic = 1;
+                return;
+            }
+            if (steps == task.power) {
+                task.mark = rest;
+                task.power *= 2;
+                steps = 0;
+            }
+        }
+        printer_putc(printer, ' ');
+        push_task(state, TASK_LIST_REST, rest->cons.cdr, task.quoted, steps, NULL);
+        if (state->count > 0) {
+            state->tasks[state->count - 1].mark = task.mark;
+            state->tasks[state->count - 1].power = task.power;
+        }
+        push_object(state, rest->cons.car, task.quoted);
+    } else if (is_nil(rest)) {
+        printer_putc(printer, ')');
+    } else {
+        printer_write(printer, " . ", 3);
+        push_text(state, ")");
+        push_object(state, rest, task.quoted);
+    }
+}
+
+/* Stop sensing cycles, and find them; if there are any, start over
+ * from the output at start with them labelled */
+static void stop_sensing(PrintState *state, LispObject *obj, int quoted, size_t start) {
+    Printer *printer = state->printer;
+    WalkStack stack = {NULL, 0, 0};
+    state->sensing = 0;
+    printer->holding = 0;
+    if (!find_cycles(obj, &stack, &state->labels)) printer->failed = 1;
+    free(stack.frames);
+    if (state->labels.count > 0) {
+        printer->length = start;
+        state->count = 0;
+        push_object(state, obj, quoted);
+    }
+}
+
+void printer_print(Printer *printer, LispObject *obj, int quoted) {
+    PrintState state;
+    memset(&state, 0, sizeof(state));
+    state.printer = printer;
+
+    /* A limited printer stops early, perhaps before going round a
+     * cycle, so it looks for them first */
+    if (obj && is_container(obj)) {
+        WalkStack stack = {NULL, 0, 0};
+        if (walk_is_small(obj, &stack)) {
+            /* No cycles */
+        } else if (printer->limit) {
+            if (!find_cycles(obj, &stack, &state.labels)) printer->failed = 1;
+        } else if (labels_init(&state.open, 64)) {
+            state.sensing = 1;
+            printer->holding = 1;
+        } else {
+            printer->failed = 1;
+        }
+        free(stack.frames);
+    }
+
+    size_t start = printer->length;
+    push_object(&state, obj, quoted);
+    for (;;) {
+        if (state.sensing && (state.cyclic || state.count == 0 ||
+                              printer->length - start > PRINT_HOLD_LIMIT)) {
+            if (state.count > 0 || state.cyclic) {
+                stop_sensing(&state, obj, quoted, start);
+            }
+            state.sensing = 0;
+            printer->holding = 0;
+        }
+        if (state.count == 0 || printer->truncated || printer->failed) break;
+
+        PrintTask task = state.tasks[--state.count];
+        switch (task.kind) {
+            case TASK_OBJECT:
+                print_object(&state, task.obj, task.quoted);
+                break;
+            case TASK_LIST_REST:
+                print_list_rest(&state, task);
+                break;
+            case TASK_ITEMS:
+                print_items(&state, task);
+                break;
+            case TASK_TEXT:
+                printer_puts(printer, task.text);
+                break;
+            case TASK_CLOSE:
+                if (state.sensing) labels_remove(&state.open, task.obj);
+                break;
+        }
+    }
+
+    printer->holding = 0;
+    free(state.tasks);
+    free(state.labels.entries);
+    free(state.open.entries);
+}
+
+/* ============================================================
+ * Entry Points
+ * ============================================================ */
+
+void lisp_print(LispObject *obj) {
+    Printer printer;
+    printer_init(&printer, stdout);
+    printer_print(&printer, obj, 1);
+    printer_free(&printer);
+}
+
+void lisp_print_to_buffer(LispObject *obj, char *buffer, size_t size) {
+    if (size == 0) return;
+    Printer printer;
+    printer_init(&printer, NULL);
+    printer.limit = size - 1;
+    printer_print(&printer, obj, 1);
+    if (printer.failed) {
+        snprintf(buffer, size, "#<error>");
+    } else {
+        memcpy(buffer, printer_string(&printer), printer.length + 1);
+    }
+    printer_free(&printer);
+}
+
+char *lisp_print_to_string(LispObject *obj, size_t *length) {
+    Printer printer;
+    printer_init(&printer, NULL);
+    printer_print(&printer, obj, 1);
+    if (printer.failed || !reserve(&printer, 0)) {
+        printer_free(&printer);
+        return NULL;
+    }
+    printer_string(&printer);
+    if (length) *length = printer.length;
+    return printer.data;
+}
@@ -0,0 +1,59 @@
+/*
+ * printer.h - Printer
+ *
+ * Writes objects as text into a buffer: for a stream, a fixed chunk
+ * that is written out whenever it fills, and for a string, a buffer
+ * that grows.  The printer keeps its own stack rather than recursing,
+ * so lists and nesting of any length print, and structure that refers
+ * back to itself prints with datum labels: a circular list of 1 and 2
+ * prints as #0=(1 2 . #0#).  Structure shared without a cycle prints
+ * in full wherever it appears.
+ */
+
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include "lisp.h"
+#include <stdio.h>
+
+/* Bytes a stream printer collects before writing them out */
+#define PRINTER_CHUNK 65536
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    FILE *out;                  /* Where full chunks go; NULL for a string */
+    size_t limit;               /* A string's maximum length (0: none) */
+    int holding;                /* Keep all output in the buffer for now */
+    int truncated;              /* Output stopped at the limit */
+    int failed;                 /* Out of memory: output was lost */
+} Printer;
+
+/* Start a printer for the stream out, or, if out is NULL, one that
+ * collects a string */
+void printer_init(Printer *printer, FILE *out);
+
+/* Write out what a stream printer holds, and release the buffer */
+void printer_free(Printer *printer);
+
+/* Write out what a stream printer holds so far */
+void printer_flush(Printer *printer);
+
+void printer_write(Printer *printer, const char *text, size_t length);
+void printer_puts(Printer *printer, const char *text);
+void printer_putc(Printer *printer, char c);
+
+/* Print obj as write does (quoted: strings in quotes with escapes,
+ * characters as #\x) or as display does */
+void printer_print(Printer *printer, LispObject *obj, int quoted);
+
+/* The string a string printer has collected, '\0'-terminated ("" if
+ * nothing could be stored) */
+const char *printer_string(Printer *printer);
+
+/* Print obj into a new string, as write does; NULL if out of memory.
+ * The caller frees it. */
+char *lisp_print_to_string(LispObject *obj, size_t *length);
+
+#endif /* PRINTER_H */
@@ -0,0 +1,438 @@
+/*
+ * profile.c - Sampling Profiler
+ *
+ * The timer only counts ticks: the signal can arrive in the middle of
+ * an allocation or a source table update, so samples are taken by eval,
+ * where everything is consistent.  A sample stores the shadow stack as
+ * frame ids, with direct recursion (a procedure calling itself) folded
+ * into one frame, and identical stacks share one counter.
+ *
+ * Each thread has its own shadow stack; the tables are shared, and the
+ * thread that notices pending ticks records its own stack for them.
+ */
+
+#include "profile.h"
+#include "srcloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+/* Frames of a recorded stack; deeper stacks keep their outermost frame
+ * and their innermost ones */
+#define PROFILE_MAX_RECORDED 256
+
+LISP_THREAD_LOCAL LispObject *profile_stack[PROFILE_MAX_DEPTH];
+LISP_THREAD_LOCAL int profile_depth = 0;
+volatile sig_atomic_t profile_ticks = 0;
+
+#ifndef _WIN32
+/* Serializes samples taken by different threads */
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* A procedure, by the body it runs */
+typedef struct {
+    const LispObject *body;
+    char *label;                /* "name (file:line)" */
+    uint64_t self;
+    uint64_t total;
+    uint64_t seen;              /* Last stack counted in total */
+} Frame;
+
+/* A distinct stack and its samples */
+typedef struct {
+    uint64_t hash;
+    uint32_t offset;            /* Into stack_ids */
+    uint32_t length;
+    uint64_t count;             /* 0 for an empty slot */
+} Stack;
+
+static Frame *frames = NULL;
+static uint32_t frame_count = 0;
+static uint32_t frame_capacity = 0;
+
+/* Frame ids by body (open addressing, ids + 1, 0 empty) */
+static uint32_t *frame_index = NULL;
+static size_t frame_index_size = 0;
+
+static Stack *stacks = NULL;
+static size_t stack_count = 0;
+static size_t stack_size = 0;
+
+static uint32_t *stack_ids = NULL;
+static size_t stack_ids_length = 0;
+static size_t stack_ids_capacity = 0;
+
+static uint64_t sample_total = 0;
+static uint64_t sample_lost = 0;
+
+static int profiling = 0;
+
+/* Pseudo-frames for code outside any procedure and for the frames left
+ * out of deep stacks */
+static uint32_t toplevel_frame = UINT32_MAX;
+static uint32_t deeper_frame = UINT32_MAX;
+
+#ifndef _WIN32
+static struct sigaction old_action;
+#endif
+
+static size_t pointer_slot(const void *key, size_t size) {
+    uint64_t h = (uint64_t)(uintptr_t)key >> 4;
+    return (size_t)((h * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+/* Name and location of a procedure, as shown in a profile */
+static char *frame_label(LispObject *func) {
+    const char *name = func->lambda.name ? func->lambda.name : "<lambda>";
+    LispObject *body = func->lambda.body;
+    const char *file = NULL;
+    int line = 0;
+    if (is_cons(body)) {
+        srcloc_get(car(body), &file, &line, NULL);
+    }
+
+    size_t size = strlen(name) + (file ? strlen(file) : 0) + 32;
+    char *label = (char *)malloc(size);
+    if (!label) return NULL;
+    if (file) {
+        snprintf(label, size, "%s (%s:%d)", name, file, line);
+    } else {
+        snprintf(label, size, "%s", name);
+    }
+
+    /* ';' separates frames in collapsed stacks */
+    for (char *c = label; *c; c++) {
+        if (*c == ';' || *c == '\n') *c = '_';
+    }
+    return label;
+}
+
+static uint32_t add_frame(const LispObject *body, char *label) {
+    if (frame_count == frame_capacity) {
+        uint32_t capacity = frame_capacity ? frame_capacity * 2 : 256;
+        Frame *grown = (Frame *)realloc(frames, capacity * sizeof(Frame));
+        if (!grown) return UINT32_MAX;
+        frames = grown;
+        frame_capacity = capacity;
+    }
+    Frame *frame = &frames[frame_count];
+    memset(frame, 0, sizeof(*frame));
+    frame->body = body;
+    frame->label = label;
+    return frame_count++;
+}
+
+static uint32_t add_pseudo_frame(const char *name) {
+    char *label = (char *)malloc(strlen(name) + 1);
+    if (!label) return UINT32_MAX;
+    strcpy(label, name);
+    uint32_t id = add_frame(NULL, label);
+    if (id == UINT32_MAX) free(label);
+    return id;
+}
+
+static int grow_frame_index(void) {
+    size_t size = frame_index_size ? frame_index_size * 2 : 1024;
+    uint32_t *index = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (!index) return 0;
+    for (uint32_t id = 0; id < frame_count; id++) {
+        if (!frames[id].body) continue;
+        size_t i = pointer_slot(frames[id].body, size);
+        while (index[i]) i = (i + 1) & (size - 1);
+        index[i] = id + 1;
+    }
+    free(frame_index);
+    frame_index = index;
+    frame_index_size = size;
+    return 1;
+}
+
+/* Id of the frame of a procedure, added on first sight */
+static uint32_t frame_id(LispObject *func) {
+    const LispObject *body = func->lambda.body;
+    if ((frame_count + 1) * 2 > frame_index_size && !grow_frame_index()) {
+        return UINT32_MAX;
+    }
+
+    size_t i = pointer_slot(body, frame_index_size);
+    while (frame_index[i]) {
+        uint32_t id = frame_index[i] - 1;
+        if (frames[id].body == body) return id;
+        i = (i + 1) & (frame_index_size - 1);
+    }
+
+    char *label = frame_label(func);
+    uint32_t id = label ? add_frame(body, label) : UINT32_MAX;
+    if (id == UINT32_MAX) {
+        free(label);
+        return UINT32_MAX;
+    }
+    frame_index[i] = id + 1;
+    return id;
+}
+
+static uint64_t hash_ids(const uint32_t *ids, uint32_t length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint32_t i = 0; i < length; i++) {
+        h = (h ^ ids[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int grow_stacks(void) {
+    size_t size = stack_size ? stack_size * 2 : 256;
+    Stack *table = (Stack *)calloc(size, sizeof(Stack));
+    if (!table) return 0;
+    for (size_t s = 0; s < stack_size; s++) {
+        if (!stacks[s].count) continue;
+        size_t i = (size_t)stacks[s].hash & (size - 1);
+        while (table[i].count) i = (i + 1) & (size - 1);
+        table[i] = stacks[s];
+    }
+    free(stacks);
+    stacks = table;
+    stack_size = size;
+    return 1;
+}
+
+/* Add count samples of a stack */
+static int add_stack(const uint32_t *ids, uint32_t length, uint64_t count) {
+    if ((stack_count + 1) * 4 > stack_size * 3 && !grow_stacks()) return 0;
+
+    uint64_t hash = hash_ids(ids, length);
+    size_t i = (size_t)hash & (stack_size - 1);
+    while (stacks[i].count) {
+        Stack *s = &stacks[i];
+        if (s->hash == hash && s->length == length &&
+            memcmp(stack_ids + s->offset, ids, length * sizeof(uint32_t)) == 0) {
+            s->count += count;
+            return 1;
+        }
+        i = (i + 1) & (stack_size - 1);
+    }
+
+    if (stack_ids_length + length > stack_ids_capacity) {
+        size_t capacity = stack_ids_capacity ? stack_ids_capacity * 2 : 4096;
+        while (capacity < stack_ids_length + length) capacity *= 2;
+        uint32_t *grown = (uint32_t *)realloc(stack_ids, capacity * sizeof(uint32_t));
+        if (!grown) return 0;
+        stack_ids = grown;
+        stack_ids_capacity = capacity;
+    }
+    memcpy(stack_ids + stack_ids_length, ids, length * sizeof(uint32_t));
+
+    stacks[i].hash = hash;
+    stacks[i].offset = (uint32_t)stack_ids_length;
+    stacks[i].length = length;
+    stacks[i].count = count;
+    stack_ids_length += length;
+    stack_count++;
+    return 1;
+}
+
+static void record_sample(void) {
+    static uint32_t ids[PROFILE_MAX_DEPTH];
+
+    uint64_t ticks = (uint64_t)profile_ticks;
+    profile_ticks = 0;
+    if (!profiling || ticks == 0) return;
+    sample_total += ticks;
+
+    if (toplevel_frame == UINT32_MAX) toplevel_frame = add_pseudo_frame("<toplevel>");
+    if (deeper_frame == UINT32_MAX) deeper_frame = add_pseudo_frame("...");
+    if (toplevel_frame == UINT32_MAX || deeper_frame == UINT32_MAX) {
+        sample_lost += ticks;
+        return;
+    }
+
+    int depth = profile_depth < PROFILE_MAX_DEPTH ? profile_depth : PROFILE_MAX_DEPTH;
+    uint32_t length = 0;
+    const LispObject *last_body = NULL;
+    for (int d = 0; d < depth; d++) {
+        LispObject *func = profile_stack[d];
+        if (func->lambda.body == last_body) continue;
+        last_body = func->lambda.body;
+
+        uint32_t id = frame_id(func);
+        if (id == UINT32_MAX) {
+            sample_lost += ticks;
+            return;
+        }
+        if (length > 0 && ids[length - 1] == id) continue;
+        ids[length++] = id;
+    }
+    if (length == 0) {
+        ids[length++] = toplevel_frame;
+    }
+
+    /* Keep the outermost frame and the innermost ones */
+    if (length > PROFILE_MAX_RECORDED) {
+        uint32_t keep = PROFILE_MAX_RECORDED - 2;
+        memmove(ids + 2, ids + length - keep, keep * sizeof(uint32_t));
+        ids[1] = deeper_frame;
+        length = PROFILE_MAX_RECORDED;
+    }
+
+    if (!add_stack(ids, length, ticks)) {
+        sample_lost += ticks;
+    }
+}
+
+void profile_sample(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&sample_lock);
+    record_sample();
+    pthread_mutex_unlock(&sample_lock);
+#else
+    record_sample();
+#endif
+}
+
+#ifndef _WIN32
+static void on_tick(int signal) {
+    (void)signal;
+    profile_ticks++;
+}
+#endif
+
+int profile_start(void) {
+#ifndef _WIN32
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &old_action) != 0) return 1;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = PROFILE_INTERVAL_US;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &old_action, NULL);
+        return 1;
+    }
+
+    profile_ticks = 0;
+    profiling = 1;
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/* Frames by self time, then total time */
+static int compare_frames(const void *a, const void *b) {
+    const Frame *fa = &frames[*(const uint32_t *)a];
+    const Frame *fb = &frames[*(const uint32_t *)b];
+    if (fa->self != fb->self) return fa->self < fb->self ? 1 : -1;
+    if (fa->total != fb->total) return fa->total < fb->total ? 1 : -1;
+    return 0;
+}
+
+static void write_folded(FILE *out) {
+    for (size_t s = 0; s < stack_size; s++) {
+        if (!stacks[s].count) continue;
+        const uint32_t *ids = stack_ids + stacks[s].offset;
+        for (uint32_t i = 0; i < stacks[s].length; i++) {
+            fprintf(out, "%s%s", i ? ";" : "", frames[ids[i]].label);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stacks[s].count);
+    }
+}
+
+static void write_report(FILE *out, int top) {
+    /* Self: samples in which a frame is innermost; total: samples in
+     * which it appears at all */
+    for (size_t s = 0; s < stack_size; s++) {
+        if (!stacks[s].count) continue;
+        const uint32_t *ids = stack_ids + stacks[s].offset;
+        uint32_t length = stacks[s].length;
+        for (uint32_t i = 0; i < length; i++) {
+            Frame *frame = &frames[ids[i]];
+            if (frame->seen == s + 1) continue;
+            frame->seen = s + 1;
+            frame->total += stacks[s].count;
+        }
+        frames[ids[length - 1]].self += stacks[s].count;
+    }
+
+    uint32_t *order = (uint32_t *)malloc((frame_count + 1) * sizeof(uint32_t));
+    if (!order) return;
+    uint32_t shown = 0;
+    for (uint32_t id = 0; id < frame_count; id++) {
+        if (frames[id].total) order[shown++] = id;
+    }
+    qsort(order, shown, sizeof(uint32_t), compare_frames);
+    if (top > 0 && shown > (uint32_t)top) shown = (uint32_t)top;
+
+    double scale = sample_total ? 100.0 / (double)sample_total : 0.0;
+    fprintf(out, "Profile: %llu samples",
+            (unsigned long long)sample_total);
+    if (sample_lost) {
+        fprintf(out, " (%llu not recorded)", (unsigned long long)sample_lost);
+    }
+    fprintf(out, "\n%8s %8s  %s\n", "Self", "Total", "Procedure");
+    for (uint32_t i = 0; i < shown; i++) {
+        const Frame *frame = &frames[order[i]];
+        fprintf(out, "%7.1f%% %7.1f%%  %s\n",
+                (double)frame->self * scale, (double)frame->total * scale, frame->label);
+    }
+    free(order);
+}
+
+void profile_stop(const char *folded_path, FILE *report, int top) {
+    if (!profiling) return;
+
+#ifndef _WIN32
+    /* Wait for a sample another thread may be taking */
+    pthread_mutex_lock(&sample_lock);
+    profiling = 0;
+    pthread_mutex_unlock(&sample_lock);
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &old_action, NULL);
+#else
+    profiling = 0;
+#endif
+    profile_ticks = 0;
+
+    if (folded_path) {
+        FILE *out = fopen(folded_path, "w");
+        if (out) {
+            write_folded(out);
+            fclose(out);
+        } else {
+            fprintf(stderr, "Error: Cannot write profile '%s'\n", folded_path);
+        }
+    }
+    if (report) {
+        write_report(report, top);
+    }
+
+    for (uint32_t id = 0; id < frame_count; id++) {
+        free(frames[id].label);
+    }
+    free(frames);
+    free(frame_index);
+    free(stacks);
+    free(stack_ids);
+    frames = NULL;
+    frame_count = frame_capacity = 0;
+    frame_index = NULL;
+    frame_index_size = 0;
+    stacks = NULL;
+    stack_count = stack_size = 0;
+    stack_ids = NULL;
+    stack_ids_length = stack_ids_capacity = 0;
+    toplevel_frame = deeper_frame = UINT32_MAX;
+    sample_total = sample_lost = 0;
+}
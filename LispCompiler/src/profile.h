@@ -0,0 +1,60 @@
+/*
+ * profile.h - Sampling Profiler
+ *
+ * apply keeps a shadow stack of the procedures being called, always,
+ * whether or not profiling is on: an entry is one pointer store.  With
+ * profiling on, a SIGPROF timer counts ticks of CPU time, and the next
+ * eval takes a sample of the shadow stack for them.  Samples are keyed
+ * by procedure name and the source location of its body, so a profile
+ * reads like the program.
+ *
+ * When profiling stops, the samples are written as collapsed stacks
+ * ("outer;inner count" lines, the input of flamegraph.pl) and as a
+ * table of each procedure's self and total time.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "lisp.h"
+#include <signal.h>
+#include <stdio.h>
+
+/* Frames beyond this depth are counted but not recorded */
+#define PROFILE_MAX_DEPTH 16384
+
+/* Timer interval (microseconds of CPU time per tick) */
+#define PROFILE_INTERVAL_US 1000
+
+/* The calling thread's shadow stack */
+extern LISP_THREAD_LOCAL LispObject *profile_stack[PROFILE_MAX_DEPTH];
+extern LISP_THREAD_LOCAL int profile_depth;
+
+/* Ticks not yet sampled (set by the timer signal) */
+extern volatile sig_atomic_t profile_ticks;
+
+/* Enter and leave a call to a lambda */
+static inline void profile_enter(LispObject *func) {
+    if (profile_depth < PROFILE_MAX_DEPTH) {
+        profile_stack[profile_depth] = func;
+    }
+    profile_depth++;
+}
+
+static inline void profile_leave(void) {
+    profile_depth--;
+}
+
+/* Start the timer; returns 0 on success, 1 where profiling is not
+ * supported */
+int profile_start(void);
+
+/* Record the shadow stack for the pending ticks (called by eval) */
+void profile_sample(void);
+
+/* Stop the timer, write collapsed stacks to folded_path (if not NULL)
+ * and the top procedures by self time to report, then discard the
+ * samples */
+void profile_stop(const char *folded_path, FILE *report, int top);
+
+#endif /* PROFILE_H */
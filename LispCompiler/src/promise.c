@@ -0,0 +1,299 @@
+/*
+ * promise.c - Promises and Streams
+ *
+ * Forcing a promise whose expression gives another promise (delay-force,
+ * or a stream step that does the same) moves the other promise's state
+ * into the one being forced and leaves the other sharing it, then loops:
+ * the chain never nests on the C stack and its links can be collected
+ * as it goes.
+ */
+
+#include "promise.h"
+#include "eval.h"
+
+LispObject *make_promise(PromiseState state, LispObject *value) {
+    LispObject *obj = lisp_alloc();
+    obj->type = LISP_PROMISE;
+    obj->promise.state = state;
+    obj->promise.op = 0;
+    obj->promise.value = value;
+    obj->promise.env = NULL;
+    return obj;
+}
+
+LispObject *make_delayed(PromiseState state, LispObject *expr, Environment *env) {
+    LispObject *obj = make_promise(state, expr);
+    obj->promise.env = env;
+    return obj;
+}
+
+int is_promise(LispObject *obj) {
+    return obj && obj->type == LISP_PROMISE;
+}
+
+LispObject *make_stream(StreamOp op, LispObject *args) {
+    LispObject *obj = make_promise(PROMISE_STREAM, args);
+    obj->promise.op = op;
+    return obj;
+}
+
+/* The promise whose state p shares, pointing the promises on the way
+ * straight at it */
+static LispObject *promise_resolve(LispObject *p) {
+    LispObject *last = p;
+    while (last->promise.state == PROMISE_SHARED) {
+        last = last->promise.value;
+    }
+    while (p != last) {
+        LispObject *next = p->promise.value;
+        p->promise.value = last;
+        p = next;
+    }
+    return last;
+}
+
+/* ============================================================
+ * Stream Steps
+ * ============================================================ */
+
+/* Each step makes the pair of a stream from its arguments and returns
+ * it (or the empty list); a step that ends in another stream returns
+ * that instead and sets *lazy.  NULL means an error was reported.
+ * Arguments are the promise's own: a step may update them in place as
+ * it passes elements by, but must not keep them for the next promise
+ * unless it runs no Lisp code (a nested force of the same promise would
+ * see them changed).
+ *
+ * Outside eval (in compiled code) any allocation may collect, so steps
+ * build their results with collection held off. */
+
+static LispObject *step_range(LispObject *args) {
+    LispObject *first = car(args);
+    double past = cadr(args)->number;
+    double step = caddr(args)->number;
+    if (step >= 0 ? first->number >= past : first->number <= past) {
+        return make_nil();
+    }
+
+    gc_pause();
+    LispObject *pair = make_cons(make_promise(PROMISE_DONE, first),
+                                 make_stream(STREAM_RANGE, args));
+    args->cons.car = make_number(first->number + step);
+    gc_resume();
+    return pair;
+}
+
+static LispObject *step_list(LispObject *list) {
+    if (!is_cons(list)) return make_nil();
+    gc_pause();
+    LispObject *pair = make_cons(make_promise(PROMISE_DONE, car(list)),
+                                 make_stream(STREAM_LIST, cdr(list)));
+    gc_resume();
+    return pair;
+}
+
+static LispObject *step_map(LispObject *args) {
+    /* args, then the elements and the rests of the streams */
+    LispObject *slots[3] = { args, NULL, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 3);
+
+    LispObject *items_tail = NULL;
+    LispObject *rests_tail = NULL;
+    LispObject *result = NULL;
+    for (LispObject *streams = cdr(args); is_cons(streams); streams = cdr(streams)) {
+        LispObject *pair = stream_force(car(streams), "stream-map");
+        if (!pair || is_nil(pair)) {
+            result = pair;
+            break;
+        }
+        LispObject *value = promise_force(car(pair));
+
+        gc_pause();
+        LispObject *rest = make_cons(cdr(pair), make_nil());
+        if (rests_tail) rests_tail->cons.cdr = rest;
+        else slots[2] = rest;
+        rests_tail = rest;
+
+        LispObject *item = make_cons(value, make_nil());
+        if (items_tail) items_tail->cons.cdr = item;
+        else slots[1] = item;
+        items_tail = item;
+        gc_resume();
+    }
+
+    if (!result) {
+        LispObject *value = apply(car(args), slots[1] ? slots[1] : make_nil(), NULL);
+        gc_pause();
+        result = make_cons(make_promise(PROMISE_DONE, value),
+                           make_stream(STREAM_MAP, make_cons(car(args), slots[2])));
+        gc_resume();
+    }
+
+    gc_pop_frame(&frame);
+    return result;
+}
+
+static LispObject *step_filter(LispObject *args) {
+    LispObject *slots[2] = { args, NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+
+    LispObject *result = NULL;
+    for (;;) {
+        LispObject *pair = stream_force(cadr(args), "stream-filter");
+        if (!pair || is_nil(pair)) {
+            result = pair;
+            break;
+        }
+        slots[1] = pair;
+
+        LispObject *value = promise_force(car(pair));
+        LispObject *keep = apply(car(args), make_cons(value, make_nil()), NULL);
+        if (is_true(keep)) {
+            gc_pause();
+            LispObject *rest = make_cons(car(args), make_cons(cdr(pair), make_nil()));
+            result = make_cons(car(pair), make_stream(STREAM_FILTER, rest));
+            gc_resume();
+            break;
+        }
+
+        /* Passed over: let it go */
+        args->cons.cdr->cons.car = cdr(pair);
+    }
+
+    gc_pop_frame(&frame);
+    return result;
+}
+
+static LispObject *step_take(LispObject *args) {
+    double count = car(args)->number;
+    if (count < 1) return make_nil();
+
+    LispObject *pair = stream_force(cadr(args), "stream-take");
+    if (!pair || is_nil(pair)) return pair;
+
+    gc_pause();
+    LispObject *rest = make_cons(make_number(count - 1), make_cons(cdr(pair), make_nil()));
+    pair = make_cons(car(pair), make_stream(STREAM_TAKE, rest));
+    gc_resume();
+    return pair;
+}
+
+static LispObject *step_drop(LispObject *args, int *lazy) {
+    GCFrame frame;
+    gc_push_frame(&frame, &args, 1);
+
+    LispObject *result = NULL;
+    while (car(args)->number >= 1) {
+        LispObject *pair = stream_force(cadr(args), "stream-drop");
+        if (!pair || is_nil(pair)) {
+            result = pair;
+            break;
+        }
+        args->cons.cdr->cons.car = cdr(pair);
+        args->cons.car = make_number(car(args)->number - 1);
+    }
+
+    if (!result) {
+        *lazy = 1;
+        result = cadr(args);
+    }
+    gc_pop_frame(&frame);
+    return result;
+}
+
+static LispObject *stream_step(LispObject *promise, int *lazy) {
+    LispObject *args = promise->promise.value;
+    *lazy = 0;
+    switch ((StreamOp)promise->promise.op) {
+        case STREAM_RANGE:  return step_range(args);
+        case STREAM_LIST:   return step_list(args);
+        case STREAM_MAP:    return step_map(args);
+        case STREAM_FILTER: return step_filter(args);
+        case STREAM_TAKE:   return step_take(args);
+        case STREAM_DROP:   return step_drop(args, lazy);
+    }
+    return make_nil();
+}
+
+/* ============================================================
+ * Forcing
+ * ============================================================ */
+
+LispObject *promise_force(LispObject *obj) {
+    if (!is_promise(obj)) return obj;
+
+    /* The promise, and the expression being evaluated, which a nested
+     * force may take out of it */
+    LispObject *slots[2] = { promise_resolve(obj), NULL };
+    GCFrame frame;
+    gc_push_frame(&frame, slots, 2);
+    LispObject *p = slots[0];
+
+    while (p->promise.state != PROMISE_DONE) {
+        /* Safepoint: streams of primitives run without eval's */
+        LispContext *context = lisp_context;
+        if (context->gc_pending || LOAD_ACQUIRE(&gc_stop_requested)) {
+            gc_safepoint();
+        }
+
+        int lazy = p->promise.state == PROMISE_LAZY;
+        LispObject *result;
+        if (p->promise.state == PROMISE_STREAM) {
+            result = stream_step(p, &lazy);
+        } else {
+            slots[1] = p->promise.value;
+            result = eval(slots[1], p->promise.env);
+        }
+        if (!result) break;
+
+        /* Forced again while it ran: the first value stands */
+        p = slots[0] = promise_resolve(p);
+        if (p->promise.state == PROMISE_DONE) break;
+
+        if (!lazy) {
+            p->promise.state = PROMISE_DONE;
+            p->promise.value = result;
+            p->promise.env = NULL;
+            break;
+        }
+
+        if (!is_promise(result)) {
+            lisp_error("force: expected a promise from delay-force, got %s",
+                       lisp_type_name(result->type));
+            break;
+        }
+        LispObject *next = promise_resolve(result);
+        if (next == p) {
+            lisp_error("force: promise forces itself");
+            break;
+        }
+        p->promise.state = next->promise.state;
+        p->promise.op = next->promise.op;
+        p->promise.value = next->promise.value;
+        p->promise.env = next->promise.env;
+        if (next->promise.state != PROMISE_DONE) {
+            next->promise.state = PROMISE_SHARED;
+            next->promise.value = p;
+            next->promise.env = NULL;
+        }
+    }
+
+    gc_pop_frame(&frame);
+    return p->promise.state == PROMISE_DONE ? p->promise.value : make_nil();
+}
+
+LispObject *stream_force(LispObject *obj, const char *who) {
+    if (!is_promise(obj)) {
+        lisp_error("%s: expected stream, got %s", who, lisp_type_name(obj->type));
+        return NULL;
+    }
+    LispObject *value = promise_force(obj);
+    if (!is_nil(value) && !is_cons(value)) {
+        lisp_error("%s: expected stream, got a promise of %s",
+                   who, lisp_type_name(value->type));
+        return NULL;
+    }
+    return value;
+}
@@ -0,0 +1,64 @@
+/*
+ * promise.h - Promises and Streams
+ *
+ * R7RS promises: (delay expr) makes a promise whose expr force
+ * evaluates once, remembering the value, and (delay-force expr) one
+ * whose expr gives another promise to force in its place.  A promise
+ * keeps expr and its environment, and force evaluates it there, making
+ * no procedure or environment of its own.  force runs a delay-force
+ * chain in a loop, the promises of the chain sharing one state
+ * (SRFI-45), so the chain takes constant C stack and holds constant
+ * heap however long it is.  Environments are never reclaimed, though:
+ * a chain whose steps call a procedure keeps one environment per step.
+ *
+ * SRFI-41 streams are promises whose value is the empty list or a pair
+ * of a promise of the first element and the stream of the rest.  The
+ * streams that stream-map, stream-filter, stream-range and the like
+ * return are promises of a step in C that makes one pair, and hold
+ * nothing of the stream before it: a stream consumed as it is made
+ * runs in constant memory however long it is.
+ */
+
+#ifndef PROMISE_H
+#define PROMISE_H
+
+#include "lisp.h"
+
+typedef enum {
+    PROMISE_DONE,       /* value is the value */
+    PROMISE_DELAY,      /* value is an expression giving the value */
+    PROMISE_LAZY,       /* value is an expression giving a promise to
+                         * force instead */
+    PROMISE_STREAM,     /* value is the arguments of a step (StreamOp) */
+    PROMISE_SHARED      /* value is the promise this one has become */
+} PromiseState;
+
+/* Steps of the streams made in C */
+typedef enum {
+    STREAM_RANGE,       /* (first past step) */
+    STREAM_LIST,        /* the list of the elements */
+    STREAM_MAP,         /* (proc stream ...) */
+    STREAM_FILTER,      /* (pred stream) */
+    STREAM_TAKE,        /* (count stream) */
+    STREAM_DROP         /* (count stream) */
+} StreamOp;
+
+LispObject *make_promise(PromiseState state, LispObject *value);
+int is_promise(LispObject *obj);
+
+/* A promise (PROMISE_DELAY or PROMISE_LAZY) of evaluating expr in env */
+LispObject *make_delayed(PromiseState state, LispObject *expr, Environment *env);
+
+/* A promise of the stream step op on args */
+LispObject *make_stream(StreamOp op, LispObject *args);
+
+/* The value of a promise, computing it the first time; anything else
+ * is its own value */
+LispObject *promise_force(LispObject *obj);
+
+/* Force a stream: the empty list or a pair of a promise of the first
+ * element and the rest.  Returns NULL, after reporting an error naming
+ * who, if obj is not a stream. */
+LispObject *stream_force(LispObject *obj, const char *who);
+
+#endif /* PROMISE_H */
@@ -0,0 +1,283 @@
+/*
+ * reader.c - Streaming Datum Reader Implementation
+ *
+ * A small scanner tracks parentheses, strings, comments and character
+ * literals to find where the next top-level datum ends.  Its state is
+ * kept between reads, so a datum that arrives a line at a time is
+ * scanned once.  The complete datum is then parsed in place.
+ */
+
+#include "reader.h"
+#include "lexer.h"
+#include "parser.h"
+#include "srcloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Input is read a line at a time into at least this much free space */
+#define READER_MIN_READ 4096
+
+/* Scanner states */
+enum {
+    SCAN_CODE,
+    SCAN_STRING,
+    SCAN_COMMENT
+};
+
+static void reset_scan(Reader *reader) {
+    reader->scanned = 0;
+    reader->depth = 0;
+    reader->state = SCAN_CODE;
+    reader->started = 0;
+    reader->in_atom = 0;
+}
+
+void reader_init(Reader *reader, FILE *file) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->line = 1;
+    reader->column = 1;
+    reset_scan(reader);
+}
+
+int reader_open(Reader *reader, const char *path) {
+    if (strcmp(path, "-") == 0) {
+        reader_init(reader, stdin);
+        reader->file_id = srcloc_file("<stdin>");
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    reader_init(reader, file);
+    reader->owns_file = 1;
+    reader->file_id = srcloc_file(path);
+    return 1;
+}
+
+void reader_close(Reader *reader) {
+    if (reader->owns_file && reader->file) {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+    memset(reader, 0, sizeof(*reader));
+}
+
+const char *reader_error_message(Reader *reader) {
+    return reader->error_message;
+}
+
+/* Read another line of input after the pending datum */
+static void fill(Reader *reader) {
+    if (reader->position > 0) {
+        memmove(reader->buffer, reader->buffer + reader->position,
+                reader->length - reader->position);
+        reader->length -= reader->position;
+        reader->position = 0;
+    }
+
+    if (reader->capacity - reader->length < READER_MIN_READ) {
+        size_t capacity = reader->capacity ? reader->capacity * 2 : 65536;
+        char *grown = (char *)realloc(reader->buffer, capacity);
+        if (!grown) {
+            reader->at_eof = 1;
+            return;
+        }
+        reader->buffer = grown;
+        reader->capacity = capacity;
+    }
+
+    char *tail = reader->buffer + reader->length;
+    if (!fgets(tail, (int)(reader->capacity - reader->length), reader->file)) {
+        *tail = '\0';
+        reader->at_eof = 1;
+        return;
+    }
+    reader->length += strlen(tail);
+}
+
+/* Drop count bytes of input, keeping track of the line and column */
+static void consume(Reader *reader, size_t count) {
+    const char *p = reader->buffer + reader->position;
+    const char *end = p + count;
+    const char *eol;
+
+    while ((eol = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        reader->line++;
+        reader->column = 1;
+        p = eol + 1;
+    }
+    reader->column += (int)(end - p);
+    reader->position += count;
+}
+
+static int ends_atom(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == '(' || c == ')' || c == '"' || c == ';' ||
+           c == '\'' || c == '`' || c == ',';
+}
+
+/* Scan buffered input for the end of the next datum: returns its length
+ * from position, or 0 if more input is needed */
+static size_t scan_datum(Reader *reader) {
+    if (!reader->buffer) return 0;
+
+    const char *text = reader->buffer + reader->position;
+    size_t available = reader->length - reader->position;
+    size_t i = reader->scanned;
+
+    while (i < available) {
+        char c = text[i];
+
+        if (reader->state == SCAN_COMMENT) {
+            const char *eol = (const char *)memchr(text + i, '\n', available - i);
+            if (!eol) {
+                i = available;
+                break;
+            }
+            i = (size_t)(eol - text) + 1;
+            reader->state = SCAN_CODE;
+            continue;
+        }
+
+        if (reader->state == SCAN_STRING) {
+            if (c == '\\') {
+                if (i + 1 >= available) break;
+                i += 2;
+                continue;
+            }
+            i++;
+            if (c == '"') {
+                reader->state = SCAN_CODE;
+                if (reader->depth == 0) return i;
+            }
+            continue;
+        }
+
+        /* A top-level atom ends at the first delimiter */
+        if (reader->in_atom && ends_atom(c)) return i;
+
+        switch (c) {
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+                i++;
+                break;
+
+            case ';':
+                reader->state = SCAN_COMMENT;
+                i++;
+                break;
+
+            case '"':
+                reader->state = SCAN_STRING;
+                reader->started = 1;
+                i++;
+                break;
+
+            case '(':
+                reader->depth++;
+                reader->started = 1;
+                i++;
+                break;
+
+            case ')':
+                /* A stray ')' is passed on for the parser to report */
+                reader->started = 1;
+                i++;
+                if (reader->depth <= 1) return i;
+                reader->depth--;
+                break;
+
+            case ',':
+                /* ,@ must not start an atom */
+                if (i + 1 >= available) goto need_more;
+                reader->started = 1;
+                i += text[i + 1] == '@' ? 2 : 1;
+                break;
+
+            case '\'':
+            case '`':
+                reader->started = 1;
+                i++;
+                break;
+
+            case '#':
+                /* #\( and friends are characters, not delimiters */
+                if (i + 1 >= available) goto need_more;
+                if (text[i + 1] == '\\') {
+                    if (i + 2 >= available) goto need_more;
+                    i += 3;
+                    reader->started = 1;
+                    if (reader->depth == 0) reader->in_atom = 1;
+                    break;
+                }
+                /* fall through */
+
+            default:
+                reader->started = 1;
+                if (reader->depth == 0) reader->in_atom = 1;
+                i++;
+                break;
+        }
+    }
+
+need_more:
+    reader->scanned = i;
+    return 0;
+}
+
+/* Parse the pending datum, length bytes long */
+static int parse_pending(Reader *reader, size_t length, LispObject **datum) {
+    char *text = reader->buffer + reader->position;
+    char saved = text[length];
+    text[length] = '\0';
+
+    Lexer lexer;
+    lexer_init_at(&lexer, text, reader->line, reader->column);
+
+    Parser parser;
+    parser_init(&parser, &lexer);
+    parser_set_file(&parser, reader->file_id);
+
+    LispObject *expr = parse_expression(&parser);
+    int ok = expr && !parser_had_error(&parser);
+    if (!ok) {
+        snprintf(reader->error_message, sizeof(reader->error_message), "%s",
+                 parser_error_message(&parser));
+    }
+
+    text[length] = saved;
+    consume(reader, length);
+    reset_scan(reader);
+
+    if (!ok) return -1;
+    *datum = expr;
+    return 1;
+}
+
+/* Read the next datum */
+int reader_next(Reader *reader, LispObject **datum) {
+    size_t length;
+
+    *datum = NULL;
+    while ((length = scan_datum(reader)) == 0) {
+        /* Whitespace and comments before a datum need not be kept */
+        if (!reader->started && reader->scanned > 0) {
+            consume(reader, reader->scanned);
+            reader->scanned = 0;
+        }
+
+        if (reader->at_eof) {
+            if (!reader->started) return 0;
+            /* A final atom, or an incomplete datum for the parser to
+             * report */
+            length = reader->length - reader->position;
+            break;
+        }
+        fill(reader);
+    }
+
+    return parse_pending(reader, length, datum);
+}
@@ -0,0 +1,58 @@
+/*
+ * reader.h - Streaming Datum Reader
+ *
+ * Reads top-level data one at a time from a file or pipe, so a program
+ * can be evaluated while it is being read and the forms already run can
+ * be collected.  Input is buffered a line at a time; once a complete
+ * datum is buffered it is parsed by the regular parser, and memory use
+ * is bounded by the largest single datum.
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include "lisp.h"
+#include <stdio.h>
+
+/* Reader state */
+typedef struct {
+    FILE *file;
+    int owns_file;          /* Close file in reader_close */
+    int file_id;            /* srcloc file id for parsed lists */
+    int at_eof;             /* No more input to read */
+
+    char *buffer;           /* Buffered input */
+    size_t length;          /* Bytes in buffer */
+    size_t capacity;
+    size_t position;        /* Start of the next datum */
+    int line;               /* Line and column of position */
+    int column;
+
+    /* Scan of the pending datum, resumed when more input arrives */
+    size_t scanned;         /* Bytes after position already scanned */
+    int depth;              /* Open parentheses */
+    int state;              /* Code, string or comment */
+    int started;            /* Seen something other than whitespace */
+    int in_atom;            /* Inside a top-level atom */
+
+    char error_message[256];
+} Reader;
+
+/* Start reading a file ("-" reads standard input); returns 0 if the file
+ * cannot be opened.  Lists read are located in the file (see srcloc.h) */
+int reader_open(Reader *reader, const char *path);
+
+/* Start reading an open stream (not closed by reader_close) */
+void reader_init(Reader *reader, FILE *file);
+
+/* Read the next datum: returns 1 and stores it in *datum, 0 at the end
+ * of input, or -1 on a syntax error (see reader_error_message) */
+int reader_next(Reader *reader, LispObject **datum);
+
+/* Description of the last syntax error */
+const char *reader_error_message(Reader *reader);
+
+/* Release the reader's buffer (and its file, if it opened it) */
+void reader_close(Reader *reader);
+
+#endif /* READER_H */
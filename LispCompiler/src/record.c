@@ -0,0 +1,102 @@
+/*
+ * record.c - Record Procedures
+ *
+ * An accessor's test compares the record's type with its own first, so
+ * records of exactly the type take no more than that; only records of
+ * a derived type look up the ancestor.
+ */
+
+#include "record.h"
+
+int record_field_index(LispObject *rtd, LispObject *name) {
+    while (is_record_type(rtd)) {
+        int index = rtd->record_type.size - rtd->record_type.field_count;
+        for (LispObject *f = rtd->record_type.fields; is_cons(f); f = cdr(f), index++) {
+            if (car(f) == name) return index;
+        }
+        rtd = rtd->record_type.parent;
+    }
+    return -1;
+}
+
+/* Report that proc was passed obj, which is not a record of its type */
+static LispObject *wrong_record(LispObject *proc, LispObject *rtd, LispObject *obj) {
+    LispObject *expected = rtd->record_type.name;
+    LispObject *got = is_record(obj) ? obj->record.rtd->record_type.name : NULL;
+    lisp_error("%s: expected %s, got %s", proc->primitive.name,
+               is_symbol(expected) ? expected->symbol.name : "record",
+               got && is_symbol(got) ? got->symbol.name : lisp_type_name(obj->type));
+    return make_nil();
+}
+
+static LispObject *record_construct(LispObject *self, LispObject *args) {
+    LispObject *spec = self->primitive.data;
+    LispObject *rec = make_record(spec->vector.elements[0]);
+    for (size_t i = 1; i < spec->vector.length && is_cons(args); i++, args = cdr(args)) {
+        RECORD_FIELDS(rec)[(size_t)spec->vector.elements[i]->number] = car(args);
+    }
+    return rec;
+}
+
+static LispObject *record_test(LispObject *self, LispObject *args) {
+    LispObject *obj = car(args);
+    return make_boolean(obj->type == LISP_RECORD &&
+                        record_type_is(obj->record.rtd, self->primitive.data));
+}
+
+static LispObject *record_access(LispObject *self, LispObject *args) {
+    LispObject *rec = car(args);
+    LispObject *rtd = self->primitive.data;
+    if (rec->type != LISP_RECORD ||
+        (rec->record.rtd != rtd && !record_type_is(rec->record.rtd, rtd))) {
+        return wrong_record(self, rtd, rec);
+    }
+    return RECORD_FIELDS(rec)[self->primitive.slot];
+}
+
+static LispObject *record_modify(LispObject *self, LispObject *args) {
+    LispObject *rec = car(args);
+    LispObject *rtd = self->primitive.data;
+    if (rec->type != LISP_RECORD ||
+        (rec->record.rtd != rtd && !record_type_is(rec->record.rtd, rtd))) {
+        return wrong_record(self, rtd, rec);
+    }
+    RECORD_FIELDS(rec)[self->primitive.slot] = cadr(args);
+    return make_nil();
+}
+
+static const LispClosureFn record_functions[] = {
+    record_construct, record_test, record_access, record_modify
+};
+
+LispObject *make_record_proc(RecordProc kind, LispObject *name, LispObject *rtd, int field) {
+    return make_primitive_closure(name->symbol.name, record_functions[kind],
+                                  kind == RECORD_MODIFIER ? 2 : 1,
+                                  kind == RECORD_MODIFIER ? 2 : 1, rtd, field);
+}
+
+LispObject *make_record_constructor(LispObject *name, LispObject *rtd, LispObject *fields) {
+    int count = list_length(fields);
+    gc_pause();
+    LispObject *spec = make_vector((size_t)count + 1, make_nil());
+    spec->vector.elements[0] = rtd;
+    for (int i = 1; i <= count; i++, fields = cdr(fields)) {
+        spec->vector.elements[i] = car(fields);
+    }
+    LispObject *proc = make_primitive_closure(name->symbol.name, record_construct,
+                                              count, count, spec, 0);
+    gc_resume();
+    return proc;
+}
+
+int record_proc_kind(LispObject *obj) {
+    if (!is_primitive(obj) || !obj->primitive.data) return -1;
+    for (int kind = RECORD_CONSTRUCTOR; kind <= RECORD_MODIFIER; kind++) {
+        if (obj->primitive.closure == record_functions[kind]) return kind;
+    }
+    return -1;
+}
+
+LispClosureFn record_proc_function(RecordProc kind) {
+    return record_functions[kind];
+}
@@ -0,0 +1,47 @@
+/*
+ * record.h - Record Procedures
+ *
+ * define-record-type makes a record type and the procedures on its
+ * records.  A record's fields follow its object in one allocation, and a
+ * type keeps its ancestors, from the root type down to itself, after
+ * its own object: a record is of type T, or of a type derived from T,
+ * when the ancestor of its type at T's depth is T.  That is one
+ * comparison however deep the hierarchy.
+ *
+ * The procedures are primitive closures over the type and, for an
+ * accessor or a modifier, the index of the field: calling one is a
+ * primitive call that checks the type and loads or stores one slot,
+ * with no environment made and no body evaluated.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "lisp.h"
+
+typedef enum {
+    RECORD_CONSTRUCTOR,     /* data is a vector of the type and the
+                             * indices of the fields the arguments fill */
+    RECORD_PREDICATE,       /* data is the type */
+    RECORD_ACCESSOR,        /* data is the type, slot the field */
+    RECORD_MODIFIER         /* data is the type, slot the field */
+} RecordProc;
+
+/* Index of the field named name in records of type rtd, or -1.  The
+ * fields of a type follow those of its parent, and shadow them. */
+int record_field_index(LispObject *rtd, LispObject *name);
+
+/* A predicate, accessor or modifier named name on records of type rtd;
+ * field is the index of the field an accessor or modifier uses */
+LispObject *make_record_proc(RecordProc kind, LispObject *name, LispObject *rtd, int field);
+
+/* A constructor named name of records of type rtd whose arguments fill
+ * fields, a list of field indices, in order; other fields are nil */
+LispObject *make_record_constructor(LispObject *name, LispObject *rtd, LispObject *fields);
+
+/* The kind of a procedure made here, or -1 for any other object, and
+ * the function of procedures of a kind (for images) */
+int record_proc_kind(LispObject *obj);
+LispClosureFn record_proc_function(RecordProc kind);
+
+#endif /* RECORD_H */
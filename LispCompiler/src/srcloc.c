@@ -0,0 +1,303 @@
+/*
+ * srcloc.c - Source Locations of Parsed Forms
+ *
+ * Linear probing over a power-of-two table of (cell, location) pairs,
+ * kept at most three-quarters full.  Removal shifts the following
+ * entries of a probe run back instead of leaving tombstones, so the
+ * table never needs rebuilding as the collector frees located cells.
+ *
+ * Cells loaded in one block bring their locations with them, sorted by
+ * position in the block, and are looked up there instead.
+ *
+ * Threads share the tables behind one lock.  srcloc_forget takes no
+ * lock: the collector calls it with every other thread stopped.
+ */
+
+#include "srcloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_TABLES()   pthread_mutex_lock(&table_lock)
+#define UNLOCK_TABLES() pthread_mutex_unlock(&table_lock)
+#else
+#define LOCK_TABLES()   ((void)0)
+#define UNLOCK_TABLES() ((void)0)
+#endif
+
+#define SRCLOC_INITIAL_SIZE 1024
+#define SRCLOC_MAX_FILES 0xFFFF
+
+typedef struct {
+    LispObject *cell;       /* NULL for an empty slot */
+    PackedLocation location;
+} LocationSlot;
+
+static LocationSlot *slots = NULL;
+static size_t slot_count = 0;       /* Power of two */
+static size_t entry_count = 0;
+
+/* Blocks of cells, sorted by address */
+typedef struct {
+    LispObject *cells;
+    size_t count;
+    int file_id;
+    const BlockLocation *entries;
+    size_t entry_count;
+} LocationBlock;
+
+static LocationBlock *blocks = NULL;
+static size_t block_count = 0;
+static size_t block_capacity = 0;
+
+static char **file_names = NULL;    /* file_names[id - 1] */
+static int file_count = 0;
+static int file_capacity = 0;
+
+/* Cells are at least 16-byte aligned, so the low bits carry nothing */
+static size_t slot_for(const LispObject *cell) {
+    uint64_t h = (uint64_t)(uintptr_t)cell >> 4;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & (slot_count - 1);
+}
+
+static int grow(void) {
+    size_t old_count = slot_count;
+    LocationSlot *old = slots;
+    size_t count = old_count ? old_count * 2 : SRCLOC_INITIAL_SIZE;
+
+    LocationSlot *grown = (LocationSlot *)calloc(count, sizeof(LocationSlot));
+    if (!grown) return 0;
+    slots = grown;
+    slot_count = count;
+
+    for (size_t i = 0; i < old_count; i++) {
+        if (!old[i].cell) continue;
+        size_t j = slot_for(old[i].cell);
+        while (slots[j].cell) j = (j + 1) & (slot_count - 1);
+        slots[j] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+static int register_file(const char *name) {
+    for (int i = 0; i < file_count; i++) {
+        if (strcmp(file_names[i], name) == 0) return i + 1;
+    }
+    if (file_count >= SRCLOC_MAX_FILES) return 0;
+
+    if (file_count == file_capacity) {
+        int capacity = file_capacity ? file_capacity * 2 : 8;
+        char **grown = (char **)realloc(file_names, (size_t)capacity * sizeof(char *));
+        if (!grown) return 0;
+        file_names = grown;
+        file_capacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if (!copy) return 0;
+    file_names[file_count++] = copy;
+    return file_count;
+}
+
+int srcloc_file(const char *name) {
+    if (!name) return 0;
+
+    LOCK_TABLES();
+    int id = register_file(name);
+    UNLOCK_TABLES();
+    return id;
+}
+
+static const char *file_name(int file_id) {
+    if (file_id < 1 || file_id > file_count) return NULL;
+    return file_names[file_id - 1];
+}
+
+const char *srcloc_file_name(int file_id) {
+    LOCK_TABLES();
+    const char *name = file_name(file_id);
+    UNLOCK_TABLES();
+    return name;
+}
+
+static void set_location(LispObject *cell, int file_id, int line, int column) {
+    if ((entry_count + 1) * 4 > slot_count * 3 && !grow()) return;
+
+    size_t i = slot_for(cell);
+    while (slots[i].cell && slots[i].cell != cell) {
+        i = (i + 1) & (slot_count - 1);
+    }
+    if (!slots[i].cell) entry_count++;
+    slots[i].cell = cell;
+    slots[i].location = SRCLOC_PACK(file_id, line, column);
+    cell->has_location = 1;
+}
+
+void srcloc_set(LispObject *cell, int file_id, int line, int column) {
+    if (!cell || file_id <= 0) return;
+
+    LOCK_TABLES();
+    set_location(cell, file_id, line, column);
+    UNLOCK_TABLES();
+}
+
+static void add_block(LispObject *cells, size_t count, int file_id,
+                      const BlockLocation *entries, size_t entry_count) {
+    if (block_count == block_capacity) {
+        size_t capacity = block_capacity ? block_capacity * 2 : 16;
+        LocationBlock *grown = (LocationBlock *)realloc(blocks, capacity * sizeof(LocationBlock));
+        if (!grown) return;
+        blocks = grown;
+        block_capacity = capacity;
+    }
+
+    size_t at = block_count;
+    while (at > 0 && (uintptr_t)blocks[at - 1].cells > (uintptr_t)cells) at--;
+    memmove(&blocks[at + 1], &blocks[at], (block_count - at) * sizeof(LocationBlock));
+    blocks[at].cells = cells;
+    blocks[at].count = count;
+    blocks[at].file_id = file_id;
+    blocks[at].entries = entries;
+    blocks[at].entry_count = entry_count;
+    block_count++;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].index < count) cells[entries[i].index].has_location = 1;
+    }
+}
+
+void srcloc_add_block(LispObject *cells, size_t count, int file_id,
+                      const BlockLocation *entries, size_t entry_count) {
+    if (file_id <= 0 || entry_count == 0) return;
+
+    LOCK_TABLES();
+    add_block(cells, count, file_id, entries, entry_count);
+    UNLOCK_TABLES();
+}
+
+/* Location of a cell in a block, if it is in one */
+static int block_lookup(const LispObject *cell, PackedLocation *location) {
+    uintptr_t address = (uintptr_t)cell;
+    size_t low = 0, high = block_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if ((uintptr_t)blocks[mid].cells <= address) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0) return 0;
+
+    const LocationBlock *block = &blocks[low - 1];
+    size_t index = (size_t)(cell - block->cells);
+    if (index >= block->count) return 0;
+
+    low = 0;
+    high = block->entry_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (block->entries[mid].index < index) low = mid + 1;
+        else high = mid;
+    }
+    if (low == block->entry_count || block->entries[low].index != index) return 0;
+
+    *location = SRCLOC_PACK(block->file_id, block->entries[low].line,
+                            block->entries[low].column);
+    return 1;
+}
+
+/* Location of a cell, from its block or the table */
+static int find_location(const LispObject *cell, PackedLocation *location) {
+    if (block_lookup(cell, location)) return 1;
+    if (!slots) return 0;
+
+    size_t i = slot_for(cell);
+    while (slots[i].cell) {
+        if (slots[i].cell == cell) {
+            *location = slots[i].location;
+            return 1;
+        }
+        i = (i + 1) & (slot_count - 1);
+    }
+    return 0;
+}
+
+int srcloc_get(LispObject *cell, const char **file, int *line, int *column) {
+    if (!cell || !cell->has_location) return 0;
+
+    LOCK_TABLES();
+    PackedLocation loc;
+    int found = find_location(cell, &loc);
+    if (found) {
+        if (file) *file = file_name(SRCLOC_FILE(loc));
+        if (line) *line = SRCLOC_LINE(loc);
+        if (column) *column = SRCLOC_COLUMN(loc);
+    }
+    UNLOCK_TABLES();
+    return found;
+}
+
+void srcloc_forget(LispObject *cell) {
+    if (!cell || !cell->has_location || !slots) return;
+    cell->has_location = 0;
+
+    size_t mask = slot_count - 1;
+    size_t i = slot_for(cell);
+    while (slots[i].cell != cell) {
+        if (!slots[i].cell) return;
+        i = (i + 1) & mask;
+    }
+
+    /* Move later entries of the run into the hole when their home slot
+     * does not lie between the hole and where they are now */
+    size_t j = i;
+    for (;;) {
+        slots[i].cell = NULL;
+        do {
+            j = (j + 1) & mask;
+            if (!slots[j].cell) {
+                entry_count--;
+                return;
+            }
+        } while (((j - slot_for(slots[j].cell)) & mask) < ((j - i) & mask));
+        slots[i] = slots[j];
+        i = j;
+    }
+}
+
+void srcloc_stats(size_t *entries, size_t *bytes) {
+    LOCK_TABLES();
+    size_t in_blocks = 0;
+    for (size_t i = 0; i < block_count; i++) {
+        in_blocks += blocks[i].entry_count;
+    }
+    if (entries) *entries = entry_count + in_blocks;
+    if (bytes) {
+        *bytes = slot_count * sizeof(LocationSlot) +
+                 in_blocks * sizeof(BlockLocation) +
+                 block_capacity * sizeof(LocationBlock);
+    }
+    UNLOCK_TABLES();
+}
+
+void srcloc_reset(void) {
+    free(slots);
+    slots = NULL;
+    slot_count = 0;
+    entry_count = 0;
+
+    free(blocks);
+    blocks = NULL;
+    block_count = 0;
+    block_capacity = 0;
+
+    for (int i = 0; i < file_count; i++) {
+        free(file_names[i]);
+    }
+    free(file_names);
+    file_names = NULL;
+    file_count = 0;
+    file_capacity = 0;
+}
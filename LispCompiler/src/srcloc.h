@@ -0,0 +1,67 @@
+/*
+ * srcloc.h - Source Locations of Parsed Forms
+ *
+ * A side table from cons cells to the place in the source where their
+ * list began, so that error messages, the debugger and profilers can
+ * report file, line and column for a form without every LispObject
+ * carrying them.  Each location is packed into 64 bits: a 16-bit file
+ * id, a 32-bit line and a 16-bit column.  Lookups hash the cell's
+ * address into an open-addressing table, or, for cells loaded in one
+ * block, binary-search the block's own entries; cells that have a
+ * location are flagged (LispObject.has_location) so that lookups for other objects
+ * and the collector's bookkeeping cost nothing.
+ */
+
+#ifndef SRCLOC_H
+#define SRCLOC_H
+
+#include "lisp.h"
+
+/* Packed location: file id in the top 16 bits, then the line, then the
+ * column (clamped to 65535) */
+typedef uint64_t PackedLocation;
+
+#define SRCLOC_PACK(file, line, column) \
+    (((uint64_t)(file) << 48) | ((uint64_t)(uint32_t)(line) << 16) | \
+     (uint64_t)((column) > 0xFFFF ? 0xFFFF : (column)))
+#define SRCLOC_FILE(loc)   ((int)((loc) >> 48))
+#define SRCLOC_LINE(loc)   ((int)(uint32_t)((loc) >> 16))
+#define SRCLOC_COLUMN(loc) ((int)((loc) & 0xFFFF))
+
+/* Location of the cell at index in a block of cells */
+typedef struct {
+    uint32_t index;
+    uint32_t line;
+    uint32_t column;
+} BlockLocation;
+
+/* Id of a source file name, registering it the first time it is seen;
+ * ids start at 1, and 0 is returned if the file table is full */
+int srcloc_file(const char *name);
+
+/* Name registered for a file id (NULL if there is none) */
+const char *srcloc_file_name(int file_id);
+
+/* Record where the list starting at cell begins */
+void srcloc_set(LispObject *cell, int file_id, int line, int column);
+
+/* Record the locations of cells laid out together in one block (a
+ * loaded fasl image).  The entries, sorted by index, are used in place
+ * and must stay valid while the cells are in use; the cells are never
+ * freed one by one. */
+void srcloc_add_block(LispObject *cells, size_t count, int file_id,
+                      const BlockLocation *entries, size_t entry_count);
+
+/* Look up a cell's location; returns 0 if it has none */
+int srcloc_get(LispObject *cell, const char **file, int *line, int *column);
+
+/* Drop a cell's location (called when the cell is freed) */
+void srcloc_forget(LispObject *cell);
+
+/* Number of recorded locations and bytes used by the table */
+void srcloc_stats(size_t *entries, size_t *bytes);
+
+/* Drop all locations and file names */
+void srcloc_reset(void);
+
+#endif /* SRCLOC_H */
@@ -0,0 +1,715 @@
+/*
+ * text.c - Text Kernels
+ *
+ * Each kernel has a loop over whole 32- or 16-byte blocks and a scalar
+ * loop that finishes the tail (and does all the work when no vector
+ * form applies).  The AVX2 and SSE4.2 forms are compiled for those
+ * instruction sets alone, with GCC and Clang target attributes, and
+ * run only when the processor reports them; SSE2 is the x86-64
+ * baseline and needs no check.
+ */
+
+#include "text.h"
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TEXT_X86 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(TEXT_X86) || defined(TEXT_SSE2)
+/* Index of the lowest set bit of a nonzero mask */
+static int lowest_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+#endif
+
+#ifdef TEXT_X86
+static int have_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int have_sse42(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+/* c in lower case if it is an ASCII capital */
+static unsigned char fold_byte(unsigned char c) {
+    return (unsigned char)(c - 'A') < 26 ? (unsigned char)(c ^ 0x20) : c;
+}
+
+/* ============================================================
+ * Sets
+ * ============================================================ */
+
+void text_set_init(TextSet *set, const char *chars, size_t length) {
+    memset(set, 0, sizeof(*set));
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (set->member[c]) continue;
+        set->member[c] = 1;
+        if (set->count < sizeof(set->bytes)) {
+            set->bytes[set->count] = c;
+        }
+        set->count++;
+    }
+}
+
+/* ============================================================
+ * Substring Search
+ * ============================================================ */
+
+/* Candidates are the places where the first and last bytes of the
+ * needle both match; only those are compared in full.  needle_length is
+ * at least 2. */
+
+static size_t search_scalar(const char *text, size_t length, const char *needle,
+                            size_t needle_length, size_t from) {
+    const char *p = text + from;
+    const char *last = text + length - needle_length;
+    while (p <= last) {
+        p = (const char *)memchr(p, needle[0], (size_t)(last - p) + 1);
+        if (!p) break;
+        if (p[needle_length - 1] == needle[needle_length - 1] &&
+            memcmp(p + 1, needle + 1, needle_length - 2) == 0) {
+            return (size_t)(p - text);
+        }
+        p++;
+    }
+    return TEXT_NOT_FOUND;
+}
+
+#ifdef TEXT_X86
+TARGET_AVX2
+static size_t search_avx2(const char *text, size_t length, const char *needle,
+                          size_t needle_length) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(text + i + needle_length - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + (size_t)lowest_bit(mask);
+            if (memcmp(text + at + 1, needle + 1, needle_length - 2) == 0) return at;
+            mask &= mask - 1;
+        }
+    }
+    return search_scalar(text, length, needle, needle_length, i);
+}
+#endif
+
+#ifdef TEXT_SSE2
+static size_t search_sse2(const char *text, size_t length, const char *needle,
+                          size_t needle_length) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + needle_length - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + (size_t)lowest_bit(mask);
+            if (memcmp(text + at + 1, needle + 1, needle_length - 2) == 0) return at;
+            mask &= mask - 1;
+        }
+    }
+    return search_scalar(text, length, needle, needle_length, i);
+}
+#endif
+
+size_t text_search(const char *text, size_t length,
+                   const char *needle, size_t needle_length) {
+    if (needle_length == 0) return 0;
+    if (needle_length > length) return TEXT_NOT_FOUND;
+    if (needle_length == 1) {
+        const char *p = (const char *)memchr(text, needle[0], length);
+        return p ? (size_t)(p - text) : TEXT_NOT_FOUND;
+    }
+#ifdef TEXT_X86
+    if (have_avx2()) return search_avx2(text, length, needle, needle_length);
+#endif
+#ifdef TEXT_SSE2
+    return search_sse2(text, length, needle, needle_length);
+#else
+    return search_scalar(text, length, needle, needle_length, 0);
+#endif
+}
+
+size_t text_search_last(const char *text, size_t length,
+                        const char *needle, size_t needle_length) {
+    if (needle_length > length) return TEXT_NOT_FOUND;
+    size_t at = length - needle_length;
+    if (needle_length == 0) return at;
+
+    /* Byte at a time: searching backward is rare enough */
+    for (;;) {
+        if (text[at] == needle[0] &&
+            memcmp(text + at + 1, needle + 1, needle_length - 1) == 0) {
+            return at;
+        }
+        if (at == 0) return TEXT_NOT_FOUND;
+        at--;
+    }
+}
+
+/* ============================================================
+ * Byte Sets
+ * ============================================================ */
+
+static size_t find_any_scalar(const char *text, size_t length, const TextSet *set,
+                              size_t from) {
+    for (size_t i = from; i < length; i++) {
+        if (set->member[(unsigned char)text[i]]) return i;
+    }
+    return TEXT_NOT_FOUND;
+}
+
+/* Sets of up to four bytes: one comparison per byte of the set.  The
+ * unused comparisons repeat the first byte. */
+
+#ifdef TEXT_X86
+TARGET_AVX2
+static size_t find_few_avx2(const char *text, size_t length, const TextSet *set) {
+    const unsigned char *b = set->bytes;
+    const __m256i c0 = _mm256_set1_epi8((char)b[0]);
+    const __m256i c1 = _mm256_set1_epi8((char)b[set->count > 1 ? 1 : 0]);
+    const __m256i c2 = _mm256_set1_epi8((char)b[set->count > 2 ? 2 : 0]);
+    const __m256i c3 = _mm256_set1_epi8((char)b[set->count > 3 ? 3 : 0]);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, c1)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, c2), _mm256_cmpeq_epi8(v, c3)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask) return i + (size_t)lowest_bit(mask);
+    }
+    return find_any_scalar(text, length, set, i);
+}
+
+/* Sets of up to 16 bytes: PCMPESTRI compares a block with all of them */
+TARGET_SSE42
+static size_t find_any_sse42(const char *text, size_t length, const TextSet *set) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)set->bytes);
+    const int count = (int)set->count;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        int at = _mm_cmpestri(bytes, count, v, 16,
+                              _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (at < 16) return i + (size_t)at;
+    }
+    return find_any_scalar(text, length, set, i);
+}
+#endif
+
+#ifdef TEXT_SSE2
+static size_t find_few_sse2(const char *text, size_t length, const TextSet *set) {
+    const unsigned char *b = set->bytes;
+    const __m128i c0 = _mm_set1_epi8((char)b[0]);
+    const __m128i c1 = _mm_set1_epi8((char)b[set->count > 1 ? 1 : 0]);
+    const __m128i c2 = _mm_set1_epi8((char)b[set->count > 2 ? 2 : 0]);
+    const __m128i c3 = _mm_set1_epi8((char)b[set->count > 3 ? 3 : 0]);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, c1)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, c2), _mm_cmpeq_epi8(v, c3)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask) return i + (size_t)lowest_bit(mask);
+    }
+    return find_any_scalar(text, length, set, i);
+}
+#endif
+
+size_t text_find_any(const char *text, size_t length, const TextSet *set) {
+    if (set->count == 0) return TEXT_NOT_FOUND;
+    if (set->count == 1) {
+        const char *p = (const char *)memchr(text, set->bytes[0], length);
+        return p ? (size_t)(p - text) : TEXT_NOT_FOUND;
+    }
+#ifdef TEXT_X86
+    if (set->count <= 4 && have_avx2()) return find_few_avx2(text, length, set);
+    if (set->count <= 16 && have_sse42()) return find_any_sse42(text, length, set);
+#endif
+#ifdef TEXT_SSE2
+    if (set->count <= 4) return find_few_sse2(text, length, set);
+#endif
+    return find_any_scalar(text, length, set, 0);
+}
+
+/* ============================================================
+ * Case
+ * ============================================================ */
+
+/* Flip the case of the bytes from first to first + 25.  Adding
+ * 128 - first moves that range to the bottom of the signed bytes, where
+ * one signed comparison picks it out. */
+
+static void convert_scalar(char *dst, const char *src, size_t length, char first,
+                           size_t from) {
+    for (size_t i = from; i < length; i++) {
+        char c = src[i];
+        dst[i] = (unsigned char)(c - first) < 26 ? (char)(c ^ 0x20) : c;
+    }
+}
+
+#ifdef TEXT_X86
+TARGET_AVX2
+static void convert_avx2(char *dst, const char *src, size_t length, char first) {
+    const __m256i shift = _mm256_set1_epi8((char)(128 - first));
+    const __m256i bound = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i in = _mm256_cmpgt_epi8(bound, _mm256_add_epi8(v, shift));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_xor_si256(v, _mm256_and_si256(in, flip)));
+    }
+    convert_scalar(dst, src, length, first, i);
+}
+#endif
+
+#ifdef TEXT_SSE2
+static void convert_sse2(char *dst, const char *src, size_t length, char first) {
+    const __m128i shift = _mm_set1_epi8((char)(128 - first));
+    const __m128i bound = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i in = _mm_cmpgt_epi8(bound, _mm_add_epi8(v, shift));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, _mm_and_si128(in, flip)));
+    }
+    convert_scalar(dst, src, length, first, i);
+}
+#endif
+
+static void convert(char *dst, const char *src, size_t length, char first) {
+#ifdef TEXT_X86
+    if (length >= 32 && have_avx2()) {
+        convert_avx2(dst, src, length, first);
+        return;
+    }
+#endif
+#ifdef TEXT_SSE2
+    convert_sse2(dst, src, length, first);
+#else
+    convert_scalar(dst, src, length, first, 0);
+#endif
+}
+
+void text_upcase(char *dst, const char *src, size_t length) {
+    convert(dst, src, length, 'a');
+}
+
+void text_downcase(char *dst, const char *src, size_t length) {
+    convert(dst, src, length, 'A');
+}
+
+/* ============================================================
+ * Comparison
+ * ============================================================ */
+
+int text_compare(const char *a, size_t a_length, const char *b, size_t b_length) {
+    size_t n = a_length < b_length ? a_length : b_length;
+    int order = n ? memcmp(a, b, n) : 0;
+    if (order) return order;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+/* Index of the first byte at which a and b differ as lower case, from
+ * from, or n */
+static size_t mismatch_ci_scalar(const char *a, const char *b, size_t n, size_t from) {
+    for (size_t i = from; i < n; i++) {
+        if (fold_byte((unsigned char)a[i]) != fold_byte((unsigned char)b[i])) return i;
+    }
+    return n;
+}
+
+#ifdef TEXT_X86
+TARGET_AVX2
+static size_t mismatch_ci_avx2(const char *a, const char *b, size_t n) {
+    const __m256i shift = _mm256_set1_epi8((char)(128 - 'A'));
+    const __m256i bound = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        x = _mm256_xor_si256(x, _mm256_and_si256(
+            _mm256_cmpgt_epi8(bound, _mm256_add_epi8(x, shift)), flip));
+        y = _mm256_xor_si256(y, _mm256_and_si256(
+            _mm256_cmpgt_epi8(bound, _mm256_add_epi8(y, shift)), flip));
+        unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask) return i + (size_t)lowest_bit(mask);
+    }
+    return mismatch_ci_scalar(a, b, n, i);
+}
+#endif
+
+#ifdef TEXT_SSE2
+static size_t mismatch_ci_sse2(const char *a, const char *b, size_t n) {
+    const __m128i shift = _mm_set1_epi8((char)(128 - 'A'));
+    const __m128i bound = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        x = _mm_xor_si128(x, _mm_and_si128(_mm_cmpgt_epi8(bound, _mm_add_epi8(x, shift)), flip));
+        y = _mm_xor_si128(y, _mm_and_si128(_mm_cmpgt_epi8(bound, _mm_add_epi8(y, shift)), flip));
+        unsigned int mask = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (mask) return i + (size_t)lowest_bit(mask);
+    }
+    return mismatch_ci_scalar(a, b, n, i);
+}
+#endif
+
+int text_compare_ci(const char *a, size_t a_length, const char *b, size_t b_length) {
+    size_t n = a_length < b_length ? a_length : b_length;
+    size_t at;
+#ifdef TEXT_X86
+    if (n >= 32 && have_avx2()) {
+        at = mismatch_ci_avx2(a, b, n);
+    } else
+#endif
+    {
+#ifdef TEXT_SSE2
+        at = mismatch_ci_sse2(a, b, n);
+#else
+        at = mismatch_ci_scalar(a, b, n, 0);
+#endif
+    }
+    if (at < n) {
+        return (int)fold_byte((unsigned char)a[at]) - (int)fold_byte((unsigned char)b[at]);
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+/* ============================================================
+ * UTF-8
+ * ============================================================ */
+
+int text_is_scalar(uint32_t code) {
+    return code <= TEXT_MAX_CODE && (code < 0xD800 || code > 0xDFFF);
+}
+
+size_t text_utf8_encode(uint32_t code, char *out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+size_t text_utf8_decode(const char *text, size_t length, uint32_t *code) {
+    const unsigned char *s = (const unsigned char *)text;
+    unsigned char c = s[0];
+    if (c < 0x80) {
+        *code = c;
+        return 1;
+    }
+    if (c < 0xE0 && length >= 2) {
+        *code = ((uint32_t)(c & 0x1F) << 6) | (s[1] & 0x3F);
+        return 2;
+    }
+    if (c < 0xF0 && length >= 3) {
+        *code = ((uint32_t)(c & 0x0F) << 12) | ((uint32_t)(s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        return 3;
+    }
+    if (length >= 4) {
+        *code = ((uint32_t)(c & 0x07) << 18) | ((uint32_t)(s[1] & 0x3F) << 12) |
+                ((uint32_t)(s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        return 4;
+    }
+    *code = TEXT_REPLACEMENT;
+    return 1;
+}
+
+/* Validation: a byte at a time from from, which must start a character,
+ * skipping eight bytes at a time through ASCII */
+static size_t utf8_valid_scalar(const unsigned char *s, size_t length, size_t from) {
+    size_t i = from;
+    while (i < length) {
+        if (i + 8 <= length) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        /* The range of the second byte depends on the first: it rules out
+         * overlong forms, surrogates and values past U+10FFFF */
+        size_t n;
+        unsigned char low = 0x80, high = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            n = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) low = 0xA0;
+            if (c == 0xED) high = 0x9F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) low = 0x90;
+            if (c == 0xF4) high = 0x8F;
+        } else {
+            return i;
+        }
+
+        if (length - i < n || s[i + 1] < low || s[i + 1] > high) return i;
+        for (size_t k = 2; k < n; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) return i;
+        }
+        i += n;
+    }
+    return length;
+}
+
+#ifdef TEXT_X86
+/* Keiser and Lemire, "Validating UTF-8 in less than one instruction per
+ * byte" (2021).  Each byte is checked against the one to three before
+ * it: three table lookups, on the high and low nibbles of the byte
+ * before and the high nibble of this one, flag every error visible in
+ * a pair of bytes, and the bytes two and three after a three- or
+ * four-byte lead must be continuations. */
+
+#define UTF8_TOO_SHORT   (1 << 0)   /* Lead or ASCII after a lead */
+#define UTF8_TOO_LONG    (1 << 1)   /* Continuation after ASCII */
+#define UTF8_OVERLONG_3  (1 << 2)
+#define UTF8_TOO_LARGE   (1 << 3)
+#define UTF8_SURROGATE   (1 << 4)
+#define UTF8_OVERLONG_2  (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4  (1 << 6)
+#define UTF8_TWO_CONTS   (-128)     /* Continuation after a continuation (bit 7) */
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+/* The 32 bytes before each byte of input, n back, taking the first from
+ * the end of prev */
+#define UTF8_PREV(input, prev, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+TARGET_AVX2
+static size_t utf8_valid_avx2(const unsigned char *s, size_t length) {
+    const __m256i byte_1_high_table = UTF8_TABLE(
+        /* 0xxx: ASCII */
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        /* 10xx: continuation */
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        /* 1100, 1101: two-byte lead */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        /* 1110: three-byte lead */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        /* 1111: four-byte lead */
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m256i byte_1_low_table = UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte_2_high_table = UTF8_TABLE(
+        /* 0xxx: ASCII */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        /* 1000 */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        /* 1001 */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        /* 101x */
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        /* 11xx: lead */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i third_lead = _mm256_set1_epi8((char)(0xE0 - 0x80));
+    const __m256i fourth_lead = _mm256_set1_epi8((char)(0xF0 - 0x80));
+    const __m256i high_bit = _mm256_set1_epi8((char)0x80);
+    /* Nonzero where the last bytes of a block start an unfinished
+     * sequence */
+    const __m256i unfinished = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(s + i));
+
+        /* ASCII: valid unless the block before left a sequence open */
+        if (!_mm256_movemask_epi8(input)) {
+            if (!_mm256_testz_si256(incomplete, incomplete)) break;
+            prev = input;
+            continue;
+        }
+
+        __m256i prev1 = UTF8_PREV(input, prev, 1);
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(byte_1_high_table,
+                                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble))),
+            _mm256_shuffle_epi8(byte_2_high_table,
+                                _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+        __m256i must_continue = _mm256_and_si256(
+            _mm256_or_si256(_mm256_subs_epu8(UTF8_PREV(input, prev, 2), third_lead),
+                            _mm256_subs_epu8(UTF8_PREV(input, prev, 3), fourth_lead)),
+            high_bit);
+        __m256i error = _mm256_xor_si256(must_continue, special);
+        if (!_mm256_testz_si256(error, error)) break;
+
+        incomplete = _mm256_subs_epu8(input, unfinished);
+        prev = input;
+    }
+    return i;
+}
+#endif
+
+size_t text_utf8_valid(const char *text, size_t length) {
+    const unsigned char *s = (const unsigned char *)text;
+    size_t from = 0;
+#ifdef TEXT_X86
+    if (length >= 32 && have_avx2()) {
+        /* The blocks before from are valid but for a sequence that may
+         * run over into the next: back up to its lead, and let the
+         * scalar loop check it and the rest */
+        size_t end = utf8_valid_avx2(s, length);
+        from = end;
+        for (size_t k = 1; k <= 3 && k <= end; k++) {
+            unsigned char c = s[end - k];
+            if ((c & 0xC0) == 0x80) continue;
+            if (c >= 0xC0) from = end - k;
+            break;
+        }
+    }
+#endif
+    return utf8_valid_scalar(s, length, from);
+}
+
+/* Characters: the bytes that are not continuations (0x80 to 0xBF, as
+ * signed bytes -128 to -65) */
+
+static size_t count_scalar(const char *text, size_t length, size_t from) {
+    size_t count = 0;
+    for (size_t i = from; i < length; i++) {
+        count += ((unsigned char)text[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+static int bit_count(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+#endif
+}
+
+#ifdef TEXT_X86
+TARGET_AVX2
+static size_t count_avx2(const char *text, size_t length) {
+    const __m256i last_continuation = _mm256_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+        count += (size_t)bit_count((unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(v, last_continuation)));
+    }
+    return count + count_scalar(text, length, i);
+}
+#endif
+
+#ifdef TEXT_SSE2
+static size_t count_sse2(const char *text, size_t length) {
+    const __m128i last_continuation = _mm_set1_epi8(-65);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        count += (size_t)bit_count((unsigned int)_mm_movemask_epi8(
+            _mm_cmpgt_epi8(v, last_continuation)));
+    }
+    return count + count_scalar(text, length, i);
+}
+#endif
+
+size_t text_utf8_count(const char *text, size_t length) {
+#ifdef TEXT_X86
+    if (length >= 32 && have_avx2()) return count_avx2(text, length);
+#endif
+#ifdef TEXT_SSE2
+    return count_sse2(text, length);
+#else
+    return count_scalar(text, length, 0);
+#endif
+}
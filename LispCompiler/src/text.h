@@ -0,0 +1,90 @@
+/*
+ * text.h - Text Kernels
+ *
+ * The loops under the string primitives: substring search, search for
+ * any of a set of bytes (for splitting and string-index), ASCII case
+ * conversion and case-insensitive comparison.  On x86 they run 32
+ * bytes at a time with AVX2 or 16 with SSE2 and SSE4.2, chosen by what
+ * the processor supports when called; elsewhere, and for the short
+ * tails, they run a byte at a time.  Single-byte search and
+ * case-sensitive comparison are memchr and memcmp, which the C library
+ * already vectorizes.
+ *
+ * Strings hold UTF-8 (lisp.h).  The kernels here that search, split
+ * and compare work on the bytes, which for UTF-8 gives the same matches
+ * and order as working on the characters; case conversion changes only
+ * ASCII letters.  The UTF-8 kernels validate (Keiser and Lemire's
+ * lookup algorithm with AVX2), count characters and convert between
+ * characters and their bytes.
+ */
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by the searches when there is no match */
+#define TEXT_NOT_FOUND ((size_t)-1)
+
+/* A set of bytes to search for */
+typedef struct {
+    unsigned char member[256];   /* Nonzero for the bytes in the set */
+    unsigned char bytes[16];     /* The bytes, when there are at most 16 */
+    size_t count;                /* How many distinct bytes */
+} TextSet;
+
+/* The set of the length bytes at chars (repeats are counted once) */
+void text_set_init(TextSet *set, const char *chars, size_t length);
+
+/* Index of the first occurrence of the needle_length bytes at needle in
+ * the length bytes at text, or TEXT_NOT_FOUND.  An empty needle is
+ * found at 0. */
+size_t text_search(const char *text, size_t length,
+                   const char *needle, size_t needle_length);
+
+/* Index of the last occurrence, or TEXT_NOT_FOUND.  An empty needle is
+ * found at length. */
+size_t text_search_last(const char *text, size_t length,
+                        const char *needle, size_t needle_length);
+
+/* Index of the first of the length bytes at text in set, or
+ * TEXT_NOT_FOUND */
+size_t text_find_any(const char *text, size_t length, const TextSet *set);
+
+/* Copy length bytes from src to dst with ASCII letters in upper or
+ * lower case; dst may be src */
+void text_upcase(char *dst, const char *src, size_t length);
+void text_downcase(char *dst, const char *src, size_t length);
+
+/* Compare two byte strings, a shorter prefix first: negative, zero or
+ * positive as a is less than, equal to or greater than b.  The _ci
+ * form compares ASCII letters as lower case. */
+int text_compare(const char *a, size_t a_length, const char *b, size_t b_length);
+int text_compare_ci(const char *a, size_t a_length, const char *b, size_t b_length);
+
+/* The largest Unicode scalar value, and the replacement character that
+ * stands for bytes that are not UTF-8 */
+#define TEXT_MAX_CODE 0x10FFFF
+#define TEXT_REPLACEMENT 0xFFFD
+
+/* Length of the longest prefix of the length bytes at text that is
+ * valid UTF-8 (length if all of it is) */
+size_t text_utf8_valid(const char *text, size_t length);
+
+/* Characters in the length bytes of valid UTF-8 at text */
+size_t text_utf8_count(const char *text, size_t length);
+
+/* Decode the character that starts at text, in valid UTF-8 of length
+ * bytes: sets *code and returns the bytes it takes (1 to 4) */
+size_t text_utf8_decode(const char *text, size_t length, uint32_t *code);
+
+/* Write the UTF-8 of code, a scalar value, to out (room for 4 bytes);
+ * returns the bytes written */
+size_t text_utf8_encode(uint32_t code, char *out);
+
+/* Whether code is a Unicode scalar value: at most TEXT_MAX_CODE and not
+ * a surrogate */
+int text_is_scalar(uint32_t code);
+
+#endif /* TEXT_H */
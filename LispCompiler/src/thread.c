@@ -0,0 +1,253 @@
+/*
+ * thread.c - Threads and Mutexes
+ *
+ * The parent creates a started thread's context, rooting the thread
+ * object (and through it the thunk and, later, the result) until the
+ * thread has finished.  The thread records its result or error, wakes
+ * its joiners, and only then destroys its context.
+ */
+
+#include "thread.h"
+#include "eval.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef enum {
+    THREAD_NEW,
+    THREAD_RUNNING,
+    THREAD_DONE
+} ThreadStatus;
+
+/* The operating system side of a thread object (thread.handle) */
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t done;        /* Signalled when status becomes DONE */
+#endif
+    ThreadStatus status;
+    char *error;                /* Message of an error in the thread */
+} ThreadState;
+
+/* The state of a mutex object (mutex.handle) */
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t unlocked;
+#endif
+    int locked;
+} MutexState;
+
+/* ============================================================
+ * Threads
+ * ============================================================ */
+
+LispObject *make_thread(LispObject *thunk, LispObject *name) {
+    ThreadState *state = (ThreadState *)calloc(1, sizeof(ThreadState));
+    if (!state) {
+        lisp_error("make-thread: out of memory");
+        return make_nil();
+    }
+#ifndef _WIN32
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->done, NULL);
+#endif
+    state->status = THREAD_NEW;
+
+    LispObject *obj = lisp_alloc();
+    obj->type = LISP_THREAD;
+    obj->thread.thunk = thunk;
+    obj->thread.name = name;
+    obj->thread.result = NULL;
+    obj->thread.handle = state;
+    return obj;
+}
+
+int is_thread(LispObject *obj) {
+    return obj && obj->type == LISP_THREAD;
+}
+
+#ifndef _WIN32
+static void *thread_main(void *arg) {
+    LispContext *context = (LispContext *)arg;
+    lisp_context_enter(context);
+
+    LispObject *thread = context->thread;
+    ThreadState *state = (ThreadState *)thread->thread.handle;
+    thread->thread.result = apply(thread->thread.thunk, make_nil(), NULL);
+    char *error = lisp_had_error() ? strdup(context->error_message) : NULL;
+
+    pthread_mutex_lock(&state->lock);
+    state->error = error;
+    state->status = THREAD_DONE;
+    pthread_cond_broadcast(&state->done);
+    pthread_mutex_unlock(&state->lock);
+
+    lisp_context_destroy(context);
+    return NULL;
+}
+#endif
+
+int thread_start(LispObject *thread) {
+#ifndef _WIN32
+    ThreadState *state = (ThreadState *)thread->thread.handle;
+    pthread_mutex_lock(&state->lock);
+    int fresh = state->status == THREAD_NEW;
+    if (fresh) state->status = THREAD_RUNNING;
+    pthread_mutex_unlock(&state->lock);
+    if (!fresh) {
+        lisp_error("thread-start!: thread was already started");
+        return 1;
+    }
+
+    LispContext *context = lisp_context_create(thread);
+    pthread_t id;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, lisp_stack_size());
+    int failed = !context || pthread_create(&id, &attr, thread_main, context) != 0;
+    pthread_attr_destroy(&attr);
+    if (failed) {
+        lisp_context_destroy(context);
+        pthread_mutex_lock(&state->lock);
+        state->status = THREAD_NEW;
+        pthread_mutex_unlock(&state->lock);
+        lisp_error("thread-start!: cannot create a thread");
+        return 1;
+    }
+    pthread_detach(id);
+    return 0;
+#else
+    (void)thread;
+    lisp_error("thread-start!: threads are not supported on this platform");
+    return 1;
+#endif
+}
+
+LispObject *thread_join(LispObject *thread) {
+    ThreadState *state = (ThreadState *)thread->thread.handle;
+#ifndef _WIN32
+    pthread_mutex_lock(&state->lock);
+    ThreadStatus status = state->status;
+    pthread_mutex_unlock(&state->lock);
+
+    if (status == THREAD_RUNNING) {
+        gc_blocking_begin();
+        pthread_mutex_lock(&state->lock);
+        while (state->status != THREAD_DONE) {
+            pthread_cond_wait(&state->done, &state->lock);
+        }
+        pthread_mutex_unlock(&state->lock);
+        gc_blocking_end();
+        status = THREAD_DONE;
+    }
+#else
+    ThreadStatus status = state->status;
+#endif
+
+    if (status == THREAD_NEW) {
+        lisp_error("thread-join!: thread was not started");
+        return make_nil();
+    }
+    if (state->error) {
+        lisp_error("thread-join!: thread failed: %s", state->error);
+        return make_nil();
+    }
+    return thread->thread.result ? thread->thread.result : make_nil();
+}
+
+void thread_free(LispObject *thread) {
+    ThreadState *state = (ThreadState *)thread->thread.handle;
+    if (!state) return;
+#ifndef _WIN32
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->done);
+#endif
+    free(state->error);
+    free(state);
+}
+
+/* ============================================================
+ * Mutexes
+ * ============================================================ */
+
+LispObject *make_mutex(LispObject *name) {
+    MutexState *state = (MutexState *)calloc(1, sizeof(MutexState));
+    if (!state) {
+        lisp_error("make-mutex: out of memory");
+        return make_nil();
+    }
+#ifndef _WIN32
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->unlocked, NULL);
+#endif
+
+    LispObject *obj = lisp_alloc();
+    obj->type = LISP_MUTEX;
+    obj->mutex.name = name;
+    obj->mutex.handle = state;
+    return obj;
+}
+
+int is_mutex(LispObject *obj) {
+    return obj && obj->type == LISP_MUTEX;
+}
+
+void mutex_lock(LispObject *mutex) {
+    MutexState *state = (MutexState *)mutex->mutex.handle;
+#ifndef _WIN32
+    /* Uncontended: no need to let collections run without us */
+    pthread_mutex_lock(&state->lock);
+    int acquired = !state->locked;
+    if (acquired) state->locked = 1;
+    pthread_mutex_unlock(&state->lock);
+    if (acquired) return;
+
+    gc_blocking_begin();
+    pthread_mutex_lock(&state->lock);
+    while (state->locked) {
+        pthread_cond_wait(&state->unlocked, &state->lock);
+    }
+    state->locked = 1;
+    pthread_mutex_unlock(&state->lock);
+    gc_blocking_end();
+#else
+    if (state->locked) {
+        lisp_error("mutex-lock!: mutex is locked and no other thread can unlock it");
+        return;
+    }
+    state->locked = 1;
+#endif
+}
+
+int mutex_unlock(LispObject *mutex) {
+    MutexState *state = (MutexState *)mutex->mutex.handle;
+#ifndef _WIN32
+    pthread_mutex_lock(&state->lock);
+    int was_locked = state->locked;
+    state->locked = 0;
+    if (was_locked) pthread_cond_signal(&state->unlocked);
+    pthread_mutex_unlock(&state->lock);
+#else
+    int was_locked = state->locked;
+    state->locked = 0;
+#endif
+    if (!was_locked) {
+        lisp_error("mutex-unlock!: mutex is not locked");
+        return 1;
+    }
+    return 0;
+}
+
+void mutex_free(LispObject *mutex) {
+    MutexState *state = (MutexState *)mutex->mutex.handle;
+    if (!state) return;
+#ifndef _WIN32
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->unlocked);
+#endif
+    free(state);
+}
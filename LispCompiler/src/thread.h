@@ -0,0 +1,46 @@
+/*
+ * thread.h - Threads and Mutexes
+ *
+ * SRFI-18 style threads: (make-thread thunk) makes a thread that has
+ * not started, thread-start! runs the thunk on a new operating system
+ * thread with its own evaluation context (see LispContext in lisp.h),
+ * and thread-join! waits for it and returns the thunk's value.  All
+ * threads share the heap and the global environment.
+ *
+ * Mutexes are not owned: any thread may unlock a mutex another locked,
+ * as SRFI-18 allows.  Waiting for a mutex or a thread lets collections
+ * run without the waiting thread.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "lisp.h"
+
+/* Threads */
+LispObject *make_thread(LispObject *thunk, LispObject *name);
+int is_thread(LispObject *obj);
+
+/* Start a thread; returns 0, or 1 (after reporting an error) if it was
+ * started before or could not be created */
+int thread_start(LispObject *thread);
+
+/* Wait for a started thread to finish and return the thunk's value; an
+ * error in the thread is reported as an error of the join */
+LispObject *thread_join(LispObject *thread);
+
+/* Mutexes */
+LispObject *make_mutex(LispObject *name);
+int is_mutex(LispObject *obj);
+void mutex_lock(LispObject *mutex);
+
+/* Returns 0, or 1 (after reporting an error) if the mutex was not
+ * locked */
+int mutex_unlock(LispObject *mutex);
+
+/* Release the operating system resources of a thread or mutex (called
+ * by the collector when it frees one) */
+void thread_free(LispObject *thread);
+void mutex_free(LispObject *mutex);
+
+#endif /* THREAD_H */
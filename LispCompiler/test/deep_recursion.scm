@@ -0,0 +1,11 @@
+; deep_recursion.scm - recursion too deep for the stack is reported, in
+; every build and by compiled code, and the program goes on
+
+(define (deep n) (if (= n 0) '() (let ((r (deep (- n 1)))) (cons n r))))
+(deep 100000)
+(define (deep-quasi n) (if (= n 0) '() `(,n ,@(deep-quasi (- n 1)))))
+(deep-quasi 100000)
+(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))
+(fact 5.5)
+(display "survived")
+(newline)
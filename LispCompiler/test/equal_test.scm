@@ -0,0 +1,55 @@
+; equal? on long, deep, shared and circular structure
+
+(define (iota-list n)
+  (do ((i 0 (+ i 1)) (l '() (cons i l))) ((= i n) l)))
+
+(define (nest n)
+  (do ((i 0 (+ i 1)) (l '() (list l))) ((= i n) l)))
+
+; Each level holds the level below twice: 2^n paths, n + 1 pairs
+(define (dag n)
+  (do ((i 0 (+ i 1)) (l '() (cons l l))) ((= i n) l)))
+
+; Long lists and deep nesting compare without exhausting the C stack
+(display (equal? (iota-list 500000) (iota-list 500000)))
+(newline)
+(display (equal? (nest 200000) (nest 200000)))
+(newline)
+
+; Shared structure is compared once, not once per path
+(display (equal? (dag 64) (dag 64)))
+(newline)
+
+; Vectors and strings compare element by element
+(display (list (equal? (vector 1 "a" (list 2)) (vector 1 "a" (list 2)))
+               (equal? (vector 1 2) (vector 1 3))
+               (equal? "abc" "abd")))
+(newline)
+
+; Circular lists: a cycle of 1 2 3 equals one unrolled twice
+(define a (list 1 2 3))
+(set-cdr! (cdr (cdr a)) a)
+(define b (list 1 2 3 1 2 3))
+(set-cdr! (list-tail b 5) b)
+(define c (list 1 2 3 1 2 4))
+(set-cdr! (list-tail c 5) c)
+(display (list (equal? a b) (equal? a c)))
+(newline)
+
+; A cycle through cars and vectors
+(define v (vector 1 '()))
+(vector-set! v 1 (list v))
+(define w (vector 1 '()))
+(vector-set! w 1 (list w))
+(display (equal? v w))
+(newline)
+
+; member, assoc and equal hashtables use equal?
+(display (member (list 2) (list (list 1) (list 2) (list 3))))
+(newline)
+(display (assoc (list "b") (list (cons (list "a") 1) (cons (list "b") 2))))
+(newline)
+(define table (make-hashtable))
+(hashtable-set! table (list 1 "two" (vector 3)) 'found)
+(display (hashtable-ref table (list 1 "two" (vector 3)) 'missing))
+(newline)
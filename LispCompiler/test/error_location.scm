@@ -0,0 +1,10 @@
+; Runtime errors report the file, line and column of the innermost
+; form being evaluated
+(define (second-of lst)
+  (car
+    (cdr lst)))
+
+(display (second-of '(1 2)))
+(newline)
+(display (second-of 5))
+(newline)
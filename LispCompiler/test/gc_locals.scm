@@ -0,0 +1,19 @@
+; gc_locals.scm - Values held only by running code survive collections
+;
+; A do loop whose bindings are reachable from nothing but the loop,
+; across enough allocation to collect many times, and a hash table of
+; integer keys with deletions in its probe runs.
+
+(define (sum-with-pairs n)
+  (do ((i 0 (+ i 1))
+       (last '() (cons i '()))
+       (sum 0 (+ sum i)))
+      ((= i n) (list last sum))))
+(display (sum-with-pairs 300000))
+(newline)
+
+(define table (make-eqv-hashtable))
+(do ((i 0 (+ i 1))) ((= i 1000)) (hashtable-set! table i (* i i)))
+(do ((i 0 (+ i 2))) ((>= i 1000)) (hashtable-delete! table i))
+(display (list (hashtable-size table) (hashtable-ref table 999 #f) (hashtable-ref table 998 #f)))
+(newline)
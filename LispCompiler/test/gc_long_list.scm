@@ -0,0 +1,30 @@
+; gc_long_list.scm - Collecting a heap with a long list
+;
+; A list of 300000 cells is live through several collections; marking
+; it must not recurse once per cell.
+
+(define (build n)
+  (do ((i 0 (+ i 1))
+       (acc '() (cons i acc)))
+      ((= i n) acc)))
+
+(define big (build 300000))
+
+(define table (make-vector 50000 0))
+(do ((i 0 (+ i 1))) ((= i 50000))
+  (vector-set! table i (list i)))
+
+(define (churn k)
+  (if (> k 0)
+      (begin (build 50000)
+             (churn (- k 1)))))
+(churn 10)
+
+(display (length big))
+(newline)
+(display (fold + 0 big))
+(newline)
+(display (fold + 0 (map car (vector->list table))))
+(newline)
+(display (> (cdr (assq 'collections (gc-statistics))) 1))
+(newline)
@@ -0,0 +1,43 @@
+; gc_stats.scm - GC telemetry
+;
+; Allocates enough garbage for several collections, then checks what
+; (gc-statistics) reports about them.
+
+(define (build n acc)
+  (if (= n 0)
+      acc
+      (build (- n 1) (cons (make-vector 3 n) acc))))
+
+(define (churn k)
+  (if (> k 0)
+      (begin (build 500 '())
+             (churn (- k 1)))))
+
+(churn 100)
+
+(define stats (gc-statistics))
+(define (stat name) (cdr (assq name stats)))
+
+(display "collected = ")
+(display (> (stat 'collections) 0))
+(newline)
+
+(display "live objects = ")
+(display (> (stat 'live-objects) 0))
+(newline)
+
+; Every collection is in the histogram
+(display "histogram = ")
+(display (= (fold + 0 (map cdr (stat 'pause-histogram)))
+            (stat 'collections)))
+(newline)
+
+; Allocation counts cover at least the 50000 vectors made by build
+(display "vectors = ")
+(display (>= (car (cdr (assq 'vector (stat 'allocations)))) 50000))
+(newline)
+
+; The busiest allocation site is in build
+(display "top site = ")
+(display (car (car (stat 'sites))))
+(newline)
@@ -0,0 +1,40 @@
+; image_lib.scm - Library saved in a heap image
+;
+; Defines procedures, closures with private state, a macro, and data of
+; several kinds, for image_main.scm to use from a fresh interpreter.
+
+(define (square x) (* x x))
+
+(define (make-counter)
+  (let ((count 0))
+    (lambda ()
+      (set! count (+ count 1))
+      count)))
+
+(define next-id (make-counter))
+(next-id)
+(next-id)
+
+(defmacro swap! (a b)
+  `(let ((tmp ,a))
+     (set! ,a ,b)
+     (set! ,b tmp)))
+
+(define table (make-eq-hashtable))
+(hashtable-set! table 'one 1)
+(hashtable-set! table 'two 2)
+(hashtable-set! table 'three 3)
+
+(define numbers (vector 1 2.5 -3 1e10))
+(define greeting (string-append "hello" ", " "image"))
+(define shared '(a b c))
+(define both (list shared shared))
+(define plus +)
+
+(define (describe x)
+  (cond ((number? x) "number")
+        ((string? x) "string")
+        ((symbol? x) "symbol")
+        (else "other")))
+
+(define odd-squares (compose (tfilter odd?) (tmap square)))
@@ -0,0 +1,34 @@
+; image_main.scm - Program run after image_lib.scm, either in the same
+; interpreter or from an image saved after it
+
+(display "square = ") (display (square 12)) (newline)
+
+; The counter keeps counting from where it was saved
+(display "next-id = ") (display (next-id)) (newline)
+
+(define x 1)
+(define y 2)
+(swap! x y)
+(display "swapped = ") (display (list x y)) (newline)
+
+; Symbols are hashed by address, which changes between runs
+(display "table = ")
+(display (list (hashtable-ref table 'one 0)
+               (hashtable-ref table 'two 0)
+               (hashtable-ref table 'three 0)
+               (hashtable-ref table 'four 0)))
+(newline)
+(hashtable-set! table 'four 4)
+(display "size = ") (display (hashtable-size table)) (newline)
+
+(display "numbers = ") (display numbers) (newline)
+(display "greeting = ") (display greeting) (newline)
+(display "shared = ") (display (eq? (car both) (car (cdr both)))) (newline)
+(display "plus = ") (display (plus 1 2 3)) (newline)
+(display "describe = ")
+(display (map describe (list 1 "s" 'sym #\c)))
+(newline)
+(display "symbol = ") (display (eq? (car shared) 'a)) (newline)
+(display "transduce = ")
+(display (list-transduce odd-squares rcons '(1 2 3 4 5)))
+(newline)
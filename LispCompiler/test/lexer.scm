@@ -0,0 +1,9 @@
+; lexer.scm - Tokens that start with a dot
+;
+; A dot alone separates the tail of a dotted pair; followed by digits it
+; starts a number, and followed by other symbol characters a symbol.
+
+(display (list .5 -0.5 '... '.foo '(1 . 2) '(a .b)))
+(newline)
+(display (list (+ .25 .75) (symbol? '...) (string-length (symbol->string '...))))
+(newline)
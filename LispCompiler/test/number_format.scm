@@ -0,0 +1,42 @@
+; number_format.scm - Writing and reading numbers
+;
+; Numbers print with the fewest digits that read back as the same
+; number, and string->number reads them back exactly.
+
+(define (show x)
+  (display x)
+  (newline))
+
+(show 0.1)
+(show (/ 1 3))
+(show (sqrt 2))
+(show 123456.789)
+(show 1e21)
+(show 1e20)
+(show 1.5e-7)
+(show 0.000001)
+(show -2.5e-300)
+(show 9007199254740993)
+(show (list 1e400 (- (expt 10 400)) (string->number "+nan.0")))
+(show (number->string 2.5))
+(show (list (* -1 0.0) -0.0 0.0 (string->number "-0.0") (/ -1 1e400)))
+
+; Reading
+(show (list (string->number "0.1") (string->number "12abc")
+            (string->number "1e") (string->number "-inf.0")
+            (string->number ".5") (string->number "100000000000000000000001")))
+
+; Every number reads back equal
+(define (round-trips? x)
+  (= x (string->number (number->string x))))
+
+(define (count-round-trips n)
+  (let loop ((i 1) (count 0))
+    (if (> i n)
+        count
+        (loop (+ i 1)
+              (+ count
+                 (if (round-trips? (/ i 7)) 1 0)
+                 (if (round-trips? (* i 1.1e-310)) 1 0)
+                 (if (round-trips? (sqrt i)) 1 0))))))
+(show (count-round-trips 1000))
@@ -0,0 +1,121 @@
+; numeric_test.scm - Numeric code and type specialization
+;
+; Tests:
+; - Functions whose parameters are always numbers
+; - Numeric loops (named let) and tail calls
+; - Calls through procedure objects and with non-numbers
+; - Floating point corner cases
+
+; Recursive numeric functions
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (tak x y z)
+  (if (not (< y x))
+      z
+      (tak (tak (- x 1) y z)
+           (tak (- y 1) z x)
+           (tak (- z 1) x y))))
+
+(display "fib(20) = ")
+(display (fib 20))
+(newline)
+
+(display "tak(18, 12, 6) = ")
+(display (tak 18 12 6))
+(newline)
+
+; Loops with numeric accumulators
+(define (sum-to n)
+  (let loop ((i 0) (acc 0))
+    (if (> i n)
+        acc
+        (loop (+ i 1) (+ acc i)))))
+
+(define (harmonic n)
+  (let loop ((i 1) (acc 0.0))
+    (if (> i n)
+        acc
+        (loop (+ i 1) (+ acc (/ 1 i))))))
+
+(display "sum-to(1000) = ")
+(display (sum-to 1000))
+(newline)
+
+(display "harmonic(10) = ")
+(display (harmonic 10))
+(newline)
+
+; Lengths are numbers whatever the argument
+(define (vector-sum v)
+  (let loop ((i 0) (acc 0))
+    (if (= i (vector-length v))
+        acc
+        (loop (+ i 1) (+ acc (vector-ref v i))))))
+
+(define (total-length s v)
+  (+ (string-length s) (vector-length v)))
+
+(display "vector-sum = ")
+(display (vector-sum (vector 1 2 3 4 5)))
+(newline)
+
+(display "total-length = ")
+(display (total-length "hello" (vector 1 2 3)))
+(newline)
+
+; Predicates and mutual recursion
+(define (small? x) (< (abs x) 10))
+
+(define (my-even? n) (if (= n 0) #t (my-odd? (- n 1))))
+(define (my-odd? n) (if (= n 0) #f (my-even? (- n 1))))
+
+(display "small? 5 = ")
+(display (small? 5))
+(newline)
+
+(display "small? -42 = ")
+(display (small? -42))
+(newline)
+
+(display "my-even? 1001 = ")
+(display (my-even? 1001))
+(newline)
+
+; Through procedure objects
+(display "map fib = ")
+(display (map fib '(1 2 3 4 5 6 7 8)))
+(newline)
+
+(display "filter small? = ")
+(display (filter small? '(3 15 -7 100 9)))
+(newline)
+
+; A parameter that is not always a number
+(define (describe x)
+  (if (number? x) (* x 2) x))
+
+(display "describe = ")
+(display (list (describe 21) (describe "text")))
+(newline)
+
+; Floating point corner cases
+(define (add2 a b) (+ a b))
+(define (negate a) (- a))
+(define (scale a) (* a 1.5))
+
+(display "add2 = ")
+(display (list (add2 0.1 0.2) (add2 -0.0 -0.0) (add2 1e300 1e300)))
+(newline)
+
+(display "negate/scale = ")
+(display (list (negate 0) (negate -2.5) (scale 3) (scale -0.5)))
+(newline)
+
+; Non-numbers reaching a numeric function report the same errors as
+; the interpreter; the results printed here are the fallbacks
+(display "fib of a string = ")
+(display (fib "x"))
+(newline)
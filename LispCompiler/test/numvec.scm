@@ -0,0 +1,59 @@
+; numvec.scm - SRFI-4 numeric vectors, the bulk operations on them (over
+; lengths that take the 32- and 16-byte paths and a scalar tail), and
+; numbers in bytevectors
+
+(define (ramp make set n)
+  (let ((v (make n)))
+    (do ((i 0 (+ i 1)))
+        ((= i n) v)
+      (set v i (- i 20)))))
+
+(define a (f64vector 1 2 3 4 5 6 7 8 9 10))
+(define b (make-f64vector 10 0.5))
+(display (list a (f64vector? a) (f32vector? a) (bytevector? (u8vector 1 2))
+               (f64vector-length a) (f64vector-ref a 3) (f64vector->list b)))
+(newline)
+
+(display (list (numvector-add a b) (numvector-scale a 2) (numvector-dot a a)
+               (numvector-sum a) (numvector-min a) (numvector-max a)))
+(newline)
+
+; Each kind over 45 elements, -20 to 24 (u8 from 0)
+(define vectors
+  (list (ramp make-s32vector s32vector-set! 45)
+        (ramp make-s64vector s64vector-set! 45)
+        (ramp make-f32vector f32vector-set! 45)
+        (ramp make-f64vector f64vector-set! 45)
+        (numvector-add (make-u8vector 45 3) (numvector-scale (make-u8vector 45 1) 2))))
+(display (map (lambda (v) (list (numvector-sum v) (numvector-dot v v)
+                                (numvector-min v) (numvector-max v)))
+              vectors))
+(newline)
+
+; Integers wrap around
+(define s (s32vector 2147483647 -2147483648 5))
+(numvector-add! s (s32vector 1 -1 -5))
+(display (list s (numvector-scale (u8vector 200 3) 2) (numvector-sum (u8vector 255 255))))
+(newline)
+
+(define f (f32vector 0.5 1.5 2.5))
+(numvector-scale! f 2)
+(display (list f (numvector-dot f f) (s64vector 1 -2 9007199254740992)
+               (list->s32vector '(1 2 3)) (s32vector->list (s32vector -1 0 1))))
+(newline)
+
+(define c (make-s64vector 6 0))
+(numvector-copy! c 1 (s64vector 1 2 3 4) 1 3)
+(numvector-fill! c 9 4)
+(display (list c (numvector-copy c 1 3) (equal? c (s64vector 0 2 3 0 9 9))
+               (equal? (f64vector 1) (f32vector 1))))
+(newline)
+
+(define bv (make-bytevector 16 0))
+(bytevector-ieee-double-set! bv 0 3.25 'little)
+(bytevector-s32-set! bv 8 -2 'big)
+(bytevector-ieee-single-set! bv 12 1.5 'big)
+(display (list bv (bytevector-ieee-double-ref bv 0 'little) (bytevector-s32-ref bv 8 'big)
+               (bytevector-s32-ref bv 8 'little) (bytevector-ieee-single-ref bv 12 'big)
+               (bytevector-s64-ref bv 8 'big)))
+(newline)
@@ -0,0 +1,91 @@
+; pcoll.scm - persistent maps, sets and vectors: versions that share
+; structure, transients, append and slice across many levels, and
+; collections as equal? keys
+
+(define m1 (pmap 'a 1 'b 2 "c" 3))
+(define m2 (pmap-set m1 'a 10))
+(define m3 (pmap-delete m2 "c"))
+(display (list (pmap-ref m1 'a) (pmap-ref m2 'a) (pmap-ref m3 "c" 'none)
+               (pmap-size m1) (pmap-size m3) (pmap-contains? m1 "c")
+               (pmap? m1) (pmap? (pset 1)) m1))
+(newline)
+
+(display (list (pmap->alist (pmap-set (pmap) '(1 2) 'list))
+               (equal? m3 (alist->pmap '((b . 2) (a . 10))))
+               (equal? m1 m2)
+               (length (pmap-keys m1)) (apply + (pmap-values m1))))
+(newline)
+
+(define s1 (list->pset '(1 2 3 2 1)))
+(define s2 (pset-add (pset-delete s1 2) "two"))
+(display (list (pset-size s1) (pset-contains? s1 2) (pset-contains? s2 2)
+               (pset-contains? s2 "two") (pset? s2) (equal? s1 (pset 3 2 1))))
+(newline)
+
+(define v1 (pvector 1 2 3))
+(define v2 (pvector-push v1 4))
+(define v3 (pvector-set v2 0 'x))
+(display (list (pvector-length v1) (pvector->list v2) (pvector->list v3)
+               (pvector-ref v2 0) (pvector? v3) v3))
+(newline)
+
+; Builds through a transient, and a thousand versions sharing one map
+(define (build-vector n)
+  (let ((t (transient (pvector))))
+    (do ((i 0 (+ i 1)))
+        ((= i n) (persistent! t))
+      (pvector-push! t i))))
+
+(define big (build-vector 5000))
+(define tm (transient (pmap)))
+(do ((i 0 (+ i 1)))
+    ((= i 3000))
+  (pmap-set! tm i (* i i)))
+(define bm (persistent! tm))
+(define versions
+  (do ((i 0 (+ i 1))
+       (acc '() (cons (pmap-set bm i 'changed) acc)))
+      ((= i 1000) acc)))
+(display (list (pvector-length big) (pvector-ref big 4321)
+               (pmap-size bm) (pmap-ref bm 2999) (pmap-ref bm 500)
+               (pmap-ref (car versions) 999) (pmap-ref (car versions) 500)
+               (transient? tm) (transient? (transient bm))))
+(newline)
+
+(define bt (transient big))
+(pvector-set! bt 0 'first)
+(define tm2 (transient bm))
+(pmap-delete! tm2 0)
+(display (list (pvector-ref big 0) (pvector-ref bt 0)
+               (pmap-size bm) (pmap-size tm2) bt))
+(newline)
+
+; Append and slice, checked element by element against lists
+(define (sum-vector v)
+  (let ((n (pvector-length v)))
+    (do ((i 0 (+ i 1))
+         (s 0 (+ s (pvector-ref v i))))
+        ((= i n) s))))
+
+(define joined
+  (do ((i 0 (+ i 1))
+       (v (pvector) (pvector-append v (pvector-slice big (* i 37) (+ (* i 37) 1000)))))
+      ((= i 40) v)))
+(define cut (pvector-slice joined 1234 38000))
+(display (list (pvector-length joined) (sum-vector joined)
+               (pvector-length cut) (sum-vector cut)
+               (pvector-ref cut 0) (pvector-ref cut 36765)
+               (equal? (pvector-slice big 100 200)
+                       (list->pvector (pvector->list (pvector-slice big 100 200))))
+               (pvector->list (pvector-append (pvector 1) (pvector) (pvector 2 3)))
+               (pvector->list (pvector-slice (pvector 1 2 3 4) 2))))
+(newline)
+
+; Collections as equal? keys
+(define h (make-hashtable))
+(hashtable-set! h (pvector 1 2) 'vector)
+(hashtable-set! h (pset 'a 'b) 'set)
+(display (list (hashtable-ref h (pvector-push (pvector 1) 2) #f)
+               (hashtable-ref h (pset-add (pset 'b) 'a) #f)
+               (pmap-ref (pmap (pvector 1) 'one) (pvector 1))))
+(newline)
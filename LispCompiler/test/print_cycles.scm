@@ -0,0 +1,42 @@
+; Printing shared and circular structure, and output string ports
+
+; A circular list prints with a datum label
+(define ring (list 1 2 3))
+(set-cdr! (cdr (cdr ring)) ring)
+(write ring)
+(newline)
+
+; So does a vector that holds itself
+(define v (vector 1 2 3))
+(vector-set! v 1 v)
+(write v)
+(newline)
+
+; A list whose car is itself
+(define self (list 'a 'b))
+(set-car! self self)
+(display self)
+(newline)
+
+; Sharing without a cycle prints in full
+(define shared (list 1 2))
+(write (list shared shared (vector shared)))
+(newline)
+
+; Deep nesting prints without exhausting the C stack
+(define deep '())
+(do ((i 0 (+ i 1))) ((= i 100000)) (set! deep (list deep)))
+(define out (open-output-string))
+(write deep out)
+(display (string-length (get-output-string out)))
+(newline)
+
+; write quotes strings and characters, display does not
+(define port (open-output-string))
+(write "say \"hi\"\n" port)
+(display " " port)
+(display "plain" port)
+(display " " port)
+(write #\a port)
+(display (get-output-string port))
+(newline)
@@ -0,0 +1,23 @@
+; profile_test.scm - Workload for the sampling profiler
+;
+; Most of the time is spent in fib, called through run-fib; the profile
+; should show run-fib;fib as the hottest stack.
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (run-fib n)
+  (fib n))
+
+(define (count-down n)
+  (if (> n 0)
+      (count-down (- n 1))
+      'done))
+
+(display "fib(22) = ")
+(display (run-fib 22))
+(newline)
+(display (count-down 2000))
+(newline)
@@ -0,0 +1,23 @@
+; quoted_data.scm - Quoted data and string literals
+;
+; Tests:
+; - Quoted lists are the same object every time they are evaluated
+; - Nested data, symbols, strings, characters and dotted pairs
+
+(define (colors) '(red green (blue . 3) "violet" #\x #t))
+
+(display "colors = ")
+(display (colors))
+(newline)
+
+(display "same object = ")
+(display (eq? (colors) (colors)))
+(newline)
+
+(display "lookup = ")
+(display (assq 'blue (cdr (cdr (colors)))))
+(newline)
+
+(display "greeting = ")
+(display (string-append "hello, " "world"))
+(newline)
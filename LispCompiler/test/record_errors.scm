@@ -0,0 +1,6 @@
+; record_errors.scm - an accessor rejects a record of its type's parent
+
+(define-record-type point (make-point x y) point? (x point-x) (y point-y))
+(define-record-type (point3 point) (make-point3 x y z) point3? (z point3-z))
+(point-x (make-point3 1 2 3))
+(point3-z (make-point 1 2))
@@ -0,0 +1,38 @@
+; records.scm - define-record-type: constructors, predicates, accessors
+; and modifiers, and types derived from types
+
+(define-record-type <point> (make-point x y) point? (x point-x set-point-x!) (y point-y))
+(define p (make-point 3 4))
+(set-point-x! p 30)
+(display (list (point-x p) (point-y p) (point? p) (point? 5) (point? (vector 3 4))
+               p <point> point-x))
+(newline)
+
+; Constructors may take the fields in any order, or leave some out
+(define-record-type node (make-node right left) node?
+  (left node-left) (right node-right) (mark node-mark set-node-mark!))
+(define n (make-node 'r 'l))
+(set-node-mark! n 'seen)
+(display (list (node-left n) (node-right n) (node-mark n) (point? n) (node? p)))
+(newline)
+
+; Derived types: accessors of a type take records of the types under it
+(define-record-type (<point3> <point>) (make-point3 x y z) point3? (z point3-z))
+(define-record-type (<point4> <point3>) make-point4 point4? (w point4-w set-point4-w!))
+(define q (make-point3 1 2 3))
+(define r (make-point4 5 6 7 8))
+(set-point-x! r 50)
+(set-point4-w! r 80)
+(display (list (point-x q) (point3-z q) (point-x r) (point-y r) (point3-z r) (point4-w r)
+               (point? r) (point3? r) (point4? q) (point3? p)
+               (map point-x (list p q r))))
+(newline)
+
+; Many records, summed through accessors
+(define total 0)
+(do ((i 0 (+ i 1)))
+    ((= i 20000))
+  (let ((s (if (even? i) (make-point i 1) (make-point4 i 1 2 3))))
+    (set! total (+ total (point-x s) (point-y s)))))
+(display total)
+(newline)
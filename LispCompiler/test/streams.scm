@@ -0,0 +1,48 @@
+; Promises and streams: memoized, iterative forcing, constant space
+
+; A promise is forced once
+(define count 0)
+(define p (delay (begin (set! count (+ count 1)) (* 6 7))))
+(display (list (force p) (force p) count (promise? p) (force (make-promise 5))))
+(newline)
+
+; A long delay-force chain forces in a loop, not on the C stack
+(define (countdown n)
+  (delay-force (if (= n 0) (delay 'done) (countdown (- n 1)))))
+(display (force (countdown 100000)))
+(newline)
+
+; ... and holds only the promise being forced, however long it is
+(display (list (force (countdown 300000))
+               (< (cdr (assq 'live-objects (gc-statistics))) 500000)))
+(newline)
+
+; A promise forced while it is being forced keeps the first value
+(define r (delay (begin (set! count (+ count 1))
+                        (if (> count 5) 'inner (begin (force r) 'outer)))))
+(display (force r))
+(newline)
+
+; stream-cons delays both its element and the rest
+(define (integers-from n) (stream-cons n (integers-from (+ n 1))))
+(display (stream->list 5 (integers-from 0)))
+(newline)
+(display (stream->list (stream-take 5 (stream-filter (lambda (x) (= 0 (modulo x 3)))
+                                                     (integers-from 1)))))
+(newline)
+(display (stream->list (stream-map + (stream-range 0 5) (stream-range 10 20))))
+(newline)
+(display (list (stream-ref (integers-from 0) 1000)
+               (stream->list (stream-drop 3 (list->stream '(a b c d e))))
+               (stream->list (stream-range 5 0))
+               (stream-null? stream-null)
+               (stream-pair? (integers-from 0))))
+(newline)
+(stream-for-each display (stream-range 0 5))
+(newline)
+
+; Consuming a stream as it is made keeps only the current element
+(display (stream-fold + 0 (stream-take 1000000 (stream-drop 5 (stream-range 0 1e18)))))
+(newline)
+(display (< (cdr (assq 'live-objects (gc-statistics))) 500000))
+(newline)
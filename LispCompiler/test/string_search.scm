@@ -0,0 +1,52 @@
+; string_search.scm - Searching, splitting, joining, case and comparison
+; of strings (long enough to take the 16- and 32-byte paths)
+
+(define (repeat s n)
+  (if (= n 0) "" (string-append s (repeat s (- n 1)))))
+
+(define line "2026-10-18 12:00:01 WARN  disk /dev/sda1 at 91% (threshold 90%)")
+(define long (string-append (repeat "abcdefgh" 20) "needle" (repeat "xyz" 10)))
+
+(display (list (string-search-forward "needle" long)
+               (string-search-forward "needle" long 161)
+               (string-search-forward "abc" long 1)
+               (string-search-backward "abc" long)
+               (string-search-all "90%" "90%90%90%")
+               (string-contains line "WARN")
+               (string-contains line "ERROR")
+               (string-search-forward "" "abc")))
+(newline)
+
+(display (list (string-index line #\%)
+               (string-index line "()")
+               (string-index long #\d 161)
+               (string-index line (lambda (c) (char=? c #\:)) 14)
+               (string-index "abc" #\z)))
+(newline)
+
+(write (string-split line #\space))
+(newline)
+(write (string-split "a,b;;c" ",;"))
+(newline)
+(write (list (string-join '("usr" "local" "bin") "/")
+             (string-join '("a" "b"))
+             (string-join '())))
+(newline)
+
+(define mixed (repeat "Hello, World! 123 ÄbC " 3))
+(write (list (string-upcase mixed)
+             (string-downcase "ABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{")
+             (string-foldcase "MiXeD")))
+(newline)
+
+(display (list (string-ci=? (string-upcase long) long)
+               (string-ci=? "abc" "abd")
+               (string-ci<? (string-append (repeat "A" 40) "b")
+                            (string-append (repeat "a" 40) "C"))
+               (string-ci<? "abc" "ABC")
+               (string=? "a\x0;b" "a\x0;c")
+               (string<? "a\x0;b" "a\x0;c")
+               (string-prefix? "2026-" line)
+               (string-suffix? "90%)" line)
+               (string-suffix? "longer than the string" "short")))
+(newline)
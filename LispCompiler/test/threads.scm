@@ -0,0 +1,56 @@
+; threads.scm - Threads and mutexes
+;
+; Several threads build and sum lists, enough to collect while they all
+; run, and add to a shared total under a mutex.
+
+(define total 0)
+(define total-lock (make-mutex 'total))
+
+(define (build n acc)
+  (if (= n 0)
+      acc
+      (build (- n 1) (cons (* n n) acc))))
+
+(define (sum lst)
+  (fold + 0 lst))
+
+(define (worker k)
+  (lambda ()
+    (let loop ((round 0) (last 0))
+      (if (< round 200)
+          (loop (+ round 1) (sum (build (+ 500 k) '())))
+          (begin
+            (mutex-lock! total-lock)
+            (set! total (+ total last))
+            (mutex-unlock! total-lock)
+            last)))))
+
+(define threads
+  (map (lambda (k) (thread-start! (make-thread (worker k) k)))
+       '(0 1 2 3)))
+
+(display "results = ")
+(display (map thread-join! threads))
+(newline)
+
+(display "total = ")
+(display total)
+(newline)
+
+(display "names = ")
+(display (map thread-name threads))
+(newline)
+
+(display "thread? = ")
+(display (list (thread? (car threads)) (thread? total-lock) (mutex? total-lock)))
+(newline)
+
+; An error in a thread is reported when it is joined
+(define failing (thread-start! (make-thread (lambda () (car '())))))
+(thread-join! failing)
+(newline)
+(display "done")
+(newline)
+
+; A thread still running at the end of the program is waited for
+(thread-start! (make-thread (lambda () (do ((i 0 (+ i 1))) ((= i 200000)) (list i)))))
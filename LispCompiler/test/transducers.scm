@@ -0,0 +1,48 @@
+; Transducers, and map, filter and fold without per-element garbage
+
+(define (iota-list n)
+  (do ((i n (- i 1)) (l '() (cons i l))) ((= i 0) l)))
+
+(define (square x) (* x x))
+
+(display (list-transduce (compose (tfilter odd?) (tmap square)) + '(1 2 3 4 5)))
+(newline)
+(display (list (list-transduce (tmap (lambda (x) (+ x 1))) rcons '(1 2 3))
+               (list-transduce (compose (tdrop 2) (ttake 3)) rcons '(1 2 3 4 5 6 7))
+               (list-transduce (ttake 0) rcons '(1 2))
+               (list-transduce (tmap -) + 100 '(1 2 3))
+               (vector-transduce (tfilter even?) rcount (vector 1 2 3 4))))
+(newline)
+
+; A transducer written as a procedure of a reducer, as SRFI-171 has them
+(define (tdouble reducer)
+  (case-lambda
+    (() (reducer))
+    ((acc) (reducer acc))
+    ((acc x) (reducer (reducer acc x) x))))
+(display (list-transduce tdouble rcons '(a b)))
+(newline)
+
+; The argument list is reused only where the procedure cannot keep it
+(display (list (map + '(1 2 3) '(10 20 30))
+               (map (lambda x x) '(1 2) '(3 4))
+               (map list '(1 2) '(3 4))
+               (map (lambda (x) (lambda () x)) '(1))
+               (fold cons '() '(1 2 3))
+               (fold-right cons '() '(1 2 3))
+               (filter odd? '(1 2 3 4 5))))
+(newline)
+
+; Pairs allocated by a pipeline over 100000 elements: the result of
+; filter and of map for the list functions, none for the transducer
+(define xs (iota-list 100000))
+(define (pairs)
+  (car (cdr (assq 'pair (cdr (assq 'allocations (gc-statistics)))))))
+(define before (pairs))
+(define sum (fold + 0 (map square (filter odd? xs))))
+(display (< (- (pairs) before) 100500))
+(newline)
+(define before (pairs))
+(define sum2 (list-transduce (compose (tfilter odd?) (tmap square)) + xs))
+(display (list (= sum sum2) (< (- (pairs) before) 500)))
+(newline)
@@ -0,0 +1,41 @@
+; unicode.scm - Strings of UTF-8 indexed by character, code-point
+; characters, and conversion to and from bytevectors
+
+(define (repeat s n)
+  (if (= n 0) "" (string-append s (repeat s (- n 1)))))
+
+(define s "héllo λ wörld")
+(display (list (string-length s) (string-ref s 1) (string-ref s 6)
+               (substring s 6 13) (string-copy s 9)))
+(newline)
+
+(write (list #\λ #\x3bb #\x41 (integer->char 8364) (char->integer #\€)
+             #\space #\alarm #\null #\delete #\x1 #\())
+(newline)
+
+; Sequential and scattered access over a long string, past the index
+; stride many times
+(define long (string-append (repeat "αβγδ" 100) "end"))
+(define (count-char str c)
+  (do ((i 0 (+ i 1))
+       (n 0 (if (char=? (string-ref str i) c) (+ n 1) n)))
+      ((= i (string-length str)) n)))
+(display (list (string-length long) (count-char long #\γ)
+               (string-ref long 399) (string-ref long 401) (substring long 398 403)))
+(newline)
+
+(display (list (string-index s #\λ) (string-index s "öλ")
+               (string-index s (lambda (c) (char=? c #\w)))
+               (string-search-forward "wö" s) (string-search-backward "l" s)
+               (string-search-all "" "λé")))
+(newline)
+(write (list (string-split "a→b→c" #\→) (string-split "aλb,c" "λ,")))
+(newline)
+
+(define bytes (string->utf8 "aλ€"))
+(write (list bytes (string->utf8 "aλ€" 1 2) (utf8->string bytes)
+             (utf8->string bytes 1 3) (string=? (utf8->string bytes) "aλ€")))
+(newline)
+
+(write "tab\there\x0;\r\x1b;\x3bb;")
+(newline)
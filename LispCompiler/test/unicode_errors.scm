@@ -0,0 +1,5 @@
+; unicode_errors.scm - integer->char rejects a code point past Unicode,
+; naming it in full, and returns nil
+
+(display (null? (integer->char 1114112)))
+(newline)
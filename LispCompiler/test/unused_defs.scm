@@ -0,0 +1,39 @@
+; unused_defs.scm - Programs with definitions nothing refers to
+;
+; Tests:
+; - Unused procedures and constants are left out
+; - Definitions reached only through other definitions are kept
+; - Names mentioned only in quoted data or set! are kept
+
+(define (square x) (* x x))
+(define (sum-of-squares a b) (+ (square a) (square b)))
+
+; Never called, and only mention each other
+(define (ping n) (if (= n 0) 'done (pong (- n 1))))
+(define (pong n) (if (= n 0) 'done (ping (- n 1))))
+
+(define unused-constant 42)
+(define unused-text "never printed")
+(define unused-proc (lambda (x) (string-append x "!")))
+
+; Reached only through a quoted list and an assignment
+(define quoted-only 1)
+(define assigned 10)
+(set! assigned (+ assigned 5))
+
+(define greeting "hello")
+
+(display "sum-of-squares 3 4 = ")
+(display (sum-of-squares 3 4))
+(newline)
+
+(display "names = ")
+(display '(quoted-only other))
+(newline)
+
+(display "assigned = ")
+(display assigned)
+(newline)
+
+(display greeting)
+(newline)